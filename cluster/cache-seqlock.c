@@ -0,0 +1,497 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2013 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file cluster/cache-seqlock.c
+//! Implements the sequence locks of the CC caches. A sequence number is even
+//! while its data is stable and odd while a writer is updating it. A reader
+//! samples an even number, reads, and accepts what it read only if the number
+//! did not move meanwhile.
+//!
+//! Writers must hold the semaphore of the cache they update. That is also
+//! what lets them recover from a writer that died mid-update: whoever gets
+//! the semaphore next and finds an odd number knows no update is running.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include <eucalyptus.h>
+
+#include "cache-seqlock.h"
+
+#ifdef _UNIT_TEST
+#include <unistd.h>
+#include <time.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif /* _UNIT_TEST */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define SEQLOCK_YIELD_SPINS                      64 //!< busy spins on an odd sequence number before yielding the CPU to the writer
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Marks the start of an update: readers that overlap it will retry.
+//!
+//! @param[in] seq the sequence number guarding the data
+//!
+//! @note the caller must hold the semaphore of the cache
+//!
+void seqlock_write_begin(volatile unsigned int *seq)
+{
+    seqlock_repair(seq);
+    (*seq)++;                          // odd: write in progress
+    __sync_synchronize();
+}
+
+//!
+//! Marks the end of an update started with seqlock_write_begin()
+//!
+//! @param[in] seq the sequence number guarding the data
+//!
+//! @note the caller must hold the semaphore of the cache
+//!
+void seqlock_write_end(volatile unsigned int *seq)
+{
+    __sync_synchronize();
+    (*seq)++;                          // even: data is stable again
+}
+
+//!
+//! Waits for the data to be stable and samples its sequence number. Gives up
+//! after SEQLOCK_READ_SPINS attempts, which only happens when a writer is
+//! descheduled (or dead) in the middle of an update.
+//!
+//! @param[in]  seq the sequence number guarding the data
+//! @param[out] start where to store the sampled number, for seqlock_read_retry()
+//!
+//! @return EUCA_OK if the data may be read or EUCA_TIMEOUT_ERROR if the caller
+//!         should take the semaphore instead
+//!
+int seqlock_read_begin(volatile unsigned int *seq, unsigned int *start)
+{
+    int i = 0;
+
+    for (i = 0; i < SEQLOCK_READ_SPINS; i++) {
+        if (!((*start = *seq) & 1)) {
+            __sync_synchronize();
+            return (EUCA_OK);
+        }
+        if ((i % SEQLOCK_YIELD_SPINS) == (SEQLOCK_YIELD_SPINS - 1))
+            sched_yield();
+    }
+    return (EUCA_TIMEOUT_ERROR);
+}
+
+//!
+//! Tells whether what was read since seqlock_read_begin() must be discarded
+//!
+//! @param[in] seq the sequence number guarding the data
+//! @param[in] start the number seqlock_read_begin() sampled
+//!
+//! @return TRUE if an update overlapped the read, FALSE if the read is consistent
+//!
+int seqlock_read_retry(volatile unsigned int *seq, unsigned int start)
+{
+    __sync_synchronize();
+    return (*seq != start);
+}
+
+//!
+//! Makes an odd sequence number even again. With the semaphore held no update
+//! can be running, so an odd number was left behind by a process that died in
+//! the middle of one.
+//!
+//! @param[in] seq the sequence number guarding the data
+//!
+//! @note the caller must hold the semaphore of the cache
+//!
+void seqlock_repair(volatile unsigned int *seq)
+{
+    if (*seq & 1) {
+        (*seq)++;
+    }
+}
+
+#ifdef _UNIT_TEST
+#define TEST_SLOTS                               2048   //!< slots in the test cache, about what CC_MAX_INSTANCES is in practice
+#define TEST_WORDS                               256    //!< words per slot, a 1K payload standing in for a ccInstance
+#define TEST_MAX_READERS                         256    //!< upper bound on reader processes
+
+//! Who the readers synchronize with
+typedef enum test_mode_t {
+    TEST_SEMAPHORE = 0,                //!< readers take the semaphore for a full scan, as DescribeInstances used to
+    TEST_SEQLOCK,                      //!< readers validate each slot against its sequence number
+} test_mode;
+
+//! One slot of the test cache; every word of a consistent slot holds the same value
+typedef struct test_slot_t {
+    volatile unsigned int seq;
+    unsigned int words[TEST_WORDS];
+} test_slot;
+
+//! Everything the test processes share
+typedef struct test_shm_t {
+    sem_t lock;                        //!< stands in for the INSTCACHE semaphore
+    volatile int stop;                 //!< tells the workers to exit
+    long long scans;                   //!< full scans completed by the readers
+    long long fallbacks;               //!< slot reads that had to take the semaphore
+    long long torn;                    //!< inconsistent slots seen by the readers, must stay 0
+    long long writes;                  //!< slot updates completed by the writer
+    long long writeWaitTotal;          //!< nanoseconds the writer spent waiting for the semaphore
+    long long writeWaitMax;            //!< longest single wait of the writer
+    test_slot slots[TEST_SLOTS];
+} test_shm;
+
+static const char *test_mode_names[] = { "semaphore", "seqlock" };
+
+//!
+//! Returns the monotonic clock in nanoseconds
+//!
+static long long test_nsec(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec);
+}
+
+//!
+//! Copies a slot the way a lock-free reader of the instance cache does
+//!
+static void test_copy_slot(test_shm * shm, int i, unsigned int *dst)
+{
+    int tries = 0;
+    unsigned int start = 0;
+    test_slot *slot = &(shm->slots[i]);
+
+    for (tries = 0; tries < SEQLOCK_READ_SPINS; tries++) {
+        if (seqlock_read_begin(&(slot->seq), &start) != EUCA_OK)
+            break;
+        memcpy(dst, slot->words, sizeof(slot->words));
+        if (!seqlock_read_retry(&(slot->seq), start))
+            return;
+    }
+
+    __sync_add_and_fetch(&(shm->fallbacks), 1);
+    sem_wait(&(shm->lock));
+    memcpy(dst, slot->words, sizeof(slot->words));
+    sem_post(&(shm->lock));
+}
+
+//!
+//! Reader process: scans the whole cache over and over, checking every slot
+//!
+static void test_reader(test_shm * shm, test_mode mode)
+{
+    int i = 0;
+    int w = 0;
+    long long scans = 0;
+    long long torn = 0;
+    unsigned int copy[TEST_WORDS] = { 0 };
+
+    while (!shm->stop) {
+        if (mode == TEST_SEMAPHORE)
+            sem_wait(&(shm->lock));
+        for (i = 0; i < TEST_SLOTS; i++) {
+            if (mode == TEST_SEMAPHORE)
+                memcpy(copy, shm->slots[i].words, sizeof(copy));
+            else
+                test_copy_slot(shm, i, copy);
+            for (w = 1; (w < TEST_WORDS) && (copy[w] == copy[0]); w++) ;
+            if (w < TEST_WORDS)
+                torn++;
+        }
+        if (mode == TEST_SEMAPHORE)
+            sem_post(&(shm->lock));
+        scans++;
+    }
+
+    __sync_add_and_fetch(&(shm->scans), scans);
+    __sync_add_and_fetch(&(shm->torn), torn);
+    _exit(0);
+}
+
+//!
+//! Writer process: updates slots one at a time, like the monitor thread
+//! refreshing instances, and times how long it waits for the semaphore
+//!
+static void test_writer(test_shm * shm)
+{
+    int w = 0;
+    unsigned int i = 0;
+    unsigned int value = 0;
+    long long t0 = 0;
+    long long wait = 0;
+    test_slot *slot = NULL;
+
+    while (!shm->stop) {
+        i = (i * 1103515245U + 12345U);
+        slot = &(shm->slots[(i >> 8) % TEST_SLOTS]);
+
+        t0 = test_nsec();
+        sem_wait(&(shm->lock));
+        wait = test_nsec() - t0;
+
+        seqlock_write_begin(&(slot->seq));
+        value++;
+        for (w = 0; w < TEST_WORDS; w++)
+            slot->words[w] = value;
+        seqlock_write_end(&(slot->seq));
+        sem_post(&(shm->lock));
+
+        shm->writes++;
+        shm->writeWaitTotal += wait;
+        if (wait > shm->writeWaitMax)
+            shm->writeWaitMax = wait;
+    }
+    _exit(0);
+}
+
+//!
+//! Runs one writer against 'readers' reader processes for 'seconds'
+//!
+//! @return the shared state with the results, to be unmapped by the caller
+//!
+static test_shm *test_run(test_mode mode, int readers, int seconds)
+{
+    int i = 0;
+    pid_t pid = 0;
+    test_shm *shm = NULL;
+
+    if ((shm = mmap(NULL, sizeof(test_shm), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    sem_init(&(shm->lock), 1, 1);
+
+    for (i = 0; i <= readers; i++) {
+        if ((pid = fork()) < 0) {
+            perror("fork");
+            exit(1);
+        } else if (pid == 0) {
+            if (i == 0)
+                test_writer(shm);
+            test_reader(shm, mode);
+        }
+    }
+
+    sleep(seconds);
+    shm->stop = 1;
+    while (wait(NULL) > 0) ;
+    sem_destroy(&(shm->lock));
+    return (shm);
+}
+
+//!
+//! Unit test for the sequence number protocol, then a run of concurrent
+//! readers and a writer that must not produce a single torn read. With
+//! 'bench-contention [readers] [seconds]', compares the throughput of the
+//! readers and the semaphore waits of the writer when readers take the
+//! semaphore vs. when they use the sequence numbers.
+//!
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int m = 0;
+    int errors = 0;
+    int seconds = 2;
+    int readers[] = { 1, 8, 32, 128 };
+    int readersLen = sizeof(readers) / sizeof(readers[0]);
+    unsigned int start = 0;
+    volatile unsigned int seq = 0;
+    test_shm *shm = NULL;
+
+    if ((argc > 1) && !strcmp(argv[1], "bench-contention")) {
+        if (argc > 2) {
+            readers[0] = atoi(argv[2]);
+            readersLen = 1;
+            if ((readers[0] < 1) || (readers[0] > TEST_MAX_READERS)) {
+                printf("readers must be between 1 and %d\n", TEST_MAX_READERS);
+                return (1);
+            }
+        }
+        if (argc > 3)
+            seconds = atoi(argv[3]);
+
+        printf("%d slots of %d bytes, one writer, %d second(s) per run\n", TEST_SLOTS, (int)sizeof(test_slot), seconds);
+        printf("%8s %10s %12s %12s %16s %16s %10s %6s\n", "readers", "mode", "scans/s", "writes/s", "write wait (us)", "max wait (us)", "fallbacks", "torn");
+        for (i = 0; i < readersLen; i++) {
+            for (m = TEST_SEMAPHORE; m <= TEST_SEQLOCK; m++) {
+                shm = test_run(m, readers[i], seconds);
+                printf("%8d %10s %12.1f %12.1f %16.2f %16.2f %10lld %6lld\n", readers[i], test_mode_names[m], (double)shm->scans / seconds,
+                       (double)shm->writes / seconds, (shm->writes ? (shm->writeWaitTotal / 1000.0) / shm->writes : 0.0), shm->writeWaitMax / 1000.0,
+                       shm->fallbacks, shm->torn);
+                errors += (shm->torn != 0);
+                munmap(shm, sizeof(test_shm));
+            }
+        }
+        return (errors ? 1 : 0);
+    }
+
+    seqlock_write_begin(&seq);
+    if (!(seq & 1) || (seqlock_read_begin(&seq, &start) != EUCA_TIMEOUT_ERROR)) {
+        printf("FAIL: read allowed during a write\n");
+        errors++;
+    }
+    seqlock_write_end(&seq);
+    if ((seqlock_read_begin(&seq, &start) != EUCA_OK) || seqlock_read_retry(&seq, start)) {
+        printf("FAIL: stable data not readable\n");
+        errors++;
+    }
+    seqlock_write_begin(&seq);
+    seqlock_write_end(&seq);
+    if (!seqlock_read_retry(&seq, start)) {
+        printf("FAIL: overlapping write not detected\n");
+        errors++;
+    }
+    // a writer died mid-update: the next one must leave the number even
+    seqlock_write_begin(&seq);
+    seqlock_write_begin(&seq);
+    seqlock_write_end(&seq);
+    if (seq & 1) {
+        printf("FAIL: sequence number left odd after a dead writer\n");
+        errors++;
+    }
+
+    shm = test_run(TEST_SEQLOCK, 4, 1);
+    if (shm->torn || !shm->scans || !shm->writes) {
+        printf("FAIL: %lld torn reads in %lld scans, %lld writes\n", shm->torn, shm->scans, shm->writes);
+        errors++;
+    }
+    munmap(shm, sizeof(test_shm));
+
+    printf("correctness: %s\n", errors ? "FAILED" : "ok");
+    return (errors ? 1 : 0);
+}
+#endif /* _UNIT_TEST */
@@ -77,6 +77,8 @@ configEntry configKeysRestartCC[] = {
     ,
     {"NC_FANOUT", "1"}
     ,
+    {"NC_CLIENT_POOL", "Y"}
+    ,
     {"NC_PORT", "8775"}
     ,
     {"NC_SERVICE", "axis2/services/EucalyptusNC"}
@@ -131,6 +133,12 @@ configEntry configKeysRestartCC[] = {
     ,
     {"MAX_INSTANCES_PER_CC", NULL}
     ,
+    {"NC_PEER_PORT", "0"}
+    ,
+    {"CC_PREFETCH_NODES", "0"}
+    ,
+    {"CC_PUSH_PORT", "0"}
+    ,
     {NULL, NULL}
     ,
 };
@@ -318,12 +318,9 @@ int doDescribeServices(ncMetadata * pMeta, serviceInfoType * serviceIds, int ser
     }
 
     if (do_report_nodes) {
-        extern ccResourceCache *resourceCache;
         ccResourceCache resourceCacheLocal;
 
-        sem_mywait(RESCACHE);
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-        sem_mypost(RESCACHE);
+        copy_resourceCache(&resourceCacheLocal);
 
         if (resourceCacheLocal.numResources > 0 && my_partition != NULL) {  // parition is unknown at early stages of CC initialization
             for (int idIdx = 0; idIdx < serviceIdsLen; idIdx++) {
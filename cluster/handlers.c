@@ -77,13 +77,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
 #include <semaphore.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
@@ -115,6 +118,9 @@
 #include "client-marshal.h"
 #include "config-cc.h"
 #include "handlers-state.h"
+#include "nc-client-pool.h"
+#include "instance-index.h"
+#include "cache-seqlock.h"
 
 #include <stats.h>
 #include <message_stats.h>
@@ -149,6 +155,65 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Arguments of a per-node refresh task (see refresh_fanout())
+typedef struct ncRefreshArgs_t {
+    ncMetadata *pMeta;                 //!< metadata for the NC calls, must outlive the task
+    int idx;                           //!< index of the node in resourceCacheStage->resources[]
+    int timeout;                       //!< overall timeout for the refresh, in seconds
+    time_t op_start;                   //!< when the refresh started
+    int history_size;                  //!< sensor history size (refresh_sensors only)
+    long long collection_interval_time_ms;  //!< sensor collection interval (refresh_sensors only)
+    const char *pick;                  //!< nodes to refresh, flagged by index in resourceCacheStage->resources[], NULL for all
+    ccResource res;                    //!< private copy of the node's entry, which the task updates and publishes (see refresh_publish())
+} ncRefreshArgs;
+
+//! A RunInstances request on its way to the nodes. It is shared by doRunInstances() and its
+//! per-node tasks (see run_instances_node()) and freed by whichever of them lets go last.
+typedef struct ccRunRequest_t {
+    int refs;                          //!< references held, updated atomically
+    ncMetadata meta;                   //!< metadata for the NC calls, with copies of its strings
+    char *reservationId;               //!< reservation identifier
+    char *amiId;                       //!< EMI identifier
+    char *amiURL;                      //!< EMI URL
+    char *kernelId;                    //!< EKI identifier
+    char *kernelURL;                   //!< EKI URL
+    char *ramdiskId;                   //!< ERI identifier
+    char *ramdiskURL;                  //!< ERI URL
+    char *ownerId;                     //!< owner identifier
+    char *accountId;                   //!< account identifier
+    char *keyName;                     //!< key name
+    char *userData;                    //!< user data
+    char *credential;                  //!< credential
+    char *launchIndex;                 //!< launch index
+    char *platform;                    //!< platform name
+    char *rootDirective;               //!< root directive
+    int expiryTime;                    //!< reservation expiration time
+    char **netNames;                   //!< security group names
+    int netNamesLen;                   //!< number of entries in netNames
+    char **netIds;                     //!< security group identifiers
+    int netIdsLen;                     //!< number of entries in netIds
+    netConfig *secNetCfgs;             //!< secondary network interfaces
+    int secNetCfgsLen;                 //!< number of entries in secNetCfgs
+    int ncRunTimeout;                  //!< how long to keep retrying a single instance, in seconds
+    int instancesLen;                  //!< number of instances in the request
+    char (*instIds)[16];               //!< identifier of each instance
+    char (*uuids)[48];                 //!< UUID of each instance
+    netConfig *ncnets;                 //!< primary network interface of each instance
+    int *launched;                     //!< resource index of the node each instance was started on, -1 until then
+} ccRunRequest;
+
+//! One node's share of a RunInstances request, sent with a single ncRunInstances call
+typedef struct ccRunBatch_t {
+    ccRunRequest *req;                 //!< request the batch belongs to (the batch holds a reference)
+    int resid;                         //!< index of the node in resourceCache->resources[]
+    int lockidx;                       //!< NC lock index of the node
+    char ncURL[384];                   //!< URL of the node
+    virtualMachine ncvm;               //!< VM parameters, with the image peer hints for this node
+    boolean *started;                  //!< which instances of the batch the node started (see run_publish_entry())
+    int slotsLen;                      //!< number of instances in the batch
+    int slots[];                       //!< indices of the instances in the request's arrays
+} ccRunBatch;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -179,10 +244,12 @@ int stats_initd = 0;
 ccConfig *config = NULL;
 ccInstanceCache *instanceCache = NULL; // canonical source for latest information about instances
 ccInstanceCacheMetadata *instanceCacheMetadata = NULL; // metadata for the cache
+instanceIndex *instanceCacheIndex = NULL;  // hash indexes over instanceCache[], stored right after it in the same segment
 euca_network *gpEucaNet = NULL;
 globalNetworkInfo *globalnetworkinfo = NULL;
 ccResourceCache *resourceCache = NULL; // canonical source for latest information about resources
 ccResourceCache *resourceCacheStage = NULL; // clone of resourceCache used for aggregating replies from NCs (via child procs)
+ccImageTrendCache *imageTrendCache = NULL; // launch rates of recently launched images, for prefetching them into NC caches
 sensorResourceCache *ccSensorResourceCache = NULL;  // canonical source for latest sensor data, both local and from NCs
 char *message_stats_shared_mem = NULL; //Reference to the shared memory region
 char message_stats_cache[MESSAGE_STATS_MEMORY_REGION_SIZE]; //The proc local holder for cached copies of message_stats_shared_mem to avoid realloc for each cache copy.
@@ -193,7 +260,7 @@ json_object *stats_cache_json = NULL;  //! Pointer to parsed stats from the cach
 //! @{
 //! @name shared (between CC processes) semaphores
 sem_t *locks[ENDLOCK];
-int mylocks[ENDLOCK];
+__thread int mylocks[ENDLOCK];          //!< semaphores held by this thread, which unlock_exit() posts (NC client pool workers hold their own)
 //! @}
 
 #ifndef NO_COMP
@@ -206,6 +273,7 @@ char *SCHEDPOLICIES[SCHEDLAST] = {
     "ROUNDROBIN",
     "POWERSAVE",
     "USER",
+    "CACHEAFFINITY",
 };
 
 /*----------------------------------------------------------------------------*\
@@ -221,12 +289,55 @@ char *SCHEDPOLICIES[SCHEDLAST] = {
 \*----------------------------------------------------------------------------*/
 
 static void reconfigure_resourceCache(ccResource * res, int numHosts);
-static void refresh_resourceCache(ccResourceCache * updatedResourceCache, boolean do_purge_unconfigured);
+static void refresh_resourceCache(ccResourceCache * updatedResourceCache, boolean do_purge_unconfigured, boolean do_settle_reservations, const char *pick);
+static void stage_resourceCache(void);
+static long long process_started(pid_t pid);
+static ccPlacement *placement_enter(virtualMachine * vm);
+static void placement_drop(ccPlacement * pl);
+static void placement_exit(ccPlacement * pl);
+static boolean placement_busy(void);
+static void reap_placements(void);
+static boolean resource_take(volatile int *reserved, volatile int *avail, volatile int *committed, int need);
+static boolean resource_reserve(ccPlacement * pl, int resid);
+static void resource_commit(ccPlacement * pl, int resid);
+static void resource_release(ccPlacement * pl, int resid);
 
 static int schedule_instance_migration(ncInstance * instance, char **includeNodes, char **excludeNodes, int includeNodeCount, int excludeNodeCount, int inresid, int *outresid,
                                        ccResourceCache * resourceCacheLocal, char **replyString);
 static int migration_handler(ccInstance * myInstance, char *host, char *src, char *dst, migration_states migration_state, char **node, char **instance, char **action);
 static int populateOutboundMeta(ncMetadata * pMeta);
+static void image_trend_decay(ccImageTrend * trend, time_t now);
+static int cache_affinity_score(ccResource * res, virtualMachine * vm);
+static void cache_affinity_note(ccResource * res, virtualMachine * vm);
+static int ncClientCallForked(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char *ncOp, va_list al);
+static int ncClientCallPooled(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char *ncOp, va_list al);
+static void refresh_publish_entry(void *arg);
+static void refresh_publish(ncRefreshArgs * args);
+static int refresh_fanout(ncPoolTask task, ncRefreshArgs * proto);
+static int refresh_pushed(ncMetadata * pMeta, int timeout, const char *pick);
+static int push_open(int port);
+static int push_lookup(const char *msg, struct sockaddr_in *from);
+static void monitor_wait(ncMetadata * pMeta, int seconds);
+static void run_request_put(ccRunRequest * req);
+static void run_publish_entry(void *arg);
+static int run_instances_node(void *arg);
+static int refresh_resources_node(void *arg);
+static int refresh_instances_node(void *arg);
+static int refresh_sensors_node(void *arg);
+static int instanceCache_match_id(int entry, const char *key, void *ctx);
+static int instanceCache_match_ip(int entry, const char *key, void *ctx);
+static boolean instanceCache_ip_indexed(const char *ip);
+static void index_instanceCacheSlot(int i);
+static void unindex_instanceCacheSlot(int i);
+static void rebuild_instanceCacheIndex(void);
+static void begin_instanceCacheSlotUpdate(int i);
+static void end_instanceCacheSlotUpdate(int i);
+static void open_instanceCacheView(int i, ccInstanceView * view);
+static int peek_instanceCacheView(int i, ccInstanceView * view);
+static int copy_instanceCacheSlot(int i, ccInstance * dst, unsigned int *seq);
+static void mark_instanceCacheDescribed(int i, unsigned int seq);
+static int lookup_instanceCacheId(char *instanceId, boolean validOnly);
+static int lookup_instanceCacheIP(char *ip);
 static int initialize_stats_system(int interval_sec);
 static json_object **message_stats_getter();
 static void message_stats_setter();
@@ -411,9 +522,7 @@ int doBundleInstance(ncMetadata * pMeta, char *instanceId, char *bucketName, cha
         strncpy(theObjectStorageURL, objectStorageURL, strlen(objectStorageURL) + 1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
@@ -484,11 +593,7 @@ int doBundleRestartInstance(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    {
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    }
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
         // found the instance in the cache
@@ -554,9 +659,7 @@ int doCancelBundleTask(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
@@ -622,22 +725,21 @@ void filter_services(ncMetadata * meta, char *filter_partition)
 }
 
 //!
-//!
+//! Legacy NC invocation path: forks a child that builds a one-shot stub, makes
+//! the call and marshals the results back to the parent through a pipe. It is
+//! used when the in-process engine is disabled and for fire-and-forget calls
+//! (timeout == 0), whose arguments may not outlive the caller.
 //!
 //! @param[in] pMeta a pointer to the node controller (NC) metadata structure
 //! @param[in] timeout
 //! @param[in] ncLock
 //! @param[in] ncURL
 //! @param[in] ncOp
-//! @param[in] ...
-//!
-//! @return
-//!
-//! @pre
+//! @param[in] al the operation-specific arguments
 //!
-//! @note
+//! @return 0 on success or 1 on failure
 //!
-int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char *ncOp, ...)
+static int ncClientCallForked(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char *ncOp, va_list al)
 {
 #define WRITE_REPLY_STRING                                                                \
 {                                                                                         \
@@ -687,7 +789,6 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
     int len = 0;
     int rbytes = 0;
     int filedes[2] = { 0 };
-    va_list al = { {0} };
 
     LOGTRACE("invoked: ncOps=%s ncURL=%s timeout=%d\n", ncOp, ncURL, timeout);  // these are common
 
@@ -696,8 +797,6 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
         return (1);
     }
 
-    va_start(al, ncOp);
-
     // grab the lock
     sem_mywait(ncLock);
 
@@ -894,6 +993,63 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
 
             if (outInst)
                 EUCA_FREE(*outInst);
+        } else if (!strcmp(ncOp, "ncRunInstances")) {
+            char **uuids = va_arg(al, char **);
+            char **instIds = va_arg(al, char **);
+            netConfig *ncnets = va_arg(al, netConfig *);
+            int instIdsLen = va_arg(al, int);
+            char *reservationId = va_arg(al, char *);
+            virtualMachine *ncvm = va_arg(al, virtualMachine *);
+            char *imageId = va_arg(al, char *);
+            char *imageURL = va_arg(al, char *);
+            char *kernelId = va_arg(al, char *);
+            char *kernelURL = va_arg(al, char *);
+            char *ramdiskId = va_arg(al, char *);
+            char *ramdiskURL = va_arg(al, char *);
+            char *ownerId = va_arg(al, char *);
+            char *accountId = va_arg(al, char *);
+            char *keyName = va_arg(al, char *);
+            char *userData = va_arg(al, char *);
+            char *credential = va_arg(al, char *);
+            char *launchIndex = va_arg(al, char *);
+            char *platform = va_arg(al, char *);
+            int expiryTime = va_arg(al, int);
+            char **netNames = va_arg(al, char **);
+            int netNamesLen = va_arg(al, int);
+            char *rootDirective = va_arg(al, char *);
+            char **netIds = va_arg(al, char **);
+            int netIdsLen = va_arg(al, int);
+            netConfig *secNetCfgs = va_arg(al, netConfig *);
+            int secNetCfgsLen = va_arg(al, int);
+            ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
+            int *ncOutInstsLen = va_arg(al, int *);
+
+            rc = ncRunInstancesStub(ncs, localmeta, uuids, instIds, ncnets, instIdsLen, reservationId, ncvm, imageId, imageURL, kernelId, kernelURL, ramdiskId,
+                                    ramdiskURL, ownerId, accountId, keyName, userData, credential, launchIndex, platform, expiryTime, netNames, netNamesLen,
+                                    rootDirective, netIds, netIdsLen, secNetCfgs, secNetCfgsLen, ncOutInsts, ncOutInstsLen);
+            if (timeout && ncOutInsts && ncOutInstsLen) {
+                if (!rc) {
+                    len = *ncOutInstsLen;
+                    rc = write(filedes[1], &len, sizeof(int));
+                    for (i = 0; i < len; i++) {
+                        rc = write(filedes[1], (*ncOutInsts)[i], sizeof(ncInstance));
+                    }
+                    rc = 0;
+                } else {
+                    len = 0;
+                    rc = write(filedes[1], &len, sizeof(int));
+                    rc = 1;
+                }
+            }
+
+            if (ncOutInsts) {
+                if (ncOutInstsLen) {
+                    for (i = 0; i < (*ncOutInstsLen); i++) {
+                        EUCA_FREE((*ncOutInsts)[i]);
+                    }
+                }
+                EUCA_FREE(*ncOutInsts);
+            }
         } else if (!strcmp(ncOp, "ncDescribeInstances")) {
             char **instIds = va_arg(al, char **);
             int instIdsLen = va_arg(al, int);
@@ -926,6 +1082,58 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                 }
                 EUCA_FREE(*ncOutInsts);
             }
+        } else if (!strcmp(ncOp, "ncDescribeInstancesSince")) {
+            long long sinceGeneration = va_arg(al, long long);
+            ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
+            int *ncOutInstsLen = va_arg(al, int *);
+            long long *outGeneration = va_arg(al, long long *);
+            boolean *outDelta = va_arg(al, boolean *);
+            char ***outLiveIds = va_arg(al, char ***);
+            int *outLiveIdsLen = va_arg(al, int *);
+            int delta = 0;
+
+            rc = ncDescribeInstancesSinceStub(ncs, localmeta, sinceGeneration, ncOutInsts, ncOutInstsLen, outGeneration, outDelta, outLiveIds, outLiveIdsLen);
+            if (timeout && ncOutInsts && ncOutInstsLen) {
+                // instances first, same as ncDescribeInstances, then the generation and the live instance IDs
+                if (!rc) {
+                    len = *ncOutInstsLen;
+                    rc = write(filedes[1], &len, sizeof(int));
+                    for (i = 0; i < len; i++) {
+                        rc = write(filedes[1], (*ncOutInsts)[i], sizeof(ncInstance));
+                    }
+                    delta = *outDelta;
+                    rc = write(filedes[1], outGeneration, sizeof(long long));
+                    rc = write(filedes[1], &delta, sizeof(int));
+                    rc = write(filedes[1], outLiveIdsLen, sizeof(int));
+                    for (i = 0; i < *outLiveIdsLen; i++) {
+                        len = strlen((*outLiveIds)[i]) + 1;
+                        rc = write(filedes[1], &len, sizeof(int));
+                        rc = write(filedes[1], (*outLiveIds)[i], sizeof(char) * len);
+                    }
+                    rc = 0;
+                } else {
+                    len = 0;
+                    rc = write(filedes[1], &len, sizeof(int));
+                    rc = 1;
+                }
+            }
+
+            if (ncOutInsts) {
+                if (ncOutInstsLen) {
+                    for (i = 0; i < (*ncOutInstsLen); i++) {
+                        EUCA_FREE((*ncOutInsts)[i]);
+                    }
+                }
+                EUCA_FREE(*ncOutInsts);
+            }
+            if (outLiveIds) {
+                if (outLiveIdsLen) {
+                    for (i = 0; i < (*outLiveIdsLen); i++) {
+                        EUCA_FREE((*outLiveIds)[i]);
+                    }
+                }
+                EUCA_FREE(*outLiveIds);
+            }
         } else if (!strcmp(ncOp, "ncDescribeResource")) {
             char *resourceType = va_arg(al, char *);
             ncResource **outRes = va_arg(al, ncResource **);
@@ -1016,6 +1224,9 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
         } else if (!strcmp(ncOp, "ncModifyNode")) {
             char *stateName = va_arg(al, char *);
             rc = ncModifyNodeStub(ncs, localmeta, stateName);
+        } else if (!strcmp(ncOp, "ncPrefetchImages")) {
+            virtualMachine *ncvm = va_arg(al, virtualMachine *);
+            rc = ncPrefetchImagesStub(ncs, localmeta, ncvm);
         } else if (!strcmp(ncOp, "ncMigrateInstances")) {
             ncInstance **instances = va_arg(al, ncInstance **);
             int instancesLen = va_arg(al, int);
@@ -1235,6 +1446,95 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                     }
                 }
             }
+        } else if (!strcmp(ncOp, "ncRunInstances")) {
+            char **uuids = NULL;
+            char **instIds = NULL;
+            netConfig *ncnets = NULL;
+            int instIdsLen = 0;
+            char *reservationId = NULL;
+            virtualMachine *ncvm = NULL;
+            char *imageId = NULL;
+            char *imageURL = NULL;
+            char *kernelId = NULL;
+            char *kernelURL = NULL;
+            char *ramdiskId = NULL;
+            char *ramdiskURL = NULL;
+            char *ownerId = NULL;
+            char *accountId = NULL;
+            char *keyName = NULL;
+            char *userData = NULL;
+            char *credential = NULL;
+            char *launchIndex = NULL;
+            char *platform = NULL;
+            int expiryTime = 0;
+            char **netNames = NULL;
+            int netNamesLen = 0;
+            char *rootDirective = NULL;
+            char **netIds = NULL;
+            int netIdsLen = 0;
+            netConfig *secNetCfgs = NULL;
+            int secNetCfgsLen = 0;
+            ncInstance ***ncOutInsts = NULL;
+            int *ncOutInstsLen = NULL;
+
+            uuids = va_arg(al, char **);
+            instIds = va_arg(al, char **);
+            ncnets = va_arg(al, netConfig *);
+            instIdsLen = va_arg(al, int);
+            reservationId = va_arg(al, char *);
+            ncvm = va_arg(al, virtualMachine *);
+            imageId = va_arg(al, char *);
+            imageURL = va_arg(al, char *);
+            kernelId = va_arg(al, char *);
+            kernelURL = va_arg(al, char *);
+            ramdiskId = va_arg(al, char *);
+            ramdiskURL = va_arg(al, char *);
+            ownerId = va_arg(al, char *);
+            accountId = va_arg(al, char *);
+            keyName = va_arg(al, char *);
+            userData = va_arg(al, char *);
+            credential = va_arg(al, char *);
+            launchIndex = va_arg(al, char *);
+            platform = va_arg(al, char *);
+            expiryTime = va_arg(al, int);
+            netNames = va_arg(al, char **);
+            netNamesLen = va_arg(al, int);
+            rootDirective = va_arg(al, char *);
+            netIds = va_arg(al, char **);
+            netIdsLen = va_arg(al, int);
+            secNetCfgs = va_arg(al, netConfig *);
+            secNetCfgsLen = va_arg(al, int);
+            ncOutInsts = va_arg(al, ncInstance ***);
+            ncOutInstsLen = va_arg(al, int *);
+            if (ncOutInstsLen && ncOutInsts) {
+                *ncOutInstsLen = 0;
+                *ncOutInsts = NULL;
+            }
+            if (timeout && ncOutInsts && ncOutInstsLen) {
+                rbytes = timeread(filedes[0], &len, sizeof(int), timeout);
+                if (rbytes <= 0) {
+                    killwait(pid);
+                    opFail = 1;
+                } else if (len > 0) {
+                    *ncOutInsts = EUCA_ZALLOC(len, sizeof(ncInstance *));
+                    if (!*ncOutInsts) {
+                        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                        unlock_exit(1);
+                    }
+                    *ncOutInstsLen = len;
+                    for (i = 0; i < len; i++) {
+                        if (((*ncOutInsts)[i] = EUCA_ZALLOC(1, sizeof(ncInstance))) == NULL) {
+                            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                            unlock_exit(1);
+                        }
+                        if ((rbytes = timeread(filedes[0], (*ncOutInsts)[i], sizeof(ncInstance), timeout)) <= 0) {
+                            killwait(pid);
+                            opFail = 1;
+                            break;
+                        }
+                    }
+                }
+            }
         } else if (!strcmp(ncOp, "ncDescribeInstances")) {
             char **instIds = NULL;
             int instIdsLen = 0;
@@ -1273,6 +1573,91 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                     }
                 }
             }
+        } else if (!strcmp(ncOp, "ncDescribeInstancesSince")) {
+            ncInstance ***ncOutInsts = NULL;
+            int *ncOutInstsLen = NULL;
+            long long *outGeneration = NULL;
+            boolean *outDelta = NULL;
+            char ***outLiveIds = NULL;
+            int *outLiveIdsLen = NULL;
+            int delta = 0;
+            int idlen = 0;
+
+            va_arg(al, long long);
+            ncOutInsts = va_arg(al, ncInstance ***);
+            ncOutInstsLen = va_arg(al, int *);
+            outGeneration = va_arg(al, long long *);
+            outDelta = va_arg(al, boolean *);
+            outLiveIds = va_arg(al, char ***);
+            outLiveIdsLen = va_arg(al, int *);
+            if (ncOutInstsLen && ncOutInsts) {
+                *ncOutInstsLen = 0;
+                *ncOutInsts = NULL;
+            }
+            if (outGeneration && outDelta && outLiveIds && outLiveIdsLen) {
+                *outGeneration = 0;
+                *outDelta = FALSE;
+                *outLiveIds = NULL;
+                *outLiveIdsLen = 0;
+            }
+            if (timeout && ncOutInsts && ncOutInstsLen) {
+                rbytes = timeread(filedes[0], &len, sizeof(int), timeout);
+                if (rbytes <= 0) {
+                    killwait(pid);
+                    opFail = 1;
+                } else {
+                    if (len > 0) {
+                        *ncOutInsts = EUCA_ZALLOC(len, sizeof(ncInstance *));
+                        if (!*ncOutInsts) {
+                            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                            unlock_exit(1);
+                        }
+                        *ncOutInstsLen = len;
+                    }
+                    for (i = 0; i < len; i++) {
+                        ncInstance *inst;
+                        inst = EUCA_ZALLOC(1, sizeof(ncInstance));
+                        if (!inst) {
+                            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                            unlock_exit(1);
+                        }
+                        rbytes = timeread(filedes[0], inst, sizeof(ncInstance), timeout);
+                        (*ncOutInsts)[i] = inst;
+                    }
+
+                    // the child only sends the trailer when the call succeeded, a short read means it did not
+                    if (timeread(filedes[0], outGeneration, sizeof(long long), timeout) != sizeof(long long)
+                        || timeread(filedes[0], &delta, sizeof(int), timeout) != sizeof(int)
+                        || timeread(filedes[0], outLiveIdsLen, sizeof(int), timeout) != sizeof(int)) {
+                        *outGeneration = 0;
+                        *outLiveIdsLen = 0;
+                        delta = 0;
+                    }
+                    *outDelta = (delta) ? TRUE : FALSE;
+                    if (*outLiveIdsLen > 0) {
+                        *outLiveIds = EUCA_ZALLOC(*outLiveIdsLen, sizeof(char *));
+                        if (!*outLiveIds) {
+                            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                            unlock_exit(1);
+                        }
+                        for (i = 0; i < *outLiveIdsLen; i++) {
+                            rbytes = timeread(filedes[0], &idlen, sizeof(int), timeout);
+                            if ((rbytes <= 0) || (idlen <= 0) || (idlen > CHAR_BUFFER_SIZE)) {
+                                killwait(pid);
+                                opFail = 1;
+                                break;
+                            }
+                            (*outLiveIds)[i] = EUCA_ZALLOC(idlen, sizeof(char));
+                            if (!(*outLiveIds)[i]) {
+                                LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                                unlock_exit(1);
+                            }
+                            rbytes = timeread(filedes[0], (*outLiveIds)[i], idlen, timeout);
+                            (*outLiveIds)[i][idlen - 1] = '\0';
+                        }
+                    }
+                }
+            }
         } else if (!strcmp(ncOp, "ncDescribeResource")) {
             char *resourceType = NULL;
             char **errMsg = NULL;
@@ -1405,8 +1790,6 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
     // release the lock
     sem_mypost(ncLock);
 
-    va_end(al);
-
     return (ret);
 
 #undef WRITE_REPLY_STRING
@@ -1414,35 +1797,387 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
 }
 
 //!
-//! Calculate nc call timeout, based on when operation was started (op_start), the total
-//! number of calls to make (numCalls), and the current progress (idx)
-//!
-//! @param[in] op_start
-//! @param[in] op_max
-//! @param[in] numCalls
-//! @param[in] idx
-//!
-//! @return
+//! In-process NC invocation path: makes the call through the persistent stub
+//! for the NC, with the transport timeout set to 'timeout'. Results are handed
+//! to the caller directly, in the same form the forked path produces them.
 //!
-//! @pre
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout
+//! @param[in] ncLock
+//! @param[in] ncURL
+//! @param[in] ncOp
+//! @param[in] al the operation-specific arguments
 //!
-//! @note
+//! @return 0 on success or 1 on failure
 //!
-int ncGetTimeout(time_t op_start, time_t op_max, int numCalls, int idx)
+static int ncClientCallPooled(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char *ncOp, va_list al)
 {
-    time_t op_timer, op_pernode;
-    int numLeft;
+    int rc = 0;
+    ncStub *ncs = NULL;
+    ncMetadata *localmeta = NULL;
 
-    numLeft = numCalls - idx;
-    if (numLeft <= 0) {
-        numLeft = 1;
+    LOGTRACE("invoked: ncOps=%s ncURL=%s timeout=%d\n", ncOp, ncURL, timeout);
+
+    localmeta = EUCA_ZALLOC(1, sizeof(ncMetadata));
+    if (!localmeta) {
+        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+        unlock_exit(1);
+    }
+    memcpy(localmeta, pMeta, sizeof(ncMetadata));
+    localmeta->correlationId = strdup(pMeta->correlationId ? pMeta->correlationId : "unset");
+    localmeta->userId = strdup(pMeta->userId ? pMeta->userId : "eucalyptus");
+    localmeta->replyString = NULL;
+    if (populateOutboundMeta(localmeta)) {
+        LOGERROR("Failed to update output service metadata\n");
     }
 
-    op_timer = op_max - (time(NULL) - op_start);
-    op_pernode = op_timer / numLeft;
+    // grab the lock
+    sem_mywait(ncLock);
 
-    return (maxint(minint(op_pernode, OP_TIMEOUT_PERNODE), OP_TIMEOUT_MIN));
-}
+    if ((ncs = ncpool_stub_acquire(ncURL, timeout)) == NULL) {
+        LOGERROR("cannot obtain NC client stub for %s ncOps=%s\n", ncURL, ncOp);
+        sem_mypost(ncLock);
+        EUCA_FREE(localmeta->correlationId);
+        EUCA_FREE(localmeta->userId);
+        EUCA_FREE(localmeta);
+        return (1);
+    }
+    ncStubSetTimeout(ncs, timeout);
+
+    LOGTRACE("\tncOps=%s client calling '%s'\n", ncOp, ncOp);
+    if (!strcmp(ncOp, "ncGetConsoleOutput")) {
+        char *instId = va_arg(al, char *);
+        char **consoleOutput = va_arg(al, char **);
+
+        if (consoleOutput)
+            *consoleOutput = NULL;
+        rc = ncGetConsoleOutputStub(ncs, localmeta, instId, consoleOutput);
+        if (!rc && consoleOutput && !*consoleOutput)
+            rc = 1;
+    } else if (!strcmp(ncOp, "ncAttachVolume")) {
+        char *instanceId = va_arg(al, char *);
+        char *volumeId = va_arg(al, char *);
+        char *remoteDev = va_arg(al, char *);
+        char *localDev = va_arg(al, char *);
+
+        rc = ncAttachVolumeStub(ncs, localmeta, instanceId, volumeId, remoteDev, localDev);
+    } else if (!strcmp(ncOp, "ncDetachVolume")) {
+        char *instanceId = va_arg(al, char *);
+        char *volumeId = va_arg(al, char *);
+        char *remoteDev = va_arg(al, char *);
+        char *localDev = va_arg(al, char *);
+        int force = va_arg(al, int);
+
+        rc = ncDetachVolumeStub(ncs, localmeta, instanceId, volumeId, remoteDev, localDev, force);
+    } else if (!strcmp(ncOp, "ncAttachNetworkInterface")) {
+        char *instanceId = va_arg(al, char *);
+        netConfig *netCfg = va_arg(al, netConfig *);
+
+        rc = ncAttachNetworkInterfaceStub(ncs, localmeta, instanceId, netCfg);
+    } else if (!strcmp(ncOp, "ncDetachNetworkInterface")) {
+        char *instanceId = va_arg(al, char *);
+        char *attachmentId = va_arg(al, char *);
+        int force = va_arg(al, int);
+
+        rc = ncDetachNetworkInterfaceStub(ncs, localmeta, instanceId, attachmentId, force);
+    } else if (!strcmp(ncOp, "ncCreateImage")) {
+        char *instanceId = va_arg(al, char *);
+        char *volumeId = va_arg(al, char *);
+        char *remoteDev = va_arg(al, char *);
+
+        rc = ncCreateImageStub(ncs, localmeta, instanceId, volumeId, remoteDev);
+    } else if (!strcmp(ncOp, "ncPowerDown")) {
+        rc = ncPowerDownStub(ncs, localmeta);
+    } else if (!strcmp(ncOp, "ncAssignAddress")) {
+        char *instanceId = va_arg(al, char *);
+        char *publicIp = va_arg(al, char *);
+
+        rc = ncAssignAddressStub(ncs, localmeta, instanceId, publicIp);
+    } else if (!strcmp(ncOp, "ncBroadcastNetworkInfo")) {
+        char *networkInfo = va_arg(al, char *);
+
+        rc = ncBroadcastNetworkInfoStub(ncs, localmeta, networkInfo);
+    } else if (!strcmp(ncOp, "ncRebootInstance")) {
+        char *instId = va_arg(al, char *);
+
+        rc = ncRebootInstanceStub(ncs, localmeta, instId);
+    } else if (!strcmp(ncOp, "ncTerminateInstance")) {
+        char *instId = va_arg(al, char *);
+        int force = va_arg(al, int);
+        int *shutdownState = va_arg(al, int *);
+        int *previousState = va_arg(al, int *);
+
+        if (shutdownState && previousState)
+            *shutdownState = *previousState = 0;
+        rc = ncTerminateInstanceStub(ncs, localmeta, instId, force, shutdownState, previousState);
+    } else if (!strcmp(ncOp, "ncStartNetwork")) {  //! @TODO remove this NC call logic, since it is not used any more
+        char *uuid = va_arg(al, char *);
+        char **peers = va_arg(al, char **);
+        int peersLen = va_arg(al, int);
+        int port = va_arg(al, int);
+        int vlan = va_arg(al, int);
+        char **outStatus = va_arg(al, char **);
+
+        if (outStatus)
+            *outStatus = NULL;
+        rc = ncStartNetworkStub(ncs, localmeta, uuid, peers, peersLen, port, vlan, outStatus);
+    } else if (!strcmp(ncOp, "ncRunInstance")) {
+        char *uuid = va_arg(al, char *);
+        char *instId = va_arg(al, char *);
+        char *reservationId = va_arg(al, char *);
+        virtualMachine *ncvm = va_arg(al, virtualMachine *);
+        char *imageId = va_arg(al, char *);
+        char *imageURL = va_arg(al, char *);
+        char *kernelId = va_arg(al, char *);
+        char *kernelURL = va_arg(al, char *);
+        char *ramdiskId = va_arg(al, char *);
+        char *ramdiskURL = va_arg(al, char *);
+        char *ownerId = va_arg(al, char *);
+        char *accountId = va_arg(al, char *);
+        char *keyName = va_arg(al, char *);
+        netConfig *ncnet = va_arg(al, netConfig *);
+        char *userData = va_arg(al, char *);
+        char *credential = va_arg(al, char *);
+        char *launchIndex = va_arg(al, char *);
+        char *platform = va_arg(al, char *);
+        int expiryTime = va_arg(al, int);
+        char **netNames = va_arg(al, char **);
+        int netNamesLen = va_arg(al, int);
+        char *rootDirective = va_arg(al, char *);
+        char **netIds = va_arg(al, char **);
+        int netIdsLen = va_arg(al, int);
+        netConfig *secNetCfgs = va_arg(al, netConfig *);
+        int secNetCfgsLen = va_arg(al, int);
+        ncInstance **outInst = va_arg(al, ncInstance **);
+
+        if (outInst)
+            *outInst = NULL;
+        rc = ncRunInstanceStub(ncs, localmeta, uuid, instId, reservationId, ncvm, imageId, imageURL, kernelId, kernelURL, ramdiskId, ramdiskURL,
+                               ownerId, accountId, keyName, ncnet, userData, credential, launchIndex, platform, expiryTime, netNames, netNamesLen, rootDirective, netIds,
+                               netIdsLen, secNetCfgs, secNetCfgsLen, outInst);
+        if (!rc && outInst && !*outInst)
+            rc = 1;
+    } else if (!strcmp(ncOp, "ncRunInstances")) {
+        char **uuids = va_arg(al, char **);
+        char **instIds = va_arg(al, char **);
+        netConfig *ncnets = va_arg(al, netConfig *);
+        int instIdsLen = va_arg(al, int);
+        char *reservationId = va_arg(al, char *);
+        virtualMachine *ncvm = va_arg(al, virtualMachine *);
+        char *imageId = va_arg(al, char *);
+        char *imageURL = va_arg(al, char *);
+        char *kernelId = va_arg(al, char *);
+        char *kernelURL = va_arg(al, char *);
+        char *ramdiskId = va_arg(al, char *);
+        char *ramdiskURL = va_arg(al, char *);
+        char *ownerId = va_arg(al, char *);
+        char *accountId = va_arg(al, char *);
+        char *keyName = va_arg(al, char *);
+        char *userData = va_arg(al, char *);
+        char *credential = va_arg(al, char *);
+        char *launchIndex = va_arg(al, char *);
+        char *platform = va_arg(al, char *);
+        int expiryTime = va_arg(al, int);
+        char **netNames = va_arg(al, char **);
+        int netNamesLen = va_arg(al, int);
+        char *rootDirective = va_arg(al, char *);
+        char **netIds = va_arg(al, char **);
+        int netIdsLen = va_arg(al, int);
+        netConfig *secNetCfgs = va_arg(al, netConfig *);
+        int secNetCfgsLen = va_arg(al, int);
+        ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
+        int *ncOutInstsLen = va_arg(al, int *);
+
+        if (ncOutInsts && ncOutInstsLen) {
+            *ncOutInsts = NULL;
+            *ncOutInstsLen = 0;
+        }
+        rc = ncRunInstancesStub(ncs, localmeta, uuids, instIds, ncnets, instIdsLen, reservationId, ncvm, imageId, imageURL, kernelId, kernelURL, ramdiskId,
+                                ramdiskURL, ownerId, accountId, keyName, userData, credential, launchIndex, platform, expiryTime, netNames, netNamesLen,
+                                rootDirective, netIds, netIdsLen, secNetCfgs, secNetCfgsLen, ncOutInsts, ncOutInstsLen);
+    } else if (!strcmp(ncOp, "ncDescribeInstances")) {
+        char **instIds = va_arg(al, char **);
+        int instIdsLen = va_arg(al, int);
+        ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
+        int *ncOutInstsLen = va_arg(al, int *);
+
+        if (ncOutInsts && ncOutInstsLen) {
+            *ncOutInsts = NULL;
+            *ncOutInstsLen = 0;
+        }
+        rc = ncDescribeInstancesStub(ncs, localmeta, instIds, instIdsLen, ncOutInsts, ncOutInstsLen);
+    } else if (!strcmp(ncOp, "ncDescribeInstancesSince")) {
+        long long sinceGeneration = va_arg(al, long long);
+        ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
+        int *ncOutInstsLen = va_arg(al, int *);
+        long long *outGeneration = va_arg(al, long long *);
+        boolean *outDelta = va_arg(al, boolean *);
+        char ***outLiveIds = va_arg(al, char ***);
+        int *outLiveIdsLen = va_arg(al, int *);
+
+        if (ncOutInsts && ncOutInstsLen) {
+            *ncOutInsts = NULL;
+            *ncOutInstsLen = 0;
+        }
+        rc = ncDescribeInstancesSinceStub(ncs, localmeta, sinceGeneration, ncOutInsts, ncOutInstsLen, outGeneration, outDelta, outLiveIds, outLiveIdsLen);
+    } else if (!strcmp(ncOp, "ncDescribeResource")) {
+        char *resourceType = va_arg(al, char *);
+        ncResource **outRes = va_arg(al, ncResource **);
+        char **errMsg = va_arg(al, char **);
+        const char *axisMsg = NULL;
+
+        if (outRes)
+            *outRes = NULL;
+        rc = ncDescribeResourceStub(ncs, localmeta, resourceType, outRes);
+        if (rc || (outRes && !*outRes)) {
+            // unlike the axis2 error string, the caller owns (and frees) *errMsg
+            if (errMsg && (axisMsg = axutil_error_get_message(ncs->env->error)) != NULL) {
+                *errMsg = strndup(axisMsg, 1024 - 1);
+            }
+            rc = 1;
+        }
+    } else if (!strcmp(ncOp, "ncDescribeSensors")) {
+        int history_size = va_arg(al, int);
+        long long collection_interval_time_ms = va_arg(al, long long);
+        char **instIds = va_arg(al, char **);
+        int instIdsLen = va_arg(al, int);
+        char **sensorIds = va_arg(al, char **);
+        int sensorIdsLen = va_arg(al, int);
+        sensorResource ***srs = va_arg(al, sensorResource ***);
+        int *srsLen = va_arg(al, int *);
+
+        if (srs && srsLen) {
+            *srs = NULL;
+            *srsLen = 0;
+        }
+        rc = ncDescribeSensorsStub(ncs, localmeta, history_size, collection_interval_time_ms, instIds, instIdsLen, sensorIds, sensorIdsLen, srs, srsLen);
+    } else if (!strcmp(ncOp, "ncBundleInstance")) {
+        char *instanceId = va_arg(al, char *);
+        char *bucketName = va_arg(al, char *);
+        char *filePrefix = va_arg(al, char *);
+        char *objectStorageURL = va_arg(al, char *);
+        char *userPublicKey = va_arg(al, char *);
+        char *S3Policy = va_arg(al, char *);
+        char *S3PolicySig = va_arg(al, char *);
+        char *architecture = va_arg(al, char *);
+
+        rc = ncBundleInstanceStub(ncs, localmeta, instanceId, bucketName, filePrefix, objectStorageURL, userPublicKey, S3Policy, S3PolicySig, architecture);
+    } else if (!strcmp(ncOp, "ncBundleRestartInstance")) {
+        char *instanceId = va_arg(al, char *);
+        rc = ncBundleRestartInstanceStub(ncs, localmeta, instanceId);
+    } else if (!strcmp(ncOp, "ncCancelBundleTask")) {
+        char *instanceId = va_arg(al, char *);
+        rc = ncCancelBundleTaskStub(ncs, localmeta, instanceId);
+    } else if (!strcmp(ncOp, "ncModifyNode")) {
+        char *stateName = va_arg(al, char *);
+        rc = ncModifyNodeStub(ncs, localmeta, stateName);
+    } else if (!strcmp(ncOp, "ncPrefetchImages")) {
+        virtualMachine *ncvm = va_arg(al, virtualMachine *);
+        rc = ncPrefetchImagesStub(ncs, localmeta, ncvm);
+    } else if (!strcmp(ncOp, "ncMigrateInstances")) {
+        ncInstance **instances = va_arg(al, ncInstance **);
+        int instancesLen = va_arg(al, int);
+        char *action = va_arg(al, char *);
+        char *credentials = va_arg(al, char *);
+        char **resourceLocations = va_arg(al, char **);
+        int resourceLocationsLen = va_arg(al, int);
+        rc = ncMigrateInstancesStub(ncs, localmeta, instances, instancesLen, action, credentials, resourceLocations, resourceLocationsLen);
+        pMeta->replyString = localmeta->replyString;
+        localmeta->replyString = NULL;
+    } else if (!strcmp(ncOp, "ncStartInstance")) {
+        char *instanceId = va_arg(al, char *);
+        rc = ncStartInstanceStub(ncs, localmeta, instanceId);
+        pMeta->replyString = localmeta->replyString;
+        localmeta->replyString = NULL;
+    } else if (!strcmp(ncOp, "ncStopInstance")) {
+        char *instanceId = va_arg(al, char *);
+        rc = ncStopInstanceStub(ncs, localmeta, instanceId);
+        pMeta->replyString = localmeta->replyString;
+        localmeta->replyString = NULL;
+    } else {
+        LOGWARN("\tncOps=%s operation '%s' not found\n", ncOp, ncOp);
+        rc = 1;
+    }
+    LOGTRACE("\tncOps=%s done calling '%s' with exit code '%d'\n", ncOp, ncOp, rc);
+    if (localmeta->replyString != NULL) {
+        LOGDEBUG("NC replied to '%s' with '%s'\n", ncOp, localmeta->replyString);
+    }
+
+    // a failed call may leave the connection in an undefined state, so such stubs are rebuilt
+    ncpool_stub_release(ncs, ((rc == 0) ? TRUE : FALSE));
+
+    // release the lock
+    sem_mypost(ncLock);
+
+    EUCA_FREE(localmeta->replyString);
+    EUCA_FREE(localmeta->correlationId);
+    EUCA_FREE(localmeta->userId);
+    EUCA_FREE(localmeta);
+
+    LOGTRACE("done ncOps=%s clientrc=%d\n", ncOp, rc);
+    return ((rc == 0) ? 0 : 1);
+}
+
+//!
+//! Invokes an operation on a node controller. Calls with a timeout go through
+//! the in-process engine (see nc-client-pool.c) unless NC_CLIENT_POOL=N, in
+//! which case, like calls without a timeout, they fork a child per call.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout
+//! @param[in] ncLock
+//! @param[in] ncURL
+//! @param[in] ncOp
+//! @param[in] ...
+//!
+//! @return 0 on success or 1 on failure
+//!
+int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char *ncOp, ...)
+{
+    int ret = 0;
+    va_list al = { {0} };
+
+    va_start(al, ncOp);
+    if (timeout && ncpool_enabled()) {
+        ret = ncClientCallPooled(pMeta, timeout, ncLock, ncURL, ncOp, al);
+    } else {
+        ret = ncClientCallForked(pMeta, timeout, ncLock, ncURL, ncOp, al);
+    }
+    va_end(al);
+
+    return (ret);
+}
+
+//!
+//! Calculate nc call timeout, based on when operation was started (op_start), the total
+//! number of calls to make (numCalls), and the current progress (idx)
+//!
+//! @param[in] op_start
+//! @param[in] op_max
+//! @param[in] numCalls
+//! @param[in] idx
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int ncGetTimeout(time_t op_start, time_t op_max, int numCalls, int idx)
+{
+    time_t op_timer, op_pernode;
+    int numLeft;
+
+    numLeft = numCalls - idx;
+    if (numLeft <= 0) {
+        numLeft = 1;
+    }
+
+    op_timer = op_max - (time(NULL) - op_start);
+    op_pernode = op_timer / numLeft;
+
+    return (maxint(minint(op_pernode, OP_TIMEOUT_PERNODE), OP_TIMEOUT_MIN));
+}
 
 //!
 //!
@@ -1483,9 +2218,7 @@ int doAttachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
@@ -1562,9 +2295,7 @@ int doDetachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
@@ -1704,11 +2435,7 @@ int doAssignAddress(ncMetadata * pMeta, char *uuid, char *src, char *dst)
     }
     set_dirty_instanceCache();
 
-    sem_mywait(RESCACHE);
-    {
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    }
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     ret = 1;
     if ((rc = find_instanceCacheIP(dst, &myInstance)) == 0) {
@@ -1784,11 +2511,7 @@ int doUnassignAddress(ncMetadata * pMeta, char *src, char *dst)
     }
     set_dirty_instanceCache();
 
-    sem_mywait(RESCACHE);
-    {
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    }
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     ret = 0;
     if ((rc = find_instanceCacheIP(src, &myInstance)) == 0) {
@@ -1941,9 +2664,7 @@ int doDescribeResources(ncMetadata * pMeta, virtualMachine ** ccvms, int vmLen,
         }
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
     {
         *outNodes = EUCA_ZALLOC(resourceCacheLocal.numResources, sizeof(ccResource));
         if (*outNodes == NULL) {
@@ -1962,9 +2683,9 @@ int doDescribeResources(ncMetadata * pMeta, virtualMachine ** ccvms, int vmLen,
                     diskpool = 0;
                     corepool = 0;
                 } else {
-                    mempool = res->availMemory;
-                    diskpool = res->availDisk;
-                    corepool = res->availCores;
+                    mempool = RES_FREE_MEMORY(res);
+                    diskpool = RES_FREE_DISK(res);
+                    corepool = RES_FREE_CORES(res);
                 }
                 mempool -= (*ccvms)[j].mem;
                 diskpool -= (*ccvms)[j].disk;
@@ -2191,9 +2912,7 @@ int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock)
     // now, broadcast the network XML to NCs
 
     // critical NC call section
-    sem_mywait(RESCACHE);
-    memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    stage_resourceCache();
 
     sem_close(locks[REFRESHLOCK]);
     locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
@@ -2255,135 +2974,212 @@ int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock)
 }
 
 //!
+//! Copies the entry a refresh task updated into resourceCacheStage[]. Goes
+//! through ncpool_publish(), so that a task still running after
+//! refresh_fanout() gave up on it leaves the stage alone: by then the stage
+//! has been merged into resourceCache[], and may be staged again for the
+//! next refresh.
 //!
+//! @param[in] arg a pointer to the ncRefreshArgs of the task
 //!
-//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
-//! @param[in] timeout
-//! @param[in] dolock
+static void refresh_publish_entry(void *arg)
+{
+    ncRefreshArgs *args = ((ncRefreshArgs *) arg);
+
+    memcpy(&(resourceCacheStage->resources[args->idx]), &(args->res), sizeof(ccResource));
+}
+
 //!
-//! @return
+//! Publishes what a refresh task learned about its node, see
+//! refresh_publish_entry().
 //!
-//! @pre
+//! @param[in] args the arguments of the task
 //!
-//! @note
+static void refresh_publish(ncRefreshArgs * args)
+{
+    if (ncpool_publish(refresh_publish_entry, args) != EUCA_OK)
+        LOGWARN("discarding late refresh of node %s\n", args->res.hostname);
+}
+
 //!
-int refresh_resources(ncMetadata * pMeta, int timeout, int dolock)
+//! Queries one node for its resources and stores the reply in its
+//! resourceCacheStage[] slot. Runs either on an NC client worker thread
+//! or in a forked child, see refresh_fanout().
+//!
+//! @param[in] arg a pointer to an ncRefreshArgs structure, freed here
+//!
+//! @return always 0
+//!
+static int refresh_resources_node(void *arg)
 {
-    int i, rc, nctimeout, pid, *pids = NULL;
-    int status;
-    time_t op_start;
+    int rc = 0;
+    int nctimeout = 0;
+    char *errMsg = NULL;
+    ncRefreshArgs *args = ((ncRefreshArgs *) arg);
+    ccResource *res = &(args->res);
     ncResource *ncResDst = NULL;
 
-    if (timeout <= 0)
-        timeout = 1;
+    if (res->state != RESASLEEP && res->running == 0) {
+        nctimeout = ncGetTimeout(args->op_start, args->timeout, 1, 1);
+        rc = ncClientCall(args->pMeta, nctimeout, res->lockidx, res->ncURL, "ncDescribeResource", NULL, &ncResDst, &errMsg);
+        if (rc != 0) {
+            powerUp(res);
 
-    op_start = time(NULL);
-    LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
+            if (res->state == RESWAKING && ((time(NULL) - res->stateChange) < config->wakeThresh)) {
+                LOGDEBUG("resource still waking up (%ld more seconds until marked as down)\n", config->wakeThresh - (time(NULL) - res->stateChange));
+            } else {
+                LOGERROR("bad return from ncDescribeResource(%s) (%d)\n", res->hostname, rc);
+                res->maxMemory = 0;
+                res->availMemory = 0;
+                res->maxDisk = 0;
+                res->availDisk = 0;
+                res->maxCores = 0;
+                res->availCores = 0;
+                changeState(res, RESDOWN);
+                res->ncState = NOTREADY;
+                res->migrationCapable = FALSE;
+                euca_strncpy(res->nodeMessage, SP(errMsg), 1024);
+                LOGERROR("error message from ncDescribeResource: %s\n", res->nodeMessage);
+            }
+        } else {
+            LOGDEBUG("received data from node=%s status=%s mem=%d/%d disk=%d/%d cores=%d/%d migrationCapable=%s\n",
+                     res->hostname,
+                     ncResDst->nodeStatus,
+                     ncResDst->memorySizeAvailable, ncResDst->memorySizeMax,
+                     ncResDst->diskSizeAvailable, ncResDst->diskSizeMax, ncResDst->numberOfCoresAvailable, ncResDst->numberOfCoresMax,
+                     (ncResDst->migrationCapable == TRUE) ? "TRUE" : "FALSE");
+            res->maxMemory = ncResDst->memorySizeMax;
+            res->availMemory = ncResDst->memorySizeAvailable;
+            res->maxDisk = ncResDst->diskSizeMax;
+            res->availDisk = ncResDst->diskSizeAvailable;
+            res->maxCores = ncResDst->numberOfCoresMax;
+            res->availCores = ncResDst->numberOfCoresAvailable;
+            if (!strcmp(ncResDst->nodeStatus, "enabled")) {
+                res->ncState = ENABLED;
+            } else if (!strcmp(ncResDst->nodeStatus, "disabled")) {
+                res->ncState = STOPPED;
+            }
+            res->migrationCapable = ncResDst->migrationCapable;
+            euca_strncpy(res->nodeStatus, ncResDst->nodeStatus, 24);
+////                    // temporarily duplicate the NC reported value in the node message for debugging
+            strcpy(res->nodeMessage, "");
+            // set iqn, if set
+            if (strlen(ncResDst->iqn)) {
+                snprintf(res->iqn, 128, "%s", ncResDst->iqn);
+            }
+            if (strlen(ncResDst->hypervisor)) {
+                euca_strncpy(res->hypervisor, ncResDst->hypervisor, 16);
+            }
+            memcpy(res->cachedImages, ncResDst->cachedImages, sizeof(res->cachedImages));
+            res->cachedImagesLen = ncResDst->cachedImagesLen;
+            changeState(res, RESUP);
+        }
+        if (errMsg != NULL) {
+            EUCA_FREE(errMsg);
+        }
+    } else {
+        LOGDEBUG("resource asleep/running instances (%d), skipping resource update\n", res->running);
+    }
 
-    // critical NC call section
-    sem_mywait(RESCACHE);
-    memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    // try to discover the mac address of the resource
+    if (res->mac[0] == '\0' && res->ip[0] != '\0') {
+        char *mac;
+        rc = IP2MAC(res->ip, &mac);
+        if (!rc) {
+            euca_strncpy(res->mac, mac, 24);
+            EUCA_FREE(mac);
+            LOGDEBUG("discovered MAC '%s' for host %s(%s)\n", res->mac, res->hostname, res->ip);
+        }
+    }
+
+    EUCA_FREE(ncResDst);
+    refresh_publish(args);
+    EUCA_FREE(args);
+    return (0);
+}
+
+//!
+//! Runs a per-node refresh task for every node in resourceCacheStage[]. With
+//! the NC client engine enabled the tasks run on its worker threads, which
+//! reuse one persistent stub per node; otherwise each task runs in a forked
+//! child, at most config->ncFanout at a time. Each task works on its own copy
+//! of its node's entry, which it publishes back into resourceCacheStage[]
+//! only if it finishes in time (see refresh_publish()).
+//!
+//! @param[in] task the per-node task, takes ownership of its ncRefreshArgs
+//! @param[in] proto template for the per-node arguments (idx is filled in here), its pick
+//!            field limits the refresh to some of the nodes
+//!
+//! @return 0 on success or 1 if some node could not be refreshed in time
+//!
+static int refresh_fanout(ncPoolTask task, ncRefreshArgs * proto)
+{
+    int i = 0;
+    int rc = 0;
+    int ret = 0;
+    int pid = 0;
+    int status = 0;
+    int *pids = NULL;
+    int numResources = 0;
+    void **args = NULL;
+
+    if (resourceCacheStage->numResources <= 0)
+        return (0);
+
+    if ((args = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(void *))) == NULL) {
+        LOGFATAL("out of memory!\n");
+        unlock_exit(1);
+    }
+
+    for (i = 0; i < resourceCacheStage->numResources; i++) {
+        if (proto->pick && !proto->pick[i])
+            continue;
+        if ((args[numResources] = EUCA_ZALLOC(1, sizeof(ncRefreshArgs))) == NULL) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
+        }
+        memcpy(args[numResources], proto, sizeof(ncRefreshArgs));
+        memcpy(&(((ncRefreshArgs *) args[numResources])->res), &(resourceCacheStage->resources[i]), sizeof(ccResource));
+        ((ncRefreshArgs *) args[numResources++])->idx = i;
+    }
+
+    if (numResources == 0) {
+        EUCA_FREE(args);
+        return (0);
+    }
+
+    if (ncpool_enabled()) {
+        // tasks own (and free) their arguments, even those still running past the deadline
+        if (ncpool_run(task, args, NULL, numResources, 120) != EUCA_OK) {
+            ret = 1;
+        }
+        EUCA_FREE(args);
+        return (ret);
+    }
 
     sem_close(locks[REFRESHLOCK]);
     locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
 
-    pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
+    pids = EUCA_ZALLOC(numResources, sizeof(int));
     if (!pids) {
         LOGFATAL("out of memory!\n");
         unlock_exit(1);
     }
 
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
+    for (i = 0; i < numResources; i++) {
         sem_mywait(REFRESHLOCK);
-
         pid = fork();
         if (!pid) {
-            ncResDst = NULL;
-            if (resourceCacheStage->resources[i].state != RESASLEEP && resourceCacheStage->resources[i].running == 0) {
-                nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
-                char *errMsg = NULL;
-                rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                  "ncDescribeResource", NULL, &ncResDst, &errMsg);
-                if (rc != 0) {
-                    powerUp(&(resourceCacheStage->resources[i]));
-
-                    if (resourceCacheStage->resources[i].state == RESWAKING && ((time(NULL) - resourceCacheStage->resources[i].stateChange) < config->wakeThresh)) {
-                        LOGDEBUG("resource still waking up (%ld more seconds until marked as down)\n",
-                                 config->wakeThresh - (time(NULL) - resourceCacheStage->resources[i].stateChange));
-                    } else {
-                        LOGERROR("bad return from ncDescribeResource(%s) (%d)\n", resourceCacheStage->resources[i].hostname, rc);
-                        resourceCacheStage->resources[i].maxMemory = 0;
-                        resourceCacheStage->resources[i].availMemory = 0;
-                        resourceCacheStage->resources[i].maxDisk = 0;
-                        resourceCacheStage->resources[i].availDisk = 0;
-                        resourceCacheStage->resources[i].maxCores = 0;
-                        resourceCacheStage->resources[i].availCores = 0;
-                        changeState(&(resourceCacheStage->resources[i]), RESDOWN);
-                        resourceCacheStage->resources[i].ncState = NOTREADY;
-                        resourceCacheStage->resources[i].migrationCapable = FALSE;
-                        euca_strncpy(resourceCacheStage->resources[i].nodeMessage, SP(errMsg), 1024);
-                        LOGERROR("error message from ncDescribeResource: %s\n", resourceCacheStage->resources[i].nodeMessage);
-                    }
-                } else {
-                    LOGDEBUG("received data from node=%s status=%s mem=%d/%d disk=%d/%d cores=%d/%d migrationCapable=%s\n",
-                             resourceCacheStage->resources[i].hostname,
-                             ncResDst->nodeStatus,
-                             ncResDst->memorySizeAvailable, ncResDst->memorySizeMax,
-                             ncResDst->diskSizeAvailable, ncResDst->diskSizeMax, ncResDst->numberOfCoresAvailable, ncResDst->numberOfCoresMax,
-                             (ncResDst->migrationCapable == TRUE) ? "TRUE" : "FALSE");
-                    resourceCacheStage->resources[i].maxMemory = ncResDst->memorySizeMax;
-                    resourceCacheStage->resources[i].availMemory = ncResDst->memorySizeAvailable;
-                    resourceCacheStage->resources[i].maxDisk = ncResDst->diskSizeMax;
-                    resourceCacheStage->resources[i].availDisk = ncResDst->diskSizeAvailable;
-                    resourceCacheStage->resources[i].maxCores = ncResDst->numberOfCoresMax;
-                    resourceCacheStage->resources[i].availCores = ncResDst->numberOfCoresAvailable;
-                    if (!strcmp(ncResDst->nodeStatus, "enabled")) {
-                        resourceCacheStage->resources[i].ncState = ENABLED;
-                    } else if (!strcmp(ncResDst->nodeStatus, "disabled")) {
-                        resourceCacheStage->resources[i].ncState = STOPPED;
-                    }
-                    resourceCacheStage->resources[i].migrationCapable = ncResDst->migrationCapable;
-                    euca_strncpy(resourceCacheStage->resources[i].nodeStatus, ncResDst->nodeStatus, 24);
-////                    // temporarily duplicate the NC reported value in the node message for debugging
-                    strcpy(resourceCacheStage->resources[i].nodeMessage, "");
-                    // set iqn, if set
-                    if (strlen(ncResDst->iqn)) {
-                        snprintf(resourceCacheStage->resources[i].iqn, 128, "%s", ncResDst->iqn);
-                    }
-                    if (strlen(ncResDst->hypervisor)) {
-                        euca_strncpy(resourceCacheStage->resources[i].hypervisor, ncResDst->hypervisor, 16);
-                    }
-                    changeState(&(resourceCacheStage->resources[i]), RESUP);
-                }
-                if (errMsg != NULL) {
-                    EUCA_FREE(errMsg);
-                }
-            } else {
-                LOGDEBUG("resource asleep/running instances (%d), skipping resource update\n", resourceCacheStage->resources[i].running);
-            }
-
-            // try to discover the mac address of the resource
-            if (resourceCacheStage->resources[i].mac[0] == '\0' && resourceCacheStage->resources[i].ip[0] != '\0') {
-                char *mac;
-                rc = IP2MAC(resourceCacheStage->resources[i].ip, &mac);
-                if (!rc) {
-                    euca_strncpy(resourceCacheStage->resources[i].mac, mac, 24);
-                    EUCA_FREE(mac);
-                    LOGDEBUG("discovered MAC '%s' for host %s(%s)\n", resourceCacheStage->resources[i].mac,
-                             resourceCacheStage->resources[i].hostname, resourceCacheStage->resources[i].ip);
-                }
-            }
-
-            EUCA_FREE(ncResDst);
+            task(args[i]);
             sem_mypost(REFRESHLOCK);
             exit(0);
         } else {
             pids[i] = pid;
+            EUCA_FREE(args[i]);
         }
     }
 
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
+    for (i = 0; i < numResources; i++) {
         rc = timewait(pids[i], &status, 120);
         if (!rc) {
             // timed out, really bad failure (reset REFRESHLOCK semaphore)
@@ -2403,16 +3199,52 @@ int refresh_resources(ncMetadata * pMeta, int timeout, int dolock)
         }
         if (rc) {
             LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
+            ret = 1;
         }
     }
 
+    EUCA_FREE(pids);
+    EUCA_FREE(args);
+    return (ret);
+}
+
+//!
+//!
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout
+//! @param[in] dolock
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int refresh_resources(ncMetadata * pMeta, int timeout, int dolock)
+{
+    ncRefreshArgs proto = { 0 };
+
+    if (timeout <= 0)
+        timeout = 1;
+
+    LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
+
+    // critical NC call section
+    stage_resourceCache();
+
+    proto.pMeta = pMeta;
+    proto.timeout = timeout;
+    proto.op_start = time(NULL);
+    refresh_fanout(refresh_resources_node, &proto);
+
     // resourceCacheStage[] entries were updated based on replies from NC,
     // so merge them into the canonical location: resourceCache[] (no
     // need to try removing hosts, since instanceCache membership
-    // does not change as part of the update)
-    refresh_resourceCache(resourceCacheStage, FALSE);
+    // does not change as part of the update), and let go of the launches
+    // that the nodes have now accounted for in their reports
+    refresh_resourceCache(resourceCacheStage, FALSE, TRUE, NULL);
 
-    EUCA_FREE(pids);
     LOGTRACE("done\n");
     return (0);
 }
@@ -2522,220 +3354,314 @@ static int migration_handler(ccInstance * myInstance, char *host, char *src, cha
 }
 
 //!
+//! Pulls the instance list from one node and merges it into the instance
+//! cache, then issues any migration commit/rollback the replies call for.
+//! Runs either on an NC client worker thread or in a forked child, see
+//! refresh_fanout().
 //!
+//! @param[in] arg a pointer to an ncRefreshArgs structure, freed here
 //!
-//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
-//! @param[in] timeout
-//! @param[in] dolock
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return always 0
 //!
-int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
+static int refresh_instances_node(void *arg)
 {
-    ccInstance *myInstance = NULL;
-    int i, numInsts = 0, found, ncOutInstsLen, rc, pid, nctimeout, *pids = NULL, status;
-    time_t op_start;
+    int i = 0;
+    int j = 0;
+    int rc = 0;
+    int nctimeout = 0;
+    int ncOutInstsLen = 0;
+    int liveIdsLen = 0;
+    int numInsts = 0;
+    long long generation = 0;
+    boolean delta = FALSE;
+    char **liveIds = NULL;
     char *migration_host = NULL;
     char *migration_instance = NULL;
     char *migration_action = NULL;
-
+    ncRefreshArgs *args = ((ncRefreshArgs *) arg);
+    ccResource *res = &(args->res);
+    ncMetadata *pMeta = args->pMeta;
+    ncMetadata *migrationMeta = NULL;
+    ccInstance *myInstance = NULL;
     ncInstance **ncOutInsts = NULL;
 
-    op_start = time(NULL);
+    i = args->idx;
+    if (res->state == RESUP) {
+        nctimeout = ncGetTimeout(args->op_start, args->timeout, 1, 1);
+        rc = ncClientCall(pMeta, nctimeout, res->lockidx, res->ncURL,
+                          "ncDescribeInstancesSince", res->instGeneration, &ncOutInsts, &ncOutInstsLen,
+                          &generation, &delta, &liveIds, &liveIdsLen);
+        if (rc) {
+            // no telling what we missed, start over with a full list
+            res->instGeneration = 0;
+        } else {
+            // a delta reply only carries the instances that changed since the generation
+            // we last saw, the rest of the node's instances are listed in liveIds
+            numInsts = ncOutInstsLen;
+            res->instGeneration = generation;
+            if (delta) {
+                numInsts = liveIdsLen;
+                LOGTRACE("node %s reported %d changed of %d instances (generation %lld)\n", res->hostname, ncOutInstsLen,
+                         liveIdsLen, generation);
+            }
+
+            // if idle, power down
+            if (numInsts == 0) {
+                LOGDEBUG("node %s idle since %ld: (%ld/%d) seconds\n", res->hostname,
+                         res->idleStart, time(NULL) - res->idleStart, config->idleThresh);
+                if (!res->idleStart) {
+                    res->idleStart = time(NULL);
+                } else if ((time(NULL) - res->idleStart) > config->idleThresh) {
+                    // call powerdown
+
+                    if (powerDown(pMeta, res)) {
+                        LOGWARN("powerDown for %s failed\n", res->hostname);
+                    }
+                }
+            } else {
+                res->idleStart = 0;
+            }
 
-    LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
-    set_clean_instanceCache();
+            // populate instanceCache
+            for (j = 0; j < ncOutInstsLen; j++) {
+                myInstance = NULL;
+                // add it
+                LOGDEBUG("describing instance %s, %s, %d\n", ncOutInsts[j]->instanceId, ncOutInsts[j]->stateName, j);
 
-    // critical NC call section
-    sem_mywait(RESCACHE);
-    memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+                // grab instance from cache, if available.  otherwise, start from scratch
+                rc = find_instanceCacheId(ncOutInsts[j]->instanceId, &myInstance);
+                if (rc || !myInstance) {
+                    myInstance = EUCA_ZALLOC(1, sizeof(ccInstance));
+                    if (!myInstance) {
+                        LOGFATAL("out of memory!\n");
+                        unlock_exit(1);
+                    }
+                }
+                // update CC instance with instance state from NC
+                rc = ncInstance_to_ccInstance(myInstance, ncOutInsts[j]);
+
+                // migration-related logic
+                if (ncOutInsts[j]->migration_state != NOT_MIGRATING) {
+
+                    rc = migration_handler(myInstance,
+                                           res->hostname,
+                                           ncOutInsts[j]->migration_src,
+                                           ncOutInsts[j]->migration_dst, ncOutInsts[j]->migration_state, &migration_host, &migration_instance, &migration_action);
+
+                    // For now just ignore updates from destination while migrating.
+                    if (!strcmp(res->hostname, ncOutInsts[j]->migration_dst)) {
+                        LOGTRACE("[%s] ignoring update from destination node %s during migration (host=%s, instance=%s, action=%s)\n",
+                                 myInstance->instanceId, ncOutInsts[j]->migration_dst, SP(migration_host), SP(migration_instance), SP(migration_action));
+                        EUCA_FREE(myInstance);
+                        continue;
+                    }
+                }
+                // instance info that the CC maintains
+                myInstance->ncHostIdx = i;
+
+                // Is this redundant?
+                myInstance->migration_state = ncOutInsts[j]->migration_state;
+
+                euca_strncpy(myInstance->serviceTag, res->ncURL, 384);
+                {
+                    char *ip = NULL;
+                    if (!strcmp(myInstance->ccnet.privateIp, "0.0.0.0")) {
+                        if ((rc = MAC2IP(myInstance->ccnet.privateMac, &ip)) == 0) {
+                            euca_strncpy(myInstance->ccnet.privateIp, ip, INET_ADDR_LEN);
+                        }
+                    }
+                    EUCA_FREE(ip);
+                }
 
-    sem_close(locks[REFRESHLOCK]);
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
+                if ((myInstance->ccnet.publicIp[0] != '\0' && strcmp(myInstance->ccnet.publicIp, "0.0.0.0"))
+                    && (myInstance->ncnet.publicIp[0] == '\0' || !strcmp(myInstance->ncnet.publicIp, "0.0.0.0"))) {
+                    // CC has network info, NC does not
+                    LOGDEBUG("sending ncAssignAddress to sync NC\n");
+                    rc = ncClientCall(pMeta, nctimeout, res->lockidx, res->ncURL,
+                                      "ncAssignAddress", myInstance->instanceId, myInstance->ccnet.publicIp);
+                    if (rc) {
+                        // problem, but will retry next time
+                        LOGWARN("could not send AssignAddress to NC\n");
+                    }
+                }
 
-    pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
-    if (!pids) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
-
-    invalidate_instanceCache();
-
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
-        sem_mywait(REFRESHLOCK);
-        pid = fork();
-        if (!pid) {
-            if (resourceCacheStage->resources[i].state == RESUP) {
-                int j;
-
-                nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
-                rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                  "ncDescribeInstances", NULL, 0, &ncOutInsts, &ncOutInstsLen);
-                if (!rc) {
-
-                    // if idle, power down
-                    if (ncOutInstsLen == 0) {
-                        LOGDEBUG("node %s idle since %ld: (%ld/%d) seconds\n", resourceCacheStage->resources[i].hostname,
-                                 resourceCacheStage->resources[i].idleStart, time(NULL) - resourceCacheStage->resources[i].idleStart, config->idleThresh);
-                        if (!resourceCacheStage->resources[i].idleStart) {
-                            resourceCacheStage->resources[i].idleStart = time(NULL);
-                        } else if ((time(NULL) - resourceCacheStage->resources[i].idleStart) > config->idleThresh) {
-                            // call powerdown
-
-                            if (powerDown(pMeta, &(resourceCacheStage->resources[i]))) {
-                                LOGWARN("powerDown for %s failed\n", resourceCacheStage->resources[i].hostname);
-                            }
-                        }
-                    } else {
-                        resourceCacheStage->resources[i].idleStart = 0;
-                    }
-
-                    // populate instanceCache
-                    for (j = 0; j < ncOutInstsLen; j++) {
-                        found = 1;
-                        if (found) {
-                            myInstance = NULL;
-                            // add it
-                            LOGDEBUG("describing instance %s, %s, %d\n", ncOutInsts[j]->instanceId, ncOutInsts[j]->stateName, j);
-                            numInsts++;
-
-                            // grab instance from cache, if available.  otherwise, start from scratch
-                            rc = find_instanceCacheId(ncOutInsts[j]->instanceId, &myInstance);
-                            if (rc || !myInstance) {
-                                myInstance = EUCA_ZALLOC(1, sizeof(ccInstance));
-                                if (!myInstance) {
-                                    LOGFATAL("out of memory!\n");
-                                    unlock_exit(1);
-                                }
-                            }
-                            // update CC instance with instance state from NC
-                            rc = ncInstance_to_ccInstance(myInstance, ncOutInsts[j]);
-
-                            // migration-related logic
-                            if (ncOutInsts[j]->migration_state != NOT_MIGRATING) {
-
-                                rc = migration_handler(myInstance,
-                                                       resourceCacheStage->resources[i].hostname,
-                                                       ncOutInsts[j]->migration_src,
-                                                       ncOutInsts[j]->migration_dst, ncOutInsts[j]->migration_state, &migration_host, &migration_instance, &migration_action);
-
-                                // For now just ignore updates from destination while migrating.
-                                if (!strcmp(resourceCacheStage->resources[i].hostname, ncOutInsts[j]->migration_dst)) {
-                                    LOGTRACE("[%s] ignoring update from destination node %s during migration (host=%s, instance=%s, action=%s)\n",
-                                             myInstance->instanceId, ncOutInsts[j]->migration_dst, SP(migration_host), SP(migration_instance), SP(migration_action));
-                                    EUCA_FREE(myInstance);
-                                    continue;
-                                }
-                            }
-                            // instance info that the CC maintains
-                            myInstance->ncHostIdx = i;
-
-                            // Is this redundant?
-                            myInstance->migration_state = ncOutInsts[j]->migration_state;
-
-                            euca_strncpy(myInstance->serviceTag, resourceCacheStage->resources[i].ncURL, 384);
-                            {
-                                char *ip = NULL;
-                                if (!strcmp(myInstance->ccnet.privateIp, "0.0.0.0")) {
-                                    if ((rc = MAC2IP(myInstance->ccnet.privateMac, &ip)) == 0) {
-                                        euca_strncpy(myInstance->ccnet.privateIp, ip, INET_ADDR_LEN);
-                                    }
-                                }
-                                EUCA_FREE(ip);
-                            }
-
-                            if ((myInstance->ccnet.publicIp[0] != '\0' && strcmp(myInstance->ccnet.publicIp, "0.0.0.0"))
-                                && (myInstance->ncnet.publicIp[0] == '\0' || !strcmp(myInstance->ncnet.publicIp, "0.0.0.0"))) {
-                                // CC has network info, NC does not
-                                LOGDEBUG("sending ncAssignAddress to sync NC\n");
-                                rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                                  "ncAssignAddress", myInstance->instanceId, myInstance->ccnet.publicIp);
-                                if (rc) {
-                                    // problem, but will retry next time
-                                    LOGWARN("could not send AssignAddress to NC\n");
-                                }
-                            }
-
-                            refresh_instanceCache(myInstance->instanceId, myInstance);
-                            LOGDEBUG("storing instance state: %s/%s/%s/%s\n", myInstance->instanceId, myInstance->state, myInstance->ccnet.publicIp, myInstance->ccnet.privateIp);
-                            print_ccInstance("refresh_instances(): ", myInstance);
-                            sensor_set_resource_alias(myInstance->instanceId, myInstance->ncnet.privateIp);
-                            // TODO swathi should this account for secondary enis?
-                            EUCA_FREE(myInstance);
-                        }
-                    }
-                }
-                if (ncOutInsts) {
-                    for (j = 0; j < ncOutInstsLen; j++) {
-                        free_instance(&(ncOutInsts[j]));
-                    }
-                    EUCA_FREE(ncOutInsts);
-                }
+                refresh_instanceCache(myInstance->instanceId, myInstance);
+                LOGDEBUG("storing instance state: %s/%s/%s/%s\n", myInstance->instanceId, myInstance->state, myInstance->ccnet.publicIp, myInstance->ccnet.privateIp);
+                print_ccInstance("refresh_instances(): ", myInstance);
+                sensor_set_resource_alias(myInstance->instanceId, myInstance->ncnet.privateIp);
+                // TODO swathi should this account for secondary enis?
+                EUCA_FREE(myInstance);
             }
-            sem_mypost(REFRESHLOCK);
 
-            if (migration_host) {
-                if (!strcmp(migration_action, "commit")) {
-                    LOGDEBUG("[%s] notifying source %s to commit migration\n", migration_instance, migration_host);
-                    // Note: Really only need to specify the instance here.
-                    doMigrateInstances(pMeta, migration_host, migration_instance, NULL, 0, 0, "commit", NULL, 0);
-                } else if (!strcmp(migration_action, "rollback")) {
-                    LOGDEBUG("[%s] notifying node %s to roll back migration\n", migration_instance, migration_host);
-                    doMigrateInstances(pMeta, migration_host, migration_instance, NULL, 0, 0, "rollback", NULL, 0);
-                } else {
-                    LOGWARN("unexpected migration action '%s' for node %s -- doing nothing\n", migration_action, migration_host);
-                }
-                EUCA_FREE(migration_host);
+            // keep the unchanged instances from expiring out of the cache
+            if (delta && touch_instanceCache(liveIds, liveIdsLen)) {
+                LOGDEBUG("instance cache out of sync with node %s, asking for all instances next time\n", res->hostname);
+                res->instGeneration = 0;
             }
-            EUCA_FREE(migration_instance);
-            EUCA_FREE(migration_action);
-
-            exit(0);
-        } else {
-            pids[i] = pid;
+        }
+        if (ncOutInsts) {
+            for (j = 0; j < ncOutInstsLen; j++) {
+                free_instance(&(ncOutInsts[j]));
+            }
+            EUCA_FREE(ncOutInsts);
+        }
+        if (liveIds) {
+            for (j = 0; j < liveIdsLen; j++) {
+                EUCA_FREE(liveIds[j]);
+            }
+            EUCA_FREE(liveIds);
         }
     }
 
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
-        rc = timewait(pids[i], &status, 120);
-        if (!rc) {
-            // timed out, really bad failure (reset REFRESHLOCK semaphore)
-            sem_close(locks[REFRESHLOCK]);
-            locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-            rc = 1;
-        } else if (rc > 0) {
-            // process exited, and wait picked it up.
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                rc = 1;
-            }
-        } else {
-            // process no longer exists, and someone else reaped it
-            rc = 0;
+    refresh_publish(args);
+
+    if (migration_host) {
+        // doMigrateInstances() hands its reply back through the metadata, which
+        // other nodes' tasks may be sharing, so use a private copy of it here
+        if ((migrationMeta = EUCA_ZALLOC(1, sizeof(ncMetadata))) == NULL) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
         }
-        if (rc) {
-            LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
+        memcpy(migrationMeta, pMeta, sizeof(ncMetadata));
+        migrationMeta->replyString = NULL;
+
+        if (!strcmp(migration_action, "commit")) {
+            LOGDEBUG("[%s] notifying source %s to commit migration\n", migration_instance, migration_host);
+            // Note: Really only need to specify the instance here.
+            doMigrateInstances(migrationMeta, migration_host, migration_instance, NULL, 0, 0, "commit", NULL, 0);
+        } else if (!strcmp(migration_action, "rollback")) {
+            LOGDEBUG("[%s] notifying node %s to roll back migration\n", migration_instance, migration_host);
+            doMigrateInstances(migrationMeta, migration_host, migration_instance, NULL, 0, 0, "rollback", NULL, 0);
+        } else {
+            LOGWARN("unexpected migration action '%s' for node %s -- doing nothing\n", migration_action, migration_host);
         }
+        EUCA_FREE(migrationMeta->replyString);
+        EUCA_FREE(migrationMeta);
+        EUCA_FREE(migration_host);
     }
+    EUCA_FREE(migration_instance);
+    EUCA_FREE(migration_action);
+    EUCA_FREE(args);
+    return (0);
+}
+
+//!
+//!
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout
+//! @param[in] dolock
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
+{
+    ncRefreshArgs proto = { 0 };
+
+    LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
+    set_clean_instanceCache();
+
+    // critical NC call section
+    stage_resourceCache();
+
+    invalidate_instanceCache();
+
+    proto.pMeta = pMeta;
+    proto.timeout = timeout;
+    proto.op_start = time(NULL);
+    refresh_fanout(refresh_instances_node, &proto);
 
     invalidate_instanceCache();        // purge old instances from cache
 
     // update canonical array of resources with latest changes
     // to resourceCacheStage (.idleStart may have changed) and
     // remove any unconfigured hosts if they have no instances
-    refresh_resourceCache(resourceCacheStage, TRUE);
-    EUCA_FREE(pids);
+    refresh_resourceCache(resourceCacheStage, TRUE, FALSE, NULL);
 
     LOGTRACE("done\n");
     return (0);
 }
 
+//!
+//! Refreshes the resources and instances of the nodes that pushed notice
+//! of a change, rather than waiting for the next poll of all the nodes.
+//! Unlike refresh_instances(), it leaves alone the instances of the other
+//! nodes and the dirty flag of the instance cache, and never removes nodes.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout overall timeout for the refresh, in seconds
+//! @param[in] pick flags the nodes to refresh, by index in resourceCache[]
+//!
+//! @return 0 on success or 1 if some node could not be refreshed in time
+//!
+static int refresh_pushed(ncMetadata * pMeta, int timeout, const char *pick)
+{
+    int ret = 0;
+    ncRefreshArgs proto = { 0 };
+
+    // membership only changes on this (the monitor) thread, so pick[] indexes the stage as well
+    stage_resourceCache();
+
+    proto.pMeta = pMeta;
+    proto.timeout = timeout;
+    proto.pick = pick;
+    proto.op_start = time(NULL);
+    if (refresh_fanout(refresh_resources_node, &proto))
+        ret = 1;
+
+    proto.op_start = time(NULL);
+    if (refresh_fanout(refresh_instances_node, &proto))
+        ret = 1;
+
+    refresh_resourceCache(resourceCacheStage, FALSE, TRUE, pick);
+    return (ret);
+}
+
+//!
+//! Pulls sensor data from one node and merges it into the sensor cache.
+//! Runs either on an NC client worker thread or in a forked child, see
+//! refresh_fanout().
+//!
+//! @param[in] arg a pointer to an ncRefreshArgs structure, freed here
+//!
+//! @return always 0
+//!
+static int refresh_sensors_node(void *arg)
+{
+    ncRefreshArgs *args = ((ncRefreshArgs *) arg);
+    ccResource *res = &(args->res);
+
+    if (res->state == RESUP) {
+        int nctimeout = ncGetTimeout(args->op_start, args->timeout, 1, 1);
+
+        sensorResource **srs = NULL;
+        int srsLen = 0;
+        int rc = ncClientCall(args->pMeta, nctimeout, res->lockidx, res->ncURL,
+                              "ncDescribeSensors", args->history_size, args->collection_interval_time_ms,
+                              NULL, 0, NULL, 0, &srs, &srsLen);
+
+        if (!rc) {
+            // update our cache
+            if (sensor_merge_records(srs, srsLen, TRUE) != EUCA_OK) {
+                LOGWARN("failed to store all sensor data due to lack of space");
+            }
+
+            if (srsLen > 0) {
+                for (int j = 0; j < srsLen; j++) {
+                    EUCA_FREE(srs[j]);
+                }
+                EUCA_FREE(srs);
+            }
+        }
+    }
+    EUCA_FREE(args);
+    return (0);
+}
+
 //!
 //!
 //!
@@ -2751,8 +3677,8 @@ int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
 //!
 int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock)
 {
+    ncRefreshArgs proto = { 0 };
 
-    time_t op_start = time(NULL);
     LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
 
     int history_size;
@@ -2761,79 +3687,15 @@ int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock)
         return (1);                    // sensor system not configured yet
 
     // critical NC call section
-    sem_mywait(RESCACHE);
-    memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
-    sem_close(locks[REFRESHLOCK]);
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-
-    int *pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
-    if (!pids) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
-
-    for (int i = 0; i < resourceCacheStage->numResources; i++) {
-        sem_mywait(REFRESHLOCK);
-        pid_t pid = fork();
-        if (!pid) {
-            if (resourceCacheStage->resources[i].state == RESUP) {
-                int nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
-
-                sensorResource **srs;
-                int srsLen;
-                int rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                      "ncDescribeSensors", history_size, collection_interval_time_ms,
-                                      NULL, 0, NULL, 0, &srs, &srsLen);
+    stage_resourceCache();
 
-                if (!rc) {
-                    // update our cache
-                    if (sensor_merge_records(srs, srsLen, TRUE) != EUCA_OK) {
-                        LOGWARN("failed to store all sensor data due to lack of space");
-                    }
+    proto.pMeta = pMeta;
+    proto.timeout = timeout;
+    proto.op_start = time(NULL);
+    proto.history_size = history_size;
+    proto.collection_interval_time_ms = collection_interval_time_ms;
+    refresh_fanout(refresh_sensors_node, &proto);
 
-                    if (srsLen > 0) {
-                        for (int j = 0; j < srsLen; j++) {
-                            EUCA_FREE(srs[j]);
-                        }
-                        EUCA_FREE(srs);
-                    }
-                }
-            }
-            sem_mypost(REFRESHLOCK);
-            exit(0);
-        } else {
-            pids[i] = pid;
-        }
-    }
-
-    for (int i = 0; i < resourceCacheStage->numResources; i++) {
-        int status;
-
-        int rc = timewait(pids[i], &status, 120);
-        if (!rc) {
-            // timed out, really bad failure (reset REFRESHLOCK semaphore)
-            sem_close(locks[REFRESHLOCK]);
-            locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-            rc = 1;
-        } else if (rc > 0) {
-            // process exited, and wait picked it up.
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                rc = 1;
-            }
-        } else {
-            // process no longer exists, and someone else reaped it
-            rc = 0;
-        }
-        if (rc) {
-            LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
-        }
-    }
-
-    EUCA_FREE(pids);
     LOGTRACE("done\n");
     return (0);
 }
@@ -2855,7 +3717,10 @@ int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock)
 //!
 int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccInstance ** outInsts, int *outInstsLen)
 {
-    int i, rc, count;
+    int i, rc, count, size, pass;
+    int *slots = NULL;
+    unsigned int generation;
+    unsigned int *seqs = NULL;
     time_t op_start;
 
     LOGDEBUG("invoked: userId=%s, instIdsLen=%d\n", SP(pMeta ? pMeta->userId : "UNSET"), instIdsLen);
@@ -2872,39 +3737,47 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccIn
     *outInsts = NULL;
     *outInstsLen = 0;
 
-    sem_mywait(INSTCACHE);
-    sem_mywait(INSTCACHEMD);
-    count = 0;
-    if (instanceCacheMetadata->numInsts) {
-        *outInsts = EUCA_ZALLOC(instanceCacheMetadata->numInsts, sizeof(ccInstance));
-        if (!*outInsts) {
-            LOGFATAL("out of memory!\n");
-            unlock_exit(1);
-        }
-
-        for (i = 0; i < config->ccMaxInstances; i++) {
-            if (instanceCache[i].cacheState == INSTVALID) {
-                if (count >= instanceCacheMetadata->numInsts) {
-                    LOGWARN("found more instances than reported by numInsts, will only report a subset of instances\n");
-                    count = 0;
+    // the cache is scanned without INSTCACHE, slot by slot, and the scan is
+    // rerun (a few times at most) if any slot changed meanwhile, so that the
+    // reply is usually a consistent snapshot of the whole cache
+    count = size = 0;
+    for (pass = 0; pass < CC_DESCRIBE_SNAPSHOT_TRIES; pass++) {
+        generation = instanceCacheMetadata->generation;
+        __sync_synchronize();
+        for (count = 0, i = 0; i < config->ccMaxInstances; i++) {
+            if (count == size) {
+                size = MAX(MAX(size * 2, instanceCacheMetadata->numInsts), 16);
+                if (((*outInsts = EUCA_REALLOC(*outInsts, size, sizeof(ccInstance))) == NULL)
+                    || ((slots = EUCA_REALLOC(slots, size, sizeof(int))) == NULL) || ((seqs = EUCA_REALLOC(seqs, size, sizeof(unsigned int))) == NULL)) {
+                    LOGFATAL("out of memory!\n");
+                    unlock_exit(1);
                 }
-                memcpy(&((*outInsts)[count]), &(instanceCache[i].instance), sizeof(ccInstance));
-                instanceCache[i].described = 1;
+            }
+            if (copy_instanceCacheSlot(i, &((*outInsts)[count]), &(seqs[count])) == EUCA_OK) {
+                slots[count] = i;
 
                 // We only report a subset of possible migration statuses upstream to the CLC.
-                if ((*outInsts)[count].migration_state == MIGRATION_READY) {
-                    (*outInsts)[count].migration_state = MIGRATION_PREPARING;
-                } else if ((*outInsts)[count].migration_state == MIGRATION_CLEANING) {
-                    (*outInsts)[count].migration_state = MIGRATION_IN_PROGRESS;
-                }
+                (*outInsts)[count].migration_state = migration_state_upstream((*outInsts)[count].migration_state);
                 count++;
             }
         }
-
-        *outInstsLen = instanceCacheMetadata->numInsts;
+        __sync_synchronize();
+        if (instanceCacheMetadata->generation == generation)
+            break;
     }
-    sem_mypost(INSTCACHEMD);
+
+    sem_mywait(INSTCACHE);
+    for (i = 0; i < count; i++)
+        mark_instanceCacheDescribed(slots[i], seqs[i]);
     sem_mypost(INSTCACHE);
+    EUCA_FREE(slots);
+    EUCA_FREE(seqs);
+
+    if (count) {
+        *outInstsLen = count;
+    } else {
+        EUCA_FREE(*outInsts);
+    }
 
     for (i = 0; i < (*outInstsLen); i++) {
         LOGDEBUG("instances summary: instanceId=%s, state=%s, migration_state=%s, publicIp=%s, privateIp=%s\n",
@@ -2919,6 +3792,102 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccIn
     return (0);
 }
 
+//!
+//! Same as doDescribeInstances() but, instead of copying every cached
+//! instance, returns read-only views into the shared instance cache. Callers
+//! that only serialize the instances copy out the fields they need, within
+//! their bounds, and check each view with instanceCacheView_valid() before
+//! using the copy (see ccInstanceViewUnmarshal()).
+//! Note that the migration state seen through a view is the raw one, callers
+//! must pass it through migration_state_upstream().
+//!
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  instIds
+//! @param[in]  instIdsLen
+//! @param[out] outViews array of views, to be freed by the caller
+//! @param[out] outViewsLen number of views in outViews
+//!
+//! @return 0 on success or 1 on failure
+//!
+int doDescribeInstanceViews(ncMetadata * pMeta, char **instIds, int instIdsLen, ccInstanceView ** outViews, int *outViewsLen)
+{
+    int i, rc, count, size, pass;
+    unsigned int generation;
+
+    LOGDEBUG("invoked: userId=%s, instIdsLen=%d\n", SP(pMeta ? pMeta->userId : "UNSET"), instIdsLen);
+
+    rc = initialize(pMeta, FALSE);
+    if (rc || ccIsEnabled()) {
+        return (1);
+    }
+
+    print_instanceCache();
+
+    *outViews = NULL;
+    *outViewsLen = 0;
+
+    // same lock-free scan as in doDescribeInstances()
+    count = size = 0;
+    for (pass = 0; pass < CC_DESCRIBE_SNAPSHOT_TRIES; pass++) {
+        generation = instanceCacheMetadata->generation;
+        __sync_synchronize();
+        for (count = 0, i = 0; i < config->ccMaxInstances; i++) {
+            if (count == size) {
+                size = MAX(MAX(size * 2, instanceCacheMetadata->numInsts), 16);
+                if ((*outViews = EUCA_REALLOC(*outViews, size, sizeof(ccInstanceView))) == NULL) {
+                    LOGFATAL("out of memory!\n");
+                    unlock_exit(1);
+                }
+            }
+            if (peek_instanceCacheView(i, &((*outViews)[count])) == EUCA_OK) {
+                count++;
+            }
+        }
+        __sync_synchronize();
+        if (instanceCacheMetadata->generation == generation)
+            break;
+    }
+
+    sem_mywait(INSTCACHE);
+    for (i = 0; i < count; i++)
+        mark_instanceCacheDescribed((*outViews)[i].slot, (*outViews)[i].seq);
+    sem_mypost(INSTCACHE);
+
+    if (count) {
+        *outViewsLen = count;
+    } else {
+        EUCA_FREE(*outViews);
+    }
+
+    for (i = 0; i < count; i++) {
+        LOGDEBUG("instances summary: instanceId=%s\n", (*outViews)[i].instanceId);
+    }
+
+    LOGTRACE("done\n");
+
+    shawn();
+
+    return (0);
+}
+
+//!
+//! Maps an instance migration state to the one reported upstream: we only
+//! report a subset of possible migration statuses to the CLC.
+//!
+//! @param[in] state the migration state as tracked by the CC
+//!
+//! @return the migration state to report
+//!
+migration_states migration_state_upstream(migration_states state)
+{
+    if (state == MIGRATION_READY) {
+        return (MIGRATION_PREPARING);
+    } else if (state == MIGRATION_CLEANING) {
+        return (MIGRATION_IN_PROGRESS);
+    }
+    return (state);
+}
+
 //!
 //!
 //!
@@ -3077,30 +4046,299 @@ int ccInstance_to_ncInstance(ncInstance * dst, ccInstance * src)
     dst->launchTime = src->ts;
     dst->migration_state = src->migration_state;
 
-    memcpy(&(dst->ncnet), &(src->ncnet), sizeof(netConfig));
-    for(i = 0; (i < src->secNetCfgsSize && i < EUCA_MAX_NICS); i++) {
-        if(strlen(src->secNetCfgs[i].interfaceId) == 0)
-            break;
-        memcpy(&(dst->secNetCfgs[i]), &(src->secNetCfgs), sizeof(netConfig));
+    memcpy(&(dst->ncnet), &(src->ncnet), sizeof(netConfig));
+    for(i = 0; (i < src->secNetCfgsSize && i < EUCA_MAX_NICS); i++) {
+        if(strlen(src->secNetCfgs[i].interfaceId) == 0)
+            break;
+        memcpy(&(dst->secNetCfgs[i]), &(src->secNetCfgs), sizeof(netConfig));
+    }
+
+    for (i = 0; i < 64; i++) {
+        snprintf(dst->groupNames[i], 64, "%s", src->groupNames[i]);
+    }
+
+    memcpy(dst->volumes, src->volumes, sizeof(ncVolume) * EUCA_MAX_VOLUMES);
+    for (i = 0; i < EUCA_MAX_VOLUMES; i++) {
+        if (strlen(dst->volumes[i].volumeId) == 0)
+            break;
+    }
+
+    memcpy(&(dst->params), &(src->ccvm), sizeof(virtualMachine));
+
+    dst->blkbytes = src->blkbytes;
+    dst->netbytes = src->netbytes;
+    dst->hasFloppy = src->hasFloppy;
+
+    return (0);
+}
+
+//!
+//! Tells when a process started, in clock ticks since boot, as proc(5)
+//! reports it.
+//!
+//! @param[in] pid the process
+//!
+//! @return the start time of the process, or -1 if there is no such process or it has exited
+//!
+static long long process_started(pid_t pid)
+{
+    int i = 0;
+    char *p = NULL;
+    char *field = NULL;
+    char *save = NULL;
+    char file[EUCA_MAX_PATH] = "";
+    char buf[1024] = "";
+    FILE *FH = NULL;
+
+    snprintf(file, EUCA_MAX_PATH, "/proc/%d/stat", pid);
+    if ((FH = fopen(file, "r")) == NULL)
+        return (-1);
+    p = fgets(buf, sizeof(buf), FH);
+    fclose(FH);
+
+    // skip past the command name, which may hold spaces and parentheses
+    if ((p == NULL) || ((p = strrchr(buf, ')')) == NULL))
+        return (-1);
+
+    // the state is the first field after it, the start time the 20th
+    for (i = 0, field = strtok_r(p + 1, " ", &save); field != NULL; i++, field = strtok_r(NULL, " ", &save)) {
+        if ((i == 0) && ((field[0] == 'Z') || (field[0] == 'X')))
+            return (-1);
+        if (i == 19)
+            return (atoll(field));
+    }
+    return (-1);
+}
+
+//!
+//! Registers the caller as placing instances, which it may then do without
+//! holding RESCACHE: entries of resourceCache[] do not move while there are
+//! placers, as the only thing that moves them, the removal of a node, waits
+//! for a moment without any. The capacity of a node is claimed with
+//! resource_reserve(), so requests placing on different nodes do not get
+//! in each other's way.
+//!
+//! The placement takes a slot of resourceCache->placements[], which records
+//! the process and what it reserves. Should the process die before it calls
+//! placement_exit(), reap_placements() gives it all back.
+//!
+//! @param[in] vm pointer to the VM to be placed
+//!
+//! @return the slot of the placement
+//!
+//! @see placement_exit()
+//!
+static ccPlacement *placement_enter(virtualMachine * vm)
+{
+    int i = 0;
+    pid_t pid = getpid();
+    ccPlacement *pl = NULL;
+
+    for (;;) {
+        for (i = 0, pl = NULL; (i < MAXPLACEMENTS) && (pl == NULL); i++) {
+            if ((resourceCache->placements[i].pid == 0) && __sync_bool_compare_and_swap(&(resourceCache->placements[i].pid), 0, pid))
+                pl = &(resourceCache->placements[i]);
+        }
+
+        if (pl == NULL) {
+            LOGDEBUG("all %d placement slots are taken, waiting for one\n", MAXPLACEMENTS);
+            usleep(100000);
+        } else if (((volatile ccResourceCache *)resourceCache)->purging) {
+            // a node is being removed, which is done under RESCACHE: wait it out
+            pl->pid = 0;
+            sem_mywait(RESCACHE);
+            sem_mypost(RESCACHE);
+        } else {
+            break;
+        }
+    }
+
+    pl->started = process_started(pid);
+    pl->mem = vm->mem;
+    pl->disk = vm->disk;
+    pl->cores = vm->cores;
+    bzero(pl->reserved, sizeof(pl->reserved));
+    return (pl);
+}
+
+//!
+//! Gives back whatever capacity a placement still holds and frees its slot.
+//!
+//! @param[in] pl pointer to the slot of the placement
+//!
+//! @pre The owner of the slot is done with it, or dead (see reap_placements()).
+//!
+static void placement_drop(ccPlacement * pl)
+{
+    int i = 0;
+    int count = 0;
+
+    for (i = 0; i < MAXNODES; i++) {
+        if ((count = pl->reserved[i]) > 0) {
+            pl->reserved[i] = 0;
+            __sync_sub_and_fetch(&(resourceCache->resources[i].reservedMemory), (pl->mem * count));
+            __sync_sub_and_fetch(&(resourceCache->resources[i].reservedDisk), (pl->disk * count));
+            __sync_sub_and_fetch(&(resourceCache->resources[i].reservedCores), (pl->cores * count));
+        }
+    }
+    pl->started = 0;
+    __sync_synchronize();
+    pl->pid = 0;
+}
+
+//!
+//! Ends what placement_enter() started.
+//!
+//! @param[in] pl pointer to the slot of the placement
+//!
+static void placement_exit(ccPlacement * pl)
+{
+    placement_drop(pl);
+}
+
+//!
+//! Tells whether any request is placing instances.
+//!
+//! @return TRUE if a slot of resourceCache->placements[] is taken or FALSE otherwise
+//!
+static boolean placement_busy(void)
+{
+    int i = 0;
+
+    for (i = 0; i < MAXPLACEMENTS; i++) {
+        if (resourceCache->placements[i].pid != 0)
+            return (TRUE);
+    }
+    return (FALSE);
+}
+
+//!
+//! Gives back the capacity held by placements whose process is gone, such
+//! as a CC worker killed in the middle of a RunInstances request, which
+//! would otherwise keep it from every later placement, and keep nodes from
+//! being removed from the cache.
+//!
+//! @pre The caller must hold the RESCACHE lock.
+//!
+static void reap_placements(void)
+{
+    int i = 0;
+    pid_t pid = 0;
+    long long started = 0;
+    ccPlacement *pl = NULL;
+
+    for (i = 0; i < MAXPLACEMENTS; i++) {
+        pl = &(resourceCache->placements[i]);
+        if ((pid = pl->pid) <= 0)
+            continue;
+
+        // a live process with the recorded start time (or not recorded yet) is the owner
+        started = process_started(pid);
+        if ((started >= 0) && ((pl->started == 0) || (pl->started == started)))
+            continue;
+
+        // the owner may have freed the slot, and another taken it, since we looked
+        if (!__sync_bool_compare_and_swap(&(pl->pid), pid, -1))
+            continue;
+
+        LOGWARN("process %d exited while placing instances, releasing the capacity it held\n", pid);
+        placement_drop(pl);
     }
+}
 
-    for (i = 0; i < 64; i++) {
-        snprintf(dst->groupNames[i], 64, "%s", src->groupNames[i]);
+//!
+//! Takes some of one kind of capacity of a node for a placement, unless the
+//! node no longer has that much free. Concurrent placements on the same node
+//! race on the compare-and-swap, and the losers check again.
+//!
+//! @param[in] reserved pointer to the node's counter of reserved capacity of this kind
+//! @param[in] avail pointer to the capacity of this kind the node last reported
+//! @param[in] committed pointer to the node's counter of committed capacity of this kind
+//! @param[in] need how much of the capacity the placement needs
+//!
+//! @return TRUE if the capacity was taken or FALSE if the node does not have it
+//!
+static boolean resource_take(volatile int *reserved, volatile int *avail, volatile int *committed, int need)
+{
+    int old = 0;
+
+    do {
+        old = *reserved;
+        if ((*avail - *committed - old) < need)
+            return (FALSE);
+    } while (!__sync_bool_compare_and_swap(reserved, old, (old + need)));
+    return (TRUE);
+}
+
+//!
+//! Reserves the memory, disk and cores of a VM on a node, all or nothing.
+//! The reservation is held until the node answers the launch, at which
+//! point resource_commit() or resource_release() disposes of it.
+//!
+//! The slot of the placement only counts the reservation once it is taken,
+//! and stops counting it before it is given back, so that should the process
+//! die in between, some capacity stays reserved until the node reports
+//! again rather than being given back twice.
+//!
+//! @param[in] pl pointer to the slot of the placement
+//! @param[in] resid index of the node in resourceCache->resources[]
+//!
+//! @return TRUE if the capacity was reserved or FALSE if the node no longer has it
+//!
+static boolean resource_reserve(ccPlacement * pl, int resid)
+{
+    ccResource *res = &(resourceCache->resources[resid]);
+
+    if (!resource_take(&(res->reservedMemory), &(res->availMemory), &(res->committedMemory), pl->mem))
+        return (FALSE);
+
+    if (!resource_take(&(res->reservedDisk), &(res->availDisk), &(res->committedDisk), pl->disk)) {
+        __sync_sub_and_fetch(&(res->reservedMemory), pl->mem);
+        return (FALSE);
     }
 
-    memcpy(dst->volumes, src->volumes, sizeof(ncVolume) * EUCA_MAX_VOLUMES);
-    for (i = 0; i < EUCA_MAX_VOLUMES; i++) {
-        if (strlen(dst->volumes[i].volumeId) == 0)
-            break;
+    if (!resource_take(&(res->reservedCores), &(res->availCores), &(res->committedCores), pl->cores)) {
+        __sync_sub_and_fetch(&(res->reservedMemory), pl->mem);
+        __sync_sub_and_fetch(&(res->reservedDisk), pl->disk);
+        return (FALSE);
     }
+    pl->reserved[resid]++;
+    return (TRUE);
+}
 
-    memcpy(&(dst->params), &(src->ccvm), sizeof(virtualMachine));
+//!
+//! Turns the reservation of a VM the node accepted into committed capacity,
+//! which stays deducted until a report of the node accounts for the VM (see
+//! refresh_resourceCache()). Commits first and releases second, so that the
+//! capacity never looks free in between.
+//!
+//! @param[in] pl pointer to the slot of the placement
+//! @param[in] resid index of the node in resourceCache->resources[]
+//!
+static void resource_commit(ccPlacement * pl, int resid)
+{
+    ccResource *res = &(resourceCache->resources[resid]);
 
-    dst->blkbytes = src->blkbytes;
-    dst->netbytes = src->netbytes;
-    dst->hasFloppy = src->hasFloppy;
+    __sync_add_and_fetch(&(res->committedMemory), pl->mem);
+    __sync_add_and_fetch(&(res->committedDisk), pl->disk);
+    __sync_add_and_fetch(&(res->committedCores), pl->cores);
+    resource_release(pl, resid);
+}
 
-    return (0);
+//!
+//! Gives back the reservation of a VM, when the node did not launch it.
+//!
+//! @param[in] pl pointer to the slot of the placement
+//! @param[in] resid index of the node in resourceCache->resources[]
+//!
+static void resource_release(ccPlacement * pl, int resid)
+{
+    ccResource *res = &(resourceCache->resources[resid]);
+
+    pl->reserved[resid]--;
+    __sync_sub_and_fetch(&(res->reservedMemory), pl->mem);
+    __sync_sub_and_fetch(&(res->reservedDisk), pl->disk);
+    __sync_sub_and_fetch(&(res->reservedCores), pl->cores);
 }
 
 //!
@@ -3136,6 +4374,8 @@ int schedule_instance(virtualMachine * vm, char *amiId, char *kernelId, char *ra
         ret = schedule_instance_greedy(vm, outresid);
     } else if (config->schedPolicy == SCHEDUSER) {
         ret = schedule_instance_user(vm, amiId, kernelId, ramdiskId, instId, userData, platform, outresid);
+    } else if (config->schedPolicy == SCHEDCACHEAFFINITY) {
+        ret = schedule_instance_cacheaffinity(vm, outresid);
     } else {
         ret = schedule_instance_greedy(vm, outresid);
     }
@@ -3163,46 +4403,177 @@ int schedule_instance_roundrobin(virtualMachine * vm, int *outresid)
     *outresid = 0;
 
     LOGDEBUG("scheduler using ROUNDROBIN policy to find next resource\n");
-    // find the best 'resource' on which to run the instance
-    done = found = 0;
-    start = config->schedState;
-    i = start;
-
-    LOGDEBUG("scheduler state starting at resource %d\n", config->schedState);
-    while (!done) {
-        int mem, disk, cores;
+    // concurrent placements do not hold CONFIG, so the state only moves on if no other placement moved it meanwhile
+    do {
+        // find the best 'resource' on which to run the instance
+        done = found = 0;
+        start = config->schedState;
+        i = start;
+
+        LOGDEBUG("scheduler state starting at resource %d\n", start);
+        while (!done) {
+            int mem, disk, cores;
 
-        res = &(resourceCache->resources[i]);
-        if ((res->state != RESDOWN) && (res->ncState == ENABLED)) {
-            mem = res->availMemory - vm->mem;
-            disk = res->availDisk - vm->disk;
-            cores = res->availCores - vm->cores;
+            res = &(resourceCache->resources[i]);
+            if ((res->state != RESDOWN) && (res->ncState == ENABLED)) {
+                mem = RES_FREE_MEMORY(res) - vm->mem;
+                disk = RES_FREE_DISK(res) - vm->disk;
+                cores = RES_FREE_CORES(res) - vm->cores;
 
-            if (mem >= 0 && disk >= 0 && cores >= 0) {
-                resid = i;
-                found = 1;
+                if (mem >= 0 && disk >= 0 && cores >= 0) {
+                    resid = i;
+                    found = 1;
+                    done++;
+                }
+            }
+            i++;
+            if (i >= resourceCache->numResources) {
+                i = 0;
+            }
+            if (i == start) {
                 done++;
             }
         }
-        i++;
-        if (i >= resourceCache->numResources) {
-            i = 0;
+
+        if (!found) {
+            // didn't find a resource
+            return (1);
         }
-        if (i == start) {
-            done++;
+    } while (!__sync_bool_compare_and_swap(&(config->schedState), start, i));
+
+    *outresid = resid;
+
+    LOGDEBUG("scheduler state finishing at resource %d\n", i);
+
+    return (0);
+}
+
+//!
+//! Scores how much of a VM's boot images a node already holds in its cache.
+//! The EMI weighs the most since it is by far the largest download.
+//!
+//! @param[in] res pointer to the node's resource entry
+//! @param[in] vm pointer to the VM to be placed
+//!
+//! @return the score, 0 when none of the images are cached on the node
+//!
+static int cache_affinity_score(ccResource * res, virtualMachine * vm)
+{
+    int i = 0;
+    int j = 0;
+    int score = 0;
+    virtualBootRecord *vbr = NULL;
+
+    for (i = 0; i < vm->virtualBootRecordLen; i++) {
+        vbr = &(vm->virtualBootRecord[i]);
+        for (j = 0; j < res->cachedImagesLen; j++) {
+            if (!strcmp(res->cachedImages[j], vbr->id)) {
+                if (!strcmp(vbr->typeName, "machine"))
+                    score += 4;
+                else if (!strcmp(vbr->typeName, "kernel") || !strcmp(vbr->typeName, "ramdisk"))
+                    score += 1;
+                break;
+            }
         }
     }
+    return (score);
+}
 
-    if (!found) {
-        // didn't find a resource
-        return (1);
+//!
+//! Adds a VM's boot images to the cache inventory of the node it was just
+//! placed on. The node is fetching them from now on, so further instances
+//! of the same images should follow it there rather than start another
+//! download elsewhere before the node's next report catches up. Entries
+//! are claimed with a compare-and-swap, since placements on the same node
+//! may be noting images at the same time.
+//!
+//! @param[in] res pointer to the node's resource entry
+//! @param[in] vm pointer to the VM placed on the node
+//!
+static void cache_affinity_note(ccResource * res, virtualMachine * vm)
+{
+    int i = 0;
+    int j = 0;
+    int len = 0;
+    virtualBootRecord *vbr = NULL;
+
+    for (i = 0; i < vm->virtualBootRecordLen; i++) {
+        vbr = &(vm->virtualBootRecord[i]);
+        if (strcmp(vbr->typeName, "machine") && strcmp(vbr->typeName, "kernel") && strcmp(vbr->typeName, "ramdisk"))
+            continue;
+        if (strlen(vbr->id) >= IMAGE_ID_LEN)
+            continue;
+        do {
+            if ((len = ((volatile ccResource *)res)->cachedImagesLen) >= EUCA_MAX_CACHED_IMAGES)
+                return;
+            for (j = 0; (j < len) && strcmp(res->cachedImages[j], vbr->id); j++) ;
+        } while ((j == len) && !__sync_bool_compare_and_swap(&(res->cachedImagesLen), len, (len + 1)));
+        if (j == len)
+            euca_strncpy(res->cachedImages[len], vbr->id, IMAGE_ID_LEN);
     }
+}
 
-    *outresid = resid;
-    config->schedState = i;
+//!
+//! Places a VM on the node whose cache holds the most of its boot images,
+//! so that the NC clones them from its cache instead of downloading them.
+//! Nodes are considered in round-robin order and the first of the warmest
+//! ones wins, so equally warm (or equally cold) nodes share the load the
+//! way the ROUNDROBIN policy would.
+//!
+//! @param[in]  vm pointer to the VM to be placed
+//! @param[out] outresid index of the chosen resource
+//!
+//! @return 0 on success or 1 if no node has the capacity for the VM
+//!
+//! @pre The caller must hold the RESCACHE lock or be placing instances (see placement_enter()).
+//!
+int schedule_instance_cacheaffinity(virtualMachine * vm, int *outresid)
+{
+    int i = 0;
+    int n = 0;
+    int state = 0;
+    int start = 0;
+    int score = 0;
+    int resid = -1;
+    int bestScore = -1;
+    ccResource *res = NULL;
+
+    *outresid = 0;
+
+    LOGDEBUG("scheduler using CACHEAFFINITY policy to find next resource\n");
+    if (resourceCache->numResources <= 0)
+        return (1);
+
+    // concurrent placements do not hold CONFIG, so the state only moves on if no other placement moved it meanwhile
+    do {
+        resid = -1;
+        bestScore = -1;
+        state = config->schedState;
+        start = ((state >= 0) && (state < resourceCache->numResources)) ? (state) : (0);
+        for (n = 0; n < resourceCache->numResources; n++) {
+            i = (start + n) % resourceCache->numResources;
+            res = &(resourceCache->resources[i]);
+            if ((res->state == RESDOWN) || (res->ncState != ENABLED))
+                continue;
+            if (((RES_FREE_MEMORY(res) - vm->mem) < 0) || ((RES_FREE_DISK(res) - vm->disk) < 0) || ((RES_FREE_CORES(res) - vm->cores) < 0))
+                continue;
+
+            if ((score = cache_affinity_score(res, vm)) > bestScore) {
+                bestScore = score;
+                resid = i;
+            }
+        }
+
+        if (resid < 0) {
+            // didn't find a resource
+            return (1);
+        }
+    } while (!__sync_bool_compare_and_swap(&(config->schedState), state, ((resid + 1) % resourceCache->numResources)));
 
-    LOGDEBUG("scheduler state finishing at resource %d\n", config->schedState);
+    cache_affinity_note(&(resourceCache->resources[resid]), vm);
+    *outresid = resid;
 
+    LOGDEBUG("scheduler picked resource %d (%s) with cache score %d\n", resid, resourceCache->resources[resid].hostname, bestScore);
     return (0);
 }
 
@@ -3253,7 +4624,7 @@ static int schedule_instance_migration(ncInstance * instance, char **includeNode
             goto out;
         }
     } else {
-        if (config->schedPolicy == SCHEDROUNDROBIN) {
+        if ((config->schedPolicy == SCHEDROUNDROBIN) || (config->schedPolicy == SCHEDCACHEAFFINITY)) {
             LOGDEBUG("[%s] scheduling migration using ROUNDROBIN scheduler\n", instance->instanceId);
         } else if (config->schedPolicy == SCHEDGREEDY || config->schedPolicy == SCHEDPOWERSAVE) {
             LOGINFO
@@ -3360,9 +4731,9 @@ int schedule_instance_explicit(virtualMachine * vm, char *targetNode, int *outre
                 if (is_migration && (res->ncState == STOPPED)) {
                     LOGINFO("scheduler overriding STOPPED state of target node (due to explicit scheduling request)\n");
                 }
-                mem = res->availMemory - vm->mem;
-                disk = res->availDisk - vm->disk;
-                cores = res->availCores - vm->cores;
+                mem = RES_FREE_MEMORY(res) - vm->mem;
+                disk = RES_FREE_DISK(res) - vm->disk;
+                cores = RES_FREE_CORES(res) - vm->cores;
 
                 if (mem >= 0 && disk >= 0 && cores >= 0) {
                     resid = i;
@@ -3371,9 +4742,9 @@ int schedule_instance_explicit(virtualMachine * vm, char *targetNode, int *outre
                 if (is_migration && (res->ncState == STOPPED)) {
                     LOGINFO("scheduler overriding STOPPED state of target node (due to explicit scheduling request)\n");
                 }
-                mem = res->availMemory - vm->mem;
-                disk = res->availDisk - vm->disk;
-                cores = res->availCores - vm->cores;
+                mem = RES_FREE_MEMORY(res) - vm->mem;
+                disk = RES_FREE_DISK(res) - vm->disk;
+                cores = RES_FREE_CORES(res) - vm->cores;
 
                 if (mem >= 0 && disk >= 0 && cores >= 0) {
                     sleepresid = i;
@@ -3433,18 +4804,18 @@ int schedule_instance_greedy(virtualMachine * vm, int *outresid)
 
         res = &(resourceCache->resources[i]);
         if ((res->state == RESUP || res->state == RESWAKING) && (resid == -1) && (res->ncState == ENABLED)) {
-            mem = res->availMemory - vm->mem;
-            disk = res->availDisk - vm->disk;
-            cores = res->availCores - vm->cores;
+            mem = RES_FREE_MEMORY(res) - vm->mem;
+            disk = RES_FREE_DISK(res) - vm->disk;
+            cores = RES_FREE_CORES(res) - vm->cores;
 
             if (mem >= 0 && disk >= 0 && cores >= 0) {
                 resid = i;
                 done++;
             }
         } else if ((res->state == RESASLEEP) && (sleepresid == -1) && (res->ncState == ENABLED)) {
-            mem = res->availMemory - vm->mem;
-            disk = res->availDisk - vm->disk;
-            cores = res->availCores - vm->cores;
+            mem = RES_FREE_MEMORY(res) - vm->mem;
+            disk = RES_FREE_DISK(res) - vm->disk;
+            cores = RES_FREE_CORES(res) - vm->cores;
 
             if (mem >= 0 && disk >= 0 && cores >= 0) {
                 sleepresid = i;
@@ -3594,6 +4965,187 @@ static void print_abbreviated_instances(const char *gerund, char **instIds, int
     LOGINFO("%s %d instance(s): %s\n", gerund, instIdsLen, list);
 }
 
+//!
+//! Drops a reference to a RunInstances request, freeing it with the last one.
+//!
+//! @param[in] req pointer to the request
+//!
+static void run_request_put(ccRunRequest * req)
+{
+    int i = 0;
+
+    if (__sync_sub_and_fetch(&(req->refs), 1) > 0)
+        return;
+
+    for (i = 0; i < req->netNamesLen; i++)
+        EUCA_FREE(req->netNames[i]);
+    for (i = 0; i < req->netIdsLen; i++)
+        EUCA_FREE(req->netIds[i]);
+    EUCA_FREE(req->netNames);
+    EUCA_FREE(req->netIds);
+    EUCA_FREE(req->secNetCfgs);
+    EUCA_FREE(req->instIds);
+    EUCA_FREE(req->uuids);
+    EUCA_FREE(req->ncnets);
+    EUCA_FREE(req->launched);
+    EUCA_FREE(req->meta.correlationId);
+    EUCA_FREE(req->meta.userId);
+    EUCA_FREE(req->reservationId);
+    EUCA_FREE(req->amiId);
+    EUCA_FREE(req->amiURL);
+    EUCA_FREE(req->kernelId);
+    EUCA_FREE(req->kernelURL);
+    EUCA_FREE(req->ramdiskId);
+    EUCA_FREE(req->ramdiskURL);
+    EUCA_FREE(req->ownerId);
+    EUCA_FREE(req->accountId);
+    EUCA_FREE(req->keyName);
+    EUCA_FREE(req->userData);
+    EUCA_FREE(req->credential);
+    EUCA_FREE(req->launchIndex);
+    EUCA_FREE(req->platform);
+    EUCA_FREE(req->rootDirective);
+    EUCA_FREE(req);
+}
+
+//!
+//! Records the instances a run task started in req->launched[]. Goes through
+//! ncpool_publish(), so that a task still running after doRunInstances() gave
+//! up on it leaves req->launched[] alone: by then the instances it was sent
+//! have been released, and may be on their way to another node.
+//!
+//! @param[in] arg a pointer to the ccRunBatch of the task
+//!
+static void run_publish_entry(void *arg)
+{
+    int i = 0;
+    ccRunBatch *batch = ((ccRunBatch *) arg);
+
+    for (i = 0; i < batch->slotsLen; i++) {
+        if (batch->started[i])
+            batch->req->launched[batch->slots[i]] = batch->resid;
+    }
+}
+
+//!
+//! Per-node task of doRunInstances(): starts a node's share of the instances
+//! with a single ncRunInstances call. Should the node not take the batched
+//! call (an older NC, or one still waking up), the instances are sent one by
+//! one with ncRunInstance, retrying each for up to req->ncRunTimeout seconds.
+//! The instances started are recorded in req->launched[] (see
+//! run_publish_entry()) or, if doRunInstances() stopped waiting for the node
+//! in the meantime, terminated, since they may be rescheduled elsewhere.
+//!
+//! @param[in] arg pointer to the ccRunBatch, which the task frees
+//!
+//! @return 0 if all of the batch's instances were started, 1 otherwise
+//!
+static int run_instances_node(void *arg)
+{
+    int i = 0;
+    int k = 0;
+    int rc = 0;
+    int slot = 0;
+    int started = 0;
+    int outInstsLen = 0;
+    int shutdownState = 0;
+    int previousState = 0;
+    char **uuids = NULL;
+    char **instIds = NULL;
+    time_t startRun = 0;
+    ncMetadata meta = { 0 };
+    netConfig *ncnets = NULL;
+    ncInstance *outInst = NULL;
+    ncInstance **outInsts = NULL;
+    ccRunBatch *batch = ((ccRunBatch *) arg);
+    ccRunRequest *req = batch->req;
+
+    if (((uuids = EUCA_ZALLOC(batch->slotsLen, sizeof(char *))) == NULL) || ((instIds = EUCA_ZALLOC(batch->slotsLen, sizeof(char *))) == NULL)
+        || ((ncnets = EUCA_ZALLOC(batch->slotsLen, sizeof(netConfig))) == NULL)
+        || ((batch->started = EUCA_ZALLOC(batch->slotsLen, sizeof(boolean))) == NULL)) {
+        LOGFATAL("out of memory!\n");
+        unlock_exit(1);
+    }
+    for (i = 0; i < batch->slotsLen; i++) {
+        slot = batch->slots[i];
+        uuids[i] = req->uuids[slot];
+        instIds[i] = req->instIds[slot];
+        memcpy(&(ncnets[i]), &(req->ncnets[slot]), sizeof(netConfig));
+    }
+
+    // the NC calls may write to the metadata, so each task gets its own
+    memcpy(&meta, &(req->meta), sizeof(ncMetadata));
+    meta.replyString = NULL;
+
+    LOGDEBUG("sending run request for %d instance(s) of reservation %s to node %s\n", batch->slotsLen, req->reservationId, batch->ncURL);
+    rc = ncClientCall(&meta, OP_TIMEOUT_PERNODE, batch->lockidx, batch->ncURL, "ncRunInstances", uuids, instIds, ncnets, batch->slotsLen, req->reservationId,
+                      &(batch->ncvm), req->amiId, req->amiURL, req->kernelId, req->kernelURL, req->ramdiskId, req->ramdiskURL, req->ownerId, req->accountId,
+                      req->keyName, req->userData, req->credential, req->launchIndex, req->platform, req->expiryTime, req->netNames, req->netNamesLen,
+                      req->rootDirective, req->netIds, req->netIdsLen, req->secNetCfgs, req->secNetCfgsLen, &outInsts, &outInstsLen);
+    if (!rc) {
+        for (k = 0; k < outInstsLen; k++) {
+            for (i = 0; outInsts[k] && (i < batch->slotsLen); i++) {
+                if (!strcmp(outInsts[k]->instanceId, instIds[i])) {
+                    batch->started[i] = TRUE;
+                    started++;
+                    break;
+                }
+            }
+        }
+    } else {
+        LOGWARN("batched run request failed on node %s, sending its %d instance(s) one at a time\n", batch->ncURL, batch->slotsLen);
+        for (i = 0; i < batch->slotsLen; i++) {
+            rc = 1;
+            startRun = time(NULL);
+            while (rc && ((time(NULL) - startRun) < req->ncRunTimeout)) {
+                outInst = NULL;
+                rc = ncClientCall(&meta, OP_TIMEOUT_PERNODE, batch->lockidx, batch->ncURL, "ncRunInstance", uuids[i], instIds[i], req->reservationId,
+                                  &(batch->ncvm), req->amiId, req->amiURL, req->kernelId, req->kernelURL, req->ramdiskId, req->ramdiskURL, req->ownerId,
+                                  req->accountId, req->keyName, &(ncnets[i]), req->userData, req->credential, req->launchIndex, req->platform, req->expiryTime,
+                                  req->netNames, req->netNamesLen, req->rootDirective, req->netIds, req->netIdsLen, req->secNetCfgs, req->secNetCfgsLen,
+                                  &outInst);
+                LOGDEBUG("sent run request for instance '%s' on resource '%s': result '%s'\n", instIds[i], batch->ncURL, rc ? "FAIL" : "SUCCESS");
+                EUCA_FREE(outInst);
+                if (rc)
+                    sleep(1);
+            }
+            if (rc) {
+                // the node is not taking instances, leave the rest to be rescheduled
+                break;
+            }
+            batch->started[i] = TRUE;
+            started++;
+        }
+    }
+    LOGDEBUG("node %s started %d of %d instance(s)\n", batch->ncURL, started, batch->slotsLen);
+
+    if ((started > 0) && (ncpool_publish(run_publish_entry, batch) != EUCA_OK)) {
+        LOGWARN("node %s started %d instance(s) of reservation %s after the request gave up on it, terminating them\n", batch->ncURL, started,
+                req->reservationId);
+        for (i = 0; i < batch->slotsLen; i++) {
+            if (!batch->started[i])
+                continue;
+            if (ncClientCall(&meta, OP_TIMEOUT_PERNODE, batch->lockidx, batch->ncURL, "ncTerminateInstance", instIds[i], 1, &shutdownState, &previousState)) {
+                LOGERROR("failed to terminate instance %s on node %s, which the CC does not count as running there\n", instIds[i], batch->ncURL);
+            }
+        }
+        started = 0;
+    }
+
+    for (k = 0; k < outInstsLen; k++)
+        EUCA_FREE(outInsts[k]);
+    EUCA_FREE(outInsts);
+    EUCA_FREE(meta.replyString);
+    EUCA_FREE(uuids);
+    EUCA_FREE(instIds);
+    EUCA_FREE(ncnets);
+    EUCA_FREE(batch->started);
+    rc = ((started == batch->slotsLen) ? 0 : 1);
+    run_request_put(req);
+    EUCA_FREE(batch);
+    return (rc);
+}
+
 //!
 //!
 //!
@@ -3643,17 +5195,21 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
                    char *platform, int expiryTime, char *targetNode, char *rootDirective, char *eniAttachmentId, netConfig * secNetCfgs, int secNetCfgsLen,
                    ccInstance ** outInsts, int *outInstsLen)
 {
-    int rc = 0, i = 0, done = 0, runCount = 0, resid = 0, foundnet = 0, error = 0, nidx = 0, thenidx = 0, pid = 0;
+    int rc = 0, i = 0, j = 0, done = 0, runCount = 0, resid = 0, foundnet = 0, error = 0, nidx = 0, thenidx = 0;
+    int tries = 0;
+    int batchesLen = 0;
+    int *resids = NULL;
     ccInstance *myInstance = NULL, *retInsts = NULL;
     char instId[16], uuid[48];
     ccResource *res = NULL;
+    ccPlacement *placement = NULL;
     char *mac = NULL;
     char privip[32] = "";
     char pubip[32] = "";
 
-    ncInstance *outInst = NULL;
-    virtualMachine ncvm;
-    netConfig ncnet;
+    netConfig *ncnet = NULL;
+    ccRunRequest *req = NULL;
+    ccRunBatch **batches = NULL;
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -3726,10 +5282,56 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
 
     runCount = 0;
 
-    // get updated resource information
-
-    done = 0;
-    for (i = 0; i < maxCount && !done; i++) {
+    if ((req = EUCA_ZALLOC(1, sizeof(ccRunRequest))) == NULL) {
+        LOGFATAL("out of memory!\n");
+        unlock_exit(1);
+    }
+    req->refs = 1;
+    memcpy(&(req->meta), pMeta, sizeof(ncMetadata));
+    req->meta.correlationId = euca_strdup(pMeta->correlationId);
+    req->meta.userId = euca_strdup(pMeta->userId);
+    req->meta.nodeName = NULL;
+    req->meta.replyString = NULL;
+    req->reservationId = euca_strdup(reservationId);
+    req->amiId = euca_strdup(amiId);
+    req->amiURL = euca_strdup(amiURL);
+    req->kernelId = euca_strdup(kernelId);
+    req->kernelURL = euca_strdup(kernelURL);
+    req->ramdiskId = euca_strdup(ramdiskId);
+    req->ramdiskURL = euca_strdup(ramdiskURL);
+    req->ownerId = euca_strdup(ownerId);
+    req->accountId = euca_strdup(accountId);
+    req->keyName = euca_strdup(keyName);
+    req->userData = euca_strdup(userData);
+    req->credential = euca_strdup(credential);
+    req->launchIndex = euca_strdup(launchIndex);
+    req->platform = euca_strdup(platform);
+    req->rootDirective = euca_strdup(rootDirective);
+    req->expiryTime = expiryTime;
+    req->netNamesLen = ((netNamesLen > 0) ? netNamesLen : 0);
+    req->netIdsLen = ((netIdsLen > 0) ? netIdsLen : 0);
+    req->secNetCfgsLen = ((secNetCfgsLen > 0) ? secNetCfgsLen : 0);
+    req->instancesLen = maxCount;
+    req->ncRunTimeout = ((config->schedPolicy == SCHEDPOWERSAVE) ? config->wakeThresh : 15);
+    if (((req->netNames = EUCA_ZALLOC((req->netNamesLen + 1), sizeof(char *))) == NULL) || ((req->netIds = EUCA_ZALLOC((req->netIdsLen + 1), sizeof(char *))) == NULL)
+        || ((req->secNetCfgs = EUCA_ZALLOC((req->secNetCfgsLen + 1), sizeof(netConfig))) == NULL)
+        || ((req->instIds = EUCA_ZALLOC(maxCount, sizeof(*(req->instIds)))) == NULL) || ((req->uuids = EUCA_ZALLOC(maxCount, sizeof(*(req->uuids)))) == NULL)
+        || ((req->ncnets = EUCA_ZALLOC(maxCount, sizeof(netConfig))) == NULL) || ((req->launched = EUCA_ZALLOC(maxCount, sizeof(int))) == NULL)
+        || ((resids = EUCA_ZALLOC(maxCount, sizeof(int))) == NULL) || ((batches = EUCA_ZALLOC(maxCount, sizeof(ccRunBatch *))) == NULL)) {
+        LOGFATAL("out of memory!\n");
+        unlock_exit(1);
+    }
+    for (i = 0; i < req->netNamesLen; i++)
+        req->netNames[i] = euca_strdup(netNames[i]);
+    for (i = 0; i < req->netIdsLen; i++)
+        req->netIds[i] = euca_strdup(netIds[i]);
+    if (req->secNetCfgsLen > 0)
+        memcpy(req->secNetCfgs, secNetCfgs, (req->secNetCfgsLen * sizeof(netConfig)));
+
+    // work out the network configuration of every instance up front
+    for (i = 0; i < maxCount; i++) {
+        req->launched[i] = -1;
+        resids[i] = -1;
         mac = EUCA_ZALLOC(32, sizeof(char)); 
 
         snprintf(instId, 16, "%s", instIds[i]);
@@ -3791,159 +5393,167 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
 
         if (mac[0] == '\0' || !foundnet) {
             LOGERROR("could not find/initialize any free network address, failing doRunInstances()\n");
+            resids[i] = -2;            // never to be scheduled
         } else {
-            // "run" the instance
-            memcpy(&ncvm, ccvm, sizeof(virtualMachine));
-
-            snprintf(ncnet.interfaceId, ENI_ID_LEN, "%s", instId);
-            ncnet.device = 0; // primary network interface is always device 0
-            ncnet.vlan = vlan;
+            ncnet = &(req->ncnets[i]);
+            snprintf(req->instIds[i], 16, "%s", instId);
+            snprintf(req->uuids[i], 48, "%s", uuid);
+            snprintf(ncnet->interfaceId, ENI_ID_LEN, "%s", instId);
+            ncnet->device = 0;         // primary network interface is always device 0
+            ncnet->vlan = vlan;
             if (thenidx >= 0) {
-                ncnet.networkIndex = networkIndexList[thenidx];
+                ncnet->networkIndex = networkIndexList[thenidx];
             } else {
-                ncnet.networkIndex = -1;
+                ncnet->networkIndex = -1;
             }
-            snprintf(ncnet.privateMac, ENET_ADDR_LEN, "%s", mac);
-            snprintf(ncnet.privateIp, INET_ADDR_LEN, "%s", privip);
-            snprintf(ncnet.publicIp, INET_ADDR_LEN, "%s", pubip);
+            snprintf(ncnet->privateMac, ENET_ADDR_LEN, "%s", mac);
+            snprintf(ncnet->privateIp, INET_ADDR_LEN, "%s", privip);
+            snprintf(ncnet->publicIp, INET_ADDR_LEN, "%s", pubip);
             if (eniAttachmentId != NULL)
-                snprintf(ncnet.attachmentId, ENI_ATTACHMENT_ID_LEN, "%s", eniAttachmentId);
+                snprintf(ncnet->attachmentId, ENI_ATTACHMENT_ID_LEN, "%s", eniAttachmentId);
             else
-                ncnet.attachmentId[0] = '\0';
-
-            sem_mywait(RESCACHE);
-
-            resid = 0;
-
-            sem_mywait(CONFIG);
-            rc = schedule_instance(ccvm, amiId, kernelId, ramdiskId, instId, userData, platform, targetNode, &resid);
-            sem_mypost(CONFIG);
+                ncnet->attachmentId[0] = '\0';
+        }
+        EUCA_FREE(mac);
+    }
 
-            res = &(resourceCache->resources[resid]);
+    //
+    // Each round schedules the instances not yet running, sends every node its share of them in a single
+    // ncRunInstances request, all nodes at once, and takes stock. Nodes that fail an instance are marked
+    // down, so the next round reschedules it elsewhere, until all are running or there is no room left.
+    //
+    // None of it holds RESCACHE: the capacity of the chosen nodes is reserved atomically instead, so that
+    // concurrent requests placing instances on different nodes proceed side by side.
+    //
+    placement = placement_enter(ccvm);
+    for (done = 0; !done;) {
+        batchesLen = 0;
+
+        for (i = 0; i < maxCount; i++) {
+            if ((resids[i] != -1) || (req->launched[i] >= 0))
+                continue;
+
+            // another request may take the capacity between the look of the scheduler and our reservation
+            for (tries = 0; tries <= resourceCache->numResources; tries++) {
+                resid = 0;
+                if ((rc = schedule_instance(ccvm, amiId, kernelId, ramdiskId, req->instIds[i], userData, platform, targetNode, &resid)) != 0)
+                    break;
+                if (resource_reserve(placement, resid))
+                    break;
+                rc = 1;
+            }
             if (rc) {
                 // could not find resource
                 LOGERROR("scheduler could not find resource to run the instance on\n");
-                // couldn't run this VM, remove networking information from system
-                //                free_instanceNetwork(mac, vlan, 1, 1);
-            } else {
-                int ret;
-
-                // try to run the instance on the chosen resource
-                LOGINFO("scheduler decided to run instance %s on resource %s, running count %d\n", instId, res->ncURL, res->running);
-
-                outInst = NULL;
-
-                pid = fork();
-                if (pid == 0) {
-                    time_t startRun, ncRunTimeout;
+                break;
+            }
 
-                    ret = 0;
-                    LOGTRACE("sending run instance: node=%s instanceId=%s emiId=%s mac=%s privIp=%s pubIp=%s vlan=%d networkIdx=%d key=%.32s... "
-                             "mem=%d disk=%d cores=%d\n", res->ncURL, instId, SP(amiId), ncnet.privateMac, ncnet.privateIp, ncnet.publicIp,
-                             ncnet.vlan, ncnet.networkIndex, SP(keyName), ncvm.mem, ncvm.disk, ncvm.cores);
+            // the reservation holds the capacity until we hear back from the node
+            res = &(resourceCache->resources[resid]);
+            resids[i] = resid;
+            LOGINFO("scheduler decided to run instance %s on resource %s, running count %d\n", req->instIds[i], res->ncURL, res->running);
 
-                    rc = 1;
-                    startRun = time(NULL);
-                    if (config->schedPolicy == SCHEDPOWERSAVE) {
-                        ncRunTimeout = config->wakeThresh;
-                    } else {
-                        ncRunTimeout = 15;
-                    }
+            for (j = 0; (j < batchesLen) && (batches[j]->resid != resid); j++) ;
+            if (j == batchesLen) {
+                if ((batches[j] = EUCA_ZALLOC(1, (sizeof(ccRunBatch) + (maxCount * sizeof(int))))) == NULL) {
+                    LOGFATAL("out of memory!\n");
+                    unlock_exit(1);
+                }
+                batches[j]->resid = resid;
+                batches[j]->lockidx = res->lockidx;
+                euca_strncpy(batches[j]->ncURL, res->ncURL, sizeof(batches[j]->ncURL));
+                memcpy(&(batches[j]->ncvm), ccvm, sizeof(virtualMachine));
+
+                // point the node at peers that have the images, so it need not download them from object storage
+                if ((config->imagePeerPort > 0) && !config->use_proxy) {
+                    image_peer_hints(&(batches[j]->ncvm), resid, j);
+                }
+                batchesLen++;
+            }
+            batches[j]->slots[batches[j]->slotsLen++] = i;
+        }
 
-                    while (rc && ((time(NULL) - startRun) < ncRunTimeout)) {
+        if (batchesLen == 0)
+            break;
 
-                        rc = ncClientCall(pMeta, OP_TIMEOUT_PERNODE, res->lockidx, res->ncURL, "ncRunInstance", uuid, instId, reservationId, &ncvm,
-                                          amiId, amiURL, kernelId, kernelURL, ramdiskId, ramdiskURL, ownerId, accountId, keyName, &ncnet, userData, credential,
-                                          launchIndex, platform, expiryTime, netNames, netNamesLen, rootDirective, netIds, netIdsLen, secNetCfgs, secNetCfgsLen, &outInst);
-                        LOGDEBUG("sent run request for instance '%s' on resource '%s': result '%s' uuis '%s'\n", instId, res->ncURL, uuid, rc ? "FAIL" : "SUCCESS");
-                        if (rc) {
-                            // make sure we get the latest topology information before trying again
-                            sem_mywait(CONFIG);
-                            memcpy(pMeta->services, config->services, sizeof(serviceInfoType) * 16);
-                            memcpy(pMeta->disabledServices, config->disabledServices, sizeof(serviceInfoType) * 16);
-                            memcpy(pMeta->notreadyServices, config->notreadyServices, sizeof(serviceInfoType) * 16);
-                            sem_mypost(CONFIG);
-                            sleep(1);
-                        }
-                    }
-                    if (!rc) {
-                        ret = 0;
-                    } else {
-                        ret = 1;
-                    }
+        for (j = 0; j < batchesLen; j++) {
+            __sync_add_and_fetch(&(req->refs), 1);
+            batches[j]->req = req;
+        }
 
-                    exit(ret);
-                } else {
-                    rc = 0;
-                    {
-                        int status;
+        // the tasks own (and free) their batch, even those still running past the deadline, which then
+        // terminate what they start rather than record it (see run_instances_node())
+        if (ncpool_enabled()) {
+            ncpool_run(run_instances_node, ((void **)batches), NULL, batchesLen, (OP_TIMEOUT - 5));
+        } else {
+            for (j = 0; j < batchesLen; j++)
+                run_instances_node(batches[j]);
+        }
 
-                        if (res->running > 0) {
-                            res->running++;
-                        }
-                        pid_t p = timewait(pid, &status, OP_TIMEOUT - 5);
-                        if (res->running > 0) {
-                            res->running--;
-                        }
+        for (i = 0, done = 1; i < maxCount; i++) {
+            if (resids[i] < 0)
+                continue;
 
-                        if (p > 0) {
-                            if (WIFEXITED(status)) {
-                                rc = WEXITSTATUS(status);
-                            } else {
-                                rc = 1; // child crashed
-                            }
-                        } else {
-                            rc = 1;    // timeout or error
-                        }
-                    }
-                    LOGDEBUG("call complete (pid/rc): %d/%d\n", pid, rc);
-                }
-                if (rc != 0) {
-                    // problem
+            resid = resids[i];
+            res = &(resourceCache->resources[resid]);
+            if (req->launched[i] != resid) {
+                // problem
+                if (res->state != RESDOWN) {
                     LOGERROR("tried to run the VM, but runInstance() failed; marking resource '%s' as down\n", res->ncURL);
                     res->state = RESDOWN;
-                    i--;
-                    // couldn't run this VM, remove networking information from system
-                    //                    free_instanceNetwork(mac, vlan, 1, 1);
-                } else {
-                    res->availMemory -= ccvm->mem;
-                    res->availDisk -= ccvm->disk;
-                    res->availCores -= ccvm->cores;
-
-                    LOGDEBUG("resource information after schedule/run: %d/%d, %d/%d, %d/%d\n", res->availMemory, res->maxMemory,
-                             res->availCores, res->maxCores, res->availDisk, res->maxDisk);
-
-                    myInstance = &(retInsts[runCount]);
-                    bzero(myInstance, sizeof(ccInstance));
+                }
+                resource_release(placement, resid);
+                resids[i] = -1;
+                done = 0;
+                // couldn't run this VM, remove networking information from system
+                //                    free_instanceNetwork(mac, vlan, 1, 1);
+                continue;
+            }
 
-                    allocate_ccInstance(myInstance, instId, amiId, kernelId, ramdiskId, amiURL, kernelURL, ramdiskURL, ownerId, accountId, "Pending",
-                                        "", time(NULL), reservationId, &ncnet, &ncnet, ccvm, resid, keyName, resourceCache->resources[resid].ncURL,
-                                        userData, launchIndex, platform, myInstance->guestStateName, myInstance->bundleTaskStateName, myInstance->groupNames, myInstance->groupIds,
-                                        myInstance->volumes, myInstance->volumesSize, myInstance->bundleTaskProgress, secNetCfgs, secNetCfgsLen);
-                    sensor_add_resource(myInstance->instanceId, "instance", uuid);
-                    sensor_set_resource_alias(myInstance->instanceId, myInstance->ncnet.privateIp);
+            resource_commit(placement, resid);
+            LOGDEBUG("resource information after schedule/run: %d/%d, %d/%d, %d/%d\n", RES_FREE_MEMORY(res), res->maxMemory,
+                     RES_FREE_CORES(res), res->maxCores, RES_FREE_DISK(res), res->maxDisk);
 
-                    // start up DHCP
-                    sem_mywait(CONFIG);
-                    config->kick_dhcp = 1;
-                    sem_mypost(CONFIG);
+            myInstance = &(retInsts[runCount]);
+            bzero(myInstance, sizeof(ccInstance));
 
-                    // add the instance to the cache, and continue on
-                    refresh_instanceCache(myInstance->instanceId, myInstance);
-                    print_ccInstance("", myInstance);
+            allocate_ccInstance(myInstance, req->instIds[i], amiId, kernelId, ramdiskId, amiURL, kernelURL, ramdiskURL, ownerId, accountId, "Pending",
+                                "", time(NULL), reservationId, &(req->ncnets[i]), &(req->ncnets[i]), ccvm, resid, keyName, resourceCache->resources[resid].ncURL,
+                                userData, launchIndex, platform, myInstance->guestStateName, myInstance->bundleTaskStateName, myInstance->groupNames, myInstance->groupIds,
+                                myInstance->volumes, myInstance->volumesSize, myInstance->bundleTaskProgress, secNetCfgs, secNetCfgsLen);
+            sensor_add_resource(myInstance->instanceId, "instance", req->uuids[i]);
+            sensor_set_resource_alias(myInstance->instanceId, myInstance->ncnet.privateIp);
 
-                    runCount++;
-                }
-            }
+            // add the instance to the cache, and continue on
+            refresh_instanceCache(myInstance->instanceId, myInstance);
+            print_ccInstance("", myInstance);
 
-            sem_mypost(RESCACHE);
+            resids[i] = -2;            // done with this one
+            runCount++;
+        }
 
+        if (runCount > 0) {
+            // start up DHCP
+            sem_mywait(CONFIG);
+            config->kick_dhcp = 1;
+            sem_mypost(CONFIG);
         }
-        EUCA_FREE(mac);
     }
+
+    placement_exit(placement);
+
+    run_request_put(req);
+    EUCA_FREE(batches);
+    EUCA_FREE(resids);
+
     *outInstsLen = runCount;
     *outInsts = retInsts;
 
+    // count the launches toward the image's trend, so the monitor can get it into more NC caches
+    if ((runCount > 0) && (config->prefetchNodes > 0) && !config->use_proxy) {
+        image_trend_record(ccvm, runCount);
+    }
+
     LOGTRACE("done\n");
 
     shawn();
@@ -3997,11 +5607,7 @@ int doGetConsoleOutput(ncMetadata * pMeta, char *instanceId, char **consoleOutpu
     LOGINFO("[%s] requesting console output\n", SP(instanceId));
     LOGDEBUG("invoked: instId=%s\n", SP(instanceId));
 
-    sem_mywait(RESCACHE);
-    {
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    }
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
         // found the instance in the cache
@@ -4066,9 +5672,7 @@ int doRebootInstances(ncMetadata * pMeta, char **instIds, int instIdsLen)
     LOGINFO("rebooting %d instances\n", instIdsLen);
     LOGDEBUG("invoked: instIdsLen=%d\n", instIdsLen);
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     for (i = 0; i < instIdsLen; i++) {
         instId = instIds[i];
@@ -4139,9 +5743,7 @@ int doTerminateInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, int
     LOGINFO("terminating instances\n");
     LOGDEBUG("invoked: userId=%s, instIdsLen=%d, firstInstId=%s, force=%d\n", SP(pMeta ? pMeta->userId : "UNSET"), instIdsLen, SP(instIdsLen ? instIds[0] : "UNSET"), force);
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     for (i = 0; i < instIdsLen; i++) {
         instId = instIds[i];
@@ -4233,9 +5835,7 @@ int doCreateImage(ncMetadata * pMeta, char *instanceId, char *volumeId, char *re
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
@@ -4425,9 +6025,7 @@ int doModifyNode(ncMetadata * pMeta, char *nodeName, char *stateName)
     }
     LOGINFO("modifying node %s with state=%s\n", SP(nodeName), SP(stateName));
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     for (i = 0; i < resourceCacheLocal.numResources && (src_index == -1); i++) {
         if (resourceCacheLocal.resources[i].state != RESASLEEP) {
@@ -4452,6 +6050,7 @@ int doModifyNode(ncMetadata * pMeta, char *nodeName, char *stateName)
 
     } else {                           // state change succeded => update nodeStatus and resource availability if the change succeeds
         sem_mywait(RESCACHE);
+        seqlock_write_begin(&(resourceCache->seq));
         for (i = 0; i < MAXNODES; i++) {
             if (!strcmp(resourceCache->resources[i].hostname, nodeName)) {
                 ccResource *res = &(resourceCache->resources[i]);
@@ -4464,6 +6063,7 @@ int doModifyNode(ncMetadata * pMeta, char *nodeName, char *stateName)
                 break;
             }
         }
+        seqlock_write_end(&(resourceCache->seq));
         sem_mypost(RESCACHE);
     }
 
@@ -4543,9 +6143,7 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     if (!instanceId) {
         for (i = 0; i < resourceCacheLocal.numResources && (src_index == -1); i++) {
@@ -4847,11 +6445,7 @@ int doStartInstance(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    {
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    }
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
         // found the instance in the cache
@@ -4919,11 +6513,7 @@ int doStopInstance(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    {
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    }
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
         // found the instance in the cache
@@ -5389,6 +6979,139 @@ int ccCheckState(int checkArbitrator)
     return (ret);
 }
 
+//!
+//! Opens the non-blocking UDP socket on which NCs push notice of their changes.
+//!
+//! @param[in] port the UDP port to listen on
+//!
+//! @return the socket or -1 on failure
+//!
+static int push_open(int port)
+{
+    int sock = -1;
+    struct sockaddr_in addr = { 0 };
+
+    if ((sock = socket(AF_INET, (SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC), 0)) < 0) {
+        LOGERROR("cannot create socket for NC notifications: %s\n", strerror(errno));
+        return (-1);
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, ((struct sockaddr *)&addr), sizeof(addr)) < 0) {
+        LOGERROR("cannot listen for NC notifications on UDP port %d: %s\n", port, strerror(errno));
+        close(sock);
+        return (-1);
+    }
+
+    LOGINFO("listening for NC notifications on UDP port %d\n", port);
+    return (sock);
+}
+
+//!
+//! Finds the node that sent a notification. The node is known by the name it
+//! gives, as long as it is the name the CC has for it, or else by the address
+//! the datagram came from. Anything else is ignored.
+//!
+//! @param[in] msg the notification, NUL-terminated
+//! @param[in] from the address the notification came from
+//!
+//! @return the index of the node in resourceCache[] or -1 if it is not one of ours
+//!
+static int push_lookup(const char *msg, struct sockaddr_in *from)
+{
+    int i = 0;
+    int ret = -1;
+    char ip[INET_ADDRSTRLEN] = "";
+    const char *name = NULL;
+
+    if (strncmp(msg, NC_PUSH_HEADER, strlen(NC_PUSH_HEADER)))
+        return (-1);
+
+    name = msg + strlen(NC_PUSH_HEADER);
+    inet_ntop(AF_INET, &(from->sin_addr), ip, sizeof(ip));
+
+    sem_mywait(RESCACHE);
+    {
+        for (i = 0; (i < resourceCache->numResources) && (ret < 0); i++) {
+            if (!strcmp(resourceCache->resources[i].hostname, name) || !strcmp(resourceCache->resources[i].ip, ip))
+                ret = i;
+        }
+    }
+    sem_mypost(RESCACHE);
+
+    if (ret < 0)
+        LOGDEBUG("ignoring notification from %s, not one of our nodes\n", ip);
+    return (ret);
+}
+
+//!
+//! Sleeps for the given number of seconds, unless CC_PUSH_PORT is set, in which
+//! case it listens for notifications from the NCs in the meantime and refreshes
+//! the nodes they come from right away. Notifications that arrive together are
+//! served by a single refresh.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] seconds how long to wait
+//!
+static void monitor_wait(ncMetadata * pMeta, int seconds)
+{
+    static int sock = -1;
+    static int sockPort = 0;
+
+    int i = 0;
+    int picked = 0;
+    ssize_t len = 0;
+    long long now = 0;
+    long long deadline = 0;
+    char msg[512] = "";
+    char pick[MAXNODES] = { 0 };
+    socklen_t fromLen = 0;
+    struct pollfd pfd = { 0 };
+    struct sockaddr_in from = { 0 };
+
+    if (config->pushPort != sockPort) {
+        if (sock >= 0)
+            close(sock);
+        sock = (config->pushPort > 0) ? (push_open(config->pushPort)) : (-1);
+        sockPort = config->pushPort;
+    }
+
+    if (sock < 0) {
+        sleep(seconds);
+        return;
+    }
+
+    deadline = time_ms() + (seconds * 1000LL);
+    while ((now = time_ms()) < deadline) {
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, (int)(deadline - now)) <= 0)
+            continue;
+
+        bzero(pick, sizeof(pick));
+        for (picked = 0;;) {
+            fromLen = sizeof(from);
+            if ((len = recvfrom(sock, msg, (sizeof(msg) - 1), 0, ((struct sockaddr *)&from), &fromLen)) < 0)
+                break;
+            msg[len] = '\0';
+            if (((i = push_lookup(msg, &from)) >= 0) && !pick[i]) {
+                pick[i] = 1;
+                picked++;
+            }
+        }
+
+        if ((picked > 0) && (config->ccState == ENABLED)) {
+            LOGDEBUG("refreshing %d node(s) that notified of changes\n", picked);
+            if (refresh_pushed(pMeta, 60, pick)) {
+                LOGWARN("call to refresh_pushed() failed in monitor thread\n");
+            }
+        }
+    }
+}
+
 //!
 //! The CC will start a background thread to poll its collection of nodes. This thread populates an
 //! in-memory cache of instance and resource information that can be accessed via the regular describeInstances
@@ -5444,9 +7167,11 @@ void *monitor_thread(void *in)
 
         if (config->ccState == ENABLED) {
 
-            // NC Polling operations
+            // NC Polling operations, only needed now and then to reconcile if the NCs push their changes
             if (cycleStartTime >= nextNcPullRunTime) {
                  nextNcPullRunTime = cycleStartTime + config->ncPollingFrequency;
+                 if (config->pushPort > 0)
+                     nextNcPullRunTime = cycleStartTime + MAX(config->ncPollingFrequency, MIN(CC_PUSH_RECONCILE_SEC, (config->instanceTimeout / 2)));
                  ncRefresh = 1;
             }
 
@@ -5460,6 +7185,17 @@ void *monitor_thread(void *in)
                 if (rc) {
                     LOGWARN("call to refresh_instances() failed in monitor thread\n");
                 }
+
+                // drop persistent NC stubs for nodes we have not talked to in a while
+                ncpool_stub_reap();
+
+                // get the images being launched the most into the caches of the nodes likely to launch them next
+                if ((config->prefetchNodes > 0) && !config->use_proxy) {
+                    rc = prefetch_trending_images(&pMeta, 60);
+                    if (rc) {
+                        LOGWARN("call to prefetch_trending_images() failed in monitor thread\n");
+                    }
+                }
             }
 
             if (config->kick_broadcast_network_info) {
@@ -5615,7 +7351,7 @@ void *monitor_thread(void *in)
 
         LOGTRACE("localState=%s - done.\n", config->ccStatus.localState);
         ncRefresh = 0;
-        sleep(1);
+        monitor_wait(&pMeta, 1);
     }
 
     EUCA_FREE(pMeta.correlationId);
@@ -5870,6 +7606,16 @@ int init_thread(void)
         }
         
 
+        if (imageTrendCache == NULL) {
+            rc = setup_shared_buffer((void **)&imageTrendCache, "/eucalyptusCCImageTrendCache", sizeof(ccImageTrendCache), &(locks[IMGTREND]),
+                                     "/eucalyptusCCImageTrendCacheLock", SHARED_FILE);
+            if (rc != 0) {
+                fprintf(stderr, "Cannot set up shared memory region for ccImageTrendCache, exiting...\n");
+                sem_mypost(INIT);
+                exit(1);
+            }
+        }
+
         if (gpEucaNet == NULL) {
             rc = setup_shared_buffer((void **)&gpEucaNet, "/eucalyptusCCNETConfig", sizeof(euca_network), &(locks[NETCONFIG]), "/eucalyptusCCNETConfigLock", SHARED_FILE);
             if (rc != 0) {
@@ -5926,7 +7672,8 @@ int init_dynamicCaches(void) {
         LOGDEBUG("ccSensorResourceCache NULL: %d\n", instanceCache==NULL);
 
         if (instanceCache == NULL) {
-            rc = setup_shared_buffer((void **)&instanceCache, "/eucalyptusCCInstanceCache", sizeof(ccInstanceCache) * config->ccMaxInstances, &(locks[INSTCACHE]),
+            rc = setup_shared_buffer((void **)&instanceCache, "/eucalyptusCCInstanceCache",
+                                     (sizeof(ccInstanceCache) * config->ccMaxInstances) + instidx_size(config->ccMaxInstances), &(locks[INSTCACHE]),
                                      "/eucalyptusCCInstanceCacheLock", SHARED_FILE);
             if (rc != 0) {
                 fprintf(stderr, "Cannot set up shared memory region for ccInstanceCache, exiting...\n");
@@ -5935,6 +7682,18 @@ int init_dynamicCaches(void) {
             }
         }
 
+        //
+        // the instance cache indexes live past the last instanceCache[] slot; the
+        // first process to attach after a (re)start or a MAX_INSTANCES_PER_CC
+        // change finds them missing or mis-sized and rebuilds them from the cache
+        //
+        instanceCacheIndex = (instanceIndex *) (instanceCache + config->ccMaxInstances);
+        sem_mywait(INSTCACHE);
+        if (!instidx_valid(instanceCacheIndex, config->ccMaxInstances)) {
+            rebuild_instanceCacheIndex();
+        }
+        sem_mypost(INSTCACHE);
+
         //
         // config->ccMaxInstances -1 is needed because we are appending the memory to the sensorResourceCache
         // struct to give it more elements in the 'resources' array...
@@ -6142,11 +7901,15 @@ int init_config(void)
     int use_wssec = 0;
     int use_tunnels = 0;
     int use_proxy = 0;
+    int use_ncpool = 0;
     int proxy_max_cache_size = 0;
     int schedPolicy = 0;
     int idleThresh = 0;
     int wakeThresh = 0;
     int ccMaxInstances = DEFAULT_MAX_INSTANCES_PER_CC;
+    int imagePeerPort = 0;
+    int prefetchNodes = 0;
+    int pushPort = 0;
     char *psHost = NULL;
     char *tmpstr = NULL;
     char *proxyIp = NULL;
@@ -6261,6 +8024,8 @@ int init_config(void)
             schedPolicy = SCHEDROUNDROBIN;
         else if (!strcmp(tmpstr, "POWERSAVE"))
             schedPolicy = SCHEDPOWERSAVE;
+        else if (!strcmp(tmpstr, "CACHEAFFINITY"))
+            schedPolicy = SCHEDCACHEAFFINITY;
         else if (access(tmpstr, X_OK) == 0) {   // scheduler is an executable path, assumed to be user scheduler
             LOGWARN("will use user-defined scheduler at '%s'\n", tmpstr);
             euca_strncpy(schedPath, tmpstr, sizeof(schedPath));
@@ -6350,6 +8115,16 @@ int init_config(void)
     }
     EUCA_FREE(tmpstr);
 
+    // in-process NC client engine (persistent stubs + worker threads)
+    use_ncpool = 1;
+    tmpstr = configFileValue("NC_CLIENT_POOL");
+    if (tmpstr) {
+        if (!strcmp(tmpstr, "N")) {
+            use_ncpool = 0;
+        }
+    }
+    EUCA_FREE(tmpstr);
+
     tmpstr = configFileValue("INSTANCE_TIMEOUT");
     if (!tmpstr) {
         instanceTimeout = 300;
@@ -6397,6 +8172,35 @@ int init_config(void)
     }
     EUCA_FREE(tmpstr);
 
+    // NCs serving their cached images to one another
+    tmpstr = configFileValue(CONFIG_NC_PEER_PORT);
+    if (tmpstr) {
+        if (atoi(tmpstr) > 0 && atoi(tmpstr) <= 65535) {
+            imagePeerPort = atoi(tmpstr);
+        }
+    }
+    EUCA_FREE(tmpstr);
+
+    // NCs prefetching trending images into their caches
+    tmpstr = configFileValue("CC_PREFETCH_NODES");
+    if (tmpstr) {
+        prefetchNodes = atoi(tmpstr);
+        if (prefetchNodes < 0 || prefetchNodes > MAXNODES) {
+            LOGWARN("CC_PREFETCH_NODES set out of bounds (min=%d max=%d) (current=%d), resetting to default (0 NCs)\n", 0, MAXNODES, prefetchNodes);
+            prefetchNodes = 0;
+        }
+    }
+    EUCA_FREE(tmpstr);
+
+    // NCs pushing notice of their changes
+    tmpstr = configFileValue(CONFIG_CC_PUSH_PORT);
+    if (tmpstr) {
+        if (atoi(tmpstr) > 0 && atoi(tmpstr) <= 65535) {
+            pushPort = atoi(tmpstr);
+        }
+    }
+    EUCA_FREE(tmpstr);
+
     
     // CC Image Caching
     proxyIp = NULL;
@@ -6460,7 +8264,11 @@ int init_config(void)
     config->ncSensorsPollingInterval = ncPollingFrequency;  // initially poll sensors with the same frequency as other NC ops
     config->clcPollingFrequency = clcPollingFrequency;
     config->ncFanout = ncFanout;
+    config->use_ncpool = use_ncpool;
     config->ccMaxInstances = ccMaxInstances;
+    config->imagePeerPort = imagePeerPort;
+    config->prefetchNodes = prefetchNodes;
+    config->pushPort = pushPort;
     locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
     config->initialized = 1;
     ccChangeState(LOADED);
@@ -6492,6 +8300,7 @@ int init_config(void)
     LOGINFO("   CC Configuration: eucahome=%s\n", SP(config->eucahome));
     LOGINFO("                     policyfile=%s\n", SP(config->policyFile));
     LOGINFO("                     ws-security=%s\n", use_wssec ? "ENABLED" : "DISABLED");
+    LOGINFO("                     ncClientPool=%s (fanout=%d)\n", use_ncpool ? "ENABLED" : "DISABLED", config->ncFanout);
     LOGINFO("                     schedulerPolicy=%s\n", SP(SCHEDPOLICIES[config->schedPolicy]));
     LOGINFO("                     idleThreshold=%d\n", config->idleThresh);
     LOGINFO("                     wakeThreshold=%d\n", config->wakeThresh);
@@ -7094,6 +8903,303 @@ int pubIpSet(ccInstance * inst, void *ip)
     return (0);
 }
 
+//!
+//! instidx_match_fn for the instance ID index
+//!
+//! @param[in] entry the instanceCache[] slot to check
+//! @param[in] key the instance ID being looked up
+//! @param[in] ctx a pointer to a boolean, TRUE if only INSTVALID slots may match
+//!
+//! @return TRUE if the slot carries the instance ID, FALSE otherwise
+//!
+static int instanceCache_match_id(int entry, const char *key, void *ctx)
+{
+    if (ctx && *((boolean *) ctx) && (instanceCache[entry].cacheState != INSTVALID))
+        return (FALSE);
+    return (!strcmp(instanceCache[entry].instance.instanceId, key));
+}
+
+//!
+//! instidx_match_fn for the public and private IP indexes
+//!
+//! @param[in] entry the instanceCache[] slot to check
+//! @param[in] key the IP address being looked up
+//! @param[in] ctx unused
+//!
+//! @return TRUE if the slot carries the IP as its public or private address, FALSE otherwise
+//!
+static int instanceCache_match_ip(int entry, const char *key, void *ctx)
+{
+    return (!strcmp(instanceCache[entry].instance.ccnet.publicIp, key) || !strcmp(instanceCache[entry].instance.ccnet.privateIp, key));
+}
+
+//!
+//! Tells whether an IP address is distinctive enough to be indexed. Unset
+//! and "0.0.0.0" addresses are shared by many slots and are never looked up
+//! in practice, so they are left out of the index and served by a scan.
+//!
+//! @param[in] ip the IP address
+//!
+//! @return TRUE if the address is indexed, FALSE otherwise
+//!
+static boolean instanceCache_ip_indexed(const char *ip)
+{
+    return ((ip[0] != '\0') && strcmp(ip, "0.0.0.0"));
+}
+
+//!
+//! Adds the keys of an instanceCache[] slot to the indexes. Must be called,
+//! with INSTCACHE held, after any change to the instance ID or IPs of a slot.
+//!
+//! @param[in] i the slot index
+//!
+static void index_instanceCacheSlot(int i)
+{
+    ccInstance *inst = &(instanceCache[i].instance);
+
+    if (instanceCacheIndex == NULL)
+        return;
+
+    instidx_insert(instanceCacheIndex, INSTIDX_ID, inst->instanceId, i);
+    if (instanceCache_ip_indexed(inst->ccnet.publicIp))
+        instidx_insert(instanceCacheIndex, INSTIDX_PUBIP, inst->ccnet.publicIp, i);
+    if (instanceCache_ip_indexed(inst->ccnet.privateIp))
+        instidx_insert(instanceCacheIndex, INSTIDX_PRIVIP, inst->ccnet.privateIp, i);
+}
+
+//!
+//! Removes the keys of an instanceCache[] slot from the indexes. Must be
+//! called, with INSTCACHE held, before the instance ID or IPs of a slot
+//! are changed or the slot is cleared.
+//!
+//! @param[in] i the slot index
+//!
+static void unindex_instanceCacheSlot(int i)
+{
+    ccInstance *inst = &(instanceCache[i].instance);
+
+    if (instanceCacheIndex == NULL)
+        return;
+
+    instidx_remove(instanceCacheIndex, INSTIDX_ID, inst->instanceId, i);
+    if (instanceCache_ip_indexed(inst->ccnet.publicIp))
+        instidx_remove(instanceCacheIndex, INSTIDX_PUBIP, inst->ccnet.publicIp, i);
+    if (instanceCache_ip_indexed(inst->ccnet.privateIp))
+        instidx_remove(instanceCacheIndex, INSTIDX_PRIVIP, inst->ccnet.privateIp, i);
+}
+
+//!
+//! Marks the start of an update of an instanceCache[] slot: readers holding a
+//! view of the slot will see it invalidated, and the slot's keys are removed
+//! from the indexes. Must be paired with end_instanceCacheSlotUpdate().
+//!
+//! @param[in] i the slot index
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static void begin_instanceCacheSlotUpdate(int i)
+{
+    unindex_instanceCacheSlot(i);
+    seqlock_write_begin(&(instanceCache[i].seq));
+}
+
+//!
+//! Marks the end of an update of an instanceCache[] slot, indexes the
+//! slot under its (possibly new) keys and moves the cache to a new generation
+//!
+//! @param[in] i the slot index
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static void end_instanceCacheSlotUpdate(int i)
+{
+    seqlock_write_end(&(instanceCache[i].seq));
+    index_instanceCacheSlot(i);
+    __sync_add_and_fetch(&(instanceCacheMetadata->generation), 1);
+}
+
+//!
+//! Points a view at an instanceCache[] slot
+//!
+//! @param[in]  i the slot index
+//! @param[out] view the view to fill in
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static void open_instanceCacheView(int i, ccInstanceView * view)
+{
+    seqlock_repair(&(instanceCache[i].seq));
+    view->slot = i;
+    view->seq = instanceCache[i].seq;
+    view->instance = &(instanceCache[i].instance);
+    euca_strncpy(view->instanceId, instanceCache[i].instance.instanceId, sizeof(view->instanceId));
+    __sync_synchronize();
+}
+
+//!
+//! Points a view at an instanceCache[] slot without taking INSTCACHE, so that
+//! scanning the cache never holds up the threads updating it. Only falls back
+//! to the lock when a writer keeps the slot busy for too long.
+//!
+//! @param[in]  i the slot index
+//! @param[out] view the view to fill in
+//!
+//! @return EUCA_OK if the slot holds an instance or EUCA_NOT_FOUND_ERROR if it is free
+//!
+static int peek_instanceCacheView(int i, ccInstanceView * view)
+{
+    int tries = 0;
+    int ret = EUCA_NOT_FOUND_ERROR;
+    unsigned int start = 0;
+
+    for (tries = 0; tries < SEQLOCK_READ_SPINS; tries++) {
+        if (seqlock_read_begin(&(instanceCache[i].seq), &start) != EUCA_OK)
+            break;
+        ret = (instanceCache[i].cacheState == INSTVALID) ? EUCA_OK : EUCA_NOT_FOUND_ERROR;
+        if (ret == EUCA_OK) {
+            memcpy(view->instanceId, instanceCache[i].instance.instanceId, sizeof(view->instanceId));
+            view->instanceId[sizeof(view->instanceId) - 1] = '\0';
+        }
+        if (!seqlock_read_retry(&(instanceCache[i].seq), start)) {
+            view->slot = i;
+            view->seq = start;
+            view->instance = &(instanceCache[i].instance);
+            return (ret);
+        }
+    }
+
+    sem_mywait(INSTCACHE);
+    if ((ret = ((instanceCache[i].cacheState == INSTVALID) ? EUCA_OK : EUCA_NOT_FOUND_ERROR)) == EUCA_OK)
+        open_instanceCacheView(i, view);
+    sem_mypost(INSTCACHE);
+    return (ret);
+}
+
+//!
+//! Copies an instanceCache[] slot without taking INSTCACHE, see
+//! peek_instanceCacheView()
+//!
+//! @param[in]  i the slot index
+//! @param[out] dst where to copy the instance
+//! @param[out] seq where to store the sequence number of the slot as of the copy
+//!
+//! @return EUCA_OK if the slot holds an instance or EUCA_NOT_FOUND_ERROR if it is free
+//!
+static int copy_instanceCacheSlot(int i, ccInstance * dst, unsigned int *seq)
+{
+    int tries = 0;
+    int ret = EUCA_NOT_FOUND_ERROR;
+    unsigned int start = 0;
+
+    for (tries = 0; tries < SEQLOCK_READ_SPINS; tries++) {
+        if (seqlock_read_begin(&(instanceCache[i].seq), &start) != EUCA_OK)
+            break;
+        if ((ret = ((instanceCache[i].cacheState == INSTVALID) ? EUCA_OK : EUCA_NOT_FOUND_ERROR)) == EUCA_OK)
+            memcpy(dst, &(instanceCache[i].instance), sizeof(ccInstance));
+        if (!seqlock_read_retry(&(instanceCache[i].seq), start)) {
+            *seq = start;
+            return (ret);
+        }
+    }
+
+    sem_mywait(INSTCACHE);
+    if ((ret = ((instanceCache[i].cacheState == INSTVALID) ? EUCA_OK : EUCA_NOT_FOUND_ERROR)) == EUCA_OK)
+        memcpy(dst, &(instanceCache[i].instance), sizeof(ccInstance));
+    *seq = instanceCache[i].seq;
+    sem_mypost(INSTCACHE);
+    return (ret);
+}
+
+//!
+//! Flags an instanceCache[] slot a describe reported as described, which
+//! makes it one of the first add_instanceCache() reuses once the instance is
+//! in Teardown. The describe copies slots without INSTCACHE, so the slot may
+//! have been given to another instance since: only the slot as it was copied
+//! gets the flag.
+//!
+//! @param[in] i the slot index
+//! @param[in] seq the sequence number of the slot as of the copy
+//!
+//! @pre The caller must hold the INSTCACHE lock.
+//!
+static void mark_instanceCacheDescribed(int i, unsigned int seq)
+{
+    if (instanceCache[i].seq == seq)
+        instanceCache[i].described = 1;
+}
+
+//!
+//! Rebuilds the instanceCache[] indexes from scratch
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static void rebuild_instanceCacheIndex(void)
+{
+    int i = 0;
+
+    LOGDEBUG("rebuilding instance cache index for %d slots\n", config->ccMaxInstances);
+    instidx_init(instanceCacheIndex, config->ccMaxInstances);
+    for (i = 0; i < config->ccMaxInstances; i++) {
+        index_instanceCacheSlot(i);
+    }
+}
+
+//!
+//! Finds the instanceCache[] slot holding an instance ID
+//!
+//! @param[in] instanceId the instance ID to look for
+//! @param[in] validOnly set to TRUE to ignore slots that are not INSTVALID
+//!
+//! @return the lowest matching slot index or -1 if not found
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static int lookup_instanceCacheId(char *instanceId, boolean validOnly)
+{
+    int i = 0;
+
+    if ((instanceCacheIndex != NULL) && (instanceId[0] != '\0'))
+        return (instidx_lookup(instanceCacheIndex, INSTIDX_ID, instanceId, instanceCache_match_id, &validOnly));
+
+    for (i = 0; i < config->ccMaxInstances; i++) {
+        if (instanceCache_match_id(i, instanceId, &validOnly))
+            return (i);
+    }
+    return (-1);
+}
+
+//!
+//! Finds the instanceCache[] slot holding an IP as its public or private address
+//!
+//! @param[in] ip the IP address to look for
+//!
+//! @return the lowest matching slot index or -1 if not found
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static int lookup_instanceCacheIP(char *ip)
+{
+    int i = 0;
+    int pub = -1;
+    int priv = -1;
+
+    if ((instanceCacheIndex != NULL) && instanceCache_ip_indexed(ip)) {
+        pub = instidx_lookup(instanceCacheIndex, INSTIDX_PUBIP, ip, instanceCache_match_ip, NULL);
+        priv = instidx_lookup(instanceCacheIndex, INSTIDX_PRIVIP, ip, instanceCache_match_ip, NULL);
+        if ((pub < 0) || ((priv >= 0) && (priv < pub)))
+            return (priv);
+        return (pub);
+    }
+
+    for (i = 0; i < config->ccMaxInstances; i++) {
+        if ((instanceCache[i].instance.ccnet.publicIp[0] != '\0' || instanceCache[i].instance.ccnet.privateIp[0] != '\0')) {
+            if (instanceCache_match_ip(i, ip, NULL))
+                return (i);
+        }
+    }
+    return (-1);
+}
+
 //!
 //!
 //!
@@ -7116,10 +9222,13 @@ int map_instanceCache(int (*match) (ccInstance *, void *), void *matchParam, int
 
     for (i = 0; i < config->ccMaxInstances; i++) {
         if (!match(&(instanceCache[i].instance), matchParam)) {
+            // the operation may change indexed fields (e.g. the public IP)
+            begin_instanceCacheSlotUpdate(i);
             if (operate(&(instanceCache[i].instance), operateParam)) {
                 LOGWARN("instance cache mapping failed to operate at index %d\n", i);
                 ret++;
             }
+            end_instanceCacheSlotUpdate(i);
         }
     }
 
@@ -7315,10 +9424,12 @@ void invalidate_instanceCache(void)
                 //                if (!strcmp(instanceCache[i].instance.state, "Pending") || !strcmp(instanceCache[i].instance.state, "Extant")) {
                     //                    instanceCache->numInstsActive--;
                 //                }
+                begin_instanceCacheSlotUpdate(i);
                 bzero(&(instanceCache[i].instance), sizeof(ccInstance));
                 instanceCache[i].described = 0;
                 instanceCache[i].lastseen = 0;
                 instanceCache[i].cacheState = INSTINVALID;
+                end_instanceCacheSlotUpdate(i);
                 //                instanceCache->numInsts--;
             }
         }
@@ -7358,23 +9469,21 @@ int refresh_instanceCache(char *instanceId, ccInstance * in)
     sem_mywait(INSTCACHE);
     sem_mywait(INSTCACHEMD);
     done = 0;
-    for (i = 0; i < config->ccMaxInstances && !done; i++) {
-        if (!strcmp(instanceCache[i].instance.instanceId, instanceId)) {
-            // in cache
-            // give precedence to instances that are in Extant/Pending over expired instances, when info comes from two different nodes
-            if (strcmp(in->serviceTag, instanceCache[i].instance.serviceTag) && strcmp(in->state, instanceCache[i].instance.state)
-                && !strcmp(in->state, "Teardown")) {
-                // skip
-                LOGDEBUG("skipping cache refresh with instance in Teardown (instance with non-Teardown from different node already cached)\n");
-            } else {
-                // update cached instance info
-                memcpy(&(instanceCache[i].instance), in, sizeof(ccInstance));
-                instanceCache[i].lastseen = time(NULL);
-            }
-            //            sem_mypost(INSTCACHE);
-            //            return (0);
-            done++;
+    if ((i = lookup_instanceCacheId(instanceId, FALSE)) >= 0) {
+        // in cache
+        // give precedence to instances that are in Extant/Pending over expired instances, when info comes from two different nodes
+        if (strcmp(in->serviceTag, instanceCache[i].instance.serviceTag) && strcmp(in->state, instanceCache[i].instance.state)
+            && !strcmp(in->state, "Teardown")) {
+            // skip
+            LOGDEBUG("skipping cache refresh with instance in Teardown (instance with non-Teardown from different node already cached)\n");
+        } else {
+            // update cached instance info
+            begin_instanceCacheSlotUpdate(i);
+            memcpy(&(instanceCache[i].instance), in, sizeof(ccInstance));
+            instanceCache[i].lastseen = time(NULL);
+            end_instanceCacheSlotUpdate(i);
         }
+        done++;
     }
 
     if (!done) {
@@ -7400,6 +9509,47 @@ int refresh_instanceCache(char *instanceId, ccInstance * in)
     return (0);
 }
 
+//!
+//! Marks the cached instances that a node reported as unchanged (in a delta
+//! ncDescribeInstances reply) as seen, so that invalidate_instanceCache()
+//! keeps them around.
+//!
+//! @param[in] instIds the identifiers of all instances the node knows about
+//! @param[in] instIdsLen the number of identifiers in the instIds list
+//!
+//! @return the number of instances that the cache has lost track of, or whose
+//!         public address has yet to reach the node; the caller should ask that
+//!         node for a full instance list next time if this is not 0
+//!
+int touch_instanceCache(char **instIds, int instIdsLen)
+{
+    int i = 0;
+    int j = 0;
+    int stale = 0;
+    time_t now = time(NULL);
+    ccInstance *cached = NULL;
+
+    sem_mywait(INSTCACHE);
+    for (j = 0; j < instIdsLen; j++) {
+        if ((i = lookup_instanceCacheId(instIds[j], TRUE)) < 0) {
+            stale++;
+            continue;
+        }
+
+        instanceCache[i].lastseen = now;
+
+        // the full refresh path re-sends ncAssignAddress until the NC picks the address up
+        cached = &(instanceCache[i].instance);
+        if ((cached->ccnet.publicIp[0] != '\0' && strcmp(cached->ccnet.publicIp, "0.0.0.0"))
+            && (cached->ncnet.publicIp[0] == '\0' || !strcmp(cached->ncnet.publicIp, "0.0.0.0"))) {
+            stale++;
+        }
+    }
+    sem_mypost(INSTCACHE);
+
+    return (stale);
+}
+
 //!
 //!
 //!
@@ -7423,16 +9573,18 @@ int add_instanceCache(char *instanceId, ccInstance * in)
     ret = 0;
 
     //    sem_mywait(INSTCACHE);
+    if ((i = lookup_instanceCacheId(instanceId, TRUE)) >= 0) {
+        // already in cache
+        LOGDEBUG("'%s/%s/%s' already in cache\n", instanceId, in->ccnet.publicIp, in->ccnet.privateIp);
+        instanceCache[i].lastseen = time(NULL);
+        //            sem_mypost(INSTCACHE);
+        return (0);
+    }
+
     firstNull = idxDescribedTeardown = idxNotDescribedTeardown = idxDescribedExtant = -1;
     done = 0;
     for (i = 0; i < config->ccMaxInstances && !done; i++) {
-        if ((instanceCache[i].cacheState == INSTVALID) && (!strcmp(instanceCache[i].instance.instanceId, instanceId))) {
-            // already in cache
-            LOGDEBUG("'%s/%s/%s' already in cache\n", instanceId, in->ccnet.publicIp, in->ccnet.privateIp);
-            instanceCache[i].lastseen = time(NULL);
-            //            sem_mypost(INSTCACHE);
-            return (0);
-        } else if (instanceCache[i].cacheState == INSTINVALID) {
+        if (instanceCache[i].cacheState == INSTINVALID) {
             firstNull = i;
             done++;
         } else if (!strcmp(instanceCache[i].instance.state, "Teardown") && instanceCache[i].described == 1) {
@@ -7464,6 +9616,7 @@ int add_instanceCache(char *instanceId, ccInstance * in)
         //            instanceCacheMetadata->numInsts++;
         //        }
 
+        begin_instanceCacheSlotUpdate(cacheIdx);
         allocate_ccInstance(&(instanceCache[cacheIdx].instance), in->instanceId, in->amiId, in->kernelId, in->ramdiskId, in->amiURL, in->kernelURL,
                             in->ramdiskURL, in->ownerId, in->accountId, in->state, in->ccState, in->ts, in->reservationId, &(in->ccnet), &(in->ncnet),
                             &(in->ccvm), in->ncHostIdx, in->keyName, in->serviceTag, in->userData, in->launchIndex, in->platform, in->guestStateName, in->bundleTaskStateName,
@@ -7471,6 +9624,7 @@ int add_instanceCache(char *instanceId, ccInstance * in)
         instanceCache[cacheIdx].described = 0;
         instanceCache[cacheIdx].lastseen = time(NULL);
         instanceCache[cacheIdx].cacheState = INSTVALID;
+        end_instanceCacheSlotUpdate(cacheIdx);
     } else {
         LOGERROR("not enough cache space for storing instance [%s]: skipping update\n", instanceId);
         ret = 1;
@@ -7494,19 +9648,21 @@ int del_instanceCacheId(char *instanceId)
 {
     int i;
 
+    if (!instanceId) {
+        return (1);
+    }
+
     sem_mywait(INSTCACHE);
-    for (i = 0; i < config->ccMaxInstances; i++) {
-        if ((instanceCache[i].cacheState == INSTVALID) && (!strcmp(instanceCache[i].instance.instanceId, instanceId))) {
-            // del from cache
-            bzero(&(instanceCache[i].instance), sizeof(ccInstance));
-            instanceCache[i].described = 0;
-            instanceCache[i].lastseen = 0;
-            instanceCache[i].cacheState = INSTINVALID;
-            //            instanceCache->numInsts--;
-            //            instanceCache->numInstsActive = instanceCache->numInsts;
-            sem_mypost(INSTCACHE);
-            return (0);
-        }
+    if ((i = lookup_instanceCacheId(instanceId, TRUE)) >= 0) {
+        // del from cache
+        begin_instanceCacheSlotUpdate(i);
+        bzero(&(instanceCache[i].instance), sizeof(ccInstance));
+        instanceCache[i].described = 0;
+        instanceCache[i].lastseen = 0;
+        instanceCache[i].cacheState = INSTINVALID;
+        end_instanceCacheSlotUpdate(i);
+        //            instanceCache->numInsts--;
+        //            instanceCache->numInstsActive = instanceCache->numInsts;
     }
     sem_mypost(INSTCACHE);
     return (0);
@@ -7535,33 +9691,31 @@ int find_instanceCacheId(char *instanceId, ccInstance ** out)
     sem_mywait(INSTCACHE);
     *out = NULL;
     done = 0;
-    for (i = 0; i < config->ccMaxInstances && !done; i++) {
-        if (!strcmp(instanceCache[i].instance.instanceId, instanceId)) {
-            // found it
-            *out = EUCA_ZALLOC(1, sizeof(ccInstance));
-            if (!*out) {
-                LOGFATAL("out of memory!\n");
-                unlock_exit(1);
-            }
-            allocate_ccInstance(*out, instanceCache[i].instance.instanceId, instanceCache[i].instance.amiId, instanceCache[i].instance.kernelId,
-                                instanceCache[i].instance.ramdiskId, instanceCache[i].instance.amiURL, instanceCache[i].instance.kernelURL,
-                                instanceCache[i].instance.ramdiskURL, instanceCache[i].instance.ownerId, instanceCache[i].instance.accountId,
-                                instanceCache[i].instance.state, instanceCache[i].instance.ccState, instanceCache[i].instance.ts,
-                                instanceCache[i].instance.reservationId, &(instanceCache[i].instance.ccnet), &(instanceCache[i].instance.ncnet),
-                                &(instanceCache[i].instance.ccvm), instanceCache[i].instance.ncHostIdx, instanceCache[i].instance.keyName,
-                                instanceCache[i].instance.serviceTag, instanceCache[i].instance.userData, instanceCache[i].instance.launchIndex,
-                                instanceCache[i].instance.platform, instanceCache[i].instance.guestStateName, instanceCache[i].instance.bundleTaskStateName,
-                                instanceCache[i].instance.groupNames, instanceCache[i].instance.groupIds, instanceCache[i].instance.volumes,
-                                instanceCache[i].instance.volumesSize, instanceCache[i].instance.bundleTaskProgress, instanceCache[i].instance.secNetCfgs,
-                                instanceCache[i].instance.secNetCfgsSize);
-            LOGTRACE("found instance in cache '%s/%s/%s'\n", instanceCache[i].instance.instanceId,
-                     instanceCache[i].instance.ccnet.publicIp, instanceCache[i].instance.ccnet.privateIp);
-            // migration-related
-            // TO-DO: move to allocate_ccInstance() ?
-            (*out)->migration_state = instanceCache[i].instance.migration_state;
-            LOGTRACE("instance %s migration state=%s\n", instanceCache[i].instance.instanceId, migration_state_names[(*out)->migration_state]);
-            done++;
+    if ((i = lookup_instanceCacheId(instanceId, FALSE)) >= 0) {
+        // found it
+        *out = EUCA_ZALLOC(1, sizeof(ccInstance));
+        if (!*out) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
         }
+        allocate_ccInstance(*out, instanceCache[i].instance.instanceId, instanceCache[i].instance.amiId, instanceCache[i].instance.kernelId,
+                            instanceCache[i].instance.ramdiskId, instanceCache[i].instance.amiURL, instanceCache[i].instance.kernelURL,
+                            instanceCache[i].instance.ramdiskURL, instanceCache[i].instance.ownerId, instanceCache[i].instance.accountId,
+                            instanceCache[i].instance.state, instanceCache[i].instance.ccState, instanceCache[i].instance.ts,
+                            instanceCache[i].instance.reservationId, &(instanceCache[i].instance.ccnet), &(instanceCache[i].instance.ncnet),
+                            &(instanceCache[i].instance.ccvm), instanceCache[i].instance.ncHostIdx, instanceCache[i].instance.keyName,
+                            instanceCache[i].instance.serviceTag, instanceCache[i].instance.userData, instanceCache[i].instance.launchIndex,
+                            instanceCache[i].instance.platform, instanceCache[i].instance.guestStateName, instanceCache[i].instance.bundleTaskStateName,
+                            instanceCache[i].instance.groupNames, instanceCache[i].instance.groupIds, instanceCache[i].instance.volumes,
+                            instanceCache[i].instance.volumesSize, instanceCache[i].instance.bundleTaskProgress, instanceCache[i].instance.secNetCfgs,
+                            instanceCache[i].instance.secNetCfgsSize);
+        LOGTRACE("found instance in cache '%s/%s/%s'\n", instanceCache[i].instance.instanceId,
+                 instanceCache[i].instance.ccnet.publicIp, instanceCache[i].instance.ccnet.privateIp);
+        // migration-related
+        // TO-DO: move to allocate_ccInstance() ?
+        (*out)->migration_state = instanceCache[i].instance.migration_state;
+        LOGTRACE("instance %s migration state=%s\n", instanceCache[i].instance.instanceId, migration_state_names[(*out)->migration_state]);
+        done++;
     }
     sem_mypost(INSTCACHE);
     if (done) {
@@ -7593,30 +9747,26 @@ int find_instanceCacheIP(char *ip, ccInstance ** out)
     sem_mywait(INSTCACHE);
     *out = NULL;
     done = 0;
-    for (i = 0; i < config->ccMaxInstances && !done; i++) {
-        if ((instanceCache[i].instance.ccnet.publicIp[0] != '\0' || instanceCache[i].instance.ccnet.privateIp[0] != '\0')) {
-            if (!strcmp(instanceCache[i].instance.ccnet.publicIp, ip) || !strcmp(instanceCache[i].instance.ccnet.privateIp, ip)) {
-                // found it
-                *out = EUCA_ZALLOC(1, sizeof(ccInstance));
-                if (!*out) {
-                    LOGFATAL("out of memory!\n");
-                    unlock_exit(1);
-                }
-                allocate_ccInstance(*out, instanceCache[i].instance.instanceId, instanceCache[i].instance.amiId,
-                                    instanceCache[i].instance.kernelId, instanceCache[i].instance.ramdiskId, instanceCache[i].instance.amiURL,
-                                    instanceCache[i].instance.kernelURL, instanceCache[i].instance.ramdiskURL,
-                                    instanceCache[i].instance.ownerId, instanceCache[i].instance.accountId, instanceCache[i].instance.state,
-                                    instanceCache[i].instance.ccState, instanceCache[i].instance.ts, instanceCache[i].instance.reservationId,
-                                    &(instanceCache[i].instance.ccnet), &(instanceCache[i].instance.ncnet), &(instanceCache[i].instance.ccvm),
-                                    instanceCache[i].instance.ncHostIdx, instanceCache[i].instance.keyName,
-                                    instanceCache[i].instance.serviceTag, instanceCache[i].instance.userData,
-                                    instanceCache[i].instance.launchIndex, instanceCache[i].instance.platform,
-                                    instanceCache[i].instance.guestStateName, instanceCache[i].instance.bundleTaskStateName, instanceCache[i].instance.groupNames,
-                                    instanceCache[i].instance.groupIds, instanceCache[i].instance.volumes, instanceCache[i].instance.volumesSize,
-                                    instanceCache[i].instance.bundleTaskProgress, instanceCache[i].instance.secNetCfgs, instanceCache[i].instance.secNetCfgsSize);
-                done++;
-            }
+    if ((i = lookup_instanceCacheIP(ip)) >= 0) {
+        // found it
+        *out = EUCA_ZALLOC(1, sizeof(ccInstance));
+        if (!*out) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
         }
+        allocate_ccInstance(*out, instanceCache[i].instance.instanceId, instanceCache[i].instance.amiId,
+                            instanceCache[i].instance.kernelId, instanceCache[i].instance.ramdiskId, instanceCache[i].instance.amiURL,
+                            instanceCache[i].instance.kernelURL, instanceCache[i].instance.ramdiskURL,
+                            instanceCache[i].instance.ownerId, instanceCache[i].instance.accountId, instanceCache[i].instance.state,
+                            instanceCache[i].instance.ccState, instanceCache[i].instance.ts, instanceCache[i].instance.reservationId,
+                            &(instanceCache[i].instance.ccnet), &(instanceCache[i].instance.ncnet), &(instanceCache[i].instance.ccvm),
+                            instanceCache[i].instance.ncHostIdx, instanceCache[i].instance.keyName,
+                            instanceCache[i].instance.serviceTag, instanceCache[i].instance.userData,
+                            instanceCache[i].instance.launchIndex, instanceCache[i].instance.platform,
+                            instanceCache[i].instance.guestStateName, instanceCache[i].instance.bundleTaskStateName, instanceCache[i].instance.groupNames,
+                            instanceCache[i].instance.groupIds, instanceCache[i].instance.volumes, instanceCache[i].instance.volumesSize,
+                            instanceCache[i].instance.bundleTaskProgress, instanceCache[i].instance.secNetCfgs, instanceCache[i].instance.secNetCfgsSize);
+        done++;
     }
 
     sem_mypost(INSTCACHE);
@@ -7626,6 +9776,92 @@ int find_instanceCacheIP(char *ip, ccInstance ** out)
     return (1);
 }
 
+//!
+//! Looks up an instance in the cache and returns a zero-copy, read-only view
+//! of its slot instead of a copy. The view stays usable after the lock is
+//! released: readers access view->instance directly in shared memory and
+//! then call instanceCacheView_valid() to learn whether the slot was
+//! modified meanwhile, in which case whatever they read must be discarded.
+//!
+//! @param[in]  instanceId the instance ID to look for
+//! @param[out] view the view to fill in
+//!
+//! @return 0 if the instance was found or 1 otherwise
+//!
+int find_instanceCacheIdView(char *instanceId, ccInstanceView * view)
+{
+    int i = 0;
+
+    if (!instanceId || !view) {
+        return (1);
+    }
+
+    sem_mywait(INSTCACHE);
+    if ((i = lookup_instanceCacheId(instanceId, TRUE)) >= 0) {
+        open_instanceCacheView(i, view);
+    }
+    sem_mypost(INSTCACHE);
+    return ((i >= 0) ? 0 : 1);
+}
+
+//!
+//! Checks whether a view still reflects its slot, i.e. that no update of
+//! the slot started since the view was taken. Call it after reading through
+//! the view, seqlock-style.
+//!
+//! @param[in] view the view to check
+//!
+//! @return TRUE if everything read through the view is consistent, FALSE otherwise
+//!
+boolean instanceCacheView_valid(ccInstanceView * view)
+{
+    __sync_synchronize();
+    return (instanceCache[view->slot].seq == view->seq);
+}
+
+//!
+//! Re-takes a view whose slot was modified, provided the slot still holds
+//! the same instance
+//!
+//! @param[in,out] view the view to refresh
+//!
+//! @return EUCA_OK on success or EUCA_NOT_FOUND_ERROR if the instance left the slot
+//!
+int instanceCacheView_reopen(ccInstanceView * view)
+{
+    int ret = EUCA_NOT_FOUND_ERROR;
+
+    sem_mywait(INSTCACHE);
+    if ((instanceCache[view->slot].cacheState == INSTVALID) && !strcmp(instanceCache[view->slot].instance.instanceId, view->instanceId)) {
+        open_instanceCacheView(view->slot, view);
+        ret = EUCA_OK;
+    }
+    sem_mypost(INSTCACHE);
+    return (ret);
+}
+
+//!
+//! Copies the current contents of a view's slot, with the lock held. This is
+//! the fallback for readers whose optimistic reads kept getting invalidated.
+//!
+//! @param[in]  view the view whose slot to copy
+//! @param[out] dst where to copy the instance
+//!
+//! @return EUCA_OK on success or EUCA_NOT_FOUND_ERROR if the instance left the slot
+//!
+int instanceCacheView_copy(ccInstanceView * view, ccInstance * dst)
+{
+    int ret = EUCA_NOT_FOUND_ERROR;
+
+    sem_mywait(INSTCACHE);
+    if ((instanceCache[view->slot].cacheState == INSTVALID) && !strcmp(instanceCache[view->slot].instance.instanceId, view->instanceId)) {
+        memcpy(dst, &(instanceCache[view->slot].instance), sizeof(ccInstance));
+        ret = EUCA_OK;
+    }
+    sem_mypost(INSTCACHE);
+    return (ret);
+}
+
 //!
 //! Updates the canonical cache of resources based on the
 //! configuration. The configuration may bring new nodes,
@@ -7652,6 +9888,7 @@ static void reconfigure_resourceCache(ccResource * res, int numHosts)
     }
 
     sem_mywait(RESCACHE);
+    seqlock_write_begin(&(resourceCache->seq));
     {
         resourceCache->lastResourceUpdate = 0;  // reset timestamp, since configuration has changed
 
@@ -7714,6 +9951,7 @@ static void reconfigure_resourceCache(ccResource * res, int numHosts)
             LOGINFO("node configuration change: %d node(s) added, %d removed, %d total\n", num_added, num_deleted, numHosts);
         }
     }
+    seqlock_write_end(&(resourceCache->seq));
     sem_mypost(RESCACHE);
 }
 
@@ -7748,7 +9986,9 @@ static int reindex_instanceCache(int removed_index, ccResource * removed_resourc
                 ccInstance *inst = &instanceCache[i].instance;
                 if ((instanceCache[i].cacheState == INSTVALID) &&  // a valid instance slot
                     (inst->ncHostIdx > removed_index)) {    // host index bigger than one being removed
+                    begin_instanceCacheSlotUpdate(i);
                     inst->ncHostIdx--;
+                    end_instanceCacheSlotUpdate(i);
                 }
             }
         }
@@ -7758,6 +9998,67 @@ static int reindex_instanceCache(int removed_index, ccResource * removed_resourc
     return ret;
 }
 
+//!
+//! Clones the canonical cache of resources into resourceCacheStage[]
+//! for a round of NC calls. Only the entries in use are copied, not
+//! the whole MAXNODES array.
+//!
+static void stage_resourceCache(void)
+{
+    sem_mywait(RESCACHE);
+    {
+        resourceCacheStage->numResources = resourceCache->numResources;
+        resourceCacheStage->lastResourceUpdate = resourceCache->lastResourceUpdate;
+        resourceCacheStage->resourceCacheUpdate = resourceCache->resourceCacheUpdate;
+        memcpy(resourceCacheStage->resources, resourceCache->resources, (sizeof(ccResource) * resourceCache->numResources));
+        memcpy(resourceCacheStage->cacheState, resourceCache->cacheState, (sizeof(int) * resourceCache->numResources));
+    }
+    sem_mypost(RESCACHE);
+}
+
+//!
+//! Copies the canonical cache of resources for a request to read. Like
+//! stage_resourceCache(), only the entries in use are copied, and the copy
+//! is taken without RESCACHE, retrying if the monitor thread updated the
+//! cache meanwhile. Should the cache stay busy for too long, the copy is
+//! taken with the lock held.
+//!
+//! @param[out] dst where to copy the cache
+//!
+void copy_resourceCache(ccResourceCache * dst)
+{
+    int tries = 0;
+    int numResources = 0;
+    unsigned int start = 0;
+
+    for (tries = 0; tries < SEQLOCK_READ_SPINS; tries++) {
+        if (seqlock_read_begin(&(resourceCache->seq), &start) != EUCA_OK)
+            break;
+        numResources = MIN(MAX(resourceCache->numResources, 0), MAXNODES);
+        dst->numResources = numResources;
+        dst->lastResourceUpdate = resourceCache->lastResourceUpdate;
+        dst->resourceCacheUpdate = resourceCache->resourceCacheUpdate;
+        memcpy(dst->resources, resourceCache->resources, (sizeof(ccResource) * numResources));
+        memcpy(dst->cacheState, resourceCache->cacheState, (sizeof(int) * numResources));
+        if (!seqlock_read_retry(&(resourceCache->seq), start)) {
+            dst->seq = start;
+            return;
+        }
+    }
+
+    sem_mywait(RESCACHE);
+    {
+        seqlock_repair(&(resourceCache->seq));
+        dst->numResources = resourceCache->numResources;
+        dst->lastResourceUpdate = resourceCache->lastResourceUpdate;
+        dst->resourceCacheUpdate = resourceCache->resourceCacheUpdate;
+        dst->seq = resourceCache->seq;
+        memcpy(dst->resources, resourceCache->resources, (sizeof(ccResource) * resourceCache->numResources));
+        memcpy(dst->cacheState, resourceCache->cacheState, (sizeof(int) * resourceCache->numResources));
+    }
+    sem_mypost(RESCACHE);
+}
+
 //!
 //! Updates the canonical cache of resources based on the
 //! information from the NCs. This is called after processing
@@ -7772,19 +10073,35 @@ static int reindex_instanceCache(int removed_index, ccResource * removed_resourc
 //! no instances, and do_purge_unconfigured is TRUE, the
 //! node will be deleted from the resource cache.
 //!
+//! The capacity counters that placements update atomically
+//! (reservedMemory and the fields after it) are left alone,
+//! except that with do_settle_reservations, launches which
+//! were committed before the clone was taken, and which the
+//! NC has since accounted for in its report, are let go.
+//! Reservations of placements whose process has died are
+//! given back first (see reap_placements()).
+//!
 //! @param[in] updatedResourceCache clone of resourceCache[] with updates from the NCs
 //! @param[in] do_purge_unconfigured idle nodes no longer in configuration should be deleted
+//! @param[in] do_settle_reservations the clone carries fresh capacity reports from the NCs
+//! @param[in] pick flags, by index in the clone, the nodes to merge, NULL to merge all of them
 //!
-static void refresh_resourceCache(ccResourceCache * updatedResourceCache, boolean do_purge_unconfigured)
+static void refresh_resourceCache(ccResourceCache * updatedResourceCache, boolean do_purge_unconfigured, boolean do_settle_reservations, const char *pick)
 {
     // ingress updated resource information, atomically
     sem_mywait(RESCACHE);
+    seqlock_write_begin(&(resourceCache->seq));
     {
+        reap_placements();
+
         // run though array of updated resource information, copying it to canonical location
         for (int i = 0; i < updatedResourceCache->numResources; i++) {
             ccResource *res_new = updatedResourceCache->resources + i;
             boolean found_it = FALSE;
 
+            if (pick && !pick[i])
+                continue;
+
             // find the incoming node in the canonical resource cache
             for (int j = 0; j < resourceCache->numResources; j++) {
                 ccResource *res_old = resourceCache->resources + j;
@@ -7795,19 +10112,31 @@ static void refresh_resourceCache(ccResourceCache * updatedResourceCache, boolea
                             || ((res_new->idleStart != 0) &&    // no instances on node according to ncDescribeInstances
                                 (res_new->maxCores == res_new->availCores))) {  // no instances according to ncDescribeResource
 
-                            // if indexes could be adjusted sucessfully, remove the node from the cache
-                            if (reindex_instanceCache(j, res_old) == EUCA_OK) {
+                            // shifting the array would move entries from under requests placing instances, so wait for a quiet moment
+                            resourceCache->purging = 1;
+                            __sync_synchronize();
+                            if (placement_busy()) {
+                                LOGDEBUG("deferring removal of node '%s' while instances are being placed\n", res_old->hostname);
+                            } else if (reindex_instanceCache(j, res_old) == EUCA_OK) {
+                                // if indexes could be adjusted sucessfully, remove the node from the cache
                                 LOGDEBUG("removing node '%s' from resource cache\n", res_old->hostname);
                                 // shift the two arrays down
                                 memmove(res_old, res_old + 1, sizeof(ccResource) * (resourceCache->numResources - j));
                                 memmove(resourceCache->cacheState + j, resourceCache->cacheState + (j + 1), sizeof(int) * (resourceCache->numResources - j));
                                 resourceCache->numResources--;
                             }
+                            __sync_synchronize();
+                            resourceCache->purging = 0;
                         } else {
                             LOGWARN("node '%s' not in configuration, but with instances on it\n", res_old->hostname);
                         }
                     } else {           // a configured resource, so just update cache with latest info
-                        memcpy(res_old, res_new, sizeof(ccResource));
+                        memcpy(res_old, res_new, offsetof(ccResource, reservedMemory));
+                        if (do_settle_reservations && (res_new->state == RESUP)) {
+                            __sync_sub_and_fetch(&(res_old->committedMemory), res_new->committedMemory);
+                            __sync_sub_and_fetch(&(res_old->committedDisk), res_new->committedDisk);
+                            __sync_sub_and_fetch(&(res_old->committedCores), res_new->committedCores);
+                        }
                     }
                     found_it = TRUE;
                     break;
@@ -7819,6 +10148,7 @@ static void refresh_resourceCache(ccResourceCache * updatedResourceCache, boolea
             }
         }
     }
+    seqlock_write_end(&(resourceCache->seq));
     sem_mypost(RESCACHE);
 }
 
@@ -7934,6 +10264,332 @@ int image_cache(char *id, char *url)
     return (0);
 }
 
+//!
+//! Names, in the image VBRs of an instance about to be sent to a node, up to
+//! CC_IMAGE_PEER_HINTS other nodes that have the image in their cache (those
+//! running an instance of it) or are getting it (those launching one), so the
+//! node can fetch the image from them rather than from object storage. Nodes
+//! running the image are named first; @p seq rotates the choice among equally
+//! good nodes so a batch of launches does not converge on a single one.
+//!
+//! @param[in] vm the VM of the instance, as it will be sent to the node
+//! @param[in] resid index of the resource the instance was scheduled on
+//! @param[in] seq position of the instance in its batch
+//!
+//! @return the number of VBRs that got hints
+//!
+//! @pre the caller holds RESCACHE or is placing instances (see placement_enter()), INSTCACHE must not be held
+//!
+int image_peer_hints(virtualMachine * vm, int resid, int seq)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int n = 0;
+    int pass = 0;
+    int count = 0;
+    int hinted = 0;
+    int nodes[2][MAXNODES] = { {0} };
+    int nodesLen[2] = { 0 };
+    char seen[MAXNODES] = { 0 };
+    char hint[BIG_CHAR_BUFFER_SIZE] = "";
+    virtualBootRecord *vbr = NULL;
+    ccInstance *inst = NULL;
+    ccResource *res = NULL;
+
+    for (k = 0; k < vm->virtualBootRecordLen; k++) {
+        vbr = &(vm->virtualBootRecord[k]);
+        if ((strcmp(vbr->typeName, "machine") && strcmp(vbr->typeName, "kernel") && strcmp(vbr->typeName, "ramdisk"))
+            || (strstr(vbr->resourceLocation, "objectstorage://") != vbr->resourceLocation) || strstr(vbr->resourceLocation, VBR_PEERS_HINT)) {
+            continue;
+        }
+
+        nodesLen[0] = nodesLen[1] = 0;
+        bzero(seen, sizeof(seen));
+        sem_mywait(INSTCACHE);
+        {
+            for (i = 0; i < config->ccMaxInstances; i++) {
+                inst = &(instanceCache[i].instance);
+                if ((instanceCache[i].cacheState != INSTVALID) || (inst->ncHostIdx == resid) || (inst->ncHostIdx < 0) || (inst->ncHostIdx >= MAXNODES)
+                    || seen[inst->ncHostIdx]) {
+                    continue;
+                }
+                pass = (!strcmp(inst->state, "Extant")) ? (0) : ((!strcmp(inst->state, "Pending")) ? (1) : (-1));
+                if (pass < 0)
+                    continue;
+                for (j = 0; j < inst->ccvm.virtualBootRecordLen; j++) {
+                    if (!strcmp(inst->ccvm.virtualBootRecord[j].id, vbr->id)) {
+                        seen[inst->ncHostIdx] = 1;
+                        nodes[pass][nodesLen[pass]++] = inst->ncHostIdx;
+                        break;
+                    }
+                }
+            }
+        }
+        sem_mypost(INSTCACHE);
+
+        hint[0] = '\0';
+        count = 0;
+        for (pass = 0; (pass < 2) && (count < CC_IMAGE_PEER_HINTS); pass++) {
+            for (n = 0; (n < nodesLen[pass]) && (count < CC_IMAGE_PEER_HINTS); n++) {
+                res = &(resourceCache->resources[nodes[pass][(n + seq) % nodesLen[pass]]]);
+                if (res->state != RESUP)
+                    continue;
+                euca_strncat(hint, ((count++) ? (",") : (VBR_PEERS_HINT)), sizeof(hint));
+                euca_strncat(hint, res->hostname, sizeof(hint));
+            }
+        }
+
+        if ((count > 0) && ((strlen(vbr->resourceLocation) + strlen(hint)) < sizeof(vbr->resourceLocation))) {
+            strcat(vbr->resourceLocation, hint);
+            LOGDEBUG("image %s may be fetched from peer(s) %s\n", vbr->id, hint + strlen(VBR_PEERS_HINT));
+            hinted++;
+        }
+    }
+    return (hinted);
+}
+
+//!
+//! Halves the launch score of an image once for every CC_PREFETCH_HALFLIFE_SEC
+//! elapsed since it was last decayed.
+//!
+//! @param[in] trend the trend entry to bring up to date
+//! @param[in] now the current time
+//!
+//! @pre the caller holds IMGTREND
+//!
+static void image_trend_decay(ccImageTrend * trend, time_t now)
+{
+    if ((now - trend->lastDecay) >= (64 * CC_PREFETCH_HALFLIFE_SEC)) {
+        trend->score = 0;
+        trend->lastDecay = now;
+        return;
+    }
+    while ((now - trend->lastDecay) >= CC_PREFETCH_HALFLIFE_SEC) {
+        trend->score /= 2;
+        trend->lastDecay += CC_PREFETCH_HALFLIFE_SEC;
+    }
+}
+
+//!
+//! Counts instances launched from an image toward its trend, remembering the
+//! image VBRs and instance type of the launch so the image can be prefetched
+//! later. When all CC_PREFETCH_IMAGES entries are in use, the entry with the
+//! lowest score makes room.
+//!
+//! @param[in] vm the VM the instances were launched with
+//! @param[in] count number of instances launched
+//!
+//! @return 0 on success or 1 if the image cannot be prefetched (not in object storage)
+//!
+//! @pre RESCACHE and INSTCACHE may be held, IMGTREND must not be
+//!
+int image_trend_record(virtualMachine * vm, int count)
+{
+    int i = 0;
+    int slot = -1;
+    time_t now = time(NULL);
+    virtualBootRecord *vbr = NULL;
+    virtualBootRecord *machine = NULL;
+    ccImageTrend *trend = NULL;
+
+    for (i = 0; (i < vm->virtualBootRecordLen) && !machine; i++) {
+        if (!strcmp(vm->virtualBootRecord[i].typeName, "machine"))
+            machine = &(vm->virtualBootRecord[i]);
+    }
+    if (!machine || (strstr(machine->resourceLocation, "objectstorage://") != machine->resourceLocation)) {
+        return (1);
+    }
+
+    sem_mywait(IMGTREND);
+    {
+        for (i = 0; i < CC_PREFETCH_IMAGES; i++) {
+            trend = &(imageTrendCache->images[i]);
+            image_trend_decay(trend, now);
+            if (!strcmp(trend->imageId, machine->id)) {
+                slot = i;
+                break;
+            }
+            if ((slot < 0) || (trend->score < imageTrendCache->images[slot].score))
+                slot = i;
+        }
+
+        trend = &(imageTrendCache->images[slot]);
+        if (strcmp(trend->imageId, machine->id)) {
+            bzero(trend, sizeof(ccImageTrend));
+            euca_strncpy(trend->imageId, machine->id, sizeof(trend->imageId));
+            trend->lastDecay = now;
+        }
+
+        trend->mem = vm->mem;
+        trend->cores = vm->cores;
+        trend->disk = vm->disk;
+        trend->vbrsLen = 0;
+        for (i = 0; (i < vm->virtualBootRecordLen) && (trend->vbrsLen < 3); i++) {
+            vbr = &(vm->virtualBootRecord[i]);
+            if ((!strcmp(vbr->typeName, "machine") || !strcmp(vbr->typeName, "kernel") || !strcmp(vbr->typeName, "ramdisk"))
+                && (strstr(vbr->resourceLocation, "objectstorage://") == vbr->resourceLocation)) {
+                memcpy(&(trend->vbrs[trend->vbrsLen++]), vbr, sizeof(virtualBootRecord));
+            }
+        }
+        trend->score += count;
+        LOGDEBUG("image %s launch score is now %.1f\n", trend->imageId, trend->score);
+    }
+    sem_mypost(IMGTREND);
+
+    return (0);
+}
+
+//!
+//! Asks up to config->prefetchNodes nodes to fetch each trending image (one
+//! with a launch score of at least CC_PREFETCH_MIN_SCORE) into their cache,
+//! so that the instances of it launched next do not wait on the download.
+//! Nodes are considered in the order the scheduler policy would place the
+//! next instance, skipping those that run or are launching the image, those
+//! that could not take an instance of the type it was last launched as, and
+//! those asked about the image in the last CC_PREFETCH_RESEND_SEC. The
+//! requests carry peer hints when NCs serve their caches to one another.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout the timeout for all the requests of the call
+//!
+//! @return 0 on success or 1 on failure
+//!
+//! @pre RESCACHE, INSTCACHE and IMGTREND must not be held
+//!
+int prefetch_trending_images(ncMetadata * pMeta, int timeout)
+{
+    int i = 0;
+    int j = 0;
+    int n = 0;
+    int t = 0;
+    int rc = 0;
+    int start = 0;
+    int targetsLen = 0;
+    int targets[MAXNODES] = { 0 };
+    char hasImage[MAXNODES] = { 0 };
+    char imageId[SMALL_CHAR_BUFFER_SIZE] = "";
+    time_t now = time(NULL);
+    time_t op_start = now;
+    time_t lastPrefetch[MAXNODES] = { 0 };
+    ccInstance *inst = NULL;
+    ccResource *res = NULL;
+    ccImageTrend *trend = NULL;
+    ccResourceCache *resourceCacheLocal = NULL;
+    virtualMachine *vm = NULL;
+
+    if ((vm = EUCA_ALLOC(1, sizeof(virtualMachine))) == NULL) {
+        LOGERROR("out of memory\n");
+        return (1);
+    }
+    if ((resourceCacheLocal = EUCA_ALLOC(1, sizeof(ccResourceCache))) == NULL) {
+        LOGERROR("out of memory\n");
+        EUCA_FREE(vm);
+        return (1);
+    }
+
+    for (t = 0; t < CC_PREFETCH_IMAGES; t++) {
+        // take the image's VBRs and state out of the trend cache
+        imageId[0] = '\0';
+        sem_mywait(IMGTREND);
+        {
+            trend = &(imageTrendCache->images[t]);
+            image_trend_decay(trend, now);
+            if (strlen(trend->imageId) && (trend->score >= CC_PREFETCH_MIN_SCORE) && (trend->vbrsLen > 0)) {
+                euca_strncpy(imageId, trend->imageId, sizeof(imageId));
+                bzero(vm, sizeof(virtualMachine));
+                vm->mem = trend->mem;
+                vm->cores = trend->cores;
+                vm->disk = trend->disk;
+                memcpy(vm->virtualBootRecord, trend->vbrs, (trend->vbrsLen * sizeof(virtualBootRecord)));
+                vm->virtualBootRecordLen = trend->vbrsLen;
+                memcpy(lastPrefetch, trend->lastPrefetch, sizeof(lastPrefetch));
+            }
+        }
+        sem_mypost(IMGTREND);
+        if (imageId[0] == '\0')
+            continue;
+
+        // find the nodes that already have the image, or are getting it
+        bzero(hasImage, sizeof(hasImage));
+        sem_mywait(INSTCACHE);
+        {
+            for (i = 0; i < config->ccMaxInstances; i++) {
+                inst = &(instanceCache[i].instance);
+                if ((instanceCache[i].cacheState != INSTVALID) || (inst->ncHostIdx < 0) || (inst->ncHostIdx >= MAXNODES)
+                    || (strcmp(inst->state, "Extant") && strcmp(inst->state, "Pending"))) {
+                    continue;
+                }
+                for (j = 0; j < inst->ccvm.virtualBootRecordLen; j++) {
+                    if (!strcmp(inst->ccvm.virtualBootRecord[j].id, imageId)) {
+                        hasImage[inst->ncHostIdx] = 1;
+                        break;
+                    }
+                }
+            }
+        }
+        sem_mypost(INSTCACHE);
+
+        // walk the nodes in the order the scheduler would fill them
+        targetsLen = 0;
+        sem_mywait(RESCACHE);
+        {
+            sem_mywait(CONFIG);
+            start = (((config->schedPolicy == SCHEDROUNDROBIN) || (config->schedPolicy == SCHEDCACHEAFFINITY))
+                     && (config->schedState < resourceCache->numResources)) ? (config->schedState) : (0);
+            sem_mypost(CONFIG);
+
+            for (n = 0; (n < resourceCache->numResources) && (targetsLen < config->prefetchNodes); n++) {
+                i = (start + n) % resourceCache->numResources;
+                res = &(resourceCache->resources[i]);
+                if ((res->state != RESUP) || (res->ncState != ENABLED) || hasImage[i] || ((now - lastPrefetch[i]) < CC_PREFETCH_RESEND_SEC)) {
+                    continue;
+                }
+                if ((RES_FREE_MEMORY(res) < vm->mem) || (RES_FREE_DISK(res) < vm->disk) || (RES_FREE_CORES(res) < vm->cores)) {
+                    continue;
+                }
+                targets[targetsLen++] = i;
+            }
+
+            if (targetsLen > 0) {
+                // none of the targets has the image, so a single set of hints serves all of them
+                if (config->imagePeerPort > 0) {
+                    image_peer_hints(vm, targets[0], t);
+                }
+                memcpy(resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
+            }
+        }
+        sem_mypost(RESCACHE);
+        if (targetsLen == 0)
+            continue;
+
+        // remember who was asked, whatever the outcome, so failing nodes are not asked every cycle
+        sem_mywait(IMGTREND);
+        {
+            trend = &(imageTrendCache->images[t]);
+            if (!strcmp(trend->imageId, imageId)) {
+                for (n = 0; n < targetsLen; n++) {
+                    trend->lastPrefetch[targets[n]] = now;
+                }
+            }
+        }
+        sem_mypost(IMGTREND);
+
+        for (n = 0; n < targetsLen; n++) {
+            res = &(resourceCacheLocal->resources[targets[n]]);
+            LOGINFO("asking resource %s to prefetch trending image %s\n", res->ncURL, imageId);
+            rc = ncClientCall(pMeta, ncGetTimeout(op_start, timeout, targetsLen, n), res->lockidx, res->ncURL, "ncPrefetchImages", vm);
+            if (rc) {
+                LOGWARN("resource %s failed to start prefetching image %s\n", res->ncURL, imageId);
+            }
+        }
+    }
+
+    EUCA_FREE(resourceCacheLocal);
+    EUCA_FREE(vm);
+    return (0);
+}
+
 //!
 //!
 //!
@@ -8072,9 +10728,7 @@ int doAttachNetworkInterface(ncMetadata * pMeta, char *instanceId, netConfig * n
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
@@ -8148,9 +10802,7 @@ int doDetachNetworkInterface(ncMetadata * pMeta, char *instanceId, char *attachm
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    copy_resourceCache(&resourceCacheLocal);
 
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
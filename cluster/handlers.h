@@ -96,6 +96,13 @@
 #define LOG_INTERVAL_SUMMARY_SEC                 60
 #define SCHED_TIMEOUT_SEC                         8 //! timeout for user scheduler
 #define MESSAGE_STATS_MEMORY_REGION_SIZE         10485760   //! 10 MB
+#define CC_IMAGE_PEER_HINTS                       3 //! most peers named to an NC for each image it is to launch
+#define CC_PREFETCH_IMAGES                       16 //! most images whose launch rate is tracked for prefetching
+#define CC_PREFETCH_HALFLIFE_SEC                600 //! time over which the launch score of an image halves
+#define CC_PREFETCH_MIN_SCORE                     3 //! launch score at which an image is prefetched into more NC caches
+#define CC_PREFETCH_RESEND_SEC                 3600 //! time before the same NC is asked to prefetch the same image again
+#define CC_PUSH_RECONCILE_SEC                    60 //! period of the full NC poll when NCs push their changes (at most INSTANCE_TIMEOUT/2)
+#define CC_DESCRIBE_SNAPSHOT_TRIES                3 //! lock-free scans of the instance cache attempted before settling for a non-atomic one
 
 /*
 {
@@ -133,6 +140,7 @@ enum {
     SENSORCACHE,
     STATSCACHE,
     GLOBALNETWORKINFO,
+    IMGTREND,
     NCCALL0,
     NCCALL1,
     NCCALL2,
@@ -216,6 +224,7 @@ enum {
     SCHEDROUNDROBIN,
     SCHEDPOWERSAVE,
     SCHEDUSER,
+    SCHEDCACHEAFFINITY,
     SCHEDLAST,
 };
 
@@ -305,14 +314,47 @@ typedef struct resource_t {
     char nodeStatus[24];
     boolean migrationCapable;
     char hypervisor[16];
+    char cachedImages[EUCA_MAX_CACHED_IMAGES][IMAGE_ID_LEN];    //!< images the NC reported in its cache, plus those sent to it since
+    int cachedImagesLen;               //!< number of valid entries in cachedImages
+    long long instGeneration;          //!< NC instance-list generation as of the last ncDescribeInstances, 0 to ask for a full list
+    // capacity the CC holds on the node on top of what the node reports; changed with atomic operations only, never under
+    // RESCACHE, so these must remain the last fields: refresh_resourceCache() merges node reports up to reservedMemory
+    int reservedMemory;                //!< memory held for instances the CC is launching on the node
+    int reservedDisk;                  //!< disk held for instances the CC is launching on the node
+    int reservedCores;                 //!< cores held for instances the CC is launching on the node
+    int committedMemory;               //!< memory of instances the node accepted but has not reported yet
+    int committedDisk;                 //!< disk of instances the node accepted but has not reported yet
+    int committedCores;                //!< cores of instances the node accepted but has not reported yet
 } ccResource;
 
+//! @{
+//! @name Capacity of a node still free for placements: what it last reported, less what the CC has placed on it since
+#define RES_FREE_MEMORY(_res)          ((_res)->availMemory - (_res)->reservedMemory - (_res)->committedMemory)
+#define RES_FREE_DISK(_res)            ((_res)->availDisk - (_res)->reservedDisk - (_res)->committedDisk)
+#define RES_FREE_CORES(_res)           ((_res)->availCores - (_res)->reservedCores - (_res)->committedCores)
+//! @}
+
+#define MAXPLACEMENTS                  32       //!< number of requests that may be placing instances at once
+
+//! Capacity a request placing instances holds on the nodes, kept where the monitor can give it back should the request die (see reap_placements())
+typedef struct ccPlacement_t {
+    volatile pid_t pid;                //!< process placing the instances, 0 while the slot is free
+    long long started;                 //!< start time of that process, which tells it from a later one with the same pid (0 until known)
+    int mem;                           //!< memory of each instance being placed
+    int disk;                          //!< disk of each instance being placed
+    int cores;                         //!< cores of each instance being placed
+    int reserved[MAXNODES];            //!< number of instances with capacity reserved, by index in resources[]
+} ccPlacement;
+
 typedef struct ccResourceCache_t {
     ccResource resources[MAXNODES];
     int cacheState[MAXNODES];
     int numResources;
     int lastResourceUpdate;
     int resourceCacheUpdate;
+    ccPlacement placements[MAXPLACEMENTS];  //!< requests placing instances without RESCACHE (see placement_enter())
+    int purging;                       //!< set while a node is being removed from the cache, which placers must wait out
+    volatile unsigned int seq;         //!< seqlock sequence number of the cache, odd while an update is in progress (see copy_resourceCache())
 } ccResourceCache;
 
 //
@@ -323,15 +365,42 @@ typedef struct ccInstanceCache_t {
     time_t lastseen;
     int cacheState;
     int described;
+    volatile unsigned int seq;         //!< seqlock sequence number of the slot, odd while an update is in progress
 } ccInstanceCache;
 
+//! Zero-copy, read-only view of an instance cache slot (see find_instanceCacheIdView())
+typedef struct ccInstanceView_t {
+    const ccInstance *instance;        //!< points straight into the shared instance cache, never write through it
+    int slot;                          //!< index of the slot in the instance cache
+    unsigned int seq;                  //!< sequence number of the slot when the view was taken
+    char instanceId[16];               //!< ID of the instance the view was taken of
+} ccInstanceView;
+
 typedef struct ccInstanceCacheMetadata_t {
     int numInsts; 
     int numInstsActive;
     int instanceCacheUpdate;
     int dirty;
+    volatile unsigned int generation;  //!< bumped after every update of any instance cache slot
 } ccInstanceCacheMetadata;
 
+//! Launch rate of an image, for prefetching trending images into NC caches (see image_trend_record())
+typedef struct ccImageTrend_t {
+    char imageId[SMALL_CHAR_BUFFER_SIZE];   //!< ID of the root image (emi-XXXXXXXX), empty for a free slot
+    int mem;                           //!< memory of the latest instance type the image was launched as
+    int cores;                         //!< cores of the latest instance type the image was launched as
+    int disk;                          //!< disk of the latest instance type the image was launched as
+    virtualBootRecord vbrs[3];         //!< image, kernel and ramdisk VBRs of the latest launch
+    int vbrsLen;                       //!< number of VBRs in vbrs[]
+    double score;                      //!< instances launched from the image, halved every CC_PREFETCH_HALFLIFE_SEC
+    time_t lastDecay;                  //!< time up to which the score has been decayed
+    time_t lastPrefetch[MAXNODES];     //!< when each node was last asked to prefetch the image, 0 if never
+} ccImageTrend;
+
+typedef struct ccImageTrendCache_t {
+    ccImageTrend images[CC_PREFETCH_IMAGES];
+} ccImageTrendCache;
+
 typedef struct ccConfig_t {
     char eucahome[EUCA_MAX_PATH];
     char log_file_path[EUCA_MAX_PATH];
@@ -352,7 +421,7 @@ typedef struct ccConfig_t {
     int kick_dhcp;
     int schedPolicy;
     char schedPath[EUCA_MAX_PATH];
-    int schedState;
+    int schedState;                    //!< where the scheduler starts looking, moved with compare-and-swap by placements (see placement_enter())
     int idleThresh;
     int wakeThresh;
     time_t instanceTimeout;
@@ -361,6 +430,7 @@ typedef struct ccConfig_t {
     time_t ncSensorsPollingInterval;
     int threads[NUM_THREADS];
     int ncFanout;
+    int use_ncpool;
     int ccState;
     int ccLastState;
     int kick_network;
@@ -375,6 +445,9 @@ typedef struct ccConfig_t {
     char arbitrators[256];
     int arbitratorFails;
     int ccMaxInstances;
+    int imagePeerPort;                 //!< port on which NCs serve cached images to one another, 0 if they do not
+    int prefetchNodes;                 //!< most NCs asked to prefetch a trending image per monitor cycle, 0 to never prefetch
+    int pushPort;                      //!< UDP port on which NCs notify the CC of their changes, 0 if the CC only polls them
 } ccConfig;
 
 /*----------------------------------------------------------------------------*\
@@ -419,6 +492,8 @@ int refresh_instances(ncMetadata * pMeta, int timeout, int dolock);
 int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock);
 int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock);
 int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccInstance ** outInsts, int *outInstsLen);
+int doDescribeInstanceViews(ncMetadata * pMeta, char **instIds, int instIdsLen, ccInstanceView ** outViews, int *outViewsLen);
+migration_states migration_state_upstream(migration_states state);
 int powerUp(ccResource * res);
 int powerDown(ncMetadata * pMeta, ccResource * node);
 void print_netConfig(char *prestr, netConfig * in);
@@ -426,6 +501,7 @@ int ncInstance_to_ccInstance(ccInstance * dst, ncInstance * src);
 int ccInstance_to_ncInstance(ncInstance * dst, ccInstance * src);
 int schedule_instance(virtualMachine * vm, char *amiId, char *kernelId, char *ramdiskId, char *instId, char *userData, char *platform, char *targetNode, int *outresid);
 int schedule_instance_roundrobin(virtualMachine * vm, int *outresid);
+int schedule_instance_cacheaffinity(virtualMachine * vm, int *outresid);
 int schedule_instance_explicit(virtualMachine * vm, char *targetNode, int *outresid, boolean is_migration);
 int schedule_instance_user(virtualMachine * vm, char *amiId, char *kernelId, char *ramdiskId, char *instId, char *userData, char *platform, int *outresid);
 int schedule_instance_greedy(virtualMachine * vm, int *outresid);
@@ -481,20 +557,29 @@ int privIpSet(ccInstance * inst, void *ip);
 int pubIpSet(ccInstance * inst, void *ip);
 int map_instanceCache(int (*match) (ccInstance *, void *), void *matchParam, int (*operate) (ccInstance *, void *), void *operateParam);
 void print_instanceCache(void);
+void copy_resourceCache(ccResourceCache * dst);
 void print_ccInstance(char *tag, ccInstance * in);
 void set_clean_instanceCache(void);
 void set_dirty_instanceCache(void);
 int is_clean_instanceCache(void);
 void invalidate_instanceCache(void);
 int refresh_instanceCache(char *instanceId, ccInstance * in);
+int touch_instanceCache(char **instIds, int instIdsLen);
 int add_instanceCache(char *instanceId, ccInstance * in);
 int del_instanceCacheId(char *instanceId);
 int find_instanceCacheId(char *instanceId, ccInstance ** out);
 int find_instanceCacheIP(char *ip, ccInstance ** out);
+int find_instanceCacheIdView(char *instanceId, ccInstanceView * view);
+boolean instanceCacheView_valid(ccInstanceView * view);
+int instanceCacheView_reopen(ccInstanceView * view);
+int instanceCacheView_copy(ccInstanceView * view, ccInstance * dst);
 void unlock_exit(int code);
 int sem_mywait(int lockno);
 int sem_mypost(int lockno);
 int image_cache(char *id, char *url);
+int image_peer_hints(virtualMachine * vm, int resid, int seq);
+int image_trend_record(virtualMachine * vm, int count);
+int prefetch_trending_images(ncMetadata * pMeta, int timeout);
 int image_cache_invalidate(void);
 int image_cache_proxykick(ccResource * res, int *numHosts);
 
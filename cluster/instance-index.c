@@ -0,0 +1,589 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2013 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file cluster/instance-index.c
+//! Implements the hash indexes over instanceCache[] slots. Each key type gets
+//! its own linear-probing table sized to at least four times the number of
+//! cache slots, so probe sequences stay short even when every slot is in use.
+//! Deletions use backward-shift compaction instead of tombstones, which keeps
+//! the tables clean no matter how much the cache churns, without ever having
+//! to rebuild them.
+//!
+//! Several cache entries may legitimately share a key (e.g. the private IP of
+//! an instance in Teardown that was reused by a new one), so buckets are keyed
+//! by (hash, entry) and a lookup returns the lowest matching entry, which is
+//! what the linear scans of instanceCache[] used to return.
+//!
+//! All functions assume that the caller serializes access (the INSTCACHE
+//! semaphore in the CC).
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <eucalyptus.h>
+#include <misc.h>
+
+#include "instance-index.h"
+
+#ifdef _UNIT_TEST
+#include <sys/time.h>
+#endif /* _UNIT_TEST */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define INSTIDX_LOAD_FACTOR                      4  //!< buckets per indexed entry, per table
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static int instidx_slots(int capacity);
+static uint32_t instidx_hash(const char *key);
+static instanceIndexBucket *instidx_table(instanceIndex * idx, instidx_key which);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Computes the number of buckets per table for a given cache capacity
+//!
+//! @param[in] capacity the number of instance cache slots
+//!
+//! @return the smallest power of two that is >= INSTIDX_LOAD_FACTOR * capacity
+//!
+static int instidx_slots(int capacity)
+{
+    int slots = 16;
+
+    while (slots < (capacity * INSTIDX_LOAD_FACTOR))
+        slots <<= 1;
+    return (slots);
+}
+
+//!
+//! 32-bit FNV-1a hash of a NUL-terminated key. Instance IDs and IP addresses
+//! are short and differ mostly in their last characters, which FNV mixes well.
+//!
+//! @param[in] key the string to hash
+//!
+//! @return the hash value
+//!
+static uint32_t instidx_hash(const char *key)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *key; key++) {
+        hash ^= (unsigned char)*key;
+        hash *= 16777619U;
+    }
+    return (hash);
+}
+
+//!
+//! Returns the first bucket of the table for a given key type
+//!
+//! @param[in] idx a pointer to the index
+//! @param[in] which the key type
+//!
+//! @return a pointer to the table's buckets
+//!
+static instanceIndexBucket *instidx_table(instanceIndex * idx, instidx_key which)
+{
+    return (idx->buckets + ((size_t) which * idx->slots));
+}
+
+//!
+//! Computes the number of bytes needed to index a cache of 'capacity' slots,
+//! so callers can reserve room for the index in a shared memory segment.
+//!
+//! @param[in] capacity the number of instance cache slots
+//!
+//! @return the size of the index in bytes
+//!
+size_t instidx_size(int capacity)
+{
+    return (sizeof(instanceIndex) + (sizeof(instanceIndexBucket) * INSTIDX_NKEYS * (size_t) instidx_slots(capacity)));
+}
+
+//!
+//! Initializes an empty index for a cache of 'capacity' slots
+//!
+//! @param[in] idx a pointer to a memory region of at least instidx_size(capacity) bytes
+//! @param[in] capacity the number of instance cache slots
+//!
+void instidx_init(instanceIndex * idx, int capacity)
+{
+    int i = 0;
+    int n = 0;
+
+    idx->capacity = capacity;
+    idx->slots = instidx_slots(capacity);
+    for (i = 0; i < INSTIDX_NKEYS; i++)
+        idx->used[i] = 0;
+
+    n = INSTIDX_NKEYS * idx->slots;
+    for (i = 0; i < n; i++) {
+        idx->buckets[i].hash = 0;
+        idx->buckets[i].entry = INSTIDX_NONE;
+    }
+    idx->magic = INSTIDX_MAGIC;
+}
+
+//!
+//! Checks whether a memory region holds an initialized index of the right
+//! geometry (e.g. after attaching to a shared memory segment that may have
+//! been created by a CC with a different MAX_INSTANCES_PER_CC setting)
+//!
+//! @param[in] idx a pointer to the index
+//! @param[in] capacity the expected number of instance cache slots
+//!
+//! @return TRUE if the index is usable as-is, FALSE if it must be rebuilt
+//!
+int instidx_valid(instanceIndex * idx, int capacity)
+{
+    if ((idx == NULL) || (idx->magic != INSTIDX_MAGIC) || (idx->capacity != capacity) || (idx->slots != instidx_slots(capacity)))
+        return (FALSE);
+    return (TRUE);
+}
+
+//!
+//! Adds a (key, entry) pair to one of the tables. Empty keys are not indexed.
+//!
+//! @param[in] idx a pointer to the index
+//! @param[in] which the key type
+//! @param[in] key the key value
+//! @param[in] entry the instance cache slot carrying the key
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_DUPLICATE_ERROR: if the pair is already in the table
+//!         \li EUCA_NO_SPACE_ERROR: if the table is full (cannot happen within capacity)
+//!
+int instidx_insert(instanceIndex * idx, instidx_key which, const char *key, int entry)
+{
+    uint32_t hash = 0;
+    uint32_t mask = 0;
+    uint32_t pos = 0;
+    instanceIndexBucket *table = NULL;
+
+    if ((idx == NULL) || (key == NULL) || (which >= INSTIDX_NKEYS) || (entry < 0) || (entry >= idx->capacity))
+        return (EUCA_INVALID_ERROR);
+    if (key[0] == '\0')
+        return (EUCA_OK);
+    if (idx->used[which] >= (idx->slots - 1))
+        return (EUCA_NO_SPACE_ERROR);
+
+    table = instidx_table(idx, which);
+    hash = instidx_hash(key);
+    mask = idx->slots - 1;
+    for (pos = hash & mask; table[pos].entry != INSTIDX_NONE; pos = (pos + 1) & mask) {
+        if ((table[pos].entry == entry) && (table[pos].hash == hash))
+            return (EUCA_DUPLICATE_ERROR);
+    }
+    table[pos].hash = hash;
+    table[pos].entry = entry;
+    idx->used[which]++;
+    return (EUCA_OK);
+}
+
+//!
+//! Removes a (key, entry) pair from one of the tables. The key must be the
+//! value the entry carried when it was inserted, so callers remove an entry
+//! from the index before they modify or clear the cache slot.
+//!
+//! @param[in] idx a pointer to the index
+//! @param[in] which the key type
+//! @param[in] key the key value
+//! @param[in] entry the instance cache slot carrying the key
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_NOT_FOUND_ERROR: if the pair is not in the table
+//!
+int instidx_remove(instanceIndex * idx, instidx_key which, const char *key, int entry)
+{
+    uint32_t hash = 0;
+    uint32_t mask = 0;
+    uint32_t pos = 0;
+    uint32_t next = 0;
+    uint32_t home = 0;
+    instanceIndexBucket *table = NULL;
+
+    if ((idx == NULL) || (key == NULL) || (which >= INSTIDX_NKEYS))
+        return (EUCA_INVALID_ERROR);
+    if (key[0] == '\0')
+        return (EUCA_OK);
+
+    table = instidx_table(idx, which);
+    hash = instidx_hash(key);
+    mask = idx->slots - 1;
+    for (pos = hash & mask; table[pos].entry != INSTIDX_NONE; pos = (pos + 1) & mask) {
+        if ((table[pos].entry == entry) && (table[pos].hash == hash))
+            break;
+    }
+    if (table[pos].entry == INSTIDX_NONE)
+        return (EUCA_NOT_FOUND_ERROR);
+
+    // backward-shift the rest of the cluster so that no lookup ever stops
+    // short at the hole we just made
+    for (next = (pos + 1) & mask; table[next].entry != INSTIDX_NONE; next = (next + 1) & mask) {
+        home = table[next].hash & mask;
+        // the bucket at 'next' may move into the hole only if its home is not
+        // cyclically within (pos, next]
+        if (((next > pos) && ((home <= pos) || (home > next))) || ((next < pos) && ((home <= pos) && (home > next)))) {
+            table[pos] = table[next];
+            pos = next;
+        }
+    }
+    table[pos].hash = 0;
+    table[pos].entry = INSTIDX_NONE;
+    idx->used[which]--;
+    return (EUCA_OK);
+}
+
+//!
+//! Finds the lowest cache entry carrying a given key
+//!
+//! @param[in] idx a pointer to the index
+//! @param[in] which the key type
+//! @param[in] key the key value
+//! @param[in] match callback confirming that an entry carries the key (mandatory)
+//! @param[in] ctx opaque pointer handed to the callback
+//!
+//! @return the cache slot or INSTIDX_NONE if no entry carries the key
+//!
+int instidx_lookup(instanceIndex * idx, instidx_key which, const char *key, instidx_match_fn match, void *ctx)
+{
+    int found = INSTIDX_NONE;
+    uint32_t hash = 0;
+    uint32_t mask = 0;
+    uint32_t pos = 0;
+    instanceIndexBucket *table = NULL;
+
+    if ((idx == NULL) || (key == NULL) || (key[0] == '\0') || (which >= INSTIDX_NKEYS) || (match == NULL))
+        return (INSTIDX_NONE);
+
+    table = instidx_table(idx, which);
+    hash = instidx_hash(key);
+    mask = idx->slots - 1;
+    for (pos = hash & mask; table[pos].entry != INSTIDX_NONE; pos = (pos + 1) & mask) {
+        if ((table[pos].hash == hash) && ((found == INSTIDX_NONE) || (table[pos].entry < found))) {
+            if (match(table[pos].entry, key, ctx))
+                found = table[pos].entry;
+        }
+    }
+    return (found);
+}
+
+#ifdef _UNIT_TEST
+//!
+//! Fake cache slot used by the unit test
+//!
+typedef struct test_entry_t {
+    char instanceId[16];
+    char publicIp[24];
+    char privateIp[24];
+} test_entry;
+
+static test_entry *test_cache = NULL;
+static int test_cache_size = 0;
+
+//!
+//! instidx_match_fn for the instance ID table of the test cache
+//!
+static int test_match_id(int entry, const char *key, void *ctx)
+{
+    return (!strcmp(test_cache[entry].instanceId, key));
+}
+
+//!
+//! instidx_match_fn for the private IP table of the test cache
+//!
+static int test_match_privip(int entry, const char *key, void *ctx)
+{
+    return (!strcmp(test_cache[entry].privateIp, key));
+}
+
+//!
+//! What find_instanceCacheId() used to do: scan every slot with strcmp()
+//!
+static int test_linear_id(const char *key)
+{
+    int i = 0;
+
+    for (i = 0; i < test_cache_size; i++) {
+        if (!strcmp(test_cache[i].instanceId, key))
+            return (i);
+    }
+    return (INSTIDX_NONE);
+}
+
+//!
+//! Returns the wall clock in microseconds
+//!
+static long long test_usec(void)
+{
+    struct timeval tv = { 0 };
+
+    gettimeofday(&tv, NULL);
+    return (((long long)tv.tv_sec * 1000000LL) + tv.tv_usec);
+}
+
+//!
+//! Fills the test cache with 'size' instances, indexing all of them
+//!
+static int test_fill(instanceIndex * idx, int size)
+{
+    int i = 0;
+
+    for (i = 0; i < size; i++) {
+        snprintf(test_cache[i].instanceId, sizeof(test_cache[i].instanceId), "i-%08X", (unsigned)(i * 2654435761U));
+        snprintf(test_cache[i].publicIp, sizeof(test_cache[i].publicIp), "10.%d.%d.%d", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+        snprintf(test_cache[i].privateIp, sizeof(test_cache[i].privateIp), "172.16.%d.%d", (i >> 8) & 0xff, i & 0xff);
+        if ((instidx_insert(idx, INSTIDX_ID, test_cache[i].instanceId, i) != EUCA_OK)
+            || (instidx_insert(idx, INSTIDX_PUBIP, test_cache[i].publicIp, i) != EUCA_OK)
+            || (instidx_insert(idx, INSTIDX_PRIVIP, test_cache[i].privateIp, i) != EUCA_OK)) {
+            printf("FAIL: could not index entry %d\n", i);
+            return (1);
+        }
+    }
+    return (0);
+}
+
+//!
+//! Checks that every entry is found through the index exactly where the
+//! linear scan finds it
+//!
+static int test_verify(instanceIndex * idx, int size)
+{
+    int i = 0;
+
+    for (i = 0; i < size; i++) {
+        if (test_cache[i].instanceId[0] == '\0')
+            continue;
+        if (instidx_lookup(idx, INSTIDX_ID, test_cache[i].instanceId, test_match_id, NULL) != test_linear_id(test_cache[i].instanceId)) {
+            printf("FAIL: lookup of %s disagrees with linear scan\n", test_cache[i].instanceId);
+            return (1);
+        }
+    }
+    return (0);
+}
+
+//!
+//! Unit test and benchmark: correctness of insert/remove/lookup under churn
+//! and with duplicate keys, then lookup latency of the index vs. the linear
+//! scan for growing cache sizes.
+//!
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int j = 0;
+    int size = 0;
+    int iters = 0;
+    int errors = 0;
+    int sizes[] = { 100, 1000, 5000, 10000, 20000, 50000 };
+    volatile int sink = 0;
+    long long t0 = 0;
+    long long tlin = 0;
+    long long tidx = 0;
+    instanceIndex *idx = NULL;
+
+    // correctness with churn: remove a third of the entries, re-add them with new IDs
+    size = 10000;
+    test_cache = calloc(size, sizeof(test_entry));
+    idx = calloc(1, instidx_size(size));
+    test_cache_size = size;
+    instidx_init(idx, size);
+    errors += test_fill(idx, size);
+    errors += test_verify(idx, size);
+    for (i = 0; i < size; i += 3) {
+        if (instidx_remove(idx, INSTIDX_ID, test_cache[i].instanceId, i) != EUCA_OK) {
+            printf("FAIL: could not remove %s\n", test_cache[i].instanceId);
+            errors++;
+        }
+        test_cache[i].instanceId[0] = '\0';
+    }
+    errors += test_verify(idx, size);
+    for (i = 0; i < size; i += 3) {
+        snprintf(test_cache[i].instanceId, sizeof(test_cache[i].instanceId), "i-R%07d", i);
+        instidx_insert(idx, INSTIDX_ID, test_cache[i].instanceId, i);
+    }
+    errors += test_verify(idx, size);
+    if (instidx_insert(idx, INSTIDX_ID, test_cache[1].instanceId, 1) != EUCA_DUPLICATE_ERROR) {
+        printf("FAIL: duplicate insert not detected\n");
+        errors++;
+    }
+    if (instidx_remove(idx, INSTIDX_ID, "i-NOTTHERE", 1) != EUCA_NOT_FOUND_ERROR) {
+        printf("FAIL: removal of missing key not detected\n");
+        errors++;
+    }
+    // two slots sharing a private IP: the lower one wins, then the other once it is gone
+    strcpy(test_cache[42].privateIp, test_cache[7].privateIp);
+    instidx_remove(idx, INSTIDX_PRIVIP, "172.16.0.42", 42);
+    instidx_insert(idx, INSTIDX_PRIVIP, test_cache[42].privateIp, 42);
+    if (instidx_lookup(idx, INSTIDX_PRIVIP, test_cache[7].privateIp, test_match_privip, NULL) != 7) {
+        printf("FAIL: duplicate key did not resolve to the lowest entry\n");
+        errors++;
+    }
+    instidx_remove(idx, INSTIDX_PRIVIP, test_cache[7].privateIp, 7);
+    test_cache[7].privateIp[0] = '\0';
+    if (instidx_lookup(idx, INSTIDX_PRIVIP, test_cache[42].privateIp, test_match_privip, NULL) != 42) {
+        printf("FAIL: duplicate key lost after removal of its twin\n");
+        errors++;
+    }
+    free(idx);
+    free(test_cache);
+    printf("correctness: %s\n", errors ? "FAILED" : "ok");
+
+    // lookup latency vs. cache size
+    printf("%10s %16s %16s %10s\n", "slots", "linear (ns/op)", "index (ns/op)", "speedup");
+    for (j = 0; j < (int)(sizeof(sizes) / sizeof(sizes[0])); j++) {
+        size = sizes[j];
+        test_cache = calloc(size, sizeof(test_entry));
+        idx = calloc(1, instidx_size(size));
+        test_cache_size = size;
+        instidx_init(idx, size);
+        errors += test_fill(idx, size);
+
+        iters = 2000000 / size + 200;
+        t0 = test_usec();
+        for (i = 0; i < iters; i++)
+            sink += test_linear_id(test_cache[((unsigned)i * 7919U) % size].instanceId);
+        tlin = test_usec() - t0;
+
+        t0 = test_usec();
+        for (i = 0; i < (iters * 100); i++)
+            sink += instidx_lookup(idx, INSTIDX_ID, test_cache[((unsigned)i * 7919U) % size].instanceId, test_match_id, NULL);
+        tidx = test_usec() - t0;
+
+        printf("%10d %16.1f %16.1f %9.0fx\n", size, (tlin * 1000.0) / iters, (tidx * 1000.0) / (iters * 100.0),
+               ((tidx > 0) ? ((double)tlin * 100.0) / tidx : 0.0));
+        free(idx);
+        free(test_cache);
+    }
+
+    return (errors ? 1 : 0);
+}
+#endif /* _UNIT_TEST */
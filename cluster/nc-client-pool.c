@@ -0,0 +1,716 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2013 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file cluster/nc-client-pool.c
+//! Implements the in-process NC client engine used by ncClientCall() and by
+//! the monitor's refresh_*() fan-out. Each CC process keeps at most one Axis2
+//! stub per NC URL alive across calls, and a bounded set of worker threads
+//! executes per-node tasks so that a polling cycle no longer forks a child
+//! (and builds a new stub) for every node.
+//!
+//! The state is per process. CC processes fork (the monitor, sensor and
+//! stats "threads", the legacy ncClientCall path), so the engine registers
+//! pthread_atfork() handlers that give the child a clean, empty engine
+//! rather than inheriting stubs whose sockets are shared with the parent.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <eucalyptus.h>
+#include "axis2_skel_EucalyptusCC.h"
+
+#include <misc.h>
+#include <euca_string.h>
+#include <euca_axis.h>
+
+#include "handlers.h"
+#include "client-marshal.h"
+#include "nc-client-pool.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A persistent stub slot, keyed by NC URL
+typedef struct ncPoolStub_t {
+    char ncURL[384];                   //!< URL of the NC this stub talks to
+    ncStub *stub;                      //!< the Axis2 stub, NULL until first use
+    boolean busy;                      //!< TRUE while a caller holds the stub
+    time_t lastUsed;                   //!< last time the stub was released
+    long long calls;                   //!< number of calls made through this stub
+} ncPoolStub;
+
+//! Completion state shared by all tasks submitted through one ncpool_run()
+typedef struct ncPoolBatch_t {
+    int refs;                          //!< the caller plus every task not yet finished
+    int pending;                       //!< tasks not yet finished
+    int *results;                      //!< per-task return codes
+    boolean expired;                   //!< set once the caller stopped waiting, after which tasks may not publish (see ncpool_publish())
+    pthread_cond_t done;               //!< signaled when pending reaches 0
+} ncPoolBatch;
+
+//! A queued unit of work
+typedef struct ncPoolJob_t {
+    ncPoolTask task;                   //!< function to run
+    void *arg;                         //!< its argument
+    int idx;                           //!< index into batch->results
+    ncPoolBatch *batch;                //!< batch this job belongs to
+    struct ncPoolJob_t *next;          //!< next job in the queue
+} ncPoolJob;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+extern ccConfig *config;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< protects everything below
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER; //!< signaled when a job is queued or on shutdown
+static pthread_cond_t pool_stub_free = PTHREAD_COND_INITIALIZER;    //!< signaled when a stub is released
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static pid_t pool_pid = 0;             //!< process that owns the worker threads
+static int pool_workers = 0;           //!< number of running worker threads
+static boolean pool_stopping = FALSE;
+static pthread_t pool_threads[NC_POOL_MAX_WORKERS];
+static ncPoolJob *pool_head = NULL;
+static ncPoolJob *pool_tail = NULL;
+static ncPoolStub pool_stubs[NC_POOL_MAX_STUBS];
+static __thread ncPoolJob *pool_current = NULL;    //!< job the calling worker thread is running, if any
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void ncpool_atfork_prepare(void);
+static void ncpool_atfork_parent(void);
+static void ncpool_atfork_child(void);
+static void ncpool_register_atfork(void);
+static void ncpool_batch_put(ncPoolBatch * batch);
+static void *ncpool_worker(void *arg);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Holds the pool mutex across fork() so the child never sees it mid-update
+//!
+static void ncpool_atfork_prepare(void)
+{
+    pthread_mutex_lock(&pool_mutex);
+}
+
+//!
+//! Releases the pool mutex in the parent after fork()
+//!
+static void ncpool_atfork_parent(void)
+{
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+//!
+//! Resets the engine in a freshly forked child. Worker threads do not survive
+//! fork() and the inherited stubs share their sockets with the parent, so the
+//! child forgets about both (the stub memory is deliberately not freed since
+//! tearing down an Axis2 environment may write to the shared connection).
+//!
+static void ncpool_atfork_child(void)
+{
+    pthread_mutex_init(&pool_mutex, NULL);
+    pthread_cond_init(&pool_work, NULL);
+    pthread_cond_init(&pool_stub_free, NULL);
+    pool_pid = 0;
+    pool_workers = 0;
+    pool_stopping = FALSE;
+    pool_head = pool_tail = NULL;
+    bzero(pool_stubs, sizeof(pool_stubs));
+}
+
+//!
+//! Installs the fork handlers exactly once per process image
+//!
+static void ncpool_register_atfork(void)
+{
+    pthread_atfork(ncpool_atfork_prepare, ncpool_atfork_parent, ncpool_atfork_child);
+}
+
+//!
+//! Tells whether NC calls should go through the in-process engine
+//!
+//! @return TRUE if NC_CLIENT_POOL is enabled in the CC configuration
+//!
+boolean ncpool_enabled(void)
+{
+    return ((config && config->use_ncpool) ? TRUE : FALSE);
+}
+
+//!
+//! Starts the worker threads for this process, if they are not running yet.
+//! Calling it again from the same process is a no-op, so callers may invoke
+//! it lazily before every fan-out.
+//!
+//! @param[in] numWorkers number of worker threads to start (clamped to [1, NC_POOL_MAX_WORKERS])
+//!
+//! @return EUCA_OK on success or EUCA_THREAD_ERROR if no worker could be started
+//!
+int ncpool_init(int numWorkers)
+{
+    int i = 0;
+
+    pthread_once(&pool_once, ncpool_register_atfork);
+
+    if (numWorkers < 1)
+        numWorkers = 1;
+    if (numWorkers > NC_POOL_MAX_WORKERS)
+        numWorkers = NC_POOL_MAX_WORKERS;
+
+    pthread_mutex_lock(&pool_mutex);
+    {
+        if ((pool_pid == getpid()) && (pool_workers > 0)) {
+            pthread_mutex_unlock(&pool_mutex);
+            return (EUCA_OK);
+        }
+
+        pool_pid = getpid();
+        pool_stopping = FALSE;
+        for (i = 0; i < numWorkers; i++) {
+            if (pthread_create(&pool_threads[i], NULL, ncpool_worker, NULL) != 0) {
+                LOGERROR("failed to start NC client worker thread %d of %d\n", (i + 1), numWorkers);
+                break;
+            }
+            pool_workers++;
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (pool_workers == 0)
+        return (EUCA_THREAD_ERROR);
+
+    LOGDEBUG("NC client engine started with %d worker(s) in process %d\n", pool_workers, pool_pid);
+    return (EUCA_OK);
+}
+
+//!
+//! Stops the worker threads of this process and destroys all idle stubs.
+//! Jobs still queued are executed before the workers exit.
+//!
+void ncpool_shutdown(void)
+{
+    int i = 0;
+    int workers = 0;
+    ncStub *stubs[NC_POOL_MAX_STUBS] = { NULL };
+
+    pthread_mutex_lock(&pool_mutex);
+    {
+        if (pool_pid == getpid()) {
+            pool_stopping = TRUE;
+            workers = pool_workers;
+            pthread_cond_broadcast(&pool_work);
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    for (i = 0; i < workers; i++) {
+        pthread_join(pool_threads[i], NULL);
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    {
+        pool_workers = 0;
+        pool_stopping = FALSE;
+        for (i = 0; i < NC_POOL_MAX_STUBS; i++) {
+            if (pool_stubs[i].stub && !pool_stubs[i].busy) {
+                stubs[i] = pool_stubs[i].stub;
+                bzero(&(pool_stubs[i]), sizeof(ncPoolStub));
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    for (i = 0; i < NC_POOL_MAX_STUBS; i++) {
+        if (stubs[i])
+            ncStubDestroy(stubs[i]);
+    }
+}
+
+//!
+//! Returns the persistent stub for the given NC, creating it on first use.
+//! The stub is reserved for the caller until ncpool_stub_release() is invoked;
+//! a concurrent caller for the same NC waits up to 'timeout' seconds for it.
+//!
+//! @param[in] ncURL the NC endpoint URL
+//! @param[in] timeout how long to wait for a busy stub, in seconds
+//!
+//! @return a pointer to the stub or NULL on failure
+//!
+ncStub *ncpool_stub_acquire(char *ncURL, int timeout)
+{
+    int i = 0;
+    int slot = -1;
+    int empty = -1;
+    int victim = -1;
+    ncStub *stub = NULL;
+    ncStub *evicted = NULL;
+    struct timespec deadline = { 0 };
+
+    if (ncURL == NULL)
+        return (NULL);
+
+    pthread_once(&pool_once, ncpool_register_atfork);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ((timeout > 0) ? timeout : OP_TIMEOUT_PERNODE);
+
+    pthread_mutex_lock(&pool_mutex);
+    {
+        for (;;) {
+            slot = empty = victim = -1;
+            for (i = 0; i < NC_POOL_MAX_STUBS; i++) {
+                if (!strcmp(pool_stubs[i].ncURL, ncURL)) {
+                    slot = i;
+                    break;
+                } else if (pool_stubs[i].ncURL[0] == '\0') {
+                    if (empty < 0)
+                        empty = i;
+                } else if (!pool_stubs[i].busy && ((victim < 0) || (pool_stubs[i].lastUsed < pool_stubs[victim].lastUsed))) {
+                    victim = i;
+                }
+            }
+
+            if (slot >= 0 && !pool_stubs[slot].busy)
+                break;
+
+            if ((slot < 0) && ((empty >= 0) || (victim >= 0))) {
+                // claim an empty slot, or evict the least recently used idle stub
+                slot = ((empty >= 0) ? empty : victim);
+                evicted = pool_stubs[slot].stub;
+                bzero(&(pool_stubs[slot]), sizeof(ncPoolStub));
+                euca_strncpy(pool_stubs[slot].ncURL, ncURL, sizeof(pool_stubs[slot].ncURL));
+                break;
+            }
+
+            if (pthread_cond_timedwait(&pool_stub_free, &pool_mutex, &deadline) == ETIMEDOUT) {
+                pthread_mutex_unlock(&pool_mutex);
+                LOGWARN("timed out waiting for NC client stub for %s\n", ncURL);
+                return (NULL);
+            }
+        }
+
+        pool_stubs[slot].busy = TRUE;
+        stub = pool_stubs[slot].stub;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (evicted)
+        ncStubDestroy(evicted);
+
+    if (stub == NULL) {
+        // first use of this NC in this process: build the stub outside the lock
+        if ((stub = ncStubCreate(ncURL, NULL, NULL)) != NULL) {
+            if (config->use_wssec) {
+                if (InitWSSEC(stub->env, stub->stub, config->policyFile)) {
+                    LOGERROR("failed to initialize WS-SEC policy for NC stub %s\n", ncURL);
+                }
+            }
+            LOGDEBUG("created persistent NC client stub for %s\n", ncURL);
+        }
+
+        pthread_mutex_lock(&pool_mutex);
+        {
+            if (stub) {
+                pool_stubs[slot].stub = stub;
+            } else {
+                bzero(&(pool_stubs[slot]), sizeof(ncPoolStub));
+                pthread_cond_broadcast(&pool_stub_free);
+            }
+        }
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    return (stub);
+}
+
+//!
+//! Hands a stub obtained from ncpool_stub_acquire() back to the cache. A stub
+//! whose last call failed is destroyed, since its connection may be in an
+//! undefined state; the next call to that NC will create a fresh one.
+//!
+//! @param[in] pStub the stub to release
+//! @param[in] healthy FALSE if the stub must be discarded
+//!
+void ncpool_stub_release(ncStub * pStub, boolean healthy)
+{
+    int i = 0;
+    ncStub *discard = NULL;
+
+    if (pStub == NULL)
+        return;
+
+    pthread_mutex_lock(&pool_mutex);
+    {
+        for (i = 0; i < NC_POOL_MAX_STUBS; i++) {
+            if (pool_stubs[i].stub == pStub) {
+                pool_stubs[i].calls++;
+                pool_stubs[i].lastUsed = time(NULL);
+                pool_stubs[i].busy = FALSE;
+                if (!healthy) {
+                    discard = pStub;
+                    pool_stubs[i].stub = NULL;
+                }
+                break;
+            }
+        }
+        if (i == NC_POOL_MAX_STUBS) {
+            // not ours (e.g. the cache was reset by a fork), do not keep it
+            discard = pStub;
+        }
+        pthread_cond_broadcast(&pool_stub_free);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (discard)
+        ncStubDestroy(discard);
+}
+
+//!
+//! Destroys stubs that have been idle for longer than NC_POOL_STUB_IDLE_SEC,
+//! so that nodes removed from the configuration do not pin connections forever.
+//!
+void ncpool_stub_reap(void)
+{
+    int i = 0;
+    time_t now = time(NULL);
+    ncStub *stubs[NC_POOL_MAX_STUBS] = { NULL };
+
+    pthread_mutex_lock(&pool_mutex);
+    {
+        for (i = 0; i < NC_POOL_MAX_STUBS; i++) {
+            if (pool_stubs[i].ncURL[0] != '\0' && !pool_stubs[i].busy && ((now - pool_stubs[i].lastUsed) > NC_POOL_STUB_IDLE_SEC)) {
+                LOGDEBUG("dropping idle NC client stub for %s after %lld call(s)\n", pool_stubs[i].ncURL, pool_stubs[i].calls);
+                stubs[i] = pool_stubs[i].stub;
+                bzero(&(pool_stubs[i]), sizeof(ncPoolStub));
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    for (i = 0; i < NC_POOL_MAX_STUBS; i++) {
+        if (stubs[i])
+            ncStubDestroy(stubs[i]);
+    }
+}
+
+//!
+//! Drops one reference to a batch, freeing it with the last one.
+//! Must be called with pool_mutex held.
+//!
+//! @param[in] batch the batch to release
+//!
+static void ncpool_batch_put(ncPoolBatch * batch)
+{
+    if (--batch->refs == 0) {
+        pthread_cond_destroy(&(batch->done));
+        EUCA_FREE(batch->results);
+        EUCA_FREE(batch);
+    }
+}
+
+//!
+//! Worker thread main loop: pops jobs off the queue until shutdown
+//!
+//! @param[in] arg unused
+//!
+//! @return always NULL
+//!
+static void *ncpool_worker(void *arg)
+{
+    int rc = 0;
+    ncPoolJob *job = NULL;
+
+    for (;;) {
+        pthread_mutex_lock(&pool_mutex);
+        {
+            while (pool_head == NULL && !pool_stopping) {
+                pthread_cond_wait(&pool_work, &pool_mutex);
+            }
+
+            if (pool_head == NULL) {
+                pthread_mutex_unlock(&pool_mutex);
+                break;
+            }
+
+            job = pool_head;
+            if ((pool_head = job->next) == NULL)
+                pool_tail = NULL;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+
+        pool_current = job;
+        rc = job->task(job->arg);
+        pool_current = NULL;
+
+        pthread_mutex_lock(&pool_mutex);
+        {
+            job->batch->results[job->idx] = rc;
+            if (--job->batch->pending == 0)
+                pthread_cond_broadcast(&(job->batch->done));
+            ncpool_batch_put(job->batch);
+        }
+        pthread_mutex_unlock(&pool_mutex);
+
+        EUCA_FREE(job);
+    }
+
+    return (NULL);
+}
+
+//!
+//! Runs task(args[i]) for every i on the worker pool and waits for all of
+//! them, or until 'timeout' seconds have passed. If the workers have not been
+//! started in this process they are started first; if that fails the tasks
+//! run in the calling thread, one after another.
+//!
+//! Tasks that are still running when the timeout expires are left to finish
+//! on their own and their results are discarded, so each args[i] must stay
+//! valid until the task itself is done with it (tasks normally own and free
+//! their argument). Tasks hand anything the caller reads back through
+//! ncpool_publish(), which turns away those that are late.
+//!
+//! @param[in]  task the function to run
+//! @param[in]  args array of numTasks task arguments
+//! @param[out] results optional array of numTasks return codes (EUCA_TIMEOUT_ERROR for unfinished tasks)
+//! @param[in]  numTasks number of tasks
+//! @param[in]  timeout overall limit in seconds
+//!
+//! @return EUCA_OK if all tasks finished in time, EUCA_TIMEOUT_ERROR otherwise
+//!
+int ncpool_run(ncPoolTask task, void **args, int *results, int numTasks, int timeout)
+{
+    int i = 0;
+    int rc = 0;
+    int ret = EUCA_OK;
+    ncPoolJob *job = NULL;
+    ncPoolBatch *batch = NULL;
+    struct timespec deadline = { 0 };
+
+    if ((task == NULL) || (numTasks <= 0))
+        return (EUCA_OK);
+
+    if (ncpool_init(config ? config->ncFanout : 1) != EUCA_OK) {
+        for (i = 0; i < numTasks; i++) {
+            rc = task(args[i]);
+            if (results)
+                results[i] = rc;
+        }
+        return (EUCA_OK);
+    }
+
+    if ((batch = EUCA_ZALLOC(1, sizeof(ncPoolBatch))) == NULL) {
+        LOGFATAL("out of memory!\n");
+        unlock_exit(1);
+    }
+    if ((batch->results = EUCA_ZALLOC(numTasks, sizeof(int))) == NULL) {
+        LOGFATAL("out of memory!\n");
+        unlock_exit(1);
+    }
+    pthread_cond_init(&(batch->done), NULL);
+    batch->refs = numTasks + 1;
+    batch->pending = numTasks;
+    for (i = 0; i < numTasks; i++)
+        batch->results[i] = EUCA_TIMEOUT_ERROR;
+
+    pthread_mutex_lock(&pool_mutex);
+    {
+        for (i = 0; i < numTasks; i++) {
+            if ((job = EUCA_ZALLOC(1, sizeof(ncPoolJob))) == NULL) {
+                LOGFATAL("out of memory!\n");
+                unlock_exit(1);
+            }
+            job->task = task;
+            job->arg = args[i];
+            job->idx = i;
+            job->batch = batch;
+            if (pool_tail)
+                pool_tail->next = job;
+            else
+                pool_head = job;
+            pool_tail = job;
+        }
+        pthread_cond_broadcast(&pool_work);
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += ((timeout > 0) ? timeout : OP_TIMEOUT);
+        while (batch->pending > 0) {
+            if (pthread_cond_timedwait(&(batch->done), &pool_mutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+
+        if (batch->pending > 0) {
+            LOGWARN("%d of %d NC task(s) did not complete within %d seconds\n", batch->pending, numTasks, timeout);
+            ret = EUCA_TIMEOUT_ERROR;
+        }
+        batch->expired = TRUE;
+
+        if (results)
+            memcpy(results, batch->results, (numTasks * sizeof(int)));
+        ncpool_batch_put(batch);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    return (ret);
+}
+
+//!
+//! Lets a task hand its results over to the caller of ncpool_run(), unless
+//! the caller has stopped waiting for it: 'publish' runs with pool_mutex
+//! held, so it either completes before ncpool_run() returns or does not run
+//! at all. Outside of a worker thread, such as when the tasks run in the
+//! calling thread or in a forked child, 'publish' always runs.
+//!
+//! @param[in] publish the function storing the results, which must not call into the pool
+//! @param[in] arg its argument
+//!
+//! @return EUCA_OK if the results were published or EUCA_TIMEOUT_ERROR if the task is late
+//!
+int ncpool_publish(void (*publish) (void *arg), void *arg)
+{
+    int ret = EUCA_OK;
+
+    if (pool_current == NULL) {
+        publish(arg);
+        return (EUCA_OK);
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    {
+        if (pool_current->batch->expired)
+            ret = EUCA_TIMEOUT_ERROR;
+        else
+            publish(arg);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return (ret);
+}
@@ -95,6 +95,10 @@
 
 #define DONOTHING                                0
 #define EVENTLOG                                 0
+#define VIEW_READ_RETRIES                        3  //!< optimistic reads of an instance cache view before falling back to a locked copy
+
+//! Copies a string field of a cached instance with view_copy_str()
+#define VIEW_COPY_STR(_dst, _src, _field)        view_copy_str((_dst)->_field, (_src)->_field, sizeof((_dst)->_field))
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -141,6 +145,11 @@ extern euca_network *gpEucaNet;
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static void view_copy_str(char *dst, const char *src, size_t size);
+static void view_copy_net(netConfig * dst, const netConfig * src);
+static void view_copy_instance(ccInstance * dst, const ccInstance * src);
+static adb_ccInstanceType_t *ccInstanceViewUnmarshal(ccInstanceView * view, ccInstance * scratch, const axutil_env_t * env);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -1286,13 +1295,13 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
     adb_ccInstanceType_t *it = NULL;
     char **instIds = NULL;
     int instIdsLen = 0;
-    int outInstsLen = 0;
+    int outViewsLen = 0;
     int i = 0;
     int rc = 0;
     axis2_bool_t status = AXIS2_TRUE;
     char statusMessage[256] = { 0 };
-    ccInstance *outInsts = NULL;
-    ccInstance *myInstance = NULL;
+    ccInstance *scratch = NULL;
+    ccInstanceView *outViews = NULL;
     ncMetadata ccMeta = { 0 };
     long long call_time = time_ms();
 
@@ -1310,24 +1319,27 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
     rc = 1;
     if (!DONOTHING) {
         threadCorrelationId *corr_id = set_corrid(ccMeta.correlationId);
-        rc = doDescribeInstances(&ccMeta, instIds, instIdsLen, &outInsts, &outInstsLen);
+        rc = doDescribeInstanceViews(&ccMeta, instIds, instIdsLen, &outViews, &outViewsLen);
         unset_corrid(corr_id);
     }
 
     EUCA_FREE(instIds);
     if (rc) {
-        LOGERROR("doDescribeInstances() failed: %d (%d)\n", rc, instIdsLen);
+        LOGERROR("doDescribeInstanceViews() failed: %d (%d)\n", rc, instIdsLen);
         status = AXIS2_FALSE;
         snprintf(statusMessage, 255, "ERROR");
     } else {
-        for (i = 0; i < outInstsLen; i++) {
-            myInstance = &(outInsts[i]);
-
-            it = adb_ccInstanceType_create(env);
-            rc = ccInstanceUnmarshal(it, myInstance, env);
-            adb_describeInstancesResponseType_add_instances(dirt, env, it);
+        if ((outViewsLen > 0) && ((scratch = EUCA_ALLOC(1, sizeof(ccInstance))) == NULL)) {
+            LOGFATAL("out of memory!\n");
+            outViewsLen = 0;
         }
-        EUCA_FREE(outInsts);
+        for (i = 0; i < outViewsLen; i++) {
+            if ((it = ccInstanceViewUnmarshal(&(outViews[i]), scratch, env)) != NULL) {
+                adb_describeInstancesResponseType_add_instances(dirt, env, it);
+            }
+        }
+        EUCA_FREE(scratch);
+        EUCA_FREE(outViews);
     }
 
     adb_describeInstancesResponseType_set_correlationId(dirt, env, ccMeta.correlationId);
@@ -1345,6 +1357,149 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
     return (ret);
 }
 
+//!
+//! Copies a string field of a cached instance that a writer may be changing
+//! as it is read, so that the copy ends within the field whether or not the
+//! field holds its terminator at that moment.
+//!
+//! @param[out] dst where to copy the string
+//! @param[in]  src the field
+//! @param[in]  size size of the field, and of dst
+//!
+static void view_copy_str(char *dst, const char *src, size_t size)
+{
+    size_t len = strnlen(src, (size - 1));
+
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+//!
+//! Copies the fields of a network configuration of a cached instance that
+//! ccInstanceUnmarshal() reads, see view_copy_instance().
+//!
+//! @param[out] dst where to copy the configuration
+//! @param[in]  src the configuration in the cache
+//!
+static void view_copy_net(netConfig * dst, const netConfig * src)
+{
+    dst->vlan = src->vlan;
+    dst->networkIndex = src->networkIndex;
+    dst->device = src->device;
+    VIEW_COPY_STR(dst, src, privateMac);
+    VIEW_COPY_STR(dst, src, publicIp);
+    VIEW_COPY_STR(dst, src, privateIp);
+    VIEW_COPY_STR(dst, src, interfaceId);
+    VIEW_COPY_STR(dst, src, attachmentId);
+}
+
+//!
+//! Copies the fields of a cached instance that ccInstanceUnmarshal() reads,
+//! without the cache lock. Strings are copied no further than they go, and
+//! counts are clamped to their arrays, so a torn read makes a wrong copy but
+//! never a read out of bounds; the caller checks the view afterwards to tell.
+//! The other fields of dst are left as they were.
+//!
+//! @param[out] dst where to copy the instance
+//! @param[in]  src the instance in the cache
+//!
+static void view_copy_instance(ccInstance * dst, const ccInstance * src)
+{
+    int i = 0;
+
+    VIEW_COPY_STR(dst, src, instanceId);
+    VIEW_COPY_STR(dst, src, uuid);
+    VIEW_COPY_STR(dst, src, reservationId);
+    VIEW_COPY_STR(dst, src, ownerId);
+    VIEW_COPY_STR(dst, src, accountId);
+    VIEW_COPY_STR(dst, src, amiId);
+    VIEW_COPY_STR(dst, src, kernelId);
+    VIEW_COPY_STR(dst, src, ramdiskId);
+    VIEW_COPY_STR(dst, src, keyName);
+    VIEW_COPY_STR(dst, src, state);
+    VIEW_COPY_STR(dst, src, serviceTag);
+    VIEW_COPY_STR(dst, src, userData);
+    VIEW_COPY_STR(dst, src, launchIndex);
+    VIEW_COPY_STR(dst, src, platform);
+    VIEW_COPY_STR(dst, src, guestStateName);
+    VIEW_COPY_STR(dst, src, bundleTaskStateName);
+    VIEW_COPY_STR(dst, src, migration_src);
+    VIEW_COPY_STR(dst, src, migration_dst);
+    dst->ts = src->ts;
+    dst->migration_state = src->migration_state;
+    dst->bundleTaskProgress = src->bundleTaskProgress;
+    dst->blkbytes = src->blkbytes;
+    dst->netbytes = src->netbytes;
+
+    for (i = 0; i < 64; i++)
+        VIEW_COPY_STR(dst, src, groupNames[i]);
+
+    dst->volumesSize = MIN(MAX(src->volumesSize, 0), EUCA_MAX_VOLUMES);
+    for (i = 0; i < dst->volumesSize; i++) {
+        VIEW_COPY_STR(dst, src, volumes[i].volumeId);
+        VIEW_COPY_STR(dst, src, volumes[i].attachmentToken);
+        VIEW_COPY_STR(dst, src, volumes[i].devName);
+        VIEW_COPY_STR(dst, src, volumes[i].stateName);
+    }
+
+    view_copy_net(&(dst->ccnet), &(src->ccnet));
+    dst->secNetCfgsSize = MIN(MAX(src->secNetCfgsSize, 0), EUCA_MAX_NICS);
+    for (i = 0; i < dst->secNetCfgsSize; i++)
+        view_copy_net(&(dst->secNetCfgs[i]), &(src->secNetCfgs[i]));
+
+    dst->ccvm.mem = src->ccvm.mem;
+    dst->ccvm.cores = src->ccvm.cores;
+    dst->ccvm.disk = src->ccvm.disk;
+    VIEW_COPY_STR(dst, src, ccvm.name);
+    dst->ccvm.virtualBootRecordLen = MIN(MAX(src->ccvm.virtualBootRecordLen, 0), EUCA_MAX_VBRS);
+    for (i = 0; i < dst->ccvm.virtualBootRecordLen; i++) {
+        VIEW_COPY_STR(dst, src, ccvm.virtualBootRecord[i].resourceLocation);
+        VIEW_COPY_STR(dst, src, ccvm.virtualBootRecord[i].guestDeviceName);
+        VIEW_COPY_STR(dst, src, ccvm.virtualBootRecord[i].formatName);
+        VIEW_COPY_STR(dst, src, ccvm.virtualBootRecord[i].id);
+        VIEW_COPY_STR(dst, src, ccvm.virtualBootRecord[i].typeName);
+        dst->ccvm.virtualBootRecord[i].sizeBytes = src->ccvm.virtualBootRecord[i].sizeBytes;
+    }
+}
+
+//!
+//! Converts an instance to an AXIS2 instance structure out of the shared
+//! instance cache, without its lock. Only the fields the reply carries are
+//! copied, each within its bounds, and the copy is checked against the slot
+//! before any of it reaches AXIS2: if the slot got updated meanwhile, the
+//! read is retried, and after a few failed attempts the instance is copied
+//! with the cache lock held.
+//!
+//! @param[in] view a pointer to a view of the instance cache slot
+//! @param[in] scratch a pointer to an instance structure to copy the instance into
+//! @param[in] env pointer to the AXIS2 environment structure
+//!
+//! @return the AXIS2 instance structure or NULL if the instance left the cache
+//!
+static adb_ccInstanceType_t *ccInstanceViewUnmarshal(ccInstanceView * view, ccInstance * scratch, const axutil_env_t * env)
+{
+    int i = 0;
+    adb_ccInstanceType_t *it = NULL;
+
+    for (i = 0; i < VIEW_READ_RETRIES; i++) {
+        view_copy_instance(scratch, view->instance);
+        if (instanceCacheView_valid(view))
+            break;
+
+        // the slot changed under us, drop what we read and look again
+        if (instanceCacheView_reopen(view) != EUCA_OK)
+            return (NULL);
+    }
+
+    if ((i == VIEW_READ_RETRIES) && (instanceCacheView_copy(view, scratch) != EUCA_OK))
+        return (NULL);
+
+    scratch->migration_state = migration_state_upstream(scratch->migration_state);
+    it = adb_ccInstanceType_create(env);
+    ccInstanceUnmarshal(it, scratch, env);
+    return (it);
+}
+
 //!
 //! Converts an instance structure to an AXIS2 instance structure.
 //!
@@ -1421,7 +1576,8 @@ int ccInstanceUnmarshal(adb_ccInstanceType_t * dst, ccInstance * src, const axut
         }
     }
 
-    for (i = 0; i < src->volumesSize; i++) {
+    // bounds are clamped: src may have been read out of the shared cache without its lock (see view_copy_instance())
+    for (i = 0; ((i < src->volumesSize) && (i < EUCA_MAX_VOLUMES)); i++) {
         vol = adb_volumeType_create(env);
         adb_volumeType_set_volumeId(vol, env, src->volumes[i].volumeId);
         adb_volumeType_set_remoteDev(vol, env, src->volumes[i].attachmentToken);
@@ -1445,7 +1601,7 @@ int ccInstanceUnmarshal(adb_ccInstanceType_t * dst, ccInstance * src, const axut
         adb_netConfigType_reset_attachmentId(netconf, env);
     adb_ccInstanceType_set_netParams(dst, env, netconf);
 
-    for (i = 0; i < src->secNetCfgsSize; i++) {
+    for (i = 0; ((i < src->secNetCfgsSize) && (i < EUCA_MAX_NICS)); i++) {
        if (strlen( src->secNetCfgs[i].interfaceId) == 0)
            continue;
        netconf = adb_netConfigType_create(env);
@@ -140,6 +140,13 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int ebt_table_match(int entry, const void *key, void *ctx);
+static int ebt_chain_match(int entry, const void *key, void *ctx);
+static int ebt_rule_match(int entry, const void *key, void *ctx);
+static void ebt_table_reindex(ebt_table * table);
+static void ebt_chain_reindex(ebt_chain * chain);
+static void ebt_table_free(ebt_table * table);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -542,6 +549,7 @@ int ebt_handler_add_table(ebt_handler * ebth, char *tablename)
         }
         bzero(&(ebth->tables[ebth->max_tables]), sizeof(ebt_table));
         snprintf(ebth->tables[ebth->max_tables].name, 64, tablename);
+        hidx_insert(&(ebth->table_index), hidx_hash_str(ebth->tables[ebth->max_tables].name), ebth->max_tables);
         ebth->max_tables++;
     }
 
@@ -597,6 +605,7 @@ int ebt_table_add_chain(ebt_handler * ebth, char *tablename, char *chainname, ch
             !strcmp(table->chains[table->max_chains].name, "PREROUTING") || !strcmp(table->chains[table->max_chains].name, "POSTROUTING")) {
             table->chains[table->max_chains].ref_count = 1;
         }
+        hidx_insert(&(table->chain_index), hidx_hash_str(table->chains[table->max_chains].name), table->max_chains);
 
         table->max_chains++;
 
@@ -653,6 +662,7 @@ int ebt_chain_add_rule(ebt_handler * ebth, char *tablename, char *chainname, cha
         }
         bzero(&(chain->rules[chain->max_rules]), sizeof(ebt_rule));
         snprintf(chain->rules[chain->max_rules].ebtrule, 1024, "%s", newrule);
+        hidx_insert(&(chain->rule_index), hidx_hash_str(chain->rules[chain->max_rules].ebtrule), chain->max_rules);
         chain->max_rules++;
     }
     return (0);
@@ -725,23 +735,32 @@ int ebt_handler_update_refcounts(ebt_handler * ebth)
 //!
 ebt_table *ebt_handler_find_table(ebt_handler * ebth, char *findtable)
 {
-    int i, tableidx = 0, found = 0;
+    int tableidx = 0;
     if (!ebth || !findtable || !ebth->init) {
         return (NULL);
     }
 
-    found = 0;
-    for (i = 0; i < ebth->max_tables && !found; i++) {
-        tableidx = i;
-        if (!strcmp(ebth->tables[i].name, findtable))
-            found++;
-    }
-    if (!found) {
+    tableidx = hidx_lookup(&(ebth->table_index), hidx_hash_str(findtable), findtable, ebt_table_match, ebth->tables);
+    if (tableidx == HIDX_NONE) {
         return (NULL);
     }
     return (&(ebth->tables[tableidx]));
 }
 
+//!
+//! Tells ebt_handler_find_table() whether a table index entry is the one looked up
+//!
+//! @param[in] entry the index of the candidate in the tables array
+//! @param[in] key the name of the table looked up
+//! @param[in] ctx the tables array
+//!
+//! @return TRUE if the names match, FALSE otherwise
+//!
+static int ebt_table_match(int entry, const void *key, void *ctx)
+{
+    return (!strcmp(((ebt_table *) ctx)[entry].name, (const char *)key));
+}
+
 //!
 //! Function description.
 //!
@@ -761,7 +780,7 @@ ebt_table *ebt_handler_find_table(ebt_handler * ebth, char *findtable)
 //!
 ebt_chain *ebt_table_find_chain(ebt_handler * ebth, char *tablename, char *findchain)
 {
-    int i, found = 0, chainidx = 0;
+    int chainidx = 0;
     ebt_table *table = NULL;
 
     if (!ebth || !tablename || !findchain || !ebth->init) {
@@ -773,20 +792,28 @@ ebt_chain *ebt_table_find_chain(ebt_handler * ebth, char *tablename, char *findc
         return (NULL);
     }
 
-    found = 0;
-    for (i = 0; i < table->max_chains && !found; i++) {
-        chainidx = i;
-        if (!strcmp(table->chains[i].name, findchain))
-            found++;
-    }
-
-    if (!found) {
+    chainidx = hidx_lookup(&(table->chain_index), hidx_hash_str(findchain), findchain, ebt_chain_match, table->chains);
+    if (chainidx == HIDX_NONE) {
         return (NULL);
     }
 
     return (&(table->chains[chainidx]));
 }
 
+//!
+//! Tells ebt_table_find_chain() whether a chain index entry is the one looked up
+//!
+//! @param[in] entry the index of the candidate in the chains array
+//! @param[in] key the name of the chain looked up
+//! @param[in] ctx the chains array
+//!
+//! @return TRUE if the names match, FALSE otherwise
+//!
+static int ebt_chain_match(int entry, const void *key, void *ctx)
+{
+    return (!strcmp(((ebt_chain *) ctx)[entry].name, (const char *)key));
+}
+
 //!
 //! Function description.
 //!
@@ -807,7 +834,7 @@ ebt_chain *ebt_table_find_chain(ebt_handler * ebth, char *tablename, char *findc
 //!
 ebt_rule *ebt_chain_find_rule(ebt_handler * ebth, char *tablename, char *chainname, char *findrule)
 {
-    int i, found = 0;
+    int ruleidx = 0;
     ebt_chain *chain;
 
     if (!ebth || !tablename || !chainname || !findrule || !ebth->init) {
@@ -819,14 +846,55 @@ ebt_rule *ebt_chain_find_rule(ebt_handler * ebth, char *tablename, char *chainna
         return (NULL);
     }
 
-    for (i = 0; i < chain->max_rules; i++) {
-        if (!strcmp(chain->rules[i].ebtrule, findrule))
-            found++;
-    }
-    if (!found) {
+    ruleidx = hidx_lookup(&(chain->rule_index), hidx_hash_str(findrule), findrule, ebt_rule_match, chain->rules);
+    if (ruleidx == HIDX_NONE) {
         return (NULL);
     }
-    return (&(chain->rules[i]));
+    return (&(chain->rules[ruleidx]));
+}
+
+//!
+//! Tells ebt_chain_find_rule() whether a rule index entry is the one looked up
+//!
+//! @param[in] entry the index of the candidate in the rules array
+//! @param[in] key the rule looked up
+//! @param[in] ctx the rules array
+//!
+//! @return TRUE if the rules match, FALSE otherwise
+//!
+static int ebt_rule_match(int entry, const void *key, void *ctx)
+{
+    return (!strcmp(((ebt_rule *) ctx)[entry].ebtrule, (const char *)key));
+}
+
+//!
+//! Rebuilds the chain index of a table once chains got renamed
+//!
+//! @param[in] table pointer to the EB table
+//!
+static void ebt_table_reindex(ebt_table * table)
+{
+    int j = 0;
+
+    hidx_clear(&(table->chain_index));
+    for (j = 0; j < table->max_chains; j++) {
+        hidx_insert(&(table->chain_index), hidx_hash_str(table->chains[j].name), j);
+    }
+}
+
+//!
+//! Rebuilds the rule index of a chain once its rules moved around
+//!
+//! @param[in] chain pointer to the EB table chain
+//!
+static void ebt_chain_reindex(ebt_chain * chain)
+{
+    int k = 0;
+
+    hidx_clear(&(chain->rule_index));
+    for (k = 0; k < chain->max_rules; k++) {
+        hidx_insert(&(chain->rule_index), hidx_hash_str(chain->rules[k].ebtrule), k);
+    }
 }
 
 //!
@@ -891,7 +959,7 @@ int ebt_table_deletechainempty(ebt_handler * ebth, char *tablename)
 //!
 int ebt_table_deletechainmatch(ebt_handler * ebth, char *tablename, char *chainmatch)
 {
-    int i, found = 0;
+    int i, found = 0, renamed = 0;
     ebt_table *table = NULL;
 
     if (!ebth || !tablename || !chainmatch || !ebth->init) {
@@ -907,10 +975,15 @@ int ebt_table_deletechainmatch(ebt_handler * ebth, char *tablename, char *chainm
     for (i = 0; i < table->max_chains && !found; i++) {
         if (strstr(table->chains[i].name, chainmatch)) {
             EUCA_FREE(table->chains[i].rules);
+            hidx_free(&(table->chains[i].rule_index));
             bzero(&(table->chains[i]), sizeof(ebt_chain));
             snprintf(table->chains[i].name, 64, "EMPTY");
+            renamed++;
         }
     }
+    if (renamed) {
+        ebt_table_reindex(table);
+    }
 
     return (0);
 }
@@ -953,6 +1026,7 @@ int ebt_chain_flush(ebt_handler * ebth, char *tablename, char *chainname)
     EUCA_FREE(chain->rules);
     chain->max_rules = 0;
     chain->counters[0] = '\0';
+    hidx_clear(&(chain->rule_index));
 
     return (0);
 }
@@ -1022,6 +1096,7 @@ int ebt_chain_flush_rule(ebt_handler * ebth, char *tablename, char *chainname, c
             chain->max_rules = 0;
             chain->counters[0] = '\0';
         }
+        ebt_chain_reindex(chain);
     } else {
         LOGDEBUG("Could not find (%s) from chain %s at table %s\n", findrule, chainname, tablename);
         return (2);
@@ -1047,7 +1122,6 @@ int ebt_chain_flush_rule(ebt_handler * ebth, char *tablename, char *chainname, c
 int ebt_handler_free(ebt_handler * ebth)
 {
     int i = 0;
-    int j = 0;
     char saved_cmdprefix[EUCA_MAX_PATH] = "";
     if (!ebth || !ebth->init) {
         return (1);
@@ -1055,12 +1129,10 @@ int ebt_handler_free(ebt_handler * ebth)
     snprintf(saved_cmdprefix, EUCA_MAX_PATH, "%s", ebth->cmdprefix);
 
     for (i = 0; i < ebth->max_tables; i++) {
-        for (j = 0; j < ebth->tables[i].max_chains; j++) {
-            EUCA_FREE(ebth->tables[i].chains[j].rules);
-        }
-        EUCA_FREE(ebth->tables[i].chains);
+        ebt_table_free(&(ebth->tables[i]));
     }
     EUCA_FREE(ebth->tables);
+    hidx_free(&(ebth->table_index));
 
     unlink(ebth->ebt_filter_file);
     unlink(ebth->ebt_nat_file);
@@ -1087,19 +1159,16 @@ int ebt_handler_free(ebt_handler * ebth)
 int ebt_handler_close(ebt_handler * ebth)
 {
     int i = 0;
-    int j = 0;
     if (!ebth || !ebth->init) {
         LOGTRACE("Invalid argument. NULL or uninitialized ebt_handler.\n");
         return (1);
     }
 
     for (i = 0; i < ebth->max_tables; i++) {
-        for (j = 0; j < ebth->tables[i].max_chains; j++) {
-            EUCA_FREE(ebth->tables[i].chains[j].rules);
-        }
-        EUCA_FREE(ebth->tables[i].chains);
+        ebt_table_free(&(ebth->tables[i]));
     }
     EUCA_FREE(ebth->tables);
+    hidx_free(&(ebth->table_index));
 
     unlink(ebth->ebt_filter_file);
     unlink(ebth->ebt_nat_file);
@@ -1108,6 +1177,24 @@ int ebt_handler_close(ebt_handler * ebth)
     return (0);
 }
 
+//!
+//! Releases the chains and rules of a table, along with their indexes
+//!
+//! @param[in] table pointer to the EB table to release
+//!
+static void ebt_table_free(ebt_table * table)
+{
+    int j = 0;
+
+    for (j = 0; j < table->max_chains; j++) {
+        EUCA_FREE(table->chains[j].rules);
+        hidx_free(&(table->chains[j].rule_index));
+    }
+    EUCA_FREE(table->chains);
+    hidx_free(&(table->chain_index));
+    table->max_chains = 0;
+}
+
 //!
 //! Function description.
 //!
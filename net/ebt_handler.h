@@ -77,6 +77,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#include "handler_index.h"
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -112,17 +114,20 @@ typedef struct ebt_chain_t {
     ebt_rule *rules;
     int max_rules;
     int ref_count;
+    handler_index rule_index;          //!< rules by ebtrule
 } ebt_chain;
 
 typedef struct ebt_table_t {
     char name[64];
     ebt_chain *chains;
     int max_chains;
+    handler_index chain_index;         //!< chains by name
 } ebt_table;
 
 typedef struct ebt_handler_t {
     ebt_table *tables;
     int max_tables;
+    handler_index table_index;         //!< tables by name
     int init;
     char ebt_filter_file[EUCA_MAX_PATH];
     char ebt_nat_file[EUCA_MAX_PATH];
@@ -88,6 +88,8 @@
 #include <netdb.h>
 #include <ifaddrs.h>
 
+#include <libxml/xmlreader.h>
+
 #include <eucalyptus.h>
 #include <misc.h>
 #include <hash.h>
@@ -162,6 +164,7 @@ static boolean xml_initialized = FALSE;    //!< To determine if the XML library
 #endif
 //! Static prototypes
 static int map_proto_to_names(int proto_number, char *out_proto_name, int out_proto_len);
+static void gni_reset(globalNetworkInfo * gni);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -2111,6 +2114,51 @@ int gni_populate(globalNetworkInfo *gni, gni_hostname_info *host_info, char *xml
     return (gni_populate_v(GNI_POPULATE_ALL, gni, host_info, xmlpath));
 }
 
+/**
+ * Reads the version of a GNI XML file without parsing the whole document: the
+ * version is an attribute of the root element, so the reader stops right after
+ * the first element. Cheap enough to tell whether the file holds a GNI that has
+ * already been populated before calling gni_populate() on it.
+ * @param xmlpath [in] path to the XML file to be read
+ * @param version [out] the version of the document, empty if it has none
+ * @param len [in] size of the version buffer
+ * @return 0 on success or 1 if the file could not be read or is not a GNI document
+ */
+int gni_read_version(const char *xmlpath, char *version, int len) {
+    int rc = 0;
+    xmlChar *attr = NULL;
+    xmlTextReaderPtr reader = NULL;
+
+    if (!xmlpath || !version || (len < 1)) {
+        LOGERROR("invalid input\n");
+        return (1);
+    }
+    version[0] = '\0';
+
+    XML_INIT();
+    if ((reader = xmlReaderForFile(xmlpath, NULL, XML_PARSE_NONET)) == NULL) {
+        LOGERROR("unable to open XML file (%s)\n", xmlpath);
+        return (1);
+    }
+    while (((rc = xmlTextReaderRead(reader)) == 1) && (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT))
+        ;
+    if (rc != 1) {
+        LOGERROR("unable to find the root element of XML file (%s)\n", xmlpath);
+        rc = 1;
+    } else if (xmlStrcmp(xmlTextReaderConstName(reader), (const xmlChar *) "network-data")) {
+        LOGERROR("network-data node not found in GNI xml\n");
+        rc = 1;
+    } else {
+        if ((attr = xmlTextReaderGetAttribute(reader, (const xmlChar *) "version")) != NULL) {
+            snprintf(version, len, "%s", (char *)attr);
+            xmlFree(attr);
+        }
+        rc = 0;
+    }
+    xmlFreeTextReader(reader);
+    return (rc);
+}
+
 /**
  * Populates a given globalNetworkInfo structure from the content of an XML file
  * @param mode [in] mode what to populate GNI_POPULATE_ALL || GNI_POPULATE_CONFIG || GNI_POPULATE_NONE
@@ -2120,6 +2168,21 @@ int gni_populate(globalNetworkInfo *gni, gni_hostname_info *host_info, char *xml
  * @return 0 on success or 1 on failure
  */
 int gni_populate_v(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath) {
+    return (gni_populate_sax(mode, gni, host_info, xmlpath));
+}
+
+/**
+ * Populates a given globalNetworkInfo structure from the content of an XML file
+ * by loading the whole document and evaluating one XPath expression per field.
+ * gni_populate_sax() does the same in a single pass and is what gni_populate_v()
+ * uses; this one is kept as the reference the SAX parser is tested against.
+ * @param mode [in] mode what to populate GNI_POPULATE_ALL || GNI_POPULATE_CONFIG || GNI_POPULATE_NONE
+ * @param gni [in] a pointer to the global network information structure
+ * @param host_info [in] a pointer to the hostname info data structure (only relevant to VPCMIDO - to be deprecated)
+ * @param xmlpath [in] path to the XML file to be used to populate
+ * @return 0 on success or 1 on failure
+ */
+int gni_populate_xpath(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath) {
     int rc = 0;
     xmlDocPtr docptr;
     xmlXPathContextPtr ctxptr;
@@ -2357,7 +2420,7 @@ int gni_populate_gnidata(globalNetworkInfo *gni, xmlNodePtr xmlnode, xmlXPathCon
         rc += evaluate_xpath_property(ctxptr, doc, xmlnode, expression, &results, &max_results);
         for (i = 0; i < max_results; i++) {
             LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->sMode, NETMODE_LEN, results[i]);
+            snprintf(gni->sMode, NETMODE_LEN, "%s", results[i]);
             gni->nmCode = euca_netmode_atoi(gni->sMode);
             EUCA_FREE(results[i]);
         }
@@ -2566,7 +2629,7 @@ int gni_populate_configuration(globalNetworkInfo *gni, gni_hostname_info *host_i
     rc += evaluate_xpath_nodeset(ctxptr, doc, xmlnode, expression, &nodeset);
     if (nodeset.nodeNr > 0) {
         LOGTRACE("Found %d managed subnets\n", nodeset.nodeNr);
-        gni->managedSubnet = EUCA_ZALLOC_C(nodeset.nodeNr, sizeof (gni_subnet));
+        gni->managedSubnet = EUCA_ZALLOC_C(nodeset.nodeNr, sizeof (gni_managedsubnet));
         gni->max_managedSubnets = nodeset.nodeNr;
 
         for (j = 0; j < gni->max_managedSubnets; j++) {
@@ -4109,7 +4172,7 @@ int gni_populate_dhcpos(globalNetworkInfo *gni, xmlNodePtr xmlnode, xmlXPathCont
                 gdh->netbios_ns[i] = dot2hex(results[i]);
                 EUCA_FREE(results[i]);
             }
-            gdh->max_ntp = max_results;
+            gdh->max_netbios_ns = max_results;
             EUCA_FREE(results);
 
             snprintf(expression, 2048, "./property[@name='netbios-node-type']/value");
@@ -4250,6 +4313,13 @@ int gni_iterate(globalNetworkInfo * gni, int mode)
     int i, j;
     char *strptra = NULL;
 
+    if ((mode == GNI_ITERATE_FREE) && gni->arena) {
+        // populated by gni_populate_sax(): every list is in the arena
+        gni_arena_free(gni->arena);
+        gni_reset(gni);
+        return (0);
+    }
+
     strptra = hex2dot(gni->enabledCLCIp);
     if (mode == GNI_ITERATE_PRINT)
         LOGTRACE("enabledCLCIp: %s\n", SP(strptra));
@@ -4547,16 +4617,27 @@ int gni_iterate(globalNetworkInfo * gni, int mode)
     }
 
     if (mode == GNI_ITERATE_FREE) {
-        //bzero(gni, sizeof (globalNetworkInfo));
-        gni->init = 1;
-        gni->networkInfo[0] = '\0';
-        char *version_addr = (char *) gni + (sizeof (gni->init) + sizeof (gni->networkInfo));
-        memset(version_addr, 0, sizeof (globalNetworkInfo) - sizeof (gni->init) - sizeof (gni->networkInfo));
+        gni_reset(gni);
     }
 
     return (0);
 }
 
+//!
+//! Zeroes out a globalNetworkInfo structure whose lists have been released,
+//! keeping it initialized.
+//!
+//! @param[in] gni a pointer to the global network information structure
+//!
+static void gni_reset(globalNetworkInfo * gni)
+{
+    //bzero(gni, sizeof (globalNetworkInfo));
+    gni->init = 1;
+    gni->networkInfo[0] = '\0';
+    char *version_addr = (char *) gni + (sizeof (gni->init) + sizeof (gni->networkInfo));
+    memset(version_addr, 0, sizeof (globalNetworkInfo) - sizeof (gni->init) - sizeof (gni->networkInfo));
+}
+
 //!
 //! Clears a given globalNetworkInfo structure. This will free member's allocated memory and zero
 //! out the structure itself.
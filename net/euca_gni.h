@@ -364,6 +364,15 @@ typedef struct gni_hostname_info_t {
     int max_hostnames;
 } gni_hostname_info;
 
+//! A chunk of arena memory (see gni_arena)
+typedef struct gni_arena_chunk_t gni_arena_chunk;
+
+//! Memory pool the arrays of a GNI come from, released all at once (see gni_populate_sax())
+typedef struct gni_arena_t {
+    gni_arena_chunk *chunks;                //!< chunks of the arena, the one being filled first
+    size_t allocated;                       //!< bytes allocated for the chunks
+} gni_arena;
+
 //! Global GNI Information Structure
 typedef struct globalNetworkInfo_t {
     boolean init;                           //!< has the structure been initialized successfully?
@@ -406,6 +415,7 @@ typedef struct globalNetworkInfo_t {
     int max_vpcIgws;                        //!< Number of VPC Internet Gateways
     gni_dhcp_os *dhcpos;                    //!< List of DHCP Options Set information
     int max_dhcpos;                         //!< Number of DHCP Option Sets
+    gni_arena *arena;                       //!< Where the lists come from, NULL if each is allocated on its own
 } globalNetworkInfo;
 
 /*----------------------------------------------------------------------------*\
@@ -427,6 +437,9 @@ int gni_print(globalNetworkInfo * gni);
 int gni_iterate(globalNetworkInfo * gni, int mode);
 int gni_populate(globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath);
 int gni_populate_v(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath);
+int gni_populate_xpath(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath);
+int gni_populate_sax(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, const char *xmlpath);
+int gni_read_version(const char *xmlpath, char *version, int len);
 int gni_populate_xpathnodes(xmlDocPtr doc, xmlNode **gni_nodes);
 gni_xpath_node_type gni_xmlstr2type(const xmlChar *nodename);
 int gni_populate_gnidata(globalNetworkInfo *gni, xmlNodePtr xmlnode, xmlXPathContextPtr ctxptr, xmlDocPtr doc);
@@ -447,6 +460,10 @@ int gni_populate_aclentry(gni_acl_entry *aclentry, xmlNodePtr xmlnode, xmlXPathC
 int gni_populate_internetgateways(globalNetworkInfo *gni, xmlNodePtr xmlnode, xmlXPathContextPtr ctxptr, xmlDocPtr doc);
 int gni_populate_dhcpos(globalNetworkInfo *gni, xmlNodePtr xmlnode, xmlXPathContextPtr ctxptr, xmlDocPtr doc);
 
+gni_arena *gni_arena_create(void);
+void *gni_arena_alloc(gni_arena *arena, size_t nmemb, size_t size);
+void gni_arena_free(gni_arena *arena);
+
 int gni_is_self(const char *test_ip);
 int gni_is_self_getifaddrs(const char *test_ip);
 
@@ -0,0 +1,2215 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2013 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file net/euca_gni_sax.c
+//! Populates a globalNetworkInfo structure from a GNI XML file in a single
+//! streaming (SAX) pass. Rather than building the whole document tree and then
+//! running one XPath query per field of every object, the parser keeps a stack
+//! of the elements it is in, classifies each element against its parent as it
+//! starts, and stores each text element straight into the structure being
+//! built. The sections and their fields are exactly the ones of the XPath based
+//! gni_populate_xpath(), which stays around as the reference implementation.
+//!
+//! All the arrays (and the fixed size strings within them) of a GNI populated
+//! this way come from one arena owned by the structure: objects are allocated
+//! from it as their element starts, and the children of an element are gathered
+//! in scratch arrays that get copied to the arena in one piece when it ends.
+//! gni_clear() then releases the whole GNI by releasing its arena.
+//!
+//! Once the document is read, the links between objects (security group
+//! members, VPC and subnet interfaces, the nodes the instances run on) are
+//! resolved through sorted name keys instead of nested scans.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <libxml/parser.h>
+
+#include <eucalyptus.h>
+#include <log.h>
+#include <euca_string.h>
+#include <euca_network.h>
+
+#include "euca_gni.h"
+#include "eucanetd_util.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define GNI_ARENA_CHUNK                          (1024 * 1024)  //!< size of a regular arena chunk
+#define GNI_ARENA_ALIGN                          8      //!< alignment of the arena allocations
+#define GNI_SAX_MAX_DEPTH                        32     //!< elements deeper than this are not looked at
+#define GNI_SAX_READ_SIZE                        65536  //!< bytes of the XML file handed to the parser at a time
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! What an element of the GNI document is to the parser
+typedef enum gni_sax_node_t {
+    GNI_SAX_SKIP,                      //!< not of interest, nor is anything in it
+    GNI_SAX_LEAF,                      //!< text element, handed to its parent when it ends
+    GNI_SAX_DOC,                       //!< the document itself (parent of the root element)
+    GNI_SAX_ROOT,                      //!< network-data
+    GNI_SAX_CONFIG,                    //!< configuration
+    GNI_SAX_CFG_MODE,                  //!< configuration/property[@name='mode']
+    GNI_SAX_CFG_CLCIP,                 //!< configuration/property[@name='enabledCLCIp']
+    GNI_SAX_CFG_DNSDOMAIN,             //!< configuration/property[@name='instanceDNSDomain']
+    GNI_SAX_CFG_PUBGW,                 //!< configuration/property[@name='publicGateway']
+    GNI_SAX_CFG_DNSSERVERS,            //!< configuration/property[@name='instanceDNSServers']
+    GNI_SAX_CFG_PUBLICIPS,             //!< configuration/property[@name='publicIps']
+    GNI_SAX_MIDO,                      //!< configuration/property[@name='mido']
+    GNI_SAX_MIDO_HOST,                 //!< mido/property[@name='eucanetdHost']
+    GNI_SAX_MIDO_CIDR,                 //!< mido/property[@name='publicNetworkCidr']
+    GNI_SAX_MIDO_GWIP,                 //!< mido/property[@name='publicGatewayIP']
+    GNI_SAX_MIDO_GATEWAYS,             //!< mido/property[@name='gateways']
+    GNI_SAX_GATEWAY,                   //!< gateways/gateway
+    GNI_SAX_GW_HOST,                   //!< gateway/property[@name='gatewayHost']
+    GNI_SAX_GW_IP,                     //!< gateway/property[@name='gatewayIP']
+    GNI_SAX_GW_IFACE,                  //!< gateway/property[@name='gatewayInterface']
+    GNI_SAX_MSUBNETS,                  //!< configuration/property[@name='managedSubnet']
+    GNI_SAX_MSUBNET,                   //!< managedSubnet/managedSubnet
+    GNI_SAX_MSN_NETMASK,               //!< managedSubnet/property[@name='netmask']
+    GNI_SAX_MSN_MINVLAN,               //!< managedSubnet/property[@name='minVlan']
+    GNI_SAX_MSN_MAXVLAN,               //!< managedSubnet/property[@name='maxVlan']
+    GNI_SAX_MSN_SEGSIZE,               //!< managedSubnet/property[@name='segmentSize']
+    GNI_SAX_SUBNETS,                   //!< configuration/property[@name='subnets']
+    GNI_SAX_SUBNET,                    //!< subnets/subnet
+    GNI_SAX_SN_NETMASK,                //!< subnet/property[@name='netmask']
+    GNI_SAX_SN_GATEWAY,                //!< subnet/property[@name='gateway']
+    GNI_SAX_CLUSTERS,                  //!< configuration/property[@name='clusters']
+    GNI_SAX_CLUSTER,                   //!< clusters/cluster
+    GNI_SAX_CL_CCIP,                   //!< cluster/property[@name='enabledCCIp']
+    GNI_SAX_CL_MACPREFIX,              //!< cluster/property[@name='macPrefix']
+    GNI_SAX_CL_PRIVIPS,                //!< cluster/property[@name='privateIps']
+    GNI_SAX_CL_SUBNET,                 //!< cluster/subnet
+    GNI_SAX_CLSN_NETMASK,              //!< cluster/subnet/property[@name='netmask']
+    GNI_SAX_CLSN_GATEWAY,              //!< cluster/subnet/property[@name='gateway']
+    GNI_SAX_CL_NODES,                  //!< cluster/property[@name='nodes']
+    GNI_SAX_NODE,                      //!< nodes/node
+    GNI_SAX_NODE_INSTIDS,              //!< node/instanceIds
+    GNI_SAX_INSTANCES,                 //!< instances
+    GNI_SAX_INSTANCE,                  //!< instances/instance
+    GNI_SAX_INST_SGS,                  //!< instance/securityGroups
+    GNI_SAX_IFACES,                    //!< instance/networkInterfaces
+    GNI_SAX_IFACE,                     //!< networkInterfaces/networkInterface
+    GNI_SAX_IFACE_SGS,                 //!< networkInterface/securityGroups
+    GNI_SAX_SECGROUPS,                 //!< securityGroups
+    GNI_SAX_SECGROUP,                  //!< securityGroups/securityGroup
+    GNI_SAX_SG_RULES,                  //!< securityGroup/rules
+    GNI_SAX_SG_INGRESS,                //!< securityGroup/ingressRules
+    GNI_SAX_SG_EGRESS,                 //!< securityGroup/egressRules
+    GNI_SAX_RULE,                      //!< ingressRules/rule or egressRules/rule
+    GNI_SAX_VPCS,                      //!< vpcs
+    GNI_SAX_VPC,                       //!< vpcs/vpc
+    GNI_SAX_RTBS,                      //!< vpc/routeTables
+    GNI_SAX_RTB,                       //!< routeTables/routeTable
+    GNI_SAX_ROUTES,                    //!< routeTable/routes
+    GNI_SAX_ROUTE,                     //!< routes/route
+    GNI_SAX_VPCSUBNETS,                //!< vpc/subnets
+    GNI_SAX_VPCSUBNET,                 //!< vpc/subnets/subnet
+    GNI_SAX_VPC_IGWS,                  //!< vpc/internetGateways
+    GNI_SAX_NATGWS,                    //!< vpc/natGateways
+    GNI_SAX_NATGW,                     //!< natGateways/natGateway
+    GNI_SAX_ACLS,                      //!< vpc/networkAcls
+    GNI_SAX_ACL,                       //!< networkAcls/networkAcl
+    GNI_SAX_ACL_INGRESS,               //!< networkAcl/ingressEntries
+    GNI_SAX_ACL_EGRESS,                //!< networkAcl/egressEntries
+    GNI_SAX_ACLENTRY,                  //!< ingressEntries/entry or egressEntries/entry
+    GNI_SAX_IGWS,                      //!< internetGateways
+    GNI_SAX_IGW,                       //!< internetGateways/internetGateway
+    GNI_SAX_DHCPOSS,                   //!< dhcpOptionSets
+    GNI_SAX_DHCPOS,                    //!< dhcpOptionSets/dhcpOptionSet
+    GNI_SAX_DHCP_DOMAINS,              //!< dhcpOptionSet/property[@name='domain-name']
+    GNI_SAX_DHCP_DNS,                  //!< dhcpOptionSet/property[@name='domain-name-servers']
+    GNI_SAX_DHCP_NTP,                  //!< dhcpOptionSet/property[@name='ntp-servers']
+    GNI_SAX_DHCP_NBNS,                 //!< dhcpOptionSet/property[@name='netbios-name-servers']
+    GNI_SAX_DHCP_NBTYPE,               //!< dhcpOptionSet/property[@name='netbios-node-type']
+    GNI_SAX_NODES_MAX,                 //!< number of element kinds
+} gni_sax_node;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A chunk of arena memory
+struct gni_arena_chunk_t {
+    struct gni_arena_chunk_t *next;    //!< chunk allocated before this one
+    size_t size;                       //!< usable bytes in data
+    size_t used;                       //!< bytes handed out so far
+    char data[];                       //!< the memory itself, zeroed
+};
+
+//! An element of the GNI document that the parser knows about
+typedef struct gni_sax_edge_t {
+    gni_sax_node parent;               //!< the kind of element it must be in
+    const char *element;               //!< its name
+    const char *property;              //!< the name attribute of a property element, NULL for others
+    gni_sax_node node;                 //!< what it is to the parser
+} gni_sax_edge;
+
+//! A scratch array where the children of an element are gathered until it ends
+typedef struct gni_sax_vec_t {
+    char *data;                        //!< 'count' elements of 'size' bytes
+    int count;                         //!< elements gathered so far
+    int cap;                           //!< elements that fit in data
+    size_t size;                       //!< size of an element
+} gni_sax_vec;
+
+//! An instance (or network interface) being parsed
+typedef struct gni_sax_if_t {
+    gni_instance *gi;                  //!< the structure being filled (in the arena)
+    boolean eni;                       //!< is this a network interface (eni-xxxxxxxx)?
+    gni_sax_vec sgnames;               //!< its security group names (gni_name)
+} gni_sax_if;
+
+//! A name sorted for lookups, along with the index of the object carrying it
+typedef struct gni_sax_key_t {
+    const char *name;                  //!< name of the object
+    int idx;                           //!< index of the object in its array
+} gni_sax_key;
+
+//! The state of a GNI document being parsed
+typedef struct gni_sax_parser_t {
+    globalNetworkInfo *gni;            //!< the structure being populated
+    gni_arena *arena;                  //!< where its arrays go (gni->arena)
+    int mode;                          //!< GNI_POPULATE_ALL or GNI_POPULATE_CONFIG
+    int first[GNI_SAX_NODES_MAX];      //!< first edge of each parent kind in gni_sax_edges[]
+    int edges[GNI_SAX_NODES_MAX];      //!< number of edges of each parent kind in gni_sax_edges[]
+    int depth;                         //!< number of elements open
+    gni_sax_node stack[GNI_SAX_MAX_DEPTH];      //!< what the open elements are
+    char *text;                        //!< text of the open leaf element
+    int textlen;                       //!< length of text
+    int textcap;                       //!< size of the text buffer
+    boolean hastext;                   //!< did the open leaf element get text?
+    boolean textdone;                  //!< did an element start within the open leaf (its first text node is over)?
+
+    gni_sax_vec instances;             //!< gni_instance pointers
+    gni_sax_vec ifs;                   //!< gni_instance pointers of the network interfaces
+    gni_sax_vec secgroups;             //!< gni_secgroup
+    gni_sax_vec vpcs;                  //!< gni_vpc
+    gni_sax_vec igws;                  //!< gni_internet_gateway
+    gni_sax_vec dhcpos;                //!< gni_dhcp_os
+    gni_sax_vec dnsservers;            //!< u32
+    gni_sax_vec publicips;             //!< char pointers, public IP ranges
+    gni_sax_vec msubnets;              //!< gni_managedsubnet
+    gni_sax_vec subnets;               //!< gni_subnet
+    gni_sax_vec clusters;              //!< gni_cluster
+
+    gni_sax_if inst[2];                //!< the open instance [0] and network interface [1]
+    gni_sax_vec instifs;               //!< gni_instance pointers of the open instance
+    gni_secgroup *sg;                  //!< the open security group
+    gni_sax_vec grouprules;            //!< gni_name
+    gni_sax_vec ingress;               //!< gni_rule
+    gni_sax_vec egress;                //!< gni_rule
+    gni_rule *rule;                    //!< the open security group rule
+    gni_vpc *vpc;                      //!< the open VPC
+    gni_sax_vec rtbs;                  //!< gni_route_table
+    gni_sax_vec routes;                //!< gni_route_entry
+    gni_sax_vec vpcsubnets;            //!< gni_vpcsubnet
+    gni_sax_vec vpcigws;               //!< gni_name
+    gni_sax_vec natgws;                //!< gni_nat_gateway
+    gni_sax_vec acls;                  //!< gni_network_acl
+    gni_sax_vec aclin;                 //!< gni_acl_entry
+    gni_sax_vec acleg;                 //!< gni_acl_entry
+    gni_route_table *rtb;              //!< the open route table
+    gni_route_entry *route;            //!< the open route
+    int routeprio;                     //!< rank of the route target so far (gatewayId, networkInterfaceId then natGatewayId)
+    gni_vpcsubnet *vpcsubnet;          //!< the open VPC subnet
+    gni_nat_gateway *natgw;            //!< the open NAT gateway
+    gni_network_acl *acl;              //!< the open network ACL
+    gni_acl_entry *aclentry;           //!< the open network ACL entry
+    gni_internet_gateway *igw;         //!< the open internet gateway
+    gni_dhcp_os *dhcp;                 //!< the open DHCP option set
+    gni_sax_vec domains;               //!< gni_name
+    gni_sax_vec dns;                   //!< u32
+    gni_sax_vec ntp;                   //!< u32
+    gni_sax_vec nbns;                  //!< u32
+    gni_managedsubnet *msubnet;        //!< the open managed subnet
+    gni_subnet *subnet;                //!< the open global subnet
+    gni_cluster *cluster;              //!< the open cluster
+    gni_sax_vec privips;               //!< char pointers, private IP ranges
+    gni_sax_vec nodes;                 //!< gni_node
+    int clsubnets;                     //!< subnet elements seen in the open cluster
+    gni_node *node;                    //!< the open node
+    gni_sax_vec instids;               //!< gni_name
+
+    int midos;                         //!< mido properties seen
+    int gateways;                      //!< mido gateways seen
+    char eucanetdHost[HOSTNAME_LEN];   //!< mido eucanetdHost
+    char publicNetworkCidr[HOSTNAME_LEN];       //!< mido publicNetworkCidr
+    char publicGatewayIP[HOSTNAME_LEN];         //!< mido publicGatewayIP
+    char gwhost[2048];                 //!< gatewayHost of the open gateway
+    char gwips[2048];                  //!< ",gatewayIP" of the open gateway
+    char gwifaces[2048];               //!< ",gatewayInterface" of the open gateway
+    char gwhosts[HOSTNAME_LEN * 3 * 33];        //!< "host,ip,interface " of each gateway
+} gni_sax_parser;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! The elements of the GNI document the parser knows about, grouped by parent
+static const gni_sax_edge gni_sax_edges[] = {
+    {GNI_SAX_DOC, "network-data", NULL, GNI_SAX_ROOT},
+
+    {GNI_SAX_ROOT, "configuration", NULL, GNI_SAX_CONFIG},
+    {GNI_SAX_ROOT, "instances", NULL, GNI_SAX_INSTANCES},
+    {GNI_SAX_ROOT, "securityGroups", NULL, GNI_SAX_SECGROUPS},
+    {GNI_SAX_ROOT, "vpcs", NULL, GNI_SAX_VPCS},
+    {GNI_SAX_ROOT, "internetGateways", NULL, GNI_SAX_IGWS},
+    {GNI_SAX_ROOT, "dhcpOptionSets", NULL, GNI_SAX_DHCPOSS},
+
+    {GNI_SAX_CONFIG, "property", "mode", GNI_SAX_CFG_MODE},
+    {GNI_SAX_CONFIG, "property", "enabledCLCIp", GNI_SAX_CFG_CLCIP},
+    {GNI_SAX_CONFIG, "property", "instanceDNSDomain", GNI_SAX_CFG_DNSDOMAIN},
+    {GNI_SAX_CONFIG, "property", "publicGateway", GNI_SAX_CFG_PUBGW},
+    {GNI_SAX_CONFIG, "property", "instanceDNSServers", GNI_SAX_CFG_DNSSERVERS},
+    {GNI_SAX_CONFIG, "property", "publicIps", GNI_SAX_CFG_PUBLICIPS},
+    {GNI_SAX_CONFIG, "property", "mido", GNI_SAX_MIDO},
+    {GNI_SAX_CONFIG, "property", "managedSubnet", GNI_SAX_MSUBNETS},
+    {GNI_SAX_CONFIG, "property", "subnets", GNI_SAX_SUBNETS},
+    {GNI_SAX_CONFIG, "property", "clusters", GNI_SAX_CLUSTERS},
+
+    {GNI_SAX_MIDO, "property", "eucanetdHost", GNI_SAX_MIDO_HOST},
+    {GNI_SAX_MIDO, "property", "publicNetworkCidr", GNI_SAX_MIDO_CIDR},
+    {GNI_SAX_MIDO, "property", "publicGatewayIP", GNI_SAX_MIDO_GWIP},
+    {GNI_SAX_MIDO, "property", "gateways", GNI_SAX_MIDO_GATEWAYS},
+    {GNI_SAX_MIDO_GATEWAYS, "gateway", NULL, GNI_SAX_GATEWAY},
+    {GNI_SAX_GATEWAY, "property", "gatewayHost", GNI_SAX_GW_HOST},
+    {GNI_SAX_GATEWAY, "property", "gatewayIP", GNI_SAX_GW_IP},
+    {GNI_SAX_GATEWAY, "property", "gatewayInterface", GNI_SAX_GW_IFACE},
+
+    {GNI_SAX_MSUBNETS, "managedSubnet", NULL, GNI_SAX_MSUBNET},
+    {GNI_SAX_MSUBNET, "property", "netmask", GNI_SAX_MSN_NETMASK},
+    {GNI_SAX_MSUBNET, "property", "minVlan", GNI_SAX_MSN_MINVLAN},
+    {GNI_SAX_MSUBNET, "property", "maxVlan", GNI_SAX_MSN_MAXVLAN},
+    {GNI_SAX_MSUBNET, "property", "segmentSize", GNI_SAX_MSN_SEGSIZE},
+
+    {GNI_SAX_SUBNETS, "subnet", NULL, GNI_SAX_SUBNET},
+    {GNI_SAX_SUBNET, "property", "netmask", GNI_SAX_SN_NETMASK},
+    {GNI_SAX_SUBNET, "property", "gateway", GNI_SAX_SN_GATEWAY},
+
+    {GNI_SAX_CLUSTERS, "cluster", NULL, GNI_SAX_CLUSTER},
+    {GNI_SAX_CLUSTER, "property", "enabledCCIp", GNI_SAX_CL_CCIP},
+    {GNI_SAX_CLUSTER, "property", "macPrefix", GNI_SAX_CL_MACPREFIX},
+    {GNI_SAX_CLUSTER, "property", "privateIps", GNI_SAX_CL_PRIVIPS},
+    {GNI_SAX_CLUSTER, "subnet", NULL, GNI_SAX_CL_SUBNET},
+    {GNI_SAX_CLUSTER, "property", "nodes", GNI_SAX_CL_NODES},
+    {GNI_SAX_CL_SUBNET, "property", "netmask", GNI_SAX_CLSN_NETMASK},
+    {GNI_SAX_CL_SUBNET, "property", "gateway", GNI_SAX_CLSN_GATEWAY},
+    {GNI_SAX_CL_NODES, "node", NULL, GNI_SAX_NODE},
+    {GNI_SAX_NODE, "instanceIds", NULL, GNI_SAX_NODE_INSTIDS},
+
+    {GNI_SAX_INSTANCES, "instance", NULL, GNI_SAX_INSTANCE},
+    {GNI_SAX_INSTANCE, "securityGroups", NULL, GNI_SAX_INST_SGS},
+    {GNI_SAX_INSTANCE, "networkInterfaces", NULL, GNI_SAX_IFACES},
+    {GNI_SAX_IFACES, "networkInterface", NULL, GNI_SAX_IFACE},
+    {GNI_SAX_IFACE, "securityGroups", NULL, GNI_SAX_IFACE_SGS},
+
+    {GNI_SAX_SECGROUPS, "securityGroup", NULL, GNI_SAX_SECGROUP},
+    {GNI_SAX_SECGROUP, "rules", NULL, GNI_SAX_SG_RULES},
+    {GNI_SAX_SECGROUP, "ingressRules", NULL, GNI_SAX_SG_INGRESS},
+    {GNI_SAX_SECGROUP, "egressRules", NULL, GNI_SAX_SG_EGRESS},
+    {GNI_SAX_SG_INGRESS, "rule", NULL, GNI_SAX_RULE},
+    {GNI_SAX_SG_EGRESS, "rule", NULL, GNI_SAX_RULE},
+
+    {GNI_SAX_VPCS, "vpc", NULL, GNI_SAX_VPC},
+    {GNI_SAX_VPC, "routeTables", NULL, GNI_SAX_RTBS},
+    {GNI_SAX_VPC, "subnets", NULL, GNI_SAX_VPCSUBNETS},
+    {GNI_SAX_VPC, "internetGateways", NULL, GNI_SAX_VPC_IGWS},
+    {GNI_SAX_VPC, "natGateways", NULL, GNI_SAX_NATGWS},
+    {GNI_SAX_VPC, "networkAcls", NULL, GNI_SAX_ACLS},
+    {GNI_SAX_RTBS, "routeTable", NULL, GNI_SAX_RTB},
+    {GNI_SAX_RTB, "routes", NULL, GNI_SAX_ROUTES},
+    {GNI_SAX_ROUTES, "route", NULL, GNI_SAX_ROUTE},
+    {GNI_SAX_VPCSUBNETS, "subnet", NULL, GNI_SAX_VPCSUBNET},
+    {GNI_SAX_NATGWS, "natGateway", NULL, GNI_SAX_NATGW},
+    {GNI_SAX_ACLS, "networkAcl", NULL, GNI_SAX_ACL},
+    {GNI_SAX_ACL, "ingressEntries", NULL, GNI_SAX_ACL_INGRESS},
+    {GNI_SAX_ACL, "egressEntries", NULL, GNI_SAX_ACL_EGRESS},
+    {GNI_SAX_ACL_INGRESS, "entry", NULL, GNI_SAX_ACLENTRY},
+    {GNI_SAX_ACL_EGRESS, "entry", NULL, GNI_SAX_ACLENTRY},
+
+    {GNI_SAX_IGWS, "internetGateway", NULL, GNI_SAX_IGW},
+
+    {GNI_SAX_DHCPOSS, "dhcpOptionSet", NULL, GNI_SAX_DHCPOS},
+    {GNI_SAX_DHCPOS, "property", "domain-name", GNI_SAX_DHCP_DOMAINS},
+    {GNI_SAX_DHCPOS, "property", "domain-name-servers", GNI_SAX_DHCP_DNS},
+    {GNI_SAX_DHCPOS, "property", "ntp-servers", GNI_SAX_DHCP_NTP},
+    {GNI_SAX_DHCPOS, "property", "netbios-name-servers", GNI_SAX_DHCP_NBNS},
+    {GNI_SAX_DHCPOS, "property", "netbios-node-type", GNI_SAX_DHCP_NBTYPE},
+};
+
+#define GNI_SAX_EDGES                            ((int) (sizeof (gni_sax_edges) / sizeof (gni_sax_edges[0])))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void *gni_sax_vec_push(gni_sax_vec * vec);
+static void *gni_sax_vec_commit(gni_sax_parser * p, gni_sax_vec * vec, int *max);
+static void gni_sax_vec_free(gni_sax_vec * vec);
+static char *gni_sax_strdup(gni_sax_parser * p, const char *str);
+static int gni_sax_attr(const xmlChar ** attributes, int nb_attributes, const char *name, char *value, int len);
+static gni_sax_node gni_sax_classify(gni_sax_parser * p, gni_sax_node parent, const char *name, const xmlChar ** attributes, int nb_attributes);
+static int gni_sax_open(gni_sax_parser * p, gni_sax_node parent, gni_sax_node node, const xmlChar ** attributes, int nb_attributes);
+static void gni_sax_close(gni_sax_parser * p, gni_sax_node node);
+static void gni_sax_close_if(gni_sax_parser * p, gni_sax_if * pif);
+static void gni_sax_field(gni_sax_parser * p, gni_sax_node parent, const char *name, char *text);
+static void gni_sax_if_field(gni_sax_if * pif, const char *name, char *text);
+static void gni_sax_cidr(const char *text, char *cidr, int *slashnet, u32 * netaddr);
+static void gni_sax_iprange(gni_sax_parser * p, gni_sax_vec * ranges, u32 ** out, int *max);
+static void gni_sax_start(void *ctx, const xmlChar * localname, const xmlChar * prefix, const xmlChar * URI, int nb_namespaces, const xmlChar ** namespaces,
+                          int nb_attributes, int nb_defaulted, const xmlChar ** attributes);
+static void gni_sax_end(void *ctx, const xmlChar * localname, const xmlChar * prefix, const xmlChar * URI);
+static void gni_sax_characters(void *ctx, const xmlChar * ch, int len);
+static int gni_sax_key_compare(const void *p1, const void *p2);
+static int gni_sax_key_find(gni_sax_key * keys, int nkeys, const char *name, int *first);
+static void gni_sax_finish(gni_sax_parser * p);
+static void gni_sax_link_secgroups(gni_sax_parser * p);
+static void gni_sax_link_nodes(gni_sax_parser * p);
+static void gni_sax_link_vpcs(gni_sax_parser * p);
+static void gni_sax_parser_free(gni_sax_parser * p);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Is the given element kind a leaf, or something nothing is expected from?
+#define GNI_SAX_IS_TERMINAL(_node)               (((_node) == GNI_SAX_SKIP) || ((_node) == GNI_SAX_LEAF))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/**
+ * Allocates an empty arena.
+ * @return pointer to the new arena. Release with gni_arena_free().
+ */
+gni_arena *gni_arena_create(void) {
+    return (EUCA_ZALLOC_C(1, sizeof (gni_arena)));
+}
+
+/**
+ * Allocates zeroed memory for an array from an arena. The memory can only be
+ * released by releasing the whole arena.
+ * @param arena [in] the arena to allocate from
+ * @param nmemb [in] number of elements of the array
+ * @param size [in] size of an element
+ * @return pointer to the memory. NULL for an empty array or invalid arguments.
+ */
+void *gni_arena_alloc(gni_arena *arena, size_t nmemb, size_t size) {
+    gni_arena_chunk *chunk = NULL;
+    size_t len = 0;
+    void *ret = NULL;
+
+    if (!arena || !nmemb || !size || (nmemb > (SIZE_MAX / size))) {
+        return (NULL);
+    }
+    len = ((nmemb * size) + GNI_ARENA_ALIGN - 1) & ~((size_t) GNI_ARENA_ALIGN - 1);
+
+    chunk = arena->chunks;
+    if (!chunk || ((chunk->size - chunk->used) < len)) {
+        if (len > (GNI_ARENA_CHUNK / 4)) {
+            // large blocks get a chunk of their own, kept behind the one being filled
+            chunk = EUCA_ZALLOC_C(1, sizeof (gni_arena_chunk) + len);
+            chunk->size = chunk->used = len;
+            if (arena->chunks) {
+                chunk->next = arena->chunks->next;
+                arena->chunks->next = chunk;
+            } else {
+                arena->chunks = chunk;
+            }
+            arena->allocated += len;
+            return (chunk->data);
+        }
+        chunk = EUCA_ZALLOC_C(1, sizeof (gni_arena_chunk) + GNI_ARENA_CHUNK);
+        chunk->size = GNI_ARENA_CHUNK;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->allocated += GNI_ARENA_CHUNK;
+    }
+    ret = chunk->data + chunk->used;
+    chunk->used += len;
+    return (ret);
+}
+
+/**
+ * Releases an arena and all the memory allocated from it.
+ * @param arena [in] the arena to release (can be NULL)
+ */
+void gni_arena_free(gni_arena *arena) {
+    gni_arena_chunk *chunk = NULL;
+    gni_arena_chunk *next = NULL;
+
+    if (!arena) {
+        return;
+    }
+    for (chunk = arena->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        EUCA_FREE(chunk);
+    }
+    EUCA_FREE(arena);
+}
+
+/**
+ * Appends a zeroed element to a scratch array.
+ * @param vec [in] the scratch array
+ * @return pointer to the new element, valid until the next push
+ */
+static void *gni_sax_vec_push(gni_sax_vec *vec) {
+    char *elem = NULL;
+
+    if (vec->count == vec->cap) {
+        vec->cap = (vec->cap) ? (vec->cap * 2) : 16;
+        vec->data = EUCA_REALLOC_C(vec->data, vec->cap, vec->size);
+    }
+    elem = vec->data + ((size_t) vec->count * vec->size);
+    bzero(elem, vec->size);
+    vec->count++;
+    return (elem);
+}
+
+/**
+ * Moves the elements gathered in a scratch array to the arena, leaving the
+ * scratch array empty for the next element of the same kind.
+ * @param p [in] the parser
+ * @param vec [in] the scratch array
+ * @param max [out] number of elements moved
+ * @return pointer to the elements in the arena. NULL if there were none.
+ */
+static void *gni_sax_vec_commit(gni_sax_parser *p, gni_sax_vec *vec, int *max) {
+    void *ret = NULL;
+
+    *max = vec->count;
+    if (vec->count) {
+        ret = gni_arena_alloc(p->arena, vec->count, vec->size);
+        memcpy(ret, vec->data, (size_t) vec->count * vec->size);
+        vec->count = 0;
+    }
+    return (ret);
+}
+
+/**
+ * Releases the memory of a scratch array.
+ * @param vec [in] the scratch array
+ */
+static void gni_sax_vec_free(gni_sax_vec *vec) {
+    EUCA_FREE(vec->data);
+    vec->count = vec->cap = 0;
+}
+
+/**
+ * Copies a string to the arena.
+ * @param p [in] the parser
+ * @param str [in] the string to copy
+ * @return pointer to the copy
+ */
+static char *gni_sax_strdup(gni_sax_parser *p, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *ret = gni_arena_alloc(p->arena, len, 1);
+
+    memcpy(ret, str, len);
+    return (ret);
+}
+
+/**
+ * Copies an attribute of an element. The GNI names its objects with their
+ * first attribute, so a NULL name gets that one.
+ * @param attributes [in] attributes of the element as handed by libxml2 (localname/prefix/URI/value/end)
+ * @param nb_attributes [in] number of attributes
+ * @param name [in] name of the attribute of interest, NULL for the first one
+ * @param value [out] buffer for the value of the attribute
+ * @param len [in] size of the value buffer
+ * @return 1 if the element has such an attribute (with a value), 0 otherwise
+ */
+static int gni_sax_attr(const xmlChar **attributes, int nb_attributes, const char *name, char *value, int len) {
+    int i = 0;
+    int vlen = 0;
+
+    for (i = 0; i < nb_attributes; i++) {
+        const xmlChar **attr = &(attributes[i * 5]);
+        if (name && strcmp((const char *) attr[0], name)) {
+            continue;
+        }
+        vlen = (int) (attr[4] - attr[3]);
+        if (vlen < 1) {
+            return (0);
+        }
+        if (vlen >= len) {
+            vlen = len - 1;
+        }
+        memcpy(value, attr[3], vlen);
+        value[vlen] = '\0';
+        return (1);
+    }
+    return (0);
+}
+
+/**
+ * Tells what a starting element is to the parser, given what its parent is.
+ * @param p [in] the parser
+ * @param parent [in] what the parent element is
+ * @param name [in] name of the starting element
+ * @param attributes [in] attributes of the starting element
+ * @param nb_attributes [in] number of attributes
+ * @return what the element is
+ */
+static gni_sax_node gni_sax_classify(gni_sax_parser *p, gni_sax_node parent, const char *name, const xmlChar **attributes, int nb_attributes) {
+    char property[128] = "";
+    int i = 0;
+
+    if (GNI_SAX_IS_TERMINAL(parent)) {
+        return (GNI_SAX_SKIP);
+    }
+    for (i = p->first[parent]; i < (p->first[parent] + p->edges[parent]); i++) {
+        const gni_sax_edge *edge = &(gni_sax_edges[i]);
+        if (strcmp(edge->element, name)) {
+            continue;
+        }
+        if (edge->property) {
+            if (!property[0] && !gni_sax_attr(attributes, nb_attributes, "name", property, sizeof (property))) {
+                return (GNI_SAX_SKIP);
+            }
+            if (strcmp(edge->property, property)) {
+                continue;
+            }
+        }
+        switch (edge->node) {
+        case GNI_SAX_INSTANCES:
+        case GNI_SAX_SECGROUPS:
+        case GNI_SAX_VPCS:
+        case GNI_SAX_IGWS:
+        case GNI_SAX_DHCPOSS:
+            return ((p->mode == GNI_POPULATE_ALL) ? edge->node : GNI_SAX_SKIP);
+        case GNI_SAX_IFACES:
+            // interfaces are only relevant in VPCMIDO mode (when the mode is not known yet, they get dropped at the end)
+            return (((p->gni->nmCode == NM_INVALID) || IS_NETMODE_VPCMIDO(p->gni)) ? edge->node : GNI_SAX_SKIP);
+        default:
+            return (edge->node);
+        }
+    }
+    if (parent == GNI_SAX_DOC) {
+        LOGERROR("network-data node not found in GNI xml\n");
+        return (GNI_SAX_SKIP);
+    }
+    return (GNI_SAX_LEAF);
+}
+
+/**
+ * Sets up the object of an element that is starting.
+ * @param p [in] the parser
+ * @param parent [in] what the parent element is
+ * @param node [in] what the starting element is
+ * @param attributes [in] attributes of the starting element
+ * @param nb_attributes [in] number of attributes
+ * @return 0 if the content of the element is of interest, 1 if it is to be skipped
+ */
+static int gni_sax_open(gni_sax_parser *p, gni_sax_node parent, gni_sax_node node, const xmlChar **attributes, int nb_attributes) {
+    globalNetworkInfo *gni = p->gni;
+    char name[1024] = "";
+    int hasname = gni_sax_attr(attributes, nb_attributes, NULL, name, sizeof (name));
+    gni_sax_if *pif = NULL;
+
+    switch (node) {
+    case GNI_SAX_ROOT:
+        gni_sax_attr(attributes, nb_attributes, "version", gni->version, sizeof (gni->version));
+        gni_sax_attr(attributes, nb_attributes, "applied-version", gni->appliedVersion, sizeof (gni->appliedVersion));
+        break;
+    case GNI_SAX_MIDO:
+        p->midos++;
+        break;
+    case GNI_SAX_GATEWAY:
+        p->gateways++;
+        p->gwhost[0] = p->gwips[0] = p->gwifaces[0] = '\0';
+        break;
+    case GNI_SAX_MSUBNET:
+        p->msubnet = gni_sax_vec_push(&(p->msubnets));
+        if (!hasname) {
+            LOGWARN("invalid managed subnet at idx %d\n", p->msubnets.count - 1);
+            return (1);
+        }
+        p->msubnet->subnet = dot2hex(name);
+        break;
+    case GNI_SAX_SUBNET:
+        p->subnet = gni_sax_vec_push(&(p->subnets));
+        if (!hasname) {
+            LOGWARN("invalid global subnet at idx %d\n", p->subnets.count - 1);
+            return (1);
+        }
+        p->subnet->subnet = dot2hex(name);
+        break;
+    case GNI_SAX_CLUSTER:
+        p->cluster = gni_sax_vec_push(&(p->clusters));
+        p->clsubnets = 0;
+        if (!hasname) {
+            LOGWARN("invalid cluster at idx %d\n", p->clusters.count - 1);
+            return (1);
+        }
+        euca_strncpy(p->cluster->name, name, HOSTNAME_LEN);
+        break;
+    case GNI_SAX_CL_SUBNET:
+        // only the first subnet of a cluster counts
+        if ((p->clsubnets++ > 0) || !hasname) {
+            return (1);
+        }
+        p->cluster->private_subnet.subnet = dot2hex(name);
+        break;
+    case GNI_SAX_NODE:
+        p->node = gni_sax_vec_push(&(p->nodes));
+        if (hasname) {
+            euca_strncpy(p->node->name, name, HOSTNAME_LEN);
+        }
+        break;
+    case GNI_SAX_INSTANCE:
+    case GNI_SAX_IFACE:
+        pif = &(p->inst[(node == GNI_SAX_INSTANCE) ? 0 : 1]);
+        pif->gi = gni_arena_alloc(p->arena, 1, sizeof (gni_instance));
+        if (node == GNI_SAX_INSTANCE) {
+            *((gni_instance **) gni_sax_vec_push(&(p->instances))) = pif->gi;
+        } else {
+            euca_strncpy(pif->gi->instance_name.name, p->inst[0].gi->name, 1024);
+            *((gni_instance **) gni_sax_vec_push(&(p->ifs))) = pif->gi;
+            *((gni_instance **) gni_sax_vec_push(&(p->instifs))) = pif->gi;
+        }
+        if (hasname) {
+            euca_strncpy(pif->gi->name, name, INTERFACE_ID_LEN);
+        } else {
+            LOGERROR("Invalid argument: invalid instance name.\n");
+        }
+        pif->eni = (strstr(pif->gi->name, "eni-")) ? TRUE : FALSE;
+        break;
+    case GNI_SAX_SECGROUP:
+        p->sg = gni_sax_vec_push(&(p->secgroups));
+        if (hasname) {
+            euca_strncpy(p->sg->name, name, SECURITY_GROUP_ID_LEN);
+        }
+        break;
+    case GNI_SAX_RULE:
+        p->rule = gni_sax_vec_push((parent == GNI_SAX_SG_INGRESS) ? &(p->ingress) : &(p->egress));
+        break;
+    case GNI_SAX_VPC:
+        p->vpc = gni_sax_vec_push(&(p->vpcs));
+        if (hasname) {
+            euca_strncpy(p->vpc->name, name, 16);
+        }
+        break;
+    case GNI_SAX_RTB:
+        p->rtb = gni_sax_vec_push(&(p->rtbs));
+        if (hasname) {
+            euca_strncpy(p->rtb->name, name, 16);
+        }
+        break;
+    case GNI_SAX_ROUTE:
+        p->route = gni_sax_vec_push(&(p->routes));
+        p->routeprio = 4;
+        break;
+    case GNI_SAX_VPCSUBNET:
+        p->vpcsubnet = gni_sax_vec_push(&(p->vpcsubnets));
+        if (hasname) {
+            euca_strncpy(p->vpcsubnet->name, name, 16);
+        }
+        break;
+    case GNI_SAX_NATGW:
+        p->natgw = gni_sax_vec_push(&(p->natgws));
+        if (hasname) {
+            euca_strncpy(p->natgw->name, name, 32);
+        }
+        break;
+    case GNI_SAX_ACL:
+        p->acl = gni_sax_vec_push(&(p->acls));
+        if (hasname) {
+            euca_strncpy(p->acl->name, name, NETWORK_ACL_ID_LEN);
+        }
+        break;
+    case GNI_SAX_ACLENTRY:
+        p->aclentry = gni_sax_vec_push((parent == GNI_SAX_ACL_INGRESS) ? &(p->aclin) : &(p->acleg));
+        if (hasname) {
+            p->aclentry->number = atoi(name);
+        }
+        break;
+    case GNI_SAX_IGW:
+        p->igw = gni_sax_vec_push(&(p->igws));
+        if (hasname) {
+            euca_strncpy(p->igw->name, name, 16);
+        }
+        break;
+    case GNI_SAX_DHCPOS:
+        p->dhcp = gni_sax_vec_push(&(p->dhcpos));
+        if (hasname) {
+            euca_strncpy(p->dhcp->name, name, DHCP_OS_ID_LEN);
+        }
+        break;
+    default:
+        break;
+    }
+    return (0);
+}
+
+/**
+ * Completes the instance or network interface of an element that is ending.
+ * @param p [in] the parser
+ * @param pif [in] the instance or network interface
+ */
+static void gni_sax_close_if(gni_sax_parser *p, gni_sax_if *pif) {
+    gni_instance *gi = pif->gi;
+
+    gi->secgroup_names = gni_sax_vec_commit(p, &(pif->sgnames), &(gi->max_secgroup_names));
+    gi->gnisgs = gni_arena_alloc(p->arena, gi->max_secgroup_names, sizeof (gni_secgroup *));
+    if (pif->eni) {
+        // Use the instance name for primary interfaces
+        euca_strncpy(gi->ifname, gi->name, INTERFACE_ID_LEN);
+        if (gi->deviceidx == 0) {
+            euca_strncpy(gi->name, gi->instance_name.name, INTERFACE_ID_LEN);
+        }
+    }
+}
+
+/**
+ * Completes the object of an element that is ending: its children move from
+ * the scratch arrays to the arena.
+ * @param p [in] the parser
+ * @param node [in] what the ending element is
+ */
+static void gni_sax_close(gni_sax_parser *p, gni_sax_node node) {
+    char token[2048] = "";
+    int i = 0;
+
+    switch (node) {
+    case GNI_SAX_GATEWAY:
+        euca_strncpy(token, p->gwhost, sizeof (token));
+        euca_strncat(token, p->gwips, sizeof (token));
+        euca_strncat(token, p->gwifaces, sizeof (token));
+        euca_strncat(p->gwhosts, token, sizeof (p->gwhosts));
+        euca_strncat(p->gwhosts, " ", sizeof (p->gwhosts));
+        break;
+    case GNI_SAX_CLUSTER:
+        gni_sax_iprange(p, &(p->privips), &(p->cluster->private_ips), &(p->cluster->max_private_ips));
+        p->cluster->nodes = gni_sax_vec_commit(p, &(p->nodes), &(p->cluster->max_nodes));
+        break;
+    case GNI_SAX_NODE:
+        p->node->instance_names = gni_sax_vec_commit(p, &(p->instids), &(p->node->max_instance_names));
+        break;
+    case GNI_SAX_INSTANCE:
+        gni_sax_close_if(p, &(p->inst[0]));
+        p->inst[0].gi->interfaces = gni_sax_vec_commit(p, &(p->instifs), &(p->inst[0].gi->max_interfaces));
+        break;
+    case GNI_SAX_IFACE:
+        gni_sax_close_if(p, &(p->inst[1]));
+        break;
+    case GNI_SAX_SECGROUP:
+        p->sg->grouprules = gni_sax_vec_commit(p, &(p->grouprules), &(p->sg->max_grouprules));
+        p->sg->ingress_rules = gni_sax_vec_commit(p, &(p->ingress), &(p->sg->max_ingress_rules));
+        p->sg->egress_rules = gni_sax_vec_commit(p, &(p->egress), &(p->sg->max_egress_rules));
+        break;
+    case GNI_SAX_VPC:
+        p->vpc->routeTables = gni_sax_vec_commit(p, &(p->rtbs), &(p->vpc->max_routeTables));
+        p->vpc->subnets = gni_sax_vec_commit(p, &(p->vpcsubnets), &(p->vpc->max_subnets));
+        p->vpc->internetGatewayNames = gni_sax_vec_commit(p, &(p->vpcigws), &(p->vpc->max_internetGatewayNames));
+        p->vpc->natGateways = gni_sax_vec_commit(p, &(p->natgws), &(p->vpc->max_natGateways));
+        p->vpc->networkAcls = gni_sax_vec_commit(p, &(p->acls), &(p->vpc->max_networkAcls));
+        // route tables are complete only now, wherever they were in the vpc element
+        for (i = 0; i < p->vpc->max_subnets; i++) {
+            gni_vpcsubnet *vpcsubnet = &(p->vpc->subnets[i]);
+            if (vpcsubnet->routeTable_name[0]) {
+                vpcsubnet->routeTable = gni_vpc_get_routeTable(p->vpc, vpcsubnet->routeTable_name);
+                if (vpcsubnet->routeTable == NULL) {
+                    LOGWARN("Failed to find GNI %s for %s\n", vpcsubnet->routeTable_name, vpcsubnet->name);
+                }
+            }
+        }
+        break;
+    case GNI_SAX_RTB:
+        p->rtb->entries = gni_sax_vec_commit(p, &(p->routes), &(p->rtb->max_entries));
+        break;
+    case GNI_SAX_ACL:
+        p->acl->ingress = gni_sax_vec_commit(p, &(p->aclin), &(p->acl->max_ingress));
+        p->acl->egress = gni_sax_vec_commit(p, &(p->acleg), &(p->acl->max_egress));
+        break;
+    case GNI_SAX_DHCPOS:
+        p->dhcp->domains = gni_sax_vec_commit(p, &(p->domains), &(p->dhcp->max_domains));
+        p->dhcp->dns = gni_sax_vec_commit(p, &(p->dns), &(p->dhcp->max_dns));
+        p->dhcp->ntp = gni_sax_vec_commit(p, &(p->ntp), &(p->dhcp->max_ntp));
+        p->dhcp->netbios_ns = gni_sax_vec_commit(p, &(p->nbns), &(p->dhcp->max_netbios_ns));
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Splits a CIDR the way the security group rules and network ACL entries keep it.
+ * @param text [in] the CIDR
+ * @param cidr [out] copy of the CIDR (NETWORK_ADDR_LEN bytes)
+ * @param slashnet [out] its prefix length
+ * @param netaddr [out] its network address
+ */
+static void gni_sax_cidr(const char *text, char *cidr, int *slashnet, u32 *netaddr) {
+    char *scidrnetaddr = NULL;
+
+    euca_strncpy(cidr, text, NETWORK_ADDR_LEN);
+    cidrsplit(cidr, &scidrnetaddr, slashnet);
+    *netaddr = dot2hex(scidrnetaddr);
+    EUCA_FREE(scidrnetaddr);
+}
+
+/**
+ * Expands a list of IP ranges into a list of IPs in the arena.
+ * @param p [in] the parser
+ * @param ranges [in] scratch array of the ranges (char pointers), emptied
+ * @param out [out] the IPs
+ * @param max [out] number of IPs
+ */
+static void gni_sax_iprange(gni_sax_parser *p, gni_sax_vec *ranges, u32 **out, int *max) {
+    u32 *ips = NULL;
+    int max_ips = 0;
+
+    if (ranges->count == 0) {
+        return;
+    }
+    gni_serialize_iprange_list((char **) ranges->data, ranges->count, &ips, &max_ips);
+    if (max_ips > 0) {
+        *out = gni_arena_alloc(p->arena, max_ips, sizeof (u32));
+        memcpy(*out, ips, max_ips * sizeof (u32));
+        *max = max_ips;
+    }
+    EUCA_FREE(ips);
+    ranges->count = 0;
+}
+
+/**
+ * Stores the field of an instance or network interface.
+ * @param pif [in] the instance or network interface
+ * @param name [in] name of the field element
+ * @param text [in] its text
+ */
+static void gni_sax_if_field(gni_sax_if *pif, const char *name, char *text) {
+    gni_instance *gi = pif->gi;
+
+    if (!strcmp(name, "ownerId")) {
+        euca_strncpy(gi->accountId, text, 128);
+    } else if (!strcmp(name, "macAddress")) {
+        mac2hex(text, gi->macAddress);
+    } else if (!strcmp(name, "publicIp")) {
+        gi->publicIp = dot2hex(text);
+    } else if (!strcmp(name, "privateIp")) {
+        gi->privateIp = dot2hex(text);
+    } else if (!strcmp(name, "vpc")) {
+        euca_strncpy(gi->vpc, text, 16);
+    } else if (!strcmp(name, "subnet")) {
+        euca_strncpy(gi->subnet, text, 16);
+    } else if (!strcmp(name, "attachmentId")) {
+        euca_strncpy(gi->attachmentId, text, ENI_ATTACHMENT_ID_LEN);
+    } else if (pif->eni && !strcmp(name, "sourceDestCheck")) {
+        euca_strtolower(text);
+        gi->srcdstcheck = (!strcmp(text, "true")) ? TRUE : FALSE;
+    } else if (pif->eni && !strcmp(name, "deviceIndex")) {
+        gi->deviceidx = atoi(text);
+    }
+}
+
+/**
+ * Stores the text of a leaf element in the object of its parent.
+ * @param p [in] the parser
+ * @param parent [in] what the parent element is
+ * @param name [in] name of the leaf element
+ * @param text [in] its text (can be modified)
+ */
+static void gni_sax_field(gni_sax_parser *p, gni_sax_node parent, const char *name, char *text) {
+    globalNetworkInfo *gni = p->gni;
+    char newrule[2048] = "";
+    int value = !strcmp(name, "value");
+
+    switch (parent) {
+    case GNI_SAX_CFG_MODE:
+        if (value) {
+            euca_strncpy(gni->sMode, text, NETMODE_LEN);
+            gni->nmCode = euca_netmode_atoi(gni->sMode);
+        }
+        break;
+    case GNI_SAX_CFG_CLCIP:
+        if (value)
+            gni->enabledCLCIp = dot2hex(text);
+        break;
+    case GNI_SAX_CFG_DNSDOMAIN:
+        if (value)
+            euca_strncpy(gni->instanceDNSDomain, text, HOSTNAME_LEN);
+        break;
+#ifdef USE_IP_ROUTE_HANDLER
+    case GNI_SAX_CFG_PUBGW:
+        if (value)
+            gni->publicGateway = dot2hex(text);
+        break;
+#endif /* USE_IP_ROUTE_HANDLER */
+    case GNI_SAX_CFG_DNSSERVERS:
+        if (value)
+            *((u32 *) gni_sax_vec_push(&(p->dnsservers))) = dot2hex(text);
+        break;
+    case GNI_SAX_CFG_PUBLICIPS:
+        if (value)
+            *((char **) gni_sax_vec_push(&(p->publicips))) = gni_sax_strdup(p, text);
+        break;
+    case GNI_SAX_MIDO_HOST:
+        if (value)
+            euca_strncpy(p->eucanetdHost, text, HOSTNAME_LEN);
+        break;
+    case GNI_SAX_MIDO_CIDR:
+        if (value)
+            euca_strncpy(p->publicNetworkCidr, text, HOSTNAME_LEN);
+        break;
+    case GNI_SAX_MIDO_GWIP:
+        if (value)
+            euca_strncpy(p->publicGatewayIP, text, HOSTNAME_LEN);
+        break;
+    case GNI_SAX_GW_HOST:
+        if (value)
+            euca_strncpy(p->gwhost, text, sizeof (p->gwhost));
+        break;
+    case GNI_SAX_GW_IP:
+        if (value) {
+            euca_strncat(p->gwips, ",", sizeof (p->gwips));
+            euca_strncat(p->gwips, text, sizeof (p->gwips));
+        }
+        break;
+    case GNI_SAX_GW_IFACE:
+        if (value) {
+            euca_strncat(p->gwifaces, ",", sizeof (p->gwifaces));
+            euca_strncat(p->gwifaces, text, sizeof (p->gwifaces));
+        }
+        break;
+    case GNI_SAX_MSN_NETMASK:
+        if (value)
+            p->msubnet->netmask = dot2hex(text);
+        break;
+    case GNI_SAX_MSN_MINVLAN:
+        if (value)
+            p->msubnet->minVlan = atoi(text);
+        break;
+    case GNI_SAX_MSN_MAXVLAN:
+        if (value)
+            p->msubnet->maxVlan = atoi(text);
+        break;
+    case GNI_SAX_MSN_SEGSIZE:
+        if (value)
+            p->msubnet->segmentSize = atoi(text);
+        break;
+    case GNI_SAX_SN_NETMASK:
+        if (value)
+            p->subnet->netmask = dot2hex(text);
+        break;
+    case GNI_SAX_SN_GATEWAY:
+        if (value)
+            p->subnet->gateway = dot2hex(text);
+        break;
+    case GNI_SAX_CL_CCIP:
+        if (value)
+            p->cluster->enabledCCIp = dot2hex(text);
+        break;
+    case GNI_SAX_CL_MACPREFIX:
+        if (value)
+            euca_strncpy(p->cluster->macPrefix, text, ENET_MACPREFIX_LEN);
+        break;
+    case GNI_SAX_CL_PRIVIPS:
+        if (value)
+            *((char **) gni_sax_vec_push(&(p->privips))) = gni_sax_strdup(p, text);
+        break;
+    case GNI_SAX_CLSN_NETMASK:
+        if (value)
+            p->cluster->private_subnet.netmask = dot2hex(text);
+        break;
+    case GNI_SAX_CLSN_GATEWAY:
+        if (value)
+            p->cluster->private_subnet.gateway = dot2hex(text);
+        break;
+    case GNI_SAX_NODE_INSTIDS:
+        if (value)
+            euca_strncpy(((gni_name *) gni_sax_vec_push(&(p->instids)))->name, text, 1024);
+        break;
+    case GNI_SAX_INSTANCE:
+        gni_sax_if_field(&(p->inst[0]), name, text);
+        break;
+    case GNI_SAX_IFACE:
+        gni_sax_if_field(&(p->inst[1]), name, text);
+        break;
+    case GNI_SAX_INST_SGS:
+    case GNI_SAX_IFACE_SGS:
+        if (value)
+            euca_strncpy(((gni_name *) gni_sax_vec_push(&(p->inst[(parent == GNI_SAX_INST_SGS) ? 0 : 1].sgnames)))->name, text, 1024);
+        break;
+    case GNI_SAX_SECGROUP:
+        if (!strcmp(name, "ownerId"))
+            euca_strncpy(p->sg->accountId, text, 128);
+        break;
+    case GNI_SAX_SG_RULES:
+        if (value) {
+            gni_name *rule = gni_sax_vec_push(&(p->grouprules));
+            if (!ruleconvert(text, newrule)) {
+                euca_strncpy(rule->name, newrule, 1024);
+            }
+        }
+        break;
+    case GNI_SAX_RULE:
+        if (!strcmp(name, "protocol")) {
+            p->rule->protocol = atoi(text);
+        } else if (!strcmp(name, "groupId")) {
+            euca_strncpy(p->rule->groupId, text, SECURITY_GROUP_ID_LEN);
+        } else if (!strcmp(name, "groupOwnerId")) {
+            euca_strncpy(p->rule->groupOwnerId, text, 16);
+        } else if (!strcmp(name, "cidr")) {
+            gni_sax_cidr(text, p->rule->cidr, &(p->rule->cidrSlashnet), &(p->rule->cidrNetaddr));
+        } else if (!strcmp(name, "fromPort")) {
+            p->rule->fromPort = atoi(text);
+        } else if (!strcmp(name, "toPort")) {
+            p->rule->toPort = atoi(text);
+        } else if (!strcmp(name, "icmpType")) {
+            p->rule->icmpType = atoi(text);
+        } else if (!strcmp(name, "icmpCode")) {
+            p->rule->icmpCode = atoi(text);
+        }
+        break;
+    case GNI_SAX_VPC:
+        if (!strcmp(name, "ownerId")) {
+            euca_strncpy(p->vpc->accountId, text, 128);
+        } else if (!strcmp(name, "cidr")) {
+            euca_strncpy(p->vpc->cidr, text, 24);
+        } else if (!strcmp(name, "dhcpOptionSet")) {
+            euca_strncpy(p->vpc->dhcpOptionSet_name, text, 16);
+        }
+        break;
+    case GNI_SAX_RTB:
+        if (!strcmp(name, "ownerId"))
+            euca_strncpy(p->rtb->accountId, text, 128);
+        break;
+    case GNI_SAX_ROUTE:
+        if (!strcmp(name, "destinationCidr")) {
+            euca_strncpy(p->route->destCidr, text, 16);
+        } else {
+            // a gateway target wins over a network interface, which wins over a nat gateway
+            int prio = (!strcmp(name, "gatewayId")) ? 1 : (!strcmp(name, "networkInterfaceId")) ? 2 : (!strcmp(name, "natGatewayId")) ? 3 : 4;
+            if ((prio < 4) && (prio <= p->routeprio)) {
+                euca_strncpy(p->route->target, text, 32);
+                p->routeprio = prio;
+            }
+        }
+        break;
+    case GNI_SAX_VPCSUBNET:
+        if (!strcmp(name, "ownerId")) {
+            euca_strncpy(p->vpcsubnet->accountId, text, 128);
+        } else if (!strcmp(name, "cidr")) {
+            euca_strncpy(p->vpcsubnet->cidr, text, 24);
+        } else if (!strcmp(name, "cluster")) {
+            euca_strncpy(p->vpcsubnet->cluster_name, text, HOSTNAME_LEN);
+        } else if (!strcmp(name, "networkAcl")) {
+            euca_strncpy(p->vpcsubnet->networkAcl_name, text, 16);
+        } else if (!strcmp(name, "routeTable")) {
+            euca_strncpy(p->vpcsubnet->routeTable_name, text, 16);
+        }
+        break;
+    case GNI_SAX_VPC_IGWS:
+        if (value)
+            euca_strncpy(((gni_name *) gni_sax_vec_push(&(p->vpcigws)))->name, text, 16);
+        break;
+    case GNI_SAX_NATGW:
+        if (!strcmp(name, "ownerId")) {
+            euca_strncpy(p->natgw->accountId, text, 128);
+        } else if (!strcmp(name, "macAddress")) {
+            mac2hex(text, p->natgw->macAddress);
+        } else if (!strcmp(name, "publicIp")) {
+            p->natgw->publicIp = dot2hex(text);
+        } else if (!strcmp(name, "privateIp")) {
+            p->natgw->privateIp = dot2hex(text);
+        } else if (!strcmp(name, "vpc")) {
+            euca_strncpy(p->natgw->vpc, text, 16);
+        } else if (!strcmp(name, "subnet")) {
+            euca_strncpy(p->natgw->subnet, text, 16);
+        }
+        break;
+    case GNI_SAX_ACL:
+        if (!strcmp(name, "ownerId"))
+            euca_strncpy(p->acl->accountId, text, 128);
+        break;
+    case GNI_SAX_ACLENTRY:
+        if (!strcmp(name, "action")) {
+            if (!strcmp(text, "allow"))
+                p->aclentry->allow = 1;
+        } else if (!strcmp(name, "protocol")) {
+            p->aclentry->protocol = atoi(text);
+        } else if (!strcmp(name, "cidr")) {
+            gni_sax_cidr(text, p->aclentry->cidr, &(p->aclentry->cidrSlashnet), &(p->aclentry->cidrNetaddr));
+        } else if (!strcmp(name, "portRangeFrom")) {
+            p->aclentry->fromPort = atoi(text);
+        } else if (!strcmp(name, "portRangeTo")) {
+            p->aclentry->toPort = atoi(text);
+        } else if (!strcmp(name, "icmpType")) {
+            p->aclentry->icmpType = atoi(text);
+        } else if (!strcmp(name, "icmpCode")) {
+            p->aclentry->icmpCode = atoi(text);
+        }
+        break;
+    case GNI_SAX_IGW:
+        if (!strcmp(name, "ownerId"))
+            euca_strncpy(p->igw->accountId, text, 128);
+        break;
+    case GNI_SAX_DHCPOS:
+        if (!strcmp(name, "ownerId"))
+            euca_strncpy(p->dhcp->accountId, text, 128);
+        break;
+    case GNI_SAX_DHCP_DOMAINS:
+        if (value)
+            euca_strncpy(((gni_name *) gni_sax_vec_push(&(p->domains)))->name, text, 1024);
+        break;
+    case GNI_SAX_DHCP_DNS:
+        if (value)
+            *((u32 *) gni_sax_vec_push(&(p->dns))) = dot2hex(text);
+        break;
+    case GNI_SAX_DHCP_NTP:
+        if (value)
+            *((u32 *) gni_sax_vec_push(&(p->ntp))) = dot2hex(text);
+        break;
+    case GNI_SAX_DHCP_NBNS:
+        if (value)
+            *((u32 *) gni_sax_vec_push(&(p->nbns))) = dot2hex(text);
+        break;
+    case GNI_SAX_DHCP_NBTYPE:
+        if (value)
+            p->dhcp->netbios_type = atoi(text);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * libxml2 SAX2 callback for the start of an element.
+ */
+static void gni_sax_start(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI, int nb_namespaces, const xmlChar **namespaces,
+        int nb_attributes, int nb_defaulted, const xmlChar **attributes) {
+    gni_sax_parser *p = (gni_sax_parser *) ctx;
+    gni_sax_node parent = GNI_SAX_DOC;
+    gni_sax_node node = GNI_SAX_SKIP;
+
+    if (p->depth > 0) {
+        parent = (p->depth <= GNI_SAX_MAX_DEPTH) ? p->stack[p->depth - 1] : GNI_SAX_SKIP;
+    }
+    if (parent == GNI_SAX_LEAF) {
+        // only the text before the first child element of a leaf counts
+        p->textdone = TRUE;
+    }
+    p->depth++;
+    if (p->depth > GNI_SAX_MAX_DEPTH) {
+        return;
+    }
+
+    node = gni_sax_classify(p, parent, (const char *) localname, attributes, nb_attributes);
+    if (node == GNI_SAX_LEAF) {
+        p->textlen = 0;
+        p->hastext = FALSE;
+        p->textdone = FALSE;
+    } else if ((node != GNI_SAX_SKIP) && gni_sax_open(p, parent, node, attributes, nb_attributes)) {
+        node = GNI_SAX_SKIP;
+    }
+    p->stack[p->depth - 1] = node;
+}
+
+/**
+ * libxml2 SAX2 callback for the end of an element.
+ */
+static void gni_sax_end(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI) {
+    gni_sax_parser *p = (gni_sax_parser *) ctx;
+    gni_sax_node node = GNI_SAX_SKIP;
+
+    if (p->depth <= GNI_SAX_MAX_DEPTH) {
+        node = p->stack[p->depth - 1];
+    }
+    if ((node == GNI_SAX_LEAF) && p->hastext) {
+        p->text[p->textlen] = '\0';
+        gni_sax_field(p, (p->depth > 1) ? p->stack[p->depth - 2] : GNI_SAX_DOC, (const char *) localname, p->text);
+        p->hastext = FALSE;
+    } else if (!GNI_SAX_IS_TERMINAL(node)) {
+        gni_sax_close(p, node);
+    }
+    p->depth--;
+}
+
+/**
+ * libxml2 SAX2 callback for text (and whitespace).
+ */
+static void gni_sax_characters(void *ctx, const xmlChar *ch, int len) {
+    gni_sax_parser *p = (gni_sax_parser *) ctx;
+
+    if ((p->depth < 1) || (p->depth > GNI_SAX_MAX_DEPTH) || (p->stack[p->depth - 1] != GNI_SAX_LEAF) || p->textdone) {
+        return;
+    }
+    if ((p->textlen + len + 1) > p->textcap) {
+        p->textcap = p->textlen + len + 256;
+        p->text = EUCA_REALLOC_C(p->text, p->textcap, sizeof (char));
+    }
+    memcpy(p->text + p->textlen, ch, len);
+    p->textlen += len;
+    p->hastext = TRUE;
+}
+
+/**
+ * Orders name keys by name, then by object index.
+ */
+static int gni_sax_key_compare(const void *p1, const void *p2) {
+    const gni_sax_key *k1 = (const gni_sax_key *) p1;
+    const gni_sax_key *k2 = (const gni_sax_key *) p2;
+    int rc = strcmp(k1->name, k2->name);
+
+    if (rc) {
+        return (rc);
+    }
+    return ((k1->idx > k2->idx) - (k1->idx < k2->idx));
+}
+
+/**
+ * Finds the objects carrying a name in an array of sorted name keys.
+ * @param keys [in] keys sorted with gni_sax_key_compare()
+ * @param nkeys [in] number of keys
+ * @param name [in] the name of interest
+ * @param first [out] position of the first matching key
+ * @return number of matching keys (objects with that name, in index order)
+ */
+static int gni_sax_key_find(gni_sax_key *keys, int nkeys, const char *name, int *first) {
+    int lo = 0;
+    int hi = nkeys;
+    int mid = 0;
+    int end = 0;
+
+    while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        if (strcmp(keys[mid].name, name) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (end = lo; (end < nkeys) && !strcmp(keys[end].name, name); end++)
+        ;
+    *first = lo;
+    return (end - lo);
+}
+
+/**
+ * Links the security groups with their member instances and interfaces. A group
+ * lists its members in the order the instances (interfaces) are in the GNI.
+ * @param p [in] the parser
+ */
+static void gni_sax_link_secgroups(gni_sax_parser *p) {
+    globalNetworkInfo *gni = p->gni;
+    gni_sax_key *keys = NULL;
+    gni_instance *gi = NULL;
+    int pass = 0;
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int n = 0;
+    int first = 0;
+
+    if (gni->max_secgroups == 0) {
+        return;
+    }
+    keys = EUCA_ZALLOC_C(gni->max_secgroups, sizeof (gni_sax_key));
+    for (i = 0; i < gni->max_secgroups; i++) {
+        keys[i].name = gni->secgroups[i].name;
+        keys[i].idx = i;
+    }
+    qsort(keys, gni->max_secgroups, sizeof (gni_sax_key), gni_sax_key_compare);
+
+    // count the members of each group, allocate, then fill in
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < gni->max_instances; i++) {
+            gi = gni->instances[i];
+            for (j = 0; j < gi->max_secgroup_names; j++) {
+                n = gni_sax_key_find(keys, gni->max_secgroups, gi->secgroup_names[j].name, &first);
+                for (k = first; k < (first + n); k++) {
+                    gni_secgroup *gsg = &(gni->secgroups[keys[k].idx]);
+                    if (pass) {
+                        gsg->instances[gsg->max_instances] = gi;
+                    }
+                    gsg->max_instances++;
+                }
+            }
+        }
+        if (IS_NETMODE_VPCMIDO(gni)) {
+            for (i = 0; i < gni->max_ifs; i++) {
+                gi = gni->ifs[i];
+                for (j = 0; j < gi->max_secgroup_names; j++) {
+                    n = gni_sax_key_find(keys, gni->max_secgroups, gi->secgroup_names[j].name, &first);
+                    for (k = first; k < (first + n); k++) {
+                        gni_secgroup *gsg = &(gni->secgroups[keys[k].idx]);
+                        if (pass) {
+                            gsg->interfaces[gsg->max_interfaces] = gi;
+                            gi->gnisgs[j] = gsg;
+                        }
+                        gsg->max_interfaces++;
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            for (i = 0; i < gni->max_secgroups; i++) {
+                gni_secgroup *gsg = &(gni->secgroups[i]);
+                gsg->instances = gni_arena_alloc(p->arena, gsg->max_instances, sizeof (gni_instance *));
+                gsg->interfaces = gni_arena_alloc(p->arena, gsg->max_interfaces, sizeof (gni_instance *));
+                gsg->max_instances = gsg->max_interfaces = 0;
+            }
+        }
+    }
+    EUCA_FREE(keys);
+}
+
+/**
+ * Tells the instances and interfaces of a VPCMIDO GNI which node they run on.
+ * @param p [in] the parser
+ */
+static void gni_sax_link_nodes(gni_sax_parser *p) {
+    globalNetworkInfo *gni = p->gni;
+    gni_sax_key *keys = NULL;
+    gni_node *node = NULL;
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int l = 0;
+    int m = 0;
+    int n = 0;
+    int first = 0;
+
+    if (!IS_NETMODE_VPCMIDO(gni) || (gni->max_instances == 0)) {
+        return;
+    }
+    keys = EUCA_ZALLOC_C(gni->max_instances, sizeof (gni_sax_key));
+    for (i = 0; i < gni->max_instances; i++) {
+        keys[i].name = gni->instances[i]->name;
+        keys[i].idx = i;
+    }
+    qsort(keys, gni->max_instances, sizeof (gni_sax_key), gni_sax_key_compare);
+
+    for (i = 0; i < gni->max_clusters; i++) {
+        for (j = 0; j < gni->clusters[i].max_nodes; j++) {
+            node = &(gni->clusters[i].nodes[j]);
+            for (k = 0; k < node->max_instance_names; k++) {
+                n = gni_sax_key_find(keys, gni->max_instances, node->instance_names[k].name, &first);
+                for (l = first; l < (first + n); l++) {
+                    gni_instance *gi = gni->instances[keys[l].idx];
+                    euca_strncpy(gi->node, node->name, HOSTNAME_LEN);
+                    // the interfaces of an instance are the ones named after it
+                    for (m = 0; m < gi->max_interfaces; m++) {
+                        euca_strncpy(gi->interfaces[m]->node, node->name, HOSTNAME_LEN);
+                    }
+                }
+            }
+        }
+    }
+    EUCA_FREE(keys);
+}
+
+/**
+ * Finds the interfaces, DHCP option set and network ACLs of each VPC and VPC
+ * subnet.
+ * @param p [in] the parser
+ */
+static void gni_sax_link_vpcs(gni_sax_parser *p) {
+    globalNetworkInfo *gni = p->gni;
+    gni_sax_key *keys = NULL;
+    gni_vpc *vpc = NULL;
+    int pass = 0;
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int n = 0;
+    int first = 0;
+
+    if (gni->max_vpcs == 0) {
+        return;
+    }
+    keys = EUCA_ZALLOC_C(gni->max_vpcs, sizeof (gni_sax_key));
+    for (i = 0; i < gni->max_vpcs; i++) {
+        keys[i].name = gni->vpcs[i].name;
+        keys[i].idx = i;
+    }
+    qsort(keys, gni->max_vpcs, sizeof (gni_sax_key), gni_sax_key_compare);
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < gni->max_ifs; i++) {
+            n = gni_sax_key_find(keys, gni->max_vpcs, gni->ifs[i]->vpc, &first);
+            for (k = first; k < (first + n); k++) {
+                vpc = &(gni->vpcs[keys[k].idx]);
+                if (pass) {
+                    vpc->interfaces[vpc->max_interfaces] = gni->ifs[i];
+                }
+                vpc->max_interfaces++;
+            }
+        }
+        for (i = 0; (pass == 0) && (i < gni->max_vpcs); i++) {
+            vpc = &(gni->vpcs[i]);
+            vpc->interfaces = gni_arena_alloc(p->arena, vpc->max_interfaces, sizeof (gni_instance *));
+            vpc->max_interfaces = 0;
+        }
+    }
+    EUCA_FREE(keys);
+
+    for (i = 0; i < gni->max_vpcs; i++) {
+        vpc = &(gni->vpcs[i]);
+        vpc->dhcpOptionSet = gni_get_dhcpos(gni, vpc->dhcpOptionSet_name, NULL);
+        for (j = 0; j < vpc->max_subnets; j++) {
+            vpc->subnets[j].networkAcl = gni_get_networkacl(vpc, vpc->subnets[j].networkAcl_name, NULL);
+        }
+        if ((vpc->max_subnets == 0) || (vpc->max_interfaces == 0)) {
+            continue;
+        }
+        keys = EUCA_ZALLOC_C(vpc->max_subnets, sizeof (gni_sax_key));
+        for (j = 0; j < vpc->max_subnets; j++) {
+            keys[j].name = vpc->subnets[j].name;
+            keys[j].idx = j;
+        }
+        qsort(keys, vpc->max_subnets, sizeof (gni_sax_key), gni_sax_key_compare);
+        for (pass = 0; pass < 2; pass++) {
+            for (j = 0; j < vpc->max_interfaces; j++) {
+                n = gni_sax_key_find(keys, vpc->max_subnets, vpc->interfaces[j]->subnet, &first);
+                for (k = first; k < (first + n); k++) {
+                    gni_vpcsubnet *vpcsubnet = &(vpc->subnets[keys[k].idx]);
+                    if (pass) {
+                        vpcsubnet->interfaces[vpcsubnet->max_interfaces] = vpc->interfaces[j];
+                    }
+                    vpcsubnet->max_interfaces++;
+                }
+            }
+            for (j = 0; (pass == 0) && (j < vpc->max_subnets); j++) {
+                gni_vpcsubnet *vpcsubnet = &(vpc->subnets[j]);
+                vpcsubnet->interfaces = gni_arena_alloc(p->arena, vpcsubnet->max_interfaces, sizeof (gni_instance *));
+                vpcsubnet->max_interfaces = 0;
+            }
+        }
+        EUCA_FREE(keys);
+    }
+}
+
+/**
+ * Moves what the document held to the GNI structure once it has been read, and
+ * links its objects together.
+ * @param p [in] the parser
+ */
+static void gni_sax_finish(gni_sax_parser *p) {
+    globalNetworkInfo *gni = p->gni;
+    int i = 0;
+
+    gni->instances = gni_sax_vec_commit(p, &(p->instances), &(gni->max_instances));
+    gni->ifs = gni_sax_vec_commit(p, &(p->ifs), &(gni->max_ifs));
+    gni->secgroups = gni_sax_vec_commit(p, &(p->secgroups), &(gni->max_secgroups));
+    gni->vpcs = gni_sax_vec_commit(p, &(p->vpcs), &(gni->max_vpcs));
+    gni->vpcIgws = gni_sax_vec_commit(p, &(p->igws), &(gni->max_vpcIgws));
+    gni->dhcpos = gni_sax_vec_commit(p, &(p->dhcpos), &(gni->max_dhcpos));
+    gni->instanceDNSServers = gni_sax_vec_commit(p, &(p->dnsservers), &(gni->max_instanceDNSServers));
+    gni->managedSubnet = gni_sax_vec_commit(p, &(p->msubnets), &(gni->max_managedSubnets));
+    gni->subnets = gni_sax_vec_commit(p, &(p->subnets), &(gni->max_subnets));
+    gni->clusters = gni_sax_vec_commit(p, &(p->clusters), &(gni->max_clusters));
+    gni_sax_iprange(p, &(p->publicips), &(gni->public_ips), &(gni->max_public_ips));
+
+    if (IS_NETMODE_VPCMIDO(gni)) {
+        if (p->midos == 1) {
+            euca_strncpy(gni->EucanetdHost, p->eucanetdHost, HOSTNAME_LEN);
+            euca_strncpy(gni->PublicNetworkCidr, p->publicNetworkCidr, HOSTNAME_LEN);
+            euca_strncpy(gni->PublicGatewayIP, p->publicGatewayIP, HOSTNAME_LEN);
+            if (p->gateways <= 0) {
+                LOGERROR("Invalid mido gateway(s) detected. Check network configuration.\n");
+            } else {
+                euca_strncpy(gni->GatewayHosts, p->gwhosts, sizeof (gni->GatewayHosts));
+            }
+        } else {
+            LOGTRACE("mido section not found in GNI\n");
+        }
+    } else if (gni->max_ifs) {
+        // the mode came after the instances: drop the interfaces that were parsed just in case
+        gni->ifs = NULL;
+        gni->max_ifs = 0;
+        for (i = 0; i < gni->max_instances; i++) {
+            gni->instances[i]->interfaces = NULL;
+            gni->instances[i]->max_interfaces = 0;
+        }
+    }
+
+    if (p->mode == GNI_POPULATE_ALL) {
+        gni_sax_link_secgroups(p);
+        gni_sax_link_vpcs(p);
+    }
+    gni_sax_link_nodes(p);
+}
+
+/**
+ * Releases the scratch memory of a parser.
+ * @param p [in] the parser
+ */
+static void gni_sax_parser_free(gni_sax_parser *p) {
+    gni_sax_vec *vecs[] = {
+        &(p->instances), &(p->ifs), &(p->secgroups), &(p->vpcs), &(p->igws), &(p->dhcpos), &(p->dnsservers), &(p->publicips), &(p->msubnets),
+        &(p->subnets), &(p->clusters), &(p->inst[0].sgnames), &(p->inst[1].sgnames), &(p->instifs), &(p->grouprules), &(p->ingress), &(p->egress),
+        &(p->rtbs), &(p->routes), &(p->vpcsubnets), &(p->vpcigws), &(p->natgws), &(p->acls), &(p->aclin), &(p->acleg), &(p->domains), &(p->dns),
+        &(p->ntp), &(p->nbns), &(p->privips), &(p->nodes), &(p->instids),
+    };
+    int i = 0;
+
+    for (i = 0; i < (int) (sizeof (vecs) / sizeof (vecs[0])); i++) {
+        gni_sax_vec_free(vecs[i]);
+    }
+    EUCA_FREE(p->text);
+    EUCA_FREE(p);
+}
+
+/**
+ * Populates a given globalNetworkInfo structure from the content of an XML file
+ * in a single streaming pass (see the top of this file). The structure gets the
+ * same content gni_populate_xpath() gives it, with all of its arrays in an
+ * arena released by gni_clear().
+ * @param mode [in] mode what to populate GNI_POPULATE_ALL || GNI_POPULATE_CONFIG || GNI_POPULATE_NONE
+ * @param gni [in] a pointer to the global network information structure
+ * @param host_info [in] a pointer to the hostname info data structure (only relevant to VPCMIDO - to be deprecated)
+ * @param xmlpath [in] path to the XML file to be used to populate
+ * @return 0 on success or 1 on failure
+ */
+int gni_populate_sax(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, const char *xmlpath) {
+    int rc = 0;
+    int i = 0;
+    size_t len = 0;
+    char *buf = NULL;
+    FILE *fh = NULL;
+    gni_sax_parser *p = NULL;
+    xmlParserCtxtPtr ctxt = NULL;
+    xmlSAXHandler handler;
+    struct timeval tv, ttv;
+
+    if (mode == GNI_POPULATE_NONE) {
+        return (0);
+    }
+
+    eucanetd_timer_usec(&ttv);
+    eucanetd_timer_usec(&tv);
+    if (!gni || !xmlpath) {
+        LOGERROR("invalid input\n");
+        return (1);
+    }
+
+    gni_clear(gni);
+    LOGTRACE("gni cleared in %ld us.\n", eucanetd_timer_usec(&tv));
+
+    if ((fh = fopen(xmlpath, "r")) == NULL) {
+        LOGERROR("unable to parse XML file (%s)\n", xmlpath);
+        return (1);
+    }
+
+    xmlInitParser();
+    bzero(&handler, sizeof (handler));
+    handler.initialized = XML_SAX2_MAGIC;
+    handler.startElementNs = gni_sax_start;
+    handler.endElementNs = gni_sax_end;
+    handler.characters = gni_sax_characters;
+    handler.ignorableWhitespace = gni_sax_characters;
+
+    p = EUCA_ZALLOC_C(1, sizeof (gni_sax_parser));
+    p->gni = gni;
+    p->mode = mode;
+    p->arena = gni->arena = gni_arena_create();
+    for (i = 0; i < GNI_SAX_EDGES; i++) {
+        if (p->edges[gni_sax_edges[i].parent]++ == 0) {
+            p->first[gni_sax_edges[i].parent] = i;
+        }
+    }
+    p->instances.size = p->ifs.size = p->instifs.size = sizeof (gni_instance *);
+    p->secgroups.size = sizeof (gni_secgroup);
+    p->vpcs.size = sizeof (gni_vpc);
+    p->igws.size = sizeof (gni_internet_gateway);
+    p->dhcpos.size = sizeof (gni_dhcp_os);
+    p->dnsservers.size = p->dns.size = p->ntp.size = p->nbns.size = sizeof (u32);
+    p->publicips.size = p->privips.size = sizeof (char *);
+    p->msubnets.size = sizeof (gni_managedsubnet);
+    p->subnets.size = sizeof (gni_subnet);
+    p->clusters.size = sizeof (gni_cluster);
+    p->nodes.size = sizeof (gni_node);
+    p->inst[0].sgnames.size = p->inst[1].sgnames.size = p->grouprules.size = p->vpcigws.size = p->domains.size = p->instids.size = sizeof (gni_name);
+    p->ingress.size = p->egress.size = sizeof (gni_rule);
+    p->rtbs.size = sizeof (gni_route_table);
+    p->routes.size = sizeof (gni_route_entry);
+    p->vpcsubnets.size = sizeof (gni_vpcsubnet);
+    p->natgws.size = sizeof (gni_nat_gateway);
+    p->acls.size = sizeof (gni_network_acl);
+    p->aclin.size = p->acleg.size = sizeof (gni_acl_entry);
+
+    LOGTRACE("begin parsing XML into data structures\n");
+    buf = EUCA_ZALLOC_C(GNI_SAX_READ_SIZE, sizeof (char));
+    if ((ctxt = xmlCreatePushParserCtxt(&handler, p, NULL, 0, xmlpath)) == NULL) {
+        rc = 1;
+    } else {
+        xmlCtxtUseOptions(ctxt, XML_PARSE_NONET);
+        while (!rc && ((len = fread(buf, 1, GNI_SAX_READ_SIZE, fh)) > 0)) {
+            rc = (xmlParseChunk(ctxt, buf, (int) len, 0) != 0);
+        }
+        if (!rc) {
+            rc = (xmlParseChunk(ctxt, NULL, 0, 1) != 0);
+        }
+        if (!ctxt->wellFormed || ferror(fh)) {
+            rc = 1;
+        }
+        xmlFreeParserCtxt(ctxt);
+    }
+    EUCA_FREE(buf);
+    fclose(fh);
+
+    if (rc) {
+        LOGERROR("unable to parse XML file (%s)\n", xmlpath);
+        gni_sax_parser_free(p);
+        gni_clear(gni);
+        return (1);
+    }
+    LOGTRACE("gni document parsed in %ld us.\n", eucanetd_timer_usec(&tv));
+
+    gni_sax_finish(p);
+    gni_sax_parser_free(p);
+    LOGTRACE("gni objects linked in %ld us.\n", eucanetd_timer_usec(&tv));
+    LOGTRACE("end parsing XML into data structures\n");
+
+    rc = gni_validate(gni);
+    if (rc) {
+        LOGDEBUG("could not validate GNI after XML parse: check network config\n");
+        return (1);
+    }
+    LOGDEBUG("gni validated in %ld us.\n", eucanetd_timer_usec(&tv));
+
+    LOGINFO("gni populated in %.2f ms.\n", eucanetd_timer_usec(&ttv) / 1000.0);
+    return (0);
+}
+
+#ifdef _UNIT_TEST
+#include <ctype.h>
+#include <unistd.h>
+#include <euca_file.h>
+
+//! Defined by eucanetd.c in the daemon, referenced by the other objects of libeucanet
+eucanetdConfig *config = NULL;
+
+#define TEST_INSTANCES_PER_NODE                  25     //!< instances of each node in the generated GNI
+#define TEST_INSTANCES_PER_SECGROUP              50     //!< instances of each security group in the generated GNI
+#define TEST_INSTANCES_PER_VPC                   1000   //!< instances of each VPC in the generated GNI
+
+//!
+//! Returns the wall clock in microseconds
+//!
+static long long test_usec(void)
+{
+    struct timeval tv = { 0 };
+
+    gettimeofday(&tv, NULL);
+    return (((long long)tv.tv_sec * 1000000LL) + tv.tv_usec);
+}
+
+//!
+//! Writes the configuration section of a GNI for 'instances' instances in mode 'mode'
+//!
+static void test_write_config(FILE * pFh, int instances, const char *mode)
+{
+    int i = 0;
+    int j = 0;
+    int nodes = (instances + TEST_INSTANCES_PER_NODE - 1) / TEST_INSTANCES_PER_NODE;
+
+    fprintf(pFh, "<configuration>\n<property name=\"mode\"><value>%s</value></property>\n", mode);
+    fprintf(pFh, "<property name=\"publicIps\"><value>10.111.200.1-10.111.200.254</value><value>10.111.201.7</value></property>\n");
+    fprintf(pFh, "<property name=\"enabledCLCIp\"><value>10.111.1.1</value></property>\n");
+    fprintf(pFh, "<property name=\"instanceDNSDomain\"><value>eucalyptus.internal</value></property>\n");
+    fprintf(pFh, "<property name=\"instanceDNSServers\"><value>10.111.1.1</value><value>10.111.1.2</value></property>\n");
+    fprintf(pFh, "<property name=\"mido\"><property name=\"eucanetdHost\"><value>10.111.1.11</value></property><property name=\"gateways\">");
+    for (i = 0; i < 2; i++) {
+        fprintf(pFh, "<gateway><property name=\"gatewayHost\"><value>gw%d.example.com</value></property>", i);
+        fprintf(pFh, "<property name=\"gatewayIP\"><value>10.116.%d.1</value></property>", i);
+        fprintf(pFh, "<property name=\"gatewayInterface\"><value>em%d</value></property></gateway>", i);
+    }
+    fprintf(pFh, "</property><property name=\"publicNetworkCidr\"><value>10.116.0.0/16</value></property>");
+    fprintf(pFh, "<property name=\"publicGatewayIP\"><value>10.116.255.254</value></property></property>\n");
+    fprintf(pFh, "<property name=\"managedSubnet\"><managedSubnet name=\"1.0.0.0\"><property name=\"netmask\"><value>255.0.0.0</value></property>");
+    fprintf(pFh, "<property name=\"minVlan\"><value>2</value></property><property name=\"maxVlan\"><value>4095</value></property>");
+    fprintf(pFh, "<property name=\"segmentSize\"><value>32</value></property></managedSubnet><managedSubnet/></property>\n");
+    fprintf(pFh, "<property name=\"subnets\"><subnet name=\"172.31.0.0\"><property name=\"netmask\"><value>255.255.0.0</value></property>");
+    fprintf(pFh, "<property name=\"gateway\"><value>172.31.0.1</value></property></subnet></property>\n");
+    fprintf(pFh, "<property name=\"clusters\"><cluster name=\"one\"><property name=\"enabledCCIp\"><value>10.111.1.3</value></property>");
+    fprintf(pFh, "<property name=\"macPrefix\"><value>d0:0d</value></property>");
+    fprintf(pFh, "<subnet name=\"172.31.0.0\"><property name=\"netmask\"><value>255.255.0.0</value></property><property name=\"gateway\"><value>172.31.0.1</value></property>");
+    fprintf(pFh, "<property name=\"name\"><value>172.31.0.0</value></property></subnet><subnet name=\"10.0.0.0\"/>");
+    fprintf(pFh, "<property name=\"privateIps\"><value>172.31.0.2-172.31.0.254</value><value>172.31.1.5</value></property>\n<property name=\"nodes\">");
+    for (i = 0; i < nodes; i++) {
+        fprintf(pFh, "<node name=\"10.112.%d.%d\"><instanceIds>", i / 250, (i % 250) + 1);
+        for (j = i * TEST_INSTANCES_PER_NODE; (j < instances) && (j < ((i + 1) * TEST_INSTANCES_PER_NODE)); j++)
+            fprintf(pFh, "<value>i-%08x</value>", j);
+        fprintf(pFh, "</instanceIds></node>\n");
+    }
+    fprintf(pFh, "</property></cluster></property>\n</configuration>\n");
+}
+
+//!
+//! Writes what the CLC would publish for 'instances' instances in mode 'mode', with the
+//! configuration section first or last
+//!
+static int test_write_gni(const char *path, int instances, const char *mode, boolean configLast)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int sgs = (instances + TEST_INSTANCES_PER_SECGROUP - 1) / TEST_INSTANCES_PER_SECGROUP;
+    int vpcs = (instances + TEST_INSTANCES_PER_VPC - 1) / TEST_INSTANCES_PER_VPC;
+    FILE *pFh = NULL;
+
+    if ((pFh = fopen(path, "w")) == NULL)
+        return (1);
+    fprintf(pFh, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<network-data version=\"%d\" applied-version=\"%d\">\n", instances, instances - 1);
+    if (!configLast)
+        test_write_config(pFh, instances, mode);
+
+    fprintf(pFh, "<vpcs>\n");
+    for (i = 0; i < vpcs; i++) {
+        fprintf(pFh, "<vpc name=\"vpc-%08x\"><ownerId>000000000001</ownerId><cidr>172.%d.0.0/16</cidr><dhcpOptionSet>dopt-%08x</dhcpOptionSet>\n", i, 16 + (i % 16), i % 2);
+        fprintf(pFh, "<subnets>");
+        for (j = 0; j < 4; j++) {
+            fprintf(pFh, "<subnet name=\"subnet-%06x%02x\"><ownerId>000000000001</ownerId><cidr>172.%d.%d.0/24</cidr><cluster>one</cluster>", i, j, 16 + (i % 16), j);
+            fprintf(pFh, "<networkAcl>acl-%08x</networkAcl><routeTable>rtb-%06x%02x</routeTable></subnet>", i, i, j % 2);
+        }
+        fprintf(pFh, "</subnets>\n<networkAcls><networkAcl name=\"acl-%08x\"><ownerId>000000000001</ownerId><ingressEntries>", i);
+        fprintf(pFh, "<entry number=\"100\"><action>allow</action><protocol>6</protocol><cidr>10.0.0.0/8</cidr><portRangeFrom>22</portRangeFrom><portRangeTo>22</portRangeTo></entry>");
+        fprintf(pFh, "<entry number=\"200\"><action>deny</action><protocol>1</protocol><cidr>0.0.0.0/0</cidr><icmpType>8</icmpType><icmpCode>-1</icmpCode></entry>");
+        fprintf(pFh, "</ingressEntries><egressEntries><entry number=\"100\"><action>allow</action><protocol>-1</protocol><cidr>0.0.0.0/0</cidr></entry></egressEntries>");
+        fprintf(pFh, "</networkAcl></networkAcls>\n<routeTables>");
+        for (j = 0; j < 2; j++) {
+            fprintf(pFh, "<routeTable name=\"rtb-%06x%02x\"><ownerId>000000000001</ownerId><routes>", i, j);
+            fprintf(pFh, "<route><destinationCidr>172.%d.0.0/16</destinationCidr><gatewayId>local</gatewayId></route>", 16 + (i % 16));
+            fprintf(pFh, "<route><destinationCidr>0.0.0.0/0</destinationCidr><natGatewayId>nat-%015x</natGatewayId><networkInterfaceId>eni-%08x</networkInterfaceId></route>", i, i);
+            fprintf(pFh, "<route><destinationCidr>8.8.8.8/32</destinationCidr><natGatewayId>nat-%015x</natGatewayId><gatewayId>igw-%08x</gatewayId></route>", i, i);
+            fprintf(pFh, "</routes></routeTable>");
+        }
+        fprintf(pFh, "</routeTables>\n<natGateways><natGateway name=\"nat-%015x\"><ownerId>000000000001</ownerId><macAddress>d0:0d:4b:00:%02x:%02x</macAddress>", i,
+                (i >> 8) & 0xff, i & 0xff);
+        fprintf(pFh, "<publicIp>10.116.%d.%d</publicIp><privateIp>172.%d.0.4</privateIp><vpc>vpc-%08x</vpc><subnet>subnet-%06x00</subnet></natGateway></natGateways>\n",
+                100 + (i / 250), (i % 250) + 1, 16 + (i % 16), i, i);
+        fprintf(pFh, "<internetGateways><value>igw-%08x</value></internetGateways></vpc>\n", i);
+    }
+    fprintf(pFh, "</vpcs>\n<instances>\n");
+
+    for (i = 0; i < instances; i++) {
+        k = i / TEST_INSTANCES_PER_VPC;
+        fprintf(pFh, "<instance name=\"i-%08x\"><ownerId>%012d</ownerId><macAddress>d0:0d:%02x:%02x:%02x:%02x</macAddress>", i, 1 + (i % 3), (i >> 24) & 0xff,
+                (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+        if (i % 3)
+            fprintf(pFh, "<publicIp>10.117.%d.%d</publicIp>", (i >> 8) & 0xff, i & 0xff);
+        fprintf(pFh, "<privateIp>172.31.%d.%d</privateIp><vpc>vpc-%08x</vpc><subnet>subnet-%06x%02x</subnet>", (i >> 8) & 0xff, i & 0xff, k, k, i % 4);
+        fprintf(pFh, "<securityGroups><value>sg-%08x</value><value>sg-%08x</value></securityGroups>\n", i / TEST_INSTANCES_PER_SECGROUP, (i * 7) % sgs);
+        fprintf(pFh, "<networkInterfaces>");
+        for (j = 0; j < (1 + ((i % 5) == 0)); j++) {
+            fprintf(pFh, "<networkInterface name=\"eni-%07x%d\"><ownerId>%012d</ownerId><macAddress>d0:0d:%02x:%02x:%02x:%02x</macAddress>", i, j, 1 + (i % 3), j,
+                    (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+            fprintf(pFh, "<privateIp>172.%d.%d.%d</privateIp><vpc>vpc-%08x</vpc><subnet>subnet-%06x%02x</subnet>", 16 + (k % 16), (i >> 8) & 0xff, i & 0xff, k, k, i % 4);
+            fprintf(pFh, "<securityGroups><value>sg-%08x</value></securityGroups>", i / TEST_INSTANCES_PER_SECGROUP);
+            fprintf(pFh, "<sourceDestCheck>%s</sourceDestCheck><deviceIndex>%d</deviceIndex><attachmentId>eni-attach-%08x</attachmentId></networkInterface>",
+                    (j ? "False" : "TRUE"), j, i);
+        }
+        fprintf(pFh, "</networkInterfaces></instance>\n");
+    }
+    fprintf(pFh, "</instances>\n<dhcpOptionSets>");
+    for (i = 0; i < 2; i++) {
+        fprintf(pFh, "<dhcpOptionSet name=\"dopt-%08x\"><ownerId>000000000001</ownerId>", i);
+        fprintf(pFh, "<property name=\"domain-name\"><value>example%d.com</value><value>eu.example%d.com</value></property>", i, i);
+        fprintf(pFh, "<property name=\"domain-name-servers\"><value>10.1.1.%d</value></property>", i + 1);
+        fprintf(pFh, "<property name=\"ntp-servers\"><value>10.1.2.%d</value><value>10.1.2.9</value></property>", i + 1);
+        fprintf(pFh, "<property name=\"netbios-name-servers\"><value>10.1.3.%d</value></property>", i + 1);
+        fprintf(pFh, "<property name=\"netbios-node-type\"><value>%d</value></property></dhcpOptionSet>", 2 * (i + 1));
+    }
+    fprintf(pFh, "</dhcpOptionSets>\n<internetGateways>");
+    for (i = 0; i < vpcs; i++)
+        fprintf(pFh, "<internetGateway name=\"igw-%08x\"><ownerId>000000000001</ownerId></internetGateway>", i);
+    fprintf(pFh, "</internetGateways>\n<securityGroups>\n");
+    for (i = 0; i < sgs; i++) {
+        fprintf(pFh, "<securityGroup name=\"sg-%08x\"><ownerId>%012d</ownerId>", i, 1 + (i % 3));
+        fprintf(pFh, "<rules><value>-P 6 -p 22-22 -s 0.0.0.0/0</value><value>-P 17 -p 1000-2000 -s 10.%d.0.0/16</value><value>-P 1 -t -1:-1 -o sg-%08x -u %012d</value></rules>",
+                i & 0xff, (i + 1) % sgs, 1 + (i % 3));
+        fprintf(pFh, "<ingressRules><rule><protocol>6</protocol><fromPort>22</fromPort><toPort>22</toPort><cidr>0.0.0.0/0</cidr></rule>");
+        fprintf(pFh, "<rule><protocol>1</protocol><groupId>sg-%08x</groupId><groupOwnerId>%012d</groupOwnerId><icmpType>-1</icmpType><icmpCode>-1</icmpCode></rule>",
+                (i + 1) % sgs, 1 + (i % 3));
+        fprintf(pFh, "</ingressRules><egressRules><rule><protocol>-1</protocol><cidr>10.%d.0.0/16</cidr></rule></egressRules></securityGroup>\n", i & 0xff);
+    }
+    fprintf(pFh, "</securityGroups>\n");
+
+    if (configLast)
+        test_write_config(pFh, instances, mode);
+    fprintf(pFh, "</network-data>\n");
+    fclose(pFh);
+    return (0);
+}
+
+//!
+//! Prints an instance or interface, naming what it points to
+//!
+static void test_dump_instance(FILE * pFh, gni_instance * gi)
+{
+    int i = 0;
+
+    fprintf(pFh, "  %s %s %s %s %02x%02x%02x%02x%02x%02x %x %x %s %s %s %s %d %d %s\n", gi->name, gi->ifname, gi->attachmentId, gi->accountId, gi->macAddress[0],
+            gi->macAddress[1], gi->macAddress[2], gi->macAddress[3], gi->macAddress[4], gi->macAddress[5], gi->publicIp, gi->privateIp, gi->vpc, gi->subnet, gi->node,
+            gi->nodehostname, gi->srcdstcheck, gi->deviceidx, gi->instance_name.name);
+    for (i = 0; i < gi->max_secgroup_names; i++)
+        fprintf(pFh, "   sg %s %s\n", gi->secgroup_names[i].name, (gi->gnisgs[i] ? gi->gnisgs[i]->name : "-"));
+    for (i = 0; i < gi->max_interfaces; i++)
+        fprintf(pFh, "   if %s\n", gi->interfaces[i]->ifname);
+}
+
+//!
+//! Prints an ACL entry or a security group rule
+//!
+static void test_dump_rules(FILE * pFh, const char *kind, gni_rule * rules, int max, gni_acl_entry * entries, int max_entries)
+{
+    int i = 0;
+
+    for (i = 0; i < max; i++)
+        fprintf(pFh, "   %s %d %d %d %d %d %d %x %s %s %s\n", kind, rules[i].protocol, rules[i].fromPort, rules[i].toPort, rules[i].icmpType, rules[i].icmpCode,
+                rules[i].cidrSlashnet, rules[i].cidrNetaddr, rules[i].cidr, rules[i].groupId, rules[i].groupOwnerId);
+    for (i = 0; i < max_entries; i++)
+        fprintf(pFh, "   %s %d %d %d %d %d %d %d %d %x %s\n", kind, entries[i].number, entries[i].allow, entries[i].protocol, entries[i].fromPort, entries[i].toPort,
+                entries[i].icmpType, entries[i].icmpCode, entries[i].cidrSlashnet, entries[i].cidrNetaddr, entries[i].cidr);
+}
+
+//!
+//! Prints every field of a populated GNI, following its pointers by name, so that two GNIs
+//! populated differently can be compared as text
+//!
+static char *test_dump(globalNetworkInfo * gni)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    char *psBuf = NULL;
+    size_t len = 0;
+    FILE *pFh = open_memstream(&psBuf, &len);
+
+    fprintf(pFh, "%s %s %s %d %x %s|%s|%s|%s %s %d\n", gni->version, gni->appliedVersion, gni->sMode, gni->nmCode, gni->enabledCLCIp, gni->EucanetdHost,
+            gni->GatewayHosts, gni->PublicNetworkCidr, gni->PublicGatewayIP, gni->instanceDNSDomain, gni->sorted_instances);
+    for (i = 0; i < gni->max_instanceDNSServers; i++)
+        fprintf(pFh, " dns %x\n", gni->instanceDNSServers[i]);
+    fprintf(pFh, " public ips %d", gni->max_public_ips);
+    for (i = 0; i < gni->max_public_ips; i++)
+        fprintf(pFh, " %x", gni->public_ips[i]);
+    fprintf(pFh, "\n");
+    for (i = 0; i < gni->max_subnets; i++)
+        fprintf(pFh, " subnet %x %x %x\n", gni->subnets[i].subnet, gni->subnets[i].netmask, gni->subnets[i].gateway);
+    for (i = 0; i < gni->max_managedSubnets; i++)
+        fprintf(pFh, " managed subnet %x %x %d %d %d\n", gni->managedSubnet[i].subnet, gni->managedSubnet[i].netmask, gni->managedSubnet[i].minVlan,
+                gni->managedSubnet[i].maxVlan, gni->managedSubnet[i].segmentSize);
+    for (i = 0; i < gni->max_clusters; i++) {
+        gni_cluster *cluster = &(gni->clusters[i]);
+        fprintf(pFh, " cluster %s %x %s %x %x %x\n  private ips", cluster->name, cluster->enabledCCIp, cluster->macPrefix, cluster->private_subnet.subnet,
+                cluster->private_subnet.netmask, cluster->private_subnet.gateway);
+        for (j = 0; j < cluster->max_private_ips; j++)
+            fprintf(pFh, " %x", cluster->private_ips[j]);
+        fprintf(pFh, "\n");
+        for (j = 0; j < cluster->max_nodes; j++) {
+            fprintf(pFh, "  node %s:", cluster->nodes[j].name);
+            for (k = 0; k < cluster->nodes[j].max_instance_names; k++)
+                fprintf(pFh, " %s", cluster->nodes[j].instance_names[k].name);
+            fprintf(pFh, "\n");
+        }
+    }
+    fprintf(pFh, " instances %d\n", gni->max_instances);
+    for (i = 0; i < gni->max_instances; i++)
+        test_dump_instance(pFh, gni->instances[i]);
+    fprintf(pFh, " interfaces %d\n", gni->max_ifs);
+    for (i = 0; i < gni->max_ifs; i++)
+        test_dump_instance(pFh, gni->ifs[i]);
+    for (i = 0; i < gni->max_secgroups; i++) {
+        gni_secgroup *sg = &(gni->secgroups[i]);
+        fprintf(pFh, " secgroup %s %s %s\n", sg->name, sg->accountId, sg->chainname);
+        for (j = 0; j < sg->max_grouprules; j++)
+            fprintf(pFh, "   rule %s\n", sg->grouprules[j].name);
+        test_dump_rules(pFh, "ingress", sg->ingress_rules, sg->max_ingress_rules, NULL, 0);
+        test_dump_rules(pFh, "egress", sg->egress_rules, sg->max_egress_rules, NULL, 0);
+        for (j = 0; j < sg->max_instances; j++)
+            fprintf(pFh, "   instance %s\n", sg->instances[j]->name);
+        for (j = 0; j < sg->max_interfaces; j++)
+            fprintf(pFh, "   interface %s\n", sg->interfaces[j]->ifname);
+    }
+    for (i = 0; i < gni->max_vpcs; i++) {
+        gni_vpc *vpc = &(gni->vpcs[i]);
+        fprintf(pFh, " vpc %s %s %s %s %s\n", vpc->name, vpc->accountId, vpc->cidr, vpc->dhcpOptionSet_name, (vpc->dhcpOptionSet ? vpc->dhcpOptionSet->name : "-"));
+        for (j = 0; j < vpc->max_subnets; j++) {
+            gni_vpcsubnet *subnet = &(vpc->subnets[j]);
+            fprintf(pFh, "  subnet %s %s %s %s %s %s %s %s\n", subnet->name, subnet->accountId, subnet->cidr, subnet->cluster_name, subnet->networkAcl_name,
+                    subnet->routeTable_name, (subnet->routeTable ? subnet->routeTable->name : "-"), (subnet->networkAcl ? subnet->networkAcl->name : "-"));
+            for (k = 0; k < subnet->max_interfaces; k++)
+                fprintf(pFh, "   interface %s\n", subnet->interfaces[k]->ifname);
+        }
+        for (j = 0; j < vpc->max_networkAcls; j++) {
+            fprintf(pFh, "  acl %s %s\n", vpc->networkAcls[j].name, vpc->networkAcls[j].accountId);
+            test_dump_rules(pFh, "ingress", NULL, 0, vpc->networkAcls[j].ingress, vpc->networkAcls[j].max_ingress);
+            test_dump_rules(pFh, "egress", NULL, 0, vpc->networkAcls[j].egress, vpc->networkAcls[j].max_egress);
+        }
+        for (j = 0; j < vpc->max_routeTables; j++) {
+            fprintf(pFh, "  route table %s %s\n", vpc->routeTables[j].name, vpc->routeTables[j].accountId);
+            for (k = 0; k < vpc->routeTables[j].max_entries; k++)
+                fprintf(pFh, "   route %s %s\n", vpc->routeTables[j].entries[k].destCidr, vpc->routeTables[j].entries[k].target);
+        }
+        for (j = 0; j < vpc->max_natGateways; j++) {
+            gni_nat_gateway *natgw = &(vpc->natGateways[j]);
+            fprintf(pFh, "  nat gateway %s %s %02x%02x%02x%02x%02x%02x %x %x %s %s\n", natgw->name, natgw->accountId, natgw->macAddress[0], natgw->macAddress[1],
+                    natgw->macAddress[2], natgw->macAddress[3], natgw->macAddress[4], natgw->macAddress[5], natgw->publicIp, natgw->privateIp, natgw->vpc, natgw->subnet);
+        }
+        for (j = 0; j < vpc->max_internetGatewayNames; j++)
+            fprintf(pFh, "  igw %s\n", vpc->internetGatewayNames[j].name);
+        for (j = 0; j < vpc->max_interfaces; j++)
+            fprintf(pFh, "  interface %s\n", vpc->interfaces[j]->ifname);
+    }
+    for (i = 0; i < gni->max_vpcIgws; i++)
+        fprintf(pFh, " internet gateway %s %s\n", gni->vpcIgws[i].name, gni->vpcIgws[i].accountId);
+    for (i = 0; i < gni->max_dhcpos; i++) {
+        gni_dhcp_os *dhcp = &(gni->dhcpos[i]);
+        fprintf(pFh, " dhcp option set %s %s %d\n  ", dhcp->name, dhcp->accountId, dhcp->netbios_type);
+        for (j = 0; j < dhcp->max_domains; j++)
+            fprintf(pFh, " %s", dhcp->domains[j].name);
+        for (j = 0; j < dhcp->max_dns; j++)
+            fprintf(pFh, " dns %x", dhcp->dns[j]);
+        for (j = 0; j < dhcp->max_ntp; j++)
+            fprintf(pFh, " ntp %x", dhcp->ntp[j]);
+        for (j = 0; j < dhcp->max_netbios_ns; j++)
+            fprintf(pFh, " nbns %x", dhcp->netbios_ns[j]);
+        fprintf(pFh, "\n");
+    }
+    fclose(pFh);
+    return (psBuf);
+}
+
+//!
+//! Populates a GNI from 'path' both ways and reports where they differ
+//!
+static int test_compare(const char *what, const char *path, int mode)
+{
+    int rcx = 0;
+    int rcs = 0;
+    int errors = 0;
+    char *psXpath = NULL;
+    char *psSax = NULL;
+    char *pX = NULL;
+    char *pS = NULL;
+    globalNetworkInfo *gnix = gni_init();
+    globalNetworkInfo *gnis = gni_init();
+
+    rcx = gni_populate_xpath(mode, gnix, NULL, (char *)path);
+    rcs = gni_populate_sax(mode, gnis, NULL, path);
+    psXpath = test_dump(gnix);
+    psSax = test_dump(gnis);
+    if (rcx || rcs) {
+        printf("FAIL: %s: populated with rc %d (XPath) and %d (SAX)\n", what, rcx, rcs);
+        errors++;
+    }
+    if (strcmp(psXpath, psSax)) {
+        for (pX = psXpath, pS = psSax; *pX && (*pX == *pS); pX++, pS++) ;
+        for (; (pX > psXpath) && (pX[-1] != '\n'); pX--, pS--) ;
+        printf("FAIL: %s: populated differently\n  XPath: %.*s\n  SAX:   %.*s\n", what, (int)strcspn(pX, "\n"), pX, (int)strcspn(pS, "\n"), pS);
+        errors++;
+    }
+    if (!gnis->arena || (gnis->max_instances && (gnis->instances[0] == NULL))) {
+        printf("FAIL: %s: SAX populated GNI not in an arena\n", what);
+        errors++;
+    }
+    EUCA_FREE(psXpath);
+    EUCA_FREE(psSax);
+    gni_free(gnix);
+    gni_free(gnis);
+    return (errors);
+}
+
+//!
+//! Unit test: a GNI populated by the SAX parser must be the same as the one the XPath
+//! based parser populates from the same document. With 'bench-parse [instances] [mode]',
+//! compares the time both take on a GNI of 50k EDGE instances by default (VPCMIDO is much
+//! slower with XPath, which matches every node instance against every instance).
+//!
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int errors = 0;
+    int instances = 50000;
+    long long t0 = 0;
+    long long txpath = 0;
+    long long tsax = 0;
+    char path[EUCA_MAX_PATH] = "/tmp/gni-sax-XXXXXX";
+    const char *mode = "EDGE";
+    FILE *pFh = NULL;
+    globalNetworkInfo *gni = NULL;
+
+    log_params_set(EUCA_LOG_WARN, 0, 100000);
+    if ((i = safe_mkstemp(path)) < 0)
+        return (1);
+    close(i);
+
+    if ((argc > 1) && !strcmp(argv[1], "bench-parse")) {
+        for (i = 2; i < argc; i++) {
+            if (isdigit(argv[i][0]))
+                instances = atoi(argv[i]);
+            else
+                mode = argv[i];
+        }
+        test_write_gni(path, instances, mode, FALSE);
+        gni = gni_init();
+        t0 = test_usec();
+        errors += (gni_populate_xpath(GNI_POPULATE_ALL, gni, NULL, path) != 0);
+        txpath = test_usec() - t0;
+        gni_clear(gni);
+        t0 = test_usec();
+        errors += (gni_populate_sax(GNI_POPULATE_ALL, gni, NULL, path) != 0);
+        tsax = test_usec() - t0;
+        printf("%10s %8s %14s %14s %10s %12s\n", "instances", "mode", "XPath (ms)", "SAX (ms)", "speedup", "arena (MB)");
+        printf("%10d %8s %14.2f %14.2f %9.1fx %12.2f\n", instances, mode, txpath / 1000.0, tsax / 1000.0, (double)txpath / (tsax ? tsax : 1),
+               (gni->arena ? gni->arena->allocated : 0) / (1024.0 * 1024.0));
+        gni_free(gni);
+    } else {
+        test_write_gni(path, 200, "VPCMIDO", FALSE);
+        errors += test_compare("VPCMIDO", path, GNI_POPULATE_ALL);
+        errors += test_compare("VPCMIDO configuration", path, GNI_POPULATE_CONFIG);
+        test_write_gni(path, 200, "EDGE", FALSE);
+        errors += test_compare("EDGE", path, GNI_POPULATE_ALL);
+        // the mode comes after the interfaces: they are parsed, then dropped
+        test_write_gni(path, 200, "EDGE", TRUE);
+        errors += test_compare("EDGE with configuration last", path, GNI_POPULATE_ALL);
+        test_write_gni(path, 200, "VPCMIDO", TRUE);
+        errors += test_compare("VPCMIDO with configuration last", path, GNI_POPULATE_ALL);
+
+        // populating again releases the previous arena, clearing leaves an empty GNI
+        gni = gni_init();
+        test_write_gni(path, 60, "VPCMIDO", FALSE);
+        for (i = 0; i < 3; i++) {
+            if (gni_populate_sax(GNI_POPULATE_ALL, gni, NULL, path) || (gni->max_instances != 60) || (gni->max_ifs != 72) || strcmp(gni->instances[59]->node, "10.112.0.3")
+                || (gni->secgroups[0].max_interfaces != 60) || (gni->ifs[0]->gnisgs[0] != &(gni->secgroups[0]))) {
+                printf("FAIL: GNI not populated again\n");
+                errors++;
+            }
+        }
+        gni_clear(gni);
+        if (gni->arena || gni->instances || gni->max_instances || gni->version[0] || !gni->init) {
+            printf("FAIL: GNI not cleared\n");
+            errors++;
+        }
+
+        // a broken document is an error, and leaves nothing behind
+        if ((pFh = fopen(path, "w")) != NULL) {
+            fprintf(pFh, "<network-data version=\"3\"><configuration><property name=\"mode\"><value>EDGE</value></property></configuration><instances>");
+            fclose(pFh);
+        }
+        if ((gni_populate_sax(GNI_POPULATE_ALL, gni, NULL, path) != 1) || gni->arena || gni->version[0] || gni->sMode[0]) {
+            printf("FAIL: broken GNI document not rejected\n");
+            errors++;
+        }
+        gni_free(gni);
+        printf("correctness: %s\n", errors ? "FAILED" : "ok");
+    }
+
+    unlink(path);
+    return (errors ? 1 : 0);
+}
+#endif /* _UNIT_TEST */
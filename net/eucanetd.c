@@ -1696,6 +1696,7 @@ static int eucanetd_read_latest_network(globalNetworkInfo *pGni, boolean *update
     char *strptrc = NULL;
     char *strptrd = NULL;
     boolean found_ip = FALSE;
+    char version[32] = "";
     gni_cluster *mycluster = NULL;
 
     LOGTRACE("reading latest network view into eucanetd\n");
@@ -1704,7 +1705,14 @@ static int eucanetd_read_latest_network(globalNetworkInfo *pGni, boolean *update
         LOGWARN("Invalid argument: update_globalnet is null.\n");
         return (1);
     }
-    rc = gni_populate(pGni, host_info, config->global_network_info_file.dest);
+    // when pGni already holds the version we last applied, and the file still has it, there is nothing new to parse
+    if (strlen(pGni->version) && !strcmp(pGni->version, config->lastAppliedVersion)
+        && !gni_read_version(config->global_network_info_file.dest, version, sizeof(version)) && !strcmp(version, pGni->version)) {
+        LOGTRACE("global network version (%s) already populated, not parsing '%s'\n", version, config->global_network_info_file.dest);
+        rc = 0;
+    } else {
+        rc = gni_populate(pGni, host_info, config->global_network_info_file.dest);
+    }
     if (rc) {
         LOGERROR("failed to initialize global network info data structures from XML file: check network config settings\n");
         ret = 1;
@@ -0,0 +1,313 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2013 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file net/handler_index.c
+//! Implements the hash indexes of the IP table, EB table and IP set handlers.
+//! Each index is a linear-probing table kept at most half full, doubling as
+//! entries get added. The handlers never shrink their arrays in place, so
+//! there is no removal: when entries move (a chain gets compacted or sorted),
+//! the owner clears the index and inserts the entries again.
+//!
+//! An array may hold the same key more than once (e.g. the "EMPTY" chains of
+//! the EB table handler), so a lookup returns the lowest matching entry, which
+//! is what the linear scans it replaces used to return.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <eucalyptus.h>
+#include <log.h>
+#include <hash.h>
+
+#include "handler_index.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define HIDX_MIN_SLOTS                           16     //!< buckets of an index after its first insertion
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void hidx_place(handler_index_bucket * buckets, int slots, uint32_t hash, int entry);
+static void hidx_grow(handler_index * idx);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Hashes a key of any type (e.g. an IP/netmask pair)
+//!
+//! @param[in] key pointer to the key
+//! @param[in] len the size of the key in bytes
+//!
+//! @return the hash value
+//!
+uint32_t hidx_hash(const void *key, size_t len)
+{
+    return (jenkins((const char *)key, len));
+}
+
+//!
+//! Hashes a NUL-terminated key (a table, chain, rule or set name)
+//!
+//! @param[in] key the string to hash
+//!
+//! @return the hash value
+//!
+uint32_t hidx_hash_str(const char *key)
+{
+    return (jenkins(key, strlen(key)));
+}
+
+//!
+//! Puts an entry in the first free bucket of its probe sequence
+//!
+//! @param[in] buckets the buckets to insert into, with at least one free
+//! @param[in] slots the number of buckets, a power of two
+//! @param[in] hash the hash of the entry key
+//! @param[in] entry the array entry
+//!
+static void hidx_place(handler_index_bucket * buckets, int slots, uint32_t hash, int entry)
+{
+    int i = (hash & (slots - 1));
+
+    while (buckets[i].entry != HIDX_NONE)
+        i = ((i + 1) & (slots - 1));
+    buckets[i].hash = hash;
+    buckets[i].entry = entry;
+}
+
+//!
+//! Doubles the number of buckets of an index (or allocates the first ones)
+//! and moves the entries over
+//!
+//! @param[in] idx pointer to the index
+//!
+static void hidx_grow(handler_index * idx)
+{
+    int i = 0;
+    int slots = ((idx->slots > 0) ? (idx->slots << 1) : HIDX_MIN_SLOTS);
+    handler_index_bucket *buckets = NULL;
+
+    if ((buckets = EUCA_ALLOC(slots, sizeof(handler_index_bucket))) == NULL) {
+        LOGFATAL("out of memory!\n");
+        exit(1);
+    }
+    for (i = 0; i < slots; i++)
+        buckets[i].entry = HIDX_NONE;
+    for (i = 0; i < idx->slots; i++) {
+        if (idx->buckets[i].entry != HIDX_NONE)
+            hidx_place(buckets, slots, idx->buckets[i].hash, idx->buckets[i].entry);
+    }
+    EUCA_FREE(idx->buckets);
+    idx->buckets = buckets;
+    idx->slots = slots;
+}
+
+//!
+//! Adds an array entry to an index
+//!
+//! @param[in] idx pointer to the index
+//! @param[in] hash the hash of the entry key, from hidx_hash() or hidx_hash_str()
+//! @param[in] entry the array entry
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if any parameter does not meet the preconditions
+//!
+//! @pre The same entry must not already be in the index
+//!
+int hidx_insert(handler_index * idx, uint32_t hash, int entry)
+{
+    if (!idx || (entry < 0)) {
+        return (EUCA_INVALID_ERROR);
+    }
+    // stay at most half full so that probe sequences remain short
+    if (((idx->used + 1) * 2) > idx->slots) {
+        hidx_grow(idx);
+    }
+    hidx_place(idx->buckets, idx->slots, hash, entry);
+    idx->used++;
+    return (EUCA_OK);
+}
+
+//!
+//! Finds the array entry that carries a given key
+//!
+//! @param[in] idx pointer to the index
+//! @param[in] hash the hash of the key
+//! @param[in] key the key, passed on to match
+//! @param[in] match verifies that a candidate entry carries the key
+//! @param[in] ctx passed on to match, typically the indexed array
+//!
+//! @return the lowest entry carrying the key or HIDX_NONE if there is none
+//!
+int hidx_lookup(handler_index * idx, uint32_t hash, const void *key, hidx_match_fn match, void *ctx)
+{
+    int i = 0;
+    int found = HIDX_NONE;
+
+    if (!idx || !idx->buckets || !match) {
+        return (HIDX_NONE);
+    }
+
+    for (i = (hash & (idx->slots - 1)); idx->buckets[i].entry != HIDX_NONE; i = ((i + 1) & (idx->slots - 1))) {
+        if ((idx->buckets[i].hash == hash) && ((found == HIDX_NONE) || (idx->buckets[i].entry < found)) && match(idx->buckets[i].entry, key, ctx)) {
+            found = idx->buckets[i].entry;
+        }
+    }
+    return (found);
+}
+
+//!
+//! Empties an index, keeping its buckets for the entries to be inserted again
+//!
+//! @param[in] idx pointer to the index
+//!
+void hidx_clear(handler_index * idx)
+{
+    int i = 0;
+
+    if (!idx) {
+        return;
+    }
+    for (i = 0; i < idx->slots; i++)
+        idx->buckets[i].entry = HIDX_NONE;
+    idx->used = 0;
+}
+
+//!
+//! Releases the buckets of an index, leaving it empty
+//!
+//! @param[in] idx pointer to the index
+//!
+void hidx_free(handler_index * idx)
+{
+    if (!idx) {
+        return;
+    }
+    EUCA_FREE(idx->buckets);
+    idx->slots = 0;
+    idx->used = 0;
+}
@@ -115,6 +115,12 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! What the member index of a set is keyed by
+typedef struct ips_member_key_t {
+    u32 ip;                            //!< the member IP, as dot2hex() returns it
+    int nm;                            //!< the member netmask length
+} ips_member_key;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -141,6 +147,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int ips_set_match(int entry, const void *key, void *ctx);
+static int ips_member_match(int entry, const void *key, void *ctx);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -454,6 +463,7 @@ int ips_handler_add_set(ips_handler * ipsh, char *setname)
         bzero(&(ipsh->sets[ipsh->max_sets]), sizeof(ips_set));
         snprintf(ipsh->sets[ipsh->max_sets].name, 64, setname);
         ipsh->sets[ipsh->max_sets].ref_count = 1;
+        hidx_insert(&(ipsh->set_index), hidx_hash_str(ipsh->sets[ipsh->max_sets].name), ipsh->max_sets);
         ipsh->max_sets++;
     }
     return (0);
@@ -477,23 +487,32 @@ int ips_handler_add_set(ips_handler * ipsh, char *setname)
 //!
 ips_set *ips_handler_find_set(ips_handler * ipsh, char *findset)
 {
-    int i, setidx = 0, found = 0;
+    int setidx = 0;
     if (!ipsh || !findset || !ipsh->init) {
         return (NULL);
     }
 
-    found = 0;
-    for (i = 0; i < ipsh->max_sets && !found; i++) {
-        setidx = i;
-        if (!strcmp(ipsh->sets[i].name, findset))
-            found++;
-    }
-    if (!found) {
+    setidx = hidx_lookup(&(ipsh->set_index), hidx_hash_str(findset), findset, ips_set_match, ipsh->sets);
+    if (setidx == HIDX_NONE) {
         return (NULL);
     }
     return (&(ipsh->sets[setidx]));
 }
 
+//!
+//! Tells ips_handler_find_set() whether a set index entry is the one looked up
+//!
+//! @param[in] entry the index of the candidate in the sets array
+//! @param[in] key the name of the set looked up
+//! @param[in] ctx the sets array
+//!
+//! @return TRUE if the names match, FALSE otherwise
+//!
+static int ips_set_match(int entry, const void *key, void *ctx)
+{
+    return (!strcmp(((ips_set *) ctx)[entry].name, (const char *)key));
+}
+
 //!
 //! Function description.
 //!
@@ -538,6 +557,7 @@ int ips_set_add_net(ips_handler * ipsh, char *setname, char *ipname, int nmname)
 {
     ips_set *set = NULL;
     u32 *ip = NULL;
+    ips_member_key key = { 0 };
     if (!ipsh || !setname || !ipname || !ipsh->init) {
         return (1);
     }
@@ -564,6 +584,9 @@ int ips_set_add_net(ips_handler * ipsh, char *setname, char *ipname, int nmname)
         bzero(&(set->member_nms[set->max_member_ips]), sizeof(int));
         set->member_ips[set->max_member_ips] = dot2hex(ipname);
         set->member_nms[set->max_member_ips] = nmname;
+        key.ip = set->member_ips[set->max_member_ips];
+        key.nm = nmname;
+        hidx_insert(&(set->member_index), hidx_hash(&key, sizeof(key)), set->max_member_ips);
         set->max_member_ips++;
         set->ref_count++;
     }
@@ -612,9 +635,9 @@ u32 *ips_set_find_ip(ips_handler * ipsh, char *setname, char *findipstr)
 //!
 u32 *ips_set_find_net(ips_handler * ipsh, char *setname, char *findipstr, int findnm)
 {
-    int i, found = 0, ipidx = 0;
+    int ipidx = 0;
     ips_set *set = NULL;
-    u32 findip;
+    ips_member_key key = { 0 };
 
     if (!ipsh || !setname || !findipstr || !ipsh->init) {
         return (NULL);
@@ -625,21 +648,32 @@ u32 *ips_set_find_net(ips_handler * ipsh, char *setname, char *findipstr, int fi
         return (NULL);
     }
 
-    findip = dot2hex(findipstr);
-    found = 0;
-    for (i = 0; i < set->max_member_ips && !found; i++) {
-        ipidx = i;
-        if (set->member_ips[i] == findip && set->member_nms[i] == findnm)
-            found++;
-    }
-
-    if (!found) {
+    key.ip = dot2hex(findipstr);
+    key.nm = findnm;
+    ipidx = hidx_lookup(&(set->member_index), hidx_hash(&key, sizeof(key)), &key, ips_member_match, set);
+    if (ipidx == HIDX_NONE) {
         return (NULL);
     }
 
     return (&(set->member_ips[ipidx]));
 }
 
+//!
+//! Tells ips_set_find_net() whether a member index entry is the one looked up
+//!
+//! @param[in] entry the index of the candidate in the member arrays
+//! @param[in] key the ips_member_key looked up
+//! @param[in] ctx the set
+//!
+//! @return TRUE if both the IP and the netmask match, FALSE otherwise
+//!
+static int ips_member_match(int entry, const void *key, void *ctx)
+{
+    ips_set *set = ctx;
+
+    return ((set->member_ips[entry] == ((const ips_member_key *)key)->ip) && (set->member_nms[entry] == ((const ips_member_key *)key)->nm));
+}
+
 //!
 //! Function description.
 //!
@@ -672,6 +706,7 @@ int ips_set_flush(ips_handler * ipsh, char *setname)
     EUCA_FREE(set->member_ips);
     EUCA_FREE(set->member_nms);
     set->max_member_ips = set->ref_count = 0;
+    hidx_clear(&(set->member_index));
 
     return (0);
 }
@@ -708,6 +743,7 @@ int ips_handler_deletesetmatch(ips_handler * ipsh, char *setmatch)
             EUCA_FREE(ipsh->sets[i].member_nms);
             ipsh->sets[i].max_member_ips = 0;
             ipsh->sets[i].ref_count = 0;
+            hidx_clear(&(ipsh->sets[i].member_index));
         }
     }
 
@@ -742,8 +778,10 @@ int ips_handler_free(ips_handler * ipsh)
     for (i = 0; i < ipsh->max_sets; i++) {
         EUCA_FREE(ipsh->sets[i].member_ips);
         EUCA_FREE(ipsh->sets[i].member_nms);
+        hidx_free(&(ipsh->sets[i].member_index));
     }
     EUCA_FREE(ipsh->sets);
+    hidx_free(&(ipsh->set_index));
 
     unlink(ipsh->ips_file);
 
@@ -775,8 +813,10 @@ int ips_handler_close(ips_handler * ipsh)
     for (i = 0; i < ipsh->max_sets; i++) {
         EUCA_FREE(ipsh->sets[i].member_ips);
         EUCA_FREE(ipsh->sets[i].member_nms);
+        hidx_free(&(ipsh->sets[i].member_index));
     }
     EUCA_FREE(ipsh->sets);
+    hidx_free(&(ipsh->set_index));
 
     unlink(ipsh->ips_file);
     return (0);
@@ -77,6 +77,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#include "handler_index.h"
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -107,11 +109,13 @@ typedef struct ips_set_t {
     int *member_nms;
     int max_member_ips;
     int ref_count;
+    handler_index member_index;        //!< members by IP and netmask
 } ips_set;
 
 typedef struct ips_handler_t {
     ips_set *sets;
     int max_sets;
+    handler_index set_index;           //!< sets by name
     char ips_file[EUCA_MAX_PATH];
     char cmdprefix[EUCA_MAX_PATH];
     int init;
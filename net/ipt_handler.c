@@ -115,6 +115,14 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! What ipt_handler_deploy() is about to do with a chain
+typedef struct ipt_chain_plan_t {
+    char *rules;                       //!< the chain as it is to be deployed, declaration line first, NULL if it is to be removed
+    size_t len;                        //!< length of rules
+    size_t decl_len;                   //!< length of the declaration line that starts rules
+    boolean changed;                   //!< the chain differs from what the system has
+} ipt_chain_plan;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -141,12 +149,26 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int ipt_system_apply(ipt_handler * pIpt, boolean noflush);
+static int ipt_handler_load(ipt_handler * ipth);
+static void ipt_chain_render(ipt_chain * chain, FILE * pFh, boolean deploy);
+static int ipt_chain_render_mem(ipt_chain * chain, boolean deploy, char **ppsOut, size_t * pLen);
+static void ipt_table_write(ipt_table * table, ipt_chain_plan * plans, boolean full, FILE * pFh);
+static void ipt_table_free(ipt_table * table);
+static int ipt_table_match(int entry, const void *key, void *ctx);
+static int ipt_chain_match(int entry, const void *key, void *ctx);
+static int ipt_rule_match(int entry, const void *key, void *ctx);
+static void ipt_chain_reindex(ipt_chain * chain);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Built-in chains have a policy, user-defined ones have '-' instead
+#define IPT_CHAIN_BUILTIN(_pChain)               (strcmp((_pChain)->policyname, "-") != 0)
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                               IMPLEMENTATION                               |
@@ -184,12 +206,15 @@
 int ipt_handler_init(ipt_handler * pIpt, const char *psCmdPrefix, const char *psPreloadPath)
 {
     int fd = 0;
+    boolean tested = FALSE;
     char sTempFileName[EUCA_MAX_PATH] = "";  // Used to temporarily hold name while we zero out the struct
 
     // Make sure our pointers are valid
     if (!pIpt) {
         return (1);
     }
+    // ipt_handler_free() re-initializes the handler on every repopulate, no need to test the shell-outs each time
+    tested = pIpt->init;
 
     //
     // Initialize the temporary file *ONCE* per process execution
@@ -244,7 +269,7 @@ int ipt_handler_init(ipt_handler * pIpt, const char *psCmdPrefix, const char *ps
         snprintf(pIpt->preloadPath, EUCA_MAX_PATH, "%s", psPreloadPath);
     }
     // test required shell-outs
-    if (euca_execlp_redirect(NULL, NULL, "/dev/null", FALSE, "/dev/null", FALSE, pIpt->cmdprefix, "iptables-save", NULL) != EUCA_OK) {
+    if (!tested && (euca_execlp_redirect(NULL, NULL, "/dev/null", FALSE, "/dev/null", FALSE, pIpt->cmdprefix, "iptables-save", NULL) != EUCA_OK)) {
         LOGERROR("could not execute iptables-save. check command/permissions\n");
         return (1);
     }
@@ -302,9 +327,24 @@ int ipt_system_save(ipt_handler * pIpt)
 //! @note
 //!
 int ipt_system_restore(ipt_handler * pIpt)
+{
+    return (ipt_system_apply(pIpt, FALSE));
+}
+
+//!
+//! Same as ipt_system_restore() but, with noflush set, iptables-restore runs with --noflush: it
+//! only touches the chains our file declares or names in its commands, instead of replacing every
+//! table the file mentions.
+//!
+//! @param[in] pIpt pointer to the IP table handler structure
+//! @param[in] noflush set to TRUE to leave what our file does not mention alone
+//!
+//! @return 0 on success or any other value if any failure occured
+//!
+static int ipt_system_apply(ipt_handler * pIpt, boolean noflush)
 {
     int rc = EUCA_OK;
-    if (euca_execlp_redirect(NULL, pIpt->ipt_file, NULL, FALSE, NULL, FALSE, pIpt->cmdprefix, "iptables-restore", "-c", NULL) != EUCA_OK) {
+    if (euca_execlp_redirect(NULL, pIpt->ipt_file, NULL, FALSE, NULL, FALSE, pIpt->cmdprefix, "iptables-restore", "-c", (noflush ? "--noflush" : NULL), NULL) != EUCA_OK) {
         copy_file(pIpt->ipt_file, "/tmp/euca_ipt_file_failed");
         LOGERROR("iptables-restore failed. copying failed input file to '/tmp/euca_ipt_file_failed' for manual retry.\n");
         rc = EUCA_ERROR;
@@ -334,13 +374,25 @@ int ipt_system_restore(ipt_handler * pIpt)
 //!     system IP tables should remain unchanged.
 //!
 //! @note
+//!     Only the chains that differ from what the system has (as last read by ipt_handler_repopulate()
+//!     or written by this function) are written, and iptables-restore applies them with --noflush,
+//!     leaving every other chain alone. Each table is still committed atomically. When nothing
+//!     changed, iptables-restore is not run at all. Tables that were never read from the system,
+//!     and a preload file, whose content is not tracked, make for a full restore of the tables
+//!     involved instead.
 //!
 int ipt_handler_deploy(ipt_handler * pIpt)
 {
     int i = 0;
     int j = 0;
-    int k = 0;
+    int rc = 0;
+    int chains = 0;
+    int deployed = 0;
+    boolean full = FALSE;
+    boolean *pWrite = NULL;
     char *psPreload = NULL;
+    ipt_chain *chain = NULL;
+    ipt_chain_plan **ppPlans = NULL;
     FILE *pFh = NULL;
 
     if (!pIpt || !pIpt->init) {
@@ -349,42 +401,200 @@ int ipt_handler_deploy(ipt_handler * pIpt)
 
     ipt_handler_update_refcounts(pIpt);
 
-    if ((pFh = fopen(pIpt->ipt_file, "w")) == NULL) {
-        LOGERROR("could not open file for write '%s': check permissions\n", pIpt->ipt_file);
-        return (1);
+    ppPlans = EUCA_ZALLOC(pIpt->max_tables + 1, sizeof(ipt_chain_plan *));
+    pWrite = EUCA_ZALLOC(pIpt->max_tables + 1, sizeof(boolean));
+    if (!ppPlans || !pWrite) {
+        LOGFATAL("out of memory!\n");
+        exit(1);
+    }
+    // a preload file is written as is, which takes a full restore
+    full = (strlen(pIpt->preloadPath) > 0);
+
+    // find out which chains changed since they were applied
+    for (i = 0; (i < pIpt->max_tables) && !rc; i++) {
+        if ((ppPlans[i] = EUCA_ZALLOC(pIpt->tables[i].max_chains + 1, sizeof(ipt_chain_plan))) == NULL) {
+            LOGFATAL("out of memory!\n");
+            exit(1);
+        }
+        pWrite[i] = full;
+        for (j = 0; j < pIpt->tables[i].max_chains; j++) {
+            chain = &(pIpt->tables[i].chains[j]);
+            if (!chain->flushed && chain->ref_count) {
+                if (ipt_chain_render_mem(chain, TRUE, &(ppPlans[i][j].rules), &(ppPlans[i][j].len)) != 0) {
+                    rc = 1;
+                    break;
+                }
+                ppPlans[i][j].decl_len = (strchr(ppPlans[i][j].rules, '\n') - ppPlans[i][j].rules) + 1;
+            }
+            if (!ppPlans[i][j].rules) {
+                ppPlans[i][j].changed = (chain->applied != NULL);
+            } else {
+                ppPlans[i][j].changed = (!chain->applied || (chain->applied_len != ppPlans[i][j].len) || memcmp(chain->applied, ppPlans[i][j].rules, ppPlans[i][j].len));
+            }
+            if (ppPlans[i][j].changed) {
+                pWrite[i] = TRUE;
+                chains++;
+            }
+        }
+        if (pWrite[i] && !pIpt->tables[i].loaded) {
+            full = TRUE;
+        }
+    }
+
+    if (!rc) {
+        if ((pFh = fopen(pIpt->ipt_file, "w")) == NULL) {
+            LOGERROR("could not open file for write '%s': check permissions\n", pIpt->ipt_file);
+            rc = 1;
+        }
     }
-    // do the preload stuff first if needed
-    if (strlen(pIpt->preloadPath)) {
-        if ((psPreload = file2str(pIpt->preloadPath)) == NULL) {
-            LOGTRACE("Fail to load IP table preload content from '%s'.\n", pIpt->preloadPath);
+
+    if (!rc) {
+        // do the preload stuff first if needed
+        if (strlen(pIpt->preloadPath)) {
+            if ((psPreload = file2str(pIpt->preloadPath)) == NULL) {
+                LOGTRACE("Fail to load IP table preload content from '%s'.\n", pIpt->preloadPath);
+            } else {
+                fprintf(pFh, "%s\n", psPreload);
+                EUCA_FREE(psPreload);
+                deployed++;
+            }
+        }
+
+        for (i = 0; i < pIpt->max_tables; i++) {
+            if (pWrite[i]) {
+                ipt_table_write(&(pIpt->tables[i]), ppPlans[i], full, pFh);
+                deployed++;
+            }
+        }
+        fclose(pFh);
+
+        if (deployed == 0) {
+            LOGDEBUG("no IPT chain changed, not running iptables-restore\n");
+            unlink(pIpt->ipt_file);
+        } else if (full) {
+            LOGDEBUG("deploying all IPT chains of the changed tables\n");
+            rc = ipt_system_apply(pIpt, FALSE);
         } else {
-            fprintf(pFh, "%s\n", psPreload);
-            EUCA_FREE(psPreload);
+            LOGDEBUG("deploying %d changed IPT chains\n", chains);
+            rc = ipt_system_apply(pIpt, TRUE);
         }
     }
 
     for (i = 0; i < pIpt->max_tables; i++) {
-        fprintf(pFh, "*%s\n", pIpt->tables[i].name);
-        for (j = 0; j < pIpt->tables[i].max_chains; j++) {
-            if (!pIpt->tables[i].chains[j].flushed && pIpt->tables[i].chains[j].ref_count) {
-                fprintf(pFh, ":%s %s %s\n", pIpt->tables[i].chains[j].name, pIpt->tables[i].chains[j].policyname, pIpt->tables[i].chains[j].counters);
+        for (j = 0; ppPlans[i] && (j < pIpt->tables[i].max_chains); j++) {
+            chain = &(pIpt->tables[i].chains[j]);
+            if (!rc && pWrite[i]) {
+                // what we just wrote is what the system has now
+                EUCA_FREE(chain->applied);
+                chain->applied = ppPlans[i][j].rules;
+                chain->applied_len = ppPlans[i][j].len;
+            } else {
+                EUCA_FREE(ppPlans[i][j].rules);
             }
         }
-        for (j = 0; j < pIpt->tables[i].max_chains; j++) {
-            if (!pIpt->tables[i].chains[j].flushed && pIpt->tables[i].chains[j].ref_count) {
-                // qsort!
-                qsort(pIpt->tables[i].chains[j].rules, pIpt->tables[i].chains[j].max_rules, sizeof(ipt_rule), ipt_ruleordercmp);
-                for (k = 0; k < pIpt->tables[i].chains[j].max_rules; k++) {
-                    if (!pIpt->tables[i].chains[j].rules[k].flushed) {
-                        fprintf(pFh, "%s %s\n", pIpt->tables[i].chains[j].rules[k].counterstr, pIpt->tables[i].chains[j].rules[k].iptrule);
-                    }
-                }
+        if (!rc && pWrite[i]) {
+            pIpt->tables[i].loaded = 1;
+        }
+        EUCA_FREE(ppPlans[i]);
+    }
+    EUCA_FREE(ppPlans);
+    EUCA_FREE(pWrite);
+    return (rc);
+}
+
+//!
+//! Writes a table for iptables-restore. A full write holds every chain to be deployed, and
+//! replaces the table. Otherwise, only the changed chains are written, for --noflush: declaring
+//! a user-defined chain flushes it, built-in chains have to be flushed explicitly, and removed
+//! chains are deleted last, once the rules jumping to them are gone.
+//!
+//! @param[in] table pointer to the IP table to write
+//! @param[in] plans what to do with each chain of the table
+//! @param[in] full set to TRUE for a full write, FALSE for a --noflush one
+//! @param[in] pFh the stream to write to
+//!
+static void ipt_table_write(ipt_table * table, ipt_chain_plan * plans, boolean full, FILE * pFh)
+{
+    int j = 0;
+    ipt_chain *chain = NULL;
+
+    fprintf(pFh, "*%s\n", table->name);
+    for (j = 0; j < table->max_chains; j++) {
+        if (plans[j].rules && (full || plans[j].changed)) {
+            fwrite(plans[j].rules, 1, plans[j].decl_len, pFh);
+        }
+    }
+    for (j = 0; !full && (j < table->max_chains); j++) {
+        chain = &(table->chains[j]);
+        if (plans[j].rules && plans[j].changed && IPT_CHAIN_BUILTIN(chain)) {
+            fprintf(pFh, "-F %s\n", chain->name);
+        }
+    }
+    for (j = 0; j < table->max_chains; j++) {
+        if (plans[j].rules && (full || plans[j].changed)) {
+            fwrite(plans[j].rules + plans[j].decl_len, 1, plans[j].len - plans[j].decl_len, pFh);
+        }
+    }
+    for (j = 0; !full && (j < table->max_chains); j++) {
+        chain = &(table->chains[j]);
+        if (!plans[j].rules && plans[j].changed) {
+            fprintf(pFh, "-F %s\n", chain->name);
+            if (!IPT_CHAIN_BUILTIN(chain)) {
+                fprintf(pFh, "-X %s\n", chain->name);
             }
         }
-        fprintf(pFh, "COMMIT\n");
     }
+    fprintf(pFh, "COMMIT\n");
+}
+
+//!
+//! Writes one chain in the iptables-save/iptables-restore format: its declaration line, then its rules
+//!
+//! @param[in] chain pointer to the IP table chain to write
+//! @param[in] pFh the stream to write to
+//! @param[in] deploy set to TRUE to write the chain as ipt_handler_deploy() does (without the flushed
+//!                   rules, in order), FALSE to write everything as it is
+//!
+static void ipt_chain_render(ipt_chain * chain, FILE * pFh, boolean deploy)
+{
+    int k = 0;
+
+    fprintf(pFh, ":%s %s %s\n", chain->name, chain->policyname, chain->counters);
+    if (deploy) {
+        // qsort!
+        qsort(chain->rules, chain->max_rules, sizeof(ipt_rule), ipt_ruleordercmp);
+        ipt_chain_reindex(chain);
+    }
+    for (k = 0; k < chain->max_rules; k++) {
+        if (!deploy || !chain->rules[k].flushed) {
+            fprintf(pFh, "%s %s\n", chain->rules[k].counterstr, chain->rules[k].iptrule);
+        }
+    }
+}
+
+//!
+//! Same as ipt_chain_render() but into a new memory buffer
+//!
+//! @param[in]  chain pointer to the IP table chain to write
+//! @param[in]  deploy see ipt_chain_render()
+//! @param[out] ppsOut the buffer holding the chain, to be freed by the caller
+//! @param[out] pLen the length of the buffer content
+//!
+//! @return 0 on success or 1 if any failure occured
+//!
+static int ipt_chain_render_mem(ipt_chain * chain, boolean deploy, char **ppsOut, size_t * pLen)
+{
+    FILE *pFh = NULL;
+
+    *ppsOut = NULL;
+    *pLen = 0;
+    if ((pFh = open_memstream(ppsOut, pLen)) == NULL) {
+        LOGERROR("could not open memory stream for IPT chain '%s'\n", chain->name);
+        return (1);
+    }
+    ipt_chain_render(chain, pFh, deploy);
     fclose(pFh);
-    return (ipt_system_restore(pIpt));
+    return (0);
 }
 
 //!
@@ -436,18 +646,7 @@ int ipt_ruleordercmp(const void *p1, const void *p2)
 int ipt_handler_repopulate(ipt_handler * ipth)
 {
     int rc = 0;
-    FILE *FH = NULL;
-    char buf[1024] = "";
-    char tmpbuf[1024] = "";
-    char *strptr = NULL;
-    char newrule[1024] = "";
-    char tablename[64] = "";
-    char chainname[64] = "";
-    char policyname[64] = "";
-    char counters[64] = "";
-    char counterstr[256] = "";
     struct timeval tv = { 0 };
-    //  long long int countersa, countersb;
 
     eucanetd_timer_usec(&tv);
     if (!ipth || !ipth->init) {
@@ -465,6 +664,40 @@ int ipt_handler_repopulate(ipt_handler * ipth)
         return (1);
     }
 
+    if ((rc = ipt_handler_load(ipth)) != 0) {
+        return (rc);
+    }
+
+    LOGINFO("ipt populated in %.2f ms.\n", eucanetd_timer_usec(&tv) / 1000.0);
+    return (0);
+}
+
+//!
+//! Parses the output of iptables-save, as stored in our IP table file, into the handler. Each
+//! chain is also kept in ipt_handler_deploy() format, for ipt_handler_deploy() to tell which
+//! chains it needs to write.
+//!
+//! @param[in] ipth pointer to the IP table handler structure
+//!
+//! @return 0 on success or 1 if any failure occured
+//!
+static int ipt_handler_load(ipt_handler * ipth)
+{
+    int i = 0;
+    int j = 0;
+    ipt_chain *chain = NULL;
+    FILE *FH = NULL;
+    char buf[1024] = "";
+    char tmpbuf[1024] = "";
+    char *strptr = NULL;
+    char newrule[1024] = "";
+    char tablename[64] = "";
+    char chainname[64] = "";
+    char policyname[64] = "";
+    char counters[64] = "";
+    char counterstr[256] = "";
+    //  long long int countersa, countersb;
+
     FH = fopen(ipth->ipt_file, "r");
     if (!FH) {
         LOGERROR("could not open file for read '%s': check permissions\n", ipth->ipt_file);
@@ -510,7 +743,16 @@ int ipt_handler_repopulate(ipt_handler * ipth)
     }
     fclose(FH);
 
-    LOGINFO("ipt populated in %.2f ms.\n", eucanetd_timer_usec(&tv) / 1000.0);
+    for (i = 0; i < ipth->max_tables; i++) {
+        for (j = 0; j < ipth->tables[i].max_chains; j++) {
+            chain = &(ipth->tables[i].chains[j]);
+            EUCA_FREE(chain->applied);
+            if (ipt_chain_render_mem(chain, FALSE, &(chain->applied), &(chain->applied_len)) != 0) {
+                return (1);
+            }
+        }
+        ipth->tables[i].loaded = 1;
+    }
     return (0);
 }
 
@@ -546,6 +788,7 @@ int ipt_handler_add_table(ipt_handler * ipth, char *tablename)
         }
         bzero(&(ipth->tables[ipth->max_tables]), sizeof(ipt_table));
         snprintf(ipth->tables[ipth->max_tables].name, 64, tablename);
+        hidx_insert(&(ipth->table_index), hidx_hash_str(ipth->tables[ipth->max_tables].name), ipth->max_tables);
         ipth->max_tables++;
     }
 
@@ -601,6 +844,7 @@ int ipt_table_add_chain(ipt_handler * ipth, char *tablename, char *chainname, ch
             !strcmp(table->chains[table->max_chains].name, "PREROUTING") || !strcmp(table->chains[table->max_chains].name, "POSTROUTING")) {
             table->chains[table->max_chains].ref_count = 1;
         }
+        hidx_insert(&(table->chain_index), hidx_hash_str(table->chains[table->max_chains].name), table->max_chains);
         chain = &(table->chains[table->max_chains]);
         table->max_chains++;
     }
@@ -708,6 +952,7 @@ int ipt_chain_insert_rule(ipt_handler * ipth, char *tablename, char *chainname,
         bzero(rule, sizeof(ipt_rule));
         snprintf(rule->iptrule, 1024, "%s", newrule);
         snprintf(rule->counterstr, 256, "[0:0]");
+        hidx_insert(&(chain->rule_index), hidx_hash_str(rule->iptrule), chain->max_rules);
         chain->max_rules++;
     }
     if (counterstr && strlen(counterstr)) {
@@ -795,23 +1040,32 @@ int ipt_handler_update_refcounts(ipt_handler * ipth)
 //!
 ipt_table *ipt_handler_find_table(ipt_handler * ipth, const char *findtable)
 {
-    int i, tableidx = 0, found = 0;
+    int tableidx = 0;
     if (!ipth || !findtable || !ipth->init) {
         return (NULL);
     }
 
-    found = 0;
-    for (i = 0; i < ipth->max_tables && !found; i++) {
-        tableidx = i;
-        if (!strcmp(ipth->tables[i].name, findtable))
-            found++;
-    }
-    if (!found) {
+    tableidx = hidx_lookup(&(ipth->table_index), hidx_hash_str(findtable), findtable, ipt_table_match, ipth->tables);
+    if (tableidx == HIDX_NONE) {
         return (NULL);
     }
     return (&(ipth->tables[tableidx]));
 }
 
+//!
+//! Tells ipt_handler_find_table() whether a table index entry is the one looked up
+//!
+//! @param[in] entry the index of the candidate in the tables array
+//! @param[in] key the name of the table looked up
+//! @param[in] ctx the tables array
+//!
+//! @return TRUE if the names match, FALSE otherwise
+//!
+static int ipt_table_match(int entry, const void *key, void *ctx)
+{
+    return (!strcmp(((ipt_table *) ctx)[entry].name, (const char *)key));
+}
+
 //!
 //! Function description.
 //!
@@ -831,7 +1085,7 @@ ipt_table *ipt_handler_find_table(ipt_handler * ipth, const char *findtable)
 //!
 ipt_chain *ipt_table_find_chain(ipt_handler * ipth, const char *tablename, const char *findchain)
 {
-    int i, found = 0, chainidx = 0;
+    int chainidx = 0;
     ipt_table *table = NULL;
 
     if (!ipth || !tablename || !findchain || !ipth->init) {
@@ -843,20 +1097,28 @@ ipt_chain *ipt_table_find_chain(ipt_handler * ipth, const char *tablename, const
         return (NULL);
     }
 
-    found = 0;
-    for (i = 0; i < table->max_chains && !found; i++) {
-        chainidx = i;
-        if (!strcmp(table->chains[i].name, findchain))
-            found++;
-    }
-
-    if (!found) {
+    chainidx = hidx_lookup(&(table->chain_index), hidx_hash_str(findchain), findchain, ipt_chain_match, table->chains);
+    if (chainidx == HIDX_NONE) {
         return (NULL);
     }
 
     return (&(table->chains[chainidx]));
 }
 
+//!
+//! Tells ipt_table_find_chain() whether a chain index entry is the one looked up
+//!
+//! @param[in] entry the index of the candidate in the chains array
+//! @param[in] key the name of the chain looked up
+//! @param[in] ctx the chains array
+//!
+//! @return TRUE if the names match, FALSE otherwise
+//!
+static int ipt_chain_match(int entry, const void *key, void *ctx)
+{
+    return (!strcmp(((ipt_chain *) ctx)[entry].name, (const char *)key));
+}
+
 //!
 //! Finds a given IPT chain in a given IPT and set its default policy.
 //!
@@ -917,7 +1179,7 @@ int ipt_table_set_chain_policy(ipt_handler * pIpth, const char *tablename, const
 //!
 ipt_rule *ipt_chain_find_rule(ipt_handler * ipth, char *tablename, char *chainname, char *findrule)
 {
-    int i, found = 0, ruleidx = 0;
+    int ruleidx = 0;
     ipt_chain *chain;
 
     if (!ipth || !tablename || !chainname || !findrule || !ipth->init) {
@@ -929,17 +1191,42 @@ ipt_rule *ipt_chain_find_rule(ipt_handler * ipth, char *tablename, char *chainna
         return (NULL);
     }
 
-    for (i = 0; i < chain->max_rules && !found; i++) {
-        ruleidx = i;
-        if (!strcmp(chain->rules[i].iptrule, findrule))
-            found++;
-    }
-    if (!found) {
+    ruleidx = hidx_lookup(&(chain->rule_index), hidx_hash_str(findrule), findrule, ipt_rule_match, chain->rules);
+    if (ruleidx == HIDX_NONE) {
         return (NULL);
     }
     return (&(chain->rules[ruleidx]));
 }
 
+//!
+//! Tells ipt_chain_find_rule() whether a rule index entry is the one looked up
+//!
+//! @param[in] entry the index of the candidate in the rules array
+//! @param[in] key the rule looked up
+//! @param[in] ctx the rules array
+//!
+//! @return TRUE if the rules match, FALSE otherwise
+//!
+static int ipt_rule_match(int entry, const void *key, void *ctx)
+{
+    return (!strcmp(((ipt_rule *) ctx)[entry].iptrule, (const char *)key));
+}
+
+//!
+//! Rebuilds the rule index of a chain once its rules moved around (e.g. were sorted)
+//!
+//! @param[in] chain pointer to the IP table chain
+//!
+static void ipt_chain_reindex(ipt_chain * chain)
+{
+    int k = 0;
+
+    hidx_clear(&(chain->rule_index));
+    for (k = 0; k < chain->max_rules; k++) {
+        hidx_insert(&(chain->rule_index), hidx_hash_str(chain->rules[k].iptrule), k);
+    }
+}
+
 //!
 //! Function description.
 //!
@@ -1090,8 +1377,8 @@ int ipt_chain_flush(ipt_handler * ipth, char *tablename, char *chainname)
 //! @note
 //!
 int ipt_chain_flush_rule(ipt_handler * ipth, char *tablename, char *chainname, char *findrule) {
-    int i, found = 0;
     ipt_chain *chain;
+    ipt_rule *rule;
 
     if (!ipth || !tablename || !chainname || !findrule || !ipth->init) {
         return (EUCA_INVALID_ERROR);
@@ -1102,16 +1389,12 @@ int ipt_chain_flush_rule(ipt_handler * ipth, char *tablename, char *chainname, c
         return (EUCA_INVALID_ERROR);
     }
 
-    for (i = 0; i < chain->max_rules && !found; i++) {
-        if (!strcmp(chain->rules[i].iptrule, findrule)) {
-            found++;
-            chain->rules[i].flushed = 1;
-            chain->rules[i].order = 0;
-        }
-    }
-    if (!found) {
+    rule = ipt_chain_find_rule(ipth, tablename, chainname, findrule);
+    if (!rule) {
         return (EUCA_NOT_FOUND_ERROR);
     }
+    rule->flushed = 1;
+    rule->order = 0;
     return (EUCA_OK);
 }
 
@@ -1133,7 +1416,6 @@ int ipt_chain_flush_rule(ipt_handler * ipth, char *tablename, char *chainname, c
 int ipt_handler_free(ipt_handler * ipth)
 {
     int i = 0;
-    int j = 0;
     char saved_cmdprefix[EUCA_MAX_PATH] = "";
     char saved_preloadPath[EUCA_MAX_PATH] = "";
 
@@ -1144,17 +1426,35 @@ int ipt_handler_free(ipt_handler * ipth)
     snprintf(saved_preloadPath, EUCA_MAX_PATH, "%s", ipth->preloadPath);
 
     for (i = 0; i < ipth->max_tables; i++) {
-        for (j = 0; j < ipth->tables[i].max_chains; j++) {
-            EUCA_FREE(ipth->tables[i].chains[j].rules);
-        }
-        EUCA_FREE(ipth->tables[i].chains);
+        ipt_table_free(&(ipth->tables[i]));
     }
     EUCA_FREE(ipth->tables);
+    hidx_free(&(ipth->table_index));
     unlink(ipth->ipt_file);
 
     return (ipt_handler_init(ipth, saved_cmdprefix, saved_preloadPath));
 }
 
+//!
+//! Releases the chains and rules of a table, along with their indexes and applied content
+//!
+//! @param[in] table pointer to the IP table to release
+//!
+static void ipt_table_free(ipt_table * table)
+{
+    int j = 0;
+
+    for (j = 0; j < table->max_chains; j++) {
+        EUCA_FREE(table->chains[j].rules);
+        EUCA_FREE(table->chains[j].applied);
+        hidx_free(&(table->chains[j].rule_index));
+    }
+    EUCA_FREE(table->chains);
+    hidx_free(&(table->chain_index));
+    table->max_chains = 0;
+    table->loaded = 0;
+}
+
 //!
 //! Release all resources associated with the given ipt_handler.
 //!
@@ -1173,7 +1473,6 @@ int ipt_handler_free(ipt_handler * ipth)
 int ipt_handler_close(ipt_handler *ipth)
 {
     int i = 0;
-    int j = 0;
 
     if (!ipth || !ipth->init) {
         LOGDEBUG("Invalid argument. NULL or uninitialized ipt_handler.\n");
@@ -1181,12 +1480,10 @@ int ipt_handler_close(ipt_handler *ipth)
     }
 
     for (i = 0; i < ipth->max_tables; i++) {
-        for (j = 0; j < ipth->tables[i].max_chains; j++) {
-            EUCA_FREE(ipth->tables[i].chains[j].rules);
-        }
-        EUCA_FREE(ipth->tables[i].chains);
+        ipt_table_free(&(ipth->tables[i]));
     }
     EUCA_FREE(ipth->tables);
+    hidx_free(&(ipth->table_index));
     unlink(ipth->ipt_file);
     return (0);
 }
@@ -1233,3 +1530,294 @@ int ipt_handler_print(ipt_handler * ipth)
     return (0);
 }
 
+
+#ifdef _UNIT_TEST
+#include <sys/time.h>
+
+//! Defined by eucanetd.c in the daemon, referenced by the other objects of libeucanet
+eucanetdConfig *config = NULL;
+
+#define TEST_RULES_PER_CHAIN                     100    //!< rules per security group chain in the generated rulesets
+
+static char test_restore_input[EUCA_MAX_PATH] = "";
+
+//!
+//! Returns the wall clock in microseconds
+//!
+static long long test_usec(void)
+{
+    struct timeval tv = { 0 };
+
+    gettimeofday(&tv, NULL);
+    return (((long long)tv.tv_sec * 1000000LL) + tv.tv_usec);
+}
+
+//!
+//! Writes what iptables-save would print for an EDGE node with 'rules' security group rules
+//! spread over chains of TEST_RULES_PER_CHAIN rules each
+//!
+static int test_write_save(const char *path, int rules)
+{
+    int i = 0;
+    int chains = (rules + TEST_RULES_PER_CHAIN - 1) / TEST_RULES_PER_CHAIN;
+    FILE *pFh = NULL;
+
+    if ((pFh = fopen(path, "w")) == NULL)
+        return (1);
+    fprintf(pFh, "# Generated by iptables-save\n*nat\n:PREROUTING ACCEPT [0:0]\n:POSTROUTING ACCEPT [0:0]\n:OUTPUT ACCEPT [0:0]\n");
+    fprintf(pFh, "[0:0] -A POSTROUTING -s 172.16.0.0/16 -j MASQUERADE\nCOMMIT\n");
+    fprintf(pFh, "*filter\n:INPUT ACCEPT [0:0]\n:FORWARD ACCEPT [0:0]\n:OUTPUT ACCEPT [0:0]\n:EUCA_FILTER_FWD - [0:0]\n");
+    for (i = 0; i < chains; i++)
+        fprintf(pFh, ":EU_sg%05d - [0:0]\n", i);
+    fprintf(pFh, "[12:3456] -A FORWARD -j EUCA_FILTER_FWD\n");
+    for (i = 0; i < chains; i++)
+        fprintf(pFh, "[0:0] -A EUCA_FILTER_FWD -m set --match-set EU_sg%05d dst -j EU_sg%05d\n", i, i);
+    for (i = 0; i < rules; i++)
+        fprintf(pFh, "[%d:%d] -A EU_sg%05d -s 10.%d.%d.0/24 -p tcp -m tcp --dport %d -j ACCEPT\n", i % 7, i % 11, i / TEST_RULES_PER_CHAIN,
+                (i >> 8) & 0xff, i & 0xff, 1024 + (i % 20000));
+    fprintf(pFh, "COMMIT\n");
+    fclose(pFh);
+    return (0);
+}
+
+//!
+//! Deploys and reports how many bytes reached iptables-restore, -1 if it did not run
+//!
+static long test_deploy(ipt_handler * ipth, long long *pUsec)
+{
+    long long t0 = 0;
+    struct stat st = { 0 };
+
+    unlink(test_restore_input);
+    t0 = test_usec();
+    if (ipt_handler_deploy(ipth) != 0)
+        return (-2);
+    if (pUsec)
+        *pUsec = test_usec() - t0;
+    if (stat(test_restore_input, &st) != 0)
+        return (-1);
+    return ((long)st.st_size);
+}
+
+//!
+//! Sets up a handler whose iptables-restore copies its arguments, then its input, to test_restore_input, loaded
+//! with a generated ruleset of 'rules' rules
+//!
+static int test_setup(ipt_handler * ipth, const char *fakebin, int rules, long long *pUsec)
+{
+    long long t0 = 0;
+
+    bzero(ipth, sizeof(ipt_handler));
+    if (ipt_handler_init(ipth, fakebin, NULL) || test_write_save(ipth->ipt_file, rules))
+        return (1);
+    t0 = test_usec();
+    if (ipt_handler_load(ipth))
+        return (1);
+    if (pUsec)
+        *pUsec = test_usec() - t0;
+    return (0);
+}
+
+//!
+//! Builds models of 'rules' rules (or set members) in a single chain (or set), the way eucanetd
+//! adds them, and reports how long each handler took
+//!
+static int test_build(const char *fakebin, int rules)
+{
+    int i = 0;
+    int errors = 0;
+    char rule[1024] = "";
+    char ip[32] = "";
+    long long t0 = 0;
+    long long tipt = 0;
+    long long tips = 0;
+    long long tebt = 0;
+    ipt_handler ipth = { 0 };
+    ips_handler ipsh = { 0 };
+    ebt_handler ebth = { 0 };
+
+    if (ipt_handler_init(&ipth, fakebin, NULL) || ips_handler_init(&ipsh, fakebin) || ebt_handler_init(&ebth, fakebin)) {
+        printf("FAIL: could not set up the handlers\n");
+        return (1);
+    }
+
+    t0 = test_usec();
+    ipt_handler_add_table(&ipth, "filter");
+    ipt_table_add_chain(&ipth, "filter", "FORWARD", "ACCEPT", "[0:0]");
+    ipt_table_add_chain(&ipth, "filter", "EU_sg00000", "-", "[0:0]");
+    ipt_chain_add_rule(&ipth, "filter", "FORWARD", "-A FORWARD -j EU_sg00000");
+    for (i = 0; i < rules; i++) {
+        snprintf(rule, sizeof(rule), "-A EU_sg00000 -s 10.%d.%d.0/24 -p tcp -m tcp --dport %d -j ACCEPT", (i >> 8) & 0xff, i & 0xff, 1024 + (i % 20000));
+        ipt_chain_add_rule(&ipth, "filter", "EU_sg00000", rule);
+    }
+    ipt_handler_update_refcounts(&ipth);
+    tipt = test_usec() - t0;
+    errors += (ipt_table_find_chain(&ipth, "filter", "EU_sg00000")->max_rules != rules);
+
+    t0 = test_usec();
+    ips_handler_add_set(&ipsh, "EU_sg00000");
+    for (i = 0; i < rules; i++) {
+        snprintf(ip, sizeof(ip), "10.%d.%d.%d", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+        ips_set_add_ip(&ipsh, "EU_sg00000", ip);
+    }
+    tips = test_usec() - t0;
+    errors += (ips_handler_find_set(&ipsh, "EU_sg00000")->max_member_ips != rules);
+
+    t0 = test_usec();
+    ebt_handler_add_table(&ebth, "filter");
+    ebt_table_add_chain(&ebth, "filter", "EUCA_EBT_FWD", "ACCEPT", "");
+    for (i = 0; i < rules; i++) {
+        snprintf(rule, sizeof(rule), "-p IPv4 -i vn_i-%08x --ip-src 10.%d.%d.%d -j ACCEPT", i, (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+        ebt_chain_add_rule(&ebth, "filter", "EUCA_EBT_FWD", rule);
+    }
+    tebt = test_usec() - t0;
+    errors += (ebt_table_find_chain(&ebth, "filter", "EUCA_EBT_FWD")->max_rules != rules);
+
+    printf("%8d %14.2f %14.2f %14.2f\n", rules, tipt / 1000.0, tips / 1000.0, tebt / 1000.0);
+    ipt_handler_close(&ipth);
+    ips_handler_close(&ipsh);
+    ebt_handler_close(&ebth);
+    return (errors);
+}
+
+//!
+//! Unit test: unchanged models must not run iptables-restore, changed ones must only hand it
+//! the changed chains, with --noflush. With 'bench-deploy [rules]', compares the cost of writing
+//! every table with that of writing the changed chains, for 10k and 50k rules by default. With
+//! 'bench-build [rules]', times building models of 20k rules by default.
+//!
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int errors = 0;
+    int sizes[] = { 10000, 50000 };
+    int sizesLen = sizeof(sizes) / sizeof(sizes[0]);
+    long bytes = 0;
+    long long tload = 0;
+    long long tfull = 0;
+    long long tsame = 0;
+    long long tone = 0;
+    long fullBytes = 0;
+    long oneBytes = 0;
+    char fakebin[EUCA_MAX_PATH] = "/tmp/ipt-fakebin-XXXXXX";
+    char *psInput = NULL;
+    char *psDel = NULL;
+    FILE *pFh = NULL;
+    ipt_rule *rule = NULL;
+    ipt_handler ipth = { 0 };
+
+    log_params_set(EUCA_LOG_WARN, 0, 100000);
+
+    // stands in for the command prefix: records what iptables-restore would have been given
+    snprintf(test_restore_input, sizeof(test_restore_input), "/tmp/ipt-restore-input-%d", getpid());
+    if ((i = safe_mkstemp(fakebin)) < 0)
+        return (1);
+    close(i);
+    if ((pFh = fopen(fakebin, "w")) == NULL)
+        return (1);
+    fprintf(pFh, "#!/bin/sh\nif [ \"$1\" = iptables-restore ]; then echo \"# $*\" > %s; cat >> %s; fi\nexit 0\n", test_restore_input, test_restore_input);
+    fclose(pFh);
+    chmod(fakebin, 0700);
+
+    if ((argc > 1) && !strcmp(argv[1], "bench-build")) {
+        printf("%8s %14s %14s %14s\n", "rules", "ipt (ms)", "ips (ms)", "ebt (ms)");
+        errors += test_build(fakebin, ((argc > 2) ? atoi(argv[2]) : 20000));
+    } else if ((argc > 1) && !strcmp(argv[1], "bench-deploy")) {
+        if (argc > 2) {
+            sizes[0] = atoi(argv[2]);
+            sizesLen = 1;
+        }
+        printf("%8s %10s %14s %14s %14s %16s %16s\n", "rules", "load (ms)", "all (ms)", "same (ms)", "one (ms)", "all (bytes)", "one (bytes)");
+        for (i = 0; i < sizesLen; i++) {
+            if (test_setup(&ipth, fakebin, sizes[i], &tload)) {
+                printf("FAIL: could not set up %d rules\n", sizes[i]);
+                errors++;
+                break;
+            }
+            // forget what the system holds: everything gets written, as before
+            for (j = 0; j < ipth.max_tables; j++) {
+                ipth.tables[j].loaded = 0;
+                for (k = 0; k < ipth.tables[j].max_chains; k++)
+                    EUCA_FREE(ipth.tables[j].chains[k].applied);
+            }
+            fullBytes = test_deploy(&ipth, &tfull);
+            bytes = test_deploy(&ipth, &tsame);
+            errors += (bytes != -1);
+            ipt_chain_add_rule(&ipth, "filter", "EU_sg00000", "-A EU_sg00000 -s 192.168.0.0/16 -j ACCEPT");
+            oneBytes = test_deploy(&ipth, &tone);
+            printf("%8d %10.2f %14.2f %14.2f %14.2f %16ld %16ld\n", sizes[i], tload / 1000.0, tfull / 1000.0, tsame / 1000.0, tone / 1000.0, fullBytes, oneBytes);
+            ipt_handler_close(&ipth);
+        }
+    } else {
+        if (test_setup(&ipth, fakebin, 500, NULL)) {
+            printf("FAIL: could not set up the handler\n");
+            errors++;
+        } else {
+            if ((bytes = test_deploy(&ipth, NULL)) != -1) {
+                printf("FAIL: unchanged tables handed to iptables-restore (%ld bytes)\n", bytes);
+                errors++;
+            }
+            ipt_chain_add_rule(&ipth, "filter", "EU_sg00001", "-A EU_sg00001 -s 192.168.0.0/16 -j ACCEPT");
+            if ((bytes = test_deploy(&ipth, NULL)) <= 0) {
+                printf("FAIL: changed table not deployed\n");
+                errors++;
+            } else if ((psInput = file2str(test_restore_input)) != NULL) {
+                if (!strstr(psInput, "--noflush") || !strstr(psInput, "*filter\n") || strstr(psInput, "*nat\n") || !strstr(psInput, ":EU_sg00001 - ")
+                    || !strstr(psInput, "-A EU_sg00001 -s 192.168.0.0/16 -j ACCEPT\n") || strstr(psInput, "EU_sg00000") || strstr(psInput, "EUCA_FILTER_FWD")) {
+                    printf("FAIL: wrong chains handed to iptables-restore\n");
+                    errors++;
+                }
+                EUCA_FREE(psInput);
+            }
+            if ((bytes = test_deploy(&ipth, NULL)) != -1) {
+                printf("FAIL: deployed table not remembered as applied\n");
+                errors++;
+            }
+            // deploying sorted the rules, the index must have followed them
+            if (!(rule = ipt_chain_find_rule(&ipth, "filter", "EU_sg00001", "-A EU_sg00001 -s 192.168.0.0/16 -j ACCEPT"))
+                || strcmp(rule->iptrule, "-A EU_sg00001 -s 192.168.0.0/16 -j ACCEPT") || (rule->order == INT_MAX)) {
+                printf("FAIL: rule index out of date after a deploy\n");
+                errors++;
+            }
+            ipt_chain_flush(&ipth, "filter", "EU_sg00002");
+            if ((bytes = test_deploy(&ipth, NULL)) <= 0) {
+                printf("FAIL: flush of a chain not deployed\n");
+                errors++;
+            } else if ((psInput = file2str(test_restore_input)) != NULL) {
+                if (!strstr(psInput, ":EU_sg00002 - ") || strstr(psInput, "-A EU_sg00002 ")) {
+                    printf("FAIL: flushed chain not emptied\n");
+                    errors++;
+                }
+                EUCA_FREE(psInput);
+            }
+            // a removed chain is deleted once nothing jumps to it anymore
+            ipt_table_deletechainmatch(&ipth, "filter", "EU_sg00003");
+            ipt_chain_flush_rule(&ipth, "filter", "EUCA_FILTER_FWD", "-A EUCA_FILTER_FWD -m set --match-set EU_sg00003 dst -j EU_sg00003");
+            if ((bytes = test_deploy(&ipth, NULL)) <= 0) {
+                printf("FAIL: removal of a chain not deployed\n");
+                errors++;
+            } else if ((psInput = file2str(test_restore_input)) != NULL) {
+                psDel = strstr(psInput, "-X EU_sg00003\n");
+                if (!psDel || !strstr(psInput, ":EUCA_FILTER_FWD - ") || (strstr(psInput, "-A EUCA_FILTER_FWD ") > psDel) || strstr(psInput, "-j EU_sg00003")
+                    || strstr(psInput, ":FORWARD ")) {
+                    printf("FAIL: wrong removal handed to iptables-restore\n");
+                    errors++;
+                }
+                EUCA_FREE(psInput);
+            }
+            if ((bytes = test_deploy(&ipth, NULL)) != -1) {
+                printf("FAIL: removed chain not remembered as gone\n");
+                errors++;
+            }
+            ipt_handler_close(&ipth);
+        }
+        printf("correctness: %s\n", errors ? "FAILED" : "ok");
+    }
+
+    unlink(test_restore_input);
+    unlink(fakebin);
+    return (errors ? 1 : 0);
+}
+#endif /* _UNIT_TEST */
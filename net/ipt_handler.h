@@ -80,6 +80,8 @@
 #include <unistd.h>
 #include <errno.h>
 
+#include "handler_index.h"
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -153,17 +155,23 @@ typedef struct ipt_chain_t {
     int ruleorder;
     int ref_count;
     int flushed;
+    handler_index rule_index;          //!< rules by iptrule
+    char *applied;                     //!< the chain as the system has it, as ipt_handler_deploy() would write it (NULL if absent)
+    size_t applied_len;                //!< length of applied
 } ipt_chain;
 
 typedef struct ipt_table_t {
     char name[64];
     ipt_chain *chains;
     int max_chains;
+    handler_index chain_index;         //!< chains by name
+    int loaded;                        //!< set once the applied content of the chains is known (see ipt_handler_deploy())
 } ipt_table;
 
 typedef struct ipt_handler_t {
     ipt_table *tables;
     int max_tables;
+    handler_index table_index;         //!< tables by name
     int init;
     char ipt_file[EUCA_MAX_PATH];
     char cmdprefix[EUCA_MAX_PATH];
@@ -275,6 +275,34 @@ int ncStubDestroy(ncStub * pStub)
     return (EUCA_OK);
 }
 
+//!
+//! Sets the transport timeout used by all subsequent requests made through
+//! this stub. Persistent stubs are reused across calls, so the timeout has
+//! to be (re)applied before every invocation.
+//!
+//! @param[in] pStub a pointer to the node controller (NC) stub structure
+//! @param[in] timeout the timeout in seconds (0 leaves the Axis2 default in place)
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int ncStubSetTimeout(ncStub * pStub, int timeout)
+{
+    axis2_options_t *options = NULL;
+
+    if ((pStub == NULL) || (pStub->stub == NULL))
+        return (EUCA_ERROR);
+
+    if (timeout <= 0)
+        return (EUCA_OK);
+
+    if ((options = axis2_stub_get_options(pStub->stub, pStub->env)) == NULL)
+        return (EUCA_ERROR);
+
+    if (axis2_options_set_timeout_in_milli_seconds(options, pStub->env, ((long)timeout) * 1000L) != AXIS2_SUCCESS)
+        return (EUCA_ERROR);
+    return (EUCA_OK);
+}
+
 //!
 //! Marshals the Run instance request
 //!
@@ -411,6 +439,172 @@ int ncRunInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char *inst
     return (status);
 }
 
+//!
+//! Marshals the batched run instance request, which starts several instances
+//! that share everything but their identity and primary network interface
+//! with a single round trip to the node.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  uuids the unique identifier of each instance to run
+//! @param[in]  instanceIds the identifier of each instance to run (i-XXXXXXXX)
+//! @param[in]  netparams the primary network interface of each instance to run
+//! @param[in]  instancesLen the number of entries in the uuids, instanceIds and netparams lists
+//! @param[in]  reservationId the reservation identifier string
+//! @param[in]  params a pointer to the virtual machine parameters to use
+//! @param[in]  imageId the image identifier string
+//! @param[in]  imageURL the image URL address tring
+//! @param[in]  kernelId the kernel image identifier (eki-XXXXXXXX)
+//! @param[in]  kernelURL the kernel image URL address
+//! @param[in]  ramdiskId the ramdisk image identifier (eri-XXXXXXXX)
+//! @param[in]  ramdiskURL the ramdisk image URL address
+//! @param[in]  ownerId the owner identifier string
+//! @param[in]  accountId the account identifier string
+//! @param[in]  keyName the key name string
+//! @param[in]  userData the user data string
+//! @param[in]  credential the credential string
+//! @param[in]  launchIndex the launch index string
+//! @param[in]  platform the platform name string
+//! @param[in]  expiryTime the reservation expiration time
+//! @param[in]  groupNames a list of group name string
+//! @param[in]  groupNamesSize the number of group name in the groupNames list
+//! @param[in]  rootDirective the root directive string
+//! @param[in]  groupIds a list of group identifier string
+//! @param[in]  groupIdsSize the number of group identifiers in the groupIds list
+//! @param[in]  secNetCfgs a list of secondary network interfaces
+//! @param[in]  secNetCfgsLen the number of network interfaces in the secNetCfgs list
+//! @param[out] outInsts the list of instances that were started, which may be fewer than requested
+//! @param[out] outInstsLen the number of instances in the outInsts list
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int ncRunInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **uuids, char **instanceIds, netConfig * netparams, int instancesLen, char *reservationId,
+                       virtualMachine * params, char *imageId, char *imageURL, char *kernelId, char *kernelURL, char *ramdiskId, char *ramdiskURL, char *ownerId,
+                       char *accountId, char *keyName, char *userData, char *credential, char *launchIndex, char *platform, int expiryTime, char **groupNames,
+                       int groupNamesSize, char *rootDirective, char **groupIds, int groupIdsSize, netConfig * secNetCfgs, int secNetCfgsLen, ncInstance *** outInsts,
+                       int *outInstsLen)
+{
+    int i = 0;
+    int status = 0;
+    axutil_env_t *env = pStub->env;
+    axis2_stub_t *stub = pStub->stub;
+    char *correlation_id = NULL;
+    adb_ncRunInstances_t *input = adb_ncRunInstances_create(env);
+    adb_ncRunInstancesType_t *request = adb_ncRunInstancesType_create(env);
+    axutil_date_time_t *dt = NULL;
+    adb_ncRunInstancesResponse_t *output = NULL;
+    adb_ncRunInstancesResponseType_t *response = NULL;
+    adb_runInstancesEntryType_t *entry = NULL;
+    adb_netConfigType_t *netConfig = NULL;
+    adb_instanceType_t *instance = NULL;
+
+    *outInsts = NULL;
+    *outInstsLen = 0;
+
+    // set standard input fields
+    adb_ncRunInstancesType_set_nodeName(request, env, pStub->node_name);
+    if (pMeta) {
+        correlation_id = create_corrid(pMeta->correlationId);
+        EUCA_MESSAGE_MARSHAL(ncRunInstancesType, request, pMeta);
+        EUCA_FREE(pMeta->correlationId);
+    }
+    if (correlation_id != NULL) {
+        adb_ncRunInstancesType_set_correlationId(request, env, correlation_id);
+    }
+    // set op-specific input fields
+    adb_ncRunInstancesType_set_reservationId(request, env, reservationId);
+    adb_ncRunInstancesType_set_instanceType(request, env, copy_vm_type_to_adb(env, params));
+
+    adb_ncRunInstancesType_set_imageId(request, env, imageId);
+    adb_ncRunInstancesType_set_imageURL(request, env, imageURL);
+    adb_ncRunInstancesType_set_kernelId(request, env, kernelId);
+    adb_ncRunInstancesType_set_kernelURL(request, env, kernelURL);
+    adb_ncRunInstancesType_set_ramdiskId(request, env, ramdiskId);
+    adb_ncRunInstancesType_set_ramdiskURL(request, env, ramdiskURL);
+    adb_ncRunInstancesType_set_ownerId(request, env, ownerId);
+    adb_ncRunInstancesType_set_accountId(request, env, accountId);
+    adb_ncRunInstancesType_set_keyName(request, env, keyName);
+    adb_ncRunInstancesType_set_userData(request, env, userData);
+    adb_ncRunInstancesType_set_credential(request, env, credential);
+    adb_ncRunInstancesType_set_launchIndex(request, env, launchIndex);
+    adb_ncRunInstancesType_set_platform(request, env, platform);
+
+    dt = axutil_date_time_create_with_offset(env, expiryTime);
+    adb_ncRunInstancesType_set_expiryTime(request, env, dt);
+
+    for (i = 0; i < groupNamesSize; i++) {
+        adb_ncRunInstancesType_add_groupNames(request, env, groupNames[i]);
+    }
+    adb_ncRunInstancesType_set_rootDirective(request, env, rootDirective);
+
+    for (i = 0; i < groupIdsSize; i++) {
+        adb_ncRunInstancesType_add_groupIds(request, env, groupIds[i]);
+    }
+
+    for (i = 0; i < secNetCfgsLen; i++) { // non-vpc
+        netConfig = adb_netConfigType_create(env);
+        adb_netConfigType_set_interfaceId(netConfig, env, secNetCfgs[i].interfaceId);
+        adb_netConfigType_set_device(netConfig, env, secNetCfgs[i].device);
+        adb_netConfigType_set_privateMacAddress(netConfig, env, secNetCfgs[i].privateMac);
+        adb_netConfigType_set_privateIp(netConfig, env, secNetCfgs[i].privateIp);
+        adb_netConfigType_set_publicIp(netConfig, env, secNetCfgs[i].publicIp);
+        adb_netConfigType_set_vlan(netConfig, env, secNetCfgs[i].vlan);
+        adb_netConfigType_set_networkIndex(netConfig, env, secNetCfgs[i].networkIndex);
+        adb_netConfigType_set_attachmentId(netConfig, env, secNetCfgs[i].attachmentId);
+        adb_ncRunInstancesType_add_secondaryNetConfig(request, env, netConfig);
+    }
+
+    for (i = 0; i < instancesLen; i++) {
+        netConfig = adb_netConfigType_create(env);
+        adb_netConfigType_set_interfaceId(netConfig, env, netparams[i].interfaceId);
+        adb_netConfigType_set_device(netConfig, env, netparams[i].device);
+        adb_netConfigType_set_privateMacAddress(netConfig, env, netparams[i].privateMac);
+        adb_netConfigType_set_privateIp(netConfig, env, netparams[i].privateIp);
+        adb_netConfigType_set_publicIp(netConfig, env, netparams[i].publicIp);
+        adb_netConfigType_set_vlan(netConfig, env, netparams[i].vlan);
+        adb_netConfigType_set_networkIndex(netConfig, env, netparams[i].networkIndex);
+        if (strlen(netparams[i].attachmentId)) // vpc
+            adb_netConfigType_set_attachmentId(netConfig, env, netparams[i].attachmentId);
+        else // non-vpc
+            adb_netConfigType_reset_attachmentId(netConfig, env);
+
+        entry = adb_runInstancesEntryType_create(env);
+        adb_runInstancesEntryType_set_uuid(entry, env, uuids[i]);
+        adb_runInstancesEntryType_set_instanceId(entry, env, instanceIds[i]);
+        adb_runInstancesEntryType_set_netParams(entry, env, netConfig);
+        adb_ncRunInstancesType_add_instances(request, env, entry);
+    }
+
+    adb_ncRunInstances_set_ncRunInstances(input, env, request);
+
+    // do it
+    if ((output = axis2_stub_op_EucalyptusNC_ncRunInstances(stub, env, input)) == NULL) {
+        LOGERROR(NULL_ERROR_MSG);
+        status = -1;
+    } else {
+        response = adb_ncRunInstancesResponse_get_ncRunInstancesResponse(output, env);
+        if (adb_ncRunInstancesResponseType_get_return(response, env) == AXIS2_FALSE) {
+            LOGERROR("[%s] returned an error\n", reservationId);
+            status = 1;
+        }
+
+        if ((*outInstsLen = adb_ncRunInstancesResponseType_sizeof_instances(response, env)) != 0) {
+            if ((*outInsts = EUCA_ZALLOC(*outInstsLen, sizeof(ncInstance *))) == NULL) {
+                LOGERROR("out of memory\n");
+                *outInstsLen = 0;
+                status = 2;
+            } else {
+                for (i = 0; i < *outInstsLen; i++) {
+                    instance = adb_ncRunInstancesResponseType_get_instances_at(response, env, i);
+                    (*outInsts)[i] = copy_instance_from_adb(instance, env);
+                }
+            }
+        }
+    }
+
+    return (status);
+}
+
 //!
 //! Marshals the get console output request.
 //!
@@ -661,6 +855,108 @@ int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds,
     return (status);
 }
 
+//!
+//! Marshals the client delta describe instance request: asks the NC for the instances that
+//! changed since the generation it returned to a previous request.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  sinceGeneration the generation returned by the previous request, or 0 for the full list
+//! @param[out] outInsts a pointer the list of instances for which we have data
+//! @param[out] outInstsLen the number of instances in the outInsts list.
+//! @param[out] outGeneration the generation to pass along with the next request (0 if the NC does not support deltas)
+//! @param[out] outDelta set to TRUE if outInsts only holds the instances that changed since sinceGeneration
+//! @param[out] outLiveIds the identifiers of all instances on the NC, when outDelta is TRUE
+//! @param[out] outLiveIdsLen the number of identifiers in the outLiveIds list.
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int ncDescribeInstancesSinceStub(ncStub * pStub, ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen,
+                                 long long *outGeneration, boolean * outDelta, char ***outLiveIds, int *outLiveIdsLen)
+{
+    int i = 0;
+    int status = 0;
+    axutil_env_t *env = NULL;
+    axis2_stub_t *stub = NULL;
+    adb_instanceType_t *instance = NULL;
+    adb_ncDescribeInstances_t *input = NULL;
+    adb_ncDescribeInstancesType_t *request = NULL;
+    adb_ncDescribeInstancesResponse_t *output = NULL;
+    adb_ncDescribeInstancesResponseType_t *response = NULL;
+    char *correlation_id = NULL;
+
+    *outGeneration = 0;
+    *outDelta = FALSE;
+    *outLiveIds = NULL;
+    *outLiveIdsLen = 0;
+
+    env = pStub->env;
+    stub = pStub->stub;
+    input = adb_ncDescribeInstances_create(env);
+    request = adb_ncDescribeInstancesType_create(env);
+
+    /* set input fields */
+    adb_ncDescribeInstancesType_set_nodeName(request, env, pStub->node_name);
+    if (pMeta) {
+        correlation_id = create_corrid(pMeta->correlationId);
+        EUCA_FREE(pMeta->correlationId);
+        EUCA_MESSAGE_MARSHAL(ncDescribeInstancesType, request, pMeta);
+    }
+    if (correlation_id != NULL)
+        adb_ncDescribeInstancesType_set_correlationId(request, env, correlation_id);
+
+    if (sinceGeneration > 0)
+        adb_ncDescribeInstancesType_set_sinceGeneration(request, env, (int64_t) sinceGeneration);
+    adb_ncDescribeInstances_set_ncDescribeInstances(input, env, request);
+
+    if ((output = axis2_stub_op_EucalyptusNC_ncDescribeInstances(stub, env, input)) == NULL) {
+        LOGERROR(NULL_ERROR_MSG);
+        status = -1;
+    } else {
+        response = adb_ncDescribeInstancesResponse_get_ncDescribeInstancesResponse(output, env);
+        if (adb_ncDescribeInstancesResponseType_get_return(response, env) == AXIS2_FALSE) {
+            LOGERROR("returned an error\n");
+            status = 1;
+        }
+
+        if ((*outInstsLen = adb_ncDescribeInstancesResponseType_sizeof_instances(response, env)) != 0) {
+            if ((*outInsts = EUCA_ZALLOC(*outInstsLen, sizeof(ncInstance *))) == NULL) {
+                LOGERROR("out of memory\n");
+                *outInstsLen = 0;
+                status = 2;
+            } else {
+                for (i = 0; i < *outInstsLen; i++) {
+                    instance = adb_ncDescribeInstancesResponseType_get_instances_at(response, env, i);
+                    (*outInsts)[i] = copy_instance_from_adb(instance, env);
+                }
+            }
+        }
+
+        // older NCs leave these out, which reads as generation 0 and a full list
+        if (status == 0) {
+            *outGeneration = (long long)adb_ncDescribeInstancesResponseType_get_generation(response, env);
+            if (*outGeneration && (adb_ncDescribeInstancesResponseType_get_delta(response, env) == AXIS2_TRUE)) {
+                if ((*outLiveIdsLen = adb_ncDescribeInstancesResponseType_sizeof_liveInstanceIds(response, env)) != 0) {
+                    if ((*outLiveIds = EUCA_ZALLOC(*outLiveIdsLen, sizeof(char *))) == NULL) {
+                        LOGERROR("out of memory\n");
+                        *outLiveIdsLen = 0;
+                        *outGeneration = 0;
+                        status = 2;
+                    } else {
+                        for (i = 0; i < *outLiveIdsLen; i++) {
+                            (*outLiveIds)[i] = strdup(adb_ncDescribeInstancesResponseType_get_liveInstanceIds_at(response, env, i));
+                        }
+                    }
+                }
+                if (status == 0)
+                    *outDelta = TRUE;
+            }
+        }
+    }
+
+    return (status);
+}
+
 //!
 //! Handle the client describe resource request
 //!
@@ -673,7 +969,9 @@ int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds,
 //!
 int ncDescribeResourceStub(ncStub * pStub, ncMetadata * pMeta, char *resourceType, ncResource ** outRes)
 {
+    int i = 0;
     int status = 0;
+    char *image = NULL;
     ncResource *res = NULL;
     axutil_env_t *env = NULL;
     axis2_stub_t *stub = NULL;
@@ -728,6 +1026,12 @@ int ncDescribeResourceStub(ncStub * pStub, ncMetadata * pMeta, char *resourceTyp
         if (!res) {
             LOGERROR("out of memory\n");
             status = 2;
+        } else {
+            // older NCs do not report their cache contents, leaving the list empty
+            for (i = 0; (i < adb_ncDescribeResourceResponseType_sizeof_cachedImages(response, env)) && (res->cachedImagesLen < EUCA_MAX_CACHED_IMAGES); i++) {
+                if ((image = (char *)adb_ncDescribeResourceResponseType_get_cachedImages_at(response, env, i)) != NULL)
+                    euca_strncpy(res->cachedImages[res->cachedImagesLen++], image, IMAGE_ID_LEN);
+            }
         }
         *outRes = res;
     }
@@ -1673,6 +1977,63 @@ int ncModifyNodeStub(ncStub * pStub, ncMetadata * pMeta, char *stateName)
     return (status);
 }
 
+//!
+//! Marshals the image prefetch request.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  params a pointer to the virtual machine whose VBR names the images to prefetch
+//!
+//! @return 0 for success, non-zero for error
+//!
+//! @see ncPrefetchImages()
+//!
+int ncPrefetchImagesStub(ncStub * pStub, ncMetadata * pMeta, virtualMachine * params)
+{
+    int status = 0;
+    axutil_env_t *env = NULL;
+    axis2_stub_t *stub = NULL;
+    adb_ncPrefetchImages_t *input = NULL;
+    adb_ncPrefetchImagesType_t *request = NULL;
+    adb_ncPrefetchImagesResponse_t *output = NULL;
+    adb_ncPrefetchImagesResponseType_t *response = NULL;
+    char *correlation_id = NULL;
+
+    env = pStub->env;
+    stub = pStub->stub;
+    input = adb_ncPrefetchImages_create(env);
+    request = adb_ncPrefetchImagesType_create(env);
+
+    // set standard input fields
+    adb_ncPrefetchImagesType_set_nodeName(request, env, pStub->node_name);
+    if (pMeta) {
+        correlation_id = create_corrid(pMeta->correlationId);
+        EUCA_FREE(pMeta->correlationId);
+        EUCA_MESSAGE_MARSHAL(ncPrefetchImagesType, request, pMeta);
+    }
+    if (correlation_id != NULL)
+        adb_ncPrefetchImagesType_set_correlationId(request, env, correlation_id);
+
+    // set op-specific input fields
+    adb_ncPrefetchImagesType_set_instanceType(request, env, copy_vm_type_to_adb(env, params));
+    adb_ncPrefetchImages_set_ncPrefetchImages(input, env, request);
+
+    // do it
+    if ((output = axis2_stub_op_EucalyptusNC_ncPrefetchImages(stub, env, input)) == NULL) {
+        LOGERROR(NULL_ERROR_MSG);
+        status = -1;
+    } else {
+        response = adb_ncPrefetchImagesResponse_get_ncPrefetchImagesResponse(output, env);
+        if (adb_ncPrefetchImagesResponseType_get_return(response, env) == AXIS2_FALSE) {
+            LOGERROR("returned an error\n");
+            status = 1;
+        }
+        // no output other than success/failure
+    }
+
+    return (status);
+}
+
 //!
 //! Marshals the instance migration request, with different behavior on source and destination.
 //!
@@ -173,6 +173,19 @@ int ncStubDestroy(ncStub * pStub)
     return (EUCA_OK);
 }
 
+//!
+//! Sets the transport timeout used by subsequent requests made through this stub
+//!
+//! @param[in] pStub a pointer to the node controller (NC) stub structure
+//! @param[in] timeout the timeout in seconds
+//!
+//! @return Always returns EUCA_OK
+//!
+int ncStubSetTimeout(ncStub * pStub, int timeout)
+{
+    return (EUCA_OK);
+}
+
 //!
 //! Handles the Run instance request
 //!
@@ -214,6 +227,70 @@ int ncRunInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char *inst
                          secNetCfgs, secNetCfgsLen, outInstPtr);
 }
 
+//!
+//! Handles the batched run instance request by running each instance in turn.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  uuids the unique identifier of each instance to run
+//! @param[in]  instanceIds the identifier of each instance to run (i-XXXXXXXX)
+//! @param[in]  netparams the primary network interface of each instance to run
+//! @param[in]  instancesLen the number of entries in the uuids, instanceIds and netparams lists
+//! @param[in]  reservationId the reservation identifier string
+//! @param[in]  params a pointer to the virtual machine parameters to use
+//! @param[in]  imageId the image identifier string
+//! @param[in]  imageURL the image URL address tring
+//! @param[in]  kernelId the kernel image identifier (eki-XXXXXXXX)
+//! @param[in]  kernelURL the kernel image URL address
+//! @param[in]  ramdiskId the ramdisk image identifier (eri-XXXXXXXX)
+//! @param[in]  ramdiskURL the ramdisk image URL address
+//! @param[in]  ownerId the owner identifier string
+//! @param[in]  accountId the account identifier string
+//! @param[in]  keyName the key name string
+//! @param[in]  userData the user data string
+//! @param[in]  credential the credential string
+//! @param[in]  launchIndex the launch index string
+//! @param[in]  platform the platform name string
+//! @param[in]  expiryTime the reservation expiration time
+//! @param[in]  groupNames a list of group name string
+//! @param[in]  groupNamesSize the number of group name in the groupNames list
+//! @param[in]  rootDirective the root directive string
+//! @param[in]  groupIds a list of group identifier string
+//! @param[in]  groupIdsSize the number of group identifiers in the groupIds list
+//! @param[in]  secNetCfgs a list of secondary network interfaces
+//! @param[in]  secNetCfgsLen the number of network interfaces in the secNetCfgs list
+//! @param[out] outInsts the list of instances that were started, which may be fewer than requested
+//! @param[out] outInstsLen the number of instances in the outInsts list
+//!
+//! @return EUCA_OK, or EUCA_MEMORY_ERROR if the list of started instances
+//!         cannot be allocated; instances that fail to start are left out of it
+//!
+//! @see doRunInstance()
+//!
+int ncRunInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **uuids, char **instanceIds, netConfig * netparams, int instancesLen, char *reservationId,
+                       virtualMachine * params, char *imageId, char *imageURL, char *kernelId, char *kernelURL, char *ramdiskId, char *ramdiskURL, char *ownerId,
+                       char *accountId, char *keyName, char *userData, char *credential, char *launchIndex, char *platform, int expiryTime, char **groupNames,
+                       int groupNamesSize, char *rootDirective, char **groupIds, int groupIdsSize, netConfig * secNetCfgs, int secNetCfgsLen, ncInstance *** outInsts,
+                       int *outInstsLen)
+{
+    int i = 0;
+    ncInstance *outInst = NULL;
+
+    *outInstsLen = 0;
+    if ((*outInsts = EUCA_ZALLOC(instancesLen, sizeof(ncInstance *))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    for (i = 0; i < instancesLen; i++) {
+        outInst = NULL;
+        if (doRunInstance(pMeta, uuids[i], instanceIds[i], reservationId, params, imageId, imageURL, kernelId, kernelURL, ramdiskId, ramdiskURL, ownerId,
+                          accountId, keyName, &(netparams[i]), userData, credential, launchIndex, platform, expiryTime, groupNames, groupNamesSize, rootDirective,
+                          groupIds, groupIdsSize, secNetCfgs, secNetCfgsLen, &outInst) == EUCA_OK) {
+            (*outInsts)[(*outInstsLen)++] = outInst;
+        }
+    }
+    return (EUCA_OK);
+}
+
 //!
 //! Handles the Terminate instance request
 //!
@@ -301,6 +378,29 @@ int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds,
     return doDescribeInstances(pMeta, instIds, instIdsLen, outInsts, outInstsLen);
 }
 
+//!
+//! Handles the client delta describe instance request.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  sinceGeneration the generation returned by the previous request, or 0 for the full list
+//! @param[out] outInsts a pointer the list of instances for which we have data
+//! @param[out] outInstsLen the number of instances in the outInsts list.
+//! @param[out] outGeneration the generation to pass along with the next request
+//! @param[out] outDelta set to TRUE if outInsts only holds the instances that changed since sinceGeneration
+//! @param[out] outLiveIds the identifiers of all instances on the NC, when outDelta is TRUE
+//! @param[out] outLiveIdsLen the number of identifiers in the outLiveIds list.
+//!
+//! @return the result of doDescribeInstancesSince()
+//!
+//! @see doDescribeInstancesSince()
+//!
+int ncDescribeInstancesSinceStub(ncStub * pStub, ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen,
+                                 long long *outGeneration, boolean * outDelta, char ***outLiveIds, int *outLiveIdsLen)
+{
+    return doDescribeInstancesSince(pMeta, sinceGeneration, outInsts, outInstsLen, outGeneration, outDelta, outLiveIds, outLiveIdsLen);
+}
+
 //!
 //! Handles the client bundle instance request.
 //!
@@ -513,6 +613,22 @@ int ncModifyNodeStub(ncStub * pStub, ncMetadata * pMeta, char *stateName)
     return doModifyNode(pMeta, stateName);
 }
 
+//!
+//! Handles the image prefetch request.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  params a pointer to the virtual machine whose VBR names the images to prefetch
+//!
+//! @return the result of doPrefetchImages()
+//!
+//! @see doPrefetchImages()
+//!
+int ncPrefetchImagesStub(ncStub * pStub, ncMetadata * pMeta, virtualMachine * params)
+{
+    return doPrefetchImages(pMeta, params);
+}
+
 //!
 //! Handles the instance migration request, with different behavior on source and destination.
 //!
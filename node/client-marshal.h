@@ -128,15 +128,23 @@ typedef struct ncStub_t {
 
 ncStub *ncStubCreate(char *endpoint, char *logfile, char *homedir);
 int ncStubDestroy(ncStub * stub);
+int ncStubSetTimeout(ncStub * pStub, int timeout);
 
 int ncRunInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char *instanceId, char *reservationId, virtualMachine * params, char *imageId,
                       char *imageURL, char *kernelId, char *kernelURL, char *ramdiskId, char *ramdiskURL, char *ownerId, char *accountId,
                       char *keyName, netConfig * netparams, char *userData, char *credential, char *launchIndex, char *platform, int expiryTime, char **groupNames,
                       int groupNamesSize, char *rootDirective, char **groupIds, int groupIdsSize, netConfig * secNetCfgs, int secNetCfgsLen, ncInstance ** outInstPtr);
+int ncRunInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **uuids, char **instanceIds, netConfig * netparams, int instancesLen, char *reservationId,
+                       virtualMachine * params, char *imageId, char *imageURL, char *kernelId, char *kernelURL, char *ramdiskId, char *ramdiskURL, char *ownerId,
+                       char *accountId, char *keyName, char *userData, char *credential, char *launchIndex, char *platform, int expiryTime, char **groupNames,
+                       int groupNamesSize, char *rootDirective, char **groupIds, int groupIdsSize, netConfig * secNetCfgs, int secNetCfgsLen, ncInstance *** outInsts,
+                       int *outInstsLen);
 int ncGetConsoleOutputStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, char **consoleOutput);
 int ncRebootInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId);
 int ncTerminateInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, int force, int *shutdownState, int *previousState);
 int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, ncInstance *** outInsts, int *outInstsLen);
+int ncDescribeInstancesSinceStub(ncStub * pStub, ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen,
+                                 long long *outGeneration, boolean * outDelta, char ***outLiveIds, int *outLiveIdsLen);
 int ncDescribeResourceStub(ncStub * pStub, ncMetadata * pMeta, char *resourceType, ncResource ** outRes);
 int ncStartNetworkStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char **peers, int peersLen, int port, int vlan, char **outStatus);
 int ncBroadcastNetworkInfoStub(ncStub * pStub, ncMetadata * pMeta, char *networkInfo);
@@ -158,6 +166,7 @@ int ncCreateImageStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, char
 int ncDescribeSensorsStub(ncStub * pStub, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds, int instIdsLen,
                           char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen);
 int ncModifyNodeStub(ncStub * pStub, ncMetadata * pMeta, char *stateName);
+int ncPrefetchImagesStub(ncStub * pStub, ncMetadata * pMeta, virtualMachine * params);
 int ncMigrateInstancesStub(ncStub * pStub, ncMetadata * pMeta, ncInstance ** instances, int instancesLen, char *action, char *credentials, char **resourceLocations, int resourceLocationsLen);
 int ncStartInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId);
 int ncStopInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId);
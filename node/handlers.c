@@ -127,10 +127,12 @@
 #include "hooks.h"
 #include <ebs_utils.h>
 #include "objectstorage.h"
+#include "http.h"
 #include "stats.h"
 #include "message_sensor.h"
 #include "message_stats.h"
 #include "service_sensor.h"
+#include "reclaim_sensor.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -207,6 +209,12 @@ sem *stats_sem = NULL;                 //!< Used to guard the internal message s
 bunchOfInstances *global_instances = NULL;  //!< pointer to the instance list
 bunchOfInstances *global_instances_copy = NULL; //!< pointer to the copied instance list
 
+//! Generation of global_instances_copy, bumped whenever an instance in the copy changes or
+//! goes away. Seeded from the boot time so that generations never repeat across NC restarts.
+//! Guarded by inst_copy_sem.
+static long long instances_generation = 0;
+static long long instances_generation_base = 0; //!< first generation handed out by this NC process
+
 const int default_staging_cleanup_threshold = 60 * 60 * 2;  //!< after this many seconds any STAGING domains will be cleaned up
 const int default_booting_cleanup_threshold = 60;   //!< after this many seconds any BOOTING domains will be cleaned up
 const int default_booting_envwait_threshold = NETWORK_GATE_TIMEOUT_SEC;   //!< after this many seconds an instance will fail to boot unless network environment is ready
@@ -265,6 +273,22 @@ static json_object *stats_json = NULL; //!< The json object that holds all of th
 static int stats_sensor_interval_sec;  //!< Keeps the current value for sensor interval. Set during init
 static int hypervisor_conn_errors = 0;
 
+//! @{
+//! @name Where the NC pushes notice of its changes to the CC (see nc_push_set_target())
+static int push_port = 0;              //!< CC_PUSH_PORT, 0 if the CC is not to be notified
+static int push_sock = -1;             //!< UDP socket the notifications go out on
+static struct sockaddr_in push_addr = { 0 };    //!< address of the enabled CC, zero until known
+static char push_msg[HOSTNAME_LEN + sizeof(NC_PUSH_HEADER)] = "";  //!< the notification, naming this node
+static pthread_mutex_t push_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards the above
+//! @}
+
+//! @{
+//! @name Where and to whom the NC serves its cached images (see nc_peer_set_cluster())
+static int peer_port = 0;              //!< NC_PEER_PORT, 0 if cached images are not served to other nodes
+static char peer_ip[INET_ADDRSTRLEN] = "";  //!< address the image peer server listens on, empty until it is started
+static pthread_mutex_t peer_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards the above
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -284,8 +308,10 @@ static void printMsgServiceStateInfo(ncMetadata * pMeta);
 //! Helpers for internal stats handling in the NC
 static json_object **message_stats_getter();
 static void message_stats_setter();
+static int reclaim_stats_getter(reclaim_sensor_stats_t * stats, int max_stats);
 static int initialize_stats_system(int interval_sec);
 static void *nc_run_stats(void *ignored_arg);
+static void nc_push_notify(void);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -388,6 +414,31 @@ int nc_update_message_stats(const char *message_name, long call_time, int msg_fa
     return EUCA_OK;
 }
 
+//! Fills in the counters of the cache reclaimer for the reclaim sensor,
+//! starting a new interval
+static int reclaim_stats_getter(reclaim_sensor_stats_t * stats, int max_stats)
+{
+    blobstore_reclaim_stats cache_stats = { 0 };
+
+    LOGTRACE("Fetching cache reclaimer stats\n");
+    if ((max_stats < 1) || (stat_backing_reclaimer(&cache_stats, TRUE) != EUCA_OK)) {
+        return 0;                      // no cache, or no reclaimer for it
+    }
+
+    euca_strncpy(stats[0].store_name, "cache", SENSOR_NAME_MAX);
+    stats[0].limit_bytes = cache_stats.limit_blocks * 512LL;
+    stats[0].used_bytes = cache_stats.used_blocks * 512LL;
+    stats[0].purged_bytes = cache_stats.purged_blocks * 512LL;
+    stats[0].purge_usec = cache_stats.purge_usec;
+    stats[0].purge_passes = cache_stats.purge_passes;
+    stats[0].inline_purges = cache_stats.inline_purges;
+    stats[0].inline_bytes = cache_stats.inline_blocks * 512LL;
+    stats[0].inline_usec = cache_stats.inline_usec;
+    stats[0].max_lag_usec = cache_stats.max_lag_usec;
+    stats[0].lag_usec = cache_stats.lag_usec;
+    return 1;
+}
+
 //! Provides NC-specific initializations for the stats system of
 //! internal service sensors (state sensors, message statistics, etc)
 //! @returns EUCA_OK on success, or error code on failure
@@ -418,6 +469,13 @@ static int initialize_stats_system(int interval_sec)
             goto cleanup;
         }
 
+        //Init the reclaim sensor, which reports on the background purging of the image cache
+        ret = initialize_reclaim_sensor(euca_this_component_name, interval_sec, stats_ttl, reclaim_stats_getter);
+        if (ret != EUCA_OK) {
+            LOGERROR("Error initializing internal reclaim sensor: %d\n", ret);
+            goto cleanup;
+        }
+
         ret = init_stats(nc_state.home, euca_this_component_name, nc_lock_stats, nc_unlock_stats);
         if (ret != EUCA_OK) {
             LOGERROR("Could not initialize CC stats system: %d\n", ret);
@@ -1333,36 +1391,210 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
 //!
 //! copying the linked list for use by Describe* requests
 //!
+//! While copying, each instance is compared with its previous copy and stamped with a new
+//! generation if anything about it changed, so that delta DescribeInstances requests only
+//! need to return the instances stamped after the generation the caller last saw. Removals
+//! bump the generation as well so that the caller refreshes its list of live instances.
+//!
+//! @pre The caller must hold inst_sem
+//!
 void copy_instances(void)
 {
+    int old_count = 0;
+    int matched = 0;
     ncInstance *instance = NULL;
     ncInstance *src_instance = NULL;
     ncInstance *dst_instance = NULL;
+    long long generation = 0;
+    ncInstance *old_instance = NULL;
     bunchOfInstances *head = NULL;
     bunchOfInstances *container = NULL;
+    bunchOfInstances *old_copy = NULL;
 
     sem_p(inst_copy_sem);
     {
-        // free the old linked list copy
-        for (head = global_instances_copy; head;) {
-            container = head;
-            instance = head->instance;
-            head = head->next;
-            EUCA_FREE(instance);
-            EUCA_FREE(container);
-        }
+        generation = instances_generation;
 
+        // keep the old copy around to find out what changed since it was made
+        old_copy = global_instances_copy;
         global_instances_copy = NULL;
+        old_count = total_instances(&old_copy);
 
         // make a fresh copy
         for (head = global_instances; head; head = head->next) {
             src_instance = head->instance;
             dst_instance = (ncInstance *) EUCA_ALLOC(1, sizeof(ncInstance));
             memcpy(dst_instance, src_instance, sizeof(ncInstance));
+
+            if ((old_instance = find_instance(&old_copy, src_instance->instanceId)) != NULL) {
+                matched++;
+                dst_instance->generation = old_instance->generation;
+                if (memcmp(dst_instance, old_instance, sizeof(ncInstance)))
+                    dst_instance->generation = 0;
+            } else {
+                dst_instance->generation = 0;
+            }
+
+            if (dst_instance->generation == 0) {
+                dst_instance->generation = src_instance->generation = ++instances_generation;
+            }
             add_instance(&global_instances_copy, dst_instance);
         }
+
+        if (matched < old_count) {
+            // something went away
+            instances_generation++;
+        }
+
+        // free the old linked list copy
+        for (head = old_copy; head;) {
+            container = head;
+            instance = head->instance;
+            head = head->next;
+            EUCA_FREE(instance);
+            EUCA_FREE(container);
+        }
+        generation = (instances_generation - generation);
     }
     sem_v(inst_copy_sem);
+
+    // now that describe requests would see the changes, tell the CC to come and get them
+    if (generation > 0)
+        nc_push_notify();
+}
+
+//!
+//! Learns, from the global network information the CC broadcasts, the address
+//! this node is known by in its cluster and the other nodes of the cluster, so
+//! that the image peer server listens on that address and serves those nodes
+//! only. The server is started the first time the node finds itself in the
+//! GNI. Does nothing unless NC_PEER_PORT is set.
+//!
+//! @param[in] gni_path path to the global network information XML
+//!
+//! @return EUCA_OK on success (or if images are not served) or EUCA_ERROR if
+//!         the GNI does not say which cluster and node this is or the server
+//!         cannot start
+//!
+int nc_peer_set_cluster(char *gni_path)
+{
+    int i = 0;
+    int ret = EUCA_ERROR;
+    int npeers = 0;
+    char **peers = NULL;
+    gni_node *node = NULL;
+    gni_cluster *cluster = NULL;
+    globalNetworkInfo *gni = NULL;
+    gni_hostname_info *host_info = NULL;
+
+    if (peer_port <= 0)
+        return (EUCA_OK);
+
+    gni = gni_init();
+    host_info = gni_init_hostname_info();
+    if (gni && host_info && (gni_populate_v(GNI_POPULATE_CONFIG, gni, host_info, gni_path) == EUCA_OK)
+        && !gni_find_self_cluster(gni, &cluster) && !gni_find_self_node(gni, &node)
+        && ((peers = EUCA_ZALLOC(cluster->max_nodes + 1, sizeof(char *))) != NULL)) {
+        for (i = 0; i < cluster->max_nodes; i++) {
+            if (strcmp(cluster->nodes[i].name, node->name))
+                peers[npeers++] = cluster->nodes[i].name;
+        }
+        pthread_mutex_lock(&peer_mutex);
+        {
+            // peers are set first so a new server never answers the nodes of a stale list
+            set_backing_peers(peers, npeers);
+            ret = EUCA_OK;
+            if (strcmp(peer_ip, node->name)) {
+                if ((ret = start_backing_peer_server(node->name, peer_port)) == EUCA_OK) {
+                    euca_strncpy(peer_ip, node->name, sizeof(peer_ip));
+                } else {
+                    peer_ip[0] = '\0';
+                }
+            }
+        }
+        pthread_mutex_unlock(&peer_mutex);
+        EUCA_FREE(peers);
+    }
+
+    if (ret != EUCA_OK) {
+        LOGWARN("cannot serve cached images to the other nodes of the cluster described in %s\n", gni_path);
+    }
+    gni_free(gni);
+    gni_hostnames_free(host_info);
+    return (ret);
+}
+
+//!
+//! Learns, from the global network information the CC broadcasts, where to push
+//! notice of changes to this node's instances (see nc_push_notify()): to the
+//! enabled CC of the cluster, on CC_PUSH_PORT, naming the node the way the
+//! cloud knows it. Does nothing unless CC_PUSH_PORT is set.
+//!
+//! @param[in] gni_path path to the global network information XML
+//!
+//! @return EUCA_OK on success (or if the CC is not to be notified) or EUCA_ERROR
+//!         if the GNI does not say which CC and node this is
+//!
+int nc_push_set_target(char *gni_path)
+{
+    int ret = EUCA_ERROR;
+    char *ccIp = NULL;
+    gni_node *node = NULL;
+    gni_cluster *cluster = NULL;
+    globalNetworkInfo *gni = NULL;
+    gni_hostname_info *host_info = NULL;
+    struct sockaddr_in addr = { 0 };
+
+    if (push_port <= 0)
+        return (EUCA_OK);
+
+    gni = gni_init();
+    host_info = gni_init_hostname_info();
+    if (gni && host_info && (gni_populate_v(GNI_POPULATE_CONFIG, gni, host_info, gni_path) == EUCA_OK)
+        && !gni_find_self_cluster(gni, &cluster) && !gni_find_self_node(gni, &node) && ((ccIp = hex2dot(cluster->enabledCCIp)) != NULL)) {
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(push_port);
+        if (inet_pton(AF_INET, ccIp, &(addr.sin_addr)) == 1) {
+            pthread_mutex_lock(&push_mutex);
+            {
+                if ((push_addr.sin_addr.s_addr != addr.sin_addr.s_addr) || strcmp(push_msg + strlen(NC_PUSH_HEADER), node->name)) {
+                    LOGINFO("notifying the CC at %s:%d of changes to node %s\n", ccIp, push_port, node->name);
+                }
+                memcpy(&push_addr, &addr, sizeof(push_addr));
+                snprintf(push_msg, sizeof(push_msg), NC_PUSH_HEADER "%s", node->name);
+            }
+            pthread_mutex_unlock(&push_mutex);
+            ret = EUCA_OK;
+        }
+        EUCA_FREE(ccIp);
+    }
+
+    if (ret != EUCA_OK) {
+        LOGWARN("cannot tell from %s which CC to notify of changes, it will have to poll\n", gni_path);
+    }
+    gni_free(gni);
+    gni_hostnames_free(host_info);
+    return (ret);
+}
+
+//!
+//! Sends the CC a datagram saying that this node's instances changed, so that
+//! it refreshes the node without waiting for its next poll. Delivery is not
+//! guaranteed, which the CC makes up for by still polling now and then.
+//!
+static void nc_push_notify(void)
+{
+    pthread_mutex_lock(&push_mutex);
+    {
+        if ((push_port > 0) && (push_addr.sin_addr.s_addr != 0)) {
+            if ((push_sock < 0) && ((push_sock = socket(AF_INET, (SOCK_DGRAM | SOCK_CLOEXEC), 0)) < 0)) {
+                LOGWARN("cannot create socket to notify the CC of changes: %s\n", strerror(errno));
+            } else if (sendto(push_sock, push_msg, strlen(push_msg), MSG_DONTWAIT, ((struct sockaddr *)&push_addr), sizeof(push_addr)) < 0) {
+                LOGDEBUG("failed to notify the CC of changes: %s\n", strerror(errno));
+            }
+        }
+    }
+    pthread_mutex_unlock(&push_mutex);
 }
 
 //!
@@ -1723,6 +1955,8 @@ void *monitoring_thread(void *arg)
                     //! @todo pick up other NC options dynamically?
                 }
             }
+            // keep the cache inventory reported by doDescribeResource() current, outside of the handler lock
+            refresh_backing_cache_images();
         }
         // do this every 10th iteration (every 10*MONITORING_PERIOD seconds)
         if ((iteration % 10) == 0) {
@@ -2422,9 +2656,24 @@ static int init(void)
     GET_VAR_INT(nc_state.config_max_cores, CONFIG_MAX_CORES, 0);
     GET_VAR_INT(nc_state.save_instance_files, CONFIG_SAVE_INSTANCES, 0);
     GET_VAR_INT(nc_state.concurrent_disk_ops, CONFIG_CONCURRENT_DISK_OPS, 4);
+    {
+        int artifact_workers;
+        GET_VAR_INT(artifact_workers, CONFIG_NC_ARTIFACT_WORKERS, ART_DEFAULT_WORKERS);
+        art_set_max_workers(artifact_workers);
+    }
     GET_VAR_INT(nc_state.sc_request_timeout_sec, CONFIG_SC_REQUEST_TIMEOUT, 45);
     GET_VAR_INT(nc_state.concurrent_cleanup_ops, CONFIG_CONCURRENT_CLEANUP_OPS, 30);
     GET_VAR_INT(nc_state.disable_snapshots, CONFIG_DISABLE_SNAPSHOTS, 0);
+    {
+        int cache_dedup;
+        GET_VAR_INT(cache_dedup, CONFIG_NC_CACHE_DEDUP, 0);
+        art_set_cache_dedup(cache_dedup && !nc_state.disable_snapshots); // chunks are mapped with the device mapper
+    }
+    {
+        int download_connections;
+        GET_VAR_INT(download_connections, CONFIG_NC_DOWNLOAD_CONNECTIONS, HTTP_DEFAULT_CONNECTIONS);
+        http_set_parallel(download_connections, HTTP_DEFAULT_CHUNK_BYTES);
+    }
     GET_VAR_INT(nc_state.shutdown_grace_period_sec, CONFIG_SHUTDOWN_GRACE_PERIOD_SEC, 60);
 
     strcpy(nc_state.admin_user_id, EUCALYPTUS_ADMIN);
@@ -2478,6 +2727,11 @@ static int init(void)
         LOGFATAL("failed to create and initialize semaphores\n");
         return (EUCA_FATAL_ERROR);
     }
+
+    // leave room for about a million instance changes per second of uptime before
+    // generations could collide with those handed out after an NC restart
+    instances_generation_base = ((long long)time(NULL)) << 20;
+    instances_generation = instances_generation_base;
     if (log_sem_set(log_sem) != 0) {
         LOGFATAL("failed to set logging semaphore\n");
         return (EUCA_FATAL_ERROR);
@@ -2756,6 +3010,46 @@ static int init(void)
         LOGFATAL("integrity check of the backing store failed");
         return (EUCA_FATAL_ERROR);
     }
+
+    {
+        // keep the cache below its high watermark in the background, so launches rarely purge it themselves
+        int cache_high_pct, cache_low_pct;
+        GET_VAR_INT(cache_high_pct, CONFIG_NC_CACHE_HIGH_WATERMARK, BLOBSTORE_RECLAIM_HIGH_PCT);
+        GET_VAR_INT(cache_low_pct, CONFIG_NC_CACHE_LOW_WATERMARK, BLOBSTORE_RECLAIM_LOW_PCT);
+        if ((cache_low_pct <= 0) || (cache_low_pct >= cache_high_pct) || (cache_high_pct > 100)) {
+            LOGWARN("ignoring invalid cache watermarks (%s=%d, %s=%d), using %d and %d\n", CONFIG_NC_CACHE_HIGH_WATERMARK, cache_high_pct,
+                    CONFIG_NC_CACHE_LOW_WATERMARK, cache_low_pct, BLOBSTORE_RECLAIM_HIGH_PCT, BLOBSTORE_RECLAIM_LOW_PCT);
+            cache_high_pct = BLOBSTORE_RECLAIM_HIGH_PCT;
+            cache_low_pct = BLOBSTORE_RECLAIM_LOW_PCT;
+        }
+        if (start_backing_reclaimer(cache_high_pct, cache_low_pct) != EUCA_OK) {
+            LOGWARN("cache will only be purged when instances are launched\n");
+        }
+    }
+    {
+        // let the other NCs of the cluster fetch cached images from this one, once the GNI says which they are
+        char gni_path[EUCA_MAX_PATH];
+        GET_VAR_INT(peer_port, CONFIG_NC_PEER_PORT, 0);
+        if ((peer_port < 0) || (peer_port > 65535))
+            peer_port = 0;
+        snprintf(gni_path, sizeof(gni_path), EUCALYPTUS_RUN_DIR "/global_network_info.xml", nc_state.home);
+        if ((peer_port > 0) && !access(gni_path, R_OK)) {
+            nc_peer_set_cluster(gni_path);
+        }
+        if (peer_port > 0)
+            art_set_peer_port(peer_port);
+    }
+    {
+        // push notice of changes to the CC, which it may then poll for less often
+        char gni_path[EUCA_MAX_PATH];
+        GET_VAR_INT(push_port, CONFIG_CC_PUSH_PORT, 0);
+        if ((push_port < 0) || (push_port > 65535))
+            push_port = 0;
+        snprintf(gni_path, sizeof(gni_path), EUCALYPTUS_RUN_DIR "/global_network_info.xml", nc_state.home);
+        if ((push_port > 0) && !access(gni_path, R_OK)) {
+            nc_push_set_target(gni_path);
+        }
+    }
     // setup the network
     snprintf(nc_state.config_network_path, EUCA_MAX_PATH, NC_NET_PATH_DEFAULT, nc_state.home);
 
@@ -3202,6 +3496,90 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ncIn
     return (EUCA_OK);
 }
 
+//!
+//! Handles the describe instance request of a caller that already knows the state of all
+//! instances on this node as of a given generation. Only the instances that changed since
+//! then are returned, along with the identifiers of all instances still known to the node
+//! so that the caller can tell which of its cached instances are still alive.
+//!
+//! If the caller's generation was not handed out by this NC process (e.g. it is 0, or the
+//! NC restarted since), the full list of instances is returned and outDelta is FALSE.
+//!
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  sinceGeneration the generation returned by the caller's previous request, or 0
+//! @param[out] outInsts a pointer the list of instances that changed since sinceGeneration
+//! @param[out] outInstsLen the number of instances in the outInsts list.
+//! @param[out] outGeneration the generation to pass along with the next request
+//! @param[out] outDelta set to TRUE if outInsts only holds the instances that changed
+//! @param[out] outLiveIds the identifiers of all instances on this node (only set when outDelta is TRUE)
+//! @param[out] outLiveIdsLen the number of identifiers in the outLiveIds list.
+//!
+//! @return EUCA_OK on success or the result of doDescribeInstances()
+//!
+//! @see doDescribeInstances()
+//!
+int doDescribeInstancesSince(ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, long long *outGeneration,
+                             boolean * outDelta, char ***outLiveIds, int *outLiveIdsLen)
+{
+    int i = 0;
+    int k = 0;
+    int ret = EUCA_OK;
+    long long generation = 0;
+    char **liveIds = NULL;
+
+    *outGeneration = 0;
+    *outDelta = FALSE;
+    *outLiveIds = NULL;
+    *outLiveIdsLen = 0;
+
+    if (init())
+        return (EUCA_ERROR);
+
+    // sample the generation before describing: anything that changes in between gets
+    // stamped with a later generation, so it is returned now and again next time
+    sem_p(inst_copy_sem);
+    generation = instances_generation;
+    sem_v(inst_copy_sem);
+
+    if ((ret = doDescribeInstances(pMeta, NULL, 0, outInsts, outInstsLen)) != EUCA_OK)
+        return (ret);
+
+    *outGeneration = generation;
+    if ((sinceGeneration < instances_generation_base) || (sinceGeneration > generation))
+        return (EUCA_OK);
+
+    if ((*outInstsLen > 0) && ((liveIds = EUCA_ZALLOC(*outInstsLen, sizeof(char *))) == NULL)) {
+        LOGWARN("out of memory, falling back to full instance list\n");
+        return (EUCA_OK);
+    }
+
+    for (i = 0; i < *outInstsLen; i++) {
+        if ((liveIds[i] = strdup((*outInsts)[i]->instanceId)) == NULL) {
+            LOGWARN("out of memory, falling back to full instance list\n");
+            for (; i >= 0; i--)
+                EUCA_FREE(liveIds[i]);
+            EUCA_FREE(liveIds);
+            return (EUCA_OK);
+        }
+    }
+
+    // migrating instances are always returned, since the CC drives migrations from their reports
+    for (i = 0, k = 0; i < *outInstsLen; i++) {
+        if (((*outInsts)[i]->generation > sinceGeneration) || ((*outInsts)[i]->migration_state != NOT_MIGRATING)) {
+            (*outInsts)[k++] = (*outInsts)[i];
+        } else {
+            free_instance(&((*outInsts)[i]));
+        }
+    }
+
+    LOGDEBUG("returning %d of %d instances changed since generation %lld (now %lld)\n", k, *outInstsLen, sinceGeneration, generation);
+    *outLiveIds = liveIds;
+    *outLiveIdsLen = *outInstsLen;
+    *outInstsLen = k;
+    *outDelta = TRUE;
+    return (EUCA_OK);
+}
+
 //!
 //! Handles the broadcast network info request
 //!
@@ -3816,6 +4194,32 @@ int doModifyNode(ncMetadata * pMeta, char *stateName)
     return ret;
 }
 
+//!
+//! Handles the image prefetch request.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] params a pointer to the virtual machine whose VBR names the images to prefetch
+//!
+//! @return EUCA_OK if the prefetch was started or dropped, or an error code
+//!
+int doPrefetchImages(ncMetadata * pMeta, virtualMachine * params)
+{
+    int ret = EUCA_OK;
+
+    if (init())
+        return (EUCA_ERROR);
+
+    LOGDEBUG("invoked (vbrLen=%d)\n", (params) ? (params->virtualBootRecordLen) : (0));
+
+    if (nc_state.H->doPrefetchImages) {
+        ret = nc_state.H->doPrefetchImages(&nc_state, pMeta, params);
+    } else {
+        ret = nc_state.D->doPrefetchImages(&nc_state, pMeta, params);
+    }
+
+    return ret;
+}
+
 //!
 //! Handles the instance migration request.
 //!
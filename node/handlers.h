@@ -249,6 +249,7 @@ struct handlers {
     int (*doDescribeSensors) (struct nc_state_t * nc, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds,
                               int instIdsLen, char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen);
     int (*doModifyNode) (struct nc_state_t * nc, ncMetadata * pMeta, char *stateName);
+    int (*doPrefetchImages) (struct nc_state_t * nc, ncMetadata * pMeta, virtualMachine * params);
     int (*doMigrateInstances) (struct nc_state_t * nc, ncMetadata * pMeta, ncInstance ** instances, int instancesLen, char *action, char *credentials, char **resourceLocations, int resourceLocationsLen);
     int (*doStartInstance) (struct nc_state_t * nc, ncMetadata * pMeta, char *instanceId);
     int (*doStopInstance) (struct nc_state_t * nc, ncMetadata * pMeta, char *instanceId);
@@ -315,6 +316,8 @@ int doBroadcastNetworkInfo(ncMetadata * pMeta, char *networkInfo);
 int doAssignAddress(ncMetadata * pMeta, char *instanceId, char *publicIp);
 int doPowerDown(ncMetadata * pMeta);
 int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ncInstance *** outInsts, int *outInstsLen);
+int doDescribeInstancesSince(ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, long long *outGeneration,
+                             boolean * outDelta, char ***outLiveIds, int *outLiveIdsLen);
 int doRunInstance(ncMetadata * pMeta, char *uuid, char *instanceId, char *reservationId, virtualMachine * params, char *imageId, char *imageURL,
                   char *kernelId, char *kernelURL, char *ramdiskId, char *ramdiskURL, char *ownerId, char *accountId, char *keyName,
                   netConfig * netparams, char *userData, char *credential, char *launchIndex, char *platform, int expiryTime, char **groupNames, int groupNamesSize,
@@ -337,6 +340,7 @@ int doCreateImage(ncMetadata * pMeta, char *instanceId, char *volumeId, char *re
 int doDescribeSensors(ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds, int instIdsLen, char **sensorIds,
                       int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen);
 int doModifyNode(ncMetadata * pMeta, char *stateName);
+int doPrefetchImages(ncMetadata * pMeta, virtualMachine * params);
 int doMigrateInstances(ncMetadata * pMeta, ncInstance ** instances, int instancesLen, char *action, char *credentials, char **resourceLocations, int resourceLocationsLen);
 int doStartInstance(ncMetadata * pMeta, char *instanceId);
 int doStopInstance(ncMetadata * pMeta, char *instanceId);
@@ -381,6 +385,8 @@ void set_serial_and_bus(const char *vol, const char *dev, char *serial, int seri
 int instance_network_gate(ncInstance *instance, time_t timeout_seconds);
 char *gettok(char *haystack, char *needle);
 int find_interface_changes(char *gni_path);
+int nc_peer_set_cluster(char *gni_path);
+int nc_push_set_target(char *gni_path);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -125,6 +125,7 @@
 
 #define VOL_RETRIES 3
 #define SHUTDOWN_GRACE_PERIOD_SEC 60
+#define MAX_PREFETCHES 4               //!< most image prefetches a node will run at once (see doPrefetchImages())
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -150,6 +151,13 @@ typedef struct startstop_params_ {
     boolean do_stop;
 } startstop_params;
 
+//! Struct used to pass the VBR of a prefetch request to prefetch_thread
+typedef struct prefetch_params_ {
+    int slot;                          //!< index into prefetching[] held by this prefetch
+    boolean bail_flag;                 //!< never set, downloads of a prefetch run to completion
+    virtualMachine vm;                 //!< parsed copy of the requested VBR
+} prefetch_params;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -182,6 +190,10 @@ static boolean use_virtio_net = FALSE;
 static boolean use_virtio_disk = FALSE;
 static boolean use_virtio_root = FALSE;
 
+//! IDs of the root images being prefetched, an empty string marks a free slot
+static char prefetching[MAX_PREFETCHES][SMALL_CHAR_BUFFER_SIZE] = { "" };
+static pthread_mutex_t prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL PROTOTYPES                            |
@@ -230,6 +242,8 @@ static int doDescribeBundleTasks(struct nc_state_t *nc, ncMetadata * pMeta, char
 static int doDescribeSensors(struct nc_state_t *nc, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds,
                              int instIdsLen, char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen);
 static int doModifyNode(struct nc_state_t *nc, ncMetadata * pMeta, char *stateName);
+static void *prefetch_thread(void *arg);
+static int doPrefetchImages(struct nc_state_t *nc, ncMetadata * pMeta, virtualMachine * params);
 static int doMigrateInstances(struct nc_state_t *nc, ncMetadata * pMeta, ncInstance ** instances, int instancesLen, char *action, char *credentials, char **resourceLocations, int resourceLocationsLen);
 static void *startstop_thread(void *arg);
 static int doStartInstance(struct nc_state_t *nc, ncMetadata * pMeta, char *instanceId);
@@ -266,6 +280,7 @@ struct handlers default_libvirt_handlers = {
     .doDescribeBundleTasks = doDescribeBundleTasks,
     .doDescribeSensors = doDescribeSensors,
     .doModifyNode = doModifyNode,
+    .doPrefetchImages = doPrefetchImages,
     .doMigrateInstances = doMigrateInstances,
     .doStartInstance = doStartInstance,
     .doStopInstance = doStopInstance,
@@ -999,6 +1014,8 @@ static int doDescribeResource(struct nc_state_t *nc, ncMetadata * pMeta, char *r
         LOGERROR("out of memory\n");
         return (EUCA_MEMORY_ERROR);
     }
+    // let the CC steer instances towards nodes that already have their images
+    res->cachedImagesLen = stat_backing_cache_images(res->cachedImages, EUCA_MAX_CACHED_IMAGES);
     (*outRes) = res;
 
     LOGDEBUG("Core status:   in-use %d physical %lld over-committed %s\n", sum_cores, nc->phy_max_cores, (((sum_cores + cores_free) > nc->phy_max_cores) ? "yes" : "no"));
@@ -1044,6 +1061,12 @@ static int doBroadcastNetworkInfo(struct nc_state_t *nc, ncMetadata * pMeta, cha
         ret = EUCA_ERROR;
     }
 
+    // the CC to push notice of changes to, and the nodes to serve cached images to, may have changed along with the network information
+    if (ret == EUCA_OK) {
+        nc_push_set_target(xmlpath);
+        nc_peer_set_cluster(xmlpath);
+    }
+
     if (EUCA_OK == ret && 
         nc && nc->pEucaNet &&
         !strcmp(nc->pEucaNet->sMode, NETMODE_VPCMIDO)) {
@@ -2704,6 +2727,117 @@ static int doModifyNode(struct nc_state_t *nc, ncMetadata * pMeta, char *stateNa
     return ret;
 }
 
+//!
+//! Downloads the images of a prefetch request into the cache and releases
+//! the prefetch slot taken by doPrefetchImages()
+//!
+//! @param[in] arg a pointer to the prefetch_params structure, freed here
+//!
+//! @return Always return NULL
+//!
+static void *prefetch_thread(void *arg)
+{
+    int rc = EUCA_OK;
+    long long start_ms = time_ms();
+    prefetch_params *params = ((prefetch_params *) arg);
+
+    LOGINFO("[%s] prefetching images into the cache\n", params->vm.root->id);
+    if ((rc = prefetch_backing(&(params->vm), &(params->bail_flag))) != EUCA_OK) {
+        LOGWARN("[%s] failed to prefetch images (error=%d)\n", params->vm.root->id, rc);
+    } else {
+        LOGINFO("[%s] prefetched images in %lld ms\n", params->vm.root->id, (time_ms() - start_ms));
+    }
+
+    pthread_mutex_lock(&prefetch_mutex);
+    {
+        prefetching[params->slot][0] = '\0';
+    }
+    pthread_mutex_unlock(&prefetch_mutex);
+
+    EUCA_FREE(params);
+    return NULL;
+}
+
+//!
+//! Handles the image prefetch request: brings the images named in the VBR
+//! into the cache in the background so that a later launch of an instance
+//! from them does not wait on the download. The request is dropped, without
+//! an error, when the node is disabled, when the root image is already being
+//! prefetched, or when MAX_PREFETCHES prefetches are already in progress.
+//!
+//! @param[in] nc a pointer to the NC state structure
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] params a pointer to the virtual machine whose VBR names the images
+//!
+//! @return EUCA_OK if the prefetch was started or dropped, EUCA_INVALID_ERROR
+//!         for an unusable VBR, EUCA_MEMORY_ERROR or EUCA_THREAD_ERROR otherwise
+//!
+static int doPrefetchImages(struct nc_state_t *nc, ncMetadata * pMeta, virtualMachine * params)
+{
+    int slot = -1;
+    pthread_t tid = { 0 };
+    pthread_attr_t tattr = { {0} };
+    prefetch_params *prefetch = NULL;
+
+    if (params == NULL)
+        return (EUCA_INVALID_ERROR);
+
+    if (!nc->is_enabled) {
+        LOGDEBUG("node is disabled, ignoring the prefetch request\n");
+        return (EUCA_OK);
+    }
+
+    if ((prefetch = EUCA_ZALLOC(1, sizeof(prefetch_params))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    memcpy(&(prefetch->vm), params, sizeof(virtualMachine));
+    prefetch->vm.root = NULL;
+    if (vbr_parse(&(prefetch->vm), pMeta) != EUCA_OK) {
+        LOGERROR("failed to parse the VBR of the prefetch request\n");
+        EUCA_FREE(prefetch);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    pthread_mutex_lock(&prefetch_mutex);
+    {
+        for (int i = 0; i < MAX_PREFETCHES; i++) {
+            if (!strcmp(prefetching[i], prefetch->vm.root->id)) {
+                slot = -1;
+                break;
+            }
+            if ((slot < 0) && (prefetching[i][0] == '\0'))
+                slot = i;
+        }
+        if (slot >= 0)
+            euca_strncpy(prefetching[slot], prefetch->vm.root->id, SMALL_CHAR_BUFFER_SIZE);
+    }
+    pthread_mutex_unlock(&prefetch_mutex);
+
+    if (slot < 0) {
+        LOGDEBUG("[%s] already prefetching this image or too many prefetches, ignoring the request\n", prefetch->vm.root->id);
+        EUCA_FREE(prefetch);
+        return (EUCA_OK);
+    }
+    prefetch->slot = slot;
+
+    pthread_attr_init(&tattr);
+    pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &tattr, prefetch_thread, ((void *)prefetch)) != 0) {
+        LOGERROR("[%s] failed to start the prefetch thread\n", prefetch->vm.root->id);
+        pthread_mutex_lock(&prefetch_mutex);
+        {
+            prefetching[slot][0] = '\0';
+        }
+        pthread_mutex_unlock(&prefetch_mutex);
+        pthread_attr_destroy(&tattr);
+        EUCA_FREE(prefetch);
+        return (EUCA_THREAD_ERROR);
+    }
+    pthread_attr_destroy(&tattr);
+
+    set_corrid_pthread(get_corrid() != NULL ? get_corrid()->correlation_id : NULL, tid);
+    return (EUCA_OK);
+}
+
 //!
 //! Handles the instance migration request.
 //!
@@ -199,6 +199,7 @@ struct handlers kvm_libvirt_handlers = {
     .doDetachNetworkInterface = NULL,
     .doDescribeSensors = NULL,
     .doModifyNode = NULL,
+    .doPrefetchImages = NULL,
     .doMigrateInstances = doMigrateInstances,
     .doStartInstance = NULL,
     .doStopInstance = NULL
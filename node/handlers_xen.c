@@ -184,6 +184,7 @@ struct handlers xen_libvirt_handlers = {
     .doDetachNetworkInterface = NULL,
     .doDescribeSensors = NULL,
     .doModifyNode = NULL,
+    .doPrefetchImages = NULL,
     .doMigrateInstances = NULL,        // no support on Xen for instance migration, currently
     .doStartInstance = NULL,
     .doStopInstance = NULL,
@@ -415,6 +415,7 @@ adb_ncStartNetworkResponse_t *ncStartNetworkMarshal(adb_ncStartNetwork_t * ncSta
 //!
 adb_ncDescribeResourceResponse_t *ncDescribeResourceMarshal(adb_ncDescribeResource_t * ncDescribeResource, const axutil_env_t * env)
 {
+    int i = 0;
     int error = EUCA_OK;
     ncMetadata meta = { 0 };
     ncResource *outRes = NULL;
@@ -458,6 +459,9 @@ adb_ncDescribeResourceResponse_t *ncDescribeResourceMarshal(adb_ncDescribeResour
             adb_ncDescribeResourceResponseType_set_numberOfCoresAvailable(output, env, outRes->numberOfCoresAvailable);
             adb_ncDescribeResourceResponseType_set_publicSubnets(output, env, outRes->publicSubnets);
             adb_ncDescribeResourceResponseType_set_hypervisor(output, env, outRes->hypervisor);
+            for (i = 0; i < outRes->cachedImagesLen; i++) {
+                adb_ncDescribeResourceResponseType_add_cachedImages(output, env, outRes->cachedImages[i]);
+            }
             free_resource(&outRes);
         }
         unset_corrid(corr_id);
@@ -636,6 +640,178 @@ adb_ncRunInstanceResponse_t *ncRunInstanceMarshal(adb_ncRunInstance_t * ncRunIns
     return (response);
 }
 
+//!
+//! Unmarshals, executes, responds to the batched run instance request. Each
+//! instance is started in turn with doRunInstance() while the handler lock is
+//! held once for the whole batch; the response lists the instances that were
+//! started, so the caller can tell which of them failed.
+//!
+//! @param[in] ncRunInstances a pointer to the batched run instance request parameters
+//! @param[in] env pointer to the AXIS2 environment structure
+//!
+//! @return a pointer to the request's response structure
+//!
+adb_ncRunInstancesResponse_t *ncRunInstancesMarshal(adb_ncRunInstances_t * ncRunInstances, const axutil_env_t * env)
+{
+    int i = 0;
+    int error = EUCA_OK;
+    int started = 0;
+    int expiryTime = 0;
+    int instancesLen = 0;
+    int groupNamesSize = 0;
+    char **groupNames = NULL;
+    int groupIdsSize = 0;
+    char **groupIds = NULL;
+    netConfig netparams = { 0 };
+    ncMetadata meta = { 0 };
+    ncInstance *outInst = NULL;
+    axis2_char_t *uuid = NULL;
+    axis2_char_t *instanceId = NULL;
+    axis2_char_t *reservationId = NULL;
+    axis2_char_t *imageId = NULL;
+    axis2_char_t *imageURL = NULL;
+    axis2_char_t *kernelId = NULL;
+    axis2_char_t *kernelURL = NULL;
+    axis2_char_t *ramdiskId = NULL;
+    axis2_char_t *ramdiskURL = NULL;
+    axis2_char_t *ownerId = NULL;
+    axis2_char_t *accountId = NULL;
+    axis2_char_t *keyName = NULL;
+    axis2_char_t *userData = NULL;
+    axis2_char_t *credential = NULL;
+    axis2_char_t *launchIndex = NULL;
+    axis2_char_t *platform = NULL;
+    axis2_char_t *rootDirective = NULL;
+    virtualMachine params = { 0 };
+    axutil_date_time_t *dt = NULL;
+    adb_netConfigType_t *net_type = NULL;
+    adb_runInstancesEntryType_t *entry = NULL;
+    adb_instanceType_t *instance = NULL;
+    adb_ncRunInstancesType_t *input = NULL;
+    adb_ncRunInstancesResponse_t *response = NULL;
+    adb_ncRunInstancesResponseType_t *output = NULL;
+    long long call_time = time_ms();
+    netConfig secNetCfgs[EUCA_MAX_NICS] = { {0} };
+    int secNetCfgsLen = 0;
+
+    pthread_mutex_lock(&ncHandlerLock);
+    {
+        input = adb_ncRunInstances_get_ncRunInstances(ncRunInstances, env);
+        response = adb_ncRunInstancesResponse_create(env);
+        output = adb_ncRunInstancesResponseType_create(env);
+
+        // get operation-specific fields from input
+        reservationId = adb_ncRunInstancesType_get_reservationId(input, env);
+        copy_vm_type_from_adb(&params, adb_ncRunInstancesType_get_instanceType(input, env), env);
+        imageId = adb_ncRunInstancesType_get_imageId(input, env);
+        imageURL = adb_ncRunInstancesType_get_imageURL(input, env);
+        kernelId = adb_ncRunInstancesType_get_kernelId(input, env);
+        kernelURL = adb_ncRunInstancesType_get_kernelURL(input, env);
+        ramdiskId = adb_ncRunInstancesType_get_ramdiskId(input, env);
+        ramdiskURL = adb_ncRunInstancesType_get_ramdiskURL(input, env);
+        ownerId = adb_ncRunInstancesType_get_ownerId(input, env);
+        accountId = adb_ncRunInstancesType_get_accountId(input, env);
+        keyName = adb_ncRunInstancesType_get_keyName(input, env);
+
+        // Handle secondary network interfaces
+        secNetCfgsLen = adb_ncRunInstancesType_sizeof_secondaryNetConfig(input, env);
+        if (secNetCfgsLen > EUCA_MAX_NICS) {    // Warn that number of net configs is greater than supported
+            LOGWARN("Maximum number of secondary enis supported is %d\n", EUCA_MAX_NICS);
+            secNetCfgsLen = EUCA_MAX_NICS;
+        }
+        for (i = 0; i < secNetCfgsLen; i++) {
+            net_type = adb_ncRunInstancesType_get_secondaryNetConfig_at(input, env, i);
+            euca_strncpy(secNetCfgs[i].interfaceId, adb_netConfigType_get_interfaceId(net_type, env), ENI_ID_LEN);
+            secNetCfgs[i].device = adb_netConfigType_get_device(net_type, env);
+            secNetCfgs[i].vlan = adb_netConfigType_get_vlan(net_type, env);
+            secNetCfgs[i].networkIndex = adb_netConfigType_get_networkIndex(net_type, env);
+            euca_strncpy(secNetCfgs[i].privateMac, adb_netConfigType_get_privateMacAddress(net_type, env), ENET_ADDR_LEN);
+            euca_strncpy(secNetCfgs[i].privateIp, adb_netConfigType_get_privateIp(net_type, env), INET_ADDR_LEN);
+            euca_strncpy(secNetCfgs[i].publicIp, adb_netConfigType_get_publicIp(net_type, env), INET_ADDR_LEN);
+            euca_strncpy(secNetCfgs[i].attachmentId, adb_netConfigType_get_attachmentId(net_type, env), ENI_ATTACHMENT_ID_LEN);
+        }
+        userData = adb_ncRunInstancesType_get_userData(input, env);
+        credential = adb_ncRunInstancesType_get_credential(input, env);
+        launchIndex = adb_ncRunInstancesType_get_launchIndex(input, env);
+        platform = adb_ncRunInstancesType_get_platform(input, env);
+
+        dt = adb_ncRunInstancesType_get_expiryTime(input, env);
+        expiryTime = datetime_to_unix(dt, env);
+
+        groupNamesSize = adb_ncRunInstancesType_sizeof_groupNames(input, env);
+        groupIdsSize = adb_ncRunInstancesType_sizeof_groupIds(input, env);
+        if (((groupNames = EUCA_ZALLOC(groupNamesSize, sizeof(char *))) == NULL) || ((groupIds = EUCA_ZALLOC(groupIdsSize, sizeof(char *))) == NULL)) {
+            LOGERROR("[%s] out of memory. Cannot allocate %d groups.\n", reservationId, (groupNamesSize + groupIdsSize));
+            adb_ncRunInstancesResponseType_set_return(output, env, AXIS2_FALSE);
+            error = EUCA_MEMORY_ERROR;
+        } else {
+            for (i = 0; i < groupNamesSize; i++) {
+                groupNames[i] = adb_ncRunInstancesType_get_groupNames_at(input, env, i);
+            }
+            for (i = 0; i < groupIdsSize; i++) {
+                groupIds[i] = adb_ncRunInstancesType_get_groupIds_at(input, env, i);
+            }
+            rootDirective = adb_ncRunInstancesType_get_rootDirective(input, env);
+
+            // do it
+            EUCA_MESSAGE_UNMARSHAL(ncRunInstancesType, input, (&meta));
+
+            threadCorrelationId *corr_id = set_corrid(meta.correlationId);
+
+            instancesLen = adb_ncRunInstancesType_sizeof_instances(input, env);
+            for (i = 0; i < instancesLen; i++) {
+                entry = adb_ncRunInstancesType_get_instances_at(input, env, i);
+                uuid = adb_runInstancesEntryType_get_uuid(entry, env);
+                instanceId = adb_runInstancesEntryType_get_instanceId(entry, env);
+
+                bzero(&netparams, sizeof(netConfig));
+                net_type = adb_runInstancesEntryType_get_netParams(entry, env);
+                netparams.vlan = adb_netConfigType_get_vlan(net_type, env);
+                netparams.networkIndex = adb_netConfigType_get_networkIndex(net_type, env);
+                snprintf(netparams.privateMac, ENET_ADDR_LEN, "%s", adb_netConfigType_get_privateMacAddress(net_type, env));
+                snprintf(netparams.privateIp, INET_ADDR_LEN, "%s", adb_netConfigType_get_privateIp(net_type, env));
+                snprintf(netparams.publicIp, INET_ADDR_LEN, "%s", adb_netConfigType_get_publicIp(net_type, env));
+                snprintf(netparams.interfaceId, ENI_ID_LEN, "%s", adb_netConfigType_get_interfaceId(net_type, env));
+                netparams.device = adb_netConfigType_get_device(net_type, env);
+                if (!adb_netConfigType_is_attachmentId_nil(net_type, env))  // vpc
+                    euca_strncpy(netparams.attachmentId, adb_netConfigType_get_attachmentId(net_type, env), ENI_ATTACHMENT_ID_LEN);
+
+                outInst = NULL;
+                if ((error = doRunInstance(&meta, uuid, instanceId, reservationId, &params, imageId, imageURL, kernelId, kernelURL, ramdiskId, ramdiskURL,
+                                           ownerId, accountId, keyName, &netparams, userData, credential, launchIndex, platform, expiryTime, groupNames,
+                                           groupNamesSize, rootDirective, groupIds, groupIdsSize, secNetCfgs, secNetCfgsLen, &outInst)) != EUCA_OK) {
+                    LOGERROR("[%s] failed error=%d\n", instanceId, error);
+                    continue;
+                }
+
+                instance = adb_instanceType_create(env);
+                copy_instance_to_adb(instance, env, outInst);   // copy all values outInst->instance
+                adb_ncRunInstancesResponseType_add_instances(output, env, instance);
+                started++;
+            }
+
+            unset_corrid(corr_id);
+
+            LOGINFO("[%s] started %d of %d instance(s)\n", reservationId, started, instancesLen);
+            error = ((started > 0) ? EUCA_OK : EUCA_ERROR);
+
+            // the instances that failed to start are missing from the response, which is a success otherwise
+            adb_ncRunInstancesResponseType_set_return(output, env, AXIS2_TRUE);
+            adb_ncRunInstancesResponseType_set_correlationId(output, env, meta.correlationId);
+            adb_ncRunInstancesResponseType_set_userId(output, env, meta.userId);
+        }
+
+        EUCA_FREE(groupIds);
+        EUCA_FREE(groupNames);
+
+        // set response to output
+        adb_ncRunInstancesResponse_set_ncRunInstancesResponse(response, env, output);
+    }
+    pthread_mutex_unlock(&ncHandlerLock);
+    nc_update_message_stats("RunInstances", (long)(time_ms() - call_time), error);
+    return (response);
+}
+
 //!
 //! Unmarshals, executes, responds to the describe instance request.
 //!
@@ -650,7 +826,12 @@ adb_ncDescribeInstancesResponse_t *ncDescribeInstancesMarshal(adb_ncDescribeInst
     int error = EUCA_OK;
     int instIdsLen = 0;
     int outInstsLen = 0;
+    int liveIdsLen = 0;
     char **instIds = NULL;
+    char **liveIds = NULL;
+    boolean delta = FALSE;
+    long long sinceGeneration = 0;
+    long long generation = 0;
     ncMetadata meta = { 0 };
     ncInstance **outInsts = NULL;
     adb_instanceType_t *instance = NULL;
@@ -673,11 +854,19 @@ adb_ncDescribeInstancesResponse_t *ncDescribeInstancesMarshal(adb_ncDescribeInst
             for (i = 0; i < instIdsLen; i++) {
                 instIds[i] = adb_ncDescribeInstancesType_get_instanceIds_at(input, env, i);
             }
+            // absent from requests sent by older clients, in which case it reads as 0 (full list)
+            sinceGeneration = (long long)adb_ncDescribeInstancesType_get_sinceGeneration(input, env);
 
             // do it
             EUCA_MESSAGE_UNMARSHAL(ncDescribeInstancesType, input, (&meta));
             threadCorrelationId *corr_id = set_corrid(meta.correlationId);
-            if ((error = doDescribeInstances(&meta, instIds, instIdsLen, &outInsts, &outInstsLen)) != EUCA_OK) {
+            if (instIdsLen == 0) {
+                error = doDescribeInstancesSince(&meta, sinceGeneration, &outInsts, &outInstsLen, &generation, &delta, &liveIds, &liveIdsLen);
+            } else {
+                error = doDescribeInstances(&meta, instIds, instIdsLen, &outInsts, &outInstsLen);
+            }
+
+            if (error != EUCA_OK) {
                 LOGERROR("failed error=%d\n", error);
                 adb_ncDescribeInstancesResponseType_set_return(output, env, AXIS2_FALSE);
             } else {
@@ -685,6 +874,15 @@ adb_ncDescribeInstancesResponse_t *ncDescribeInstancesMarshal(adb_ncDescribeInst
                 adb_ncDescribeInstancesResponseType_set_return(output, env, AXIS2_TRUE);
                 adb_ncDescribeInstancesResponseType_set_correlationId(output, env, meta.correlationId);
                 adb_ncDescribeInstancesResponseType_set_userId(output, env, meta.userId);
+                if (generation) {
+                    adb_ncDescribeInstancesResponseType_set_generation(output, env, (int64_t) generation);
+                    adb_ncDescribeInstancesResponseType_set_delta(output, env, ((delta) ? (AXIS2_TRUE) : (AXIS2_FALSE)));
+                }
+                for (i = 0; i < liveIdsLen; i++) {
+                    adb_ncDescribeInstancesResponseType_add_liveInstanceIds(output, env, liveIds[i]);
+                    EUCA_FREE(liveIds[i]);
+                }
+                EUCA_FREE(liveIds);
 
                 // set operation-specific fields in output
                 for (i = 0; i < outInstsLen; i++) {
@@ -1664,6 +1862,59 @@ adb_ncModifyNodeResponse_t *ncModifyNodeMarshal(adb_ncModifyNode_t * ncModifyNod
     return (response);
 }
 
+//!
+//! Unmarshals, executes, responds to the image prefetch request.
+//!
+//! @param[in] ncPrefetchImages a pointer to the image prefetch request parameters
+//! @param[in] env pointer to the AXIS2 environment structure
+//!
+//! @return a pointer to the request's response structure
+//!
+adb_ncPrefetchImagesResponse_t *ncPrefetchImagesMarshal(adb_ncPrefetchImages_t * ncPrefetchImages, const axutil_env_t * env)
+{
+    int error = EUCA_OK;
+    ncMetadata meta = { 0 };
+    virtualMachine params = { 0 };
+    adb_ncPrefetchImagesType_t *input = NULL;
+    adb_ncPrefetchImagesResponse_t *response = NULL;
+    adb_ncPrefetchImagesResponseType_t *output = NULL;
+    long long call_time = time_ms();
+
+    pthread_mutex_lock(&ncHandlerLock);
+    {
+        input = adb_ncPrefetchImages_get_ncPrefetchImages(ncPrefetchImages, env);
+        response = adb_ncPrefetchImagesResponse_create(env);
+        output = adb_ncPrefetchImagesResponseType_create(env);
+
+        // get operation-specific fields from input
+        copy_vm_type_from_adb(&params, adb_ncPrefetchImagesType_get_instanceType(input, env), env);
+
+        // do it
+        EUCA_MESSAGE_UNMARSHAL(ncPrefetchImagesType, input, (&meta));
+
+        threadCorrelationId *corr_id = set_corrid(meta.correlationId);
+        error = doPrefetchImages(&meta, &params);
+        unset_corrid(corr_id);
+        if (error != EUCA_OK) {
+            LOGERROR("failed error=%d\n", error);
+            adb_ncPrefetchImagesResponseType_set_return(output, env, AXIS2_FALSE);
+        } else {
+            // set standard fields in output
+            adb_ncPrefetchImagesResponseType_set_return(output, env, AXIS2_TRUE);
+            adb_ncPrefetchImagesResponseType_set_correlationId(output, env, meta.correlationId);
+            adb_ncPrefetchImagesResponseType_set_userId(output, env, meta.userId);
+            // no operation-specific fields in output
+        }
+
+        // set response to output
+        adb_ncPrefetchImagesResponse_set_ncPrefetchImagesResponse(response, env, output);
+    }
+    pthread_mutex_unlock(&ncHandlerLock);
+
+    nc_update_message_stats("PrefetchImages", (long)(time_ms() - call_time), error);
+    return (response);
+}
+
 //!
 //! Unmarshals, executes, responds to the instance migration request.
 //!
@@ -86,6 +86,7 @@
 #include <limits.h>
 #include <assert.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl, ensure_...
@@ -101,6 +102,7 @@
 #include "storage-windows.h"
 #include "backing.h"
 #include "vbr.h"
+#include "peer.h"
 #include <ebs_utils.h>
 #include "xml.h"
 
@@ -166,6 +168,10 @@ static sem *disk_sem = NULL;
 
 static bunchOfInstances **instances = NULL;
 
+static pthread_mutex_t cache_images_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char cache_images[EUCA_MAX_CACHED_IMAGES][IMAGE_ID_LEN] = { {0} };  //!< images found in the cache by the last refresh
+static int cache_images_len = 0;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -281,6 +287,84 @@ int check_backing_store(bunchOfInstances ** global_instances)
     return (EUCA_OK);
 }
 
+//!
+//! Starts the background reclaimer of the cache blobstore, which keeps the cache
+//! between the given watermarks so that instance launches rarely have to purge
+//! it themselves. The work blobstore is never purged, so it gets no reclaimer.
+//!
+//! @param[in] high_pct percentage of the cache size above which purging starts
+//! @param[in] low_pct percentage of the cache size down to which purging continues
+//!
+//! @return EUCA_OK on success or if there is no cache, or the error code of
+//!         blobstore_reclaimer_start() on failure
+//!
+//! @pre init_backing_store() and check_backing_store() must have succeeded.
+//!
+int start_backing_reclaimer(int high_pct, int low_pct)
+{
+    int rc = EUCA_OK;
+
+    if (cache_bs == NULL)
+        return (EUCA_OK);
+
+    if ((rc = blobstore_reclaimer_start(cache_bs, high_pct, low_pct, BLOBSTORE_RECLAIM_INTERVAL_SEC)) != EUCA_OK) {
+        LOGERROR("failed to start the cache reclaimer: %s\n", blobstore_get_error_str(blobstore_get_error()));
+    }
+    return (rc);
+}
+
+//!
+//! Starts serving the images in the cache blobstore to the other NCs of the
+//! cluster, so they can fetch them from this node rather than from object
+//! storage. If the server is already running, it is moved to the new address.
+//!
+//! @param[in] ip address of this node that the other nodes reach it on
+//! @param[in] port TCP port to serve on
+//!
+//! @return EUCA_OK on success or if there is no cache, or the error code of
+//!         peer_server_start() on failure
+//!
+//! @pre init_backing_store() and check_backing_store() must have succeeded.
+//!
+int start_backing_peer_server(const char *ip, int port)
+{
+    if (cache_bs == NULL)
+        return (EUCA_OK);
+    peer_server_stop();
+    return (peer_server_start(cache_bs, ip, port));
+}
+
+//!
+//! Sets the other NCs of the cluster, which are the only ones served cached images
+//!
+//! @param[in] ips addresses of the nodes
+//! @param[in] count number of addresses
+//!
+//! @return the result of peer_server_set_peers()
+//!
+int set_backing_peers(char **ips, int count)
+{
+    return (peer_server_set_peers(ips, count));
+}
+
+//!
+//! Retrieves the counters of the cache reclaimer for the stats sensors.
+//!
+//! @param[out] cache_stats pointer to the counters to fill in
+//! @param[in]  reset set to TRUE to start a new interval
+//!
+//! @return EUCA_OK on success, EUCA_NOT_FOUND_ERROR if the cache has no
+//!         reclaimer, or EUCA_INVALID_ERROR if cache_stats is NULL
+//!
+int stat_backing_reclaimer(blobstore_reclaim_stats * cache_stats, boolean reset)
+{
+    if (cache_stats == NULL)
+        return (EUCA_INVALID_ERROR);
+    if (cache_bs == NULL)
+        return (EUCA_NOT_FOUND_ERROR);
+    return (blobstore_reclaimer_stats(cache_bs, cache_stats, reset));
+}
+
 //!
 //! Stats the backing blobstores (work and cache) created under the given path.
 //!
@@ -889,6 +973,123 @@ out:
     return (ret);
 }
 
+//!
+//! Brings the images (EMI, EKI, ERI) named in a VBR into the cache ahead of
+//! a launch, so that an instance started from them later finds them there.
+//! This does not take the disk semaphore, so it never holds up instances
+//! being launched; a launch that needs an image being prefetched simply
+//! waits on the blob lock for the download in progress.
+//!
+//! @param[in] vm pointer to the virtual machine whose VBR has been parsed
+//! @param[in] bail_flag pointer to a flag that, once set, aborts downloads
+//!
+//! @return EUCA_OK on success, EUCA_UNSUPPORTED_ERROR if the node has no
+//!         cache, EUCA_INVALID_ERROR if nothing in the VBR can be cached,
+//!         or the error code of art_implement_tree() on failure
+//!
+//! @pre vbr_parse() must have been called on the VBR.
+//!
+int prefetch_backing(virtualMachine * vm, boolean * bail_flag)
+{
+    int rc = EUCA_OK;
+    artifact *sentinel = NULL;
+
+    if (cache_bs == NULL)
+        return (EUCA_UNSUPPORTED_ERROR);
+
+    if ((sentinel = vbr_alloc_prefetch_tree(vm, bail_flag)) == NULL)
+        return (EUCA_INVALID_ERROR);
+
+    // the cache doubles as the work blobstore, so nothing gets built outside of it
+    rc = art_implement_tree(sentinel, cache_bs, cache_bs, NULL, INSTANCE_PREP_TIMEOUT_USEC);
+    art_free(sentinel);
+    return (rc);
+}
+
+//!
+//! Rescans the cache blobstore for the images (EMI, EKI, ERI) it holds, so
+//! that stat_backing_cache_images() can report them without touching the
+//! blobstore. Should more images be cached than can be reported, the most
+//! recently used ones are kept.
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the cache could not be searched
+//!
+int refresh_backing_cache_images(void)
+{
+    int i = 0;
+    int len = 0;
+    int found = 0;
+    int oldest = 0;
+    int images_len = 0;
+    char *dash = NULL;
+    char images[EUCA_MAX_CACHED_IMAGES][IMAGE_ID_LEN] = { {0} };
+    time_t accessed[EUCA_MAX_CACHED_IMAGES] = { 0 };
+    blockblob_meta *bm = NULL;
+    blockblob_meta *next = NULL;
+    blockblob_meta *matches = NULL;
+
+    if (cache_bs == NULL)
+        return (EUCA_OK);
+
+    // cached artifacts are named <image ID>-<digest hash> (see art_gen_id())
+    if (blobstore_search(cache_bs, "^e[mkr]i-[0-9a-fA-F]+-", &matches) < 0) {
+        LOGWARN("failed to search the cache for images\n");
+        return (EUCA_ERROR);
+    }
+
+    for (bm = matches; bm; bm = next) {
+        next = bm->next;
+        if (((dash = strchr(bm->id + 4, '-')) != NULL) && ((len = (dash - bm->id)) < IMAGE_ID_LEN)) {
+            for (i = 0, found = -1, oldest = 0; i < images_len; i++) {
+                if (!strncmp(images[i], bm->id, len) && (images[i][len] == '\0'))
+                    found = i;
+                if (accessed[i] < accessed[oldest])
+                    oldest = i;
+            }
+
+            if (found >= 0) {
+                if (bm->last_accessed > accessed[found])
+                    accessed[found] = bm->last_accessed;
+            } else if ((images_len < EUCA_MAX_CACHED_IMAGES) || (bm->last_accessed > accessed[oldest])) {
+                i = ((images_len < EUCA_MAX_CACHED_IMAGES) ? (images_len++) : (oldest));
+                euca_strncpy(images[i], bm->id, (len + 1));
+                accessed[i] = bm->last_accessed;
+            }
+        }
+        EUCA_FREE(bm);
+    }
+
+    pthread_mutex_lock(&cache_images_mutex);
+    {
+        memcpy(cache_images, images, sizeof(images));
+        cache_images_len = images_len;
+    }
+    pthread_mutex_unlock(&cache_images_mutex);
+    return (EUCA_OK);
+}
+
+//!
+//! Copies out the list of cached images found by the last call to
+//! refresh_backing_cache_images().
+//!
+//! @param[out] images array receiving the image IDs
+//! @param[in] max number of entries in the images array
+//!
+//! @return the number of image IDs copied into images
+//!
+int stat_backing_cache_images(char images[][IMAGE_ID_LEN], int max)
+{
+    int i = 0;
+
+    pthread_mutex_lock(&cache_images_mutex);
+    {
+        for (i = 0; (i < cache_images_len) && (i < max); i++)
+            euca_strncpy(images[i], cache_images[i], IMAGE_ID_LEN);
+    }
+    pthread_mutex_unlock(&cache_images_mutex);
+    return (i);
+}
+
 //!
 //! Do a clone of an instance backing store to another location.
 //!
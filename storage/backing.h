@@ -123,10 +123,17 @@
 int check_backing_store(bunchOfInstances ** global_instances);
 int stat_backing_store(const char *conf_instances_path, blobstore_meta * work_meta, blobstore_meta * cache_meta);
 int init_backing_store(const char *conf_instances_path, unsigned int conf_work_size_mb, unsigned int conf_cache_size_mb);
+int start_backing_reclaimer(int high_pct, int low_pct);
+int start_backing_peer_server(const char *ip, int port);
+int set_backing_peers(char **ips, int count);
+int stat_backing_reclaimer(blobstore_reclaim_stats * cache_stats, boolean reset);
 int save_instance_struct(const ncInstance * instance);
 ncInstance *load_instance_struct(const char *instanceId);
 
 int create_instance_backing(ncInstance * instance, boolean is_migration_dest);
+int prefetch_backing(virtualMachine * vm, boolean * bail_flag);
+int refresh_backing_cache_images(void);
+int stat_backing_cache_images(char images[][IMAGE_ID_LEN], int max);
 int clone_bundling_backing(ncInstance * instance, const char *filePrefix, char *blockPath);
 int destroy_instance_backing(ncInstance * instance, boolean do_destroy_files);
 
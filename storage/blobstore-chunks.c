@@ -0,0 +1,616 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file storage/blobstore-chunks.c
+//! Implements the table of content-addressed chunks shared by the blobs of a
+//! blobstore.
+//!
+//! The table holds every distinct chunk used by the blobs of a store, keyed by
+//! the SHA-1 of its content, along with the pack slot that stores it and the
+//! number of blob chunks that use it. It also tracks which slots of which packs
+//! are taken, so that new chunks can be placed in the slots that no blob uses
+//! anymore. The table is not persisted: the blobstore builds it from the chunk
+//! lists of the blobs that exist, one line per chunk:
+//!
+//!     <40 hex digits of SHA-1> <pack number> <slot>
+//!
+//! with a pack number of BLOBSTORE_CHUNK_ZERO for chunks of zeros, which are
+//! mapped to the zero target rather than stored.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <eucalyptus.h>
+#include <misc.h>
+
+#include "blobstore-chunks.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define CHUNKS_INITIAL_TABLE_SIZE               1024    //!< initial number of table slots, a power of two
+#define CHUNKS_INITIAL_PACKS                      16    //!< initial number of packs covered by the occupancy arrays
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static unsigned int chunks_bucket(const unsigned char *hash, int table_size);
+static blobstore_chunk *chunks_lookup(blobstore_chunk * table, int table_size, const unsigned char *hash);
+static int chunks_grow_table(blobstore_chunks * chunks);
+static int chunks_cover_pack(blobstore_chunks * chunks, int pack);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Picks the first table slot to probe for a hash. SHA-1 output is uniform, so
+//! its first bytes make a good bucket number as they are.
+//!
+//! @param[in] hash chunk hash
+//! @param[in] table_size number of table slots, a power of two
+//!
+//! @return the slot number
+//!
+static unsigned int chunks_bucket(const unsigned char *hash, int table_size)
+{
+    unsigned int b = (hash[0] << 24) | (hash[1] << 16) | (hash[2] << 8) | hash[3];
+    return (b & (table_size - 1));
+}
+
+//!
+//! Finds the table slot of a hash, or the free slot where it would go
+//!
+//! @param[in] table open-addressed hash table
+//! @param[in] table_size number of table slots, a power of two
+//! @param[in] hash chunk hash
+//!
+//! @return pointer to the slot, never NULL as long as the table is not full
+//!
+static blobstore_chunk *chunks_lookup(blobstore_chunk * table, int table_size, const unsigned char *hash)
+{
+    unsigned int i = chunks_bucket(hash, table_size);
+
+    while (table[i].used && memcmp(table[i].ref.hash, hash, BLOBSTORE_CHUNK_HASH_LEN))
+        i = (i + 1) & (table_size - 1);
+    return (table + i);
+}
+
+//!
+//! Doubles the hash table, rehashing every entry
+//!
+//! @param[in] chunks the chunk table
+//!
+//! @return 0 on success or -1 if out of memory
+//!
+static int chunks_grow_table(blobstore_chunks * chunks)
+{
+    int new_size = chunks->table_size * 2;
+    blobstore_chunk *new_table = EUCA_ZALLOC(new_size, sizeof(blobstore_chunk));
+
+    if (new_table == NULL)
+        return (-1);
+    for (int i = 0; i < chunks->table_size; i++) {
+        if (chunks->table[i].used)
+            *chunks_lookup(new_table, new_size, chunks->table[i].ref.hash) = chunks->table[i];
+    }
+    EUCA_FREE(chunks->table);
+    chunks->table = new_table;
+    chunks->table_size = new_size;
+    return (0);
+}
+
+//!
+//! Makes sure the occupancy arrays cover a pack number
+//!
+//! @param[in] chunks the chunk table
+//! @param[in] pack pack number
+//!
+//! @return 0 on success or -1 if the number is out of range or out of memory
+//!
+static int chunks_cover_pack(blobstore_chunks * chunks, int pack)
+{
+    int new_packs = chunks->num_packs;
+    unsigned char *new_slot_used = NULL;
+    char *new_pack_exists = NULL;
+
+    if ((pack < 0) || (pack >= BLOBSTORE_CHUNK_MAX_PACKS))
+        return (-1);
+    if (pack < chunks->num_packs)
+        return (0);
+
+    while (new_packs <= pack)
+        new_packs *= 2;
+    if ((new_slot_used = EUCA_REALLOC(chunks->slot_used, new_packs * BLOBSTORE_CHUNKS_PER_PACK, sizeof(unsigned char))) == NULL)
+        return (-1);
+    chunks->slot_used = new_slot_used;
+    if ((new_pack_exists = EUCA_REALLOC(chunks->pack_exists, new_packs, sizeof(char))) == NULL)
+        return (-1);
+    chunks->pack_exists = new_pack_exists;
+
+    bzero(chunks->slot_used + (chunks->num_packs * BLOBSTORE_CHUNKS_PER_PACK), (new_packs - chunks->num_packs) * BLOBSTORE_CHUNKS_PER_PACK);
+    bzero(chunks->pack_exists + chunks->num_packs, (new_packs - chunks->num_packs));
+    chunks->num_packs = new_packs;
+    return (0);
+}
+
+//!
+//! Allocates an empty chunk table
+//!
+//! @return pointer to the table, to be freed with blobstore_chunks_free(), or NULL if out of memory
+//!
+blobstore_chunks *blobstore_chunks_alloc(void)
+{
+    blobstore_chunks *chunks = EUCA_ZALLOC(1, sizeof(blobstore_chunks));
+
+    if (chunks == NULL)
+        return (NULL);
+    chunks->table_size = CHUNKS_INITIAL_TABLE_SIZE;
+    chunks->num_packs = CHUNKS_INITIAL_PACKS;
+    chunks->table = EUCA_ZALLOC(chunks->table_size, sizeof(blobstore_chunk));
+    chunks->slot_used = EUCA_ZALLOC(chunks->num_packs * BLOBSTORE_CHUNKS_PER_PACK, sizeof(unsigned char));
+    chunks->pack_exists = EUCA_ZALLOC(chunks->num_packs, sizeof(char));
+    if ((chunks->table == NULL) || (chunks->slot_used == NULL) || (chunks->pack_exists == NULL)) {
+        blobstore_chunks_free(chunks);
+        return (NULL);
+    }
+    return (chunks);
+}
+
+//!
+//! Frees a chunk table
+//!
+//! @param[in] chunks the chunk table, may be NULL
+//!
+void blobstore_chunks_free(blobstore_chunks * chunks)
+{
+    if (chunks == NULL)
+        return;
+    EUCA_FREE(chunks->table);
+    EUCA_FREE(chunks->slot_used);
+    EUCA_FREE(chunks->pack_exists);
+    EUCA_FREE(chunks);
+}
+
+//!
+//! Accounts for one chunk of a blob. The first location recorded for a hash is
+//! the one handed out by blobstore_chunks_find(); the slot of every reference
+//! is marked as taken, whatever it holds.
+//!
+//! @param[in] chunks the chunk table
+//! @param[in] ref the chunk and where the blob has it
+//!
+//! @return 0 on success or -1 if the pack number is out of range or out of memory
+//!
+int blobstore_chunks_add(blobstore_chunks * chunks, const blobstore_chunk_ref * ref)
+{
+    blobstore_chunk *entry = NULL;
+
+    if (ref->pack == BLOBSTORE_CHUNK_ZERO)
+        return (0);                    // zeros are not stored anywhere
+    if ((ref->slot < 0) || (ref->slot >= BLOBSTORE_CHUNKS_PER_PACK) || (chunks_cover_pack(chunks, ref->pack) == -1))
+        return (-1);
+
+    chunks->pack_exists[ref->pack] = TRUE;
+    chunks->slot_used[(ref->pack * BLOBSTORE_CHUNKS_PER_PACK) + ref->slot] = TRUE;
+
+    if (((chunks->num_chunks + 1) * 2 > chunks->table_size) && (chunks_grow_table(chunks) == -1))
+        return (-1);
+    entry = chunks_lookup(chunks->table, chunks->table_size, ref->hash);
+    if (!entry->used) {
+        entry->used = TRUE;
+        entry->ref = *ref;
+        chunks->num_chunks++;
+    }
+    entry->refs++;
+    return (0);
+}
+
+//!
+//! Looks up a chunk by the hash of its content
+//!
+//! @param[in] chunks the chunk table
+//! @param[in] hash hash of the content
+//!
+//! @return the table entry, or NULL if no blob uses such a chunk
+//!
+const blobstore_chunk *blobstore_chunks_find(const blobstore_chunks * chunks, const unsigned char *hash)
+{
+    const blobstore_chunk *entry = chunks_lookup(chunks->table, chunks->table_size, hash);
+    return ((entry->used) ? (entry) : (NULL));
+}
+
+//!
+//! Records that a pack blob exists, so that its free slots are handed out
+//!
+//! @param[in] chunks the chunk table
+//! @param[in] pack pack number
+//!
+//! @return 0 on success or -1 if the pack number is out of range or out of memory
+//!
+int blobstore_chunks_pack_exists(blobstore_chunks * chunks, int pack)
+{
+    if (chunks_cover_pack(chunks, pack) == -1)
+        return (-1);
+    chunks->pack_exists[pack] = TRUE;
+    return (0);
+}
+
+//!
+//! Picks the slot for a new chunk: the lowest free slot of an existing pack or,
+//! if all existing packs are full, slot 0 of the lowest pack number not in use
+//!
+//! @param[in] chunks the chunk table
+//! @param[out] pack pack number
+//! @param[out] slot slot within the pack
+//!
+//! @return 0 if the pack exists, 1 if the pack must be created or -1 if no pack number is left
+//!
+int blobstore_chunks_free_slot(const blobstore_chunks * chunks, int *pack, int *slot)
+{
+    int new_pack = -1;
+
+    for (int p = 0; p < chunks->num_packs; p++) {
+        if (!chunks->pack_exists[p]) {
+            if (new_pack == -1)
+                new_pack = p;
+            continue;
+        }
+        for (int s = 0; s < BLOBSTORE_CHUNKS_PER_PACK; s++) {
+            if (!chunks->slot_used[(p * BLOBSTORE_CHUNKS_PER_PACK) + s]) {
+                *pack = p;
+                *slot = s;
+                return (0);
+            }
+        }
+    }
+
+    if (new_pack == -1)
+        new_pack = chunks->num_packs;
+    if (new_pack >= BLOBSTORE_CHUNK_MAX_PACKS)
+        return (-1);
+    *pack = new_pack;
+    *slot = 0;
+    return (1);
+}
+
+//!
+//! Tells whether any blob uses a slot of a pack or, with a slot of -1, any slot of the pack
+//!
+//! @param[in] chunks the chunk table
+//! @param[in] pack pack number
+//! @param[in] slot slot within the pack, or -1
+//!
+//! @return TRUE or FALSE
+//!
+int blobstore_chunks_pack_is_used(const blobstore_chunks * chunks, int pack, int slot)
+{
+    if ((pack < 0) || (pack >= chunks->num_packs))
+        return (FALSE);
+    if (slot >= 0)
+        return ((slot < BLOBSTORE_CHUNKS_PER_PACK) && chunks->slot_used[(pack * BLOBSTORE_CHUNKS_PER_PACK) + slot]);
+    for (int s = 0; s < BLOBSTORE_CHUNKS_PER_PACK; s++) {
+        if (chunks->slot_used[(pack * BLOBSTORE_CHUNKS_PER_PACK) + s])
+            return (TRUE);
+    }
+    return (FALSE);
+}
+
+//!
+//! Formats a chunk reference as a line of a chunk list (without the newline)
+//!
+//! @param[in] ref the reference
+//! @param[out] line buffer for the line
+//! @param[in] line_size size of the buffer, at least BLOBSTORE_CHUNK_LINE_LEN
+//!
+//! @return 0 on success or -1 if the buffer is too small
+//!
+int blobstore_chunks_format(const blobstore_chunk_ref * ref, char *line, int line_size)
+{
+    char hex[(BLOBSTORE_CHUNK_HASH_LEN * 2) + 1] = "";
+
+    for (int i = 0; i < BLOBSTORE_CHUNK_HASH_LEN; i++)
+        snprintf(hex + (i * 2), 3, "%02x", ref->hash[i]);
+    if (snprintf(line, line_size, "%s %d %d", hex, ref->pack, ref->slot) >= line_size)
+        return (-1);
+    return (0);
+}
+
+//!
+//! Parses a line of a chunk list
+//!
+//! @param[in] line the line, with or without the newline
+//! @param[out] ref the reference
+//!
+//! @return 0 on success or -1 if the line is malformed
+//!
+int blobstore_chunks_parse(const char *line, blobstore_chunk_ref * ref)
+{
+    char hex[(BLOBSTORE_CHUNK_HASH_LEN * 2) + 1] = "";
+    unsigned int byte = 0;
+
+    if ((sscanf(line, "%40s %d %d", hex, &(ref->pack), &(ref->slot)) != 3) || (strlen(hex) != (BLOBSTORE_CHUNK_HASH_LEN * 2)))
+        return (-1);
+    for (int i = 0; i < BLOBSTORE_CHUNK_HASH_LEN; i++) {
+        if (sscanf(hex + (i * 2), "%2x", &byte) != 1)
+            return (-1);
+        ref->hash[i] = (unsigned char)byte;
+    }
+    if ((ref->pack != BLOBSTORE_CHUNK_ZERO) && ((ref->pack < 0) || (ref->pack >= BLOBSTORE_CHUNK_MAX_PACKS) || (ref->slot < 0) || (ref->slot >= BLOBSTORE_CHUNKS_PER_PACK)))
+        return (-1);
+    return (0);
+}
+
+//!
+//! Coalesces the chunks of a blob into runs that can each be mapped with a
+//! single device mapper target: consecutive chunks of zeros, or consecutive
+//! chunks in consecutive slots of the same pack
+//!
+//! @param[in] refs the chunks of the blob, in order
+//! @param[in] num_refs number of chunks
+//! @param[out] pextents newly allocated array of runs, which the caller must free
+//!
+//! @return number of runs, or -1 if out of memory
+//!
+int blobstore_chunks_extents(const blobstore_chunk_ref * refs, int num_refs, blobstore_chunk_extent ** pextents)
+{
+    int n = 0;
+    blobstore_chunk_extent *extents = EUCA_ZALLOC(MAX(num_refs, 1), sizeof(blobstore_chunk_extent));
+
+    if (extents == NULL)
+        return (-1);
+    for (int i = 0; i < num_refs; i++) {
+        blobstore_chunk_extent *last = (n > 0) ? (extents + n - 1) : (NULL);
+        if (last && (last->pack == refs[i].pack)
+            && ((refs[i].pack == BLOBSTORE_CHUNK_ZERO) || (refs[i].slot == (last->first_slot + last->num_chunks)))) {
+            last->num_chunks++;
+            continue;
+        }
+        extents[n].first_chunk = i;
+        extents[n].num_chunks = 1;
+        extents[n].pack = refs[i].pack;
+        extents[n].first_slot = (refs[i].pack == BLOBSTORE_CHUNK_ZERO) ? (0) : (refs[i].slot);
+        n++;
+    }
+    *pextents = extents;
+    return (n);
+}
+
+#ifdef _UNIT_TEST
+//!
+//! Checks the chunk table, chunk list lines and run coalescing
+//!
+//! @param[in] argc
+//! @param[in] argv
+//!
+//! @return 0 if all tests pass, 1 otherwise
+//!
+int main(int argc, char *argv[])
+{
+    int errors = 0;
+    int pack = 0;
+    int slot = 0;
+    char line[BLOBSTORE_CHUNK_LINE_LEN] = "";
+    blobstore_chunk_ref ref = { {0} };
+    blobstore_chunk_ref parsed = { {0} };
+    blobstore_chunk_ref refs[8] = { {{0}} };
+    blobstore_chunk_extent *extents = NULL;
+    blobstore_chunks *chunks = NULL;
+    const blobstore_chunk *found = NULL;
+
+#define CHECK(_cond)                                                      \
+{                                                                         \
+    if (!(_cond)) {                                                       \
+        printf("FAILED at line %d: %s\n", __LINE__, #_cond);             \
+        errors++;                                                         \
+    }                                                                     \
+}
+
+    printf("chunk list lines survive a round trip\n");
+    for (int i = 0; i < BLOBSTORE_CHUNK_HASH_LEN; i++)
+        ref.hash[i] = (unsigned char)(i * 13 + 1);
+    ref.pack = 12;
+    ref.slot = 255;
+    CHECK(blobstore_chunks_format(&ref, line, sizeof(line)) == 0);
+    CHECK(blobstore_chunks_parse(line, &parsed) == 0);
+    CHECK(!memcmp(&ref, &parsed, sizeof(ref)));
+    CHECK(blobstore_chunks_parse("0102 1 1", &parsed) == -1);
+    CHECK(blobstore_chunks_parse("0000000000000000000000000000000000000000 1 256", &parsed) == -1);
+    CHECK(blobstore_chunks_parse("0000000000000000000000000000000000000000 -1 0\n", &parsed) == 0);
+    CHECK(blobstore_chunks_format(&ref, line, 16) == -1);
+
+    printf("the table counts references and hands out free slots\n");
+    chunks = blobstore_chunks_alloc();
+    CHECK(chunks != NULL);
+    CHECK(blobstore_chunks_free_slot(chunks, &pack, &slot) == 1);
+    CHECK((pack == 0) && (slot == 0));
+    CHECK(blobstore_chunks_pack_exists(chunks, 0) == 0);
+    for (int i = 0; i < 5000; i++) {   // forces the table to grow a few times
+        CHECK(blobstore_chunks_free_slot(chunks, &pack, &slot) >= 0);
+        bzero(&ref, sizeof(ref));
+        memcpy(ref.hash, &i, sizeof(i));
+        ref.hash[19] = 0xaa;
+        ref.pack = pack;
+        ref.slot = slot;
+        CHECK(blobstore_chunks_pack_exists(chunks, pack) == 0);
+        CHECK(blobstore_chunks_add(chunks, &ref) == 0);
+        CHECK(blobstore_chunks_add(chunks, &ref) == 0);
+    }
+    CHECK(chunks->num_chunks == 5000);
+    CHECK(blobstore_chunks_free_slot(chunks, &pack, &slot) == 0);
+    CHECK((pack == (5000 / BLOBSTORE_CHUNKS_PER_PACK)) && (slot == (5000 % BLOBSTORE_CHUNKS_PER_PACK)));
+    bzero(&ref, sizeof(ref));
+    memcpy(ref.hash, &(int) { 4321 }, sizeof(int));
+    ref.hash[19] = 0xaa;
+    found = blobstore_chunks_find(chunks, ref.hash);
+    CHECK((found != NULL) && (found->refs == 2) && (found->ref.pack == (4321 / BLOBSTORE_CHUNKS_PER_PACK)) && (found->ref.slot == (4321 % BLOBSTORE_CHUNKS_PER_PACK)));
+    ref.hash[19] = 0xbb;
+    CHECK(blobstore_chunks_find(chunks, ref.hash) == NULL);
+    CHECK(blobstore_chunks_pack_is_used(chunks, 3, -1));
+    CHECK(!blobstore_chunks_pack_is_used(chunks, 30, -1));
+    blobstore_chunks_free(chunks);
+
+    printf("slots and packs that no blob uses are reused\n");
+    chunks = blobstore_chunks_alloc();
+    CHECK(blobstore_chunks_pack_exists(chunks, 0) == 0);
+    CHECK(blobstore_chunks_pack_exists(chunks, 2) == 0);
+    for (int s = 0; s < BLOBSTORE_CHUNKS_PER_PACK; s++) {
+        bzero(&ref, sizeof(ref));
+        ref.hash[0] = (unsigned char)s;
+        ref.pack = 0;
+        ref.slot = s;
+        if (s != 77)
+            CHECK(blobstore_chunks_add(chunks, &ref) == 0);
+    }
+    CHECK(blobstore_chunks_free_slot(chunks, &pack, &slot) == 0);
+    CHECK((pack == 0) && (slot == 77));
+    ref.slot = 77;
+    CHECK(blobstore_chunks_add(chunks, &ref) == 0);
+    CHECK(blobstore_chunks_free_slot(chunks, &pack, &slot) == 0);
+    CHECK((pack == 2) && (slot == 0));     // pack 2 exists but is empty
+    CHECK(blobstore_chunks_pack_exists(chunks, BLOBSTORE_CHUNK_MAX_PACKS) == -1);
+    blobstore_chunks_free(chunks);
+
+    printf("runs of chunks are coalesced\n");
+    int layout[8][2] = { {0, 4}, {0, 5}, {0, 6}, {-1, 0}, {-1, 0}, {1, 7}, {0, 7}, {0, 9} };
+    for (int i = 0; i < 8; i++) {
+        refs[i].pack = layout[i][0];
+        refs[i].slot = layout[i][1];
+    }
+    CHECK(blobstore_chunks_extents(refs, 8, &extents) == 5);
+    CHECK((extents[0].first_chunk == 0) && (extents[0].num_chunks == 3) && (extents[0].pack == 0) && (extents[0].first_slot == 4));
+    CHECK((extents[1].first_chunk == 3) && (extents[1].num_chunks == 2) && (extents[1].pack == BLOBSTORE_CHUNK_ZERO));
+    CHECK((extents[2].first_chunk == 5) && (extents[2].num_chunks == 1) && (extents[2].pack == 1) && (extents[2].first_slot == 7));
+    CHECK((extents[3].first_chunk == 6) && (extents[3].pack == 0) && (extents[3].first_slot == 7));
+    CHECK((extents[4].first_chunk == 7) && (extents[4].pack == 0) && (extents[4].first_slot == 9));
+    EUCA_FREE(extents);
+
+#undef CHECK
+
+    printf("%s\n", (errors == 0) ? "all tests passed" : "some tests FAILED");
+    return ((errors == 0) ? 0 : 1);
+}
+#endif /* _UNIT_TEST */
@@ -0,0 +1,192 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+#ifndef _INCLUDE_BLOBSTORE_CHUNKS_H_
+#define _INCLUDE_BLOBSTORE_CHUNKS_H_
+
+//!
+//! @file storage/blobstore-chunks.h
+//! Defines the table of content-addressed chunks that lets blobs of a blobstore
+//! share identical data. A deduplicated blob is cut into fixed-size chunks, each
+//! chunk is stored once in a slot of a 'pack' blob and the blob itself becomes a
+//! device mapper linear map of pack slots. The blob's chunk list, one line per
+//! chunk, is kept in its '.chunks' metadata file; the table is rebuilt from those
+//! lists, so it never disagrees with the blobs that actually exist.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define BLOBSTORE_CHUNK_SIZE                     (4 * 1024 * 1024)  //!< bytes in a chunk
+#define BLOBSTORE_CHUNK_BLOCKS                   (BLOBSTORE_CHUNK_SIZE / 512)   //!< 512-byte blocks in a chunk
+#define BLOBSTORE_CHUNK_HASH_LEN                   20   //!< bytes in a chunk hash (SHA-1)
+#define BLOBSTORE_CHUNKS_PER_PACK                 256   //!< slots in a pack blob, which is thus 1 GiB
+#define BLOBSTORE_CHUNK_PACK_PREFIX              "chunkpack-"   //!< IDs of pack blobs start with this
+#define BLOBSTORE_CHUNK_PACK_FORMAT              BLOBSTORE_CHUNK_PACK_PREFIX "%05d" //!< ID of a pack blob, by pack number
+#define BLOBSTORE_CHUNK_MAX_PACKS                100000 //!< pack numbers must fit the format above
+#define BLOBSTORE_CHUNK_ZERO                       -1   //!< pack number of chunks that hold nothing but zeros
+#define BLOBSTORE_CHUNK_LINE_LEN                   64   //!< room for one line of a chunk list
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Where one chunk of a blob is stored
+typedef struct _blobstore_chunk_ref {
+    unsigned char hash[BLOBSTORE_CHUNK_HASH_LEN];   //!< hash of the chunk's content
+    int pack;                          //!< number of the pack blob, or BLOBSTORE_CHUNK_ZERO
+    int slot;                          //!< slot within the pack
+} blobstore_chunk_ref;
+
+//! A run of chunks of a blob stored in consecutive slots of one pack (or all zeros)
+typedef struct _blobstore_chunk_extent {
+    int first_chunk;                   //!< index of the first chunk of the run in the blob
+    int num_chunks;                    //!< length of the run
+    int pack;                          //!< number of the pack blob, or BLOBSTORE_CHUNK_ZERO
+    int first_slot;                    //!< slot of the first chunk in the pack
+} blobstore_chunk_extent;
+
+//! Entry of the chunk table
+typedef struct _blobstore_chunk {
+    blobstore_chunk_ref ref;           //!< the chunk and its location
+    int refs;                          //!< number of blob chunks that use it
+    char used;                         //!< TRUE if the table slot is taken
+} blobstore_chunk;
+
+//! Table of the distinct chunks used by the blobs of a blobstore, with pack occupancy
+typedef struct _blobstore_chunks {
+    blobstore_chunk *table;            //!< open-addressed hash table, keyed by chunk hash
+    int table_size;                    //!< number of table slots, a power of two
+    int num_chunks;                    //!< number of distinct chunks in the table
+    unsigned char *slot_used;          //!< BLOBSTORE_CHUNKS_PER_PACK flags per pack
+    char *pack_exists;                 //!< one flag per pack, set for packs known to exist
+    int num_packs;                     //!< packs covered by the two arrays above
+} blobstore_chunks;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED PROTOTYPES                            |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+blobstore_chunks *blobstore_chunks_alloc(void);
+void blobstore_chunks_free(blobstore_chunks * chunks);
+int blobstore_chunks_add(blobstore_chunks * chunks, const blobstore_chunk_ref * ref);
+const blobstore_chunk *blobstore_chunks_find(const blobstore_chunks * chunks, const unsigned char *hash);
+int blobstore_chunks_pack_exists(blobstore_chunks * chunks, int pack);
+int blobstore_chunks_free_slot(const blobstore_chunks * chunks, int *pack, int *slot);
+int blobstore_chunks_pack_is_used(const blobstore_chunks * chunks, int pack, int slot);
+int blobstore_chunks_format(const blobstore_chunk_ref * ref, char *line, int line_size);
+int blobstore_chunks_parse(const char *line, blobstore_chunk_ref * ref);
+int blobstore_chunks_extents(const blobstore_chunk_ref * refs, int num_refs, blobstore_chunk_extent ** pextents);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                           STATIC INLINE PROTOTYPES                         |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                          STATIC INLINE IMPLEMENTATION                      |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#endif /* ! _INCLUDE_BLOBSTORE_CHUNKS_H_ */
@@ -0,0 +1,714 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file storage/blobstore-dm.c
+//! Implements the in-process device mapper backend of the blobstore.
+//!
+//! The 'dmsetup' backend in blobstore.c forks a child that runs the root
+//! wrapper that runs 'dmsetup' for every device in a clone, so a clone with a
+//! few snapshotted partitions costs a dozen processes, each of which opens the
+//! control node, checks the driver version, waits for udev and exits. When the
+//! process is allowed to issue device mapper ioctls itself (CAP_SYS_ADMIN),
+//! this backend does the same work over one control descriptor that is opened
+//! and verified once per process.
+//!
+//! All devices of one clone are set up as a unit by blobstore_dm_create(): the
+//! devices are first all created without tables, which reserves their names,
+//! and then, in the order given (dependencies first), each table is loaded and
+//! made live and the device node is created under BLOBSTORE_DM_DIR so that the
+//! tables that follow can refer to it. If any step fails, every device created
+//! by the call is removed again, in the reverse order, so a failed clone leaves
+//! nothing behind for the caller to clean up.
+//!
+//! Tables are accepted in the text format understood by 'dmsetup', one target
+//! per line ("<start> <length> <type> <parameters>"), and are marshaled into
+//! the dm_target_spec layout of the DM_TABLE_LOAD ioctl.
+//!
+//! Device nodes are created here because devices set up without a udev cookie
+//! are ignored by the device mapper udev rules; a node that udev did create
+//! (a symbolic link) is left alone.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <pwd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>             // major, minor
+#include <linux/dm-ioctl.h>
+
+#include <eucalyptus.h>
+#include <misc.h>
+#include <euca_string.h>
+
+#include "blobstore-dm.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define BLOBSTORE_DM_ALIGN                          8   //!< alignment of each dm_target_spec in a DM_TABLE_LOAD buffer
+#define BLOBSTORE_DM_REMOVE_RETRIES                 1   //!< same as the 'dmsetup' backend
+#define BLOBSTORE_DM_REMOVE_RETRY_USEC            100
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static pthread_once_t dm_control_once = PTHREAD_ONCE_INIT;
+static int dm_control_fd = -1;         //!< descriptor of BLOBSTORE_DM_CONTROL, -1 if ioctls may not be used
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             STATIC PROTOTYPES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void dm_init_ioctl(struct dm_ioctl *dmi, size_t size, const char *dev_name);
+static void dm_open_control(void);
+static int dm_control(void);
+static int dm_parse_target(char *line, unsigned long long *start, unsigned long long *length, char *type, char **params);
+static struct dm_ioctl *dm_marshal_table(const char *dev_name, const char *dm_table);
+static int dm_make_node(const char *dev_name, dev_t dev, uid_t uid, mode_t perm);
+static void dm_remove_node(const char *dev_name);
+static int dm_set_suspended(const char *dev_name, int suspended, dev_t * dev);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define DM_ALIGN(_n)                             (((_n) + BLOBSTORE_DM_ALIGN - 1) & ~((size_t) BLOBSTORE_DM_ALIGN - 1))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Prepares the header of a device mapper ioctl buffer
+//!
+//! @param[out] dmi the buffer to prepare, at least 'size' bytes
+//! @param[in]  size total size of the buffer, header included
+//! @param[in]  dev_name name of the device the ioctl is about, NULL if none
+//!
+static void dm_init_ioctl(struct dm_ioctl *dmi, size_t size, const char *dev_name)
+{
+    bzero(dmi, size);
+    dmi->version[0] = DM_VERSION_MAJOR;    // the driver accepts any minor version up to its own
+    dmi->version[1] = 0;
+    dmi->version[2] = 0;
+    dmi->data_size = size;
+    dmi->data_start = sizeof(struct dm_ioctl);
+    if (dev_name != NULL)
+        euca_strncpy(dmi->name, dev_name, sizeof(dmi->name));
+}
+
+//!
+//! Opens the device mapper control node and checks that this process may
+//! issue ioctls on it, which requires CAP_SYS_ADMIN. Called once per process.
+//!
+static void dm_open_control(void)
+{
+    int fd = -1;
+    struct dm_ioctl dmi = { {0} };
+
+    if ((fd = open(BLOBSTORE_DM_CONTROL, O_RDWR | O_CLOEXEC)) == -1) {
+        LOGDEBUG("cannot open %s (%s), device mapper ioctls will not be used\n", BLOBSTORE_DM_CONTROL, strerror(errno));
+        return;
+    }
+
+    dm_init_ioctl(&dmi, sizeof(dmi), NULL);
+    if (ioctl(fd, DM_VERSION, &dmi) == -1) {
+        LOGDEBUG("device mapper ioctls are not permitted (%s), they will not be used\n", strerror(errno));
+        close(fd);
+        return;
+    }
+
+    LOGINFO("using device mapper ioctls (driver version %u.%u.%u)\n", dmi.version[0], dmi.version[1], dmi.version[2]);
+    dm_control_fd = fd;
+}
+
+//!
+//! Returns the descriptor of the device mapper control node
+//!
+//! @return the descriptor or -1, with errno set to EPERM, if ioctls may not be used
+//!
+static int dm_control(void)
+{
+    pthread_once(&dm_control_once, dm_open_control);
+    if (dm_control_fd == -1)
+        errno = EPERM;
+    return (dm_control_fd);
+}
+
+//!
+//! Tells whether this process may manage device mapper devices through ioctls
+//!
+//! @return TRUE if the backend may be used, FALSE otherwise
+//!
+int blobstore_dm_available(void)
+{
+    return ((dm_control() != -1) ? TRUE : FALSE);
+}
+
+//!
+//! Splits one line of a device mapper table into its fields
+//!
+//! @param[in]  line the line, which is modified (trailing white space is cut off)
+//! @param[out] start first sector of the target
+//! @param[out] length number of sectors in the target
+//! @param[out] type target type, at least DM_MAX_TYPE_NAME bytes
+//! @param[out] params the parameters of the target, pointing into 'line'
+//!
+//! @return 1 if a target was parsed, 0 if the line is blank or -1 if it is malformed
+//!
+static int dm_parse_target(char *line, unsigned long long *start, unsigned long long *length, char *type, char **params)
+{
+    char *p = line;
+    char *end = NULL;
+    char *type_start = NULL;
+    size_t type_len = 0;
+
+    for (end = line + strlen(line); (end > line) && isspace((unsigned char)end[-1]); end--)
+        *(end - 1) = '\0';
+    while (isspace((unsigned char)*p))
+        p++;
+    if (*p == '\0')
+        return (0);
+
+    if (!isdigit((unsigned char)*p))
+        return (-1);
+    *start = strtoull(p, &end, 10);
+    p = end;
+    while (isspace((unsigned char)*p))
+        p++;
+    if (!isdigit((unsigned char)*p))
+        return (-1);
+    *length = strtoull(p, &end, 10);
+    p = end;
+
+    if (!isspace((unsigned char)*p))
+        return (-1);
+    while (isspace((unsigned char)*p))
+        p++;
+    for (type_start = p; (*p != '\0') && !isspace((unsigned char)*p); p++) ;
+    if (((type_len = p - type_start) == 0) || (type_len >= DM_MAX_TYPE_NAME))
+        return (-1);
+    memcpy(type, type_start, type_len);
+    type[type_len] = '\0';
+
+    while (isspace((unsigned char)*p))
+        p++;
+    *params = p;
+    return (1);
+}
+
+//!
+//! Builds the DM_TABLE_LOAD ioctl buffer for a table in 'dmsetup' format
+//!
+//! @param[in] dev_name name of the device to load the table into
+//! @param[in] dm_table the table, one target per line
+//!
+//! @return the buffer, to be freed by the caller, or NULL if the table is empty
+//!         or malformed or if memory is short
+//!
+static struct dm_ioctl *dm_marshal_table(const char *dev_name, const char *dm_table)
+{
+    int rc = 0;
+    int lines = 1;
+    size_t size = 0;
+    size_t used = 0;
+    char *copy = NULL;
+    char *line = NULL;
+    char *saveptr = NULL;
+    char *params = NULL;
+    char type[DM_MAX_TYPE_NAME] = "";
+    unsigned long long start = 0;
+    unsigned long long length = 0;
+    struct dm_ioctl *dmi = NULL;
+    struct dm_target_spec *spec = NULL;
+
+    for (const char *c = dm_table; *c != '\0'; c++) {
+        if (*c == '\n')
+            lines++;
+    }
+
+    // every line takes at most a spec, its parameters, a terminator and the padding
+    size = sizeof(struct dm_ioctl) + lines * (sizeof(struct dm_target_spec) + BLOBSTORE_DM_ALIGN) + strlen(dm_table) + 1;
+    if (((dmi = EUCA_ZALLOC(1, size)) == NULL) || ((copy = strdup(dm_table)) == NULL)) {
+        EUCA_FREE(dmi);
+        errno = ENOMEM;
+        return (NULL);
+    }
+    dm_init_ioctl(dmi, size, dev_name);
+
+    used = sizeof(struct dm_ioctl);
+    for (line = strtok_r(copy, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr)) {
+        if ((rc = dm_parse_target(line, &start, &length, type, &params)) == 0)
+            continue;
+        if (rc < 0) {
+            LOGERROR("malformed device mapper table line for %s: '%s'\n", dev_name, line);
+            goto malformed;
+        }
+
+        spec = (struct dm_target_spec *)((char *)dmi + used);
+        spec->sector_start = start;
+        spec->length = length;
+        spec->status = 0;
+        euca_strncpy(spec->target_type, type, sizeof(spec->target_type));
+        strcpy((char *)(spec + 1), params);
+        spec->next = DM_ALIGN(sizeof(struct dm_target_spec) + strlen(params) + 1);  // relative to this spec
+        used += spec->next;
+        dmi->target_count++;
+    }
+
+    if (dmi->target_count == 0) {
+        LOGERROR("empty device mapper table for %s\n", dev_name);
+        goto malformed;
+    }
+
+    dmi->data_size = used;
+    EUCA_FREE(copy);
+    return (dmi);
+
+malformed:
+    EUCA_FREE(copy);
+    EUCA_FREE(dmi);
+    errno = EINVAL;
+    return (NULL);
+}
+
+//!
+//! Creates, if needed, the node of a device under BLOBSTORE_DM_DIR and gives
+//! it to the owner, with the same result as 'dmsetup create' followed by
+//! diskutil_ch() in the 'dmsetup' backend
+//!
+//! @param[in] dev_name name of the device
+//! @param[in] dev device number of the device
+//! @param[in] uid owner to give the device to, -1 to leave the owner alone
+//! @param[in] perm permissions of the device
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int dm_make_node(const char *dev_name, dev_t dev, uid_t uid, mode_t perm)
+{
+    int need_node = TRUE;
+    struct stat sb = { 0 };
+    char path[EUCA_MAX_PATH] = "";
+
+    snprintf(path, sizeof(path), BLOBSTORE_DM_DIR "%s", dev_name);
+    if (lstat(path, &sb) == 0) {
+        if (S_ISLNK(sb.st_mode) || (S_ISBLK(sb.st_mode) && (sb.st_rdev == dev)))
+            need_node = FALSE;
+        else
+            unlink(path);              // left over from a device with the same name that was removed behind our back
+    }
+
+    if (need_node) {
+        if ((mkdir(BLOBSTORE_DM_DIR, 0755) == -1) && (errno != EEXIST)) {
+            LOGERROR("failed to create %s: %s\n", BLOBSTORE_DM_DIR, strerror(errno));
+            return (EUCA_ERROR);
+        }
+        if ((mknod(path, S_IFBLK | perm, dev) == -1) && (errno != EEXIST)) {
+            LOGERROR("failed to create device node %s (%u:%u): %s\n", path, major(dev), minor(dev), strerror(errno));
+            return (EUCA_ERROR);
+        }
+    }
+
+    if (((uid != (uid_t) - 1) && (chown(path, uid, (gid_t) - 1) == -1)) || (chmod(path, perm) == -1)) {
+        LOGERROR("failed to change permissions on %s: %s\n", path, strerror(errno));
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Removes the node of a device from BLOBSTORE_DM_DIR, if there is one
+//!
+//! @param[in] dev_name name of the device
+//!
+static void dm_remove_node(const char *dev_name)
+{
+    struct stat sb = { 0 };
+    char path[EUCA_MAX_PATH] = "";
+
+    snprintf(path, sizeof(path), BLOBSTORE_DM_DIR "%s", dev_name);
+    if ((lstat(path, &sb) == 0) && (S_ISBLK(sb.st_mode) || S_ISLNK(sb.st_mode)))
+        unlink(path);
+}
+
+//!
+//! Suspends a device or makes its loaded table live and resumes it
+//!
+//! @param[in]  dev_name name of the device
+//! @param[in]  suspended TRUE to suspend, FALSE to resume
+//! @param[out] dev device number of the device, may be NULL
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure, with errno set
+//!
+static int dm_set_suspended(const char *dev_name, int suspended, dev_t * dev)
+{
+    int fd = -1;
+    struct dm_ioctl dmi = { {0} };
+
+    if ((fd = dm_control()) == -1)
+        return (EUCA_ERROR);
+
+    dm_init_ioctl(&dmi, sizeof(dmi), dev_name);
+    dmi.flags = suspended ? DM_SUSPEND_FLAG : 0;
+    if (ioctl(fd, DM_DEV_SUSPEND, &dmi) == -1) {
+        LOGERROR("failed to %s device mapper device %s: %s\n", suspended ? "suspend" : "resume", dev_name, strerror(errno));
+        return (EUCA_ERROR);
+    }
+    if (dev != NULL)
+        *dev = makedev(major(dmi.dev), minor(dmi.dev));
+    return (EUCA_OK);
+}
+
+//!
+//! Sets up the device mapper devices of one clone as a unit: either all of
+//! them end up live, with nodes owned by 'owner', or none of them is left
+//!
+//! @param[in] dev_names names of the devices, in the order they depend on each other
+//! @param[in] dm_tables tables of the devices, in 'dmsetup' format
+//! @param[in] size number of devices
+//! @param[in] owner user to give the device nodes to, NULL to leave them to this process
+//! @param[in] perm permissions of the device nodes
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure, with errno set
+//!
+int blobstore_dm_create(char *dev_names[], char *dm_tables[], int size, const char *owner, mode_t perm)
+{
+    int i = 0;
+    int fd = -1;
+    int created = 0;
+    int saved_errno = 0;
+    char pwbuf[1024] = "";
+    uid_t uid = (uid_t) - 1;
+    dev_t dev = 0;
+    struct passwd pw = { 0 };
+    struct passwd *ppw = NULL;
+    struct dm_ioctl dmi = { {0} };
+    struct dm_ioctl *table = NULL;
+
+    if ((fd = dm_control()) == -1)
+        return (EUCA_ERROR);
+
+    if (owner != NULL) {
+        if ((getpwnam_r(owner, &pw, pwbuf, sizeof(pwbuf), &ppw) != 0) || (ppw == NULL)) {
+            LOGERROR("failed to look up user '%s' for device mapper devices\n", owner);
+            errno = EINVAL;
+            return (EUCA_ERROR);
+        }
+        uid = ppw->pw_uid;
+    }
+
+    // reserve all the names first, so a clash is found before any table is loaded
+    for (created = 0; created < size; created++) {
+        dm_init_ioctl(&dmi, sizeof(dmi), dev_names[created]);
+        if (ioctl(fd, DM_DEV_CREATE, &dmi) == -1) {
+            LOGERROR("failed to create device mapper device %s: %s\n", dev_names[created], strerror(errno));
+            goto rollback;
+        }
+    }
+
+    // then load and resume them in order, since later tables refer to earlier devices by their nodes
+    for (i = 0; i < size; i++) {
+        LOGDEBUG("loading table of device %s\n", dev_names[i]);
+        if ((table = dm_marshal_table(dev_names[i], dm_tables[i])) == NULL)
+            goto rollback;
+        if (ioctl(fd, DM_TABLE_LOAD, table) == -1) {
+            LOGERROR("failed to load table of device mapper device %s: %s\n", dev_names[i], strerror(errno));
+            LOGINFO("table of %s: %s", dev_names[i], dm_tables[i]);
+            EUCA_FREE(table);
+            goto rollback;
+        }
+        EUCA_FREE(table);
+
+        if (dm_set_suspended(dev_names[i], FALSE, &dev) != EUCA_OK)
+            goto rollback;
+        if (dm_make_node(dev_names[i], dev, uid, perm) != EUCA_OK)
+            goto rollback;
+    }
+
+    return (EUCA_OK);
+
+rollback:
+    saved_errno = errno;
+    for (i = created - 1; i >= 0; i--) {
+        blobstore_dm_remove(dev_names[i]);
+    }
+    errno = saved_errno;
+    return (EUCA_ERROR);
+}
+
+//!
+//! Removes a device mapper device and its node, if they exist
+//!
+//! @param[in] dev_name name of the device
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure, with errno set
+//!
+int blobstore_dm_remove(const char *dev_name)
+{
+    int fd = -1;
+    int retries = BLOBSTORE_DM_REMOVE_RETRIES;
+    struct dm_ioctl dmi = { {0} };
+
+    if ((fd = dm_control()) == -1)
+        return (EUCA_ERROR);
+
+    for (;;) {
+        dm_init_ioctl(&dmi, sizeof(dmi), dev_name);
+        if (ioctl(fd, DM_DEV_REMOVE, &dmi) == 0)
+            break;
+        if (errno == ENXIO)            // no such device, which is what we wanted
+            break;
+        if ((errno == EBUSY) && (retries-- > 0)) {
+            usleep(BLOBSTORE_DM_REMOVE_RETRY_USEC);
+            continue;
+        }
+        LOGERROR("failed to remove device mapper device %s: %s\n", dev_name, strerror(errno));
+        return (EUCA_ERROR);
+    }
+
+    dm_remove_node(dev_name);
+    return (EUCA_OK);
+}
+
+//!
+//! Suspends and then resumes a device, which flushes its outstanding I/O
+//!
+//! @param[in] dev_name name of the device
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure, with errno set
+//!
+int blobstore_dm_suspend_resume(const char *dev_name)
+{
+    if (dm_set_suspended(dev_name, TRUE, NULL) != EUCA_OK)
+        return (EUCA_ERROR);
+    return (dm_set_suspended(dev_name, FALSE, NULL));
+}
+
+#ifdef _UNIT_TEST
+//!
+//! Checks the marshaling of tables and, when the process may issue device
+//! mapper ioctls, sets up and tears down a small tree of devices
+//!
+//! @param[in] argc
+//! @param[in] argv
+//!
+//! @return 0 if all tests pass, 1 otherwise
+//!
+int main(int argc, char *argv[])
+{
+    int errors = 0;
+    char *params = NULL;
+    char path[EUCA_MAX_PATH] = "";
+    struct stat sb = { 0 };
+    struct dm_ioctl *dmi = NULL;
+    struct dm_target_spec *spec = NULL;
+
+#define CHECK(_cond)                                                      \
+{                                                                         \
+    if (!(_cond)) {                                                       \
+        printf("FAILED at line %d: %s\n", __LINE__, #_cond);             \
+        errors++;                                                         \
+    }                                                                     \
+}
+
+    printf("tables are marshaled one spec per line\n");
+    dmi = dm_marshal_table("euca-test", "0 64 linear /dev/mapper/euca-test-p0-snap 0\n\n64 32 zero  \n96 31 snapshot /dev/loop1 /dev/mapper/euca-back n 16\n");
+    CHECK(dmi != NULL);
+    if (dmi != NULL) {
+        CHECK(dmi->target_count == 3);
+        CHECK(!strcmp(dmi->name, "euca-test"));
+        CHECK(dmi->data_start == sizeof(struct dm_ioctl));
+        spec = (struct dm_target_spec *)((char *)dmi + dmi->data_start);
+        CHECK((spec->sector_start == 0) && (spec->length == 64) && !strcmp(spec->target_type, "linear"));
+        CHECK(!strcmp((char *)(spec + 1), "/dev/mapper/euca-test-p0-snap 0"));
+        CHECK((spec->next % BLOBSTORE_DM_ALIGN) == 0);
+        spec = (struct dm_target_spec *)((char *)spec + spec->next);
+        CHECK((spec->sector_start == 64) && (spec->length == 32) && !strcmp(spec->target_type, "zero"));
+        CHECK(!strcmp((char *)(spec + 1), ""));
+        spec = (struct dm_target_spec *)((char *)spec + spec->next);
+        CHECK((spec->sector_start == 96) && (spec->length == 31) && !strcmp(spec->target_type, "snapshot"));
+        CHECK(!strcmp((char *)(spec + 1), "/dev/loop1 /dev/mapper/euca-back n 16"));
+        CHECK(((char *)spec + spec->next) == ((char *)dmi + dmi->data_size));
+        EUCA_FREE(dmi);
+    }
+
+    printf("malformed tables are rejected\n");
+    CHECK(dm_marshal_table("euca-test", "") == NULL);
+    CHECK(dm_marshal_table("euca-test", " \n\n") == NULL);
+    CHECK(dm_marshal_table("euca-test", "0 64\n") == NULL);
+    CHECK(dm_marshal_table("euca-test", "x 64 linear /dev/loop0 0\n") == NULL);
+    CHECK(dm_marshal_table("euca-test", "0 64 averyveryverylongtargettype 0\n") == NULL);
+    CHECK(dm_marshal_table("euca-test", "0 64 zero\n1 1\n") == NULL);
+
+    {
+        char line[] = "  0 2199023255552 zero";
+        unsigned long long start = 1, length = 0;
+        char type[DM_MAX_TYPE_NAME] = "";
+        CHECK(dm_parse_target(line, &start, &length, type, &params) == 1);
+        CHECK((start == 0) && (length == 2199023255552ULL) && !strcmp(type, "zero") && (*params == '\0'));
+    }
+
+    if (!blobstore_dm_available()) {
+        printf("device mapper ioctls are not permitted, skipping the device tests\n");
+    } else {
+        char *names[] = { "euca-dmtest-zero", "euca-dmtest-p0-back", "euca-dmtest" };
+        char *tables[] = {
+            "0 2048 zero\n",
+            "0 1024 linear " BLOBSTORE_DM_DIR "euca-dmtest-zero 0\n",
+            "0 1024 linear " BLOBSTORE_DM_DIR "euca-dmtest-p0-back 0\n1024 1024 zero\n",
+        };
+        char *bad_tables[] = {
+            "0 2048 zero\n",
+            "0 1024 linear " BLOBSTORE_DM_DIR "euca-dmtest-zero 0\n",
+            "0 1024 linear " BLOBSTORE_DM_DIR "euca-dmtest-nonexistent 0\n",
+        };
+
+        printf("a tree of devices is set up and torn down\n");
+        CHECK(blobstore_dm_create(names, tables, 3, NULL, 0600) == EUCA_OK);
+        CHECK((stat(BLOBSTORE_DM_DIR "euca-dmtest", &sb) == 0) && S_ISBLK(sb.st_mode));
+        CHECK(blobstore_dm_suspend_resume("euca-dmtest") == EUCA_OK);
+        CHECK(blobstore_dm_create(names + 2, tables + 2, 1, NULL, 0600) == EUCA_ERROR);  // name is taken
+        for (int i = 2; i >= 0; i--)
+            CHECK(blobstore_dm_remove(names[i]) == EUCA_OK);
+        CHECK(lstat(BLOBSTORE_DM_DIR "euca-dmtest", &sb) == -1);
+        CHECK(blobstore_dm_remove(names[0]) == EUCA_OK);    // already gone
+
+        printf("a tree that fails to load leaves nothing behind\n");
+        CHECK(blobstore_dm_create(names, bad_tables, 3, NULL, 0600) == EUCA_ERROR);
+        for (int i = 0; i < 3; i++) {
+            snprintf(path, sizeof(path), BLOBSTORE_DM_DIR "%s", names[i]);
+            CHECK(lstat(path, &sb) == -1);
+        }
+        CHECK(blobstore_dm_create(names, tables, 3, NULL, 0600) == EUCA_OK);
+        for (int i = 2; i >= 0; i--)
+            CHECK(blobstore_dm_remove(names[i]) == EUCA_OK);
+    }
+
+#undef CHECK
+
+    printf("%s\n", (errors == 0) ? "all tests passed" : "some tests FAILED");
+    return ((errors == 0) ? 0 : 1);
+}
+#endif /* _UNIT_TEST */
@@ -0,0 +1,1560 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file storage/blobstore-index.c
+//! Implements the persistent index of blockblob metadata.
+//!
+//! The index is a journal of text records in BLOBSTORE_INDEX_FILE under the
+//! blobstore directory. Each line is either the header, which names the store
+//! the index belongs to, or a record that sets one or more fields of a blob:
+//!
+//!     euca-blobstore-index 1 <store id> #<checksum>
+//!     S <blob id> <key> <value> [<key> <value> ...] #<checksum>
+//!
+//! Every line ends with a checksum of everything before it, so a line torn by
+//! a crash in the middle of an append is recognized and ignored when the
+//! index is replayed. Records are appended with a single write() under an
+//! exclusive flock() on the index file, so concurrent writers never interleave.
+//!
+//! Records written by the code that changes a metadata file are 'strong' (S).
+//! Records produced while rebuilding the index from a directory walk are
+//! 'weak' (W): a weak value is ignored if a strong record for the same field
+//! of the same blob is present in the file, because the walk may have read the
+//! metadata file before a concurrent writer changed it.
+//!
+//! An in-memory copy of the index is brought up to date by replaying only the
+//! records appended since it was last read. While replaying, it keeps the total
+//! space taken by the blobs and a min-heap, ordered by the time of the last
+//! open or close, of the blobs that exist and that no other blob depends on,
+//! so the blobstore can pick eviction victims in O(log n) without looking at
+//! the blobs it does not evict.
+//!
+//! The journal is compacted - rewritten with one strong record per existing
+//! blob - into a temporary file that is fsync()'ed and rename()'d over the
+//! index while holding its lock. Writers that opened the old file notice the
+//! change of inode once they get the lock and reopen. Appends to an index file
+//! that does not exist are silently skipped: a store without an index gets one
+//! built by a full walk the next time it is scanned.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>                    // dirname
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>                  // flock
+
+#include <eucalyptus.h>
+#include <misc.h>
+#include <euca_string.h>
+
+#include "blobstore-index.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define BLOBSTORE_INDEX_MAGIC                    "euca-blobstore-index"
+#define BLOBSTORE_INDEX_VERSION                  "2"
+#define BLOBSTORE_INDEX_MAX_RECORD               8192   //!< longest record line, including the checksum and newline
+#define BLOBSTORE_INDEX_MIN_BUCKETS              256
+#define BLOBSTORE_INDEX_COMPACT_SLACK            512    //!< superseded records tolerated before compaction is worthwhile
+#define BLOBSTORE_INDEX_REOPEN_TRIES             5  //!< times to chase an index file replaced by compaction
+#define BLOBSTORE_INDEX_FILE_PERM                0660
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Keys of the fields in index records, indexed by blobstore_index_field
+static const char *blobstore_index_keys[BLOBSTORE_INDEX_TOTAL] = {
+    "e",
+    "h",
+    "r",
+    "d",
+    "m",
+    "s",
+    "z",
+    "u",
+    "dm",
+    "lo",
+};
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             STATIC PROTOTYPES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void index_path(const char *bs_path, char *path, int path_size);
+static int escape_value(const char *value, char *buf, int buf_size);
+static void unescape_value(char *value);
+static int format_line(char *buf, int buf_size, const char *body);
+static int format_record(char *buf, int buf_size, char kind, const char *bb_id, const char **values);
+static int write_all(int fd, const char *buf, int len);
+static int same_file(int fd, const char *path);
+static int open_locked(const char *path, int flags, int operation);
+static int unlock_and_close(int fd);
+static blobstore_index *index_alloc(void);
+static blobstore_index_entry *index_add(blobstore_index * idx, const char *bb_id);
+static int lru_before(const blobstore_index_entry * a, const blobstore_index_entry * b);
+static void lru_set(blobstore_index * idx, int pos, blobstore_index_entry * entry);
+static void lru_sift(blobstore_index * idx, int pos);
+static int lru_insert(blobstore_index * idx, blobstore_index_entry * entry);
+static void lru_remove(blobstore_index * idx, blobstore_index_entry * entry);
+static void index_unaccount(blobstore_index * idx, blobstore_index_entry * entry);
+static void index_account(blobstore_index * idx, blobstore_index_entry * entry);
+static void index_apply(blobstore_index_entry * entry, int strong, blobstore_index_field field, const char *value);
+static int index_parse(blobstore_index * idx, char *line, const char *bs_id);
+static int index_replay(blobstore_index * idx, int fd, const char *bs_id);
+static int index_read_fd(int fd, const char *bs_id, blobstore_index ** pidx);
+static int index_append(const char *bs_path, const char *record, int len);
+static void entry_values(const blobstore_index_entry * entry, const char **values, char bufs[][32]);
+static int index_replace(const char *bs_path, const char *bs_id, const blobstore_index * idx);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Computes the 32-bit FNV-1a hash of a buffer, continuing from a previous
+//! hash value so that data can be hashed in pieces
+//!
+//! @param[in] buf the data to hash
+//! @param[in] len number of bytes in buf
+//! @param[in] hash BLOBSTORE_INDEX_HASH_INIT or the result of a previous call
+//!
+//! @return the updated hash value
+//!
+unsigned int blobstore_index_hash(const char *buf, unsigned int len, unsigned int hash)
+{
+    for (unsigned int i = 0; i < len; i++) {
+        hash ^= (unsigned char)buf[i];
+        hash *= 16777619U;
+    }
+    return (hash);
+}
+
+//!
+//! Builds the path of the index file of a blobstore
+//!
+//! @param[in]  bs_path path of the blobstore directory
+//! @param[out] path buffer for the path of the index file
+//! @param[in]  path_size size of the path buffer
+//!
+static void index_path(const char *bs_path, char *path, int path_size)
+{
+    snprintf(path, path_size, "%s/%s", bs_path, BLOBSTORE_INDEX_FILE);
+}
+
+//!
+//! Escapes a value so that it is a single, non-empty token of a record: bytes
+//! that are not printable, whitespace, '%', '#' and '-' become %XX and an empty
+//! value becomes '-'
+//!
+//! @param[in]  value the value to escape
+//! @param[out] buf buffer for the escaped value
+//! @param[in]  buf_size size of the buffer
+//!
+//! @return the length of the escaped value or -1 if it does not fit
+//!
+static int escape_value(const char *value, char *buf, int buf_size)
+{
+    int len = 0;
+    const unsigned char *p = NULL;
+
+    if (value[0] == '\0') {
+        if (buf_size < 2)
+            return (-1);
+        strcpy(buf, "-");
+        return (1);
+    }
+
+    for (p = (const unsigned char *)value; *p != '\0'; p++) {
+        if (len + 4 > buf_size)
+            return (-1);
+        if ((*p <= ' ') || (*p >= 0x7f) || (*p == '%') || (*p == '#') || (*p == '-')) {
+            len += snprintf(buf + len, buf_size - len, "%%%02X", *p);
+        } else {
+            buf[len++] = *p;
+        }
+    }
+    buf[len] = '\0';
+    return (len);
+}
+
+//!
+//! Reverses escape_value() in place
+//!
+//! @param[in,out] value the escaped value
+//!
+static void unescape_value(char *value)
+{
+    char *src = value;
+    char *dst = value;
+    char hex[3] = "";
+
+    if (!strcmp(value, "-")) {
+        value[0] = '\0';
+        return;
+    }
+
+    while (*src != '\0') {
+        if ((src[0] == '%') && (src[1] != '\0') && (src[2] != '\0')) {
+            hex[0] = src[1];
+            hex[1] = src[2];
+            *dst++ = (char)strtoul(hex, NULL, 16);
+            src += 3;
+        } else {
+            *dst++ = *src++;
+        }
+    }
+    *dst = '\0';
+}
+
+//!
+//! Terminates a line of the index with the checksum of its body and a newline
+//!
+//! @param[out] buf buffer for the line
+//! @param[in]  buf_size size of the buffer
+//! @param[in]  body the contents of the line
+//!
+//! @return the length of the line or -1 if it does not fit
+//!
+static int format_line(char *buf, int buf_size, const char *body)
+{
+    int len = snprintf(buf, buf_size, "%s #%08x\n", body, blobstore_index_hash(body, strlen(body), BLOBSTORE_INDEX_HASH_INIT));
+    if ((len < 0) || (len >= buf_size))
+        return (-1);
+    return (len);
+}
+
+//!
+//! Formats a record that sets the given fields of a blob
+//!
+//! @param[out] buf buffer for the record
+//! @param[in]  buf_size size of the buffer
+//! @param[in]  kind 'S' for a strong record, 'W' for a weak one
+//! @param[in]  bb_id ID of the blob
+//! @param[in]  values BLOBSTORE_INDEX_TOTAL values, NULL for the fields the record does not set
+//!
+//! @return the length of the record or -1 if it does not fit
+//!
+static int format_record(char *buf, int buf_size, char kind, const char *bb_id, const char **values)
+{
+    int len = 0;
+    int elen = 0;
+    char body[BLOBSTORE_INDEX_MAX_RECORD] = "";
+
+    body[len++] = kind;
+    body[len++] = ' ';
+    if ((elen = escape_value(bb_id, body + len, sizeof(body) - len)) < 0)
+        return (-1);
+    len += elen;
+
+    for (int i = 0; i < BLOBSTORE_INDEX_TOTAL; i++) {
+        if (values[i] == NULL)
+            continue;
+        if (len + strlen(blobstore_index_keys[i]) + 3 > sizeof(body))
+            return (-1);
+        len += sprintf(body + len, " %s ", blobstore_index_keys[i]);
+        if ((elen = escape_value(values[i], body + len, sizeof(body) - len)) < 0)
+            return (-1);
+        len += elen;
+    }
+
+    return (format_line(buf, buf_size, body));
+}
+
+//!
+//! Writes the whole buffer to a file descriptor, retrying on short writes
+//!
+//! @param[in] fd the file descriptor
+//! @param[in] buf the data
+//! @param[in] len number of bytes to write
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR
+//!
+static int write_all(int fd, const char *buf, int len)
+{
+    ssize_t wrote = 0;
+
+    while (len > 0) {
+        if ((wrote = write(fd, buf, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (EUCA_IO_ERROR);
+        }
+        buf += wrote;
+        len -= wrote;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Checks that an open file descriptor still refers to the file at 'path',
+//! i.e., that the index was not replaced by a compaction since it was opened
+//!
+//! @param[in] fd the file descriptor
+//! @param[in] path the path it was opened with
+//!
+//! @return TRUE if both refer to the same file, FALSE otherwise
+//!
+static int same_file(int fd, const char *path)
+{
+    struct stat fd_st = { 0 };
+    struct stat path_st = { 0 };
+
+    if ((fstat(fd, &fd_st) != 0) || (stat(path, &path_st) != 0))
+        return (FALSE);
+    return ((fd_st.st_dev == path_st.st_dev) && (fd_st.st_ino == path_st.st_ino));
+}
+
+//!
+//! Opens the index file and flock()s it, reopening if the file is replaced
+//! while we wait for the lock
+//!
+//! @param[in] path path of the index file
+//! @param[in] flags open() flags
+//! @param[in] operation LOCK_SH or LOCK_EX
+//!
+//! @return the locked file descriptor or -1 with errno set (ENOENT if there is no index)
+//!
+static int open_locked(const char *path, int flags, int operation)
+{
+    int fd = -1;
+
+    for (int tries = 0; tries < BLOBSTORE_INDEX_REOPEN_TRIES; tries++) {
+        if ((fd = open(path, flags)) == -1)
+            return (-1);
+        if (flock(fd, operation) == -1) {
+            close(fd);
+            return (-1);
+        }
+        if (same_file(fd, path))
+            return (fd);
+        unlock_and_close(fd);
+    }
+
+    errno = EAGAIN;
+    return (-1);
+}
+
+//!
+//! Releases the flock() on a file and closes it
+//!
+//! @param[in] fd the file descriptor
+//!
+//! @return the result of close()
+//!
+static int unlock_and_close(int fd)
+{
+    flock(fd, LOCK_UN);
+    return (close(fd));
+}
+
+//!
+//! Allocates an empty in-memory index
+//!
+//! @return a pointer to the index or NULL if out of memory
+//!
+static blobstore_index *index_alloc(void)
+{
+    blobstore_index *idx = NULL;
+
+    if ((idx = EUCA_ZALLOC(1, sizeof(blobstore_index))) == NULL)
+        return (NULL);
+    idx->buckets_size = BLOBSTORE_INDEX_MIN_BUCKETS;
+    if ((idx->buckets = EUCA_ZALLOC(idx->buckets_size, sizeof(blobstore_index_entry *))) == NULL) {
+        EUCA_FREE(idx);
+        return (NULL);
+    }
+    return (idx);
+}
+
+//!
+//! Frees an in-memory index and all of its entries
+//!
+//! @param[in] idx the index, may be NULL
+//!
+void blobstore_index_free(blobstore_index * idx)
+{
+    blobstore_index_entry *entry = NULL;
+    blobstore_index_entry *next = NULL;
+
+    if (idx == NULL)
+        return;
+
+    for (entry = idx->head; entry != NULL; entry = next) {
+        next = entry->next;
+        EUCA_FREE(entry->id);
+        EUCA_FREE(entry);
+    }
+    EUCA_FREE(idx->buckets);
+    EUCA_FREE(idx->lru);
+    EUCA_FREE(idx);
+}
+
+//!
+//! Looks up the entry of a blob in an in-memory index
+//!
+//! @param[in] idx the index
+//! @param[in] bb_id ID of the blob
+//!
+//! @return the entry or NULL if the blob was never recorded
+//!
+blobstore_index_entry *blobstore_index_find(blobstore_index * idx, const char *bb_id)
+{
+    unsigned int bucket = blobstore_index_hash(bb_id, strlen(bb_id), BLOBSTORE_INDEX_HASH_INIT) & (idx->buckets_size - 1);
+
+    for (blobstore_index_entry * entry = idx->buckets[bucket]; entry != NULL; entry = entry->hnext) {
+        if (!strcmp(entry->id, bb_id))
+            return (entry);
+    }
+    return (NULL);
+}
+
+//!
+//! Adds a new, empty entry for a blob to an in-memory index, growing the hash
+//! table when the entries outnumber its buckets
+//!
+//! @param[in] idx the index
+//! @param[in] bb_id ID of the blob
+//!
+//! @return the new entry or NULL if out of memory
+//!
+static blobstore_index_entry *index_add(blobstore_index * idx, const char *bb_id)
+{
+    unsigned int bucket = 0;
+    blobstore_index_entry *entry = NULL;
+    blobstore_index_entry **buckets = NULL;
+
+    if (idx->num_entries >= idx->buckets_size) {
+        if ((buckets = EUCA_ZALLOC(idx->buckets_size * 2, sizeof(blobstore_index_entry *))) != NULL) {
+            EUCA_FREE(idx->buckets);
+            idx->buckets = buckets;
+            idx->buckets_size *= 2;
+            for (entry = idx->head; entry != NULL; entry = entry->next) {
+                bucket = blobstore_index_hash(entry->id, strlen(entry->id), BLOBSTORE_INDEX_HASH_INIT) & (idx->buckets_size - 1);
+                entry->hnext = idx->buckets[bucket];
+                idx->buckets[bucket] = entry;
+            }
+        }                              // else keep using the smaller table: chains get longer but nothing breaks
+    }
+
+    if ((entry = EUCA_ZALLOC(1, sizeof(blobstore_index_entry))) == NULL)
+        return (NULL);
+    if ((entry->id = strdup(bb_id)) == NULL) {
+        EUCA_FREE(entry);
+        return (NULL);
+    }
+
+    bucket = blobstore_index_hash(bb_id, strlen(bb_id), BLOBSTORE_INDEX_HASH_INIT) & (idx->buckets_size - 1);
+    entry->hnext = idx->buckets[bucket];
+    idx->buckets[bucket] = entry;
+    if (idx->tail != NULL) {
+        idx->tail->next = entry;
+    } else {
+        idx->head = entry;
+    }
+    idx->tail = entry;
+    idx->num_entries++;
+    return (entry);
+}
+
+//!
+//! Tells whether a blob comes before another in eviction order
+//!
+//! @param[in] a
+//! @param[in] b
+//!
+//! @return TRUE if 'a' was used less recently than 'b'
+//!
+static int lru_before(const blobstore_index_entry * a, const blobstore_index_entry * b)
+{
+    if (a->last_used != b->last_used)
+        return (a->last_used < b->last_used);
+    return (strcmp(a->id, b->id) < 0); // any stable order will do for blobs used at the same time
+}
+
+//!
+//! Places an entry at a position of the LRU heap
+//!
+//! @param[in] idx
+//! @param[in] pos 0-based position
+//! @param[in] entry
+//!
+static void lru_set(blobstore_index * idx, int pos, blobstore_index_entry * entry)
+{
+    idx->lru[pos] = entry;
+    entry->lru_pos = pos + 1;
+}
+
+//!
+//! Restores the heap property around a position whose entry may be out of place
+//!
+//! @param[in] idx
+//! @param[in] pos 0-based position
+//!
+static void lru_sift(blobstore_index * idx, int pos)
+{
+    int child = 0;
+    blobstore_index_entry *entry = idx->lru[pos];
+
+    // up, while older than the parent...
+    while ((pos > 0) && lru_before(entry, idx->lru[(pos - 1) / 2])) {
+        lru_set(idx, pos, idx->lru[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    // ...or down, while a child is older
+    while ((child = 2 * pos + 1) < idx->lru_size) {
+        if ((child + 1 < idx->lru_size) && lru_before(idx->lru[child + 1], idx->lru[child]))
+            child++;
+        if (!lru_before(idx->lru[child], entry))
+            break;
+        lru_set(idx, pos, idx->lru[child]);
+        pos = child;
+    }
+    lru_set(idx, pos, entry);
+}
+
+//!
+//! Adds an entry to the LRU heap
+//!
+//! @param[in] idx
+//! @param[in] entry
+//!
+//! @return EUCA_OK or EUCA_MEMORY_ERROR
+//!
+static int lru_insert(blobstore_index * idx, blobstore_index_entry * entry)
+{
+    int capacity = 0;
+    blobstore_index_entry **lru = NULL;
+
+    if (idx->lru_size == idx->lru_capacity) {
+        capacity = (idx->lru_capacity > 0) ? (2 * idx->lru_capacity) : (BLOBSTORE_INDEX_MIN_BUCKETS);
+        if ((lru = EUCA_REALLOC(idx->lru, capacity, sizeof(blobstore_index_entry *))) == NULL)
+            return (EUCA_MEMORY_ERROR);
+        idx->lru = lru;
+        idx->lru_capacity = capacity;
+    }
+    lru_set(idx, idx->lru_size++, entry);
+    lru_sift(idx, idx->lru_size - 1);
+    return (EUCA_OK);
+}
+
+//!
+//! Removes an entry from the LRU heap
+//!
+//! @param[in] idx
+//! @param[in] entry an entry that is in the heap
+//!
+static void lru_remove(blobstore_index * idx, blobstore_index_entry * entry)
+{
+    int pos = entry->lru_pos - 1;
+    blobstore_index_entry *last = idx->lru[--idx->lru_size];
+
+    entry->lru_pos = 0;
+    if (last != entry) {
+        lru_set(idx, pos, last);
+        lru_sift(idx, pos);
+    }
+}
+
+//!
+//! Computes the space a blob counts against the blobstore limit
+//!
+//! @param[in] entry
+//!
+//! @return the number of 512-byte blocks, 0 for hollow blobs
+//!
+long long blobstore_index_blocks(const blobstore_index_entry * entry)
+{
+    long long bytes = entry->size_bytes - (entry->mapped_blocks * 512LL);   // mapped blocks belong to other blobs
+
+    if (entry->is_hollow || (bytes <= 0))
+        return (0);
+    return ((bytes + 511) / 512);
+}
+
+//!
+//! Takes an entry out of the totals of the index, ahead of changing its fields
+//!
+//! @param[in] idx
+//! @param[in] entry
+//!
+static void index_unaccount(blobstore_index * idx, blobstore_index_entry * entry)
+{
+    if (entry->exists) {
+        idx->num_live--;
+        idx->used_blocks -= blobstore_index_blocks(entry);
+    }
+    if (entry->lru_pos) {
+        idx->evictable_blocks -= blobstore_index_blocks(entry);
+    }
+}
+
+//!
+//! Puts an entry back into the totals of the index once its fields have changed,
+//! and moves it into, within or out of the LRU heap accordingly
+//!
+//! @param[in] idx
+//! @param[in] entry
+//!
+static void index_account(blobstore_index * idx, blobstore_index_entry * entry)
+{
+    if (entry->exists) {
+        idx->num_live++;
+        idx->used_blocks += blobstore_index_blocks(entry);
+    }
+
+    if (entry->exists && (entry->refs <= 0) && !entry->lru_held) {
+        if (entry->lru_pos) {
+            lru_sift(idx, entry->lru_pos - 1); // last_used may have changed
+        } else if (lru_insert(idx, entry) != EUCA_OK) {
+            return;                    // out of memory: the blob just will not be evicted
+        }
+        idx->evictable_blocks += blobstore_index_blocks(entry);
+    } else if (entry->lru_pos) {
+        lru_remove(idx, entry);
+    }
+}
+
+//!
+//! Returns the blob that should be evicted first
+//!
+//! @param[in] idx
+//!
+//! @return the least recently used blob that exists and that no other blob
+//!         depends on, according to the index, or NULL if there is none
+//!
+blobstore_index_entry *blobstore_index_lru_first(blobstore_index * idx)
+{
+    return ((idx->lru_size > 0) ? (idx->lru[0]) : (NULL));
+}
+
+//!
+//! Keeps a blob out of the LRU heap, e.g., because it turned out to be open,
+//! or lets it back in
+//!
+//! @param[in] idx
+//! @param[in] entry
+//! @param[in] held TRUE to keep the blob out of the heap, FALSE to let it back in
+//!
+void blobstore_index_lru_hold(blobstore_index * idx, blobstore_index_entry * entry, int held)
+{
+    index_unaccount(idx, entry);
+    entry->lru_held = held;
+    index_account(idx, entry);
+}
+
+//!
+//! Applies one field of a replayed record to an entry
+//!
+//! @param[in] entry the entry
+//! @param[in] strong TRUE for a strong record, FALSE for a weak one
+//! @param[in] field the field the record sets
+//! @param[in] value the (unescaped) value
+//!
+//! @pre The entry has been taken out of the totals with index_unaccount()
+//!
+static void index_apply(blobstore_index_entry * entry, int strong, blobstore_index_field field, const char *value)
+{
+    unsigned int bit = (1U << field);
+
+    if (!strong && (entry->strong & bit))
+        return;                        // a writer has recorded a value that is at least as recent as the walk's
+    if (strong)
+        entry->strong |= bit;
+
+    switch (field) {
+    case BLOBSTORE_INDEX_EXISTS:
+        entry->exists = (atoi(value) != 0);
+        break;
+    case BLOBSTORE_INDEX_HOLLOW:
+        entry->is_hollow = (atoi(value) != 0);
+        break;
+    case BLOBSTORE_INDEX_REFS:
+        entry->refs = atoi(value);
+        break;
+    case BLOBSTORE_INDEX_DEPS:
+        entry->deps = atoi(value);
+        break;
+    case BLOBSTORE_INDEX_MAPPED:
+        entry->mapped_blocks = atoll(value);
+        break;
+    case BLOBSTORE_INDEX_SIG:
+        entry->sig_hash = (unsigned int)strtoul(value, NULL, 10);
+        break;
+    case BLOBSTORE_INDEX_SIZE:
+        entry->size_bytes = atoll(value);
+        break;
+    case BLOBSTORE_INDEX_USED:
+        entry->last_used = atoll(value);
+        break;
+    case BLOBSTORE_INDEX_DM:
+        euca_strncpy(entry->dm_name, value, sizeof(entry->dm_name));
+        break;
+    case BLOBSTORE_INDEX_LOOPBACK:
+        euca_strncpy(entry->loopback, value, sizeof(entry->loopback));
+        break;
+    default:
+        break;
+    }
+}
+
+//!
+//! Parses one line of the index file and replays it into the in-memory index
+//!
+//! @param[in] idx the index, whose num_records is 0 until the header has been seen
+//! @param[in] line the line, without the newline (modified by the call)
+//! @param[in] bs_id ID of the blobstore the index is expected to belong to
+//!
+//! @return EUCA_OK if the line was applied or skipped as torn, EUCA_INVALID_ERROR
+//!         if the header is missing or belongs to a different store, EUCA_MEMORY_ERROR
+//!
+static int index_parse(blobstore_index * idx, char *line, const char *bs_id)
+{
+    int strong = FALSE;
+    char *crc = NULL;
+    char *saveptr = NULL;
+    char *kind = NULL;
+    char *id = NULL;
+    char *key = NULL;
+    char *value = NULL;
+    blobstore_index_entry *entry = NULL;
+
+    // verify the checksum, which covers everything before " #"
+    if (((crc = strrchr(line, '#')) == NULL) || (crc == line) || (crc[-1] != ' ')
+        || (strtoul(crc + 1, NULL, 16) != blobstore_index_hash(line, crc - 1 - line, BLOBSTORE_INDEX_HASH_INIT))) {
+        idx->num_torn++;
+        return ((idx->num_records == 0) ? (EUCA_INVALID_ERROR) : (EUCA_OK));
+    }
+    crc[-1] = '\0';
+
+    if (idx->num_records == 0) {       // the first line must be the header
+        kind = strtok_r(line, " ", &saveptr);
+        value = strtok_r(NULL, " ", &saveptr);
+        id = strtok_r(NULL, " ", &saveptr);
+        if ((kind == NULL) || (value == NULL) || (id == NULL) || strcmp(kind, BLOBSTORE_INDEX_MAGIC) || strcmp(value, BLOBSTORE_INDEX_VERSION))
+            return (EUCA_INVALID_ERROR);
+        unescape_value(id);
+        if (strcmp(id, bs_id))
+            return (EUCA_INVALID_ERROR);
+        idx->num_records++;
+        return (EUCA_OK);
+    }
+
+    if (((kind = strtok_r(line, " ", &saveptr)) == NULL) || ((id = strtok_r(NULL, " ", &saveptr)) == NULL))
+        return (EUCA_OK);              // an empty record, ignore it
+    if (!strcmp(kind, "S")) {
+        strong = TRUE;
+    } else if (strcmp(kind, "W")) {
+        return (EUCA_OK);              // unknown record kind, possibly from a newer version
+    }
+
+    unescape_value(id);
+    if ((entry = blobstore_index_find(idx, id)) == NULL) {
+        if ((entry = index_add(idx, id)) == NULL)
+            return (EUCA_MEMORY_ERROR);
+    }
+
+    index_unaccount(idx, entry);
+    while (((key = strtok_r(NULL, " ", &saveptr)) != NULL) && ((value = strtok_r(NULL, " ", &saveptr)) != NULL)) {
+        unescape_value(value);
+        for (int i = 0; i < BLOBSTORE_INDEX_TOTAL; i++) {
+            if (!strcmp(key, blobstore_index_keys[i])) {
+                index_apply(entry, strong, (blobstore_index_field) i, value);
+                break;
+            }
+        }
+    }
+    index_account(idx, entry);
+    idx->num_records++;
+    return (EUCA_OK);
+}
+
+//!
+//! Replays the part of the index file that the in-memory index has not seen yet
+//!
+//! @param[in] idx the index, empty if the whole file is to be replayed
+//! @param[in] fd the descriptor of the index file, locked
+//! @param[in] bs_id ID of the blobstore the index is expected to belong to
+//!
+//! @return EUCA_OK on success or the error code
+//!
+static int index_replay(blobstore_index * idx, int fd, const char *bs_id)
+{
+    int rc = EUCA_OK;
+    char *buf = NULL;
+    char *line = NULL;
+    char *eol = NULL;
+    ssize_t got = 0;
+    size_t len = 0;
+    size_t size = 0;
+    struct stat st = { 0 };
+
+    if (fstat(fd, &st) != 0)
+        return (EUCA_IO_ERROR);
+    idx->dev = st.st_dev;
+    idx->ino = st.st_ino;
+    if (st.st_size < idx->offset)
+        return (EUCA_INVALID_ERROR);   // indexes only ever grow, until they are replaced
+    size = st.st_size - idx->offset;
+
+    if ((buf = EUCA_ALLOC(size + 1, sizeof(char))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    while (len < size) {
+        if ((got = pread(fd, buf + len, size - len, idx->offset + len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            EUCA_FREE(buf);
+            return (EUCA_IO_ERROR);
+        }
+        if (got == 0)
+            break;
+        len += got;
+    }
+    buf[len] = '\0';
+
+    for (line = buf; (rc == EUCA_OK) && ((eol = strchr(line, '\n')) != NULL); line = eol + 1) {
+        *eol = '\0';
+        rc = index_parse(idx, line, bs_id);
+    }
+    // an unterminated last line is an interrupted append, which the next append will terminate
+    if ((rc == EUCA_OK) && (*line != '\0') && (idx->offset == 0))
+        idx->num_torn++;
+    idx->offset += (line - buf);
+    if ((rc == EUCA_OK) && (idx->num_records == 0))
+        rc = EUCA_INVALID_ERROR;       // not even a header
+
+    EUCA_FREE(buf);
+    return (rc);
+}
+
+//!
+//! Reads and replays the whole index file from an open (and locked) descriptor
+//!
+//! @param[in]  fd the descriptor of the index file
+//! @param[in]  bs_id ID of the blobstore the index is expected to belong to
+//! @param[out] pidx set to the newly allocated in-memory index on success
+//!
+//! @return EUCA_OK on success or the error code
+//!
+static int index_read_fd(int fd, const char *bs_id, blobstore_index ** pidx)
+{
+    int rc = EUCA_OK;
+    blobstore_index *idx = NULL;
+
+    if ((idx = index_alloc()) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    if ((rc = index_replay(idx, fd, bs_id)) != EUCA_OK) {
+        blobstore_index_free(idx);
+        return (rc);
+    }
+    *pidx = idx;
+    return (EUCA_OK);
+}
+
+//!
+//! Loads the index of a blobstore into memory
+//!
+//! @param[in]  bs_path path of the blobstore directory
+//! @param[in]  bs_id ID of the blobstore
+//! @param[out] pidx set to the newly allocated in-memory index on success
+//!
+//! @return EUCA_OK on success, EUCA_NOT_FOUND_ERROR if the store has no index,
+//!         other error codes if the index cannot be read or is not for this store,
+//!         in which case it must be rebuilt
+//!
+int blobstore_index_load(const char *bs_path, const char *bs_id, blobstore_index ** pidx)
+{
+    *pidx = NULL;
+    return (blobstore_index_refresh(bs_path, bs_id, pidx));
+}
+
+//!
+//! Brings an in-memory index up to date with the index file. Normally only the
+//! records appended since the last call are replayed; the whole file is read
+//! if there is no in-memory index yet or if the file was replaced since.
+//!
+//! @param[in]     bs_path path of the blobstore directory
+//! @param[in]     bs_id ID of the blobstore
+//! @param[in,out] pidx the in-memory index, or NULL; on failure it is freed and set to NULL
+//!
+//! @return EUCA_OK on success, EUCA_NOT_FOUND_ERROR if the store has no index,
+//!         other error codes if the index cannot be read or is not for this store,
+//!         in which case it must be rebuilt
+//!
+//! @note The in-memory index may be replaced, so pointers to its entries must
+//!       not be kept across calls unless *pidx is unchanged
+//!
+int blobstore_index_refresh(const char *bs_path, const char *bs_id, blobstore_index ** pidx)
+{
+    int fd = -1;
+    int rc = EUCA_OK;
+    struct stat st = { 0 };
+    char path[EUCA_MAX_PATH] = "";
+    blobstore_index *idx = *pidx;
+
+    index_path(bs_path, path, sizeof(path));
+    if ((fd = open_locked(path, O_RDONLY, LOCK_SH)) == -1) {
+        rc = (errno == ENOENT) ? (EUCA_NOT_FOUND_ERROR) : (EUCA_IO_ERROR);
+        goto out;
+    }
+
+    if ((idx != NULL) && ((fstat(fd, &st) != 0) || (st.st_dev != idx->dev) || (st.st_ino != idx->ino))) {
+        blobstore_index_free(idx);     // replaced by a compaction or a rebuild
+        idx = NULL;
+    }
+    if (idx == NULL) {
+        if ((rc = index_read_fd(fd, bs_id, &idx)) == EUCA_OK) {
+            if (idx->num_torn > 0)
+                LOGWARN("skipped %d damaged record(s) in blobstore index %s\n", idx->num_torn, path);
+        } else {
+            LOGWARN("blobstore index %s is not valid for store %s, it will be rebuilt\n", path, bs_id);
+        }
+    } else {
+        rc = index_replay(idx, fd, bs_id);
+    }
+    unlock_and_close(fd);
+
+out:
+    if ((rc != EUCA_OK) && (idx != NULL)) {
+        blobstore_index_free(idx);
+        idx = NULL;
+    }
+    *pidx = idx;
+    return (rc);
+}
+
+//!
+//! Tells whether enough of the records in the index file were superseded for
+//! a compaction to pay off
+//!
+//! @param[in] idx an up-to-date in-memory index
+//!
+//! @return TRUE if blobstore_index_compact() should be called
+//!
+int blobstore_index_wants_compaction(const blobstore_index * idx)
+{
+    return ((idx->num_torn > 0) || (idx->num_records > (2 * idx->num_live + BLOBSTORE_INDEX_COMPACT_SLACK)));
+}
+
+//!
+//! Appends a record to the index file of a blobstore, if it has one
+//!
+//! @param[in] bs_path path of the blobstore directory
+//! @param[in] record the formatted record
+//! @param[in] len length of the record
+//!
+//! @return EUCA_OK on success (including when there is no index) or EUCA_IO_ERROR
+//!
+static int index_append(const char *bs_path, const char *record, int len)
+{
+    int fd = -1;
+    int rc = EUCA_OK;
+    char last = '\n';
+    char path[EUCA_MAX_PATH] = "";
+    struct stat st = { 0 };
+
+    index_path(bs_path, path, sizeof(path));
+    if ((fd = open_locked(path, O_RDWR | O_APPEND, LOCK_EX)) == -1) {
+        if (errno == ENOENT)
+            return (EUCA_OK);          // no index to keep current, the next scan will build one
+        LOGWARN("failed to open blobstore index %s: %s\n", path, strerror(errno));
+        return (EUCA_IO_ERROR);
+    }
+    // terminate a record torn by a crash so that it does not swallow this one
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0) && (pread(fd, &last, 1, st.st_size - 1) == 1) && (last != '\n'))
+        rc = write_all(fd, "\n", 1);
+    if ((rc == EUCA_OK) && ((rc = write_all(fd, record, len)) != EUCA_OK))
+        LOGWARN("failed to append to blobstore index %s: %s\n", path, strerror(errno));
+    unlock_and_close(fd);
+    return (rc);
+}
+
+//!
+//! Records new values of some fields of a blob, as known by the code that just
+//! changed the corresponding metadata files
+//!
+//! @param[in] bs_path path of the blobstore directory
+//! @param[in] bb_id ID of the blob
+//! @param[in] values BLOBSTORE_INDEX_TOTAL values, NULL for the fields that did not change
+//!
+//! @return EUCA_OK on success or the error code
+//!
+int blobstore_index_set(const char *bs_path, const char *bb_id, const char **values)
+{
+    int len = 0;
+    char record[BLOBSTORE_INDEX_MAX_RECORD] = "";
+
+    if ((len = format_record(record, sizeof(record), 'S', bb_id, values)) < 0)
+        return (EUCA_INVALID_ERROR);
+    return (index_append(bs_path, record, len));
+}
+
+//!
+//! Records a new value of one field of a blob
+//!
+//! @param[in] bs_path path of the blobstore directory
+//! @param[in] bb_id ID of the blob
+//! @param[in] field the field to set
+//! @param[in] value the new value ("" clears string fields)
+//!
+//! @return EUCA_OK on success or the error code
+//!
+int blobstore_index_set_str(const char *bs_path, const char *bb_id, blobstore_index_field field, const char *value)
+{
+    const char *values[BLOBSTORE_INDEX_TOTAL] = { NULL };
+
+    if ((field < 0) || (field >= BLOBSTORE_INDEX_TOTAL))
+        return (EUCA_INVALID_ERROR);
+    values[field] = value;
+    return (blobstore_index_set(bs_path, bb_id, values));
+}
+
+//!
+//! Same as blobstore_index_set_str(), for the numeric fields
+//!
+//! @param[in] bs_path path of the blobstore directory
+//! @param[in] bb_id ID of the blob
+//! @param[in] field the field to set
+//! @param[in] value the new value
+//!
+//! @return EUCA_OK on success or the error code
+//!
+int blobstore_index_set_num(const char *bs_path, const char *bb_id, blobstore_index_field field, long long value)
+{
+    char buf[32] = "";
+
+    snprintf(buf, sizeof(buf), "%lld", value);
+    return (blobstore_index_set_str(bs_path, bb_id, field, buf));
+}
+
+//!
+//! Records that a blob was just created: it exists and none of its other
+//! metadata files do, whatever the index remembers from a previous blob
+//! with the same ID
+//!
+//! @param[in] bs_path path of the blobstore directory
+//! @param[in] bb_id ID of the blob
+//! @param[in] size_bytes size the blob is being created with
+//!
+//! @return EUCA_OK on success or the error code
+//!
+int blobstore_index_created(const char *bs_path, const char *bb_id, long long size_bytes)
+{
+    const char *values[BLOBSTORE_INDEX_TOTAL] = { NULL };
+    char bufs[BLOBSTORE_INDEX_TOTAL][32] = { "" };
+    blobstore_index_entry entry = { 0 };
+
+    entry.exists = TRUE;
+    entry.size_bytes = size_bytes;
+    entry.last_used = time(NULL);
+    entry_values(&entry, values, bufs);
+    return (blobstore_index_set(bs_path, bb_id, values));
+}
+
+//!
+//! Fills in the values of all fields of an entry, for formatting a record
+//!
+//! @param[in]  entry the entry
+//! @param[out] values BLOBSTORE_INDEX_TOTAL pointers into the bufs
+//! @param[out] bufs scratch space for the numeric values
+//!
+static void entry_values(const blobstore_index_entry * entry, const char **values, char bufs[][32])
+{
+    snprintf(bufs[BLOBSTORE_INDEX_EXISTS], 32, "%d", entry->exists ? 1 : 0);
+    snprintf(bufs[BLOBSTORE_INDEX_HOLLOW], 32, "%d", entry->is_hollow ? 1 : 0);
+    snprintf(bufs[BLOBSTORE_INDEX_REFS], 32, "%d", entry->refs);
+    snprintf(bufs[BLOBSTORE_INDEX_DEPS], 32, "%d", entry->deps);
+    snprintf(bufs[BLOBSTORE_INDEX_MAPPED], 32, "%lld", entry->mapped_blocks);
+    snprintf(bufs[BLOBSTORE_INDEX_SIG], 32, "%u", entry->sig_hash);
+    snprintf(bufs[BLOBSTORE_INDEX_SIZE], 32, "%lld", entry->size_bytes);
+    snprintf(bufs[BLOBSTORE_INDEX_USED], 32, "%lld", entry->last_used);
+    for (int i = 0; i < BLOBSTORE_INDEX_DM; i++)
+        values[i] = bufs[i];
+    values[BLOBSTORE_INDEX_DM] = entry->dm_name;
+    values[BLOBSTORE_INDEX_LOOPBACK] = entry->loopback;
+}
+
+//!
+//! Records everything a directory walk found out about a blob. The record is
+//! weak, so it does not override values recorded by writers that may have
+//! changed the metadata files since the walk read them.
+//!
+//! @param[in] bs_path path of the blobstore directory
+//! @param[in] entry the metadata of the blob (the 'strong' and link fields are ignored)
+//!
+//! @return EUCA_OK on success or the error code
+//!
+int blobstore_index_walked(const char *bs_path, const blobstore_index_entry * entry)
+{
+    int len = 0;
+    const char *values[BLOBSTORE_INDEX_TOTAL] = { NULL };
+    char bufs[BLOBSTORE_INDEX_TOTAL][32] = { "" };
+    char record[BLOBSTORE_INDEX_MAX_RECORD] = "";
+
+    entry_values(entry, values, bufs);
+    if ((len = format_record(record, sizeof(record), 'W', entry->id, values)) < 0)
+        return (EUCA_INVALID_ERROR);
+    return (index_append(bs_path, record, len));
+}
+
+//!
+//! Atomically replaces the index file with one holding the header and a strong
+//! record for each existing blob of 'idx' (if any). The caller must hold the
+//! lock on the current index file, if there is one.
+//!
+//! @param[in] bs_path path of the blobstore directory
+//! @param[in] bs_id ID of the blobstore
+//! @param[in] idx the entries to write, or NULL for an empty index
+//!
+//! @return EUCA_OK on success or the error code
+//!
+static int index_replace(const char *bs_path, const char *bs_id, const blobstore_index * idx)
+{
+    int fd = -1;
+    int len = 0;
+    int rc = EUCA_OK;
+    const char *values[BLOBSTORE_INDEX_TOTAL] = { NULL };
+    char bufs[BLOBSTORE_INDEX_TOTAL][32] = { "" };
+    char body[BLOBSTORE_INDEX_MAX_RECORD] = "";
+    char record[BLOBSTORE_INDEX_MAX_RECORD] = "";
+    char escaped[BLOBSTORE_INDEX_MAX_RECORD / 2] = "";
+    char path[EUCA_MAX_PATH] = "";
+    char tmp_path[EUCA_MAX_PATH] = "";
+    char dir_path[EUCA_MAX_PATH] = "";
+
+    index_path(bs_path, path, sizeof(path));
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, getpid()) >= sizeof(tmp_path)) {
+        LOGERROR("path of the temporary blobstore index for %s is too long\n", path);
+        return (EUCA_INVALID_ERROR);
+    }
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, BLOBSTORE_INDEX_FILE_PERM)) == -1) {
+        LOGERROR("failed to create blobstore index %s: %s\n", tmp_path, strerror(errno));
+        return (EUCA_IO_ERROR);
+    }
+
+    if (escape_value(bs_id, escaped, sizeof(escaped)) < 0) {
+        rc = EUCA_INVALID_ERROR;
+        goto cleanup;
+    }
+    snprintf(body, sizeof(body), "%s %s %s", BLOBSTORE_INDEX_MAGIC, BLOBSTORE_INDEX_VERSION, escaped);
+    if (((len = format_line(record, sizeof(record), body)) < 0) || ((rc = write_all(fd, record, len)) != EUCA_OK))
+        goto cleanup;
+
+    for (const blobstore_index_entry * entry = ((idx != NULL) ? (idx->head) : (NULL)); entry != NULL; entry = entry->next) {
+        if (!entry->exists)
+            continue;                  // records of deleted blobs are what compaction gets rid of
+        entry_values(entry, values, bufs);
+        if ((len = format_record(record, sizeof(record), 'S', entry->id, values)) < 0)
+            continue;
+        if ((rc = write_all(fd, record, len)) != EUCA_OK)
+            goto cleanup;
+    }
+
+    if (fsync(fd) != 0) {
+        rc = EUCA_IO_ERROR;
+        goto cleanup;
+    }
+    close(fd);
+    fd = -1;
+
+    if (rename(tmp_path, path) != 0) {
+        rc = EUCA_IO_ERROR;
+        goto cleanup;
+    }
+    // make the rename itself durable
+    euca_strncpy(dir_path, path, sizeof(dir_path));
+    if ((fd = open(dirname(dir_path), O_RDONLY)) != -1) {
+        fsync(fd);
+        close(fd);
+    }
+    return (EUCA_OK);
+
+cleanup:
+    LOGERROR("failed to write blobstore index %s\n", tmp_path);
+    if (fd != -1)
+        close(fd);
+    unlink(tmp_path);
+    return ((rc == EUCA_OK) ? (EUCA_IO_ERROR) : (rc));
+}
+
+//!
+//! Replaces the index of a blobstore with an empty one, ahead of rebuilding it
+//! with blobstore_index_walked(). Records appended concurrently by writers from
+//! this point on take precedence over the ones from the walk.
+//!
+//! @param[in] bs_path path of the blobstore directory
+//! @param[in] bs_id ID of the blobstore
+//!
+//! @return EUCA_OK on success or the error code
+//!
+int blobstore_index_reset(const char *bs_path, const char *bs_id)
+{
+    int fd = -1;
+    int rc = EUCA_OK;
+    char path[EUCA_MAX_PATH] = "";
+
+    index_path(bs_path, path, sizeof(path));
+    fd = open_locked(path, O_RDONLY, LOCK_EX);  // may well not exist yet
+    rc = index_replace(bs_path, bs_id, NULL);
+    if (fd != -1)
+        unlock_and_close(fd);
+    return (rc);
+}
+
+//!
+//! Rewrites the index file of a blobstore with a single strong record per
+//! existing blob, dropping superseded and damaged records
+//!
+//! @param[in] bs_path path of the blobstore directory
+//! @param[in] bs_id ID of the blobstore
+//!
+//! @return EUCA_OK on success or the error code
+//!
+int blobstore_index_compact(const char *bs_path, const char *bs_id)
+{
+    int fd = -1;
+    int rc = EUCA_OK;
+    char path[EUCA_MAX_PATH] = "";
+    blobstore_index *idx = NULL;
+
+    index_path(bs_path, path, sizeof(path));
+    if ((fd = open_locked(path, O_RDONLY, LOCK_EX)) == -1)
+        return ((errno == ENOENT) ? (EUCA_NOT_FOUND_ERROR) : (EUCA_IO_ERROR));
+
+    // re-read under the exclusive lock so no append can slip in between
+    if ((rc = index_read_fd(fd, bs_id, &idx)) == EUCA_OK) {
+        rc = index_replace(bs_path, bs_id, idx);
+        LOGDEBUG("compacted blobstore index %s from %d to %d record(s)\n", path, idx->num_records, idx->num_live + 1);
+        blobstore_index_free(idx);
+    }
+    unlock_and_close(fd);
+    return (rc);
+}
+
+//!
+//! Removes the index of a blobstore
+//!
+//! @param[in] bs_path path of the blobstore directory
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR
+//!
+int blobstore_index_delete(const char *bs_path)
+{
+    char path[EUCA_MAX_PATH] = "";
+
+    index_path(bs_path, path, sizeof(path));
+    if ((unlink(path) != 0) && (errno != ENOENT))
+        return (EUCA_IO_ERROR);
+    return (EUCA_OK);
+}
+
+#ifdef _UNIT_TEST
+//!
+//! Exercises the index in a temporary directory
+//!
+//! @param[in] argc
+//! @param[in] argv
+//!
+//! @return 0 if all tests pass, 1 otherwise
+//!
+int main(int argc, char *argv[])
+{
+    int fd = -1;
+    int errors = 0;
+    char dir[] = "/tmp/blobstore-index-XXXXXX";
+    char path[EUCA_MAX_PATH] = "";
+    char record[BLOBSTORE_INDEX_MAX_RECORD] = "";
+    blobstore_index *idx = NULL;
+    blobstore_index_entry *entry = NULL;
+    blobstore_index_entry walked = { 0 };
+
+#define CHECK(_cond)                                                      \
+{                                                                         \
+    if (!(_cond)) {                                                       \
+        printf("FAILED at line %d: %s\n", __LINE__, #_cond);             \
+        errors++;                                                         \
+    }                                                                     \
+}
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return (1);
+    }
+    index_path(dir, path, sizeof(path));
+
+    printf("appends without an index are no-ops\n");
+    CHECK(blobstore_index_set_num(dir, "a", BLOBSTORE_INDEX_EXISTS, 1) == EUCA_OK);
+    CHECK(blobstore_index_load(dir, "store", &idx) == EUCA_NOT_FOUND_ERROR);
+
+    printf("strong records are replayed in order\n");
+    CHECK(blobstore_index_reset(dir, "store") == EUCA_OK);
+    CHECK(blobstore_index_set_num(dir, "a", BLOBSTORE_INDEX_EXISTS, 1) == EUCA_OK);
+    CHECK(blobstore_index_set_num(dir, "a", BLOBSTORE_INDEX_REFS, 2) == EUCA_OK);
+    CHECK(blobstore_index_set_str(dir, "a", BLOBSTORE_INDEX_LOOPBACK, "/dev/loop7") == EUCA_OK);
+    CHECK(blobstore_index_set_num(dir, "dir/b c#%-", BLOBSTORE_INDEX_EXISTS, 1) == EUCA_OK);
+    CHECK(blobstore_index_set_str(dir, "dir/b c#%-", BLOBSTORE_INDEX_DM, "euca-x-y") == EUCA_OK);
+    CHECK(blobstore_index_set_str(dir, "dir/b c#%-", BLOBSTORE_INDEX_DM, "") == EUCA_OK);
+    CHECK(blobstore_index_set_num(dir, "gone", BLOBSTORE_INDEX_EXISTS, 1) == EUCA_OK);
+    CHECK(blobstore_index_set_num(dir, "gone", BLOBSTORE_INDEX_EXISTS, 0) == EUCA_OK);
+    CHECK(blobstore_index_load(dir, "other-store", &idx) == EUCA_INVALID_ERROR);
+    CHECK(blobstore_index_load(dir, "store", &idx) == EUCA_OK);
+    if (idx != NULL) {
+        CHECK(idx->num_entries == 3);
+        CHECK(idx->num_live == 2);
+        CHECK(((entry = blobstore_index_find(idx, "a")) != NULL) && (entry->refs == 2) && !strcmp(entry->loopback, "/dev/loop7"));
+        CHECK(((entry = blobstore_index_find(idx, "dir/b c#%-")) != NULL) && entry->exists && (entry->dm_name[0] == '\0'));
+        CHECK(((entry = blobstore_index_find(idx, "gone")) != NULL) && !entry->exists);
+        CHECK(blobstore_index_find(idx, "nope") == NULL);
+        blobstore_index_free(idx);
+        idx = NULL;
+    }
+
+    printf("re-created blobs start afresh\n");
+    CHECK(blobstore_index_set_num(dir, "gone", BLOBSTORE_INDEX_REFS, 4) == EUCA_OK);
+    CHECK(blobstore_index_created(dir, "gone", 512) == EUCA_OK);
+    CHECK(blobstore_index_set_num(dir, "gone", BLOBSTORE_INDEX_EXISTS, 0) == EUCA_OK);
+    CHECK(blobstore_index_load(dir, "store", &idx) == EUCA_OK);
+    if (idx != NULL) {
+        CHECK(((entry = blobstore_index_find(idx, "gone")) != NULL) && !entry->exists && (entry->refs == 0));
+        blobstore_index_free(idx);
+        idx = NULL;
+    }
+
+    printf("weak records do not override strong ones\n");
+    walked.id = "a";
+    walked.exists = TRUE;
+    walked.refs = 5;
+    walked.deps = 1;
+    walked.mapped_blocks = 2048;
+    CHECK(blobstore_index_walked(dir, &walked) == EUCA_OK);
+    walked.id = "c";
+    CHECK(blobstore_index_walked(dir, &walked) == EUCA_OK);
+    CHECK(blobstore_index_load(dir, "store", &idx) == EUCA_OK);
+    if (idx != NULL) {
+        CHECK(((entry = blobstore_index_find(idx, "a")) != NULL) && (entry->refs == 2) && (entry->deps == 1) && (entry->mapped_blocks == 2048));
+        CHECK(((entry = blobstore_index_find(idx, "c")) != NULL) && (entry->refs == 5) && entry->exists);
+        blobstore_index_free(idx);
+        idx = NULL;
+    }
+
+    printf("torn and damaged records are skipped\n");
+    if ((fd = open(path, O_WRONLY | O_APPEND)) != -1) {
+        strcpy(record, "S c r 9 #00000000\nS c r 7");   // bad checksum, then an interrupted append
+        CHECK(write_all(fd, record, strlen(record)) == EUCA_OK);
+        close(fd);
+    }
+    CHECK(blobstore_index_set_num(dir, "c", BLOBSTORE_INDEX_DEPS, 3) == EUCA_OK);
+    CHECK(blobstore_index_load(dir, "store", &idx) == EUCA_OK);
+    if (idx != NULL) {
+        CHECK(idx->num_torn == 2);
+        CHECK(((entry = blobstore_index_find(idx, "c")) != NULL) && (entry->refs == 5) && (entry->deps == 3));
+        CHECK(blobstore_index_wants_compaction(idx));
+        blobstore_index_free(idx);
+        idx = NULL;
+    }
+
+    printf("compaction keeps existing blobs only\n");
+    CHECK(blobstore_index_compact(dir, "store") == EUCA_OK);
+    CHECK(blobstore_index_load(dir, "store", &idx) == EUCA_OK);
+    if (idx != NULL) {
+        CHECK(idx->num_torn == 0);
+        CHECK(idx->num_records == 4);
+        CHECK(blobstore_index_find(idx, "gone") == NULL);
+        CHECK(((entry = blobstore_index_find(idx, "a")) != NULL) && (entry->refs == 2) && (entry->strong == ((1U << BLOBSTORE_INDEX_TOTAL) - 1)));
+        blobstore_index_free(idx);
+        idx = NULL;
+    }
+
+    printf("many blobs\n");
+    for (int i = 0; i < 5000; i++) {
+        snprintf(record, sizeof(record), "blob-%d", i);
+        blobstore_index_set_num(dir, record, BLOBSTORE_INDEX_EXISTS, 1);
+        if (i % 2)
+            blobstore_index_set_num(dir, record, BLOBSTORE_INDEX_EXISTS, 0);
+    }
+    CHECK(blobstore_index_load(dir, "store", &idx) == EUCA_OK);
+    if (idx != NULL) {
+        CHECK(idx->num_live == 2500 + 3);
+        CHECK(((entry = blobstore_index_find(idx, "blob-4998")) != NULL) && entry->exists);
+        CHECK(((entry = blobstore_index_find(idx, "blob-4999")) != NULL) && !entry->exists);
+        blobstore_index_free(idx);
+        idx = NULL;
+    }
+
+    printf("incremental refresh keeps the LRU heap and the totals\n");
+    CHECK(blobstore_index_reset(dir, "store") == EUCA_OK);
+    CHECK(blobstore_index_refresh(dir, "store", &idx) == EUCA_OK);
+    for (int i = 0; i < 1000; i++) {
+        snprintf(record, sizeof(record), "lru-%d", i);
+        blobstore_index_created(dir, record, 1024);
+        blobstore_index_set_num(dir, record, BLOBSTORE_INDEX_USED, (i * 7919) % 1000);  // used in a scrambled order
+        if ((i % 10) == 0)
+            CHECK(blobstore_index_refresh(dir, "store", &idx) == EUCA_OK);
+    }
+    blobstore_index_set_num(dir, "lru-0", BLOBSTORE_INDEX_REFS, 1); // lru-0 was used at time 0, but is depended on
+    blobstore_index_set_num(dir, "lru-1", BLOBSTORE_INDEX_HOLLOW, 1);
+    CHECK(blobstore_index_refresh(dir, "store", &idx) == EUCA_OK);
+    if (idx != NULL) {
+        CHECK(idx->num_live == 1000);
+        CHECK(idx->used_blocks == 999 * 2);
+        CHECK(idx->lru_size == 999);
+        CHECK(idx->evictable_blocks == 998 * 2);
+        long long prev = -1;
+        int popped = 0;
+        while ((entry = blobstore_index_lru_first(idx)) != NULL) {
+            CHECK(entry->last_used > prev);
+            prev = entry->last_used;
+            blobstore_index_lru_hold(idx, entry, TRUE);
+            popped++;
+        }
+        CHECK(popped == 999);
+        CHECK(idx->evictable_blocks == 0);
+        CHECK(((entry = blobstore_index_find(idx, "lru-5")) != NULL) && entry->lru_held);
+        blobstore_index_lru_hold(idx, entry, FALSE);
+        CHECK(blobstore_index_lru_first(idx) == entry);
+        blobstore_index_set_num(dir, "lru-5", BLOBSTORE_INDEX_EXISTS, 0);
+        CHECK(blobstore_index_refresh(dir, "store", &idx) == EUCA_OK);
+        CHECK((idx != NULL) && (blobstore_index_lru_first(idx) == NULL) && (idx->used_blocks == 998 * 2));
+    }
+    CHECK(blobstore_index_compact(dir, "store") == EUCA_OK);
+    CHECK(blobstore_index_refresh(dir, "store", &idx) == EUCA_OK);  // replaced, so read afresh
+    if (idx != NULL) {
+        CHECK((idx->num_records == 1000) && (idx->lru_size == 998) && (idx->used_blocks == 998 * 2));
+        blobstore_index_free(idx);
+        idx = NULL;
+    }
+
+    CHECK(blobstore_index_delete(dir) == EUCA_OK);
+    CHECK(blobstore_index_load(dir, "store", &idx) == EUCA_NOT_FOUND_ERROR);
+    rmdir(dir);
+
+#undef CHECK
+
+    printf("%s\n", (errors == 0) ? "all tests passed" : "some tests FAILED");
+    return ((errors == 0) ? 0 : 1);
+}
+#endif /* _UNIT_TEST */
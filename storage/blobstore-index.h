@@ -0,0 +1,218 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+#ifndef _INCLUDE_BLOBSTORE_INDEX_H_
+#define _INCLUDE_BLOBSTORE_INDEX_H_
+
+//!
+//! @file storage/blobstore-index.h
+//! Defines the persistent index of blockblob metadata kept in each blobstore,
+//! which lets the blobstore enumerate its blobs without walking the directory
+//! tree and reading every metadata file of every blob. The in-memory copy of
+//! the index also keeps the space used by the blobs and a least-recently-used
+//! heap of the blobs that may be evicted, both updated as records are replayed.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <sys/types.h>                 // dev_t, ino_t, off_t
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define BLOBSTORE_INDEX_FILE                     ".blobstore.index" //!< name of the index file under the blobstore directory
+#define BLOBSTORE_INDEX_MAX_DM_NAME               128   //!< same as MAX_DM_NAME in blobstore.h
+#define BLOBSTORE_INDEX_MAX_LOOPBACK               64   //!< room for a /dev/loopNNN path
+#define BLOBSTORE_INDEX_HASH_INIT                0x811c9dc5U    //!< initial value for blobstore_index_hash() (FNV-1a offset basis)
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! The per-blob facts recorded in the index
+typedef enum _blobstore_index_field {
+    BLOBSTORE_INDEX_EXISTS = 0,        //!< the .blocks file of the blob exists
+    BLOBSTORE_INDEX_HOLLOW,            //!< the .hollow marker exists
+    BLOBSTORE_INDEX_REFS,              //!< number of entries in .refs (blobs depending on this one)
+    BLOBSTORE_INDEX_DEPS,              //!< number of entries in .deps (blobs this one depends on)
+    BLOBSTORE_INDEX_MAPPED,            //!< sum of the lengths, in 512-byte blocks, of the MAP entries in .deps
+    BLOBSTORE_INDEX_SIG,               //!< hash of the contents of .sig, 0 if there is no signature
+    BLOBSTORE_INDEX_SIZE,              //!< size of the .blocks file, in bytes
+    BLOBSTORE_INDEX_USED,              //!< time the blob was last opened or closed, which orders LRU eviction
+    BLOBSTORE_INDEX_DM,                //!< name of the main device mapper device (last line of .dm), if any
+    BLOBSTORE_INDEX_LOOPBACK,          //!< path of the loopback device recorded in .loopback, if any
+    BLOBSTORE_INDEX_TOTAL,
+} blobstore_index_field;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Indexed metadata of one blockblob, as replayed from the index file
+typedef struct _blobstore_index_entry {
+    char *id;                          //!< ID of the blob
+    char exists;                       //!< TRUE if the blob exists
+    char is_hollow;                    //!< TRUE if the blob is hollow
+    int refs;                          //!< number of blobs depending on this one
+    int deps;                          //!< number of blobs this one depends on
+    long long mapped_blocks;           //!< blocks of this blob's file that are mapped from other blobs
+    unsigned int sig_hash;             //!< hash of the signature, 0 if none
+    long long size_bytes;              //!< size of the .blocks file
+    long long last_used;               //!< time the blob was last opened or closed
+    char dm_name[BLOBSTORE_INDEX_MAX_DM_NAME];  //!< main device mapper device, empty if none
+    char loopback[BLOBSTORE_INDEX_MAX_LOOPBACK];    //!< loopback device, empty if none
+    unsigned int strong;               //!< bitmask of fields set by strong (writer) records since the last reset
+    int lru_pos;                       //!< 1-based position in the LRU heap, 0 if the blob may not be evicted
+    char lru_held;                     //!< TRUE if kept out of the LRU heap by blobstore_index_lru_hold()
+    struct _blobstore_index_entry *next;    //!< next entry, in the order the blobs were first recorded
+    struct _blobstore_index_entry *hnext;   //!< next entry in the same hash bucket
+} blobstore_index_entry;
+
+//! In-memory copy of a blobstore index
+typedef struct _blobstore_index {
+    blobstore_index_entry *head;       //!< all entries, including those of deleted blobs
+    blobstore_index_entry *tail;       //!< last entry of the list above
+    blobstore_index_entry **buckets;   //!< hash table over the entries, keyed by blob ID
+    int buckets_size;                  //!< number of buckets, a power of two
+    int num_entries;                   //!< number of entries in the list
+    int num_live;                      //!< number of entries of blobs that exist
+    int num_records;                   //!< number of valid records replayed from the file
+    int num_torn;                      //!< number of records skipped because they failed the checksum
+    long long used_blocks;             //!< 512-byte blocks taken by the blobs that exist and are not hollow
+    long long evictable_blocks;        //!< blocks taken by the blobs in the LRU heap
+    blobstore_index_entry **lru;       //!< min-heap, by last_used, of existing blobs no other blob depends on
+    int lru_size;                      //!< number of entries in the heap
+    int lru_capacity;                  //!< number of slots allocated for the heap
+    dev_t dev;                         //!< device of the index file this was read from
+    ino_t ino;                         //!< inode of the index file this was read from
+    off_t offset;                      //!< how much of the index file has been replayed
+} blobstore_index;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED PROTOTYPES                            |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+unsigned int blobstore_index_hash(const char *buf, unsigned int len, unsigned int hash);
+int blobstore_index_load(const char *bs_path, const char *bs_id, blobstore_index ** pidx);
+int blobstore_index_refresh(const char *bs_path, const char *bs_id, blobstore_index ** pidx);
+void blobstore_index_free(blobstore_index * idx);
+blobstore_index_entry *blobstore_index_find(blobstore_index * idx, const char *bb_id);
+long long blobstore_index_blocks(const blobstore_index_entry * entry);
+blobstore_index_entry *blobstore_index_lru_first(blobstore_index * idx);
+void blobstore_index_lru_hold(blobstore_index * idx, blobstore_index_entry * entry, int held);
+int blobstore_index_wants_compaction(const blobstore_index * idx);
+int blobstore_index_set(const char *bs_path, const char *bb_id, const char **values);
+int blobstore_index_set_str(const char *bs_path, const char *bb_id, blobstore_index_field field, const char *value);
+int blobstore_index_set_num(const char *bs_path, const char *bb_id, blobstore_index_field field, long long value);
+int blobstore_index_created(const char *bs_path, const char *bb_id, long long size_bytes);
+int blobstore_index_walked(const char *bs_path, const blobstore_index_entry * entry);
+int blobstore_index_reset(const char *bs_path, const char *bs_id);
+int blobstore_index_compact(const char *bs_path, const char *bs_id);
+int blobstore_index_delete(const char *bs_path);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                           STATIC INLINE PROTOTYPES                         |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                          STATIC INLINE IMPLEMENTATION                      |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#endif /* ! _INCLUDE_BLOBSTORE_INDEX_H_ */
@@ -92,6 +92,9 @@
 #include <sys/types.h>                 // gettid
 #include <regex.h>
 #include <libgen.h>                    // basename
+#include <fcntl.h>                     // fallocate
+#include <linux/falloc.h>              // FALLOC_FL_*
+#include <openssl/sha.h>               // SHA1
 
 #include <eucalyptus.h>                // euca user
 #include <misc.h>                      // ensure_...
@@ -99,6 +102,9 @@
 #include <euca_string.h>
 
 #include "blobstore.h"
+#include "blobstore-index.h"
+#include "blobstore-dm.h"
+#include "blobstore-chunks.h"
 #include "diskutil.h"
 
 #ifdef _EUCA_BLOBS
@@ -121,6 +127,7 @@
 #define BLOBSTORE_MAX_CONCURRENT                      99
 #define BLOBSTORE_NO_TIMEOUT                          -1L
 #define BLOBSTORE_SIG_MAX                         262144
+#define BLOBSTORE_RECLAIM_BATCH_BLOCKS           2097152LL  //!< most blocks (1GB) the reclaimer purges before letting launches have the lock
 #define DM_PATH                                  "/dev/mapper/"
 #define DM_FORMAT                                DM_PATH "%s"   //!< @TODO do not hardcode?
 #define MIN_BLOCKS_SNAPSHOT                      32 //!< otherwise dmsetup fails with device-mapper: reload ioctl failed: Cannot allocate memory OR device-mapper: reload ioctl failed: Input/output error
@@ -192,6 +199,7 @@ typedef enum {                         //!< paths to files containing...
     BLOCKBLOB_PATH_SIG,                //!< ...signature of the blob, if provided from outside
     BLOCKBLOB_PATH_REFS,               //!< ...names of blockblobs that depend on this blockblob, if any
     BLOCKBLOB_PATH_HOLLOW,             //!< ...nothing, but the file acts as a marker of 'hollow' blobs
+    BLOCKBLOB_PATH_CHUNKS,             //!< ...list of the shared chunks that hold the content of a deduplicated blob
     BLOCKBLOB_PATH_TOTAL,
 } blockblob_path_t;
 
@@ -222,6 +230,20 @@ typedef struct _blobstore_filelock {
     struct _blobstore_filelock *next;  //!< pointer for constructing a LL
 } blobstore_filelock;
 
+typedef struct _blobstore_reclaimer {
+    blobstore *bs;                     //!< the store being reclaimed, which must outlive the thread
+    pthread_t thread;
+    pthread_mutex_t mutex;             //!< guards everything below
+    pthread_cond_t cond;               //!< signalled to wake the thread up before its interval is up
+    int high_pct;                      //!< purging starts when the store is more than this percent full...
+    int low_pct;                       //!< ...and continues until it is no more than this percent full
+    int interval_sec;                  //!< how often the thread looks at the store on its own
+    boolean running;                   //!< cleared to ask the thread to exit
+    boolean kicked;                    //!< set when a launch pushed the store above the high watermark
+    long long over_since_usec;         //!< when the store was first seen above the high watermark, or 0
+    blobstore_reclaim_stats stats;     //!< counters since the last reset
+} blobstore_reclaimer;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -282,12 +304,14 @@ static const char *blobstore_metadata_suffixes[] = {
     "sig",
     "refs",
     "hollow",
+    "chunks",
 };
 
 static void (*err_fn) (const char *msg) = NULL;
 static unsigned char _do_print_errors = 1;
 static unsigned char _do_print_trace = 1;
 static pthread_mutex_t _blobstore_mutex = PTHREAD_MUTEX_INITIALIZER;    //!< process-global mutex
+static pthread_mutex_t _chunks_mutex = PTHREAD_MUTEX_INITIALIZER;   //!< serializes deduplication, which hands out slots of chunk packs
 static blobstore_filelock *locks_list = NULL;   //!< process-global LL head @TODO replace this with a hash table
 
 //! @{
@@ -313,6 +337,7 @@ static char *helpers[LASTHELPER] = {
 
 static char *helpers_path[LASTHELPER];
 static int initialized = 0;
+static blobstore_dm_backend_t dm_backend = BLOBSTORE_DM_BACKEND_ANY;
 
 #ifdef _UNIT_TEST
 static char *_farray[] = { F1, F2, F3 };
@@ -359,20 +384,32 @@ static int set_blockblob_metadata_path(blockblob_path_t path_t, const blobstore
 static int write_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, const char *str);
 static int read_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char *str, int str_size);
 static int write_array_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char **array, int array_size);
+static long long deps_mapped_blocks(const char *dep);
+static void index_blockblob_metadata(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char **array, int array_size, int lines);
 static int read_array_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char ***array, int *array_size);
 static int update_entry_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, const char *entry, int removing);
 static int typeof_blockblob_metadata_path(const blobstore * bs, const char *path, char *bb_id, unsigned int bb_id_size);
 static int delete_blockblob_files(const blobstore * bs, const char *bb_id);
 static int ensure_blockblob_metadata_path(const blobstore * bs, const char *bb_id);
 static void free_bbs(blockblob * bbs);
+static unsigned int check_opened(blobstore * bs, const char *bb_id, long long timeout_usec);
 static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long timeout_usec);
 static void set_device_path(blockblob * bb);
-static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** tail_bb, const blockblob * bb_to_avoid);
+static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** tail_bb, const blockblob * bb_to_avoid, int rebuild_index);
+static blockblob *rebuild_blobstore_index(blobstore * bs, const blockblob * bb_to_avoid);
+static int load_blobstore_index(blobstore * bs);
+static int load_blobstore_index_for(blobstore * bs, const char *bb_id, unsigned long long size_bytes);
 static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid);
 static int compare_bbs(const void *bb1, const void *bb2);
 static long long purge_blockblobs_lru(blobstore * bs, blockblob * bb_list, long long need_blocks);
+static void hold_blockblobs_lru(blobstore * bs, char **ids, int ids_size, int held);
+static long long purge_indexed_blockblobs_lru(blobstore * bs, const blockblob * bb_to_avoid, long long need_blocks);
+static void reclaimer_note_inline(blobstore * bs, long long used_blocks, long long purged_blocks, long long purge_usec);
+static void reclaim_blobstore(blobstore_reclaimer * r);
+static void *reclaimer_thread(void *arg);
 static int get_stale_refs(const blockblob * bb, char ***refs);
 static int loop_remove(blobstore * bs, const char *bb_id);
+static int dm_use_ioctls(void);
 static int dm_suspend_resume(const char *dev_name);
 static int dm_check_device(const char *dev_name);
 static int dm_delete_device(const char *dev_name);
@@ -382,6 +419,12 @@ static char *dm_get_zero(void);
 static int blockblob_check(const blockblob * bb);
 static int delete_blob_state(blockblob * bb, long long timeout_usec, char do_force);
 static int verify_bb(const blockblob * bb, unsigned long long min_size_bytes);
+static blobstore_chunks *chunks_load(blobstore * bs);
+static int chunks_read_list(blobstore * bs, const char *bb_id, blobstore_chunk_ref ** prefs, int *pnum_refs);
+static blockblob *chunks_open_pack(blobstore * bs, blockblob *** ppacks, int *pnum_packs, int pack, unsigned long long timeout_usec);
+static void chunks_close_packs(blockblob ** packs, int num_packs);
+static int chunks_map(blockblob * bb, const blobstore_chunk_ref * refs, int num_refs, blockblob ** packs);
+static int chunks_restore(blockblob * bb);
 
 #ifdef _UNIT_TEST
 static void _fill_blob(blockblob * bb, char c, int use_file);
@@ -395,6 +438,8 @@ static int do_copy_test(const char *base, const char *name);
 static int do_clone_test(const char *base, const char *name, blobstore_format_t format, blobstore_revocation_t revocation, blobstore_snapshot_t snapshot, int copy_or_snapshot);
 static int do_metadata_test(const char *base, const char *name);
 static int do_blobstore_test(const char *base, const char *name, blobstore_format_t format, blobstore_revocation_t revocation);
+static int do_reclaimer_test(const char *base, const char *name);
+static int do_dm_backend_bench(const char *base, const char *name, int iterations);
 static void *competitor_function(void *ptr);
 static void *thread_function(void *ptr);
 static void dummy_err_fn(const char *msg);
@@ -726,6 +771,18 @@ void blobstore_set_error_function(void (*fn) (const char *msg))
     err_fn = fn;
 }
 
+//!
+//! Selects how device mapper devices are set up and removed. The default,
+//! BLOBSTORE_DM_BACKEND_ANY, uses ioctls when this process is allowed to
+//! issue them and 'dmsetup' otherwise.
+//!
+//! @param[in] backend the backend to use from now on
+//!
+void blobstore_set_dm_backend(blobstore_dm_backend_t backend)
+{
+    dm_backend = backend;
+}
+
 //!
 //!
 //!
@@ -1623,6 +1680,8 @@ out:
 //!
 int blobstore_close(blobstore * bs)
 {
+    blobstore_reclaimer_stop(bs);
+    blobstore_index_free(bs->index);
     EUCA_FREE(bs);
     return 0;
 }
@@ -1685,6 +1744,8 @@ int blobstore_unlock(blobstore * bs)
 //!
 int blobstore_delete(blobstore * bs)
 {
+    blobstore_reclaimer_stop(bs);      // the baloon blob below does all the purging there is to do
+
     LOGINFO("creating the baloon blob\n");
     blockblob *bb = blockblob_open(bs, "__baloon_blob__",
                                    bs->limit_blocks * 512,  // biggest possible blob
@@ -1702,6 +1763,8 @@ int blobstore_delete(blobstore * bs)
     snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_METADATA_FILE);
     LOGINFO("removing blobstore metadata '%s'\n", meta_path);
     unlink(meta_path);
+    blobstore_index_delete(bs->path);
+    blobstore_index_free(bs->index);
     EUCA_FREE(bs);
 
     return EUCA_OK;
@@ -1774,6 +1837,9 @@ static int set_blockblob_metadata_path(blockblob_path_t path_t, const blobstore
     case BLOCKBLOB_PATH_HOLLOW:
         euca_strncpy(name, blobstore_metadata_suffixes[BLOCKBLOB_PATH_HOLLOW], sizeof(name));
         break;
+    case BLOCKBLOB_PATH_CHUNKS:
+        euca_strncpy(name, blobstore_metadata_suffixes[BLOCKBLOB_PATH_CHUNKS], sizeof(name));
+        break;
     default:
         ERR(BLOBSTORE_ERROR_INVAL, "invalid path_t");
         return -1;
@@ -1828,6 +1894,8 @@ static int write_blockblob_metadata_path(blockblob_path_t path_t, const blobstor
         ret = -1;
     } else if (ret_close != 0) {
         ret = -1;                      // close_and_unlock should have set the error code
+    } else {
+        index_blockblob_metadata(path_t, bs, bb_id, (char **)&str, 1, FALSE);
     }
 
     return ret;
@@ -1923,9 +1991,98 @@ static int write_array_blockblob_metadata_path(blockblob_path_t path_t, const bl
         ret = -1;
     }
 
+    if (ret == 0) {
+        index_blockblob_metadata(path_t, bs, bb_id, array, array_size, TRUE);
+    }
+
     return (ret);
 }
 
+//!
+//! Parses an entry of a .deps file ("store_path blob_id relation start_block len_blocks")
+//!
+//! @param[in] dep the entry
+//!
+//! @return the number of blocks the entry maps from another blob, 0 if it is not a MAP
+//!
+static long long deps_mapped_blocks(const char *dep)
+{
+    char buf[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
+    char *saveptr = NULL;
+    char *rel_type = NULL;
+    char *len_blocks = NULL;
+
+    euca_strncpy(buf, dep, sizeof(buf));
+    strtok_r(buf, " ", &saveptr);      // store_path
+    strtok_r(NULL, " ", &saveptr);     // blob_id
+    rel_type = strtok_r(NULL, " ", &saveptr);
+    strtok_r(NULL, " ", &saveptr);     // start_block
+    len_blocks = strtok_r(NULL, " ", &saveptr);
+    if (rel_type && len_blocks && strcmp(rel_type, blobstore_relation_type_name[BLOBSTORE_MAP]) == 0) {
+        return (strtoull(len_blocks, NULL, 0));
+    }
+    return (0);
+}
+
+//!
+//! Records in the blobstore index what a metadata file that was just written
+//! tells about the blob, so that scan_blobstore() does not have to read it
+//!
+//! @param[in] path_t type of the metadata file
+//! @param[in] bs
+//! @param[in] bb_id
+//! @param[in] array the contents of the file: lines or a single string
+//! @param[in] array_size number of elements in 'array'
+//! @param[in] lines TRUE if each element of 'array' was written as a line
+//!
+//! @pre The metadata file has been written successfully
+//!
+//! @note Failures are only logged: the index is rebuilt by blobstore_fsck()
+//!
+static void index_blockblob_metadata(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char **array, int array_size, int lines)
+{
+    long long mapped_blocks = 0;
+    unsigned int hash = BLOBSTORE_INDEX_HASH_INIT;
+    const char *values[BLOBSTORE_INDEX_TOTAL] = { NULL };
+    char deps[32] = "";
+    char mapped[32] = "";
+
+    switch (path_t) {
+    case BLOCKBLOB_PATH_HOLLOW:
+        blobstore_index_set_num(bs->path, bb_id, BLOBSTORE_INDEX_HOLLOW, 1);
+        break;
+    case BLOCKBLOB_PATH_REFS:
+        blobstore_index_set_num(bs->path, bb_id, BLOBSTORE_INDEX_REFS, array_size);
+        break;
+    case BLOCKBLOB_PATH_DEPS:
+        for (int i = 0; i < array_size; i++) {
+            mapped_blocks += deps_mapped_blocks(array[i]);
+        }
+        snprintf(deps, sizeof(deps), "%d", array_size);
+        snprintf(mapped, sizeof(mapped), "%lld", mapped_blocks);
+        values[BLOBSTORE_INDEX_DEPS] = deps;
+        values[BLOBSTORE_INDEX_MAPPED] = mapped;
+        blobstore_index_set(bs->path, bb_id, values);
+        break;
+    case BLOCKBLOB_PATH_DM:
+        blobstore_index_set_str(bs->path, bb_id, BLOBSTORE_INDEX_DM, (array_size > 0) ? (array[array_size - 1]) : (""));   // main device is the last one
+        break;
+    case BLOCKBLOB_PATH_LOOPBACK:
+        blobstore_index_set_str(bs->path, bb_id, BLOBSTORE_INDEX_LOOPBACK, (array_size > 0) ? (array[0]) : (""));
+        break;
+    case BLOCKBLOB_PATH_SIG:
+        for (int i = 0; i < array_size; i++) {
+            hash = blobstore_index_hash(array[i], strlen(array[i]), hash);
+            if (lines)
+                hash = blobstore_index_hash("\n", 1, hash);
+        }
+        blobstore_index_set_num(bs->path, bb_id, BLOBSTORE_INDEX_SIG, hash);
+        break;
+    default:
+        break;
+    }
+}
+
 //!
 //! The equivalent of getline for file descriptor.
 //!
@@ -2250,6 +2407,10 @@ static int delete_blockblob_files(const blobstore * bs, const char *bb_id)
         }
     }
 
+    if (count > 0) {
+        blobstore_index_set_num(bs->path, bb_id, BLOBSTORE_INDEX_EXISTS, 0);
+    }
+
     return count;
 }
 
@@ -2291,19 +2452,20 @@ static void free_bbs(blockblob * bbs)
 }
 
 //!
-//!
+//! Probes the lock file of a blob to see whether it is open right now or was
+//! left open by a process that went away
 //!
 //! @param[in] bs
 //! @param[in] bb_id
 //! @param[in] timeout_usec
 //!
-//! @return
+//! @return BLOCKBLOB_STATUS_OPENED and/or BLOCKBLOB_STATUS_ABANDONED, or 0
 //!
 //! @pre
 //!
 //! @note
 //!
-static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long timeout_usec)
+static unsigned int check_opened(blobstore * bs, const char *bb_id, long long timeout_usec)
 {
     unsigned int in_use = 0;
     char path[PATH_MAX];
@@ -2324,7 +2486,30 @@ static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long ti
     } else {
         in_use |= BLOCKBLOB_STATUS_OPENED;  //! @TODO check if open failed for other reason?
     }
+    _err_on();
+
+    return in_use;
+}
+
+//!
+//!
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//! @param[in] timeout_usec
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long timeout_usec)
+{
+    unsigned int in_use = check_opened(bs, bb_id, timeout_usec);
+    char path[PATH_MAX];
 
+    _err_off();                        // do not complain if metadata files do not exist
     if (read_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, bb_id, path, sizeof(path)) > 0) {
         in_use |= BLOCKBLOB_STATUS_MAPPED;
     }
@@ -2399,7 +2584,8 @@ int blobstore_delete_nonblobs(blobstore * bs, const char *dir_path)
     while ((dir_entry = readdir(dir)) != NULL) {
         char *entry_name = dir_entry->d_name;
 
-        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || !strcmp(BLOBSTORE_METADATA_FILE, entry_name))
+        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || !strcmp(BLOBSTORE_METADATA_FILE, entry_name)
+            || !strncmp(BLOBSTORE_INDEX_FILE, entry_name, strlen(BLOBSTORE_INDEX_FILE)))
             continue;                  // ignore known unrelated files
 
         // get the path of the directory item
@@ -2428,6 +2614,7 @@ int blobstore_delete_nonblobs(blobstore * bs, const char *dir_path)
 //! @param[in] dir_path
 //! @param[in] tail_bb
 //! @param[in] bb_to_avoid
+//! @param[in] rebuild_index if TRUE, record everything found about each blob in the blobstore index
 //!
 //! @return
 //!
@@ -2435,7 +2622,7 @@ int blobstore_delete_nonblobs(blobstore * bs, const char *dir_path)
 //!
 //! @note
 //!
-static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** tail_bb, const blockblob * bb_to_avoid)
+static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** tail_bb, const blockblob * bb_to_avoid, int rebuild_index)
 {
     DIR *dir;
     if ((dir = opendir(dir_path)) == NULL) {
@@ -2446,7 +2633,8 @@ static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** ta
     while ((dir_entry = readdir(dir)) != NULL) {
         char *entry_name = dir_entry->d_name;
 
-        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || !strcmp(BLOBSTORE_METADATA_FILE, entry_name))
+        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || !strcmp(BLOBSTORE_METADATA_FILE, entry_name)
+            || !strncmp(BLOBSTORE_INDEX_FILE, entry_name, strlen(BLOBSTORE_INDEX_FILE)))
             continue;                  // ignore known unrelated files
 
         // get the path of the directory item
@@ -2460,7 +2648,7 @@ static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** ta
         }
         // recurse if this is a directory
         if (S_ISDIR(sb.st_mode)) {
-            tail_bb = walk_bs(bs, entry_path, tail_bb, bb_to_avoid);
+            tail_bb = walk_bs(bs, entry_path, tail_bb, bb_to_avoid, rebuild_index);
             if (tail_bb == NULL) {
                 closedir(dir);
                 return NULL;
@@ -2502,23 +2690,12 @@ static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** ta
         // if there is a .refs file, subtract the mapped blocks, if any, from the size
         char **array = NULL;
         int array_size = 0;
+        long long mapped_blocks = 0;
         if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, &array, &array_size) != -1) {
             for (int i = 0; i < array_size; i++) {
-                char *store_path = NULL;
-                char *blob_id = NULL;
-                char *rel_type = NULL;
-                char *start_block = NULL;
-                char *len_blocks = NULL;
-
-                store_path = strtok(array[i], " ");
-                blob_id = strtok(NULL, " ");
-                rel_type = strtok(NULL, " ");
-                start_block = strtok(NULL, " ");
-                len_blocks = strtok(NULL, " ");
-                if (rel_type && len_blocks && strcmp(rel_type, blobstore_relation_type_name[BLOBSTORE_MAP]) == 0) {
-                    bb->size_bytes -= strtoull(len_blocks, NULL, 0) * 512LL;
-                }
+                mapped_blocks += deps_mapped_blocks(array[i]);
             }
+            bb->size_bytes -= mapped_blocks * 512LL;
         }
 
         if (array) {
@@ -2526,6 +2703,41 @@ static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** ta
                 EUCA_FREE(array[i]);
             EUCA_FREE(array);
         }
+
+        if (rebuild_index) {
+            blobstore_index_entry entry = { 0 };
+            char **refs = NULL;
+            int refs_size = 0;
+
+            entry.id = bb->id;
+            entry.exists = TRUE;
+            entry.is_hollow = bb->is_hollow;
+            entry.deps = array_size;
+            entry.mapped_blocks = mapped_blocks;
+            entry.size_bytes = sb.st_size;
+            entry.last_used = sb.st_mtime;  // the best guess there is
+            euca_strncpy(entry.dm_name, bb->dm_name, sizeof(entry.dm_name));
+
+            _err_off();                // most blobs have neither of these
+            if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bb->store, bb->id, &refs, &refs_size) != -1) {
+                entry.refs = refs_size;
+                for (int i = 0; i < refs_size; i++)
+                    EUCA_FREE(refs[i]);
+                EUCA_FREE(refs);
+            }
+            read_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bb->store, bb->id, entry.loopback, sizeof(entry.loopback) - 1);
+            char *sig = EUCA_ZALLOC(BLOBSTORE_SIG_MAX, sizeof(char));   // too big for the stack of a recursive function
+            if (sig != NULL) {
+                int sig_size = read_blockblob_metadata_path(BLOCKBLOB_PATH_SIG, bb->store, bb->id, sig, BLOBSTORE_SIG_MAX);
+                if (sig_size > 0) {
+                    entry.sig_hash = blobstore_index_hash(sig, sig_size, BLOBSTORE_INDEX_HASH_INIT);
+                }
+                EUCA_FREE(sig);
+            }
+            _err_on();
+
+            blobstore_index_walked(bs->path, &entry);
+        }
     }
 
 free:
@@ -2534,29 +2746,188 @@ free:
 }
 
 //!
-//! Runs through the blobstore and puts all found blockblobs into a linked list, returning its head
+//! Runs through the whole blobstore directory tree, puts all found blockblobs
+//! into a linked list, and rebuilds the blobstore index from what it finds
 //!
 //! @param[in] bs
 //! @param[in] bb_to_avoid
 //!
 //! @return A pointer to the head of a linked list containing all found blockblobs
 //!
-//! @pre
+//! @pre The blobstore is locked
+//!
+//! @note Writers of blob metadata do not take the blobstore lock, so the walk
+//!       records what it finds as weak records that yield to their updates
+//!
+static blockblob *rebuild_blobstore_index(blobstore * bs, const blockblob * bb_to_avoid)
+{
+    blockblob *bbs = NULL;
+    blockblob **pbb = NULL;
+    blockblob *avoided = NULL;
+
+    LOGINFO("rebuilding the index of blobstore %s\n", bs->path);
+    if (blobstore_index_reset(bs->path, bs->id) != EUCA_OK) {
+        LOGWARN("failed to reset the index of blobstore %s, it will be rebuilt on next scan\n", bs->path);
+    }
+    // the avoided blob is walked, too, so that it makes it into the index
+    if (walk_bs(bs, bs->path, &bbs, NULL, TRUE) == NULL) {
+        if (bbs)
+            free_bbs(bbs);
+        return NULL;
+    }
+    blobstore_index_compact(bs->path, bs->id);
+
+    if (bb_to_avoid != NULL) {
+        for (pbb = &bbs; *pbb != NULL; pbb = &((*pbb)->next)) {
+            if (strncmp((*pbb)->id, bb_to_avoid->id, sizeof((*pbb)->id)) == 0) {
+                avoided = *pbb;
+                *pbb = avoided->next;
+                EUCA_FREE(avoided);
+                break;
+            }
+        }
+    }
+
+    return bbs;
+}
+
+//!
+//! Puts all blockblobs recorded in the blobstore index into a linked list,
+//! returning its head. Only the .blocks and .lock files of each blob are looked
+//! at: the former for the size and timestamps, which change as the blob is written
+//! through its device, the latter for whether the blob is open. If the blobstore
+//! has no usable index, e.g., it was created by an older version, one is built
+//! by walking the directory tree.
+//!
+//! @param[in] bs
+//! @param[in] bb_to_avoid
+//!
+//! @return A pointer to the head of a linked list containing all found blockblobs
+//!
+//! @pre The blobstore is locked
 //!
 //! @note
 //!
 static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid)
 {
     blockblob *bbs = NULL;
-    if (walk_bs(bs, bs->path, &bbs, bb_to_avoid) == NULL) {
-        if (bbs)
+    blockblob **tail_bb = &bbs;
+    struct stat sb;
+
+    if (blobstore_index_refresh(bs->path, bs->id, &(bs->index)) != EUCA_OK) {
+        return rebuild_blobstore_index(bs, bb_to_avoid);
+    }
+
+    for (blobstore_index_entry * entry = bs->index->head; entry != NULL; entry = entry->next) {
+        if (!entry->exists)
+            continue;
+
+        if (bb_to_avoid != NULL && strncmp(entry->id, bb_to_avoid->id, sizeof(bb_to_avoid->id)) == 0)
+            continue;                  // avoid that particular blockblob
+
+        blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
+        if (bb == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
             free_bbs(bbs);
-        bbs = NULL;
+            bbs = NULL;
+            break;
+        }
+
+        bb->store = bs;
+        euca_strncpy(bb->id, entry->id, sizeof(bb->id));
+        set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb->id, bb->blocks_path, sizeof(bb->blocks_path));
+        if (stat(bb->blocks_path, &sb) == -1) {
+            // removed behind the blobstore's back, fsck will drop it from the index
+            EUCA_FREE(bb);
+            continue;
+        }
+        *tail_bb = bb;                 // add to LL
+        tail_bb = &(bb->next);
+
+        if (entry->dm_name[0] != '\0') {
+            snprintf(bb->device_path, sizeof(bb->device_path), DM_FORMAT, entry->dm_name);
+            euca_strncpy(bb->dm_name, entry->dm_name, sizeof(bb->dm_name));
+        } else {
+            euca_strncpy(bb->device_path, entry->loopback, sizeof(bb->device_path));
+        }
+        bb->size_bytes = sb.st_size - entry->mapped_blocks * 512LL;
+        bb->blocks_allocated = sb.st_blocks;
+        bb->last_accessed = sb.st_atime;
+        bb->last_modified = sb.st_mtime;
+        bb->snapshot_type = BLOBSTORE_FORMAT_ANY;   // it is not necessary to know whether this is a snapshot
+        bb->is_hollow = entry->is_hollow;
+        bb->in_use = check_opened(bs, bb->id, 0);
+        if (entry->refs > 0) {
+            bb->in_use |= BLOCKBLOB_STATUS_MAPPED;
+        }
+        if ((entry->deps > 0) || (entry->dm_name[0] != '\0')) {
+            bb->in_use |= BLOCKBLOB_STATUS_BACKED;
+        }
+    }
+
+    if (blobstore_index_wants_compaction(bs->index)) {
+        blobstore_index_compact(bs->path, bs->id);
     }
 
     return bbs;
 }
 
+//!
+//! Brings the in-memory copy of the blobstore index up to date, building the
+//! index first if the blobstore does not have a usable one
+//!
+//! @param[in] bs
+//!
+//! @return 0 if bs->index is usable or -1 if the index could not be built
+//!
+//! @pre The blobstore is locked
+//!
+//! @note
+//!
+static int load_blobstore_index(blobstore * bs)
+{
+    if (blobstore_index_refresh(bs->path, bs->id, &(bs->index)) == EUCA_OK) {
+        return 0;
+    }
+
+    free_bbs(rebuild_blobstore_index(bs, NULL));
+    if (blobstore_index_refresh(bs->path, bs->id, &(bs->index)) == EUCA_OK) {
+        return 0;
+    }
+    return -1;
+}
+
+//!
+//! Same as load_blobstore_index(), for the creation of a blob, making sure that
+//! the index counts the new blob with its full size: an index that had to be
+//! built after the blob was created only saw its still-empty content file.
+//!
+//! @param[in] bs
+//! @param[in] bb_id ID of the blob being created
+//! @param[in] size_bytes size the blob is being created with
+//!
+//! @return 0 if bs->index is usable or -1 if the index could not be built
+//!
+//! @pre The blobstore is locked
+//!
+//! @note
+//!
+static int load_blobstore_index_for(blobstore * bs, const char *bb_id, unsigned long long size_bytes)
+{
+    blobstore_index_entry *own = NULL;
+
+    if (load_blobstore_index(bs))
+        return -1;
+
+    own = blobstore_index_find(bs->index, bb_id);
+    if ((own != NULL) && own->exists && (own->size_bytes == (long long)size_bytes))
+        return 0;
+
+    if (blobstore_index_created(bs->path, bb_id, size_bytes) != EUCA_OK)
+        return -1;
+    return load_blobstore_index(bs);
+}
+
 //!
 //!
 //!
@@ -2660,97 +3031,511 @@ static long long purge_blockblobs_lru(blobstore * bs, blockblob * bb_list, long
 }
 
 //!
-//!
+//! Keeps the given blobs out of the LRU heap of the blobstore index, or lets them back in
 //!
 //! @param[in] bs
-//! @param[in] meta
-//!
-//! @return
+//! @param[in] ids IDs of the blobs
+//! @param[in] ids_size number of IDs
+//! @param[in] held TRUE to keep the blobs out, FALSE to let them back in
 //!
 //! @pre
 //!
 //! @note
 //!
-int blobstore_stat(blobstore * bs, blobstore_meta * meta)
+static void hold_blockblobs_lru(blobstore * bs, char **ids, int ids_size, int held)
 {
-    int ret = 0;
-
-    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
-        return EUCA_ERROR;
-    }
-    // put existing items in the blobstore into a LL
-    _blobstore_errno = BLOBSTORE_ERROR_OK;
-    blockblob *bbs = scan_blobstore(bs, NULL);
-    if (bbs == NULL) {
-        if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
-            goto unlock;
-        }
-    }
-    // analyze the LL, calculating sizes
-    meta->blocks_allocated = 0;
-    meta->blocks_unlocked = 0;
-    meta->blocks_locked = 0;
-    meta->num_blobs = 0;
-    for (blockblob * abb = bbs; abb;) {
-        //! @TODO unify this with locked/unlocked calculation in open()
-        long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
-        if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
-            // these can't be purged if we need space
-            //! @TODO look into recursive purging of unused references?
-            meta->blocks_locked += abb_size_blocks;
-        } else {
-            // these potentially can be purged, unless they are depended on by locked ones
-            meta->blocks_unlocked += abb_size_blocks;
-        }
-        meta->blocks_allocated += abb->blocks_allocated;
-        meta->num_blobs++;
-
-        // free this node and move the pointer
-        blockblob *old_bb = abb;
-        abb = abb->next;
-        EUCA_FREE(old_bb);
-    }
-
-unlock:
+    blobstore_index_entry *entry = NULL;
 
-    if (blobstore_unlock(bs) == -1) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
-    }
+    if (bs->index == NULL)
+        return;
 
-    euca_strncpy(meta->id, bs->id, sizeof(meta->id));
-    meta->revocation_policy = bs->revocation_policy;
-    meta->snapshot_policy = bs->snapshot_policy;
-    meta->format = bs->format;
-    meta->blocks_limit = bs->limit_blocks;
-    if (realpath(bs->path, meta->path) == NULL) {
-        LOGERROR("failed to resolve the blobstore path %s\n", bs->path);
-        ret = EUCA_ERROR;
+    for (int i = 0; i < ids_size; i++) {
+        if ((entry = blobstore_index_find(bs->index, ids[i])) != NULL) {
+            blobstore_index_lru_hold(bs->index, entry, held);
+        }
     }
-
-    return ret;
 }
 
 //!
-//! Read .refs file content and return any entries that point to blobs that no longer exist
+//! Frees at least 'need_blocks' blocks by deleting blobs in LRU order, as kept
+//! by the blobstore index. Only the candidates for eviction are looked at: each
+//! is checked with check_in_use(), in case the index is behind, and skipped if it
+//! is in use. Deleting a blob updates the index, so blobs that only it depended
+//! on become candidates as soon as it is gone.
 //!
-//! @param[in]  bb
-//! @param[out] refs
+//! @param[in] bs
+//! @param[in] bb_to_avoid the blob being created, which must not be evicted
+//! @param[in] need_blocks
 //!
-//! @return size of the array placed into *refs, which caller must free, or -1 on error
+//! @return the number of blocks freed
 //!
-//! @pre
+//! @pre The blobstore is locked and bs->index is up to date
 //!
 //! @note
 //!
-static int get_stale_refs(const blockblob * bb, char ***refs)
+static long long purge_indexed_blockblobs_lru(blobstore * bs, const blockblob * bb_to_avoid, long long need_blocks)
 {
-    blobstore *bs = bb->store;
-    char **array = NULL;
-    int array_size = 0;
-    int stale_refs = 0;
+    long long purged = 0;
+    long long blocks = 0;
+    int held_size = 0;
+    int held_capacity = 0;
+    char code = '?';
+    char **held = NULL;
+    char **bigger_held = NULL;
+    blobstore_index *idx = NULL;
+    blobstore_index_entry *entry = NULL;
+    blockblob *bb = NULL;
+
+    if ((bb = EUCA_ZALLOC(1, sizeof(blockblob))) == NULL)
+        return purged;
+
+    while ((purged < need_blocks) && (bs->index != NULL) && ((entry = blobstore_index_lru_first(bs->index)) != NULL)) {
+        // whatever happens to this blob, do not consider it again during this purge
+        if (held_size == held_capacity) {
+            held_capacity = (held_capacity > 0) ? (held_capacity * 2) : (32);
+            if ((bigger_held = EUCA_REALLOC(held, held_capacity, sizeof(char *))) == NULL)
+                break;
+            held = bigger_held;
+        }
+        if ((held[held_size] = strdup(entry->id)) == NULL)
+            break;
+        held_size++;
+        blobstore_index_lru_hold(bs->index, entry, TRUE);
 
-    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bb->store, bb->id, &array, &array_size) != -1) {
-        for (int i = 0; i < array_size; i++) {
+        if ((bb_to_avoid != NULL) && (strcmp(entry->id, bb_to_avoid->id) == 0))
+            continue;
+
+        bzero(bb, sizeof(blockblob));
+        bb->store = bs;
+        euca_strncpy(bb->id, entry->id, sizeof(bb->id));
+        bb->size_bytes = entry->size_bytes;
+        bb->last_modified = entry->last_used;
+        blocks = blobstore_index_blocks(entry);
+        bb->in_use = check_in_use(bs, bb->id, 0);   // trust the files rather than the index before deleting
+
+        if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
+            code = 'C';                // mapped blobs have children, the index has yet to learn about them
+        } else if (bb->in_use & BLOCKBLOB_STATUS_OPENED) {
+            code = 'O';
+        } else if (delete_blob_state(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1) == -1) {
+            code = '!';
+        } else {
+            purged += blocks;
+            code = 'D';
+        }
+        LOGDEBUG("LRU %08lld: %29s %c%c%c%c %c %9llu %s", purged, bb->id, (bb->in_use & BLOCKBLOB_STATUS_OPENED) ? ('o') : ('-'),  // o = open
+                 (bb->in_use & BLOCKBLOB_STATUS_BACKED) ? ('p') : ('-'),    // p = has parents
+                 (bb->in_use & BLOCKBLOB_STATUS_MAPPED) ? ('c') : ('-'),    // c = has children
+                 (bb->in_use & BLOCKBLOB_STATUS_ABANDONED) ? ('a') : ('-'), // a = was abandoned
+                 code,                 // outcome codes: D=deleted, else C=children, !=undeletable, O=open
+                 bb->size_bytes / 512L, // size is in sectors
+                 ctime(&(bb->last_modified)));  // ctime adds a newline
+
+        if (code == 'D') {
+            // replay what the deletion recorded, including the .refs of the blobs it depended on
+            idx = bs->index;
+            blobstore_index_refresh(bs->path, bs->id, &(bs->index));
+            if (bs->index != idx) {    // the index was read afresh, so the holds are gone
+                hold_blockblobs_lru(bs, held, held_size, TRUE);
+            }
+        }
+    }
+
+    hold_blockblobs_lru(bs, held, held_size, FALSE);
+    for (int i = 0; i < held_size; i++) {
+        EUCA_FREE(held[i]);
+    }
+    EUCA_FREE(held);
+    EUCA_FREE(bb);
+
+    return purged;
+}
+
+//!
+//! Records in the reclaimer counters that a launch had to purge the store itself
+//! and wakes the reclaimer up if the launch left the store above its high
+//! watermark, so that the next launch is less likely to have to purge.
+//!
+//! @param[in] bs
+//! @param[in] used_blocks blocks in use once the blob being created is counted
+//! @param[in] purged_blocks blocks purged by the launch, if any
+//! @param[in] purge_usec time spent purging by the launch
+//!
+//! @pre
+//!
+//! @note
+//!
+static void reclaimer_note_inline(blobstore * bs, long long used_blocks, long long purged_blocks, long long purge_usec)
+{
+    blobstore_reclaimer *r = bs->reclaimer;
+
+    if (r == NULL)
+        return;
+
+    pthread_mutex_lock(&(r->mutex));
+    {
+        if (purged_blocks > 0) {
+            r->stats.inline_purges++;
+            r->stats.inline_blocks += purged_blocks;
+            r->stats.inline_usec += purge_usec;
+        }
+        r->stats.used_blocks = used_blocks;
+        if (used_blocks > r->stats.high_blocks) {
+            r->kicked = TRUE;
+            pthread_cond_signal(&(r->cond));
+        }
+    }
+    pthread_mutex_unlock(&(r->mutex));
+}
+
+//!
+//! One pass of the reclaimer: if the store is above its high watermark, purges
+//! it in LRU order down to the low watermark. Purging is done in batches of at
+//! most BLOBSTORE_RECLAIM_BATCH_BLOCKS, with the blobstore lock released between
+//! batches, so that launches waiting for the lock are not held up for the whole
+//! pass. A pass that cannot free anything (everything evictable is in use) gives
+//! up until the next one and leaves the lag running.
+//!
+//! @param[in] r
+//!
+//! @pre
+//!
+//! @note
+//!
+static void reclaim_blobstore(blobstore_reclaimer * r)
+{
+    blobstore *bs = r->bs;
+    long long used = 0;
+    long long excess = 0;
+    long long purged = 0;
+    long long started = 0;
+    long long now = 0;
+
+    for (;;) {
+        if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1)
+            return;                    // busy, try again on the next pass
+
+        if (load_blobstore_index(bs)) {
+            blobstore_unlock(bs);
+            return;
+        }
+        used = bs->index->used_blocks;
+        now = time_usec();
+
+        pthread_mutex_lock(&(r->mutex));
+        {
+            r->stats.used_blocks = used;
+            if ((r->over_since_usec == 0) && (used > r->stats.high_blocks)) {
+                r->over_since_usec = now;
+            }
+            if ((r->over_since_usec != 0) && (used <= r->stats.low_blocks)) {
+                if ((now - r->over_since_usec) > r->stats.max_lag_usec)
+                    r->stats.max_lag_usec = now - r->over_since_usec;
+                r->over_since_usec = 0;
+            }
+            excess = (r->over_since_usec != 0 && r->running) ? (used - (long long)r->stats.low_blocks) : (0);
+        }
+        pthread_mutex_unlock(&(r->mutex));
+
+        if (excess <= 0) {
+            blobstore_unlock(bs);
+            return;
+        }
+
+        started = time_usec();
+        _err_off();                    // do not care about errors duing purging
+        purged = purge_indexed_blockblobs_lru(bs, NULL, MIN(excess, BLOBSTORE_RECLAIM_BATCH_BLOCKS));
+        _err_on();
+        now = time_usec();
+        blobstore_unlock(bs);
+
+        pthread_mutex_lock(&(r->mutex));
+        r->stats.purged_blocks += purged;
+        r->stats.purge_usec += (now - started);
+        r->stats.purge_passes++;
+        pthread_mutex_unlock(&(r->mutex));
+        LOGDEBUG("reclaimed %lld blocks from %s in %lld usec (%lld blocks were in use)\n", purged, bs->path, (now - started), used);
+
+        if (purged == 0)
+            return;
+    }
+}
+
+//!
+//! Body of the reclaimer thread, which runs a reclaim pass every interval_sec
+//! seconds or as soon as a launch signals that the store went above its high
+//! watermark, until blobstore_reclaimer_stop() clears 'running'.
+//!
+//! @param[in] arg pointer to the blobstore_reclaimer
+//!
+//! @return NULL
+//!
+//! @pre
+//!
+//! @note
+//!
+static void *reclaimer_thread(void *arg)
+{
+    blobstore_reclaimer *r = (blobstore_reclaimer *) arg;
+    struct timespec deadline = { 0 };
+
+    LOGINFO("started reclaimer for %s (high=%d%% low=%d%% interval=%ds)\n", r->bs->path, r->high_pct, r->low_pct, r->interval_sec);
+    pthread_mutex_lock(&(r->mutex));
+    while (r->running) {
+        if (!r->kicked) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += r->interval_sec;
+            pthread_cond_timedwait(&(r->cond), &(r->mutex), &deadline);
+        }
+        if (!r->running)
+            break;
+        r->kicked = FALSE;
+        pthread_mutex_unlock(&(r->mutex));
+        reclaim_blobstore(r);
+        pthread_mutex_lock(&(r->mutex));
+    }
+    pthread_mutex_unlock(&(r->mutex));
+    LOGINFO("stopped reclaimer for %s\n", r->bs->path);
+
+    return NULL;
+}
+
+//!
+//! Starts a background thread that keeps an LRU blobstore between the given
+//! watermarks, so that launches rarely have to purge the store themselves.
+//! The store must not be closed before blobstore_reclaimer_stop() is called,
+//! which blobstore_close() and blobstore_delete() do.
+//!
+//! @param[in] bs
+//! @param[in] high_pct percentage of the limit above which purging starts
+//! @param[in] low_pct percentage of the limit down to which purging continues
+//! @param[in] interval_sec how often to look at the store when not woken up
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_MEMORY_ERROR: if the reclaimer could not be allocated
+//!         \li EUCA_THREAD_ERROR: if the thread could not be started
+//!
+//! @pre The bs parameter must not be NULL, its revocation policy must be LRU,
+//!      0 < low_pct < high_pct <= 100, and interval_sec must be positive
+//!
+//! @note Only one reclaimer may run per blobstore handle
+//!
+int blobstore_reclaimer_start(blobstore * bs, int high_pct, int low_pct, int interval_sec)
+{
+    blobstore_reclaimer *r = NULL;
+
+    if ((bs == NULL) || (bs->revocation_policy != BLOBSTORE_REVOCATION_LRU) || (bs->reclaimer != NULL)
+        || (low_pct <= 0) || (low_pct >= high_pct) || (high_pct > 100) || (interval_sec <= 0)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "invalid reclaimer parameters");
+        return (EUCA_INVALID_ERROR);
+    }
+
+    if ((r = EUCA_ZALLOC(1, sizeof(blobstore_reclaimer))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return (EUCA_MEMORY_ERROR);
+    }
+
+    r->bs = bs;
+    r->high_pct = high_pct;
+    r->low_pct = low_pct;
+    r->interval_sec = interval_sec;
+    r->running = TRUE;
+    r->stats.limit_blocks = bs->limit_blocks;
+    r->stats.high_blocks = (bs->limit_blocks * high_pct) / 100;
+    r->stats.low_blocks = (bs->limit_blocks * low_pct) / 100;
+    pthread_mutex_init(&(r->mutex), NULL);
+    pthread_cond_init(&(r->cond), NULL);
+
+    bs->reclaimer = r;
+    if (pthread_create(&(r->thread), NULL, reclaimer_thread, r)) {
+        bs->reclaimer = NULL;
+        pthread_cond_destroy(&(r->cond));
+        pthread_mutex_destroy(&(r->mutex));
+        EUCA_FREE(r);
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to start the reclaimer thread");
+        return (EUCA_THREAD_ERROR);
+    }
+
+    return (EUCA_OK);
+}
+
+//!
+//! Stops the background reclaimer of a blobstore, if one was started, waiting
+//! for a pass that is under way to finish its current batch.
+//!
+//! @param[in] bs
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if bs is NULL
+//!
+//! @pre
+//!
+//! @note
+//!
+int blobstore_reclaimer_stop(blobstore * bs)
+{
+    blobstore_reclaimer *r = NULL;
+
+    if (bs == NULL)
+        return (EUCA_INVALID_ERROR);
+
+    if ((r = bs->reclaimer) == NULL)
+        return (EUCA_OK);
+
+    pthread_mutex_lock(&(r->mutex));
+    r->running = FALSE;
+    pthread_cond_signal(&(r->cond));
+    pthread_mutex_unlock(&(r->mutex));
+    pthread_join(r->thread, NULL);
+
+    bs->reclaimer = NULL;
+    pthread_cond_destroy(&(r->cond));
+    pthread_mutex_destroy(&(r->mutex));
+    EUCA_FREE(r);
+
+    return (EUCA_OK);
+}
+
+//!
+//! Copies out the counters of the background reclaimer of a blobstore, with
+//! the lag of a store that is still above its high watermark included.
+//!
+//! @param[in]  bs
+//! @param[out] stats
+//! @param[in]  reset if TRUE, the purge counters are zeroed for the next interval
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_NOT_FOUND_ERROR: if no reclaimer was started for the store
+//!
+//! @pre The bs and stats parameters must not be NULL
+//!
+//! @note
+//!
+int blobstore_reclaimer_stats(blobstore * bs, blobstore_reclaim_stats * stats, int reset)
+{
+    blobstore_reclaimer *r = NULL;
+
+    if ((bs == NULL) || (stats == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    if ((r = bs->reclaimer) == NULL)
+        return (EUCA_NOT_FOUND_ERROR);
+
+    pthread_mutex_lock(&(r->mutex));
+    {
+        *stats = r->stats;
+        stats->lag_usec = (r->over_since_usec != 0) ? (time_usec() - r->over_since_usec) : (0);
+        if (stats->lag_usec > stats->max_lag_usec)
+            stats->max_lag_usec = stats->lag_usec;
+
+        if (reset) {
+            r->stats.purged_blocks = 0;
+            r->stats.purge_usec = 0;
+            r->stats.purge_passes = 0;
+            r->stats.inline_blocks = 0;
+            r->stats.inline_usec = 0;
+            r->stats.inline_purges = 0;
+            r->stats.max_lag_usec = 0;
+        }
+    }
+    pthread_mutex_unlock(&(r->mutex));
+
+    return (EUCA_OK);
+}
+
+//!
+//!
+//!
+//! @param[in] bs
+//! @param[in] meta
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int blobstore_stat(blobstore * bs, blobstore_meta * meta)
+{
+    int ret = 0;
+
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
+        return EUCA_ERROR;
+    }
+    // put existing items in the blobstore into a LL
+    _blobstore_errno = BLOBSTORE_ERROR_OK;
+    blockblob *bbs = scan_blobstore(bs, NULL);
+    if (bbs == NULL) {
+        if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
+            goto unlock;
+        }
+    }
+    // analyze the LL, calculating sizes
+    meta->blocks_allocated = 0;
+    meta->blocks_unlocked = 0;
+    meta->blocks_locked = 0;
+    meta->num_blobs = 0;
+    for (blockblob * abb = bbs; abb;) {
+        //! @TODO unify this with locked/unlocked calculation in open()
+        long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
+        if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
+            // these can't be purged if we need space
+            //! @TODO look into recursive purging of unused references?
+            meta->blocks_locked += abb_size_blocks;
+        } else {
+            // these potentially can be purged, unless they are depended on by locked ones
+            meta->blocks_unlocked += abb_size_blocks;
+        }
+        meta->blocks_allocated += abb->blocks_allocated;
+        meta->num_blobs++;
+
+        // free this node and move the pointer
+        blockblob *old_bb = abb;
+        abb = abb->next;
+        EUCA_FREE(old_bb);
+    }
+
+unlock:
+
+    if (blobstore_unlock(bs) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+    }
+
+    euca_strncpy(meta->id, bs->id, sizeof(meta->id));
+    meta->revocation_policy = bs->revocation_policy;
+    meta->snapshot_policy = bs->snapshot_policy;
+    meta->format = bs->format;
+    meta->blocks_limit = bs->limit_blocks;
+    if (realpath(bs->path, meta->path) == NULL) {
+        LOGERROR("failed to resolve the blobstore path %s\n", bs->path);
+        ret = EUCA_ERROR;
+    }
+
+    return ret;
+}
+
+//!
+//! Read .refs file content and return any entries that point to blobs that no longer exist
+//!
+//! @param[in]  bb
+//! @param[out] refs
+//!
+//! @return size of the array placed into *refs, which caller must free, or -1 on error
+//!
+//! @pre
+//!
+//! @note
+//!
+static int get_stale_refs(const blockblob * bb, char ***refs)
+{
+    blobstore *bs = bb->store;
+    char **array = NULL;
+    int array_size = 0;
+    int stale_refs = 0;
+
+    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bb->store, bb->id, &array, &array_size) != -1) {
+        for (int i = 0; i < array_size; i++) {
             char ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
             euca_strncpy(ref, array[i], sizeof(ref));
 
@@ -2838,9 +3623,10 @@ int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb))
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
         return -1;
     }
-    // put existing items in the blobstore into a LL
+    // put existing items in the blobstore into a LL, checking the whole
+    // directory tree rather than trusting the index, which gets rebuilt
     _blobstore_errno = BLOBSTORE_ERROR_OK;
-    blockblob *bbs = scan_blobstore(bs, NULL);
+    blockblob *bbs = rebuild_blobstore_index(bs, NULL);
 
     if (blobstore_unlock(bs) == -1) {
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
@@ -3202,6 +3988,7 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
 
     if (sb.st_size == 0) {             // new blob
         created_blob = 1;
+        blobstore_index_created(bs->path, bb->id, size_bytes);
 
         if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can traverse blobstore safely
             goto clean;                // failed to obtain a lock on the blobstore
@@ -3209,22 +3996,56 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
             blobstore_locked = 1;
         }
 
-        // put existing items in the blobstore into a LL
-        _blobstore_errno = BLOBSTORE_ERROR_OK;
-        bbs = scan_blobstore(bs, bb);
-        if (bbs == NULL) {
-            if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
-                goto clean;
-            }
-        }
         // a bit of a hack: HOLLOW blobs skip the blobstore limit check upon creation
         if (flags & BLOBSTORE_FLAG_HOLLOW) {
             bb->is_hollow = TRUE;
             if (write_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bs, bb->id, "this blob is hollow\n"))
                 goto clean;
 
-        } else {                       // enforce blobstore limits
+        } else if (load_blobstore_index_for(bs, bb->id, size_bytes) == 0) {  // enforce blobstore limits, using the totals kept by the index
+
+            long long blocks_used = bs->index->used_blocks;
+            long long blocks_evictable = bs->index->evictable_blocks;
+            blobstore_index_entry *own = blobstore_index_find(bs->index, bb->id);
+            if ((own != NULL) && own->exists) { // the index already counts the blob being created
+                blocks_used -= blobstore_index_blocks(own);
+                if (own->lru_pos)
+                    blocks_evictable -= blobstore_index_blocks(own);
+            }
+
+            long long blocks_free = bs->limit_blocks - blocks_used;
+            long long blocks_freed = 0;
+            long long purge_usec = 0;
+            if (blocks_free < size_blocks) {
+                if (!(bs->revocation_policy == BLOBSTORE_REVOCATION_LRU)    // not allowed to purge
+                    || (blocks_free + blocks_evictable) < size_blocks) {    // not enough purgeable material
+                    ERR(BLOBSTORE_ERROR_NOSPC, NULL);
+                    goto clean;
+                }
+                long long blocks_needed = size_blocks - blocks_free;
+                purge_usec = time_usec();
+                _err_off();            // do not care about errors duing purging
+                blocks_freed = purge_indexed_blockblobs_lru(bs, bb, blocks_needed);
+                _err_on();
+                purge_usec = time_usec() - purge_usec;
+                if (blocks_freed < blocks_needed) {
+                    reclaimer_note_inline(bs, blocks_used - blocks_freed, blocks_freed, purge_usec);
+                    ERR(BLOBSTORE_ERROR_NOSPC, "could not purge enough from cache");
+                    goto clean;
+                }
+            }
+            reclaimer_note_inline(bs, blocks_used - blocks_freed + size_blocks, blocks_freed, purge_usec);
+
+        } else {                       // enforce blobstore limits, the slow way since there is no index
 
+            // put existing items in the blobstore into a LL
+            _blobstore_errno = BLOBSTORE_ERROR_OK;
+            bbs = scan_blobstore(bs, bb);
+            if (bbs == NULL) {
+                if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
+                    goto clean;
+                }
+            }
             // analyze the LL, calculating sizes
             long long blocks_unlocked = 0;
             long long blocks_locked = 0;
@@ -3338,6 +4159,17 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
     }
 
     set_device_path(bb);               // read .dm and .loopback and set bb->device_path accordingly
+    if ((bb->snapshot_type == BLOBSTORE_SNAPSHOT_DM) && (dm_check_device(bb->dm_name) != 0)) {
+        // device mapper maps do not survive a reboot, but those of deduplicated blobs can be rebuilt
+        char chunks_path[PATH_MAX] = "";
+        set_blockblob_metadata_path(BLOCKBLOB_PATH_CHUNKS, bs, bb->id, chunks_path, sizeof(chunks_path));
+        if ((check_path(chunks_path) == 0) && (chunks_restore(bb) == -1)) {
+            goto clean;
+        }
+    }
+    if (!created_blob) {
+        blobstore_index_set_num(bs->path, bb->id, BLOBSTORE_INDEX_USED, time(NULL));    // move it to the back of the LRU order
+    }
 
     goto out;                          // all is well
 
@@ -3413,6 +4245,7 @@ static int loop_remove(blobstore * bs, const char *bb_id)
         } else {
             set_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb_id, path, sizeof(path));    // load path of .../loopback file itself
             unlink(path);
+            blobstore_index_set_str(bs->path, bb_id, BLOBSTORE_INDEX_LOOPBACK, "");
         }
     }
 
@@ -3447,6 +4280,7 @@ int blockblob_close(blockblob * bb)
         ret = loop_remove(bb->store, bb->id);
     }
     ret |= close(bb->fd_blocks);
+    blobstore_index_set_num(bb->store->path, bb->id, BLOBSTORE_INDEX_USED, time(NULL));
     if (ftruncate(bb->fd_lock, 0) != 0) {
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to truncate the blobstore lock file.");
     }
@@ -3455,6 +4289,24 @@ int blockblob_close(blockblob * bb)
     return ret;
 }
 
+//!
+//! Tells whether device mapper devices are to be managed with ioctls issued
+//! by this process rather than with 'dmsetup' run through the root wrapper
+//!
+//! @return TRUE to use blobstore-dm.c, FALSE to use 'dmsetup'
+//!
+static int dm_use_ioctls(void)
+{
+    switch (dm_backend) {
+    case BLOBSTORE_DM_BACKEND_DMSETUP:
+        return (FALSE);
+    case BLOBSTORE_DM_BACKEND_IOCTL:
+        return (TRUE);                 // failures will be reported by the calls themselves
+    default:
+        return (blobstore_dm_available());
+    }
+}
+
 //!
 //!
 //!
@@ -3470,6 +4322,14 @@ static int dm_suspend_resume(const char *dev_name)
 {
     int ret = EUCA_OK;
 
+    if (dm_use_ioctls()) {
+        if (blobstore_dm_suspend_resume(dev_name) != EUCA_OK) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to suspend and resume device with device mapper ioctls");
+            return (-1);
+        }
+        return (0);
+    }
+
     if ((ret = euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "suspend", dev_name, NULL)) != EUCA_OK) {
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to suspend device with 'dmsetup'");
         return (-1);
@@ -3525,6 +4385,15 @@ static int dm_delete_device(const char *dev_name)
     if (check_path(dm_path) && (errno == ENOENT))   // we do not use check_block() because /dev/mapper/... entries can be sym links
         return (0);
 
+    if (dm_use_ioctls()) {
+        myprintf(EUCA_LOG_INFO, "removing device %s\n", dev_name);
+        if (blobstore_dm_remove(dev_name) != EUCA_OK) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove device mapper device with ioctls");
+            ret = -1;
+        }
+        return (ret);
+    }
+
 try_again:
     myprintf(EUCA_LOG_INFO, "removing device %s (retries=%d)\n", dev_name, retries);
     if ((euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "remove", dev_name, NULL)) != EUCA_OK) {
@@ -3630,6 +4499,17 @@ static int dm_create_devices(char *dev_names[], char *dm_tables[], int size)
     char tmpfile[EUCA_MAX_PATH] = "";
     char dm_path[MAX_DM_PATH] = "";
 
+    if (dm_use_ioctls()) {
+        // all devices are set up over one control descriptor, and the ones
+        // that were set up are removed by blobstore_dm_create() if any fails
+        myprintf(EUCA_LOG_INFO, "creating %d device(s) %s..%s\n", size, dev_names[0], dev_names[size - 1]);
+        if (blobstore_dm_create(dev_names, dm_tables, size, get_username(), BLOBSTORE_FILE_PERM) != EUCA_OK) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to set up device mapper tables with ioctls");
+            return (-1);
+        }
+        return (0);
+    }
+
     for (i = 0; i < size; i++) {
         // create devices one by one
         myprintf(EUCA_LOG_INFO, "creating device %s\n", dev_names[i]);
@@ -3749,8 +4629,11 @@ static int blockblob_check(const blockblob * bb)
     int err = 0;
     _err_off();                        // do not care if metadata files do not exist
 
-    // check on dm devices listed in .dm of this blob, if any
-    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, &array, &array_size) != -1) {
+    // check on dm devices listed in .dm of this blob, if any (except for deduplicated
+    // blobs, whose devices blockblob_open() sets up again from their chunk list)
+    char chunks_path[PATH_MAX] = "";
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_CHUNKS, bb->store, bb->id, chunks_path, sizeof(chunks_path));
+    if ((check_path(chunks_path) != 0) && (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, &array, &array_size) != -1)) {
         for (int i = 0; i < array_size; i++) {
             if (dm_check_device(array[i]))
                 err++;
@@ -4373,114 +5256,580 @@ int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
             mapped_or_snapshotted++;
             break;
 
-        default:
-            ERR(BLOBSTORE_ERROR_INVAL, "invalid device map source type");
-            ret = -1;
-            goto free;
-        }
+        default:
+            ERR(BLOBSTORE_ERROR_INVAL, "invalid device map source type");
+            ret = -1;
+            goto free;
+        }
+    }
+
+    if (mapped_or_snapshotted) {       // we must use the device mapper
+        if ((main_dm_table = dm_sort_table(&main_dm_table)) == NULL) {
+            ret = -1;
+            goto free;
+        }
+
+        euca_strncpy(bb->dm_name, dm_base, sizeof(bb->dm_name));
+        dev_names[devices] = strdup(dm_base);
+        dm_tables[devices] = main_dm_table;
+        devices++;
+
+        // change device_path from loopback to the device-mapper path
+        snprintf(bb->device_path, sizeof(bb->device_path), DM_FORMAT, dm_base);
+
+        if (dm_create_devices(dev_names, dm_tables, devices)) {
+            ret = -1;
+            goto free;
+        }
+        // record new devices in .dm of this blob
+        if (write_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, dev_names, devices) == -1) {
+            ret = -1;
+            goto cleanup;
+        }
+        bb->snapshot_type = BLOBSTORE_SNAPSHOT_DM;  // remember that blobstore uses device mapper
+
+        // update .refs on dependencies and create .deps for this blob
+        char my_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
+        snprintf(my_ref, sizeof(my_ref), "%s %s", bb->store->path, bb->id); //! @TODO use store ID to proof against moving blobstore?
+        for (int i = 0; i < map_size; i++) {
+            const blockmap *m = map + i;
+            const blockblob *sbb = m->source.blob;
+
+            if (m->source_type != BLOBSTORE_BLOCKBLOB)  // only blobstores have references
+                continue;
+
+            if (m->relation_type == BLOBSTORE_COPY) // copies do not create references
+                continue;
+
+            if (blobstore_lock(sbb->store, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock the source blobstore so the .refs are updated atomically
+                LOGERROR("{%u} error: timed out on a blobstore lock while attempting to update .refs\n", (unsigned int)pthread_self());
+                ret = -1;
+                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
+            }
+            // update .refs
+            if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, sbb->store, sbb->id, my_ref, 0) == -1) {
+                ret = -1;
+                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
+            }
+
+            if (blobstore_unlock(sbb->store) == -1) {
+                ret = -1;
+                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
+            }
+            // record the dependency in .deps (redundant entries will be filtered out)
+            char dep_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
+            snprintf(dep_ref, sizeof(dep_ref), "%s %s %s %llu %llu", sbb->store->path, sbb->id, blobstore_relation_type_name[m->relation_type], m->first_block_dst, m->len_blocks);
+            if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, dep_ref, 0) == -1) {
+                ret = -1;
+                goto cleanup;          // ditto
+            }
+        }
+    } else {
+        EUCA_FREE(main_dm_table);
+    }
+
+    goto free;
+
+cleanup:                              // this is failure cleanup code path
+    {
+        int saved_errno;
+
+        saved_errno = _blobstore_errno; // save it because dm_delete_devices may overwrite it
+        LOGERROR("error: blockblob_clone: %s (%d)\n", blobstore_get_last_msg(), _blobstore_errno);
+
+        // remove dm devices that may have been created
+        if (dm_delete_devices(dev_names, devices) == 0) {
+
+            // remove the .dm file so that others do not
+            // needlessly attempt to remove dm devices later
+            char path[PATH_MAX];
+            set_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, path, sizeof(path));
+            unlink(path);
+            blobstore_index_set_str(bb->store->path, bb->id, BLOBSTORE_INDEX_DM, "");
+        }
+        _blobstore_errno = saved_errno;
+    }
+
+free:
+    // Only free main_dm_table if mapped_or_snapshotted is 0. If its greater than
+    // 0, it would be assigned to the dm_tables array.
+    if (mapped_or_snapshotted == 0) {
+        EUCA_FREE(main_dm_table);
+    }
+
+    for (int i = 0; i < devices; i++) {
+        EUCA_FREE(dev_names[i]);
+        EUCA_FREE(dm_tables[i]);
+    }
+    EUCA_FREE(dev_names);
+    EUCA_FREE(dm_tables);
+
+    return ret;
+}
+
+//!
+//! Builds the table of chunks used by the deduplicated blobs of a blobstore
+//! from their chunk lists, noting the chunk packs that exist
+//!
+//! @param[in] bs the blobstore
+//!
+//! @return the table, to be freed with blobstore_chunks_free(), or NULL on error
+//!
+static blobstore_chunks *chunks_load(blobstore * bs)
+{
+    int num_refs = 0;
+    blockblob *bbs = NULL;
+    blobstore_chunk_ref *refs = NULL;
+    blobstore_chunks *chunks = NULL;
+
+    if ((chunks = blobstore_chunks_alloc()) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return (NULL);
+    }
+
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
+        blobstore_chunks_free(chunks);
+        return (NULL);
+    }
+    _blobstore_errno = BLOBSTORE_ERROR_OK;
+    bbs = scan_blobstore(bs, NULL);
+    blobstore_unlock(bs);
+    if ((bbs == NULL) && (_blobstore_errno != BLOBSTORE_ERROR_OK)) {
+        blobstore_chunks_free(chunks);
+        return (NULL);
+    }
+
+    for (blockblob * abb = bbs; abb; abb = abb->next) {
+        if (!strncmp(abb->id, BLOBSTORE_CHUNK_PACK_PREFIX, strlen(BLOBSTORE_CHUNK_PACK_PREFIX))) {
+            blobstore_chunks_pack_exists(chunks, atoi(abb->id + strlen(BLOBSTORE_CHUNK_PACK_PREFIX)));
+            continue;
+        }
+        if (chunks_read_list(bs, abb->id, &refs, &num_refs) == -1) {
+            LOGWARN("ignoring unreadable chunk list of blob %s\n", abb->id);
+            continue;
+        }
+        for (int i = 0; i < num_refs; i++) {
+            blobstore_chunks_add(chunks, refs + i);
+        }
+        EUCA_FREE(refs);
+    }
+    free_bbs(bbs);
+
+    return (chunks);
+}
+
+//!
+//! Reads the chunk list of a blob
+//!
+//! @param[in] bs the blobstore
+//! @param[in] bb_id ID of the blob
+//! @param[out] prefs newly allocated array of chunk references, NULL if the blob has no list
+//! @param[out] pnum_refs number of chunks in the list
+//!
+//! @return 0 on success or -1 if the list cannot be read or is malformed
+//!
+static int chunks_read_list(blobstore * bs, const char *bb_id, blobstore_chunk_ref ** prefs, int *pnum_refs)
+{
+    int ret = 0;
+    int num_lines = 0;
+    char **lines = NULL;
+    blobstore_chunk_ref *refs = NULL;
+
+    *prefs = NULL;
+    *pnum_refs = 0;
+
+    _err_off();                        // most blobs have no chunk list
+    ret = read_array_blockblob_metadata_path(BLOCKBLOB_PATH_CHUNKS, bs, bb_id, &lines, &num_lines);
+    _err_on();
+    if ((ret == -1) || (num_lines == 0))
+        return (ret);
+
+    if ((refs = EUCA_ZALLOC(num_lines, sizeof(blobstore_chunk_ref))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        ret = -1;
+    }
+    for (int i = 0; i < num_lines; i++) {
+        if ((ret == 0) && (blobstore_chunks_parse(lines[i], refs + i) == -1)) {
+            ERR(BLOBSTORE_ERROR_INVAL, "malformed chunk list");
+            ret = -1;
+        }
+        EUCA_FREE(lines[i]);
+    }
+    EUCA_FREE(lines);
+
+    if (ret == -1) {
+        EUCA_FREE(refs);
+        return (-1);
+    }
+    *prefs = refs;
+    *pnum_refs = num_lines;
+    return (0);
+}
+
+//!
+//! Opens (creating it, if necessary) a chunk pack, unless it is open already
+//!
+//! @param[in] bs the blobstore
+//! @param[in,out] ppacks array of open packs, indexed by pack number, grown as needed
+//! @param[in,out] pnum_packs size of the array
+//! @param[in] pack pack number
+//! @param[in] timeout_usec how long to wait for the pack to be available
+//!
+//! @return the pack blob or NULL on error
+//!
+static blockblob *chunks_open_pack(blobstore * bs, blockblob *** ppacks, int *pnum_packs, int pack, unsigned long long timeout_usec)
+{
+    char pack_id[BLOBSTORE_MAX_PATH] = "";
+    blockblob **packs = NULL;
+
+    if (pack >= *pnum_packs) {
+        if ((packs = EUCA_REALLOC(*ppacks, (pack + 1), sizeof(blockblob *))) == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            return (NULL);
+        }
+        bzero(packs + *pnum_packs, (pack + 1 - *pnum_packs) * sizeof(blockblob *));
+        *ppacks = packs;
+        *pnum_packs = pack + 1;
+    }
+
+    if ((*ppacks)[pack] == NULL) {
+        snprintf(pack_id, sizeof(pack_id), BLOBSTORE_CHUNK_PACK_FORMAT, pack);
+        (*ppacks)[pack] = blockblob_open(bs, pack_id, (unsigned long long)BLOBSTORE_CHUNKS_PER_PACK * BLOBSTORE_CHUNK_SIZE, BLOBSTORE_FLAG_CREAT, NULL, timeout_usec);
+    }
+    return ((*ppacks)[pack]);
+}
+
+//!
+//! Closes the chunk packs opened with chunks_open_pack() and frees the array
+//!
+//! @param[in] packs array of open packs, indexed by pack number
+//! @param[in] num_packs size of the array
+//!
+static void chunks_close_packs(blockblob ** packs, int num_packs)
+{
+    for (int i = 0; i < num_packs; i++) {
+        if (packs[i] != NULL)
+            blockblob_close(packs[i]);
+    }
+    EUCA_FREE(packs);
+}
+
+//!
+//! Sets up the device mapper device of a deduplicated blob, a linear map of
+//! pack slots and zeros, and points the blob at it
+//!
+//! @param[in] bb the blob
+//! @param[in] refs the chunks of the blob, in order
+//! @param[in] num_refs number of chunks
+//! @param[in] packs open packs, indexed by pack number, covering all packs in refs[]
+//!
+//! @return 0 on success or -1 on error
+//!
+static int chunks_map(blockblob * bb, const blobstore_chunk_ref * refs, int num_refs, blockblob ** packs)
+{
+    int ret = 0;
+    int num_extents = 0;
+    long long size_blocks = round_down_sec(bb->size_bytes) / 512;   // dmsetup will not map partial blocks
+    char buf[MAX_DM_LINE] = "";
+    char dm_base[MAX_DM_LINE] = "";
+    char *dev_names[1] = { dm_base };
+    char *dm_tables[1] = { NULL };
+    char *zero_dev = NULL;
+    blobstore_chunk_extent *extents = NULL;
+
+    if ((num_extents = blobstore_chunks_extents(refs, num_refs, &extents)) == -1) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return (-1);
+    }
+
+    for (int i = 0; i < num_extents; i++) {
+        const blobstore_chunk_extent *e = extents + i;
+        long long first_block = (long long)e->first_chunk * BLOBSTORE_CHUNK_BLOCKS;
+        long long len_blocks = MIN((long long)e->num_chunks * BLOBSTORE_CHUNK_BLOCKS, size_blocks - first_block);
+        const char *dev = NULL;
+
+        if (len_blocks <= 0)
+            break;
+        if (e->pack == BLOBSTORE_CHUNK_ZERO) {
+            if ((zero_dev == NULL) && ((zero_dev = dm_get_zero()) == NULL)) {
+                ret = -1;
+                goto out;
+            }
+            dev = zero_dev;
+        } else {
+            dev = packs[e->pack]->device_path;
+        }
+        snprintf(buf, sizeof(buf), "%lld %lld linear %s %lld\n", first_block, len_blocks, dev,
+                 (e->pack == BLOBSTORE_CHUNK_ZERO) ? (0LL) : ((long long)e->first_slot * BLOBSTORE_CHUNK_BLOCKS));
+        if ((dm_tables[0] = euca_strdupcat(dm_tables[0], buf)) == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            ret = -1;
+            goto out;
+        }
+    }
+
+    // same naming as blockblob_clone(), since the blob is a map like any clone
+    snprintf(dm_base, sizeof(dm_base), "euca-%s", bb->id);
+    for (char *c = dm_base; *c != '\0'; c++) {
+        if (*c == '/')
+            *c = '-';
+    }
+
+    if (dm_create_devices(dev_names, dm_tables, 1)) {
+        ret = -1;
+        goto out;
+    }
+    if (write_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, dev_names, 1) == -1) {
+        _err_off();
+        dm_delete_devices(dev_names, 1);
+        _err_on();
+        ret = -1;
+        goto out;
+    }
+    euca_strncpy(bb->dm_name, dm_base, sizeof(bb->dm_name));
+    snprintf(bb->device_path, sizeof(bb->device_path), DM_FORMAT, dm_base);
+    bb->snapshot_type = BLOBSTORE_SNAPSHOT_DM;
+
+out:
+    EUCA_FREE(dm_tables[0]);
+    EUCA_FREE(extents);
+    return (ret);
+}
+
+//!
+//! Sets up the device mapper device of a deduplicated blob again from its
+//! chunk list, e.g., after a reboot
+//!
+//! @param[in] bb the blob, being opened
+//!
+//! @return 0 on success or -1 on error
+//!
+static int chunks_restore(blockblob * bb)
+{
+    int ret = 0;
+    int num_refs = 0;
+    int num_packs = 0;
+    blockblob **packs = NULL;
+    blobstore_chunk_ref *refs = NULL;
+
+    if ((chunks_read_list(bb->store, bb->id, &refs, &num_refs) == -1) || (num_refs == 0)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "failed to read the chunk list of a deduplicated blob");
+        EUCA_FREE(refs);
+        return (-1);
     }
 
-    if (mapped_or_snapshotted) {       // we must use the device mapper
-        if ((main_dm_table = dm_sort_table(&main_dm_table)) == NULL) {
+    LOGINFO("rebuilding device of deduplicated blob %s from %d chunk(s)\n", bb->id, num_refs);
+    for (int i = 0; (i < num_refs) && (ret == 0); i++) {
+        if ((refs[i].pack != BLOBSTORE_CHUNK_ZERO) && (chunks_open_pack(bb->store, &packs, &num_packs, refs[i].pack, BLOBSTORE_FIND_TIMEOUT_USEC) == NULL))
             ret = -1;
-            goto free;
-        }
+    }
+    if (ret == 0)
+        ret = chunks_map(bb, refs, num_refs, packs);
 
-        euca_strncpy(bb->dm_name, dm_base, sizeof(bb->dm_name));
-        dev_names[devices] = strdup(dm_base);
-        dm_tables[devices] = main_dm_table;
-        devices++;
+    chunks_close_packs(packs, num_packs);
+    EUCA_FREE(refs);
+    return (ret);
+}
 
-        // change device_path from loopback to the device-mapper path
-        snprintf(bb->device_path, sizeof(bb->device_path), DM_FORMAT, dm_base);
+//!
+//! Deduplicates the content of a blob against the other deduplicated blobs of
+//! its blobstore. The content is cut into BLOBSTORE_CHUNK_SIZE chunks, chunks
+//! not stored yet are written to free slots of 'pack' blobs and the blob is
+//! turned into a device mapper map of the pack slots (chunks of zeros map to
+//! the zero device), after which its own file is emptied and it is marked
+//! hollow. The packs become dependencies of the blob, like the sources of a
+//! clone, so a pack is purged only once no blob maps any of its slots, and the
+//! slots of chunks that are no longer used are reused and their space released.
+//! On failure, the blob is left as it was.
+//!
+//! @param[in] bb the blob, open and not yet a clone or a map of other blobs
+//! @param[in] timeout_usec how long to wait for a chunk pack to be available
+//!
+//! @return 0 on success or -1 on error
+//!
+int blockblob_dedup(blockblob * bb, unsigned long long timeout_usec)
+{
+    int ret = -1;
+    int fd = -1;
+    int num_refs = 0;
+    int num_packs = 0;
+    int num_stored = 0;
+    int num_shared = 0;
+    char **lines = NULL;
+    unsigned char *buf = NULL;
+    unsigned char *cmp = NULL;
+    char my_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1] = "";
+    char dep_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1] = "";
+    blockblob **packs = NULL;
+    blobstore *bs = NULL;
+    blobstore_chunks *chunks = NULL;
+    blobstore_chunk_ref *refs = NULL;
 
-        if (dm_create_devices(dev_names, dm_tables, devices)) {
-            ret = -1;
-            goto free;
-        }
-        // record new devices in .dm of this blob
-        if (write_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, dev_names, devices) == -1) {
-            ret = -1;
-            goto cleanup;
-        }
-        bb->snapshot_type = BLOBSTORE_SNAPSHOT_DM;  // remember that blobstore uses device mapper
+    if (bb == NULL) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob pointer is NULL");
+        return (-1);
+    }
+    if ((bb->snapshot_type == BLOBSTORE_SNAPSHOT_DM) || bb->is_hollow || (bb->size_bytes < BLOBSTORE_CHUNK_SIZE)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "only unmapped blobs of at least one chunk can be deduplicated");
+        return (-1);
+    }
+    if (bb->store->snapshot_policy != BLOBSTORE_SNAPSHOT_DM) {
+        ERR(BLOBSTORE_ERROR_INVAL, "deduplication requires the device mapper snapshot policy");
+        return (-1);
+    }
+    if (verify_bb(bb, 0)) {
+        return (-1);
+    }
 
-        // update .refs on dependencies and create .deps for this blob
-        char my_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
-        snprintf(my_ref, sizeof(my_ref), "%s %s", bb->store->path, bb->id); //! @TODO use store ID to proof against moving blobstore?
-        for (int i = 0; i < map_size; i++) {
-            const blockmap *m = map + i;
-            const blockblob *sbb = m->source.blob;
+    bs = bb->store;
+    num_refs = (bb->size_bytes + BLOBSTORE_CHUNK_SIZE - 1) / BLOBSTORE_CHUNK_SIZE;
+    pthread_mutex_lock(&_chunks_mutex);
 
-            if (m->source_type != BLOBSTORE_BLOCKBLOB)  // only blobstores have references
-                continue;
+    if ((chunks = chunks_load(bs)) == NULL)
+        goto out;
+    refs = EUCA_ZALLOC(num_refs, sizeof(blobstore_chunk_ref));
+    lines = EUCA_ZALLOC(num_refs, sizeof(char *));
+    buf = EUCA_ALLOC(BLOBSTORE_CHUNK_SIZE, sizeof(unsigned char));
+    cmp = EUCA_ALLOC(BLOBSTORE_CHUNK_SIZE, sizeof(unsigned char));
+    if ((refs == NULL) || (lines == NULL) || (buf == NULL) || (cmp == NULL)) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        goto out;
+    }
+    if ((fd = open(bb->blocks_path, O_RDWR)) == -1) {
+        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+        goto out;
+    }
+    // find or store each chunk
+    for (int i = 0; i < num_refs; i++) {
+        blobstore_chunk_ref *ref = refs + i;
+        const blobstore_chunk *found = NULL;
+        blockblob *pack = NULL;
+        off_t offset = (off_t) i * BLOBSTORE_CHUNK_SIZE;
+        ssize_t len = MIN((off_t) BLOBSTORE_CHUNK_SIZE, (off_t) bb->size_bytes - offset);
+        int is_zero = TRUE;
 
-            if (m->relation_type == BLOBSTORE_COPY) // copies do not create references
+        if (pread(fd, buf, len, offset) != len) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto out;
+        }
+        bzero(buf + len, BLOBSTORE_CHUNK_SIZE - len);   // the tail of the last chunk is never mapped
+        SHA1(buf, BLOBSTORE_CHUNK_SIZE, ref->hash);
+        for (unsigned long long *w = (unsigned long long *)buf; is_zero && (w < (unsigned long long *)(buf + BLOBSTORE_CHUNK_SIZE)); w++)
+            is_zero = (*w == 0);
+        if (is_zero) {
+            ref->pack = BLOBSTORE_CHUNK_ZERO;
+            continue;
+        }
+        // a chunk with the same hash is reused only if its content really is the same
+        if ((found = blobstore_chunks_find(chunks, ref->hash)) != NULL) {
+            if (((pack = chunks_open_pack(bs, &packs, &num_packs, found->ref.pack, timeout_usec)) != NULL)
+                && (pread(pack->fd_blocks, cmp, BLOBSTORE_CHUNK_SIZE, (off_t) found->ref.slot * BLOBSTORE_CHUNK_SIZE) == BLOBSTORE_CHUNK_SIZE)
+                && !memcmp(buf, cmp, BLOBSTORE_CHUNK_SIZE)) {
+                *ref = found->ref;
+                blobstore_chunks_add(chunks, ref);
+                num_shared++;
                 continue;
-
-            if (blobstore_lock(sbb->store, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock the source blobstore so the .refs are updated atomically
-                LOGERROR("{%u} error: timed out on a blobstore lock while attempting to update .refs\n", (unsigned int)pthread_self());
-                ret = -1;
-                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
-            }
-            // update .refs
-            if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, sbb->store, sbb->id, my_ref, 0) == -1) {
-                ret = -1;
-                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
             }
+            LOGWARN("chunk %d of blob %s has the hash of a different chunk, storing it separately\n", i, bb->id);
+        }
 
-            if (blobstore_unlock(sbb->store) == -1) {
-                ret = -1;
-                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
-            }
-            // record the dependency in .deps (redundant entries will be filtered out)
-            char dep_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
-            snprintf(dep_ref, sizeof(dep_ref), "%s %s %s %llu %llu", sbb->store->path, sbb->id, blobstore_relation_type_name[m->relation_type], m->first_block_dst, m->len_blocks);
-            if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, dep_ref, 0) == -1) {
-                ret = -1;
-                goto cleanup;          // ditto
-            }
+        if (blobstore_chunks_free_slot(chunks, &(ref->pack), &(ref->slot)) == -1) {
+            ERR(BLOBSTORE_ERROR_NOSPC, "no chunk packs left");
+            goto out;
+        }
+        if ((pack = chunks_open_pack(bs, &packs, &num_packs, ref->pack, timeout_usec)) == NULL) {
+            goto out;                  // slots written so far are not referenced and will be reused
+        }
+        if (pwrite(pack->fd_blocks, buf, BLOBSTORE_CHUNK_SIZE, (off_t) ref->slot * BLOBSTORE_CHUNK_SIZE) != BLOBSTORE_CHUNK_SIZE) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto out;
+        }
+        blobstore_chunks_pack_exists(chunks, ref->pack);
+        blobstore_chunks_add(chunks, ref);
+        num_stored++;
+    }
+    for (int i = 0; i < num_packs; i++) {
+        if ((packs[i] != NULL) && (fsync(packs[i]->fd_blocks) == -1)) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto out;
         }
-    } else {
-        EUCA_FREE(main_dm_table);
     }
 
-    goto free;
-
-cleanup:                              // this is failure cleanup code path
-    {
-        int saved_errno;
-
-        saved_errno = _blobstore_errno; // save it because dm_delete_devices may overwrite it
-        LOGERROR("error: blockblob_clone: %s (%d)\n", blobstore_get_last_msg(), _blobstore_errno);
-
-        // remove dm devices that may have been created
-        if (dm_delete_devices(dev_names, devices) == 0) {
-
-            // remove the .dm file so that others do not
-            // needlessly attempt to remove dm devices later
-            char path[PATH_MAX];
-            set_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, path, sizeof(path));
-            unlink(path);
+    // record the chunk list, then switch the blob over to the packs
+    for (int i = 0; i < num_refs; i++) {
+        if ((lines[i] = EUCA_ALLOC(BLOBSTORE_CHUNK_LINE_LEN, sizeof(char))) == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            goto out;
         }
-        _blobstore_errno = saved_errno;
+        blobstore_chunks_format(refs + i, lines[i], BLOBSTORE_CHUNK_LINE_LEN);
+    }
+    if (write_array_blockblob_metadata_path(BLOCKBLOB_PATH_CHUNKS, bs, bb->id, lines, num_refs) == -1)
+        goto out;
+    if (chunks_map(bb, refs, num_refs, packs) == -1) {
+        char path[PATH_MAX] = "";
+        set_blockblob_metadata_path(BLOCKBLOB_PATH_CHUNKS, bs, bb->id, path, sizeof(path));
+        unlink(path);
+        goto out;
     }
+    // from here on the blob is a map of the packs, so failures are only logged
+    ret = 0;
 
-free:
-    // Only free main_dm_table if mapped_or_snapshotted is 0. If its greater than
-    // 0, it would be assigned to the dm_tables array.
-    if (mapped_or_snapshotted == 0) {
-        EUCA_FREE(main_dm_table);
+    // make each pack a dependency of the blob, as blockblob_clone() does for its sources
+    snprintf(my_ref, sizeof(my_ref), "%s %s", bs->path, bb->id);
+    for (int p = 0; p < num_packs; p++) {
+        long long mapped_blocks = 0;
+        if (packs[p] == NULL)
+            continue;
+        for (int i = 0; i < num_refs; i++) {
+            if (refs[i].pack == p)
+                mapped_blocks += BLOBSTORE_CHUNK_BLOCKS;
+        }
+        if (mapped_blocks == 0)
+            continue;
+        if ((blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1)
+            || (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, packs[p]->id, my_ref, 0) == -1)
+            || (blobstore_unlock(bs) == -1)) {
+            LOGERROR("failed to record reference to blob %s in chunk pack %s\n", bb->id, packs[p]->id);
+        }
+        snprintf(dep_ref, sizeof(dep_ref), "%s %s %s 0 %lld", bs->path, packs[p]->id, blobstore_relation_type_name[BLOBSTORE_MAP], mapped_blocks);
+        if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bs, bb->id, dep_ref, 0) == -1) {
+            LOGERROR("failed to record dependency of blob %s on chunk pack %s\n", bb->id, packs[p]->id);
+        }
     }
 
-    for (int i = 0; i < devices; i++) {
-        EUCA_FREE(dev_names[i]);
-        EUCA_FREE(dm_tables[i]);
+    // the content is in the packs now, so the blob's own blocks only take up space
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, bb->size_bytes) == -1) {
+        LOGWARN("failed to release the blocks of deduplicated blob %s: %s\n", bb->id, strerror(errno));
     }
-    EUCA_FREE(dev_names);
-    EUCA_FREE(dm_tables);
+    if (write_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bs, bb->id, "this blob is hollow\n") == 0) {
+        bb->is_hollow = TRUE;
+    }
+    // and so do the slots that no blob uses anymore
+    for (int p = 0; p < num_packs; p++) {
+        if (packs[p] == NULL)
+            continue;
+        for (int s = 0; s < BLOBSTORE_CHUNKS_PER_PACK; s++) {
+            if (!blobstore_chunks_pack_is_used(chunks, p, s))
+                fallocate(packs[p]->fd_blocks, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) s * BLOBSTORE_CHUNK_SIZE, BLOBSTORE_CHUNK_SIZE);
+        }
+    }
+    LOGINFO("deduplicated blob %s: %d chunk(s) stored, %d shared, %d zero\n", bb->id, num_stored, num_shared, num_refs - num_stored - num_shared);
 
-    return ret;
+out:
+    if (fd != -1)
+        close(fd);
+    if (packs != NULL)
+        chunks_close_packs(packs, num_packs);
+    blobstore_chunks_free(chunks);
+    pthread_mutex_unlock(&_chunks_mutex);
+    for (int i = 0; (lines != NULL) && (i < num_refs); i++)
+        EUCA_FREE(lines[i]);
+    EUCA_FREE(lines);
+    EUCA_FREE(refs);
+    EUCA_FREE(buf);
+    EUCA_FREE(cmp);
+    return (ret);
 }
 
 //!
@@ -5202,6 +6551,108 @@ done:
     return errors;
 }
 
+//!
+//! Compares the time it takes to clone, and to delete the clone of, a blob
+//! made of a map and two snapshots (five device mapper devices) with each of
+//! the device mapper backends. Needs the privileges that cloning with device
+//! mapper snapshots needs; the ioctl backend is skipped if this process may
+//! not issue device mapper ioctls.
+//!
+//! @param[in] base directory in which to create the test blobstore
+//! @param[in] name name of the test
+//! @param[in] iterations number of clones to time with each backend
+//!
+//! @return the number of errors
+//!
+static int do_dm_backend_bench(const char *base, const char *name, int iterations)
+{
+    int ret;
+    int errors = 0;
+    blockblob *bb1 = NULL, *bb2 = NULL, *bb3 = NULL, *bb4 = NULL;
+    const char *backend_names[] = { "any", "dmsetup", "ioctl" };
+    blobstore_dm_backend_t backends[] = { BLOBSTORE_DM_BACKEND_DMSETUP, BLOBSTORE_DM_BACKEND_IOCTL };
+
+    printf("\nTEST: running do_dm_backend_bench(%s, %d iterations)\n", name, iterations);
+
+    blobstore *bs = create_teststore(CBB_SIZE * 8, base, name, BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_NONE, BLOBSTORE_SNAPSHOT_DM);
+    if (bs == NULL) {
+        errors++;
+        goto done;
+    }
+
+    _OPENBB(bb1, B1, CBB_SIZE, NULL, _CBB, 0, 0);
+    _OPENBB(bb2, B2, CBB_SIZE, NULL, _CBB, 0, 0);
+    _OPENBB(bb3, B3, CBB_SIZE * 2, NULL, _CBB, 0, 0);
+    if (errors)
+        goto done;
+
+    blockmap bm[] = {
+{BLOBSTORE_MAP, BLOBSTORE_BLOCKBLOB, {blob:bb1}
+         , 0, 0, CBB_SIZE}
+        ,
+{BLOBSTORE_SNAPSHOT, BLOBSTORE_BLOCKBLOB, {blob:bb2}
+         , 0, CBB_SIZE, CBB_SIZE}
+        ,
+{BLOBSTORE_SNAPSHOT, BLOBSTORE_BLOCKBLOB, {blob:bb3}
+         , CBB_SIZE, CBB_SIZE * 2, CBB_SIZE}
+        ,
+    };
+
+    for (int b = 0; b < (sizeof(backends) / sizeof(backends[0])); b++) {
+        int timed = 0;
+        long long clone_usec = 0;
+        long long delete_usec = 0;
+
+        if ((backends[b] == BLOBSTORE_DM_BACKEND_IOCTL) && !blobstore_dm_available()) {
+            printf("%-8s skipped: device mapper ioctls are not permitted\n", backend_names[backends[b]]);
+            continue;
+        }
+        blobstore_set_dm_backend(backends[b]);
+
+        for (int i = 0; i < iterations; i++) {
+            if ((bb4 = blockblob_open(bs, B4, CBB_SIZE * 3 * 512, _CBB, NULL, 0)) == NULL) {
+                printf("failed to create the clone: %s\n", blobstore_get_error_str(blobstore_get_error()));
+                errors++;
+                break;
+            }
+
+            long long started = time_usec();
+            ret = blockblob_clone(bb4, bm, sizeof(bm) / sizeof(blockmap));
+            clone_usec += time_usec() - started;
+            if (ret == -1) {
+                printf("failed to clone with %s: %s\n", backend_names[backends[b]], blobstore_get_last_msg());
+                errors++;
+                blockblob_delete(bb4, 3000, 1);
+                break;
+            }
+
+            started = time_usec();
+            ret = blockblob_delete(bb4, 3000, 0);
+            delete_usec += time_usec() - started;
+            if (ret == -1) {
+                printf("failed to delete the clone with %s: %s\n", backend_names[backends[b]], blobstore_get_last_msg());
+                errors++;
+                break;
+            }
+            timed++;
+        }
+
+        if (timed > 0)
+            printf("%-8s clone %8.2f ms  delete %8.2f ms  (average of %d)\n", backend_names[backends[b]], clone_usec / 1000.0 / timed,
+                   delete_usec / 1000.0 / timed, timed);
+    }
+    blobstore_set_dm_backend(BLOBSTORE_DM_BACKEND_ANY);
+
+    _DELEBB(bb3, B3, 0);
+    _DELEBB(bb2, B2, 0);
+    _DELEBB(bb1, B1, 0);
+    blobstore_close(bs);
+
+done:
+    printf("completed do_dm_backend_bench (errors=%d)\n", errors);
+    return errors;
+}
+
 //!
 //!
 //!
@@ -5428,6 +6879,93 @@ done:
     return errors;
 }
 
+//!
+//! Tests that the background reclaimer purges an LRU store down to its low
+//! watermark once a launch pushes it above the high one, in LRU order and
+//! without the launch having to purge anything itself.
+//!
+//! @param[in] base
+//! @param[in] name
+//!
+//! @return the number of errors
+//!
+static int do_reclaimer_test(const char *base, const char *name)
+{
+    int ret;
+    int errors = 0;
+    blobstore_reclaim_stats stats = { 0 };
+
+    printf("\nTEST: testing background reclaimer (name=%s)\n", name);
+
+    blobstore *bs = create_teststore(BB_SIZE * 10, base, name, BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_LRU, BLOBSTORE_SNAPSHOT_ANY);
+    if (bs == NULL) {
+        errors++;
+        goto done;
+    }
+
+    blockblob *bb1, *bb2, *bb3, *bb4, *bb5, *bb6;
+    _OPENBB(bb1, B1, BB_SIZE, NULL, _CBB, 0, 0);    // bs size: 10
+    _CLOSBB(bb1, B1);
+    sleep(1);                          // to ensure LRU order of the blobs
+    _OPENBB(bb2, B2, BB_SIZE, NULL, _CBB, 0, 0);    // bs size: 20
+    _CLOSBB(bb2, B2);
+    sleep(1);
+    _OPENBB(bb3, B3, BB_SIZE, NULL, _CBB, 0, 0);    // bs size: 30
+    _CLOSBB(bb3, B3);
+    sleep(1);
+    _OPENBB(bb4, B4, BB_SIZE, NULL, _CBB, 0, 0);    // bs size: 40
+    _CLOSBB(bb4, B4);
+
+    if (blobstore_reclaimer_start(bs, 50, 25, 60) != EUCA_OK) {
+        printf("failed to start the reclaimer\n");
+        errors++;
+        goto done;
+    }
+    if (blobstore_reclaimer_start(bs, 50, 25, 60) == EUCA_OK) { // only one per store
+        _UNEXPECTED();
+    }
+
+    sleep(1);
+    _OPENBB(bb5, B5, BB_SIZE, NULL, _CBB, 0, 0);    // bs size: 50, at the high watermark
+    _CLOSBB(bb5, B5);
+    _OPENBB(bb6, B6, BB_SIZE, NULL, _CBB, 0, 0);    // bs size: 60, above it, so the reclaimer is woken up
+
+    for (int i = 0; i < 50; i++) {    // give the reclaimer up to 5 seconds to get down to 25
+        blobstore_reclaimer_stats(bs, &stats, FALSE);
+        if ((stats.purged_blocks > 0) && (stats.lag_usec == 0))
+            break;
+        usleep(100000);
+    }
+    blobstore_reclaimer_stats(bs, &stats, TRUE);
+    printf("reclaimer: used=%llu purged=%llu in %lld usec over %u passes, inline=%u, max lag=%lld usec\n",
+           stats.used_blocks, stats.purged_blocks, stats.purge_usec, stats.purge_passes, stats.inline_purges, stats.max_lag_usec);
+    if ((stats.purged_blocks != (BB_SIZE * 4)) || (stats.used_blocks > (BB_SIZE * 2)) || (stats.inline_purges != 0) || (stats.lag_usec != 0)) {
+        _UNEXPECTED();
+    }
+    blobstore_reclaimer_stats(bs, &stats, FALSE);
+    if (stats.purged_blocks != 0) {    // reset for the next interval
+        _UNEXPECTED();
+    }
+
+    _OPENBB(bb1, B1, 0, NULL, 0, 0, -1);    // the least recently used blobs are gone...
+    _OPENBB(bb4, B4, 0, NULL, 0, 0, -1);
+    _OPENBB(bb5, B5, 0, NULL, 0, 0, 0); // ...the rest are not
+    _CLOSBB(bb5, B5);
+    _CLOSBB(bb6, B6);
+
+    blobstore_reclaimer_stop(bs);
+    if (blobstore_reclaimer_stats(bs, &stats, FALSE) != EUCA_NOT_FOUND_ERROR) {
+        _UNEXPECTED();
+    }
+
+done:
+    printf("completed reclaimer test\n");
+    if (bs) {
+        blobstore_delete(bs);
+    }
+    return (errors);
+}
+
 //!
 //!
 //!
@@ -5752,6 +7290,12 @@ int main(int argc, char **argv)
     logfile(NULL, EUCA_LOG_TRACE, 4);
     blobstore_set_error_function(dummy_err_fn);
 
+    // 'bench-dm [iterations]' compares the device mapper backends instead of testing
+    if ((argc > 1) && !strcmp(argv[1], "bench-dm")) {
+        errors = do_dm_backend_bench(cwd, "bench-dm", (argc > 2) ? atoi(argv[2]) : 20);
+        blobstore_cleanup();
+        exit(errors);
+    }
     // if an argument is specified, it is treated as a blob name to create
     // this allows two simultaneous invocations of test_blobstore to compete
     // for the same blob so as to test the inter-process locks manually
@@ -5806,6 +7350,10 @@ int main(int argc, char **argv)
         goto done;                     // no point in continuing blobstore test if above isn't working
 
     errors += do_blobstore_test(cwd, "lru-visible", BLOBSTORE_FORMAT_FILES, BLOBSTORE_REVOCATION_LRU);
+    if (errors)
+        goto done;                     // no point in doing reclaimer test if above isn't working
+
+    errors += do_reclaimer_test(cwd, "lru-reclaimer");
     if (errors)
         goto done;                     // no point in doing copy test if above isn't working
 
@@ -115,6 +115,15 @@
 
 //! @}
 
+//! @{
+//! @name background reclamation of LRU blobstores
+
+#define BLOBSTORE_RECLAIM_HIGH_PCT                  90  //!< default percentage of the limit above which the reclaimer starts purging
+#define BLOBSTORE_RECLAIM_LOW_PCT                   75  //!< default percentage of the limit that the reclaimer purges down to
+#define BLOBSTORE_RECLAIM_INTERVAL_SEC              30  //!< how often the reclaimer looks at the store when nobody wakes it up
+
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -176,6 +185,12 @@ typedef enum {
     BLOBSTORE_FORMAT_DIRECTORY,        //!< all blob data are stored in a separate subdirectory under blobstore path
 } blobstore_format_t;
 
+typedef enum {
+    BLOBSTORE_DM_BACKEND_ANY,          //!< device mapper ioctls if this process may issue them, 'dmsetup' otherwise
+    BLOBSTORE_DM_BACKEND_DMSETUP,      //!< 'dmsetup' through the root wrapper, one process per device
+    BLOBSTORE_DM_BACKEND_IOCTL,        //!< device mapper ioctls issued in this process (see blobstore-dm.h)
+} blobstore_dm_backend_t;
+
 typedef enum {
     BLOBSTORE_COPY,
     BLOBSTORE_MAP,
@@ -202,6 +217,8 @@ typedef struct _blobstore {
     blobstore_snapshot_t snapshot_policy;
     blobstore_format_t format;
     int fd;                            //!< file descriptor of the blobstore metadata file
+    struct _blobstore_index *index;    //!< in-memory copy of the blobstore index, used under the blobstore lock
+    struct _blobstore_reclaimer *reclaimer; //!< background reclaimer thread state, if one was started for the store
 } blobstore;
 
 typedef struct _blockblob {
@@ -267,6 +284,22 @@ typedef struct _blobstore_meta {
     blobstore_format_t format;
 } blobstore_meta;
 
+//! Counters kept by the background reclaimer of a blobstore, over the interval since they were last reset
+typedef struct _blobstore_reclaim_stats {
+    unsigned long long limit_blocks;   //!< max size of the blobstore, in blocks
+    unsigned long long high_blocks;    //!< high watermark, in blocks, above which the reclaimer purges
+    unsigned long long low_blocks;     //!< low watermark, in blocks, down to which the reclaimer purges
+    unsigned long long used_blocks;    //!< blocks in use as of the last look at the store
+    unsigned long long purged_blocks;  //!< blocks freed by the reclaimer
+    long long purge_usec;              //!< time the reclaimer spent purging, with the blobstore locked
+    unsigned int purge_passes;         //!< number of locked purge batches that the reclaimer ran
+    unsigned long long inline_blocks;  //!< blocks that blockblob_open() had to free itself
+    long long inline_usec;             //!< time blockblob_open() spent purging
+    unsigned int inline_purges;        //!< number of blockblob_open() calls that had to purge
+    long long max_lag_usec;            //!< longest time the store stayed above the high watermark before dropping below the low one
+    long long lag_usec;                //!< time the store has currently been above the high watermark, or 0
+} blobstore_reclaim_stats;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -295,6 +328,7 @@ const char *blobstore_get_error_str(blobstore_error_t error);
 const char *blobstore_get_last_msg(void);
 const char *blobstore_get_last_trace(void);
 void blobstore_set_error_function(void (*fn) (const char *msg));
+void blobstore_set_dm_backend(blobstore_dm_backend_t backend);
 struct flock *flock_whole_file(struct flock *l, short type);
 int blobstore_init(void);
 int blobstore_cleanup(void);
@@ -311,6 +345,9 @@ int blobstore_stat(blobstore * bs, blobstore_meta * meta);
 int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb));
 int blobstore_search(blobstore * bs, const char *regex, blockblob_meta ** results);
 int blobstore_delete_regex(blobstore * bs, const char *regex);
+int blobstore_reclaimer_start(blobstore * bs, int high_pct, int low_pct, int interval_sec);
+int blobstore_reclaimer_stop(blobstore * bs);
+int blobstore_reclaimer_stats(blobstore * bs, blobstore_reclaim_stats * stats, int reset);
 //! @}
 
 //! @{
@@ -320,6 +357,7 @@ int blockblob_close(blockblob * bb);
 int blockblob_delete(blockblob * bb, long long timeout_usec, char do_force);
 int blockblob_copy(blockblob * src_bb, unsigned long long src_offset_bytes, blockblob * dst_bb, unsigned long long dst_offset_bytes, unsigned long long len_bytes); //
 int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size);
+int blockblob_dedup(blockblob * bb, unsigned long long timeout_usec);
 const char *blockblob_get_dev(blockblob * bb);
 const char *blockblob_get_file(blockblob * bb);
 blobstore *blockblob_get_blobstore(blockblob * bb);
@@ -86,6 +86,14 @@
 #include <sys/stat.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>                  // BLKZEROOUT
+#include <linux/falloc.h>              // FALLOC_FL_PUNCH_HOLE
+#include <sys/time.h>
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl
@@ -103,6 +111,9 @@
 #define LOOP_RETRIES                             9
 #define OUTPUT_ALLOC_CHUNK 1024
 #define MAX_OUTPUT_BYTES 1024*1024
+#define COPY_BUF_SIZE                            (1024 * 1024)  //!< size of the buffer used by the native copy engine
+#define COPY_BUF_ALIGN                           4096   //!< alignment of that buffer
+#define COPY_CFR_SIZE                            (64 * 1024 * 1024) //!< most bytes handed to one copy_file_range() call
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -191,6 +202,10 @@ static char service_key_path[EUCA_MAX_PATH] = "/var/lib/eucalyptus/keys/node-pk.
 static char *pruntf(boolean log_error, char *format, ...)
 _attribute_wur_ _attribute_format_(2, 3);
 static char *execlp_output(boolean log_error, ...);
+static int copy_zero_range(int fd, boolean is_file, long long offset, long long len, unsigned char *buf);
+static int copy_data_range(int in_fd, long long in_offset, int out_fd, long long out_offset, long long len, unsigned char *buf, boolean * use_cfr);
+static int copy_zero_file(const char *path, const long long size_bytes, boolean zero_fill);
+static int rootwrap_dd2(const char *in, const char *out, const int bs, const long long count, const long long seek, const long long skip);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -283,6 +298,149 @@ int diskutil_cleanup(void)
     return (EUCA_OK);
 }
 
+//!
+//! Copies a range of bytes from one file or block device to another without
+//! shelling out. Holes in a regular source file are found with SEEK_DATA and
+//! SEEK_HOLE and are reproduced in the destination instead of being read and
+//! written as zeros, so a sparse disk copies in the time it takes to copy its
+//! used blocks. Data is moved with copy_file_range() where the kernel supports
+//! it and through a large aligned buffer otherwise.
+//!
+//! @param[in] in path of the source
+//! @param[in] in_offset first byte to copy from the source
+//! @param[in] out path of the destination, created if it does not exist
+//! @param[in] out_offset where the first byte goes in the destination
+//! @param[in] len number of bytes to copy
+//! @param[in] truncate_out if TRUE, a regular destination file is first cut at out_offset, as dd does without conv=notrunc
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_ACCESS_ERROR: if either path cannot be opened for lack of privileges
+//!         \li EUCA_IO_ERROR: if either path cannot be opened or the copy fails
+//!         \li EUCA_MEMORY_ERROR: if the copy buffer cannot be allocated
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!
+//! @pre Both in and out parameters must not be NULL and the offsets and length must not be negative.
+//!
+//! @post On success the range from 'in' has been copied and flushed to 'out'.
+//!
+int diskutil_copy(const char *in, const long long in_offset, const char *out, const long long out_offset, const long long len, boolean truncate_out)
+{
+    int ret = EUCA_OK;
+    int in_fd = -1;
+    int out_fd = -1;
+    long long pos = 0;
+    long long data = 0;
+    long long hole = 0;
+    long long copied = 0;
+    long long zeroed_from = LLONG_MAX;
+    boolean in_is_file = FALSE;
+    boolean out_is_file = FALSE;
+    boolean use_cfr = TRUE;
+    boolean find_holes = FALSE;
+    unsigned char *buf = NULL;
+    struct stat in_sb = { 0 };
+    struct stat out_sb = { 0 };
+
+    if (!in || !out || (in_offset < 0) || (out_offset < 0) || (len < 0)) {
+        LOGWARN("bad params: in=%s, out=%s, in_offset=%lld, out_offset=%lld, len=%lld\n", SP(in), SP(out), in_offset, out_offset, len);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    if (((in_fd = open(in, O_RDONLY)) < 0) || (fstat(in_fd, &in_sb) < 0)) {
+        ret = ((errno == EACCES) || (errno == EPERM)) ? EUCA_ACCESS_ERROR : EUCA_IO_ERROR;
+        LOGDEBUG("failed to open '%s' for copying: %s\n", in, strerror(errno));
+        goto cleanup;
+    }
+    if (((out_fd = open(out, (O_WRONLY | O_CREAT), 0666)) < 0) || (fstat(out_fd, &out_sb) < 0)) {
+        ret = ((errno == EACCES) || (errno == EPERM)) ? EUCA_ACCESS_ERROR : EUCA_IO_ERROR;
+        LOGDEBUG("failed to open '%s' for copying: %s\n", out, strerror(errno));
+        goto cleanup;
+    }
+    if (posix_memalign((void **)&buf, COPY_BUF_ALIGN, COPY_BUF_SIZE) != 0) {
+        LOGERROR("out of memory (failed to allocate copy buffer)\n");
+        buf = NULL;
+        ret = EUCA_MEMORY_ERROR;
+        goto cleanup;
+    }
+
+    in_is_file = S_ISREG(in_sb.st_mode);
+    out_is_file = S_ISREG(out_sb.st_mode);
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    find_holes = in_is_file;
+#endif /* SEEK_DATA && SEEK_HOLE */
+
+    // in a regular destination, nothing at or past its end needs to be zeroed
+    if (out_is_file) {
+        zeroed_from = out_sb.st_size;
+        if (truncate_out && (out_sb.st_size > out_offset)) {
+            if (ftruncate(out_fd, out_offset) < 0) {
+                LOGERROR("failed to truncate '%s': %s\n", out, strerror(errno));
+                ret = EUCA_IO_ERROR;
+                goto cleanup;
+            }
+            zeroed_from = out_offset;
+        }
+    }
+
+    for (pos = 0; (pos < len) && (ret == EUCA_OK); pos = hole) {
+        data = pos;
+        hole = len;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        if (find_holes) {
+            if ((data = lseek(in_fd, (in_offset + pos), SEEK_DATA)) < 0) {
+                if (errno == ENXIO) {
+                    data = len;        // nothing but a hole until the end of the source
+                } else {
+                    LOGDEBUG("cannot find holes in '%s' (%s), copying all of it\n", in, strerror(errno));
+                    find_holes = FALSE;
+                    data = pos;
+                }
+            } else {
+                data = MIN((data - in_offset), len);
+                if ((hole = lseek(in_fd, (in_offset + data), SEEK_HOLE)) < 0)
+                    hole = len;
+                else
+                    hole = MIN((hole - in_offset), len);
+            }
+        }
+#endif /* SEEK_DATA && SEEK_HOLE */
+
+        // reproduce the hole [pos, data) in the parts of the destination that may hold data
+        if (data > pos) {
+            long long zero_start = out_offset + pos;
+            long long zero_end = MIN((out_offset + data), zeroed_from);
+            ret = copy_zero_range(out_fd, out_is_file, zero_start, (zero_end - zero_start), buf);
+        }
+        if ((ret == EUCA_OK) && (hole > data)) {
+            ret = copy_data_range(in_fd, (in_offset + data), out_fd, (out_offset + data), (hole - data), buf, &use_cfr);
+            copied += (hole - data);
+        }
+    }
+
+    // a regular destination must be at least as long as the range, even if the source ended in a hole
+    if ((ret == EUCA_OK) && out_is_file && (fstat(out_fd, &out_sb) == 0) && (out_sb.st_size < (out_offset + len))) {
+        if (ftruncate(out_fd, (out_offset + len)) < 0) {
+            LOGERROR("failed to extend '%s': %s\n", out, strerror(errno));
+            ret = EUCA_IO_ERROR;
+        }
+    }
+    if ((ret == EUCA_OK) && (fsync(out_fd) < 0)) {
+        LOGERROR("failed to flush '%s': %s\n", out, strerror(errno));
+        ret = EUCA_IO_ERROR;
+    }
+    if (ret == EUCA_OK) {
+        LOGDEBUG("copied %lld of %lld byte(s) from '%s' to '%s', the rest were holes\n", copied, len, in, out);
+    }
+
+cleanup:
+    if (in_fd >= 0)
+        close(in_fd);
+    if (out_fd >= 0)
+        close(out_fd);
+    free(buf);
+    return (ret);
+}
+
 //!
 //!
 //!
@@ -305,6 +463,16 @@ int diskutil_ddzero(const char *path, const long long sectors, boolean zero_fill
     long long seek = sectors - 1;
 
     if (path) {
+        switch (copy_zero_file(path, (sectors * 512), zero_fill)) {
+        case EUCA_OK:
+            return (EUCA_OK);
+        case EUCA_ACCESS_ERROR:
+            break;                     // let dd try with elevated privileges
+        default:
+            LOGERROR("cannot create disk file %s\n", path);
+            return (EUCA_ERROR);
+        }
+
         if (zero_fill) {
             count = sectors;
             seek = 0;
@@ -354,6 +522,17 @@ int diskutil_dd(const char *in, const char *out, const int bs, const long long c
         LOGINFO("copying data from '%s'\n", in);
         LOGINFO("               to '%s' (blocks=%lld)\n", out, count);
 
+        switch (diskutil_copy(in, 0, out, 0, (count * bs), TRUE)) {
+        case EUCA_OK:
+            return (EUCA_OK);
+        case EUCA_ACCESS_ERROR:
+            break;                     // let dd try with elevated privileges
+        default:
+            LOGERROR("cannot copy '%s'\n", in);
+            LOGERROR("                to '%s'\n", out);
+            return (EUCA_ERROR);
+        }
+
         char if_str[EUCA_MAX_PATH] = "";
         snprintf(if_str, sizeof(if_str), "if=%s", in);
         char of_str[EUCA_MAX_PATH] = "";
@@ -378,7 +557,10 @@ int diskutil_dd(const char *in, const char *out, const int bs, const long long c
 }
 
 //!
-//!
+//! Copies count blocks of bs bytes, skipping skip blocks of the input and seeking
+//! seek blocks into the output, which is not truncated. The copy is done natively
+//! with diskutil_copy() and only falls back to dd through the root wrapper when
+//! this process may not open the paths itself.
 //!
 //! @param[in] in
 //! @param[in] out
@@ -397,34 +579,21 @@ int diskutil_dd(const char *in, const char *out, const int bs, const long long c
 //!
 int diskutil_dd2(const char *in, const char *out, const int bs, const long long count, const long long seek, const long long skip)
 {
-    char *output = NULL;
-
     if (in && out) {
         LOGINFO("copying data from '%s'\n", in);
         LOGINFO("               to '%s'\n", out);
         LOGINFO("               of %lld blocks (bs=%d), seeking %lld, skipping %lld\n", count, bs, seek, skip);
 
-        char if_str[EUCA_MAX_PATH] = "";
-        snprintf(if_str, sizeof(if_str), "if=%s", in);
-        char of_str[EUCA_MAX_PATH] = "";
-        snprintf(of_str, sizeof(of_str), "of=%s", out);
-        char bs_str[64];
-        snprintf(bs_str, sizeof(bs_str), "bs=%d", bs);
-        char count_str[64];
-        snprintf(count_str, sizeof(count_str), "count=%lld", count);
-        char seek_str[64];
-        snprintf(seek_str, sizeof(seek_str), "seek=%lld", seek);
-        char skip_str[64];
-        snprintf(skip_str, sizeof(skip_str), "skip=%lld", skip);
-        output = execlp_output(TRUE, helpers_path[ROOTWRAP], helpers_path[DD], if_str, of_str, bs_str, count_str, seek_str, skip_str, "conv=notrunc,fsync", NULL);
-        if (!output) {
+        switch (diskutil_copy(in, (skip * bs), out, (seek * bs), (count * bs), FALSE)) {
+        case EUCA_OK:
+            return (EUCA_OK);
+        case EUCA_ACCESS_ERROR:
+            return (rootwrap_dd2(in, out, bs, count, seek, skip));  // let dd try with elevated privileges
+        default:
             LOGERROR("cannot copy '%s'\n", in);
             LOGERROR("                to '%s'\n", out);
             return (EUCA_ERROR);
         }
-
-        EUCA_FREE(output);
-        return (EUCA_OK);
     }
 
     LOGWARN("bad params: in=%s, out=%s\n", SP(in), SP(out));
@@ -1400,13 +1569,428 @@ long long round_down_sec(long long bytes)
     return ((bytes % SECTOR_SIZE) ? (((bytes / SECTOR_SIZE)) * SECTOR_SIZE) : bytes);
 }
 
+//!
+//! Fills a range of an open destination with zeros, as cheaply as the destination
+//! allows: holes are punched in regular files and block devices are asked to zero
+//! the range themselves (which loop devices turn into holes in their backing file).
+//! Only when neither is supported are zeros actually written.
+//!
+//! @param[in] fd destination descriptor
+//! @param[in] is_file TRUE if the destination is a regular file
+//! @param[in] offset first byte of the range
+//! @param[in] len number of bytes in the range
+//! @param[in] buf scratch buffer of COPY_BUF_SIZE bytes, clobbered
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR on failure
+//!
+static int copy_zero_range(int fd, boolean is_file, long long offset, long long len, unsigned char *buf)
+{
+    ssize_t wrote = 0;
+
+    if (len <= 0)
+        return (EUCA_OK);
+
+#if defined(FALLOC_FL_PUNCH_HOLE)
+    if (is_file && (fallocate(fd, (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE), offset, len) == 0))
+        return (EUCA_OK);
+#endif /* FALLOC_FL_PUNCH_HOLE */
+#if defined(BLKZEROOUT)
+    if (!is_file && ((offset % 512) == 0) && ((len % 512) == 0)) {
+        uint64_t range[2] = { offset, len };
+        if (ioctl(fd, BLKZEROOUT, range) == 0)
+            return (EUCA_OK);
+    }
+#endif /* BLKZEROOUT */
+
+    bzero(buf, COPY_BUF_SIZE);
+    while (len > 0) {
+        if ((wrote = pwrite(fd, buf, MIN(len, COPY_BUF_SIZE), offset)) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGERROR("failed to zero %lld byte(s) at offset %lld: %s\n", len, offset, strerror(errno));
+            return (EUCA_IO_ERROR);
+        }
+        offset += wrote;
+        len -= wrote;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Copies a range of data between two open descriptors, in the kernel when
+//! copy_file_range() is available for the pair and through an aligned buffer
+//! otherwise. Like dd, stops early without error at the end of the source.
+//!
+//! @param[in] in_fd source descriptor
+//! @param[in] in_offset first byte to read
+//! @param[in] out_fd destination descriptor
+//! @param[in] out_offset where the first byte goes
+//! @param[in] len number of bytes to copy
+//! @param[in] buf scratch buffer of COPY_BUF_SIZE bytes, clobbered
+//! @param[in,out] use_cfr whether copy_file_range() may be tried, cleared once it is found not to work
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR on failure
+//!
+static int copy_data_range(int in_fd, long long in_offset, int out_fd, long long out_offset, long long len, unsigned char *buf, boolean * use_cfr)
+{
+    ssize_t got = 0;
+    ssize_t wrote = 0;
+    ssize_t done = 0;
+
+#if defined(__NR_copy_file_range)
+    while (*use_cfr && (len > 0)) {
+        loff_t in_off = in_offset;
+        loff_t out_off = out_offset;
+        if ((got = syscall(__NR_copy_file_range, in_fd, &in_off, out_fd, &out_off, (size_t) MIN(len, COPY_CFR_SIZE), 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            // e.g., ENOSYS on old kernels, EXDEV across file systems, EINVAL for block devices
+            LOGDEBUG("copy_file_range() is not usable (%s), copying through a buffer\n", strerror(errno));
+            *use_cfr = FALSE;
+            break;
+        }
+        if (got == 0)
+            return (EUCA_OK);          // end of the source
+        in_offset += got;
+        out_offset += got;
+        len -= got;
+    }
+#endif /* __NR_copy_file_range */
+
+    while (len > 0) {
+        if ((got = pread(in_fd, buf, MIN(len, COPY_BUF_SIZE), in_offset)) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGERROR("failed to read %lld byte(s) at offset %lld: %s\n", len, in_offset, strerror(errno));
+            return (EUCA_IO_ERROR);
+        }
+        if (got == 0)
+            return (EUCA_OK);          // end of the source
+
+        for (done = 0; done < got; done += wrote) {
+            if ((wrote = pwrite(out_fd, buf + done, got - done, out_offset + done)) < 0) {
+                if (errno == EINTR) {
+                    wrote = 0;
+                    continue;
+                }
+                LOGERROR("failed to write %ld byte(s) at offset %lld: %s\n", (got - done), (out_offset + done), strerror(errno));
+                return (EUCA_IO_ERROR);
+            }
+        }
+        in_offset += got;
+        out_offset += got;
+        len -= got;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Creates a disk file of the given size without shelling out. A regular file
+//! is sized with ftruncate() and, when zero-filled, has its blocks allocated
+//! with fallocate(); anything else is zeroed in place.
+//!
+//! @param[in] path path of the disk file
+//! @param[in] size_bytes size of the disk
+//! @param[in] zero_fill if TRUE, the whole disk is zeroed (and allocated), otherwise only its last sector is
+//!
+//! @return EUCA_OK on success or EUCA_ACCESS_ERROR, EUCA_IO_ERROR or EUCA_MEMORY_ERROR on failure
+//!
+static int copy_zero_file(const char *path, const long long size_bytes, boolean zero_fill)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    long long offset = 0;
+    unsigned char *buf = NULL;
+    struct stat sb = { 0 };
+
+    if (((fd = open(path, (O_WRONLY | O_CREAT), 0666)) < 0) || (fstat(fd, &sb) < 0)) {
+        ret = ((errno == EACCES) || (errno == EPERM)) ? EUCA_ACCESS_ERROR : EUCA_IO_ERROR;
+        LOGDEBUG("failed to open '%s' for zeroing: %s\n", path, strerror(errno));
+        goto cleanup;
+    }
+
+    if (S_ISREG(sb.st_mode)) {
+        // like dd, drop whatever the file held past the point where zeroing starts
+        offset = zero_fill ? 0 : (size_bytes - 512);
+        if ((ftruncate(fd, offset) < 0) || (ftruncate(fd, size_bytes) < 0)) {
+            LOGERROR("failed to size '%s': %s\n", path, strerror(errno));
+            ret = EUCA_IO_ERROR;
+            goto cleanup;
+        }
+        if (!zero_fill || (fallocate(fd, 0, 0, size_bytes) == 0))
+            goto cleanup;
+    } else if (!zero_fill) {
+        offset = size_bytes - 512;
+    }
+
+    if (posix_memalign((void **)&buf, COPY_BUF_ALIGN, COPY_BUF_SIZE) != 0) {
+        buf = NULL;
+        ret = EUCA_MEMORY_ERROR;
+        goto cleanup;
+    }
+    if (S_ISREG(sb.st_mode)) {
+        // the file system cannot allocate blocks for us, so write the zeros out rather than punch holes
+        ret = copy_zero_range(fd, FALSE, 0, size_bytes, buf);
+    } else {
+        ret = copy_zero_range(fd, FALSE, offset, (size_bytes - offset), buf);
+    }
+
+cleanup:
+    if ((ret == EUCA_OK) && (fsync(fd) < 0))
+        ret = EUCA_IO_ERROR;
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return (ret);
+}
+
+//!
+//! Copies blocks between files or devices by running dd through the root
+//! wrapper, for when the process lacks the privileges to do it natively
+//!
+//! @param[in] in
+//! @param[in] out
+//! @param[in] bs
+//! @param[in] count
+//! @param[in] seek
+//! @param[in] skip
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if dd fails
+//!
+static int rootwrap_dd2(const char *in, const char *out, const int bs, const long long count, const long long seek, const long long skip)
+{
+    char *output = NULL;
+
+    char if_str[EUCA_MAX_PATH] = "";
+    snprintf(if_str, sizeof(if_str), "if=%s", in);
+    char of_str[EUCA_MAX_PATH] = "";
+    snprintf(of_str, sizeof(of_str), "of=%s", out);
+    char bs_str[64];
+    snprintf(bs_str, sizeof(bs_str), "bs=%d", bs);
+    char count_str[64];
+    snprintf(count_str, sizeof(count_str), "count=%lld", count);
+    char seek_str[64];
+    snprintf(seek_str, sizeof(seek_str), "seek=%lld", seek);
+    char skip_str[64];
+    snprintf(skip_str, sizeof(skip_str), "skip=%lld", skip);
+    output = execlp_output(TRUE, helpers_path[ROOTWRAP], helpers_path[DD], if_str, of_str, bs_str, count_str, seek_str, skip_str, "conv=notrunc,fsync", NULL);
+    if (!output) {
+        LOGERROR("cannot copy '%s'\n", in);
+        LOGERROR("                to '%s'\n", out);
+        return (EUCA_ERROR);
+    }
+
+    EUCA_FREE(output);
+    return (EUCA_OK);
+}
+
 #ifdef _UNIT_TEST
+//!
+//! Creates a sparse file with a 1 MiB extent of patterned data every stride bytes
+//!
+//! @param[in] path file to create
+//! @param[in] size_bytes size of the file
+//! @param[in] stride_bytes distance between the starts of the data extents
+//!
+//! @return number of data bytes written
+//!
+static long long make_sparse_file(const char *path, long long size_bytes, long long stride_bytes)
+{
+    int fd = -1;
+    long long written = 0;
+    unsigned char *buf = EUCA_ALLOC(COPY_BUF_SIZE, sizeof(unsigned char));
+
+    assert(buf);
+    assert((fd = open(path, (O_WRONLY | O_CREAT | O_TRUNC), 0600)) >= 0);
+    assert(ftruncate(fd, size_bytes) == 0);
+    for (long long off = (stride_bytes / 3); off < size_bytes; off += stride_bytes) {
+        long long n = MIN(COPY_BUF_SIZE, (size_bytes - off));
+        for (long long i = 0; i < n; i++)
+            buf[i] = (unsigned char)((off + i) * 31 + 7);
+        assert(pwrite(fd, buf, n, off) == n);
+        written += n;
+    }
+    close(fd);
+    EUCA_FREE(buf);
+    return (written);
+}
+
+//!
+//! Compares a range of one file with a range of another
+//!
+//! @param[in] a first file
+//! @param[in] a_offset start of the range in a
+//! @param[in] b second file
+//! @param[in] b_offset start of the range in b
+//! @param[in] len length of the ranges
+//!
+//! @return TRUE if the ranges are identical
+//!
+static boolean same_bytes(const char *a, long long a_offset, const char *b, long long b_offset, long long len)
+{
+    boolean same = TRUE;
+    int fa = open(a, O_RDONLY);
+    int fb = open(b, O_RDONLY);
+    unsigned char *ba = EUCA_ALLOC(COPY_BUF_SIZE, sizeof(unsigned char));
+    unsigned char *bb = EUCA_ALLOC(COPY_BUF_SIZE, sizeof(unsigned char));
+
+    assert((fa >= 0) && (fb >= 0) && ba && bb);
+    for (long long done = 0; same && (done < len);) {
+        long long n = MIN(COPY_BUF_SIZE, (len - done));
+        if ((pread(fa, ba, n, a_offset + done) != n) || (pread(fb, bb, n, b_offset + done) != n) || memcmp(ba, bb, n))
+            same = FALSE;
+        done += n;
+    }
+    close(fa);
+    close(fb);
+    EUCA_FREE(ba);
+    EUCA_FREE(bb);
+    return (same);
+}
+
+//!
+//! Checks that diskutil_copy() copies ranges exactly and keeps holes as holes
+//!
+//! @return number of failed checks
+//!
+static int test_copy(void)
+{
+    int errors = 0;
+    long long size = 64LL * COPY_BUF_SIZE;
+    char src[] = "/tmp/diskutil-src-XXXXXX";
+    char dst[] = "/tmp/diskutil-dst-XXXXXX";
+    struct stat sb = { 0 };
+
+#define CHECK(_cond)                                                      \
+{                                                                         \
+    if (!(_cond)) {                                                       \
+        printf("FAILED at line %d: %s\n", __LINE__, #_cond);             \
+        errors++;                                                         \
+    }                                                                     \
+}
+
+    close(safe_mkstemp(src));
+    close(safe_mkstemp(dst));
+    make_sparse_file(src, size, (8 * COPY_BUF_SIZE));
+
+    printf("a sparse file is copied whole and stays sparse\n");
+    CHECK(diskutil_copy(src, 0, dst, 0, size, TRUE) == EUCA_OK);
+    CHECK((stat(dst, &sb) == 0) && (sb.st_size == size));
+    CHECK(same_bytes(src, 0, dst, 0, size));
+    CHECK((sb.st_blocks * 512LL) <= (16LL * COPY_BUF_SIZE));
+
+    printf("an unaligned range lands at an offset without truncating\n");
+    make_sparse_file(dst, size, (3 * COPY_BUF_SIZE));
+    CHECK(diskutil_copy(src, 12345, dst, 777, (size / 2), FALSE) == EUCA_OK);
+    CHECK((stat(dst, &sb) == 0) && (sb.st_size == size));
+    CHECK(same_bytes(src, 12345, dst, 777, (size / 2)));
+
+    printf("holes in the source overwrite stale data in the destination\n");
+    make_sparse_file(dst, size, COPY_BUF_SIZE);
+    CHECK(diskutil_copy(src, 0, dst, 0, size, FALSE) == EUCA_OK);
+    CHECK(same_bytes(src, 0, dst, 0, size));
+
+    printf("a copy that ends in a hole extends the destination\n");
+    CHECK(diskutil_copy(src, 0, dst, 0, size, TRUE) == EUCA_OK);
+    CHECK(truncate(dst, 0) == 0);
+    CHECK(diskutil_copy(src, (size - COPY_BUF_SIZE), dst, 4096, 1000, FALSE) == EUCA_OK);
+    CHECK((stat(dst, &sb) == 0) && (sb.st_size == (4096 + 1000)));
+    CHECK(same_bytes(src, (size - COPY_BUF_SIZE), dst, 4096, 1000));
+
+    printf("disk files are created at the requested size\n");
+    CHECK(diskutil_ddzero(dst, 2048, FALSE) == EUCA_OK);
+    CHECK((stat(dst, &sb) == 0) && (sb.st_size == (2048 * 512)) && (sb.st_blocks == 0));
+    CHECK(diskutil_ddzero(dst, 2048, TRUE) == EUCA_OK);
+    CHECK((stat(dst, &sb) == 0) && (sb.st_size == (2048 * 512)));
+    CHECK(same_bytes("/dev/zero", 0, dst, 0, (2048 * 512)));
+
+    printf("missing sources and bad parameters are errors\n");
+    CHECK(diskutil_copy("/nonexistent/diskutil-src", 0, dst, 0, 512, FALSE) == EUCA_IO_ERROR);
+    CHECK(diskutil_copy(src, -1, dst, 0, 512, FALSE) == EUCA_INVALID_ERROR);
+
+#undef CHECK
+
+    unlink(src);
+    unlink(dst);
+    return (errors);
+}
+
+//!
+//! Compares the throughput of the native copy engine with that of dd on a
+//! sparse disk image, the way blockblob_copy() and blockblob_clone() use them
+//!
+//! @param[in] size_mb size of the disk image in MiB
+//! @param[in] used_percent share of the image that holds data
+//!
+//! @return 0 on success, 1 if a copy fails
+//!
+static int bench_copy(long long size_mb, int used_percent)
+{
+    int bss[] = { 512, 4096 };
+    long long size = size_mb * 1024 * 1024;
+    long long stride = (COPY_BUF_SIZE * 100LL) / MAX(1, MIN(100, used_percent));
+    long long used = 0;
+    double secs = 0;
+    char src[] = "/tmp/diskutil-bench-src-XXXXXX";
+    char dst[] = "/tmp/diskutil-bench-dst-XXXXXX";
+    struct stat sb = { 0 };
+    struct timeval start = { 0 };
+    struct timeval end = { 0 };
+
+    close(safe_mkstemp(src));
+    close(safe_mkstemp(dst));
+    used = make_sparse_file(src, size, stride);
+    printf("copying a %lld MiB image with %lld MiB of data\n", size_mb, (used / (1024 * 1024)));
+
+    unlink(dst);
+    gettimeofday(&start, NULL);
+    if (diskutil_copy(src, 0, dst, 0, size, FALSE) != EUCA_OK) {
+        printf("native copy failed\n");
+        return (1);
+    }
+    gettimeofday(&end, NULL);
+    secs = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+    stat(dst, &sb);
+    printf("%-14s %8.3f sec %10.1f MiB/s %10lld MiB allocated\n", "native", secs, (size_mb / secs), ((sb.st_blocks * 512LL) / (1024 * 1024)));
+
+    for (int i = 0; i < (sizeof(bss) / sizeof(bss[0])); i++) {
+        char label[32] = "";
+        if (!helpers_path[ROOTWRAP] || !helpers_path[DD]) {
+            printf("dd or the root wrapper is missing, skipping the dd path\n");
+            break;
+        }
+        unlink(dst);
+        gettimeofday(&start, NULL);
+        if (rootwrap_dd2(src, dst, bss[i], (size / bss[i]), 0, 0) != EUCA_OK) {
+            printf("dd copy failed\n");
+            return (1);
+        }
+        gettimeofday(&end, NULL);
+        secs = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+        stat(dst, &sb);
+        snprintf(label, sizeof(label), "dd bs=%d", bss[i]);
+        printf("%-14s %8.3f sec %10.1f MiB/s %10lld MiB allocated\n", label, secs, (size_mb / secs), ((sb.st_blocks * 512LL) / (1024 * 1024)));
+    }
+
+    unlink(src);
+    unlink(dst);
+    return (0);
+}
+
 int main(int argc, char *argv[])
 {
     char *output;
 
     logfile(NULL, EUCA_LOG_TRACE, 4);
     log_prefix_set("%T %L %t9 |");
+
+    if ((argc > 1) && !strcmp(argv[1], "bench-copy")) {
+        logfile(NULL, EUCA_LOG_WARN, 4);
+        diskutil_init(0);              // only dd and the root wrapper are needed
+        return (bench_copy(((argc > 2) ? atoll(argv[2]) : 1024), ((argc > 3) ? atoi(argv[3]) : 10)));
+    }
+
+    assert(test_copy() == 0);
     assert(diskutil_init(3) == EUCA_OK);
     assert(diskutil_init(0) == EUCA_OK);
 
@@ -135,6 +135,7 @@ int imaging_image_by_manifest_url(const char *instanceId, const char *url, const
 
 int diskutil_init(int check_first);
 int diskutil_cleanup(void);
+int diskutil_copy(const char *in, const long long in_offset, const char *out, const long long out_offset, const long long len, boolean truncate_out);
 int diskutil_ddzero(const char *path, const long long sectors, boolean zero_fill);
 int diskutil_dd(const char *in, const char *out, const int bs, const long long count);
 int diskutil_dd2(const char *in, const char *out, const int bs, const long long count, const long long seek, const long long skip);
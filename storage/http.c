@@ -74,6 +74,7 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>                    // close, stat
@@ -84,6 +85,7 @@
 #include <ctype.h>                     // tolower, isdigit
 #include <sys/types.h>                 // stat
 #include <sys/stat.h>                  // stat
+#include <errno.h>
 #include <curl/curl.h>
 #include <curl/easy.h>
 
@@ -91,11 +93,8 @@
 #include <log.h>
 #include "misc.h"
 
-#ifndef _UNIT_TEST
-// http_ functions aren't part of the unit test
 #include <config.h>
 #include "http.h"
-#endif /* ! _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -103,13 +102,12 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-#ifndef _UNIT_TEST
 #define TOTAL_RETRIES                             40    //!< download is retried in case of connection problems (2.5hrs+)
 #define FIRST_TIMEOUT                              4    //!< in seconds, goes in powers of two afterwards
 #define MAX_TIMEOUT                              300    //!< in seconds, the cap for growing timeout values
 #define STRSIZE                                  245    //!< for short strings: files, hosts, URLs
-#endif /* ! _UNIT_TEST */
 #define RANDOM_DELAY_PERCENT                    0.01    //!< 1% of current timeout determines max delay duration
+#define RANGE_POLL_MSEC                         1000    //!< longest wait for activity on the connections of a ranged download
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -129,7 +127,6 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-#ifndef _UNIT_TEST
 struct read_request {
     FILE *fp;                          //!< input file pointer to be used by curl READERs
     long long total_read;              //!< bytes written during the operation
@@ -147,7 +144,43 @@ struct write_request {
     int ret;                           //!< return value of last inflate() call
 #endif                                 /* CAN_GZIP */
 };
-#endif /* ! _UNIT_TEST */
+
+//! One connection of a ranged download, working on one chunk at a time
+struct range_slot {
+    struct range_download *dl;         //!< the download this connection belongs to
+    CURL *curl;                        //!< easy handle, reused for every chunk of this connection
+    long long chunk;                   //!< chunk being downloaded, -1 if the connection is idle
+    long long start;                   //!< offset of the first byte of the chunk in the object
+    long long len;                     //!< bytes in the chunk
+    long long received;                //!< bytes of the chunk received so far, kept across retries
+    unsigned char *buf;                //!< holds the chunk until it can be delivered (ordered downloads only)
+    int attempts;                      //!< failed attempts at the chunk
+    time_t not_before;                 //!< a failed chunk is not resumed before this time
+    boolean busy;                      //!< the handle is in the multi handle
+    boolean done;                      //!< the chunk is complete and awaits delivery
+    boolean sink_failed;               //!< the sink refused the data
+    char range[64];                    //!< value of the Range header for the current attempt
+    char error_msg[CURL_ERROR_SIZE];   //!< curl error message of the last attempt
+};
+
+//! State of a ranged download (see http_get_ranges())
+struct range_download {
+    long long chunk_bytes;             //!< bytes in every chunk but the last
+    boolean ordered;                   //!< whether the sink must get the bytes in order
+    http_range_sink sink;              //!< where the bytes go
+    void *sink_arg;                    //!< opaque argument of the sink
+};
+
+//! Sink argument for ranged downloads into a file
+struct range_file {
+    int fd;                            //!< destination file descriptor
+};
+
+//! State of the probe request of http_range_probe()
+struct range_probe {
+    long long size_bytes;              //!< object size from the Content-Range header, -1 if not seen
+    long long received;                //!< body bytes received
+};
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -169,9 +202,9 @@ struct write_request {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-#ifndef _UNIT_TEST
 static boolean curl_initialized = FALSE;    //!< boolean to indicate if we have already initialize libcurl
-#endif /* ! _UNIT_TEST */
+static int http_connections = 1;       //!< connections per download, more than 1 enables ranged downloads (see http_set_parallel())
+static long long http_chunk_bytes = HTTP_DEFAULT_CHUNK_BYTES;   //!< bytes per chunk of a ranged download
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -183,6 +216,11 @@ static size_t read_data(char *buffer, size_t size, size_t nitems, void *params);
 static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params);
 static char hch_to_int(char ch);
 static char int_to_hch(char i);
+static size_t range_probe_header(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t range_probe_data(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t range_write(void *buffer, size_t size, size_t nmemb, void *params);
+static int range_file_sink(void *arg, long long offset, const unsigned char *buf, size_t len);
+static int http_get_parallel(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, boolean * bail_flag);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -635,6 +673,13 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
         return (EUCA_INVALID_ERROR);
     }
 
+    if (http_connections > 1) {
+        // large objects from servers that support ranges are fetched over several connections
+        if ((code = http_get_parallel(url, outfile, total_retries, first_timeout, connect_timeout, bail_flag)) != EUCA_UNSUPPORTED_ERROR)
+            return (code);
+        code = EUCA_ERROR;
+    }
+
     if ((fp = fopen64(outfile, "w")) == NULL) {
         LOGERROR("failed to open %s for writing\n", outfile);
         return (EUCA_ACCESS_ERROR);
@@ -743,14 +788,621 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
     return (code);
 }
 
+//!
+//! Sets how many connections http_get_timeout() may use for a download. With
+//! more than one, objects of at least two chunks are fetched with HTTP Range
+//! requests over that many connections, each chunk resuming where it left off
+//! when its connection fails, as long as the server supports ranges.
+//!
+//! @param[in] connections connections per download, 1 or less to download over a single connection
+//! @param[in] chunk_bytes bytes per chunk, 0 for the default
+//!
+void http_set_parallel(int connections, long long chunk_bytes)
+{
+    http_connections = (connections > 1) ? connections : 1;
+    http_chunk_bytes = (chunk_bytes > 0) ? chunk_bytes : HTTP_DEFAULT_CHUNK_BYTES;
+    LOGINFO("downloads will use up to %d connection(s) with %lld-byte chunks\n", http_connections, http_chunk_bytes);
+}
+
+//!
+//! Returns the settings of http_set_parallel(), for other downloaders to follow
+//!
+//! @param[out] chunk_bytes bytes per chunk, may be NULL
+//!
+//! @return connections per download
+//!
+int http_get_parallelism(long long *chunk_bytes)
+{
+    if (chunk_bytes != NULL)
+        *chunk_bytes = http_chunk_bytes;
+    return (http_connections);
+}
+
+//!
+//! Checks whether a server will serve an object in ranges by asking for its
+//! first byte, which also reveals the size of the object
+//!
+//! @param[in] url the object URL
+//! @param[in] headers extra request headers (e.g., a signature), may be NULL
+//! @param[in] connect_timeout the libcurl connect timeout, 0 for the default
+//! @param[out] size_bytes size of the object
+//!
+//! @return EUCA_OK if the server supports ranges, EUCA_UNSUPPORTED_ERROR if it
+//!         does not and EUCA_ERROR if the request failed
+//!
+int http_range_probe(const char *url, const struct curl_slist *headers, int connect_timeout, long long *size_bytes)
+{
+    long httpcode = 0L;
+    char error_msg[CURL_ERROR_SIZE] = "";
+    CURL *curl = NULL;
+    CURLcode result = CURLE_OK;
+    struct range_probe probe = { -1, 0 };
+
+    if ((curl = curl_easy_init()) == NULL) {
+        LOGERROR("could not initialize libcurl\n");
+        return (EUCA_ERROR);
+    }
+
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_msg);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(curl, CURLOPT_RANGE, "0-0");
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)MAX_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, range_probe_header);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &probe);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, range_probe_data);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &probe);
+    if (headers != NULL)
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, (struct curl_slist *)headers);
+    if (connect_timeout > 0)
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connect_timeout);
+
+    result = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcode);
+    curl_easy_cleanup(curl);
+
+    if (result == CURLE_WRITE_ERROR) { // more than the first byte came back
+        LOGDEBUG("server ignores ranges for %s\n", url);
+        return (EUCA_UNSUPPORTED_ERROR);
+    } else if (result != CURLE_OK) {
+        LOGWARN("range probe of %s failed: %s (%d)\n", url, error_msg, result);
+        return (EUCA_ERROR);
+    } else if ((httpcode != 206L) || (probe.size_bytes < 0)) {
+        LOGDEBUG("server responded with HTTP code %ld to a range probe of %s\n", httpcode, url);
+        return (EUCA_UNSUPPORTED_ERROR);
+    }
+    *size_bytes = probe.size_bytes;
+    return (EUCA_OK);
+}
+
+//!
+//! Downloads an object in chunks, using HTTP Range requests over several
+//! connections driven by one curl multi handle. A chunk whose connection fails
+//! is resumed from the last byte received, after a delay that doubles with
+//! each failure of that chunk, while the other connections keep going.
+//!
+//! @param[in] url the object URL
+//! @param[in] headers extra request headers (e.g., a signature), may be NULL
+//! @param[in] size_bytes size of the object, e.g., from http_range_probe()
+//! @param[in] connections most connections to use at once
+//! @param[in] chunk_bytes bytes per chunk
+//! @param[in] ordered if TRUE, the sink gets the bytes in order, a chunk at a
+//!            time, which takes a chunk_bytes buffer per connection; otherwise
+//!            it gets them as they arrive, in any order
+//! @param[in] sink receives the bytes along with their offset in the object
+//! @param[in] sink_arg opaque argument of the sink
+//! @param[in] total_retries failures allowed per chunk
+//! @param[in] first_timeout seconds to wait before the first retry of a chunk
+//! @param[in] connect_timeout the libcurl connect timeout, 0 for the default
+//! @param[in] bail_flag if it becomes TRUE, the download is abandoned, may be NULL
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_UNSUPPORTED_ERROR: if the server stopped honoring ranges
+//!         \li EUCA_IO_ERROR: if the sink failed
+//!         \li EUCA_ERROR: on any other failure
+//!
+int http_get_ranges(const char *url, const struct curl_slist *headers, long long size_bytes, int connections, long long chunk_bytes, boolean ordered,
+                    http_range_sink sink, void *sink_arg, int total_retries, int first_timeout, int connect_timeout, boolean * bail_flag)
+{
+    int i = 0;
+    int code = EUCA_OK;
+    int running = 0;
+    int msgs = 0;
+    int delay = 0;
+    long httpcode = 0L;
+    long long num_chunks = 0;
+    long long next_chunk = 0;
+    long long next_delivery = 0;
+    long long delivered = 0;
+    time_t now = 0;
+    boolean progress = FALSE;
+    boolean ready = FALSE;
+    CURLM *multi = NULL;
+    CURLMsg *msg = NULL;
+    struct range_slot *s = NULL;
+    struct range_slot *slots = NULL;
+    struct range_download dl = { chunk_bytes, ordered, sink, sink_arg };
+
+    if (!url || !sink || (size_bytes <= 0) || (connections < 1) || (chunk_bytes <= 0)) {
+        LOGERROR("invalid params: url=%s, size=%lld, connections=%d, chunk=%lld\n", SP(url), size_bytes, connections, chunk_bytes);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    num_chunks = (size_bytes + chunk_bytes - 1) / chunk_bytes;
+    if (connections > num_chunks)
+        connections = num_chunks;
+
+    if (((multi = curl_multi_init()) == NULL) || ((slots = EUCA_ZALLOC(connections, sizeof(struct range_slot))) == NULL)) {
+        LOGERROR("could not initialize libcurl\n");
+        code = EUCA_ERROR;
+        goto cleanup;
+    }
+
+    for (i = 0; i < connections; i++) {
+        s = slots + i;
+        s->dl = &dl;
+        s->chunk = -1;
+        if (((s->curl = curl_easy_init()) == NULL) || (ordered && ((s->buf = EUCA_ALLOC(chunk_bytes, sizeof(unsigned char))) == NULL))) {
+            LOGERROR("could not set up connection %d of %d for %s\n", i, connections, url);
+            code = EUCA_MEMORY_ERROR;
+            goto cleanup;
+        }
+        curl_easy_setopt(s->curl, CURLOPT_ERRORBUFFER, s->error_msg);
+        curl_easy_setopt(s->curl, CURLOPT_URL, url);
+        curl_easy_setopt(s->curl, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(s->curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(s->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(s->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+        curl_easy_setopt(s->curl, CURLOPT_LOW_SPEED_LIMIT, 360L);   // must have at least a 360 baud modem
+        curl_easy_setopt(s->curl, CURLOPT_LOW_SPEED_TIME, 10L); // abort if below speed limit for this many seconds
+        curl_easy_setopt(s->curl, CURLOPT_WRITEFUNCTION, range_write);
+        curl_easy_setopt(s->curl, CURLOPT_WRITEDATA, s);
+        curl_easy_setopt(s->curl, CURLOPT_PRIVATE, s);
+        if (headers != NULL)
+            curl_easy_setopt(s->curl, CURLOPT_HTTPHEADER, (struct curl_slist *)headers);
+        if (connect_timeout > 0)
+            curl_easy_setopt(s->curl, CURLOPT_CONNECTTIMEOUT, connect_timeout);
+    }
+
+    LOGDEBUG("downloading %lld byte(s) in %lld chunk(s) over %d connection(s) from %s\n", size_bytes, num_chunks, connections, url);
+    while ((code == EUCA_OK) && (delivered < num_chunks)) {
+        if ((bail_flag != NULL) && (*bail_flag == TRUE)) {
+            LOGWARN("bailing on the download for %s\n", url);
+            code = EUCA_ERROR;
+            break;
+        }
+        // put idle connections to work on the next chunks and resume failed chunks that are due
+        now = time(NULL);
+        for (i = 0; i < connections; i++) {
+            s = slots + i;
+            if ((s->chunk == -1) && (next_chunk < num_chunks)) {
+                s->chunk = next_chunk++;
+                s->start = s->chunk * chunk_bytes;
+                s->len = ((size_bytes - s->start) < chunk_bytes) ? (size_bytes - s->start) : (chunk_bytes);
+                s->received = 0;
+                s->attempts = 0;
+                s->not_before = 0;
+            }
+            if ((s->chunk != -1) && !s->busy && !s->done && (now >= s->not_before)) {
+                snprintf(s->range, sizeof(s->range), "%lld-%lld", (s->start + s->received), (s->start + s->len - 1));
+                curl_easy_setopt(s->curl, CURLOPT_RANGE, s->range);
+                s->sink_failed = FALSE;
+                s->error_msg[0] = '\0';
+                curl_multi_add_handle(multi, s->curl);
+                s->busy = TRUE;
+            }
+        }
+
+        curl_multi_perform(multi, &running);
+
+        // sort out the transfers that ended
+        while ((msg = curl_multi_info_read(multi, &msgs)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&s);
+            curl_multi_remove_handle(multi, s->curl);
+            s->busy = FALSE;
+            httpcode = 0L;
+            curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &httpcode);
+
+            if ((msg->data.result == CURLE_OK) && (httpcode == 206L) && (s->received == s->len)) {
+                s->done = TRUE;
+            } else if (s->sink_failed) {
+                LOGERROR("failed to store bytes %lld-%lld of %s\n", s->start, (s->start + s->len - 1), url);
+                code = EUCA_IO_ERROR;
+            } else if (httpcode == 200L) {
+                LOGERROR("server stopped honoring ranges for %s\n", url);
+                code = EUCA_UNSUPPORTED_ERROR;
+            } else if ((httpcode >= 400L) && (httpcode < 500L) && (httpcode != 408L)) {
+                LOGERROR("server responded with HTTP code %ld for bytes %s of %s\n", httpcode, s->range, url);
+                code = EUCA_ERROR;
+            } else if (++(s->attempts) > total_retries) {
+                LOGERROR("giving up on bytes %lld-%lld of %s after %d attempt(s)\n", s->start, (s->start + s->len - 1), url, s->attempts);
+                code = EUCA_ERROR;
+            } else {
+                for (delay = first_timeout, i = 1; (i < s->attempts) && (delay < MAX_TIMEOUT); i++)
+                    delay <<= 1;
+                if (delay > MAX_TIMEOUT)
+                    delay = MAX_TIMEOUT;
+                s->not_before = time(NULL) + delay;
+                LOGWARN("chunk %lld of %s failed (%s, HTTP code %ld), attempt %d of %d will resume at byte %lld in %d sec\n", s->chunk, url,
+                        (s->error_msg[0] != '\0') ? (s->error_msg) : ("short read"), httpcode, (s->attempts + 1), (total_retries + 1), (s->start + s->received), delay);
+            }
+        }
+
+        // hand complete chunks to the sink, in order if necessary, freeing up their connections
+        for (progress = TRUE; progress && (code == EUCA_OK);) {
+            progress = FALSE;
+            for (i = 0; (i < connections) && (code == EUCA_OK); i++) {
+                s = slots + i;
+                if (!s->done || (ordered && (s->chunk != next_delivery)))
+                    continue;
+                if (ordered && (sink(sink_arg, s->start, s->buf, s->len) != EUCA_OK)) {
+                    LOGERROR("failed to store bytes %lld-%lld of %s\n", s->start, (s->start + s->len - 1), url);
+                    code = EUCA_IO_ERROR;
+                    break;
+                }
+                s->chunk = -1;
+                s->done = FALSE;
+                next_delivery++;
+                delivered++;
+                progress = TRUE;
+            }
+        }
+
+        if ((code == EUCA_OK) && (delivered < num_chunks)) {
+            if (running > 0) {
+                curl_multi_wait(multi, NULL, 0, RANGE_POLL_MSEC, NULL);
+            } else {
+                // nothing in flight: unless a chunk can start right away, all of them are backing off
+                now = time(NULL);
+                for (ready = (next_chunk < num_chunks), i = 0; !ready && (i < connections); i++) {
+                    s = slots + i;
+                    ready = ((s->chunk == -1) || (!s->busy && !s->done && (now >= s->not_before)));
+                }
+                if (!ready)
+                    sleep(1);
+            }
+        }
+    }
+
+    if (code == EUCA_OK) {
+        LOGDEBUG("downloaded %lld byte(s) from %s\n", size_bytes, url);
+    }
+
+cleanup:
+    for (i = 0; (slots != NULL) && (i < connections); i++) {
+        s = slots + i;
+        if (s->curl != NULL) {
+            if (s->busy)
+                curl_multi_remove_handle(multi, s->curl);
+            curl_easy_cleanup(s->curl);
+        }
+        EUCA_FREE(s->buf);
+    }
+    EUCA_FREE(slots);
+    if (multi != NULL)
+        curl_multi_cleanup(multi);
+    return (code);
+}
+
+//!
+//! libcurl header handler of http_range_probe(), picks the object size out of Content-Range
+//!
+//! @param[in] buffer the header line
+//! @param[in] size the size of each member
+//! @param[in] nmemb the number of members
+//! @param[in] params a transparent pointer to the range_probe structure
+//!
+//! @return the number of bytes consumed
+//!
+static size_t range_probe_header(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    size_t len = size * nmemb;
+    char line[256] = "";
+    char *total = NULL;
+    struct range_probe *probe = ((struct range_probe *)params);
+
+    memcpy(line, buffer, ((len < (sizeof(line) - 1)) ? (len) : (sizeof(line) - 1)));
+    if (strncasecmp(line, "HTTP/", 5) == 0) {
+        probe->size_bytes = -1;        // a new response, e.g., after a redirect
+    } else if ((strncasecmp(line, "Content-Range:", 14) == 0) && ((total = strchr(line, '/')) != NULL) && isdigit(total[1])) {
+        probe->size_bytes = atoll(total + 1);
+    }
+    return (len);
+}
+
+//!
+//! libcurl write handler of http_range_probe(), aborts the transfer if the range was ignored
+//!
+//! @param[in] buffer the data
+//! @param[in] size the size of each member
+//! @param[in] nmemb the number of members
+//! @param[in] params a transparent pointer to the range_probe structure
+//!
+//! @return the number of bytes consumed, 0 to abort
+//!
+static size_t range_probe_data(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    struct range_probe *probe = ((struct range_probe *)params);
+
+    probe->received += (size * nmemb);
+    return ((probe->received > 1) ? (0) : (size * nmemb));
+}
+
+//!
+//! libcurl write handler of http_get_ranges()
+//!
+//! @param[in] buffer the data
+//! @param[in] size the size of each member
+//! @param[in] nmemb the number of members
+//! @param[in] params a transparent pointer to the range_slot structure
+//!
+//! @return the number of bytes consumed, 0 to abort
+//!
+static size_t range_write(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    size_t len = size * nmemb;
+    long httpcode = 0L;
+    struct range_slot *s = ((struct range_slot *)params);
+
+    // the body of an error response, or of one that ignores the range, is not chunk data
+    curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &httpcode);
+    if ((httpcode != 206L) || ((s->received + (long long)len) > s->len)) {
+        return (0);                    // aborts the transfer
+    }
+
+    if (s->dl->ordered) {
+        memcpy(s->buf + s->received, buffer, len);
+    } else if (s->dl->sink(s->dl->sink_arg, (s->start + s->received), buffer, len) != EUCA_OK) {
+        s->sink_failed = TRUE;
+        return (0);
+    }
+    s->received += len;
+    return (len);
+}
+
+//!
+//! Sink of ranged downloads into a file
+//!
+//! @param[in] arg the range_file structure
+//! @param[in] offset where the bytes go in the file
+//! @param[in] buf the bytes
+//! @param[in] len number of bytes
+//!
+//! @return EUCA_OK or EUCA_IO_ERROR
+//!
+static int range_file_sink(void *arg, long long offset, const unsigned char *buf, size_t len)
+{
+    ssize_t wrote = 0;
+    struct range_file *file = ((struct range_file *)arg);
+
+    while (len > 0) {
+        if ((wrote = pwrite(file->fd, buf, len, offset)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (EUCA_IO_ERROR);
+        }
+        buf += wrote;
+        offset += wrote;
+        len -= wrote;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Downloads an object into a file with http_get_ranges(), if the server
+//! supports ranges and the object spans at least two chunks
+//!
+//! @param[in] url the request URL
+//! @param[in] outfile path of the output file
+//! @param[in] total_retries failures allowed per chunk
+//! @param[in] first_timeout seconds to wait before the first retry of a chunk
+//! @param[in] connect_timeout the libcurl connect timeout
+//! @param[in] bail_flag if it becomes TRUE, the download is abandoned, may be NULL
+//!
+//! @return EUCA_UNSUPPORTED_ERROR if the object should be downloaded over a
+//!         single connection instead, otherwise the result of http_get_ranges()
+//!
+static int http_get_parallel(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, boolean * bail_flag)
+{
+    int code = EUCA_ERROR;
+    long long size_bytes = 0;
+    struct range_file file = { -1 };
+
+    if ((http_range_probe(url, NULL, connect_timeout, &size_bytes) != EUCA_OK) || (size_bytes < (2 * http_chunk_bytes))) {
+        return (EUCA_UNSUPPORTED_ERROR);
+    }
+
+    if ((file.fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+        LOGERROR("failed to open %s for writing\n", outfile);
+        return (EUCA_ACCESS_ERROR);
+    }
+    if (ftruncate(file.fd, size_bytes) == -1) {
+        LOGERROR("failed to size %s to %lld bytes\n", outfile, size_bytes);
+        close(file.fd);
+        remove(outfile);
+        return (EUCA_IO_ERROR);
+    }
+
+    code = http_get_ranges(url, NULL, size_bytes, http_connections, http_chunk_bytes, FALSE, range_file_sink, &file, total_retries, first_timeout, connect_timeout, bail_flag);
+    close(file.fd);
+
+    if (code == EUCA_OK) {
+        LOGDEBUG("saved image in %s\n", outfile);
+    } else if (code != EUCA_UNSUPPORTED_ERROR) {
+        LOGWARN("removing %s\n", outfile);
+        remove(outfile);
+    }
+    return (code);
+}
+
 #ifdef _UNIT_TEST
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define TEST_OBJECT_BYTES                  ((3 * 1024 * 1024) + 123)    //!< size of the object served by the test server
+#define TEST_CHUNK_BYTES                          (256 * 1024)  //!< chunk size of the test downloads
+
+static unsigned char *test_object = NULL;   //!< the object served by the test server
+static boolean test_ranges = TRUE;  //!< whether the test server honors Range headers
+static int test_drop_every = 0;    //!< the test server cuts every n-th ranged response off halfway, 0 for never
+static int test_requests = 0;      //!< requests seen by the test server
+static pthread_mutex_t test_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards test_requests
+
+//!
+//! Answers one request of the test server, with a 206 for ranges if they are
+//! enabled and a 200 with the whole object otherwise
+//!
+//! @param[in] arg the connected socket
+//!
+//! @return NULL
+//!
+static void *test_serve_one(void *arg)
+{
+    int fd = (int)((long)arg);
+    int request = 0;
+    char req[4096] = "";
+    char hdr[256] = "";
+    char *range = NULL;
+    size_t got = 0;
+    ssize_t n = 0;
+    long long first = 0;
+    long long last = TEST_OBJECT_BYTES - 1;
+    long long len = 0;
+    boolean ranged = FALSE;
+
+    while ((got < (sizeof(req) - 1)) && ((n = recv(fd, req + got, sizeof(req) - 1 - got, 0)) > 0)) {
+        got += n;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n"))
+            break;
+    }
+
+    if (test_ranges && ((range = strcasestr(req, "\r\nRange: bytes=")) != NULL)) {
+        ranged = TRUE;
+        sscanf(range + 15, "%lld-%lld", &first, &last);
+        if (last >= TEST_OBJECT_BYTES)
+            last = TEST_OBJECT_BYTES - 1;
+    }
+    len = last - first + 1;
+
+    pthread_mutex_lock(&test_mutex);
+    request = ++test_requests;
+    pthread_mutex_unlock(&test_mutex);
+
+    if (ranged) {
+        snprintf(hdr, sizeof(hdr), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%lld/%d\r\nContent-Length: %lld\r\nConnection: close\r\n\r\n",
+                 first, last, TEST_OBJECT_BYTES, len);
+        if (test_drop_every && (len > 1) && ((request % test_drop_every) == 0))
+            len /= 2;
+    } else {
+        snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nConnection: close\r\n\r\n", len);
+    }
+
+    if (send(fd, hdr, strlen(hdr), MSG_NOSIGNAL) > 0) {
+        for (got = 0; got < len; got += n) {
+            if ((n = send(fd, test_object + first + got, (len - got), MSG_NOSIGNAL)) <= 0)
+                break;
+        }
+    }
+    close(fd);
+    return (NULL);
+}
+
+//!
+//! Accept loop of the test server, a thread per connection
+//!
+//! @param[in] arg the listening socket
+//!
+//! @return NULL
+//!
+static void *test_server(void *arg)
+{
+    int fd = -1;
+    int listen_fd = (int)((long)arg);
+    pthread_t tid = { 0 };
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        if (pthread_create(&tid, NULL, test_serve_one, (void *)((long)fd)) == 0)
+            pthread_detach(tid);
+        else
+            close(fd);
+    }
+    return (NULL);
+}
+
+//!
+//! Ordered sink of the tests, checks that the bytes arrive in order and intact
+//!
+//! @param[in] arg points at the next expected offset
+//! @param[in] offset where the bytes go in the object
+//! @param[in] buf the bytes
+//! @param[in] len number of bytes
+//!
+//! @return EUCA_OK if the bytes are the expected ones, EUCA_ERROR otherwise
+//!
+static int test_ordered_sink(void *arg, long long offset, const unsigned char *buf, size_t len)
+{
+    long long *expected = ((long long *)arg);
+
+    if ((offset != *expected) || memcmp(buf, test_object + offset, len))
+        return (EUCA_ERROR);
+    *expected += len;
+    return (EUCA_OK);
+}
+
+//!
+//! Sink of the tests that always fails
+//!
+//! @param[in] arg unused
+//! @param[in] offset unused
+//! @param[in] buf unused
+//! @param[in] len unused
+//!
+//! @return EUCA_IO_ERROR
+//!
+static int test_failing_sink(void *arg, long long offset, const unsigned char *buf, size_t len)
+{
+    return (EUCA_IO_ERROR);
+}
+
+//!
+//! Checks that a downloaded file matches the object of the test server
+//!
+//! @param[in] path the file
+//!
+//! @return TRUE if it does
+//!
+static boolean test_file_matches(const char *path)
+{
+    boolean matches = FALSE;
+    unsigned char *buf = NULL;
+    FILE *fp = NULL;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return (FALSE);
+    if ((buf = EUCA_ALLOC(TEST_OBJECT_BYTES + 1, sizeof(unsigned char))) != NULL) {
+        matches = ((fread(buf, 1, TEST_OBJECT_BYTES + 1, fp) == TEST_OBJECT_BYTES) && !memcmp(buf, test_object, TEST_OBJECT_BYTES));
+        EUCA_FREE(buf);
+    }
+    fclose(fp);
+    return (matches);
+}
+
 //!
 //! Main entry point of the application
 //!
 //! @param[in] argc the number of parameter passed on the command line
 //! @param[in] argv the list of arguments
 //!
-//! @return EUCA_OK
+//! @return 0 if all tests pass, 1 otherwise
 //!
 int main(int argc, char **argv)
 {
@@ -763,11 +1415,99 @@ int main(int argc, char **argv)
 	EUCA_FREE(__u);                                           \
 }
 
+#define CHECK(_cond)                                                      \
+{                                                                         \
+    if (!(_cond)) {                                                       \
+        printf("FAILED at line %d: %s\n", __LINE__, #_cond);             \
+        errors++;                                                         \
+    }                                                                     \
+}
+
+    int i = 0;
+    int errors = 0;
+    int listen_fd = -1;
+    int one = 1;
+    long long size_bytes = 0;
+    long long expected = 0;
+    char url[STRSIZE] = "";
+    char path[] = "/tmp/test_url_XXXXXX";
+    boolean bail = TRUE;
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+    struct sockaddr_in addr = { 0 };
+    pthread_t tid = { 0 };
+
     _T("hello world");
     _T("~`!1@2#3$4%5^6&7*8(9)0_-+={[}]|\\:;\"'<,>.?/");
     _T("[datastore1 (1)] windows 2003 enterprise/windows 2003 enterprise.vmx");
-    return (EUCA_OK);
 
+    curl_global_init(CURL_GLOBAL_SSL);
+    logfile(NULL, EUCA_LOG_WARN, 4);
+
+    // an object that is not the same in every chunk, served over the loopback
+    test_object = EUCA_ALLOC(TEST_OBJECT_BYTES, sizeof(unsigned char));
+    for (i = 0; i < TEST_OBJECT_BYTES; i++)
+        test_object[i] = (unsigned char)((i * 2654435761U) >> 13);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))
+        || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listen_fd, 64) || getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len)
+        || pthread_create(&tid, NULL, test_server, (void *)((long)listen_fd))) {
+        printf("failed to start the test server\n");
+        return (1);
+    }
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/object", ntohs(addr.sin_port));
+    if (safe_mkstemp(path) < 0) {
+        printf("failed to create a temporary file\n");
+        return (1);
+    }
+
+    printf("the range probe finds the size\n");
+    CHECK(http_range_probe(url, NULL, 0, &size_bytes) == EUCA_OK);
+    CHECK(size_bytes == TEST_OBJECT_BYTES);
+
+    printf("parallel download matches the object\n");
+    http_set_parallel(4, TEST_CHUNK_BYTES);
+    test_requests = 0;
+    CHECK(http_get_timeout(url, path, 10, 0, 0, 0, NULL) == EUCA_OK);
+    CHECK(test_file_matches(path));
+    CHECK(test_requests == (1 + ((TEST_OBJECT_BYTES + TEST_CHUNK_BYTES - 1) / TEST_CHUNK_BYTES)));
+
+    printf("dropped connections are resumed\n");
+    test_drop_every = 3;
+    test_requests = 0;
+    CHECK(http_get_timeout(url, path, 10, 0, 0, 0, NULL) == EUCA_OK);
+    CHECK(test_file_matches(path));
+    CHECK(test_requests > (1 + ((TEST_OBJECT_BYTES + TEST_CHUNK_BYTES - 1) / TEST_CHUNK_BYTES)));
+
+    printf("ordered delivery is in order\n");
+    CHECK(http_get_ranges(url, NULL, TEST_OBJECT_BYTES, 3, TEST_CHUNK_BYTES, TRUE, test_ordered_sink, &expected, 10, 0, 0, NULL) == EUCA_OK);
+    CHECK(expected == TEST_OBJECT_BYTES);
+    test_drop_every = 0;
+
+    printf("out of retries, a failed chunk fails the download\n");
+    test_drop_every = 1;
+    expected = 0;
+    CHECK(http_get_ranges(url, NULL, TEST_OBJECT_BYTES, 4, TEST_CHUNK_BYTES, TRUE, test_ordered_sink, &expected, 2, 0, 0, NULL) == EUCA_ERROR);
+    test_drop_every = 0;
+
+    printf("sink failures and bailing stop the download\n");
+    CHECK(http_get_ranges(url, NULL, TEST_OBJECT_BYTES, 4, TEST_CHUNK_BYTES, FALSE, test_failing_sink, NULL, 10, 0, 0, NULL) == EUCA_IO_ERROR);
+    CHECK(http_get_timeout(url, path, 10, 0, 0, 0, &bail) != EUCA_OK);
+    CHECK(access(path, F_OK) != 0);
+
+    printf("servers without ranges get a single connection\n");
+    test_ranges = FALSE;
+    CHECK(http_range_probe(url, NULL, 0, &size_bytes) == EUCA_UNSUPPORTED_ERROR);
+    CHECK(http_get_timeout(url, path, 10, 0, 0, 0, NULL) == EUCA_OK);
+    CHECK(test_file_matches(path));
+
+    unlink(path);
+    close(listen_fd);
+    EUCA_FREE(test_object);
+    printf("errors=%d\n", errors);
+    return ((errors == 0) ? (0) : (1));
+
+#undef CHECK
 #undef _T
 }
 #endif /* _UNIT_TEST */
@@ -83,12 +83,20 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define HTTP_DEFAULT_CONNECTIONS                   4    //!< default connections per download for callers that enable ranged downloads
+#define HTTP_DEFAULT_CHUNK_BYTES                 (8 * 1024 * 1024LL)    //!< default bytes per chunk of a ranged download
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+struct curl_slist;
+
+//! Receives the bytes of a ranged download (see http_get_ranges()); returns EUCA_OK or an error code to abort
+typedef int (*http_range_sink) (void *arg, long long offset, const unsigned char *buf, size_t len);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -119,6 +127,11 @@ char *url_decode(const char *encoded);
 int http_get(const char *url, const char *outfile, boolean * bail_flag);
 int http_get_timeout(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, boolean * bail_flag);
 char *http_get2str(const char *url, boolean * bail_flag);
+void http_set_parallel(int connections, long long chunk_bytes);
+int http_get_parallelism(long long *chunk_bytes);
+int http_range_probe(const char *url, const struct curl_slist *headers, int connect_timeout, long long *size_bytes);
+int http_get_ranges(const char *url, const struct curl_slist *headers, long long size_bytes, int connections, long long chunk_bytes, boolean ordered,
+                    http_range_sink sink, void *sink_arg, int total_retries, int first_timeout, int connect_timeout, boolean * bail_flag);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
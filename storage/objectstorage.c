@@ -87,6 +87,7 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <openssl/sha.h>
 #if defined(HAVE_ZLIB_H)
 #include <zlib.h>
 #endif /* HAVE_ZLIB_H */
@@ -98,6 +99,7 @@
 #include <euca_string.h>
 
 #include "objectstorage.h"
+#include "http.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -114,6 +116,7 @@
 #define BUFSIZE                                  262144 //!< should be big enough for CERT and the signature
 #define STRSIZE                                    1024 //!< for short strings: files, hosts, URLs
 #define PROGRESS_UPDATE_SEC                           3 //!< how often to report on progress of long downloads
+#define STREAM_RING_SLOTS                             8 //!< CHUNK-sized slots between the network and the writer of a streaming request
 
 #define OBJECT_STORAGE_ENDPOINT                          "/services/objectstorage"
 #define DEFAULT_HOST_PORT                        "localhost:8773"
@@ -159,6 +162,31 @@ struct progress_data_t {
     time_t last_update;
 };
 
+//! Defines the sink of a streaming request: curl fills the ring, the writer thread drains it
+struct stream_sink {
+    pthread_mutex_t mutex;             //!< protects the ring indices and flags below
+    pthread_cond_t not_empty;          //!< signaled when a slot is published or the stream ends
+    pthread_cond_t not_full;           //!< signaled when the writer releases a slot
+    unsigned char *slots[STREAM_RING_SLOTS];    //!< CHUNK-sized buffers
+    size_t lens[STREAM_RING_SLOTS];    //!< bytes held by each published slot
+    int head;                          //!< slot being filled by curl
+    int tail;                          //!< oldest published slot
+    int published;                     //!< number of published slots not yet written out
+    boolean eof;                       //!< curl will not publish any more slots
+    boolean failed;                    //!< the writer gave up, curl should abort the transfer
+    pthread_t writer;                  //!< thread that digests, inflates and writes the slots
+    int fd;                            //!< destination descriptor, written with pwrite()
+    long long base_offset;             //!< where the first byte of the object goes in the destination
+    long long offset;                  //!< bytes of object content written so far
+    long long total_received;          //!< bytes received from the network
+    int do_compress;                   //!< whether the slots hold a gzip stream
+    SHA_CTX sha;                       //!< running digest of the object content
+#if defined (CAN_GZIP)
+    z_stream strm;                     //!< stream struct used by zlib
+    int ret;                           //!< return value of last inflate() call
+#endif                                 /* CAN_GZIP */
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -190,7 +218,7 @@ static unsigned short total_attempts = TOTAL_ATTEMPTS;
 \*----------------------------------------------------------------------------*/
 
 static int objectstorage_request_timeout(const char *objectstorage_op, const char *verb, const char *requested_url, const char *outfile, const int do_compress,
-                                         int connect_timeout, int total_timeout);
+                                         int connect_timeout, int total_timeout, const boolean do_stream, const long long offset, char *digest);
 static size_t write_header(void *buffer, size_t size, size_t nmemb, void *params);
 static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params);
 
@@ -200,6 +228,13 @@ static void zerr(int ret, char *where);
 static size_t write_data_zlib(void *buffer, size_t size, size_t nmemb, void *params);
 #endif /* CAN_GZIP */
 
+static int stream_start(struct stream_sink *sink, int fd, const long long offset, const int do_compress);
+static int stream_finish(struct stream_sink *sink, char *digest);
+static int stream_put(struct stream_sink *sink, const unsigned char *buf, size_t len);
+static void *stream_writer(void *arg);
+static size_t write_data_stream(void *buffer, size_t size, size_t nmemb, void *params);
+static int stream_range_sink(void *arg, long long offset, const unsigned char *buf, size_t len);
+
 static int progress_function(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
 
 /*----------------------------------------------------------------------------*\
@@ -226,16 +261,25 @@ static int progress_function(void *clientp, double dltotal, double dlnow, double
 //! @param[in] do_compress
 //! @param[in] connect_timeout
 //! @param[in] total_timeout
+//! @param[in] do_stream if TRUE, the response is handed to a writer thread instead of being written by curl
+//! @param[in] offset where, in outfile, the first byte of the response goes (streaming only)
+//! @param[out] digest if not NULL, receives the hex SHA-1 of the bytes written (streaming only)
 //!
 //! @return EUCA_OK on success or proper error code. Known error code returned include: EUCA_ERROR.
 //!
+//! @note In streaming mode the outfile is expected to be owned by someone else (e.g.,
+//!       a blockblob), so it is neither truncated nor removed on failure.
+//!
 static int objectstorage_request_timeout(const char *objectstorage_op, const char *verb, const char *requested_url, const char *outfile, const int do_compress,
-                                         int connect_timeout, int total_timeout)
+                                         int connect_timeout, int total_timeout, const boolean do_stream, const long long offset, char *digest)
 {
     int fd = -1;
     int code = EUCA_ERROR;
     int timeout = FIRST_TIMEOUT;
+    int connections = 1;
     long httpcode = 0;
+    long long size_bytes = 0;
+    long long chunk_bytes = 0;
     char *url_path = NULL;
     char *newline = NULL;
     char *url_host = NULL;
@@ -251,7 +295,9 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
     time_t t = 0;
     struct tm tmp_t = { 0 };
     struct request params = { 0 };
+    struct stream_sink sink = { 0 };
     struct curl_slist *headers = NULL; // beginning of a DLL with headers
+    boolean ranged = FALSE;
 
     pthread_mutex_lock(&wreq_mutex);   // lock for curl construction
 
@@ -398,12 +444,45 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
     } else {
         LOGDEBUG("writing %s output to %s\n", verb, outfile);
     }
+    if (do_stream) {
+        LOGDEBUG("        streaming at offset %lld\n", offset);
+    }
 
-    for (int attempt = 1; attempt <= total_attempts; attempt++) {
+    if (do_stream && (strncmp(verb, "GET", 4) == 0) && ((connections = http_get_parallelism(&chunk_bytes)) > 1)
+        && (http_range_probe(url, headers, connect_timeout, &size_bytes) == EUCA_OK) && (size_bytes >= (2 * chunk_bytes))) {
+        // large objects are fetched in ranges over several connections, each chunk resuming on its
+        // own after a failure, and handed to the writer in order so the digest and inflate still work
+        if (stream_start(&sink, fd, offset, do_compress) == EUCA_OK) {
+            LOGINFO("downloading %s over %d connections\n", url, connections);
+            ranged = TRUE;
+            code = http_get_ranges(url, headers, size_bytes, connections, chunk_bytes, TRUE, stream_range_sink, &sink, (total_attempts - 1), FIRST_TIMEOUT,
+                                   connect_timeout, NULL);
+            if (stream_finish(&sink, digest) != EUCA_OK) {
+                LOGERROR("failed to write the response to %s\n", outfile);
+                code = EUCA_IO_ERROR;
+            } else if (code == EUCA_OK) {
+                LOGINFO("downloaded %s\n", outfile);
+            } else if (code == EUCA_UNSUPPORTED_ERROR) {
+                ranged = FALSE;        // the server changed its mind about ranges, start over below
+                code = EUCA_ERROR;
+            }
+            LOGDEBUG("received %lld byte(s), wrote %lld byte(s)\n", sink.total_received, sink.offset);
+        }
+    }
+
+    for (int attempt = 1; !ranged && (attempt <= total_attempts); attempt++) {
         params.total_wrote = 0L;
         params.total_calls = 0L;
+        if (do_stream) {
+            // every attempt starts over at the same offset with a fresh digest and inflate state
+            if (stream_start(&sink, fd, offset, do_compress) != EUCA_OK) {
+                break;
+            }
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data_stream);
+        }
 #if defined(CAN_GZIP)
-        if (do_compress) {
+        if (do_compress && !do_stream) {
             // allocate zlib inflate state
             params.strm.zalloc = Z_NULL;
             params.strm.zfree = Z_NULL;
@@ -425,10 +504,21 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
         //! an approach to parallelizing objectstorage downloads is necessary
         LOGINFO("downloading %s\n", url);
         result = curl_easy_perform(curl);   // do it
-        LOGDEBUG("wrote %lld byte(s) in %lld write(s)\n", params.total_wrote, params.total_calls);
+        boolean bail = FALSE;
+
+        if (do_stream) {
+            // wait for the writer to drain the ring; a failed write is local, so retrying will not help
+            if (stream_finish(&sink, digest) != EUCA_OK) {
+                LOGERROR("failed to write the response to %s\n", outfile);
+                bail = TRUE;
+            }
+            LOGDEBUG("received %lld byte(s), wrote %lld byte(s)\n", sink.total_received, sink.offset);
+        } else {
+            LOGDEBUG("wrote %lld byte(s) in %lld write(s)\n", params.total_wrote, params.total_calls);
+        }
 
 #if defined(CAN_GZIP)
-        if (do_compress) {
+        if (do_compress && !do_stream) {
             inflateEnd(&(params.strm));
             if (params.ret != Z_STREAM_END) {
                 zerr(params.ret, "objectstorage_request");
@@ -436,9 +526,9 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
         }
 #endif
 
-        boolean bail = FALSE;
-
-        if (result) {                  // curl error (connection or transfer failed)
+        if (bail) {
+            ;                          // the writer has already reported the problem
+        } else if (result) {           // curl error (connection or transfer failed)
             LOGERROR("connection to objectstorage failed: %s (%d)\n", error_msg, result);
         } else {
             curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcode);
@@ -474,7 +564,7 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
     }
     close(fd);
 
-    if (code != EUCA_OK) {
+    if ((code != EUCA_OK) && !do_stream) {
         LOGINFO("due to error, removing %s\n", outfile);
         remove(outfile);
     }
@@ -518,7 +608,7 @@ int objectstorage_set_max_download_attempts(unsigned short new_max_attempts)
 //!
 int objectstorage_object_by_url(const char *url, const char *outfile, const int do_compress)
 {
-    return objectstorage_request_timeout(NULL, "GET", url, outfile, do_compress, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC);
+    return objectstorage_request_timeout(NULL, "GET", url, outfile, do_compress, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC, FALSE, 0L, NULL);
 }
 
 //!
@@ -555,7 +645,29 @@ int objectstorage_object_by_path(const char *path, const char *outfile, const in
 //!
 int objectstorage_image_by_manifest_url(const char *url, const char *outfile, const int do_compress)
 {
-    return objectstorage_request_timeout(GET_IMAGE_CMD, "GET", url, outfile, do_compress, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC);
+    return objectstorage_request_timeout(GET_IMAGE_CMD, "GET", url, outfile, do_compress, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC, FALSE, 0L, NULL);
+}
+
+//!
+//! downloads a decrypted image from objectstorage based on the manifest URL and
+//! streams it into outfile at the given offset. Network transfer, decompression,
+//! digesting and disk writes overlap: curl only copies the response into a
+//! bounded ring of buffers, while a writer thread inflates it and pwrite()s the
+//! result in place, so the image is written exactly once, at its final location.
+//!
+//! @param[in] url
+//! @param[in] outfile path of an existing file or block device (e.g., of a blockblob)
+//! @param[in] offset where the first byte of the image goes in outfile
+//! @param[in] do_compress
+//! @param[out] digest optional buffer of at least OBJECTSTORAGE_DIGEST_LEN bytes for the hex SHA-1 of the image
+//!
+//! @return the result of the objectstorage_request_timeout() call.
+//!
+//! @see objectstorage_request_timeout()
+//!
+int objectstorage_image_by_manifest_url_stream(const char *url, const char *outfile, const long long offset, const int do_compress, char *digest)
+{
+    return objectstorage_request_timeout(GET_IMAGE_CMD, "GET", url, outfile, do_compress, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC, TRUE, offset, digest);
 }
 
 //!
@@ -793,6 +905,319 @@ static size_t write_data_zlib(void *buffer, size_t size, size_t nmemb, void *par
 }
 #endif /* CAN_GZIP */
 
+//!
+//! Prepares the sink of a streaming request and starts its writer thread
+//!
+//! @param[in] sink the sink to initialize
+//! @param[in] fd destination descriptor
+//! @param[in] offset where the first byte of content goes
+//! @param[in] do_compress whether the response is a gzip stream
+//!
+//! @return EUCA_OK on success or EUCA_MEMORY_ERROR, EUCA_THREAD_ERROR or EUCA_ERROR on failure
+//!
+static int stream_start(struct stream_sink *sink, int fd, const long long offset, const int do_compress)
+{
+    int i = 0;
+
+    bzero(sink, sizeof(struct stream_sink));
+    for (i = 0; i < STREAM_RING_SLOTS; i++) {
+        if ((sink->slots[i] = EUCA_ALLOC(CHUNK, sizeof(unsigned char))) == NULL) {
+            LOGERROR("out of memory (failed to allocate stream buffers)\n");
+            for (i--; i >= 0; i--)
+                EUCA_FREE(sink->slots[i]);
+            return (EUCA_MEMORY_ERROR);
+        }
+    }
+    sink->fd = fd;
+    sink->base_offset = offset;
+    SHA1_Init(&(sink->sha));
+#if defined(CAN_GZIP)
+    sink->do_compress = do_compress;
+    if (do_compress) {
+        sink->strm.zalloc = Z_NULL;
+        sink->strm.zfree = Z_NULL;
+        sink->strm.opaque = Z_NULL;
+        sink->strm.avail_in = 0;
+        sink->strm.next_in = Z_NULL;
+        if ((sink->ret = inflateInit2(&(sink->strm), 31)) != Z_OK) {
+            zerr(sink->ret, "stream_start");
+            for (i = 0; i < STREAM_RING_SLOTS; i++)
+                EUCA_FREE(sink->slots[i]);
+            return (EUCA_ERROR);
+        }
+    }
+#endif /* CAN_GZIP */
+    pthread_mutex_init(&(sink->mutex), NULL);
+    pthread_cond_init(&(sink->not_empty), NULL);
+    pthread_cond_init(&(sink->not_full), NULL);
+
+    if (pthread_create(&(sink->writer), NULL, stream_writer, sink) != 0) {
+        LOGERROR("failed to start the stream writer thread\n");
+#if defined(CAN_GZIP)
+        if (sink->do_compress)
+            inflateEnd(&(sink->strm));
+#endif /* CAN_GZIP */
+        pthread_cond_destroy(&(sink->not_full));
+        pthread_cond_destroy(&(sink->not_empty));
+        pthread_mutex_destroy(&(sink->mutex));
+        for (i = 0; i < STREAM_RING_SLOTS; i++)
+            EUCA_FREE(sink->slots[i]);
+        return (EUCA_THREAD_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Publishes the partially filled slot, if any, waits for the writer to drain
+//! the ring and releases the sink's resources
+//!
+//! @param[in] sink the sink started with stream_start()
+//! @param[out] digest optional buffer of at least OBJECTSTORAGE_DIGEST_LEN bytes for the hex SHA-1 of the content
+//!
+//! @return EUCA_OK if everything received was written out (and, for gzip, the stream was complete) or EUCA_ERROR
+//!
+static int stream_finish(struct stream_sink *sink, char *digest)
+{
+    int i = 0;
+    int ret = EUCA_OK;
+    unsigned char md[SHA_DIGEST_LENGTH] = { 0 };
+
+    pthread_mutex_lock(&(sink->mutex));
+    {
+        if (!sink->failed && (sink->lens[sink->head] > 0)) {
+            // the slot being filled is never one of the published ones, so there is room for it
+            sink->head = (sink->head + 1) % STREAM_RING_SLOTS;
+            sink->published++;
+        }
+        sink->eof = TRUE;
+        pthread_cond_signal(&(sink->not_empty));
+    }
+    pthread_mutex_unlock(&(sink->mutex));
+    pthread_join(sink->writer, NULL);
+
+    if (sink->failed)
+        ret = EUCA_ERROR;
+#if defined(CAN_GZIP)
+    if (sink->do_compress) {
+        if ((ret == EUCA_OK) && (sink->ret != Z_STREAM_END)) {
+            zerr(sink->ret, "stream_finish");
+            ret = EUCA_ERROR;
+        }
+        inflateEnd(&(sink->strm));
+    }
+#endif /* CAN_GZIP */
+
+    SHA1_Final(md, &(sink->sha));
+    if ((ret == EUCA_OK) && (digest != NULL)) {
+        for (i = 0; i < SHA_DIGEST_LENGTH; i++)
+            snprintf(digest + (i * 2), 3, "%02x", md[i]);
+    }
+
+    pthread_cond_destroy(&(sink->not_full));
+    pthread_cond_destroy(&(sink->not_empty));
+    pthread_mutex_destroy(&(sink->mutex));
+    for (i = 0; i < STREAM_RING_SLOTS; i++)
+        EUCA_FREE(sink->slots[i]);
+    return (ret);
+}
+
+//!
+//! Copies received bytes into the ring, publishing slots as they fill up. Blocks
+//! while all slots are waiting to be written, which throttles the transfer to
+//! the speed of the destination without buffering more than the ring holds.
+//!
+//! @param[in] sink the sink started with stream_start()
+//! @param[in] buf received bytes
+//! @param[in] len number of received bytes
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the writer has failed
+//!
+static int stream_put(struct stream_sink *sink, const unsigned char *buf, size_t len)
+{
+    size_t n = 0;
+    size_t *fill = NULL;
+
+    while (len > 0) {
+        pthread_mutex_lock(&(sink->mutex));
+        {
+            // the head slot may only be filled while it is not also the tail of a full ring
+            while ((sink->published == STREAM_RING_SLOTS) && !sink->failed)
+                pthread_cond_wait(&(sink->not_full), &(sink->mutex));
+            if (sink->failed) {
+                pthread_mutex_unlock(&(sink->mutex));
+                return (EUCA_ERROR);
+            }
+        }
+        pthread_mutex_unlock(&(sink->mutex));
+
+        // the writer never touches the head slot, so it can be filled without the lock
+        fill = &(sink->lens[sink->head]);
+        n = MIN(len, (CHUNK - *fill));
+        memcpy(sink->slots[sink->head] + *fill, buf, n);
+        *fill += n;
+        buf += n;
+        len -= n;
+
+        if (*fill == CHUNK) {
+            pthread_mutex_lock(&(sink->mutex));
+            {
+                sink->head = (sink->head + 1) % STREAM_RING_SLOTS;
+                sink->published++;
+                pthread_cond_signal(&(sink->not_empty));
+            }
+            pthread_mutex_unlock(&(sink->mutex));
+        }
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Writer thread of a streaming request: digests, inflates and writes out the
+//! published slots in order, each at its final offset in the destination
+//!
+//! @param[in] arg the sink started with stream_start()
+//!
+//! @return Always NULL
+//!
+static void *stream_writer(void *arg)
+{
+    struct stream_sink *sink = ((struct stream_sink *)arg);
+    unsigned char *out = NULL;
+    unsigned char *slot = NULL;
+    size_t len = 0;
+    size_t have = 0;
+    boolean failed = FALSE;
+
+#if defined(CAN_GZIP)
+    if (sink->do_compress && ((out = EUCA_ALLOC(CHUNK, sizeof(unsigned char))) == NULL)) {
+        LOGERROR("out of memory (failed to allocate inflate buffer)\n");
+        failed = TRUE;
+    }
+#endif /* CAN_GZIP */
+
+    while (!failed) {
+        pthread_mutex_lock(&(sink->mutex));
+        {
+            while ((sink->published == 0) && !sink->eof)
+                pthread_cond_wait(&(sink->not_empty), &(sink->mutex));
+            if (sink->published == 0) {
+                pthread_mutex_unlock(&(sink->mutex));
+                break;                 // end of stream and nothing left to write
+            }
+            slot = sink->slots[sink->tail];
+            len = sink->lens[sink->tail];
+        }
+        pthread_mutex_unlock(&(sink->mutex));
+
+        // the slot stays published (and thus off limits to curl) until it is written out
+        if (!sink->do_compress) {
+            SHA1_Update(&(sink->sha), slot, len);
+            if (pwrite(sink->fd, slot, len, sink->base_offset + sink->offset) != len) {
+                LOGERROR("failed to write %ld byte(s) at offset %lld\n", len, sink->base_offset + sink->offset);
+                failed = TRUE;
+            } else {
+                sink->offset += len;
+            }
+        }
+#if defined(CAN_GZIP)
+        else {
+            sink->strm.avail_in = len;
+            sink->strm.next_in = slot;
+            do {
+                sink->strm.avail_out = CHUNK;
+                sink->strm.next_out = out;
+                switch ((sink->ret = inflate(&(sink->strm), Z_NO_FLUSH))) {
+                case Z_NEED_DICT:
+                    sink->ret = Z_DATA_ERROR;   // ok to fall through
+                case Z_DATA_ERROR:
+                case Z_MEM_ERROR:
+                case Z_STREAM_ERROR:
+                    zerr(sink->ret, "stream_writer");
+                    failed = TRUE;
+                    break;
+                }
+                if (failed)
+                    break;
+
+                have = CHUNK - sink->strm.avail_out;
+                SHA1_Update(&(sink->sha), out, have);
+                if (pwrite(sink->fd, out, have, sink->base_offset + sink->offset) != have) {
+                    LOGERROR("failed to write %ld byte(s) at offset %lld\n", have, sink->base_offset + sink->offset);
+                    failed = TRUE;
+                    break;
+                }
+                sink->offset += have;
+            } while ((sink->strm.avail_out == 0) && (sink->ret != Z_STREAM_END));
+        }
+#endif /* CAN_GZIP */
+
+        pthread_mutex_lock(&(sink->mutex));
+        {
+            sink->lens[sink->tail] = 0;
+            sink->tail = (sink->tail + 1) % STREAM_RING_SLOTS;
+            sink->published--;
+            if (failed)
+                sink->failed = TRUE;
+            pthread_cond_signal(&(sink->not_full));
+        }
+        pthread_mutex_unlock(&(sink->mutex));
+    }
+
+    if (failed) {
+        pthread_mutex_lock(&(sink->mutex));
+        {
+            sink->failed = TRUE;
+            pthread_cond_signal(&(sink->not_full));
+        }
+        pthread_mutex_unlock(&(sink->mutex));
+    }
+    EUCA_FREE(out);
+    return (NULL);
+}
+
+//!
+//! libcurl write handler for streaming requests, which only hands the bytes
+//! over to the writer thread so that the network is never waiting on the disk
+//!
+//! @param[in] buffer
+//! @param[in] size
+//! @param[in] nmemb
+//! @param[in] params
+//!
+//! @return the number of bytes consumed. If the returned value does not match
+//!         size*nmemb, then libcurl will return an error.
+//!
+static size_t write_data_stream(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    assert(params != NULL);
+    struct stream_sink *sink = ((struct stream_sink *)params);
+
+    if (stream_put(sink, buffer, size * nmemb) != EUCA_OK)
+        return (0);
+    sink->total_received += size * nmemb;
+    return (size * nmemb);
+}
+
+//!
+//! http_get_ranges() sink for streamed downloads, which arrive in order
+//!
+//! @param[in] arg the sink started with stream_start()
+//! @param[in] offset offset of the bytes in the object, unused as they arrive in order
+//! @param[in] buf the bytes
+//! @param[in] len number of bytes
+//!
+//! @return the result of stream_put()
+//!
+static int stream_range_sink(void *arg, long long offset, const unsigned char *buf, size_t len)
+{
+    struct stream_sink *sink = ((struct stream_sink *)arg);
+
+    if (stream_put(sink, buf, len) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+    sink->total_received += len;
+    return (EUCA_OK);
+}
+
 static int progress_function(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow)
 {
     struct progress_data_t *progress_data = (struct progress_data_t *)clientp;
@@ -808,3 +1233,138 @@ static int progress_function(void *clientp, double dltotal, double dlnow, double
     }
     return 0;
 }
+
+#ifdef _UNIT_TEST
+//!
+//! Feeds a buffer through a streaming sink in uneven pieces, the way curl
+//! would, and checks that it lands intact at the requested offset
+//!
+//! @param[in] path destination file
+//! @param[in] payload bytes handed to the sink
+//! @param[in] payload_len number of bytes in payload
+//! @param[in] do_compress whether the payload is gzip-compressed
+//! @param[in] offset where the content should land
+//! @param[out] digest receives the hex SHA-1 computed by the sink
+//!
+//! @return the result of stream_finish()
+//!
+static int stream_buffer(const char *path, const unsigned char *payload, size_t payload_len, int do_compress, long long offset, char *digest)
+{
+    int fd = -1;
+    int ret = EUCA_ERROR;
+    size_t n = 0;
+    size_t piece = 1;
+    struct stream_sink sink = { 0 };
+
+    if ((fd = open(path, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR)) < 0)
+        return (EUCA_ERROR);
+    if (stream_start(&sink, fd, offset, do_compress) == EUCA_OK) {
+        for (n = 0; n < payload_len; n += piece) {
+            piece = MIN(((n * 7919) % 40000) + 1, (payload_len - n));   // from 1 byte to more than a slot
+            if (write_data_stream((void *)(payload + n), 1, piece, &sink) != piece)
+                break;
+        }
+        ret = stream_finish(&sink, digest);
+    }
+    close(fd);
+    return (ret);
+}
+
+//!
+//! Checks the streaming sink with plain and gzip-compressed content
+//!
+//! @param[in] argc
+//! @param[in] argv
+//!
+//! @return 0 if all tests pass, 1 otherwise
+//!
+int main(int argc, char *argv[])
+{
+    int fd = -1;
+    int errors = 0;
+    char path[] = "/tmp/objectstorage-test-XXXXXX";
+    char digest[OBJECTSTORAGE_DIGEST_LEN] = "";
+    char expected[OBJECTSTORAGE_DIGEST_LEN] = "";
+    unsigned char md[SHA_DIGEST_LENGTH] = { 0 };
+    unsigned char *image = NULL;
+    unsigned char *readback = NULL;
+    size_t image_len = (CHUNK * STREAM_RING_SLOTS * 3) + 4321;  // cycles through the ring a few times
+    long long offset = 4096;
+
+#define CHECK(_cond)                                                      \
+{                                                                         \
+    if (!(_cond)) {                                                       \
+        printf("FAILED at line %d: %s\n", __LINE__, #_cond);             \
+        errors++;                                                         \
+    }                                                                     \
+}
+
+    logfile(NULL, EUCA_LOG_ERROR, 4);
+    image = EUCA_ALLOC(image_len, sizeof(unsigned char));
+    readback = EUCA_ALLOC(image_len, sizeof(unsigned char));
+    assert(image && readback);
+    srandom(1234);
+    for (size_t i = 0; i < image_len; i++)
+        image[i] = (i % 3) ? (random() & 0xff) : 0;
+    SHA1(image, image_len, md);
+    for (int i = 0; i < SHA_DIGEST_LENGTH; i++)
+        snprintf(expected + (i * 2), 3, "%02x", md[i]);
+
+    assert((fd = safe_mkstemp(path)) >= 0);
+    close(fd);
+
+    printf("plain content is written in place and digested\n");
+    CHECK(stream_buffer(path, image, image_len, FALSE, offset, digest) == EUCA_OK);
+    CHECK(!strcmp(digest, expected));
+    fd = open(path, O_RDONLY);
+    CHECK(pread(fd, readback, image_len, offset) == image_len);
+    CHECK(!memcmp(image, readback, image_len));
+    close(fd);
+
+#if defined(CAN_GZIP)
+    {
+        z_stream strm = { 0 };
+        uLong gz_len = 0;
+        unsigned char *gz = NULL;
+
+        assert(deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+        gz_len = deflateBound(&strm, image_len) + 32;
+        assert((gz = EUCA_ALLOC(gz_len, sizeof(unsigned char))) != NULL);
+        strm.next_in = image;
+        strm.avail_in = image_len;
+        strm.next_out = gz;
+        strm.avail_out = gz_len;
+        assert(deflate(&strm, Z_FINISH) == Z_STREAM_END);
+        gz_len = strm.total_out;
+        deflateEnd(&strm);
+
+        printf("gzip content is inflated in place and digested\n");
+        truncate(path, 0);
+        digest[0] = '\0';
+        CHECK(stream_buffer(path, gz, gz_len, TRUE, offset, digest) == EUCA_OK);
+        CHECK(!strcmp(digest, expected));
+        fd = open(path, O_RDONLY);
+        CHECK(pread(fd, readback, image_len, offset) == image_len);
+        CHECK(!memcmp(image, readback, image_len));
+        close(fd);
+
+        printf("truncated gzip content is an error\n");
+        CHECK(stream_buffer(path, gz, (gz_len / 2), TRUE, offset, digest) == EUCA_ERROR);
+
+        printf("corrupt gzip content stops the transfer\n");
+        gz[gz_len / 3] ^= 0xff;
+        gz[(gz_len / 3) + 1] ^= 0xff;
+        CHECK(stream_buffer(path, gz, gz_len, TRUE, offset, digest) == EUCA_ERROR);
+        EUCA_FREE(gz);
+    }
+#endif /* CAN_GZIP */
+
+#undef CHECK
+
+    unlink(path);
+    EUCA_FREE(image);
+    EUCA_FREE(readback);
+    printf("%s\n", (errors == 0) ? "all tests passed" : "some tests FAILED");
+    return ((errors == 0) ? 0 : 1);
+}
+#endif /* _UNIT_TEST */
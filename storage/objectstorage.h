@@ -83,6 +83,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define OBJECTSTORAGE_DIGEST_LEN                     41 //!< size of a hex SHA-1 digest string, including the terminator
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -117,6 +119,7 @@ int objectstorage_set_max_download_attempts(unsigned short max_attempts);
 int objectstorage_object_by_url(const char *url, const char *outfile, const int do_compress);
 int objectstorage_object_by_path(const char *path, const char *outfile, const int do_compress);
 int objectstorage_image_by_manifest_url(const char *url, const char *outfile, const int do_compress);
+int objectstorage_image_by_manifest_url_stream(const char *url, const char *outfile, const long long offset, const int do_compress, char *digest);
 int objectstorage_image_by_manifest_path(const char *manifest_path, const char *outfile, const int do_compress);
 char *objectstorage_get_digest(const char *url);
 int objectstorage_verify_digest(const char *url, const char *old_digest_path);
@@ -0,0 +1,1017 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file storage/peer.c
+//! Implements the image peer service of the NC: a small HTTP server that hands
+//! out the blobs of the cache blobstore to other NCs, and the matching client.
+//!
+//! A peer asks for a blob by its ID, which is the artifact ID that every NC
+//! derives from the image ID and its digest, so the same image has the same
+//! ID on every node. The server only holds the blob's lock long enough to open
+//! its content, so serving peers never keeps local launches from the cache;
+//! cached blobs are not modified once created, and a blob that is purged
+//! while it is being served remains readable through the open descriptor.
+//! A request for a blob that is still being created waits for its creator to
+//! finish, which lets a node that was just handed an image by the CC serve it
+//! to the next nodes as soon as it has it. The content is sent with sendfile()
+//! and ranges are supported, so the client fetches over several connections,
+//! with per-chunk resume, through http_get_ranges(). Once it has all the bytes,
+//! the client asks the server for the SHA-1 of the blob and only accepts the
+//! copy if its own SHA-1 matches, so a copy that is short, stale or damaged on
+//! the way is refused and the caller downloads the image from its source. The
+//! server remembers the SHA-1 of the last few blobs it digested, so a fetch by
+//! one node after another reads the blob only once more for its digest.
+//!
+//! The server listens only on the address the other nodes of the cluster know
+//! this one by and only answers the nodes named with peer_server_set_peers(),
+//! which the NC learns from the global network information of its cluster.
+//! Every node of a cluster can decrypt the same images, so handing a blob to
+//! another node gives it nothing that it could not download itself.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE                    // strcasestr
+#define _FILE_OFFSET_BITS 64            // so large-file support works on 32-bit systems
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <openssl/sha.h>
+
+#include <eucalyptus.h>
+#include <misc.h>
+#include <euca_file.h>
+#include <euca_string.h>
+
+#include "blobstore.h"
+#include "http.h"
+#include "peer.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define PEER_REQUEST_SIZE                        4096   //!< longest request accepted, headers included
+#define PEER_IO_TIMEOUT_SEC                        60   //!< socket send and receive timeout of the server
+#define PEER_DIGEST_LEN          ((SHA_DIGEST_LENGTH * 2) + 1)  //!< size of a hex SHA-1 string, terminator included
+#define PEER_DIGESTS                               32   //!< number of blob digests the server remembers
+#define PEER_DIGEST_BUF_BYTES             (1024 * 1024) //!< size of the reads that digest a blob
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A digest the server computed, valid as long as the blob's content file is unchanged
+typedef struct peer_digest_t {
+    char id[BLOBSTORE_MAX_PATH];       //!< ID of the blob, empty if the entry is unused
+    dev_t dev;                         //!< device of the blob's content file
+    ino_t ino;                         //!< inode of the blob's content file
+    time_t mtime;                      //!< modification time of the blob's content file
+    long long size_bytes;              //!< size of the blob
+    char digest[PEER_DIGEST_LEN];      //!< hex SHA-1 of the blob's content
+} peer_digest;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static blobstore *peer_bs = NULL;      //!< the blobstore being served
+static int peer_listen_fd = -1;        //!< listening socket of the server, -1 when stopped
+static pthread_t peer_listener;        //!< thread accepting connections
+static int peer_connections = 0;       //!< requests being served
+static in_addr_t *peer_allowed = NULL;  //!< addresses of the nodes that may fetch blobs
+static int peer_allowed_count = 0;     //!< number of addresses in peer_allowed
+static peer_digest peer_digests[PEER_DIGESTS] = { {{0}} };  //!< digests computed by the server
+static int peer_digests_next = 0;      //!< entry of peer_digests that is replaced next
+static pthread_mutex_t peer_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards peer_connections, peer_allowed and peer_digests
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void *peer_listen(void *arg);
+static void *peer_serve(void *arg);
+static int peer_respond(int fd, int status, const char *reason, const char *extra);
+static boolean peer_valid_id(const char *id);
+static boolean peer_allowed_addr(in_addr_t addr);
+static int peer_blob_digest(const char *id, int fd, long long size_bytes, char *digest);
+static int peer_digest_fd(int fd, long long size_bytes, char *digest);
+static int peer_verify(const char *peer, int port, const char *id, const char *outfile, long long size_bytes, boolean * bail_flag);
+static int peer_file_sink(void *arg, long long offset, const unsigned char *buf, size_t len);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Starts serving the blobs of a blobstore to peers on the given address and
+//! TCP port. No peer is served until peer_server_set_peers() names some.
+//!
+//! @param[in] bs the blobstore to serve, which must stay open until peer_server_stop()
+//! @param[in] ip IPv4 address to listen on, the one the other nodes know this one by
+//! @param[in] port TCP port to listen on
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR on bad parameters or if the
+//!         server is already running, EUCA_ERROR if the port cannot be
+//!         listened on and EUCA_THREAD_ERROR if the listener cannot start
+//!
+int peer_server_start(blobstore * bs, const char *ip, int port)
+{
+    int fd = -1;
+    int one = 1;
+    struct sockaddr_in addr = { 0 };
+
+    if ((bs == NULL) || (ip == NULL) || (inet_pton(AF_INET, ip, &(addr.sin_addr)) != 1) || (port <= 0) || (port > 65535) || (peer_listen_fd != -1)) {
+        LOGERROR("invalid params: bs=%p ip=%s port=%d (running=%d)\n", bs, SP(ip), port, (peer_listen_fd != -1));
+        return (EUCA_INVALID_ERROR);
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) || (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1)
+        || (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) || (listen(fd, PEER_MAX_CONNECTIONS) == -1)) {
+        LOGERROR("failed to listen for image peers on %s:%d: %s\n", ip, port, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return (EUCA_ERROR);
+    }
+
+    peer_bs = bs;
+    peer_listen_fd = fd;
+    if (pthread_create(&peer_listener, NULL, peer_listen, NULL) != 0) {
+        LOGERROR("failed to start the image peer listener\n");
+        close(fd);
+        peer_listen_fd = -1;
+        peer_bs = NULL;
+        return (EUCA_THREAD_ERROR);
+    }
+    LOGINFO("serving cached images to peers on %s:%d\n", ip, port);
+    return (EUCA_OK);
+}
+
+//!
+//! Sets the nodes whose requests the server answers, replacing the previous
+//! ones; requests from any other address are refused
+//!
+//! @param[in] ips IPv4 addresses of the nodes, may be NULL if count is 0
+//! @param[in] count number of addresses
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR if an address is not a valid
+//!         IPv4 address (the others are still set) or EUCA_MEMORY_ERROR
+//!
+int peer_server_set_peers(char **ips, int count)
+{
+    int i = 0;
+    int n = 0;
+    int ret = EUCA_OK;
+    in_addr_t *allowed = NULL;
+    struct in_addr addr = { 0 };
+
+    if ((count > 0) && ((ips == NULL) || ((allowed = EUCA_ZALLOC(count, sizeof(in_addr_t))) == NULL)))
+        return ((ips == NULL) ? (EUCA_INVALID_ERROR) : (EUCA_MEMORY_ERROR));
+
+    for (i = 0; i < count; i++) {
+        if ((ips[i] == NULL) || (inet_pton(AF_INET, ips[i], &addr) != 1)) {
+            LOGWARN("not serving cached images to peer '%s', which is not an IPv4 address\n", SP(ips[i]));
+            ret = EUCA_INVALID_ERROR;
+            continue;
+        }
+        allowed[n++] = addr.s_addr;
+    }
+
+    pthread_mutex_lock(&peer_mutex);
+    {
+        EUCA_FREE(peer_allowed);
+        peer_allowed = allowed;
+        peer_allowed_count = n;
+    }
+    pthread_mutex_unlock(&peer_mutex);
+    return (ret);
+}
+
+//!
+//! Stops accepting peer requests. Requests already accepted run to completion.
+//!
+void peer_server_stop(void)
+{
+    int fd = peer_listen_fd;
+
+    if (fd == -1)
+        return;
+    shutdown(fd, SHUT_RDWR);           // wakes up the listener
+    pthread_join(peer_listener, NULL);
+    close(fd);
+    peer_listen_fd = -1;
+    LOGINFO("stopped serving cached images to peers\n");
+}
+
+//!
+//! Fetches a cached blob from a peer into a file, in ranges over the number of
+//! connections set with http_set_parallel()
+//!
+//! @param[in] peer host name or address of the peer
+//! @param[in] port the peer's image port
+//! @param[in] id ID of the blob
+//! @param[in] outfile existing file to write, which is not truncated (e.g., a blob's blocks)
+//! @param[in] size_bytes expected size of the blob
+//! @param[in] bail_flag if it becomes TRUE, the fetch is abandoned, may be NULL
+//!
+//! @return EUCA_OK on success, EUCA_NOT_FOUND_ERROR if the peer does not have
+//!         the blob (or has one of another size), EUCA_ACCESS_ERROR if outfile
+//!         cannot be opened, the error of http_get_ranges() or the error of
+//!         peer_verify() if the fetched content cannot be shown to be the blob's
+//!
+int peer_get(const char *peer, int port, const char *id, const char *outfile, long long size_bytes, boolean * bail_flag)
+{
+    int rc = EUCA_ERROR;
+    int connections = 1;
+    int fd = -1;
+    long long remote_bytes = 0;
+    long long chunk_bytes = 0;
+    char url[EUCA_MAX_PATH] = "";
+
+    if (!peer || !id || !outfile || (port <= 0) || (size_bytes <= 0)) {
+        LOGERROR("invalid params: peer=%s port=%d id=%s outfile=%s size=%lld\n", SP(peer), port, SP(id), SP(outfile), size_bytes);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    snprintf(url, sizeof(url), "http://%s:%d" PEER_URL_PREFIX "%s", peer, port, id);
+    if (http_range_probe(url, NULL, PEER_CONNECT_TIMEOUT, &remote_bytes) != EUCA_OK) {
+        LOGDEBUG("peer %s cannot serve %s\n", peer, id);
+        return (EUCA_NOT_FOUND_ERROR);
+    }
+    if (remote_bytes != size_bytes) {
+        LOGWARN("peer %s has %lld byte(s) of %s rather than %lld\n", peer, remote_bytes, id, size_bytes);
+        return (EUCA_NOT_FOUND_ERROR);
+    }
+
+    if ((fd = open(outfile, O_WRONLY)) == -1) {
+        LOGERROR("failed to open %s for writing\n", outfile);
+        return (EUCA_ACCESS_ERROR);
+    }
+    connections = http_get_parallelism(&chunk_bytes);
+    LOGINFO("fetching %s from peer %s\n", id, peer);
+    rc = http_get_ranges(url, NULL, size_bytes, connections, chunk_bytes, FALSE, peer_file_sink, &fd, PEER_RETRIES, 1, PEER_CONNECT_TIMEOUT, bail_flag);
+    close(fd);
+    if ((rc == EUCA_OK) && ((rc = peer_verify(peer, port, id, outfile, size_bytes, bail_flag)) == EUCA_OK)) {
+        LOGINFO("fetched %s from peer %s\n", id, peer);
+    }
+    return (rc);
+}
+
+//!
+//! Accepts peer connections until the listening socket is shut down, a thread
+//! per request up to PEER_MAX_CONNECTIONS
+//!
+//! @param[in] arg unused
+//!
+//! @return NULL
+//!
+static void *peer_listen(void *arg)
+{
+    int fd = -1;
+    boolean admit = FALSE;
+    boolean allowed = FALSE;
+    pthread_t tid;
+    pthread_attr_t attr;
+    socklen_t addr_len = 0;
+    struct sockaddr_in addr = { 0 };
+    char addr_str[INET_ADDRSTRLEN] = "";
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        addr_len = sizeof(addr);
+        if ((fd = accept(peer_listen_fd, (struct sockaddr *)&addr, &addr_len)) == -1) {
+            if ((errno == EINTR) || (errno == ECONNABORTED))
+                continue;
+            break;                     // shut down (or broken beyond repair)
+        }
+
+        pthread_mutex_lock(&peer_mutex);
+        if ((allowed = peer_allowed_addr(addr.sin_addr.s_addr)) && (admit = (peer_connections < PEER_MAX_CONNECTIONS)))
+            peer_connections++;
+        pthread_mutex_unlock(&peer_mutex);
+
+        if (!allowed) {
+            LOGWARN("refusing cached images to %s, which is not a node of this cluster\n", inet_ntop(AF_INET, &(addr.sin_addr), addr_str, sizeof(addr_str)));
+            peer_respond(fd, 403, "Forbidden", NULL);
+            close(fd);
+        } else if (!admit) {
+            peer_respond(fd, 503, "Service Unavailable", NULL);
+            close(fd);
+        } else if (pthread_create(&tid, &attr, peer_serve, (void *)((long)fd)) != 0) {
+            peer_respond(fd, 500, "Internal Server Error", NULL);
+            close(fd);
+            pthread_mutex_lock(&peer_mutex);
+            peer_connections--;
+            pthread_mutex_unlock(&peer_mutex);
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return (NULL);
+}
+
+//!
+//! Serves one GET or HEAD request for a blob, whole or a range of it
+//!
+//! @param[in] arg the connected socket
+//!
+//! @return NULL
+//!
+static void *peer_serve(void *arg)
+{
+    int fd = (int)((long)arg);
+    int blob_fd = -1;
+    char req[PEER_REQUEST_SIZE] = "";
+    char method[8] = "";
+    char path[EUCA_MAX_PATH] = "";
+    char extra[256] = "";
+    char digest[PEER_DIGEST_LEN] = "";
+    char *range = NULL;
+    const char *id = NULL;
+    const char *blob_path = NULL;
+    size_t got = 0;
+    ssize_t n = 0;
+    off_t offset = 0;
+    long long first = 0;
+    long long last = -1;
+    long long size_bytes = 0;
+    long long len = 0;
+    boolean ranged = FALSE;
+    boolean digested = FALSE;
+    blockblob *bb = NULL;
+    struct timeval tv = { PEER_IO_TIMEOUT_SEC, 0 };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    while ((got < (sizeof(req) - 1)) && ((n = recv(fd, req + got, sizeof(req) - 1 - got, 0)) > 0)) {
+        got += n;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n"))
+            break;
+    }
+
+    if ((sscanf(req, "%7s %4095s HTTP/", method, path) != 2) || (strcmp(method, "GET") && strcmp(method, "HEAD"))) {
+        peer_respond(fd, 400, "Bad Request", NULL);
+        goto done;
+    }
+    if (!strncmp(path, PEER_DIGEST_PREFIX, strlen(PEER_DIGEST_PREFIX))) {
+        id = path + strlen(PEER_DIGEST_PREFIX);
+        digested = TRUE;
+    } else {
+        id = path + strlen(PEER_URL_PREFIX);
+    }
+    if ((!digested && strncmp(path, PEER_URL_PREFIX, strlen(PEER_URL_PREFIX))) || !peer_valid_id(id)) {
+        peer_respond(fd, 404, "Not Found", NULL);
+        goto done;
+    }
+    if ((range = strcasestr(req, "\r\nRange: bytes=")) != NULL) {
+        if (sscanf(range + 15, "%lld-%lld", &first, &last) < 1) {
+            peer_respond(fd, 400, "Bad Request", NULL);
+            goto done;
+        }
+        ranged = TRUE;
+    }
+
+    // hold the blob only as long as it takes to open its content
+    if ((bb = blockblob_open(peer_bs, id, 0, 0, NULL, PEER_WAIT_USEC)) == NULL) {
+        if (blobstore_get_error() == BLOBSTORE_ERROR_NOENT) {
+            peer_respond(fd, 404, "Not Found", NULL);
+        } else {
+            LOGDEBUG("could not open %s for a peer: %s\n", id, blobstore_get_error_str(blobstore_get_error()));
+            peer_respond(fd, 503, "Service Unavailable", NULL);
+        }
+        goto done;
+    }
+    if ((blob_path = blockblob_get_file(bb)) == NULL)
+        blob_path = blockblob_get_dev(bb);    // content is on a device, e.g., for deduplicated blobs
+    size_bytes = blockblob_get_size_bytes(bb);
+    if ((blob_path != NULL) && (blob_path[0] != '\0'))
+        blob_fd = open(blob_path, O_RDONLY);
+    blockblob_close(bb);
+    if (blob_fd == -1) {
+        LOGERROR("failed to open %s for a peer\n", id);
+        peer_respond(fd, 500, "Internal Server Error", NULL);
+        goto done;
+    }
+
+    if (digested) {
+        if (peer_blob_digest(id, blob_fd, size_bytes, digest) != EUCA_OK) {
+            peer_respond(fd, 500, "Internal Server Error", NULL);
+            goto done;
+        }
+        snprintf(extra, sizeof(extra), "Content-Length: %d\r\n", (int)strlen(digest));
+        if ((peer_respond(fd, 200, "OK", extra) == EUCA_OK) && !strcmp(method, "GET"))
+            send(fd, digest, strlen(digest), MSG_NOSIGNAL);
+        goto done;
+    }
+
+    if (ranged) {
+        if ((last < 0) || (last >= size_bytes))
+            last = size_bytes - 1;
+        if ((first < 0) || (first > last)) {
+            snprintf(extra, sizeof(extra), "Content-Range: bytes */%lld\r\n", size_bytes);
+            peer_respond(fd, 416, "Requested Range Not Satisfiable", extra);
+            goto done;
+        }
+        len = last - first + 1;
+        snprintf(extra, sizeof(extra), "Content-Range: bytes %lld-%lld/%lld\r\nContent-Length: %lld\r\n", first, last, size_bytes, len);
+        n = peer_respond(fd, 206, "Partial Content", extra);
+    } else {
+        len = size_bytes;
+        snprintf(extra, sizeof(extra), "Content-Length: %lld\r\n", len);
+        n = peer_respond(fd, 200, "OK", extra);
+    }
+
+    if ((n == EUCA_OK) && !strcmp(method, "GET")) {
+        for (offset = first; len > 0; len -= n) {
+            if ((n = sendfile(fd, blob_fd, &offset, ((len > (1LL << 30)) ? (1LL << 30) : (len)))) <= 0) {
+                if ((n == -1) && (errno == EINTR)) {
+                    n = 0;
+                    continue;
+                }
+                LOGDEBUG("peer went away while being sent %s\n", id);
+                break;
+            }
+        }
+    }
+
+done:
+    if (blob_fd != -1)
+        close(blob_fd);
+    close(fd);
+    pthread_mutex_lock(&peer_mutex);
+    peer_connections--;
+    pthread_mutex_unlock(&peer_mutex);
+    return (NULL);
+}
+
+//!
+//! Sends the status line and headers of a response
+//!
+//! @param[in] fd the connected socket
+//! @param[in] status the HTTP status code
+//! @param[in] reason the reason phrase
+//! @param[in] extra more header lines, each ending with CRLF, may be NULL
+//!
+//! @return EUCA_OK if the headers went out, EUCA_IO_ERROR otherwise
+//!
+static int peer_respond(int fd, int status, const char *reason, const char *extra)
+{
+    int len = 0;
+    char hdr[512] = "";
+
+    len = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %d %s\r\nAccept-Ranges: bytes\r\n%s%sConnection: close\r\n\r\n", status, reason, ((extra) ? (extra) : ("")),
+                   ((status >= 300) && ((extra == NULL) || !strstr(extra, "Content-Length"))) ? ("Content-Length: 0\r\n") : (""));
+    if ((len >= sizeof(hdr)) || (send(fd, hdr, len, MSG_NOSIGNAL) != len))
+        return (EUCA_IO_ERROR);
+    return (EUCA_OK);
+}
+
+//!
+//! Checks that a requested ID is a plain blob ID and cannot reach outside the blobstore
+//!
+//! @param[in] id the requested ID
+//!
+//! @return TRUE if the ID is safe to look up
+//!
+static boolean peer_valid_id(const char *id)
+{
+    const char *c = NULL;
+
+    if ((id[0] == '\0') || (id[0] == '.') || (strlen(id) >= BLOBSTORE_MAX_PATH))
+        return (FALSE);
+    for (c = id; *c != '\0'; c++) {
+        if (!isalnum(*c) && (*c != '-') && (*c != '_') && (*c != '.'))
+            return (FALSE);
+    }
+    return (TRUE);
+}
+
+//!
+//! Checks whether a connection comes from one of the nodes set with peer_server_set_peers()
+//!
+//! @param[in] addr source address of the connection, in network byte order
+//!
+//! @return TRUE if the node may fetch blobs
+//!
+//! @pre peer_mutex is held
+//!
+static boolean peer_allowed_addr(in_addr_t addr)
+{
+    int i = 0;
+
+    for (i = 0; i < peer_allowed_count; i++) {
+        if (peer_allowed[i] == addr)
+            return (TRUE);
+    }
+    return (FALSE);
+}
+
+//!
+//! Looks up, or computes and remembers, the digest of a blob being served
+//!
+//! @param[in] id ID of the blob
+//! @param[in] fd open descriptor of the blob's content
+//! @param[in] size_bytes size of the blob
+//! @param[out] digest buffer of PEER_DIGEST_LEN bytes for the hex SHA-1
+//!
+//! @return EUCA_OK on success or the error of peer_digest_fd()
+//!
+static int peer_blob_digest(const char *id, int fd, long long size_bytes, char *digest)
+{
+    int i = 0;
+    int rc = EUCA_OK;
+    peer_digest *pd = NULL;
+    struct stat st = { 0 };
+
+    if (fstat(fd, &st) == -1)
+        return (EUCA_IO_ERROR);
+
+    pthread_mutex_lock(&peer_mutex);
+    for (i = 0; i < PEER_DIGESTS; i++) {
+        pd = &(peer_digests[i]);
+        if (!strcmp(pd->id, id) && (pd->dev == st.st_dev) && (pd->ino == st.st_ino) && (pd->mtime == st.st_mtime) && (pd->size_bytes == size_bytes)) {
+            euca_strncpy(digest, pd->digest, PEER_DIGEST_LEN);
+            pthread_mutex_unlock(&peer_mutex);
+            return (EUCA_OK);
+        }
+    }
+    pthread_mutex_unlock(&peer_mutex);
+
+    // two peers asking at once both read the blob, which is rare enough not to wait on one another
+    if ((rc = peer_digest_fd(fd, size_bytes, digest)) != EUCA_OK) {
+        LOGERROR("failed to digest %s for a peer\n", id);
+        return (rc);
+    }
+
+    pthread_mutex_lock(&peer_mutex);
+    {
+        pd = &(peer_digests[peer_digests_next]);
+        peer_digests_next = (peer_digests_next + 1) % PEER_DIGESTS;
+        euca_strncpy(pd->id, id, sizeof(pd->id));
+        pd->dev = st.st_dev;
+        pd->ino = st.st_ino;
+        pd->mtime = st.st_mtime;
+        pd->size_bytes = size_bytes;
+        euca_strncpy(pd->digest, digest, sizeof(pd->digest));
+    }
+    pthread_mutex_unlock(&peer_mutex);
+    return (EUCA_OK);
+}
+
+//!
+//! Computes the SHA-1 of the first bytes of a file
+//!
+//! @param[in] fd open descriptor of the file
+//! @param[in] size_bytes how many bytes to digest
+//! @param[out] digest buffer of PEER_DIGEST_LEN bytes for the hex SHA-1
+//!
+//! @return EUCA_OK on success, EUCA_MEMORY_ERROR or EUCA_IO_ERROR if the file
+//!         cannot be read or is shorter than size_bytes
+//!
+static int peer_digest_fd(int fd, long long size_bytes, char *digest)
+{
+    int i = 0;
+    ssize_t n = 0;
+    off_t offset = 0;
+    unsigned char *buf = NULL;
+    unsigned char md[SHA_DIGEST_LENGTH] = { 0 };
+    SHA_CTX sha;
+
+    if ((buf = EUCA_ALLOC(PEER_DIGEST_BUF_BYTES, sizeof(unsigned char))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    SHA1_Init(&sha);
+    for (offset = 0; offset < size_bytes; offset += n) {
+        if ((n = pread(fd, buf, (((size_bytes - offset) > PEER_DIGEST_BUF_BYTES) ? (PEER_DIGEST_BUF_BYTES) : (size_bytes - offset)), offset)) <= 0) {
+            if ((n == -1) && (errno == EINTR)) {
+                n = 0;
+                continue;
+            }
+            EUCA_FREE(buf);
+            return (EUCA_IO_ERROR);
+        }
+        SHA1_Update(&sha, buf, n);
+    }
+    SHA1_Final(md, &sha);
+    EUCA_FREE(buf);
+
+    for (i = 0; i < SHA_DIGEST_LENGTH; i++)
+        snprintf(digest + (i * 2), 3, "%02x", md[i]);
+    return (EUCA_OK);
+}
+
+//!
+//! Checks a blob fetched from a peer against the peer's digest of it
+//!
+//! @param[in] peer host name or address of the peer
+//! @param[in] port the peer's image port
+//! @param[in] id ID of the blob
+//! @param[in] outfile the file the blob was fetched into
+//! @param[in] size_bytes size of the blob
+//! @param[in] bail_flag if it becomes TRUE, the check is abandoned, may be NULL
+//!
+//! @return EUCA_OK if the content matches, EUCA_NOT_FOUND_ERROR if the peer
+//!         does not supply a digest, EUCA_IO_ERROR if outfile cannot be read
+//!         or EUCA_ERROR if the content does not match
+//!
+static int peer_verify(const char *peer, int port, const char *id, const char *outfile, long long size_bytes, boolean * bail_flag)
+{
+    int fd = -1;
+    int rc = EUCA_ERROR;
+    char *remote = NULL;
+    char url[EUCA_MAX_PATH] = "";
+    char reply_path[] = "/tmp/peer-digest-XXXXXX";
+    char local[PEER_DIGEST_LEN] = "";
+
+    if ((fd = safe_mkstemp(reply_path)) == -1) {
+        LOGERROR("failed to create a digest file %s\n", reply_path);
+        return (EUCA_IO_ERROR);
+    }
+    close(fd);
+
+    // the peer may take a while to digest a blob it has not digested before
+    snprintf(url, sizeof(url), "http://%s:%d" PEER_DIGEST_PREFIX "%s", peer, port, id);
+    if (http_get_timeout(url, reply_path, PEER_RETRIES, 1, PEER_CONNECT_TIMEOUT, 0, bail_flag) == EUCA_OK)
+        remote = file2strn(reply_path, PEER_DIGEST_LEN);
+    unlink(reply_path);
+    if ((remote == NULL) || (strlen(remote) != (PEER_DIGEST_LEN - 1))) {
+        LOGWARN("peer %s did not supply a digest of %s\n", peer, id);
+        EUCA_FREE(remote);
+        return (EUCA_NOT_FOUND_ERROR);
+    }
+
+    if ((fd = open(outfile, O_RDONLY)) == -1) {
+        rc = EUCA_IO_ERROR;
+    } else {
+        rc = peer_digest_fd(fd, size_bytes, local);
+        close(fd);
+    }
+    if (rc != EUCA_OK) {
+        LOGERROR("failed to digest %s fetched into %s\n", id, outfile);
+    } else if (strcasecmp(local, remote)) {
+        LOGWARN("copy of %s from peer %s does not match its digest (%s rather than %s)\n", id, peer, local, remote);
+        rc = EUCA_ERROR;
+    }
+    EUCA_FREE(remote);
+    return (rc);
+}
+
+//!
+//! http_get_ranges() sink of peer_get(), writes the bytes in place
+//!
+//! @param[in] arg points at the destination descriptor
+//! @param[in] offset where the bytes go
+//! @param[in] buf the bytes
+//! @param[in] len number of bytes
+//!
+//! @return EUCA_OK or EUCA_IO_ERROR
+//!
+static int peer_file_sink(void *arg, long long offset, const unsigned char *buf, size_t len)
+{
+    int fd = *((int *)arg);
+    ssize_t wrote = 0;
+
+    while (len > 0) {
+        if ((wrote = pwrite(fd, buf, len, offset)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (EUCA_IO_ERROR);
+        }
+        buf += wrote;
+        offset += wrote;
+        len -= wrote;
+    }
+    return (EUCA_OK);
+}
+
+#ifdef _UNIT_TEST
+#include <curl/curl.h>
+
+#define TEST_BLOB_BYTES                   ((5 * 1024 * 1024) + 512)     //!< size of the blob served by the test, a multiple of the block size
+#define TEST_CHUNK_BYTES                          (512 * 1024)  //!< chunk size of the test fetches
+#define TEST_HOLD_SEC                                      2    //!< how long the test keeps the blob locked
+
+static volatile boolean test_held = FALSE;  //!< set while test_hold() has the blob locked
+
+//!
+//! Fills a buffer with bytes that are not the same in every chunk
+//!
+//! @param[in] buf the buffer
+//! @param[in] len its size
+//!
+static void test_fill(unsigned char *buf, size_t len)
+{
+    size_t i = 0;
+
+    for (i = 0; i < len; i++)
+        buf[i] = (unsigned char)((i * 2654435761U) >> 11);
+}
+
+//!
+//! Checks that a file holds the test blob's content
+//!
+//! @param[in] path the file
+//!
+//! @return TRUE if it does
+//!
+static boolean test_file_matches(const char *path)
+{
+    int fd = -1;
+    boolean matches = FALSE;
+    unsigned char *want = NULL;
+    unsigned char *got = NULL;
+
+    want = EUCA_ALLOC(TEST_BLOB_BYTES, sizeof(unsigned char));
+    got = EUCA_ZALLOC(TEST_BLOB_BYTES, sizeof(unsigned char));
+    test_fill(want, TEST_BLOB_BYTES);
+    if ((fd = open(path, O_RDONLY)) != -1) {
+        matches = ((read(fd, got, TEST_BLOB_BYTES) == TEST_BLOB_BYTES) && !memcmp(want, got, TEST_BLOB_BYTES));
+        close(fd);
+    }
+    EUCA_FREE(want);
+    EUCA_FREE(got);
+    return (matches);
+}
+
+//!
+//! Holds a blob locked for TEST_HOLD_SEC, as a local creator would, from its
+//! own thread since blobstore locks are released by the thread that took them
+//!
+//! @param[in] arg the blobstore
+//!
+//! @return NULL
+//!
+static void *test_hold(void *arg)
+{
+    blockblob *bb = NULL;
+
+    if ((bb = blockblob_open((blobstore *) arg, "emi-0123abcd-4567ef89", 0, 0, NULL, 0)) != NULL) {
+        test_held = TRUE;
+        sleep(TEST_HOLD_SEC);
+        blockblob_close(bb);
+    }
+    test_held = FALSE;
+    return (NULL);
+}
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return 0 if all tests pass, 1 otherwise
+//!
+int main(int argc, char **argv)
+{
+#define CHECK(_cond)                                                      \
+{                                                                         \
+    if (!(_cond)) {                                                       \
+        printf("FAILED at line %d: %s\n", __LINE__, #_cond);             \
+        errors++;                                                         \
+    }                                                                     \
+}
+
+    int fd = -1;
+    int port = 0;
+    int errors = 0;
+    time_t started = 0;
+    char store[] = "/tmp/test_peer_XXXXXX";
+    char path[] = "/tmp/test_peer_out_XXXXXX";
+    char cmd[EUCA_MAX_PATH] = "";
+    unsigned char *content = NULL;
+    blobstore *bs = NULL;
+    blockblob *bb = NULL;
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+    struct sockaddr_in addr = { 0 };
+    pthread_t tid = { 0 };
+    char *test_peers[] = { "node-1", "10.0.0.1", "127.0.0.1" };
+    struct stat st = { 0 };
+    struct timespec times[2] = { {0} };
+
+    curl_global_init(CURL_GLOBAL_SSL);
+    logfile(NULL, EUCA_LOG_WARN, 4);
+
+    // a blobstore with one blob of known content
+    if ((mkdtemp(store) == NULL) || (safe_mkstemp(path) < 0)) {
+        printf("failed to create temporary files\n");
+        return (1);
+    }
+    if (((bs = blobstore_open(store, 2 * (TEST_BLOB_BYTES / 512), BLOBSTORE_FLAG_CREAT, BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_NONE, BLOBSTORE_SNAPSHOT_NONE)) == NULL)
+        || ((bb = blockblob_open(bs, "emi-0123abcd-4567ef89", TEST_BLOB_BYTES, BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL, NULL, 0)) == NULL)) {
+        printf("failed to create the test blob: %s\n", blobstore_get_error_str(blobstore_get_error()));
+        return (1);
+    }
+    content = EUCA_ALLOC(TEST_BLOB_BYTES, sizeof(unsigned char));
+    test_fill(content, TEST_BLOB_BYTES);
+    if (((fd = open(blockblob_get_file(bb), O_WRONLY)) == -1) || (write(fd, content, TEST_BLOB_BYTES) != TEST_BLOB_BYTES)) {
+        printf("failed to write the test blob\n");
+        return (1);
+    }
+    close(fd);
+    EUCA_FREE(content);
+    blockblob_close(bb);
+
+    // a port that was free a moment ago
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) || bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+        || getsockname(fd, (struct sockaddr *)&addr, &addr_len)) {
+        printf("failed to find a free port\n");
+        return (1);
+    }
+    port = ntohs(addr.sin_port);
+    close(fd);
+
+    printf("the server starts once\n");
+    CHECK(peer_server_start(bs, "127.0.0.1", port) == EUCA_OK);
+    CHECK(peer_server_start(bs, "127.0.0.1", port) == EUCA_INVALID_ERROR);
+    http_set_parallel(4, TEST_CHUNK_BYTES);
+
+    printf("nodes that are not peers are refused\n");
+    CHECK(peer_get("127.0.0.1", port, "emi-0123abcd-4567ef89", path, TEST_BLOB_BYTES, NULL) == EUCA_NOT_FOUND_ERROR);
+    CHECK(peer_server_set_peers(test_peers, 2) == EUCA_INVALID_ERROR);
+    CHECK(peer_get("127.0.0.1", port, "emi-0123abcd-4567ef89", path, TEST_BLOB_BYTES, NULL) == EUCA_NOT_FOUND_ERROR);
+    CHECK(peer_server_set_peers(test_peers + 1, 2) == EUCA_OK);
+
+    printf("a cached blob is fetched from the peer\n");
+    CHECK(peer_get("127.0.0.1", port, "emi-0123abcd-4567ef89", path, TEST_BLOB_BYTES, NULL) == EUCA_OK);
+    CHECK(test_file_matches(path));
+
+    printf("blobs the peer does not have, or has in another size, are not fetched\n");
+    CHECK(peer_get("127.0.0.1", port, "emi-00000000-00000000", path, TEST_BLOB_BYTES, NULL) == EUCA_NOT_FOUND_ERROR);
+    CHECK(peer_get("127.0.0.1", port, "emi-0123abcd-4567ef89", path, TEST_BLOB_BYTES + 512, NULL) == EUCA_NOT_FOUND_ERROR);
+    CHECK(peer_get("127.0.0.1", port, "..", path, TEST_BLOB_BYTES, NULL) == EUCA_NOT_FOUND_ERROR);
+    CHECK(peer_get("127.0.0.1", port, "emi-0123abcd-4567ef89", "/nonexistent/blocks", TEST_BLOB_BYTES, NULL) == EUCA_ACCESS_ERROR);
+
+    printf("a blob being created is served once its creator is done with it\n");
+    truncate(path, 0);
+    truncate(path, TEST_BLOB_BYTES);
+    if (pthread_create(&tid, NULL, test_hold, bs)) {
+        printf("failed to lock the test blob\n");
+        return (1);
+    }
+    for (started = time(NULL); !test_held && ((time(NULL) - started) < TEST_HOLD_SEC); )
+        usleep(10000);
+    started = time(NULL);
+    CHECK(peer_get("127.0.0.1", port, "emi-0123abcd-4567ef89", path, TEST_BLOB_BYTES, NULL) == EUCA_OK);
+    CHECK((time(NULL) - started) >= (TEST_HOLD_SEC - 1));
+    CHECK(test_file_matches(path));
+    pthread_join(tid, NULL);
+
+    printf("a copy that does not match the peer's digest is refused\n");
+    truncate(path, 0);
+    truncate(path, TEST_BLOB_BYTES);
+    if (((bb = blockblob_open(bs, "emi-0123abcd-4567ef89", 0, 0, NULL, 0)) == NULL) || ((fd = open(blockblob_get_file(bb), O_RDWR)) == -1)
+        || fstat(fd, &st) || (pwrite(fd, "X", 1, TEST_BLOB_BYTES / 2) != 1)) {
+        printf("failed to damage the test blob\n");
+        return (1);
+    }
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    futimens(fd, times);               // the server still has the digest of the undamaged blob
+    close(fd);
+    blockblob_close(bb);
+    CHECK(peer_get("127.0.0.1", port, "emi-0123abcd-4567ef89", path, TEST_BLOB_BYTES, NULL) == EUCA_ERROR);
+    CHECK(!test_file_matches(path));
+
+    printf("a stopped server serves no more\n");
+    peer_server_stop();
+    CHECK(peer_get("127.0.0.1", port, "emi-0123abcd-4567ef89", path, TEST_BLOB_BYTES, NULL) == EUCA_NOT_FOUND_ERROR);
+
+    blobstore_close(bs);
+    unlink(path);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", store);
+    if (system(cmd) != 0)
+        printf("failed to remove %s\n", store);
+    printf("errors=%d\n", errors);
+    return ((errors == 0) ? (0) : (1));
+
+#undef CHECK
+}
+#endif /* _UNIT_TEST */
@@ -89,6 +89,7 @@
 #include <limits.h>
 #include <assert.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl, ensure_...
@@ -99,9 +100,11 @@
 #include "vbr.h"
 #include "objectstorage.h"
 #include "blobstore.h"
+#include "blobstore-chunks.h"
 #include "diskutil.h"
 //#include "iscsi.h"
 #include "http.h"
+#include "peer.h"
 #include "ebs_utils.h"
 #include <ipc.h>
 
@@ -156,6 +159,19 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! One dependency to be built ahead of its parent by art_prefetch_deps()
+typedef struct _art_prefetch_job {
+    artifact *a;                       //!< the dependency
+    blobstore *work_bs;
+    blobstore *cache_bs;
+    const char *work_prefix;
+    long long timeout_usec;            //!< what remains of the parent's timeout, 0 for none
+    char corr_id[512];                 //!< correlation ID of the requesting thread, for logging, empty if none
+    boolean threaded;                  //!< TRUE if the job runs in a worker thread of its own
+    pthread_t thread;
+    int ret;                           //!< result of building the dependency
+} art_prefetch_job;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -200,6 +216,12 @@ static char vm_ids[TOTAL_VMS][PATH_MAX] = { {0} };
 static boolean do_fork = 0;
 #endif /* _UNIT_TEST */
 
+static pthread_mutex_t art_workers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int art_max_workers = ART_DEFAULT_WORKERS;   //!< worker threads all trees being implemented in this process may use together
+static int art_busy_workers = 0;       //!< worker threads currently running
+static boolean art_cache_dedup = FALSE;    //!< whether images created in the cache are deduplicated (see art_set_cache_dedup())
+static int art_peer_port = 0;          //!< image port of the peer NCs named in VBR hints, 0 to never fetch from peers (see art_set_peer_port())
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -220,6 +242,7 @@ static void update_vbr_with_backing_info(artifact * a);
 //!
 //! Creators return OK or an error code: either generic one (ERROR) or a code specific to a failed blobstore
 //! operation, which can be obtained using blobstore_get_error().
+static int art_get_from_peers(artifact * a, const char *dest_path);
 static int url_creator(artifact * a);
 static int objectstorage_creator(artifact * a);
 static int imaging_creator(artifact * a);
@@ -242,6 +265,13 @@ static artifact *art_alloc_disk(virtualBootRecord * vbr, artifact * prereqs[], i
                                 artifact * emi_disk, boolean do_make_work_copy, boolean is_migration_dest);
 static int find_or_create_blob(int flags, blobstore * bs, const char *id, long long size_bytes, const char *sig, blockblob ** bbp);
 static int find_or_create_artifact(int do_create, artifact * a, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, blockblob ** bbp);
+static boolean art_worker_reserve(void);
+static void art_worker_release(void);
+static boolean art_may_prefetch(const artifact * a);
+static void art_prefetch(art_prefetch_job * job);
+static void *art_prefetch_thread(void *arg);
+static void art_prefetch_deps(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec, int min_jobs,
+                              int rets[]);
 
 #ifdef _UNIT_TEST
 static blobstore *create_teststore(int size_blocks, const char *base, const char *name, blobstore_format_t format, blobstore_revocation_t revocation,
@@ -525,6 +555,13 @@ static int parse_rec(virtualBootRecord * vbr, virtualMachine * vm, ncMetadata *
         return (EUCA_ERROR);
     }
 
+    // set aside the peers hinted at by the CC, which are not part of the location proper
+    char peers[BIG_CHAR_BUFFER_SIZE] = "";
+    char *hint = strstr(vbr->resourceLocation, VBR_PEERS_HINT);
+    if (hint != NULL) {
+        euca_strncpy(peers, hint, sizeof(peers));
+        *hint = '\0';
+    }
     // identify the type of resource location from location string
     int error = EUCA_OK;
     if (strcasestr(vbr->resourceLocation, "http://") == vbr->resourceLocation || strcasestr(vbr->resourceLocation, "https://") == vbr->resourceLocation) {
@@ -576,6 +613,8 @@ static int parse_rec(virtualBootRecord * vbr, virtualMachine * vm, ncMetadata *
         LOGERROR("URL for resourceLocation '%s' is not in the message\n", vbr->resourceLocation);
         return (EUCA_ERROR);
     }
+    if ((peers[0] != '\0') && ((strlen(vbr->resourceLocation) + strlen(peers)) < sizeof(vbr->resourceLocation)))
+        strcat(vbr->resourceLocation, peers);   // for art_get_from_peers()
     // device can be 'none' only for kernel and ramdisk types
     if (!strcmp(vbr->guestDeviceName, "none")) {
         if (vbr->type != NC_RESOURCE_KERNEL && vbr->type != NC_RESOURCE_RAMDISK) {
@@ -1003,6 +1042,43 @@ static void update_vbr_with_backing_info(artifact * a)
     }
 }
 
+//!
+//! Fills a cached artifact from one of the peer NCs that the CC named in its
+//! VBR, which have the image in their cache or are getting it, so that an image
+//! launched on many nodes at once is downloaded from object storage only a few
+//! times. The artifact ID, which is derived from the image digest, identifies
+//! the same content on every node. A copy is only kept once peer_get() has
+//! checked it against the peer's digest of the blob; otherwise the next peer is
+//! tried and, when none is left, the artifact is downloaded from its source,
+//! which overwrites whatever a failed fetch left in dest_path.
+//!
+//! @param[in] a the artifact being created
+//! @param[in] dest_path where its content goes
+//!
+//! @return EUCA_OK if a peer supplied the content, or EUCA_NOT_FOUND_ERROR
+//!         if the artifact must be downloaded from its source
+//!
+static int art_get_from_peers(artifact * a, const char *dest_path)
+{
+    char *peer = NULL;
+    char *saveptr = NULL;
+    char *hint = NULL;
+    char peers[BIG_CHAR_BUFFER_SIZE] = "";
+
+    if ((art_peer_port <= 0) || !a->may_be_cached || (dest_path == NULL) || ((hint = strstr(a->vbr->resourceLocation, VBR_PEERS_HINT)) == NULL))
+        return (EUCA_NOT_FOUND_ERROR);
+
+    euca_strncpy(peers, hint + strlen(VBR_PEERS_HINT), sizeof(peers));
+    for (peer = strtok_r(peers, ",", &saveptr); peer != NULL; peer = strtok_r(NULL, ",", &saveptr)) {
+        if (peer_get(peer, art_peer_port, a->id, dest_path, a->bb->size_bytes, NULL) == EUCA_OK) {
+            LOGINFO("[%s] copied %s from peer %s\n", a->instanceId, a->id, peer);
+            return (EUCA_OK);
+        }
+    }
+    LOGDEBUG("[%s] no peer could supply %s\n", a->instanceId, a->id);
+    return (EUCA_NOT_FOUND_ERROR);
+}
+
 //!
 //!
 //!
@@ -1026,6 +1102,9 @@ static int url_creator(artifact * a)
         LOGINFO("[%s] skipping download of %s\n", a->instanceId, vbr->preparedResourceLocation);
         return (EUCA_OK);
     }
+    if (art_get_from_peers(a, dest_path) == EUCA_OK) {
+        return (EUCA_OK);
+    }
     LOGINFO("[%s] downloading %s\n", a->instanceId, vbr->preparedResourceLocation);
     if (http_get(vbr->preparedResourceLocation, dest_path, NULL) != EUCA_OK) {
         LOGERROR("[%s] failed to download component %s\n", a->instanceId, vbr->preparedResourceLocation);
@@ -1058,6 +1137,9 @@ static int objectstorage_creator(artifact * a)
         LOGINFO("[%s] skipping download of %s\n", a->instanceId, vbr->preparedResourceLocation);
         return (EUCA_OK);
     }
+    if (art_get_from_peers(a, dest_path) == EUCA_OK) {
+        return (EUCA_OK);
+    }
     LOGINFO("[%s] downloading %s\n", a->instanceId, vbr->preparedResourceLocation);
 
 #if !defined( _UNIT_TEST) && !defined(_NO_EBS)
@@ -1074,10 +1156,13 @@ static int objectstorage_creator(artifact * a)
         return (EUCA_ERROR);
     }
 #endif
-    if (objectstorage_image_by_manifest_url(vbr->preparedResourceLocation, dest_path, TRUE) != EUCA_OK) {
+    // stream the image straight into the blob rather than staging it elsewhere first
+    char digest[OBJECTSTORAGE_DIGEST_LEN] = "";
+    if (objectstorage_image_by_manifest_url_stream(vbr->preparedResourceLocation, dest_path, 0L, TRUE, digest) != EUCA_OK) {
         LOGERROR("[%s] failed to download component %s\n", a->instanceId, vbr->preparedResourceLocation);
         return (EUCA_ERROR);
     }
+    LOGDEBUG("[%s] downloaded %s (sha1 %s)\n", a->instanceId, vbr->preparedResourceLocation, digest);
 
     return (EUCA_OK);
 }
@@ -1628,9 +1713,10 @@ blockmap map[] = { {op, BLOBSTORE_BLOCKBLOB, {blob:dep->bb}
 }
 
 //!
-//! Functions for adding and freeing artifacts on a tree. Currently each artifact tree
-//! is used within a single thread (startup thread), so these do not need to be thread
-//! safe.
+//! Functions for adding and freeing artifacts on a tree. Each artifact tree is
+//! built and freed by a single thread (startup thread), so these do not need to
+//! be thread safe. While the tree is implemented, art_prefetch_deps() may hand
+//! disjoint subtrees to worker threads, but never one artifact to two threads.
 //!
 //! @param[in] a
 //! @param[in] dep
@@ -2531,6 +2617,56 @@ out:
     return root;
 }
 
+//!
+//! Creates a tree of cache-only artifacts for the downloadable images
+//! (EMI, EKI, ERI) in a VBR, so they can be brought into the cache ahead
+//! of a launch. No work copies are made and no other VBR types are
+//! included. The caller must free the tree.
+//!
+//! @param[in] vm pointer to virtual machine containing the VBR
+//! @param[in] bail_flag pointer to a flag that, once set, aborts downloads
+//!
+//! @return A pointer to the root of artifact tree or NULL on error or if
+//!         there is nothing in the VBR that can be prefetched
+//!
+//! @see vbr_alloc_tree()
+//!
+artifact *vbr_alloc_prefetch_tree(virtualMachine * vm, boolean * bail_flag)
+{
+    int total_arts = 0;
+    artifact *root = art_alloc("prefetch", NULL, -1, FALSE, FALSE, FALSE, NULL, NULL);  // allocate a sentinel artifact
+    if (root == NULL)
+        return NULL;
+
+    for (int i = 0; i < EUCA_MAX_VBRS && i < vm->virtualBootRecordLen; i++) {
+        virtualBootRecord *vbr = &(vm->virtualBootRecord[i]);
+        if (vbr->type != NC_RESOURCE_IMAGE && vbr->type != NC_RESOURCE_KERNEL && vbr->type != NC_RESOURCE_RAMDISK)
+            continue;
+        if (vbr->locationType != NC_LOCATION_URL && vbr->locationType != NC_LOCATION_OBJECT_STORAGE && vbr->locationType != NC_LOCATION_IMAGING)
+            continue;
+
+        // kernel and ramdisk must be files, exactly as in vbr_alloc_tree(), so that the cached blobs are the same
+        boolean must_be_file = (vbr->type != NC_RESOURCE_IMAGE);
+        artifact *dep = art_alloc_vbr(vbr, FALSE, FALSE, must_be_file, NULL, bail_flag);
+        if (dep == NULL)
+            goto free;
+        if (art_add_dep(root, dep) != EUCA_OK) {
+            ART_FREE(dep);
+            goto free;
+        }
+        total_arts++;
+    }
+
+    if (total_arts == 0)
+        goto free;
+    art_print_tree("", root);
+    return root;
+
+free:
+    ART_FREE(root);
+    return NULL;
+}
+
 //!
 //! Either opens a blockblob or creates it
 //!
@@ -2654,6 +2790,219 @@ try_work:
     return find_or_create_blob(flags, work_bs, id_work, size_bytes, a->sig, bbp);
 }
 
+//!
+//! Sets how many worker threads art_implement_tree() may use, in total across
+//! all trees being implemented by this process, to build independent
+//! dependencies concurrently
+//!
+//! @param[in] max_workers number of workers, 0 to build all dependencies one after another
+//!
+void art_set_max_workers(int max_workers)
+{
+    pthread_mutex_lock(&art_workers_mutex);
+    {
+        art_max_workers = (max_workers > 0) ? max_workers : 0;
+    }
+    pthread_mutex_unlock(&art_workers_mutex);
+    LOGINFO("artifact trees will be implemented with up to %d worker thread(s)\n", max_workers);
+}
+
+//!
+//! Sets whether images created in the cache blobstore are deduplicated, so
+//! that the chunks they have in common with other cached images, e.g., EMIs
+//! built from the same base, take up space only once
+//!
+//! @param[in] do_dedup TRUE to deduplicate cached images
+//!
+void art_set_cache_dedup(boolean do_dedup)
+{
+    art_cache_dedup = do_dedup;
+    LOGINFO("cached images will %sbe deduplicated\n", (do_dedup) ? ("") : ("not "));
+}
+
+//!
+//! Sets the port on which peer NCs serve their cached images, enabling the
+//! fetching of images from the peers that the CC names in VBRs
+//!
+//! @param[in] port the image port of the peers, 0 to always download from the source
+//!
+void art_set_peer_port(int port)
+{
+    art_peer_port = (port > 0) ? port : 0;
+    LOGINFO("images will %sbe fetched from peer nodes\n", (art_peer_port) ? ("") : ("not "));
+}
+
+//!
+//! Takes a worker thread slot, if one is free. Never waits, so that a thread
+//! that needs a worker can always do the work itself instead.
+//!
+//! @return TRUE if a slot was taken and must be given back with art_worker_release()
+//!
+static boolean art_worker_reserve(void)
+{
+    boolean reserved = FALSE;
+
+    pthread_mutex_lock(&art_workers_mutex);
+    {
+        if (art_busy_workers < art_max_workers) {
+            art_busy_workers++;
+            reserved = TRUE;
+        }
+    }
+    pthread_mutex_unlock(&art_workers_mutex);
+    return (reserved);
+}
+
+//!
+//! Gives back a slot taken with art_worker_reserve()
+//!
+static void art_worker_release(void)
+{
+    pthread_mutex_lock(&art_workers_mutex);
+    {
+        art_busy_workers--;
+    }
+    pthread_mutex_unlock(&art_workers_mutex);
+}
+
+//!
+//! Tells whether a dependency may be built ahead of its parent, in a thread
+//! other than the parent's
+//!
+//! @param[in] a the dependency
+//!
+//! @return TRUE if the dependency may be prefetched
+//!
+static boolean art_may_prefetch(const artifact * a)
+{
+    if (a->creator == NULL)            // sentinels are only ever roots
+        return (FALSE);
+    if (a->vbr && (a->vbr->type == NC_RESOURCE_EBS))    // attaching is not idempotent and is done in the parent's pass
+        return (FALSE);
+    if (a->refs > 1)                   // shared by several parents, so left to the serial pass to avoid building it twice at once
+        return (FALSE);
+    return (TRUE);
+}
+
+//!
+//! Builds one dependency ahead of its parent and closes its blob again, so
+//! that the parent's own pass over the dependencies, which opens and holds
+//! them for the creator in the parent's thread, finds them already built.
+//! Blob locks are always released by the thread that took them.
+//!
+//! A work copy made by copy_creator() is not built ahead, because when its
+//! source could not be cached the copy is bypassed and exists only while the
+//! parent holds it; its own dependencies are prefetched instead.
+//!
+//! @param[in] job the dependency and where to build it; job->ret receives the result
+//!
+static void art_prefetch(art_prefetch_job * job)
+{
+    artifact *a = job->a;
+    int rets[MAX_ARTIFACT_DEPS] = { 0 };
+
+    if (a->creator == copy_creator) {
+        art_prefetch_deps(a, job->work_bs, job->cache_bs, job->work_prefix, job->timeout_usec, 1, rets);
+        job->ret = EUCA_OK;
+        for (int i = 0; i < MAX_ARTIFACT_DEPS && a->deps[i]; i++) {
+            if (rets[i] != EUCA_OK)
+                job->ret = rets[i];
+        }
+        return;
+    }
+
+    LOGDEBUG("[%s] prefetching artifact %03d|%s\n", a->instanceId, a->seq, a->id);
+    if ((job->ret = art_implement_tree(a, job->work_bs, job->cache_bs, job->work_prefix, job->timeout_usec)) == EUCA_OK) {
+        if (a->bb && (blockblob_close(a->bb) == -1)) {
+            LOGERROR("[%s] failed to close prefetched artifact %s: %d %s (potential resource leak!)\n", a->instanceId, a->id, blobstore_get_error(),
+                     blobstore_get_last_msg());
+        }
+        a->bb = NULL;
+    }
+}
+
+//!
+//! Entry point of a worker thread started by art_prefetch_deps()
+//!
+//! @param[in] arg the art_prefetch_job to run
+//!
+//! @return NULL
+//!
+static void *art_prefetch_thread(void *arg)
+{
+    art_prefetch_job *job = ((art_prefetch_job *) arg);
+    threadCorrelationId *corr_id = NULL;
+
+    if (strlen(job->corr_id) > 0)
+        corr_id = set_corrid_pthread(job->corr_id, pthread_self());
+    art_prefetch(job);
+    unset_corrid(corr_id);
+    return (NULL);
+}
+
+//!
+//! Builds the dependencies of an artifact that may be built independently of
+//! each other, running as many of them concurrently as there are free worker
+//! slots and the rest in the calling thread, and waits for all of them.
+//!
+//! @param[in]  root the artifact whose dependencies to build
+//! @param[in]  work_bs pointer to work blobstore
+//! @param[in]  cache_bs pointer to OPTIONAL cache blobstore
+//! @param[in]  work_prefix OPTIONAL instance-specific prefix for forming work blob IDs
+//! @param[in]  timeout_usec timeout for building the dependencies, in microseconds or 0 for no timeout
+//! @param[in]  min_jobs do nothing unless at least this many dependencies may be prefetched
+//! @param[out] rets result for each of root->deps[], EUCA_OK for those that were not prefetched
+//!
+static void art_prefetch_deps(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec, int min_jobs,
+                              int rets[])
+{
+    int num_jobs = 0;
+    int deps_index[MAX_ARTIFACT_DEPS] = { 0 };
+    art_prefetch_job jobs[MAX_ARTIFACT_DEPS] = { {0} };
+    threadCorrelationId *corr_id = get_corrid();
+
+    for (int i = 0; i < MAX_ARTIFACT_DEPS && root->deps[i]; i++) {
+        rets[i] = EUCA_OK;
+        if (!art_may_prefetch(root->deps[i]))
+            continue;
+        jobs[num_jobs].a = root->deps[i];
+        jobs[num_jobs].work_bs = work_bs;
+        jobs[num_jobs].cache_bs = cache_bs;
+        jobs[num_jobs].work_prefix = work_prefix;
+        jobs[num_jobs].timeout_usec = timeout_usec;
+        if (corr_id)
+            euca_strncpy(jobs[num_jobs].corr_id, corr_id->correlation_id, sizeof(jobs[num_jobs].corr_id));
+        deps_index[num_jobs++] = i;
+    }
+    if ((num_jobs == 0) || (num_jobs < min_jobs))
+        return;
+
+    // the first dependency is always built by this thread, which would otherwise just wait
+    for (int j = 1; j < num_jobs; j++) {
+        if (!art_worker_reserve())
+            break;                     // the pool is busy, so this thread will do the rest
+        if (pthread_create(&(jobs[j].thread), NULL, art_prefetch_thread, &(jobs[j])) != 0) {
+            LOGWARN("[%s] failed to start a worker thread for artifact %s, building it in this thread\n", root->instanceId, jobs[j].a->id);
+            art_worker_release();
+            break;
+        }
+        jobs[j].threaded = TRUE;
+    }
+
+    for (int j = 0; j < num_jobs; j++) {
+        if (!jobs[j].threaded)
+            art_prefetch(&(jobs[j]));
+    }
+
+    for (int j = 0; j < num_jobs; j++) {
+        if (jobs[j].threaded) {
+            pthread_join(jobs[j].thread, NULL);
+            art_worker_release();
+        }
+        rets[deps_index[j]] = jobs[j].ret;
+    }
+}
+
 //!
 //! Traverse artifact tree and create/download/combine artifacts
 //!
@@ -2671,6 +3020,12 @@ try_work:
 //!
 //! Either way, none of the child blobs are open.
 //!
+//! Before the dependencies are opened one after another for the creator, those
+//! that may be built independently are built concurrently by art_prefetch_deps(),
+//! so that a cold launch waits for its slowest download rather than for all of
+//! them in turn. The prefetched blobs are closed again, and the serial pass that
+//! follows reopens them with the usual locking.
+//!
 //! @param[in] root pointer to root of the tree
 //! @param[in] work_bs pointero to work blobstore
 //! @param[in] cache_bs pointer to OPTIONAL cache blobstore
@@ -2694,6 +3049,7 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
     int tries = 0;
     do {                               // we may have to retry multiple times due to competition
         int num_opened_deps = 0;
+        int prefetch_rets[MAX_ARTIFACT_DEPS] = { 0 };
         boolean do_deps = TRUE;
         boolean do_create = TRUE;
 
@@ -2732,7 +3088,26 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
         // (though it could be created before we get around to that)
 
         if (do_deps) {                 // recursively go over dependencies, if any
+            if (tries == 1) {          // build independent dependencies concurrently, unless we are retrying after competition
+                long long prefetch_timeout_usec = timeout_usec;
+                if (timeout_usec > 0)
+                    prefetch_timeout_usec -= time_usec() - started;
+                if ((timeout_usec == 0) || (prefetch_timeout_usec > 0))
+                    art_prefetch_deps(root, work_bs, cache_bs, work_prefix, prefetch_timeout_usec, 2, prefetch_rets);
+            }
+
             for (int i = 0; i < MAX_ARTIFACT_DEPS && root->deps[i]; i++) {
+                switch (prefetch_rets[i]) {
+                case BLOBSTORE_ERROR_OK:
+                case BLOBSTORE_ERROR_AGAIN:    // the serial pass will compete for it again
+                case BLOBSTORE_ERROR_MFILE:
+                    break;
+                default:              // the dependency could not be built, so do not try building it again
+                    ret = prefetch_rets[i];
+                    LOGERROR("[%s] failed to provision dependency %s for artifact %s (error=%d) on try %d\n", root->instanceId, root->deps[i]->id, root->id, ret,
+                             tries);
+                    goto retry_or_fail;
+                }
 
                 // recalculate the time that remains in the timeout period
                 long long new_timeout_usec = timeout_usec;
@@ -2825,6 +3200,13 @@ create:
                     }
                 }
             } else {
+                if (art_cache_dedup && root->is_in_cache && !root->must_be_file && !root->id_is_path
+                    && (blockblob_get_size_bytes(root->bb) >= BLOBSTORE_CHUNK_SIZE)) {
+                    // a failure leaves the blob as it was, so the artifact remains usable
+                    if (blockblob_dedup(root->bb, FIND_BLOB_TIMEOUT_USEC) == -1) {
+                        LOGWARN("[%s] failed to deduplicate cached artifact %s: %d %s\n", root->instanceId, root->id, blobstore_get_error(), blobstore_get_last_msg());
+                    }
+                }
                 if (root->vbr && root->vbr->type != NC_RESOURCE_EBS)
                     if (work_bs && blockblob_get_blobstore(root->bb) == work_bs)
                         update_vbr_with_backing_info(root);
@@ -91,6 +91,7 @@
 #define MAX_ARTIFACT_DEPS                            16
 #define MAX_ARTIFACT_SIG                         262144
 #define MAX_SSHKEY_SIZE                          262144
+#define ART_DEFAULT_WORKERS                           4 //!< default number of threads that may build artifacts concurrently (see art_set_max_workers())
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -176,8 +177,12 @@ artifact *art_alloc(const char *id, const char *sig, long long size_bytes, boole
                     int (*creator) (artifact * a), virtualBootRecord * vbr);
 
 void art_set_instanceId(const char *instanceId);
+void art_set_max_workers(int max_workers);
+void art_set_cache_dedup(boolean do_dedup);
+void art_set_peer_port(int port);
 artifact *vbr_alloc_tree(virtualMachine * vm, boolean do_make_work_copy, boolean is_migration_dest, const char *sshkey, boolean * bail_flag,
                          const char *instanceId);
+artifact *vbr_alloc_prefetch_tree(virtualMachine * vm, boolean * bail_flag);
 int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec);
 
 /*----------------------------------------------------------------------------*\
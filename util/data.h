@@ -104,6 +104,7 @@
 
 #define KEY_STRING_SIZE                          4096   //! Buffer to hold RSA pub/private keys
 #define INSTANCE_ID_LEN                            11   //! Length of the instance ID string (i-xxxxxxxx\0)
+#define IMAGE_ID_LEN                               13   //! Length of the image ID string (emi-xxxxxxxx\0)
 #define INTERFACE_ID_LEN                           13   //! Length of the instance ID string (eni-xxxxxxxx\0)
 #define SECURITY_GROUP_ID_LEN                      12   //! Length of the instance ID string (sg-xxxxxxxx\0)
 #define NETWORK_ACL_ID_LEN                         13   //! Length of the instance ID string (acl-xxxxxxxx\0)
@@ -275,6 +276,14 @@ typedef struct ncMetadata_t {
     char *replyString;                 //!< If set, can be used to propagate error messages from handlers to marshalling code (and to the user)
 } ncMetadata;
 
+//! Fragment the CC appends to the resourceLocation of an image VBR to name NCs
+//! that have, or are getting, the image in their cache, e.g., "#peers=10.1.1.2,10.1.1.3"
+#define VBR_PEERS_HINT                           "#peers="
+
+//! Start of the datagram an NC sends to the CC's CC_PUSH_PORT when its instances change,
+//! followed by the name of the node as the cloud knows it, e.g., "EUCA-NC-PUSH 10.1.1.2"
+#define NC_PUSH_HEADER                           "EUCA-NC-PUSH "
+
 //! Structure defining the virtual boot record
 typedef struct virtualBootRecord_t {
     //! @{
@@ -466,6 +475,11 @@ typedef struct ncInstance_t {
     //! @name updated by NC upon Attach/Detach ENI in VPC mode
     netConfig secNetCfgs[EUCA_MAX_NICS]; //!< Instance's attached secondary ENIs
     //! @}
+
+    //! @{
+    //! @name maintained by NC in memory only, for delta DescribeInstances
+    long long generation;              //!< NC instance-list generation at which this instance last changed
+    //! @}
 } ncInstance;
 
 //! Structure defining NC resource information
@@ -481,6 +495,8 @@ typedef struct ncResource_t {
     int numberOfCoresAvailable;        //!< Currently available number of core on this node controller
     char publicSubnets[CHAR_BUFFER_SIZE];   //!< Public subnet configured on this node controller
     char hypervisor[CHAR_BUFFER_SIZE]; //!< Node hypervisor
+    char cachedImages[EUCA_MAX_CACHED_IMAGES][IMAGE_ID_LEN];    //!< IDs of the images held in this node's cache
+    int cachedImagesLen;               //!< Number of valid entries in cachedImages
 } ncResource;
 
 //! Instance list node structure
@@ -215,6 +215,13 @@
 #define CONFIG_HYPERVISOR                       "HYPERVISOR"
 #define CONFIG_NC_CACHE_SIZE                    "NC_CACHE_SIZE"
 #define CONFIG_NC_WORK_SIZE                     "NC_WORK_SIZE"
+#define CONFIG_NC_CACHE_HIGH_WATERMARK          "NC_CACHE_HIGH_WATERMARK"
+#define CONFIG_NC_CACHE_LOW_WATERMARK           "NC_CACHE_LOW_WATERMARK"
+#define CONFIG_NC_ARTIFACT_WORKERS              "NC_ARTIFACT_WORKERS"
+#define CONFIG_NC_CACHE_DEDUP                   "NC_CACHE_DEDUP"
+#define CONFIG_NC_DOWNLOAD_CONNECTIONS          "NC_DOWNLOAD_CONNECTIONS"
+#define CONFIG_NC_PEER_PORT                     "NC_PEER_PORT"
+#define CONFIG_CC_PUSH_PORT                     "CC_PUSH_PORT"
 #define CONFIG_NC_OVERHEAD_SIZE                 "NC_WORK_OVERHEAD_SIZE"
 #define CONFIG_NC_SWAP_SIZE                     "SWAP_SIZE"
 #define CONFIG_SAVE_INSTANCES                   "MANUAL_INSTANCES_CLEANUP"
@@ -261,6 +268,7 @@
 #define EUCA_MAX_GROUPS                                64
 #define EUCA_MAX_VOLUMES                               27
 #define EUCA_MAX_VBRS                                  64   //!< Number of Virtual Boot Record supported
+#define EUCA_MAX_CACHED_IMAGES                         32   //!< Number of cached images a node reports in its resources
 #define EUCA_MAX_PATH                                4096
 #define EUCA_MAX_PARTITIONS                            32   //!< partitions per disk
 #define EUCA_MAX_DISKS                                 26   //!< disks per bus: sd[a-z]
@@ -0,0 +1,298 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/stats/reclaim_sensor.c
+//! Blobstore reclamation sensor. The counters are kept by the reclaimers
+//! themselves and fetched through a component-specific callback
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+#include "reclaim_sensor.h"
+#include "sensor_common.h"
+#include <eucalyptus.h>
+#include <euca_string.h>
+#include <string.h>
+#include <log.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+static int sensor_data_ttl;
+static char interval_tag[SENSOR_TAG_MAX];
+static int (*reclaim_stats_fn)(reclaim_sensor_stats_t * stats, int max_stats);  //!< Pointer to function to get and reset the counters
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+static json_object *build_store_values(const reclaim_sensor_stats_t * stats);
+
+#ifdef _UNIT_TEST
+static int test_reclaim_stats(reclaim_sensor_stats_t * stats, int max_stats);
+static int test_reclaim_sensor_call();
+#endif
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Converts the counters of one store into the json values of the sensor,
+//! in MB and milliseconds, with the purge throughput of the reclaimer
+static json_object *build_store_values(const reclaim_sensor_stats_t * stats)
+{
+    json_object *values = json_object_new_object();
+    double throughput = 0.0;
+
+    if (stats->purge_usec > 0) {
+        throughput = ((double)stats->purged_bytes / MEGABYTE) / ((double)stats->purge_usec / 1000000.0);
+    }
+
+    json_object_object_add(values, RECLAIM_USED_PCT_KEY, json_object_new_int((stats->limit_bytes > 0) ? ((int)((stats->used_bytes * 100) / stats->limit_bytes)) : (0)));
+    json_object_object_add(values, RECLAIM_PURGED_MB_KEY, json_object_new_int64(stats->purged_bytes / MEGABYTE));
+    json_object_object_add(values, RECLAIM_PURGE_MS_KEY, json_object_new_int64(stats->purge_usec / 1000));
+    json_object_object_add(values, RECLAIM_THROUGHPUT_KEY, json_object_new_double(throughput));
+    json_object_object_add(values, RECLAIM_PASSES_KEY, json_object_new_int64(stats->purge_passes));
+    json_object_object_add(values, RECLAIM_INLINE_COUNT_KEY, json_object_new_int64(stats->inline_purges));
+    json_object_object_add(values, RECLAIM_INLINE_MB_KEY, json_object_new_int64(stats->inline_bytes / MEGABYTE));
+    json_object_object_add(values, RECLAIM_INLINE_MS_KEY, json_object_new_int64(stats->inline_usec / 1000));
+    json_object_object_add(values, RECLAIM_MAX_LAG_MS_KEY, json_object_new_int64(stats->max_lag_usec / 1000));
+    json_object_object_add(values, RECLAIM_LAG_MS_KEY, json_object_new_int64(stats->lag_usec / 1000));
+    return values;
+}
+
+//! Entry point for the reclaim sensor. Gets the counters of each store from
+//! the component and resets them, so that each output covers one interval.
+json_object *reclaim_sensor_call()
+{
+    int count = 0;
+    json_object *store_data = NULL;
+    json_object *event_json = NULL;
+    reclaim_sensor_stats_t stats[MAX_RECLAIM_SENSOR_STORES];
+
+    if (reclaim_stats_fn == NULL) {
+        LOGERROR("Cannot complete reclaim sensor operation, no stats function available\n");
+        return NULL;
+    }
+
+    bzero(stats, sizeof(stats));
+    if ((count = reclaim_stats_fn(stats, MAX_RECLAIM_SENSOR_STORES)) < 0) {
+        LOGERROR("Cannot get blobstore reclamation stats\n");
+        return NULL;
+    }
+
+    store_data = json_object_new_object();
+    for (int i = 0; (i < count) && (i < MAX_RECLAIM_SENSOR_STORES); i++) {
+        json_object_object_add(store_data, stats[i].store_name, build_store_values(&stats[i]));
+    }
+
+    event_json = build_sensor_output(reclaim_sensor.sensor_name, RECLAIM_SENSOR_DESCRIPTION, time(NULL), sensor_data_ttl, build_tag_set(1, interval_tag), store_data);
+    if (event_json == NULL) {
+        json_object_put(store_data);
+        LOGERROR("Failed in reclaim stats output generation.\n");
+        return NULL;
+    }
+
+    return event_json;
+}
+
+//! Initialize the reclaim sensor for the component. Not threadsafe.
+int initialize_reclaim_sensor(const char *current_component_name, int interval, int ttl, int (*stats_call)(reclaim_sensor_stats_t * stats, int max_stats))
+{
+    if (current_component_name == NULL || interval < 1 || ttl < 0 || stats_call == NULL) {
+        LOGERROR("Invalid initialization values for reclaim sensor. Cannot initialize\n");
+        return EUCA_INVALID_ERROR;
+    }
+
+    LOGINFO("Initializing reclaim sensor for component %s\n", current_component_name);
+    euca_strncpy(reclaim_sensor.config_name, RECLAIM_SENSOR_CONFIG_NAME, SENSOR_NAME_MAX);
+    snprintf(reclaim_sensor.sensor_name, SENSOR_NAME_MAX, RECLAIM_SENSOR_NAME_FORMAT, current_component_name);
+    reclaim_sensor.enabled = 0;
+    reclaim_sensor.sensor_function = reclaim_sensor_call;
+    reclaim_sensor.state_toggle_callback = NULL;
+
+    reclaim_stats_fn = stats_call;
+    sensor_data_ttl = ttl;
+    snprintf(interval_tag, SENSOR_TAG_MAX, SENSOR_INTERVAL_PERIOD_TAG_FORMAT, interval);
+
+    return EUCA_OK;
+}
+
+int teardown_reclaim_sensor()
+{
+    bzero(&reclaim_sensor, sizeof(reclaim_sensor));
+    reclaim_stats_fn = NULL;
+    return EUCA_OK;
+}
+
+#ifdef _UNIT_TEST
+
+static int test_reclaim_stats(reclaim_sensor_stats_t * stats, int max_stats)
+{
+    euca_strncpy(stats[0].store_name, "cache", SENSOR_NAME_MAX);
+    stats[0].limit_bytes = 100LL * MEGABYTE;
+    stats[0].used_bytes = 80LL * MEGABYTE;
+    stats[0].purged_bytes = 30LL * MEGABYTE;
+    stats[0].purge_usec = 1500000;
+    stats[0].purge_passes = 2;
+    stats[0].max_lag_usec = 2500000;
+    return 1;
+}
+
+static int test_reclaim_sensor_call()
+{
+    json_object *event = NULL;
+    json_object *values = NULL;
+    json_object *cache = NULL;
+    json_object *throughput = NULL;
+
+    initialize_reclaim_sensor("nc", 60, 61, test_reclaim_stats);
+    if ((event = reclaim_sensor_call()) == NULL) {
+        return 1;
+    }
+    LOGINFO("Result map: %s\n", json_object_to_json_string_ext(event, JSON_C_TO_STRING_PRETTY));
+
+    if (!json_object_object_get_ex(event, SENSOR_VALUES_KEY, &values) || !json_object_object_get_ex(values, "cache", &cache)
+        || !json_object_object_get_ex(cache, RECLAIM_THROUGHPUT_KEY, &throughput) || (json_object_get_double(throughput) != 20.0)) {
+        json_object_put(event);
+        return 1;
+    }
+    json_object_put(event);
+    teardown_reclaim_sensor();
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int count, success, failure;
+    count = 0;
+    success = 0;
+    failure = 0;
+
+    if (test_reclaim_sensor_call() == 0) {
+        LOGINFO("Success!\n");
+        success++;
+    } else {
+        LOGINFO("Failed\n");
+        failure++;
+    }
+    count++;
+
+    LOGINFO("Tests: %d, Success: %d, Failure: %d\n", count, success, failure);
+    return failure;
+}
+#endif
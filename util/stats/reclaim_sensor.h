@@ -0,0 +1,175 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+#ifndef _INCLUDE_UTIL_STATS_RECLAIM_SENSOR_H_
+#define _INCLUDE_UTIL_STATS_RECLAIM_SENSOR_H_
+
+//!
+//! @file util/stats/reclaim_sensor.h
+//! Header for the cache reclamation sensor, which reports how fast the
+//! background reclaimers purge the blobstores and how far behind they fall
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+#include "sensor_common.h"
+#include <json/json.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+#define RECLAIM_SENSOR_CONFIG_NAME "reclaim"
+#define RECLAIM_SENSOR_NAME_FORMAT "euca.components.%s.storage.reclaim"
+#define RECLAIM_SENSOR_DESCRIPTION "Blobstore reclamation throughput and lag over last interval"
+#define RECLAIM_USED_PCT_KEY "used_pct"
+#define RECLAIM_PURGED_MB_KEY "purged_mb"
+#define RECLAIM_PURGE_MS_KEY "purge_ms"
+#define RECLAIM_THROUGHPUT_KEY "purge_mb_per_sec"
+#define RECLAIM_PASSES_KEY "purge_passes"
+#define RECLAIM_INLINE_COUNT_KEY "inline_purges"
+#define RECLAIM_INLINE_MB_KEY "inline_purged_mb"
+#define RECLAIM_INLINE_MS_KEY "inline_purge_ms"
+#define RECLAIM_MAX_LAG_MS_KEY "max_lag_ms"
+#define RECLAIM_LAG_MS_KEY "lag_ms"
+#define MAX_RECLAIM_SENSOR_STORES 4
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Reclamation counters of one store, as filled in by the component's stats callback
+typedef struct {
+    char store_name[SENSOR_NAME_MAX];  //!< name of the store in the output (e.g. "cache")
+    long long limit_bytes;             //!< size of the store
+    long long used_bytes;              //!< space in use as of the last look at the store
+    long long purged_bytes;            //!< space freed by the background reclaimer
+    long long purge_usec;              //!< time the background reclaimer spent purging
+    long long purge_passes;            //!< number of purge batches the background reclaimer ran
+    long long inline_purges;           //!< number of launches that had to purge the store themselves
+    long long inline_bytes;            //!< space freed by those launches
+    long long inline_usec;             //!< time those launches spent purging
+    long long max_lag_usec;            //!< longest time the store stayed above its high watermark
+    long long lag_usec;                //!< time the store has currently been above its high watermark
+} reclaim_sensor_stats_t;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED PROTOTYPES                            |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Initialize the reclaim sensor. The callback fills in the counters of up to
+//! MAX_RECLAIM_SENSOR_STORES stores, resetting them for the next interval, and
+//! returns how many it filled in or -1 on error. Not threadsafe.
+int initialize_reclaim_sensor(const char *current_component_name, int interval, int ttl, int (*stats_call)(reclaim_sensor_stats_t * stats, int max_stats));
+int teardown_reclaim_sensor();
+json_object *reclaim_sensor_call();
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+//! Reclamation sensor
+struct internal_sensor reclaim_sensor;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                           STATIC INLINE PROTOTYPES                         |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                          STATIC INLINE IMPLEMENTATION                      |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#endif /* ! _INCLUDE_UTIL_STATS_RECLAIM_SENSOR_H_ */
@@ -86,6 +86,7 @@
 #include "message_sensor.h"
 #include "message_stats.h"
 #include "service_sensor.h"
+#include "reclaim_sensor.h"
 #include "fs_emitter.h"
 
 /*----------------------------------------------------------------------------*\
@@ -121,6 +122,7 @@
 \*----------------------------------------------------------------------------*/
 extern struct internal_sensor message_sensor; //from message_sensor.h
 extern struct internal_sensor service_state_sensor; //from service_sensor.h
+extern struct internal_sensor reclaim_sensor; //from reclaim_sensor.h
 
 /* Should preferably be handled in header file */
 
@@ -330,6 +332,14 @@ static int register_sensor_set() {
         LOGERROR("Error registering service state sensor\n");
     }
 
+    //Only components with blobstore reclaimers (the NC) initialize this one
+    if(strlen(reclaim_sensor.config_name) > 0) {
+        LOGDEBUG("Registering reclaim sensor\n");
+        if(result += register_sensor(&reclaim_sensor) > 0) {
+            LOGERROR("Error registering reclaim sensor\n");
+        }
+    }
+
     return result;
 }
 